@@ -390,6 +390,7 @@ class ProtoFieldParser:
             w.Write("size_t %s_size() const;" % (name))
         else:
             w.Write("bool has_%s() const;" % (name))
+            w.Write("void clear_%s();" % (name))
             if self.type.IsMessage():
                 w.Write("const %s& %s() const;" % (cpp_type, name))
                 w.Write("%s* mutable_%s();" % (cpp_type, name))
@@ -433,6 +434,13 @@ class ProtoFieldParser:
         else:
             w.Write("inline bool %s::has_%s() const { return has_%s_; }" %
                     (class_name, name, name))
+            # Assigning a new value rather than {} releases string storage.
+            w.Write("inline void %s::clear_%s() {" % (class_name, name))
+            w.Indent()
+            w.Write("has_%s_ = false;" % name)
+            w.Write("%s_ = %s();" % (name, var_cpp_type))
+            w.Unindent()
+            w.Write("}")
             if self.type.IsMessage():
                 w.Write("inline const %s& %s::%s() const { return %s_; }" %
                         (cpp_type, class_name, name, name))
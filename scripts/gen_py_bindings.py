@@ -30,7 +30,7 @@ from pybind.writer import Writer
 from pybind import Module, Class
 from pybind.parameters import (StringParameter, ClassParameter,
                                NumericParameter, ArgvObjects, IntegralArgv,
-                               ListOfStringsParameter)
+                               ListOfStringsParameter, BufferParameter)
 from pybind.retval import (StringViewRetVal, StringRetVal, ListOfStringsRetVal,
                            NumericRetVal, ObjCopyRetval, ObjOwnerRetval,
                            ObjTupleRetVal, IntegralTupleRetVal)
@@ -39,6 +39,7 @@ from pybind.exceptions import CppException
 # Module
 mod = Module('backends')
 mod.AddInclude('python/weights.h')
+mod.AddInclude('python/search.h')
 mod.AddInitialization('lczero::InitializeMagicBitboards();')
 ex = mod.AddException(
     CppException('LczeroException', cpp_name='lczero::Exception'))
@@ -84,6 +85,15 @@ output.AddMethod('p_raw').AddParameter(IntegralArgv('samples', 'i')).AddRetVal(
 output.AddMethod('p_softmax').AddParameter(IntegralArgv(
     'samples', 'i')).AddRetVal(IntegralTupleRetVal('f32')).AddEx(ex)
 
+# Evaluation future class
+evaluation_future = mod.AddClass(
+    Class('EvaluationFuture',
+          cpp_name='lczero::python::EvaluationFuture',
+          disable_constructor=True))
+evaluation_future.AddMethod('done').AddRetVal(NumericRetVal('bool'))
+evaluation_future.AddMethod('result', release_gil=True).AddRetVal(
+    ObjTupleRetVal(output)).AddEx(ex)
+
 # Backend capabilities class
 backend_caps = mod.AddClass(
     Class('BackendCapabilities',
@@ -101,6 +111,15 @@ backend.constructor.AddParameter(
     StringParameter('options', optional=True, can_be_none=True)).AddEx(ex)
 backend.AddMethod('evaluate').AddParameter(ArgvObjects(
     'inputs', input)).AddRetVal(ObjTupleRetVal(output)).AddEx(ex)
+backend.AddMethod('evaluate_async').AddParameter(ArgvObjects(
+    'inputs', input)).AddRetVal(ObjOwnerRetval(evaluation_future)).AddEx(ex)
+backend.AddMethod('evaluate_into', release_gil=True).AddParameter(
+    BufferParameter('masks', type='u64'),
+    BufferParameter('values', type='f32'),
+    BufferParameter('q', writable=True),
+    BufferParameter('d', writable=True),
+    BufferParameter('m', writable=True),
+    BufferParameter('policy', writable=True)).AddEx(ex)
 backend.AddMethod('capabilities').AddRetVal(ObjCopyRetval(backend_caps))
 
 # PositionHistory class
@@ -117,6 +136,28 @@ game_state.AddMethod('moves').AddRetVal(ListOfStringsRetVal())
 game_state.AddMethod('policy_indices').AddRetVal(IntegralTupleRetVal('i'))
 game_state.AddMethod('as_string').AddRetVal(StringRetVal())
 
+# Search result class
+search_result = mod.AddClass(
+    Class('SearchResult',
+          cpp_name='lczero::python::SearchResult',
+          disable_constructor=True))
+search_result.AddMethod('nodes').AddRetVal(NumericRetVal('i'))
+search_result.AddMethod('best_move').AddRetVal(StringRetVal())
+search_result.AddMethod('moves').AddRetVal(ListOfStringsRetVal())
+search_result.AddMethod('n').AddRetVal(IntegralTupleRetVal('i'))
+search_result.AddMethod('q').AddRetVal(IntegralTupleRetVal('f32'))
+search_result.AddMethod('p').AddRetVal(IntegralTupleRetVal('f32'))
+
+# Searcher class
+searcher = mod.AddClass(
+    Class('Searcher', cpp_name='lczero::python::Searcher'))
+searcher.constructor.AddParameter(
+    ClassParameter(backend, 'backend'), NumericParameter('visits'),
+    StringParameter('options', optional=True, can_be_none=True)).AddEx(ex)
+searcher.AddMethod('search', release_gil=True).AddParameter(
+    ArgvObjects('games', game_state)).AddRetVal(
+        ObjTupleRetVal(search_result)).AddEx(ex)
+
 with open(sys.argv[1], 'wt') as f:
     writer = Writer(f)
     mod.Generate(writer)
\ No newline at end of file
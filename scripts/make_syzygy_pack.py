@@ -0,0 +1,44 @@
+#!/usr/bin/env python3
+"""Packs Syzygy table files into one .tbpack file for SyzygyPath.
+
+The pack is read into memory in full when lc0 loads it, so that probes never
+wait on storage. Usage: make_syzygy_pack.py OUTPUT.tbpack DIRECTORY...
+"""
+
+import os
+import shutil
+import struct
+import sys
+
+SUFFIXES = ('.rtbw', '.rtbz')
+
+
+def align(offset):
+    return (offset + 63) // 64 * 64
+
+
+def main(output, directories):
+    tables = []
+    for directory in directories:
+        for name in sorted(os.listdir(directory)):
+            if name.endswith(SUFFIXES):
+                tables.append((name, os.path.join(directory, name)))
+    offset = align(16 + 32 * len(tables))
+    index = [b'TBPACK01', struct.pack('<II', len(tables), 0)]
+    for name, path in tables:
+        size = os.path.getsize(path)
+        index.append(struct.pack('<16sQQ', name.encode(), offset, size))
+        offset = align(offset + size)
+    with open(output, 'wb') as out:
+        out.write(b''.join(index))
+        for name, path in tables:
+            out.write(b'\0' * (align(out.tell()) - out.tell()))
+            with open(path, 'rb') as table:
+                shutil.copyfileobj(table, out)
+    print('Packed %d tables into %s' % (len(tables), output))
+
+
+if __name__ == '__main__':
+    if len(sys.argv) < 3:
+        sys.exit(__doc__)
+    main(sys.argv[1], sys.argv[2:])
@@ -208,12 +208,29 @@ class Function(PyObject):
 
 
 class MemberFunction(Function):
-    def __init__(self, name, *args, cpp_name=None, **kwargs):
+    def __init__(self, name, *args, cpp_name=None, release_gil=False,
+                 **kwargs):
         self.cpp_name = cpp_name or name
+        self.release_gil = release_gil
         super().__init__(name, *args, **kwargs)
 
     def _generate_call(self, w):
-        if isinstance(self.retval, NoneRetVal):
+        if self.release_gil:
+            # Other Python threads run meanwhile. The GIL is taken back even
+            # if the call throws, and before the result is converted.
+            w.Write('std::unique_ptr<PyThreadState, '
+                    'decltype(&PyEval_RestoreThread)>')
+            w.Write('    thread_state(PyEval_SaveThread(), '
+                    'PyEval_RestoreThread);')
+            if isinstance(self.retval, NoneRetVal):
+                w.Write(f'self->value->{self.cpp_name}'
+                        f'({self._list_caller_params()});')
+            else:
+                w.Write(f'{self.retval.cpp_type()} '
+                        f'{self.retval.cpp_val()} = self->value->'
+                        f'{self.cpp_name}({self._list_caller_params()});')
+            w.Write('thread_state.reset();')
+        elif isinstance(self.retval, NoneRetVal):
             w.Write(
                 f'self->value->{self.cpp_name}({self._list_caller_params()});')
         else:
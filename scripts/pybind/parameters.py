@@ -153,6 +153,69 @@ class NumericParameter(Parameter):
         pass
 
 
+class BufferParameter(Parameter):
+    '''C-contiguous object supporting the buffer protocol, e.g. a NumPy array,
+    passed to C++ as lczero::python::ArrayView without copying.'''
+    def __init__(self, *args, type='f32', writable=False, **kwargs):
+        self.type = type
+        self.writable = writable
+        super().__init__(*args, **kwargs)
+
+    def item_cpp_type(self):
+        return {
+            'u64': 'uint64_t',
+            'f32': 'float',
+        }[self.type]
+
+    def item_formats(self):
+        # Formats of the struct module, which NumPy uses in buffers.
+        return {
+            'u64': ['Q', 'L', 'K'],
+            'f32': ['f'],
+        }[self.type]
+
+    def GenerateParseTupleSinkDeclaration(self, w):
+        w.Write(f'PyObject* {self.name} = nullptr;')
+
+    def parse_tuple_format(self):
+        return 'O'
+
+    def parse_tuple_sink_list(self):
+        return [f'&{self.name}']
+
+    def GenerateCppParamInitialization(self, w, func):
+        flags = 'PyBUF_C_CONTIGUOUS | PyBUF_FORMAT'
+        if self.writable:
+            flags += ' | PyBUF_WRITABLE'
+        w.Write(f'Py_buffer {self.name}_buffer;')
+        w.Open(f'if (PyObject_GetBuffer({self.name}, &{self.name}_buffer, '
+               f'{flags}) < 0) {{')
+        w.Write(f'return {func._failure()};')
+        w.Close('}')
+        w.Write(f'std::unique_ptr<Py_buffer, decltype(&PyBuffer_Release)> '
+                f'{self.name}_release(&{self.name}_buffer, PyBuffer_Release);')
+        format_checks = ' || '.join([
+            f'std::string_view({self.name}_buffer.format) == "{x}"'
+            for x in self.item_formats()
+        ])
+        w.Open(f'if ({self.name}_buffer.itemsize != '
+               f'sizeof({self.item_cpp_type()}) || !({format_checks})) {{')
+        w.Write(f'PyErr_SetString(PyExc_TypeError, "{self.name}: array of '
+                f'{self.type} expected.");')
+        w.Write(f'return {func._failure()};')
+        w.Close('}')
+        const = '' if self.writable else 'const '
+        w.Write(f'lczero::python::ArrayView<{const}{self.item_cpp_type()}> '
+                f'{self.name_at_caller()}{{')
+        w.Write(f'    static_cast<{const}{self.item_cpp_type()}*>('
+                f'{self.name}_buffer.buf),')
+        w.Write(f'    static_cast<size_t>({self.name}_buffer.len / '
+                f'{self.name}_buffer.itemsize)}};')
+
+    def name_at_caller(self):
+        return f'{self.cpp_name}_cpp'
+
+
 class ArgvParameter(Parameter):
     def __init__(self, name, type, *argv, **kwargs):
         self.type = type
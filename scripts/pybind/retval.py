@@ -98,6 +98,7 @@ class NumericRetVal(RetVal):
             'i': 'int',
             'u64': 'uint64_t',
             'f32': 'float',
+            'bool': 'bool',
         }[self.type]
 
     def parse_tuple_format(self):
@@ -108,6 +109,9 @@ class NumericRetVal(RetVal):
         }[self.type]
 
     def GenerateConversion(self, w):
+        if self.type == 'bool':
+            w.Write(f'{self.py_val()} = PyBool_FromLong({self.cpp_val()});')
+            return
         w.Write(f'{self.py_val()} = Py_BuildValue('
                 f'"{self.parse_tuple_format()}", {self.cpp_val()});')
 
@@ -0,0 +1,201 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "analysis/batch.h"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "chess/callbacks.h"
+#include "chess/epd.h"
+#include "mcts/search.h"
+#include "mcts/stoppers/common.h"
+#include "mcts/stoppers/stoppers.h"
+#include "neural/factory.h"
+#include "utils/exception.h"
+#include "utils/optionsparser.h"
+
+namespace lczero {
+namespace {
+
+const OptionId kThreadsOptionId{
+    "threads", "Threads", "Number of (CPU) worker threads of each search.",
+    't'};
+const OptionId kConcurrencyId{
+    "concurrency", "", "Number of positions searched at the same time."};
+const OptionId kNodesId{
+    "nodes", "",
+    "Nodes searched in positions which don't set it with an \"acn\" "
+    "operation."};
+const OptionId kSyzygyTablebaseId{
+    "syzygy-paths", "SyzygyPath",
+    "List of Syzygy tablebase directories, list entries separated by system "
+    "separator (\";\" for Windows, \":\" for Linux).",
+    's'};
+
+// Returns the token after @opcode among the EPD operations of @line, without
+// quotes and the terminating semicolon, or "" if it's not there.
+std::string GetEpdOperand(const std::string& line, const std::string& opcode) {
+  std::istringstream stream(line);
+  std::string token;
+  while (stream >> token) {
+    if (token != opcode) continue;
+    std::string operand;
+    stream >> std::ws;
+    if (stream.peek() == '"') {
+      stream.get();
+      std::getline(stream, operand, '"');
+    } else {
+      stream >> operand;
+    }
+    if (!operand.empty() && operand.back() == ';') operand.pop_back();
+    return operand;
+  }
+  return "";
+}
+
+}  // namespace
+
+void BatchAnalysis::Run() {
+  OptionsParser options;
+  NetworkFactory::PopulateOptions(&options);
+  options.Add<IntOption>(kThreadsOptionId, 1, 128) = 1;
+  options.Add<IntOption>(kConcurrencyId, 1, 1024) = 4;
+  options.Add<IntOption>(kNodesId, 1, 999999999) = 800;
+  options.Add<IntOption>(kNNCacheSizeId, 0, 999999999) = 2000000;
+  options.Add<StringOption>(kSyzygyTablebaseId);
+  SearchParams::Populate(&options);
+
+  if (!options.ProcessAllFlags()) return;
+
+  try {
+    const auto option_dict = options.GetOptionsDict();
+    options_ = &option_dict;
+    threads_ = option_dict.Get<int>(kThreadsOptionId);
+    default_nodes_ = option_dict.Get<int>(kNodesId);
+    network_ = NetworkFactory::LoadNetwork(option_dict);
+    cache_.SetCapacity(option_dict.Get<int>(kNNCacheSizeId));
+    const auto tb_paths = option_dict.Get<std::string>(kSyzygyTablebaseId);
+    if (!tb_paths.empty()) {
+      syzygy_tb_ = std::make_unique<SyzygyTablebase>();
+      if (!syzygy_tb_->init(tb_paths)) {
+        throw Exception("Failed to load Syzygy tablebases from " + tb_paths);
+      }
+    }
+
+    std::vector<std::thread> searchers;
+    for (int i = 0; i < option_dict.Get<int>(kConcurrencyId); i++) {
+      searchers.emplace_back([this]() { Searcher(); });
+    }
+    for (auto& searcher : searchers) searcher.join();
+  } catch (Exception& ex) {
+    std::cerr << ex.what() << std::endl;
+  }
+}
+
+void BatchAnalysis::Searcher() {
+  // Search threads are kept between positions.
+  ThreadPool thread_pool;
+  while (true) {
+    std::string line;
+    int line_number;
+    {
+      Mutex::Lock lock(input_mutex_);
+      if (!std::getline(std::cin, line)) return;
+      line_number = ++lines_read_;
+    }
+    const auto first = line.find_first_not_of(" \t\r");
+    if (first == std::string::npos || line[first] == '#') continue;
+    try {
+      Output(Analyze(line, line_number, &thread_pool));
+    } catch (Exception& ex) {
+      Output("error line " + std::to_string(line_number) + " " + ex.what());
+    }
+  }
+}
+
+std::string BatchAnalysis::Analyze(const std::string& line, int line_number,
+                                   ThreadPool* thread_pool) {
+  const Position position = ParseEpdPosition(line);
+  const std::string acn = GetEpdOperand(line, "acn");
+  int64_t nodes = default_nodes_;
+  if (!acn.empty()) {
+    try {
+      nodes = std::stoll(acn);
+    } catch (const std::exception&) {
+      throw Exception("Bad acn operand: " + acn);
+    }
+    if (nodes <= 0) throw Exception("Bad acn operand: " + acn);
+  }
+
+  NodeTree tree;
+  tree.ResetToPosition(GetFen(position), {});
+  ThinkingInfo info;
+  Move best_move;
+  // Castling is reported as the king's move, like to UCI hosts.
+  auto responder = std::make_unique<Chess960Transformer>(
+      std::make_unique<CallbackUciResponder>(
+          [&](const BestMoveInfo& move) { best_move = move.bestmove; },
+          [&](const std::vector<ThinkingInfo>& infos) {
+            if (!infos.empty()) info = infos.front();
+          }),
+      tree.HeadPosition().GetBoard());
+  Search search(tree, network_.get(), std::move(responder), MoveList(),
+                std::chrono::steady_clock::now(),
+                std::make_unique<VisitsStopper>(nodes, false), false, false,
+                *options_, &cache_, syzygy_tb_.get(), thread_pool);
+  search.StartThreads(threads_);
+  search.Wait();
+
+  std::ostringstream result;
+  result << "result line " << line_number;
+  const std::string id = GetEpdOperand(line, "id");
+  if (!id.empty()) result << " id " << id;
+  result << " nodes " << search.GetTotalPlayouts();
+  if (info.mate) {
+    result << " score mate " << *info.mate;
+  } else if (info.score) {
+    result << " score cp " << *info.score;
+  }
+  if (info.wdl) {
+    result << " wdl " << info.wdl->w << " " << info.wdl->d << " "
+           << info.wdl->l;
+  }
+  result << " bestmove " << best_move.as_string() << " pv";
+  for (const auto& move : info.pv) result << " " << move.as_string();
+  return result.str();
+}
+
+void BatchAnalysis::Output(const std::string& line) {
+  Mutex::Lock lock(output_mutex_);
+  std::cout << line << std::endl;
+}
+
+}  // namespace lczero
@@ -0,0 +1,76 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "neural/cache.h"
+#include "neural/network.h"
+#include "syzygy/syzygy.h"
+#include "utils/mutex.h"
+#include "utils/optionsdict.h"
+#include "utils/threadpool.h"
+
+namespace lczero {
+
+// Searches a stream of positions, one per line of the standard input, several
+// at a time over one shared backend and NN cache. A line is a FEN or an EPD
+// position, whose "acn" (nodes) and "id" operations set its node limit and
+// name. A result line is written as each search finishes, so the order may
+// differ from the input:
+//   result line <n> [id <id>] nodes <n> score cp <x>|mate <y>
+//       wdl <w> <d> <l> bestmove <move> pv <moves>...
+// A bad line gets "error line <n> <message>" instead.
+class BatchAnalysis {
+ public:
+  BatchAnalysis() = default;
+
+  void Run();
+
+ private:
+  // Reads and searches lines until the input ends.
+  void Searcher();
+  // Returns the result line of input line @line_number.
+  std::string Analyze(const std::string& line, int line_number,
+                      ThreadPool* thread_pool);
+  void Output(const std::string& line);
+
+  const OptionsDict* options_ = nullptr;
+  std::unique_ptr<Network> network_;
+  std::unique_ptr<SyzygyTablebase> syzygy_tb_;
+  NNCache cache_;
+  int threads_ = 1;
+  int default_nodes_ = 1;
+
+  Mutex input_mutex_{"BatchAnalysis::input_mutex_"};
+  int lines_read_ GUARDED_BY(input_mutex_) = 0;
+  Mutex output_mutex_{"BatchAnalysis::output_mutex_"};
+};
+
+}  // namespace lczero
@@ -27,17 +27,28 @@
 
 #include "benchmark/backendbench.h"
 
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <thread>
+
 #include "chess/board.h"
 #include "mcts/node.h"
+#include "neural/batch_buckets.h"
 #include "neural/factory.h"
+#include "neural/trace.h"
 #include "utils/optionsparser.h"
+#include "utils/random.h"
 
 namespace lczero {
 namespace {
 const int kDefaultThreads = 1;
 
-const OptionId kThreadsOptionId{"threads", "Threads",
-                                "Number of (CPU) worker threads to use.", 't'};
+const OptionId kThreadsOptionId{
+    "threads", "Threads",
+    "Number of threads computing batches at the same time, as search threads "
+    "do.",
+    't'};
 const OptionId kBatchesId{"batches", "",
                           "Number of batches to run as a benchmark."};
 const OptionId kStartBatchSizeId{"start-batch-size", "",
@@ -47,9 +58,125 @@ const OptionId kMaxBatchSizeId{"max-batch-size", "",
 const OptionId kBatchStepId{"batch-step", "",
                             "Step of batch size in benchmark."};
 const OptionId kFenId{"fen", "", "Benchmark initial position FEN."};
+const OptionId kRandomPositionsId{
+    "random-positions", "",
+    "Number of positions reached by random moves from the initial position to "
+    "fill the batches with, 0 to only use the initial position."};
+const OptionId kCurveFileId{
+    "curve-file", "",
+    "File to write the throughput by batch size to, for the batch_curve "
+    "option of backends which compile for fixed batch sizes."};
+const OptionId kBucketsId{"buckets", "",
+                          "Number of batch size buckets to recommend from "
+                          "the measured throughput, 0 for none."};
+const OptionId kTraceFileId{
+    "trace-file", "",
+    "Trace of search batches written by the trace_file option of the "
+    "recordreplay backend. Its batches are replayed instead of the synthetic "
+    "ones, and the outputs are compared with the recorded ones."};
 
 const OptionId kClippyId{"clippy", "", "Enable helpful assistant."};
 
+// Returns the 50th, 90th and 99th percentiles of @latencies in milliseconds.
+std::string FormatLatencies(std::vector<double> latencies) {
+  std::sort(latencies.begin(), latencies.end());
+  std::ostringstream result;
+  for (int percent : {50, 90, 99}) {
+    const size_t idx = std::max<size_t>(
+        std::ceil(latencies.size() * percent / 100.0), 1);
+    result << (percent == 50 ? "p" : ", p") << percent << " "
+           << latencies[idx - 1] << "ms";
+  }
+  return result.str();
+}
+
+// Positions reached by up to 40 random moves from @history, encoded.
+std::vector<InputPlanes> RandomPositions(
+    pblczero::NetworkFormat::InputFormat input_format,
+    const PositionHistory& history, int count) {
+  std::vector<InputPlanes> result;
+  while (static_cast<int>(result.size()) < count) {
+    PositionHistory game = history;
+    const int plies = Random::Get().GetInt(0, 40);
+    for (int ply = 0; ply < plies; ply++) {
+      if (game.ComputeGameResult() != GameResult::UNDECIDED) break;
+      const auto moves = game.Last().GetBoard().GenerateLegalMoves();
+      game.Append(moves[Random::Get().GetInt(0, moves.size() - 1)]);
+    }
+    result.push_back(EncodePositionForNN(input_format, game, 8,
+                                         FillEmptyHistory::ALWAYS, nullptr));
+  }
+  return result;
+}
+
+// Computes the batches of @trace_file as fast as possible, with the batch
+// sizes of the search they were recorded in.
+void ReplayTrace(Network* network, const std::string& trace_file) {
+  std::vector<TraceBatch> batches;
+  TraceReader reader(trace_file);
+  for (TraceBatch batch; reader.Read(&batch);) {
+    batches.push_back(std::move(batch));
+  }
+  if (batches.empty()) throw Exception("No batches in " + trace_file);
+
+  auto compute = [&](const TraceBatch& batch) {
+    auto computation = network->NewComputation();
+    for (const auto& input : batch.inputs) {
+      computation->AddInput(InputPlanes(input));
+    }
+    computation->ComputeBlocking();
+    return computation;
+  };
+  // Do any backend initialization outside the timing.
+  compute(batches.front());
+
+  std::vector<int> sizes;
+  std::vector<double> latencies;
+  size_t positions = 0;
+  double q_error = 0.0, q_max_error = 0.0, d_error = 0.0, m_error = 0.0;
+  double policy_error = 0.0;
+  std::chrono::duration<double> time{0};
+  for (const auto& batch : batches) {
+    const auto start = std::chrono::steady_clock::now();
+    const auto computation = compute(batch);
+    const std::chrono::duration<double, std::milli> latency =
+        std::chrono::steady_clock::now() - start;
+    time += latency;
+    latencies.push_back(latency.count());
+
+    const int batch_size = batch.inputs.size();
+    sizes.push_back(batch_size);
+    positions += batch_size;
+    for (int i = 0; i < batch_size; i++) {
+      const double q = std::abs(computation->GetQVal(i) - batch.q[i]);
+      q_error += q;
+      q_max_error = std::max(q_max_error, q);
+      d_error += std::abs(computation->GetDVal(i) - batch.d[i]);
+      m_error += std::abs(computation->GetMVal(i) - batch.m[i]);
+      // Total variation distance between the policies.
+      double policy = 0.0;
+      for (int j = 0; j < TraceBatch::kPolicySize; j++) {
+        policy += std::abs(computation->GetPVal(i, j) -
+                           batch.policy[i * TraceBatch::kPolicySize + j]);
+      }
+      policy_error += policy / 2;
+    }
+  }
+
+  std::sort(sizes.begin(), sizes.end());
+  std::cout << "Replayed " << batches.size() << " batches of sizes "
+            << sizes.front() << " to " << sizes.back() << " (median "
+            << sizes[sizes.size() / 2] << ") in " << time.count()
+            << "s - throughput " << positions / time.count() << " nps."
+            << std::endl;
+  std::cout << "Latency " << FormatLatencies(latencies) << "." << std::endl;
+  std::cout << "Mean absolute difference to the trace: Q "
+            << q_error / positions << " (max " << q_max_error << "), D "
+            << d_error / positions << ", M " << m_error / positions
+            << ", policy total variation " << policy_error / positions << "."
+            << std::endl;
+}
+
 void Clippy(std::string title,
             std::string msg3,  std::string best3, std::string msg2,
             std::string best2, std::string msg,   std::string best) {
@@ -86,6 +213,10 @@ void BackendBenchmark::Run() {
   options.Add<IntOption>(kMaxBatchSizeId, 1, 1024) = 256;
   options.Add<IntOption>(kBatchStepId, 1, 256) = 1;
   options.Add<StringOption>(kFenId) = ChessBoard::kStartposFen;
+  options.Add<IntOption>(kRandomPositionsId, 0, 100000) = 0;
+  options.Add<StringOption>(kCurveFileId);
+  options.Add<IntOption>(kBucketsId, 0, 64) = 0;
+  options.Add<StringOption>(kTraceFileId);
   options.Add<BoolOption>(kClippyId) = false;
 
   if (!options.ProcessAllFlags()) return;
@@ -95,46 +226,77 @@ void BackendBenchmark::Run() {
 
     auto network = NetworkFactory::LoadNetwork(option_dict);
 
+    const auto trace_file = option_dict.Get<std::string>(kTraceFileId);
+    if (!trace_file.empty()) {
+      ReplayTrace(network.get(), trace_file);
+      return;
+    }
+
     NodeTree tree;
     tree.ResetToPosition(option_dict.Get<std::string>(kFenId), {});
+    // Encoded once, so that only the backend is timed.
+    const auto input_format = network->GetCapabilities().input_format;
+    std::vector<InputPlanes> inputs =
+        option_dict.Get<int>(kRandomPositionsId) > 0
+            ? RandomPositions(input_format, tree.GetPositionHistory(),
+                              option_dict.Get<int>(kRandomPositionsId))
+            : std::vector<InputPlanes>{EncodePositionForNN(
+                  input_format, tree.GetPositionHistory(), 8,
+                  FillEmptyHistory::ALWAYS, nullptr)};
 
     // Do any backend initialization outside the loop.
     auto warmup = network->NewComputation();
-    warmup->AddInput(EncodePositionForNN(
-        network->GetCapabilities().input_format, tree.GetPositionHistory(), 8,
-        FillEmptyHistory::ALWAYS, nullptr));
+    warmup->AddInput(InputPlanes(inputs.front()));
     warmup->ComputeBlocking();
 
     const int batches = option_dict.Get<int>(kBatchesId);
+    const int threads = option_dict.Get<int>(kThreadsOptionId);
 
     int best = 1; int best2 = 1; int best3 = 1;
     float best_nps = 0.0f; float best_nps2 = 0.0f; float best_nps3 = 0.0f;
     std::optional<std::chrono::time_point<std::chrono::steady_clock>> pending;
+    ThroughputCurve curve;
 
     for (int i = option_dict.Get<int>(kStartBatchSizeId);
          i <= option_dict.Get<int>(kMaxBatchSizeId);
          i += option_dict.Get<int>(kBatchStepId)) {
+      // Latencies in milliseconds, per thread.
+      std::vector<std::vector<double>> latencies(threads);
       const auto start = std::chrono::steady_clock::now();
-      // TODO: support threads not equal to 1 to be able to more sensibly test
-      // multiplexing backend.
-      for (int j = 0; j < batches; j++) {
-        // Put i copies of tree root node into computation and compute.
-        auto computation = network->NewComputation();
-        for (int k = 0; k < i; k++) {
-          computation->AddInput(EncodePositionForNN(
-              network->GetCapabilities().input_format,
-              tree.GetPositionHistory(), 8, FillEmptyHistory::ALWAYS, nullptr));
-        }
-        computation->ComputeBlocking();
+      std::vector<std::thread> workers;
+      for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+          size_t next_input = t * i;
+          for (int j = t; j < batches; j += threads) {
+            auto computation = network->NewComputation();
+            for (int k = 0; k < i; k++) {
+              computation->AddInput(
+                  InputPlanes(inputs[next_input++ % inputs.size()]));
+            }
+            const auto batch_start = std::chrono::steady_clock::now();
+            computation->ComputeBlocking();
+            const std::chrono::duration<double, std::milli> latency =
+                std::chrono::steady_clock::now() - batch_start;
+            latencies[t].push_back(latency.count());
+          }
+        });
       }
+      for (auto& worker : workers) worker.join();
 
       const auto end = std::chrono::steady_clock::now();
       std::chrono::duration<double> time = end - start;
       const auto nps = i * batches / time.count();
+      std::vector<double> all_latencies;
+      for (const auto& thread_latencies : latencies) {
+        all_latencies.insert(all_latencies.end(), thread_latencies.begin(),
+                             thread_latencies.end());
+      }
       std::cout << "Benchmark batch size " << i
                 << " with inference average time "
                 << time.count() / batches * 1000 << "ms - throughput " << nps
-                << " nps." << std::endl;
+                << " nps, latency " << FormatLatencies(all_latencies) << "."
+                << std::endl;
+      curve.emplace_back(i, nps);
 
       if (option_dict.Get<bool>(kClippyId)) {
         float nps_ingame  = std::pow((nps + best_nps)  / 2, 1.085);
@@ -182,6 +344,15 @@ void BackendBenchmark::Run() {
             "15s/move  (Rapid):      ", std::to_string(best2),
             "3min/move (Tournament): ", std::to_string(best));
     }
+    const auto curve_file = option_dict.Get<std::string>(kCurveFileId);
+    if (!curve_file.empty()) WriteThroughputCurve(curve_file, curve);
+    if (option_dict.Get<int>(kBucketsId) > 0) {
+      const auto buckets =
+          BatchBuckets::FromCurve(curve, option_dict.Get<int>(kBucketsId));
+      std::cout << "Recommended batch size buckets:";
+      for (const int size : buckets.sizes()) std::cout << " " << size;
+      std::cout << std::endl;
+    }
   } catch (Exception& ex) {
     std::cerr << ex.what() << std::endl;
   }
@@ -27,11 +27,15 @@
 
 #include "benchmark/benchmark.h"
 
+#include <fstream>
 #include <numeric>
 
+#include "chess/epd.h"
 #include "mcts/search.h"
 #include "mcts/stoppers/factory.h"
 #include "mcts/stoppers/stoppers.h"
+#include "syzygy/syzygy.h"
+#include "utils/random.h"
 
 namespace lczero {
 namespace {
@@ -45,6 +49,92 @@ const OptionId kMovetimeId{"movetime", "",
 const OptionId kFenId{"fen", "", "Benchmark position FEN."};
 const OptionId kNumPositionsId{"num-positions", "",
                                "The number of benchmark positions to test."};
+const OptionId kSuiteId{"suite", "",
+                        "Run all the benchmark positions, including the "
+                        "tablebase ones."};
+const OptionId kEpdId{"epd", "",
+                      "Run the positions of this EPD file rather than the "
+                      "built-in ones."};
+const OptionId kJsonId{"json", "",
+                       "Write the results of every position to this file, as "
+                       "JSON."};
+const OptionId kSeedId{"seed", "",
+                       "Seed of random numbers, restarted for every position. "
+                       "0 for a random seed."};
+const OptionId kSyzygyTablebaseId{
+    "syzygy-paths", "SyzygyPath",
+    "List of Syzygy tablebase directories, list entries separated by system "
+    "separator (\";\" for Windows, \":\" for Linux).",
+    's'};
+
+struct PositionResult {
+  std::string category;
+  std::string fen;
+  int64_t nodes;
+  int64_t time_ms;
+  int64_t batches;
+  uint64_t cache_hits;
+  uint64_t cache_lookups;
+  int depth;
+  int seldepth;
+  Move best_move;
+  std::vector<int64_t> time_to_depth;
+};
+
+int64_t Nps(int64_t nodes, int64_t time_ms) {
+  return std::lround(1000.0 * nodes / (time_ms + 1));
+}
+
+std::string JsonString(const std::string& str) {
+  std::string result = "\"";
+  for (char c : str) {
+    if (c == '"' || c == '\\') result += '\\';
+    result += c;
+  }
+  return result + "\"";
+}
+
+void WriteJson(const std::string& filename, const OptionsDict& options,
+               const std::vector<PositionResult>& results) {
+  std::ofstream out(filename);
+  if (!out) throw Exception("Cannot write file: " + filename);
+  int64_t total_nodes = 0;
+  int64_t total_time = 0;
+  out << "{\n  \"suite_version\": " << Benchmark::kSuiteVersion
+      << ",\n  \"seed\": " << options.Get<int>(kSeedId)
+      << ",\n  \"threads\": " << options.Get<int>(kThreadsOptionId)
+      << ",\n  \"nodes_limit\": " << options.Get<int>(kNodesId)
+      << ",\n  \"movetime\": " << options.Get<int>(kMovetimeId)
+      << ",\n  \"positions\": [";
+  for (size_t i = 0; i < results.size(); i++) {
+    const auto& result = results[i];
+    total_nodes += result.nodes;
+    total_time += result.time_ms;
+    out << (i == 0 ? "\n" : ",\n") << "    {\"category\": "
+        << JsonString(result.category)
+        << ", \"fen\": " << JsonString(result.fen)
+        << ", \"nodes\": " << result.nodes
+        << ", \"time_ms\": " << result.time_ms
+        << ", \"nps\": " << Nps(result.nodes, result.time_ms)
+        << ", \"batches\": " << result.batches
+        << ", \"avg_batch_size\": "
+        << (result.batches ? 1.0 * result.nodes / result.batches : 0.0)
+        << ", \"cache_hits\": " << result.cache_hits
+        << ", \"cache_lookups\": " << result.cache_lookups
+        << ", \"depth\": " << result.depth
+        << ", \"seldepth\": " << result.seldepth
+        << ", \"bestmove\": " << JsonString(result.best_move.as_string())
+        << ", \"time_to_depth_ms\": [";
+    for (size_t depth = 0; depth < result.time_to_depth.size(); depth++) {
+      out << (depth == 0 ? "" : ", ") << result.time_to_depth[depth];
+    }
+    out << "]}";
+  }
+  out << "\n  ],\n  \"total\": {\"nodes\": " << total_nodes
+      << ", \"time_ms\": " << total_time
+      << ", \"nps\": " << Nps(total_nodes, total_time) << "}\n}\n";
+  if (!out) throw Exception("Cannot write file: " + filename);
+}
 }  // namespace
 
 void Benchmark::Run() {
@@ -57,7 +147,12 @@ void Benchmark::Run() {
   options.Add<IntOption>(kNodesId, -1, 999999999) = -1;
   options.Add<IntOption>(kMovetimeId, -1, 999999999) = 10000;
   options.Add<StringOption>(kFenId) = "";
-  options.Add<IntOption>(kNumPositionsId, 1, 34) = 34;
+  options.Add<IntOption>(kNumPositionsId, 1, positions.size()) = 34;
+  options.Add<BoolOption>(kSuiteId) = false;
+  options.Add<StringOption>(kEpdId) = "";
+  options.Add<StringOption>(kJsonId) = "";
+  options.Add<IntOption>(kSeedId, 0, 999999999) = 0;
+  options.Add<StringOption>(kSyzygyTablebaseId);
 
   if (!options.ProcessAllFlags()) return;
 
@@ -69,22 +164,45 @@ void Benchmark::Run() {
     const int visits = option_dict.Get<int>(kNodesId);
     const int movetime = option_dict.Get<int>(kMovetimeId);
     const std::string fen = option_dict.Get<std::string>(kFenId);
+    const std::string epd = option_dict.Get<std::string>(kEpdId);
+    const int seed = option_dict.Get<int>(kSeedId);
     int num_positions = option_dict.Get<int>(kNumPositionsId);
 
-    std::vector<std::double_t> times;
-    std::vector<std::int64_t> playouts;
+    std::unique_ptr<SyzygyTablebase> syzygy_tb;
+    const auto tb_paths = option_dict.Get<std::string>(kSyzygyTablebaseId);
+    if (!tb_paths.empty()) {
+      syzygy_tb = std::make_unique<SyzygyTablebase>();
+      if (!syzygy_tb->init(tb_paths)) {
+        throw Exception("Failed to load Syzygy tablebases from " + tb_paths);
+      }
+    }
+
+    std::vector<PositionResult> results;
     std::uint64_t cnt = 1;
 
     if (fen.length() > 0) {
-      positions = {fen};
+      positions = {{"fen", fen}};
       num_positions = 1;
+    } else if (!epd.empty()) {
+      positions.clear();
+      for (const auto& position : ReadEpdFile(epd)) {
+        positions.push_back({"epd", GetFen(position)});
+      }
+      num_positions = positions.size();
+    } else if (option_dict.Get<bool>(kSuiteId)) {
+      num_positions = positions.size();
     }
-    std::vector<std::string> testing_positions(
+    std::vector<BenchmarkPosition> testing_positions(
         positions.cbegin(), positions.cbegin() + num_positions);
 
-    for (std::string position : testing_positions) {
+    for (const auto& position : testing_positions) {
       std::cout << "\nPosition: " << cnt++ << "/" << testing_positions.size()
-                << " " << position << std::endl;
+                << " " << position.fen << std::endl;
+      if (seed != 0) Random::Get().Seed(seed);
+      best_move_ = Move();
+      depth_ = 0;
+      seldepth_ = 0;
+      time_to_depth_.clear();
 
       auto stopper = std::make_unique<ChainedSearchStopper>();
       if (movetime > -1) {
@@ -98,7 +216,7 @@ void Benchmark::Run() {
       cache.SetCapacity(option_dict.Get<int>(kNNCacheSizeId));
 
       NodeTree tree;
-      tree.ResetToPosition(position, {});
+      tree.ResetToPosition(position.fen, {});
 
       const auto start = std::chrono::steady_clock::now();
       auto search = std::make_unique<Search>(
@@ -107,32 +225,47 @@ void Benchmark::Run() {
               std::bind(&Benchmark::OnBestMove, this, std::placeholders::_1),
               std::bind(&Benchmark::OnInfo, this, std::placeholders::_1)),
           MoveList(), start, std::move(stopper), false, false, option_dict,
-          &cache, nullptr);
+          &cache, syzygy_tb.get());
       search->StartThreads(option_dict.Get<int>(kThreadsOptionId));
       search->Wait();
       const auto end = std::chrono::steady_clock::now();
 
       const auto time =
           std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
-      times.push_back(time.count());
-      playouts.push_back(search->GetTotalPlayouts());
+      results.push_back({position.category, position.fen,
+                         search->GetTotalPlayouts(), time.count(),
+                         search->GetTotalBatches(), cache.GetHits(),
+                         cache.GetLookups(), depth_, seldepth_, best_move_,
+                         time_to_depth_});
+      const auto& result = results.back();
+      std::cout << "Nodes " << result.nodes << ", " << result.time_ms
+                << " ms, " << Nps(result.nodes, result.time_ms)
+                << " nps, depth " << result.depth << "/" << result.seldepth
+                << ", " << result.batches << " batches, cache hits "
+                << result.cache_hits << "/" << result.cache_lookups
+                << std::endl;
     }
 
-    const auto total_playouts =
-        std::accumulate(playouts.begin(), playouts.end(), 0);
-    const auto total_time = std::accumulate(times.begin(), times.end(), 0);
+    int64_t total_playouts = 0;
+    int64_t total_time = 0;
+    for (const auto& result : results) {
+      total_playouts += result.nodes;
+      total_time += result.time_ms;
+    }
     std::cout << "\n==========================="
               << "\nTotal time (ms) : " << total_time
               << "\nNodes searched  : " << total_playouts
-              << "\nNodes/second    : "
-              << std::lround(1000.0 * total_playouts / (total_time + 1))
+              << "\nNodes/second    : " << Nps(total_playouts, total_time)
               << std::endl;
+    const auto json = option_dict.Get<std::string>(kJsonId);
+    if (!json.empty()) WriteJson(json, option_dict, results);
   } catch (Exception& ex) {
     std::cerr << ex.what() << std::endl;
   }
 }
 
 void Benchmark::OnBestMove(const BestMoveInfo& move) {
+  best_move_ = move.bestmove;
   std::cout << "bestmove " << move.bestmove.as_string() << std::endl;
 }
 
@@ -142,6 +275,11 @@ void Benchmark::OnInfo(const std::vector<ThinkingInfo>& infos) {
   line += std::to_string(infos[0].nps) + " nps";
   if (!infos[0].pv.empty()) line += ", move " + infos[0].pv[0].as_string();
   std::cout << line << std::endl;
+  depth_ = std::max(depth_, infos[0].depth);
+  seldepth_ = std::max(seldepth_, infos[0].seldepth);
+  while (static_cast<int>(time_to_depth_.size()) < depth_) {
+    time_to_depth_.push_back(infos[0].time);
+  }
 }
 
 }  // namespace lczero
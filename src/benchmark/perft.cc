@@ -0,0 +1,166 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "benchmark/perft.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "chess/board.h"
+#include "utils/optionsparser.h"
+
+namespace lczero {
+namespace {
+
+const OptionId kFenId{"fen", "", "Position to count the moves of."};
+const OptionId kDepthId{"depth", "", "Number of plies to go down."};
+const OptionId kDivideId{"divide", "",
+                         "Also show the count below each root move."};
+const OptionId kThreadsId{"threads", "",
+                          "Number of threads sharing the root moves.", 't'};
+const OptionId kHashId{"hash", "",
+                       "Size of the table of counted positions in MiB, 0 to "
+                       "count transpositions again."};
+
+// Counts of positions at a given depth, shared by all threads without locks.
+// Entries keep the key xored with the count, so that torn writes don't match.
+class PerftHashTable {
+ public:
+  explicit PerftHashTable(size_t size_mb)
+      : entries_(size_mb * 1024 * 1024 / sizeof(Entry)) {}
+
+  bool enabled() const { return !entries_.empty(); }
+
+  bool Probe(uint64_t key, uint64_t* count) const {
+    const Entry& entry = entries_[key % entries_.size()];
+    const uint64_t data = entry.data.load(std::memory_order_relaxed);
+    if ((entry.check.load(std::memory_order_relaxed) ^ data) != key) {
+      return false;
+    }
+    *count = data;
+    return true;
+  }
+
+  void Store(uint64_t key, uint64_t count) {
+    Entry& entry = entries_[key % entries_.size()];
+    entry.check.store(key ^ count, std::memory_order_relaxed);
+    entry.data.store(count, std::memory_order_relaxed);
+  }
+
+  // Keys differ by depth, as the same position counts differently.
+  static uint64_t Key(const ChessBoard& board, int depth) {
+    return board.Hash() ^ (0x9E3779B97F4A7C15ULL * (depth + 1));
+  }
+
+ private:
+  struct Entry {
+    std::atomic<uint64_t> check{0};
+    std::atomic<uint64_t> data{0};
+  };
+  std::vector<Entry> entries_;
+};
+
+uint64_t Perft(const ChessBoard& board, int depth, PerftHashTable* hash) {
+  const auto moves = board.GenerateLegalMoves();
+  // The last ply only needs the number of moves.
+  if (depth == 1) return moves.size();
+  const uint64_t key = PerftHashTable::Key(board, depth);
+  uint64_t count = 0;
+  if (hash->enabled() && hash->Probe(key, &count)) return count;
+  for (const auto move : moves) {
+    ChessBoard child = board;
+    child.ApplyMove(move);
+    child.Mirror();
+    count += Perft(child, depth - 1, hash);
+  }
+  if (hash->enabled()) hash->Store(key, count);
+  return count;
+}
+
+}  // namespace
+
+void PerftBenchmark::Run() {
+  OptionsParser options;
+  options.Add<StringOption>(kFenId) = ChessBoard::kStartposFen;
+  options.Add<IntOption>(kDepthId, 1, 12) = 5;
+  options.Add<BoolOption>(kDivideId) = false;
+  options.Add<IntOption>(kThreadsId, 1, 256) = 1;
+  options.Add<IntOption>(kHashId, 0, 65536) = 0;
+
+  if (!options.ProcessAllFlags()) return;
+
+  try {
+    auto option_dict = options.GetOptionsDict();
+    ChessBoard board(option_dict.Get<std::string>(kFenId));
+    const int depth = option_dict.Get<int>(kDepthId);
+    PerftHashTable hash(option_dict.Get<int>(kHashId));
+
+    const auto start = std::chrono::steady_clock::now();
+    // Threads take the root moves one at a time.
+    const auto moves = board.GenerateLegalMoves();
+    std::vector<uint64_t> counts(moves.size(), 1);
+    std::atomic<size_t> next_move{0};
+    auto worker = [&]() {
+      for (size_t i = next_move++; i < moves.size(); i = next_move++) {
+        if (depth == 1) continue;
+        ChessBoard child = board;
+        child.ApplyMove(moves[i]);
+        child.Mirror();
+        counts[i] = Perft(child, depth - 1, &hash);
+      }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 1; i < option_dict.Get<int>(kThreadsId); i++) {
+      threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) thread.join();
+    const std::chrono::duration<double> time =
+        std::chrono::steady_clock::now() - start;
+
+    uint64_t nodes = 0;
+    for (size_t i = 0; i < moves.size(); i++) {
+      if (option_dict.Get<bool>(kDivideId)) {
+        Move move = moves[i];
+        if (board.flipped()) move.Mirror();
+        std::cout << move.as_string() << ": " << counts[i] << std::endl;
+      }
+      nodes += counts[i];
+    }
+    std::cout << "Perft " << depth << ": " << nodes << " nodes in "
+              << time.count() * 1000 << "ms, " << nodes / time.count()
+              << " nps." << std::endl;
+  } catch (Exception& ex) {
+    std::cerr << ex.what() << std::endl;
+  }
+}
+
+}  // namespace lczero
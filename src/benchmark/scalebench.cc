@@ -0,0 +1,301 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "benchmark/scalebench.h"
+
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <tuple>
+
+#include "benchmark/benchmark.h"
+#include "mcts/search.h"
+#include "mcts/stoppers/common.h"
+#include "mcts/stoppers/stoppers.h"
+#include "neural/factory.h"
+#include "utils/optionsparser.h"
+#include "utils/string.h"
+
+namespace lczero {
+namespace {
+const OptionId kBackendsId{
+    "backends", "",
+    "Semicolon separated backends to try, each as <backend> or "
+    "<backend>:<backend-opts>, e.g. to compare multiplexing and demux setups. "
+    "Empty for the configured backend only."};
+const OptionId kThreadsListId{"threads-list", "",
+                              "Comma separated numbers of search threads."};
+const OptionId kMinibatchListId{"minibatch-list", "",
+                                "Comma separated minibatch sizes."};
+const OptionId kTaskWorkersListId{"task-workers-list", "",
+                                  "Comma separated numbers of task workers."};
+const OptionId kMovetimeId{"movetime", "",
+                           "Time to search every position, in milliseconds."};
+const OptionId kNumPositionsId{"num-positions", "",
+                               "The number of benchmark positions to search."};
+// Configurations this much slower than the fastest are still recommended if
+// they use smaller minibatches or fewer threads, which cost less strength.
+constexpr float kRecommendTolerance = 0.03f;
+
+// Measures the time some computation of the network is in progress.
+class UtilizationNetwork : public Network {
+ public:
+  explicit UtilizationNetwork(std::unique_ptr<Network> network)
+      : network_(std::move(network)) {}
+
+  const NetworkCapabilities& GetCapabilities() const override {
+    return network_->GetCapabilities();
+  }
+  std::unique_ptr<NetworkComputation> NewComputation() override;
+  int GetThreads() const override { return network_->GetThreads(); }
+  void InitThread(int id) override { network_->InitThread(id); }
+  bool IsCpu() const override { return network_->IsCpu(); }
+  std::string GetPciBusId() const override { return network_->GetPciBusId(); }
+  int GetMiniBatchSize() const override {
+    return network_->GetMiniBatchSize();
+  }
+
+  void Begin() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (active_++ == 0) busy_start_ = std::chrono::steady_clock::now();
+  }
+  void End() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--active_ == 0) busy_ += std::chrono::steady_clock::now() - busy_start_;
+  }
+  // Returns the busy time since the last call.
+  std::chrono::duration<double> TakeBusyTime() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto result = busy_;
+    busy_ = {};
+    return result;
+  }
+
+ private:
+  const std::unique_ptr<Network> network_;
+  std::mutex mutex_;
+  int active_ = 0;
+  std::chrono::steady_clock::time_point busy_start_;
+  std::chrono::duration<double> busy_{0};
+};
+
+class UtilizationComputation : public NetworkComputation {
+ public:
+  UtilizationComputation(std::unique_ptr<NetworkComputation> computation,
+                         UtilizationNetwork* network)
+      : computation_(std::move(computation)), network_(network) {}
+
+  void AddInput(InputPlanes&& input) override {
+    computation_->AddInput(std::move(input));
+  }
+  void AddInputWithMoves(InputPlanes&& input,
+                         const std::vector<uint16_t>& moves) override {
+    computation_->AddInputWithMoves(std::move(input), moves);
+  }
+  bool CanAddInputInPlace() const override {
+    return computation_->CanAddInputInPlace();
+  }
+  InputBuffers AddInputInPlace(const std::vector<uint16_t>& moves) override {
+    return computation_->AddInputInPlace(moves);
+  }
+  void ComputeBlocking() override {
+    network_->Begin();
+    computation_->ComputeBlocking();
+    network_->End();
+  }
+  void Submit() override {
+    network_->Begin();
+    computation_->Submit();
+  }
+  void Wait() override {
+    computation_->Wait();
+    network_->End();
+  }
+  void SetPriority(ComputationPriority priority) override {
+    computation_->SetPriority(priority);
+  }
+  int GetBatchSize() const override { return computation_->GetBatchSize(); }
+  float GetQVal(int sample) const override {
+    return computation_->GetQVal(sample);
+  }
+  float GetDVal(int sample) const override {
+    return computation_->GetDVal(sample);
+  }
+  float GetMVal(int sample) const override {
+    return computation_->GetMVal(sample);
+  }
+  float GetPVal(int sample, int move_id) const override {
+    return computation_->GetPVal(sample, move_id);
+  }
+  float GetLegalPVal(int sample, int move_ordinal,
+                     int move_id) const override {
+    return computation_->GetLegalPVal(sample, move_ordinal, move_id);
+  }
+
+ private:
+  const std::unique_ptr<NetworkComputation> computation_;
+  UtilizationNetwork* const network_;
+};
+
+std::unique_ptr<NetworkComputation> UtilizationNetwork::NewComputation() {
+  return std::make_unique<UtilizationComputation>(network_->NewComputation(),
+                                                  this);
+}
+
+struct ScaleConfig {
+  std::string backend;
+  int threads;
+  int minibatch;
+  int task_workers;
+  double nps = 0.0;
+  double utilization = 0.0;
+};
+
+std::string FormatConfig(const ScaleConfig& config) {
+  std::ostringstream result;
+  if (!config.backend.empty()) {
+    const auto colon = config.backend.find(':');
+    result << "--backend=" << config.backend.substr(0, colon) << " ";
+    if (colon != std::string::npos) {
+      result << "--backend-opts=" << config.backend.substr(colon + 1) << " ";
+    }
+  }
+  result << "--threads=" << config.threads
+         << " --minibatch-size=" << config.minibatch
+         << " --task-workers=" << config.task_workers;
+  return result.str();
+}
+}  // namespace
+
+void ScaleBenchmark::Run() {
+  OptionsParser options;
+  NetworkFactory::PopulateOptions(&options);
+  options.Add<IntOption>(kNNCacheSizeId, 0, 999999999) = 200000;
+  SearchParams::Populate(&options);
+
+  options.Add<StringOption>(kBackendsId);
+  options.Add<StringOption>(kThreadsListId) = "1,2,4";
+  options.Add<StringOption>(kMinibatchListId) = "32,64,128,256";
+  options.Add<StringOption>(kTaskWorkersListId) = "-1,0,2,4";
+  options.Add<IntOption>(kMovetimeId, 1, 999999999) = 1000;
+  options.Add<IntOption>(kNumPositionsId, 1, 34) = 4;
+
+  if (!options.ProcessAllFlags()) return;
+
+  try {
+    auto option_dict = options.GetOptionsDict();
+    // An empty list has one empty backend, the configured one.
+    const auto backends =
+        StrSplit(option_dict.Get<std::string>(kBackendsId), ";");
+    const auto threads_list =
+        ParseIntList(option_dict.Get<std::string>(kThreadsListId));
+    const auto minibatch_list =
+        ParseIntList(option_dict.Get<std::string>(kMinibatchListId));
+    const auto task_workers_list =
+        ParseIntList(option_dict.Get<std::string>(kTaskWorkersListId));
+    const int movetime = option_dict.Get<int>(kMovetimeId);
+    const std::vector<BenchmarkPosition> all_positions = Benchmark().positions;
+    const std::vector<BenchmarkPosition> positions(
+        all_positions.begin(),
+        all_positions.begin() + option_dict.Get<int>(kNumPositionsId));
+
+    std::vector<ScaleConfig> results;
+    for (const auto& backend : backends) {
+      OptionsDict backend_dict(&option_dict);
+      if (!backend.empty()) {
+        const auto colon = backend.find(':');
+        backend_dict.Set<std::string>(NetworkFactory::kBackendId,
+                                      backend.substr(0, colon));
+        if (colon != std::string::npos) {
+          backend_dict.Set<std::string>(NetworkFactory::kBackendOptionsId,
+                                        backend.substr(colon + 1));
+        }
+      }
+      UtilizationNetwork network(NetworkFactory::LoadNetwork(backend_dict));
+      for (const int threads : threads_list) {
+        for (const int minibatch : minibatch_list) {
+          for (const int task_workers : task_workers_list) {
+            ScaleConfig config{backend, threads, minibatch, task_workers};
+            OptionsDict search_dict(&backend_dict);
+            search_dict.Set<int>(SearchParams::kMiniBatchSizeId, minibatch);
+            search_dict.Set<int>(SearchParams::kTaskWorkersPerSearchWorkerId,
+                                 task_workers);
+            int64_t playouts = 0;
+            std::chrono::duration<double> time{0};
+            network.TakeBusyTime();
+            for (const auto& position : positions) {
+              auto stopper = std::make_unique<ChainedSearchStopper>();
+              stopper->AddStopper(std::make_unique<TimeLimitStopper>(movetime));
+              NNCache cache(option_dict.Get<int>(kNNCacheSizeId));
+              NodeTree tree;
+              tree.ResetToPosition(position.fen, {});
+              const auto start = std::chrono::steady_clock::now();
+              Search search(tree, &network,
+                            std::make_unique<CallbackUciResponder>(
+                                [](const BestMoveInfo&) {},
+                                [](const std::vector<ThinkingInfo>&) {}),
+                            MoveList(), start, std::move(stopper), false,
+                            false, search_dict, &cache, nullptr);
+              search.RunBlocking(threads);
+              time += std::chrono::steady_clock::now() - start;
+              playouts += search.GetTotalPlayouts();
+            }
+            config.nps = playouts / time.count();
+            config.utilization = network.TakeBusyTime() / time;
+            std::cout << FormatConfig(config) << ": " << std::lround(config.nps)
+                      << " nps, backend busy " << std::fixed
+                      << std::setprecision(1) << 100 * config.utilization
+                      << "%" << std::defaultfloat << std::endl;
+            results.push_back(config);
+          }
+        }
+      }
+    }
+
+    double best_nps = 0.0;
+    for (const auto& config : results) {
+      best_nps = std::max(best_nps, config.nps);
+    }
+    const ScaleConfig* recommended = nullptr;
+    for (const auto& config : results) {
+      if (config.nps < best_nps * (1.0f - kRecommendTolerance)) continue;
+      if (!recommended ||
+          std::tie(config.minibatch, config.threads) <
+              std::tie(recommended->minibatch, recommended->threads)) {
+        recommended = &config;
+      }
+    }
+    if (recommended) {
+      std::cout << "\nRecommended: " << FormatConfig(*recommended) << " ("
+                << std::lround(recommended->nps) << " nps)" << std::endl;
+    }
+  } catch (Exception& ex) {
+    std::cerr << ex.what() << std::endl;
+  }
+}
+
+}  // namespace lczero
@@ -33,6 +33,7 @@
 #include <vector>
 
 #include "utils/bititer.h"
+#include "utils/fixedvector.h"
 
 namespace lczero {
 
@@ -298,6 +299,11 @@ class Move {
 
 using MoveList = std::vector<Move>;
 
+// No position has more than 218 legal moves, pseudolegal ones get some room.
+constexpr int kMaxGeneratedMoves = 256;
+// Moves of a single position, as generated by ChessBoard.
+using FixedMoveList = FixedVector<Move, kMaxGeneratedMoves>;
+
 // Gets the move from the NN move index, undoing the given transform.
 Move MoveFromNNIndex(int idx, int transform);
 
@@ -29,9 +29,9 @@
 
 #include <algorithm>
 #include <cctype>
+#include <charconv>
 #include <cstdlib>
 #include <cstring>
-#include <sstream>
 
 #include "utils/exception.h"
 
@@ -41,6 +41,88 @@
 #endif
 
 namespace lczero {
+namespace {
+// Random keys for Zobrist hashing, from the white point of view.
+struct ZobristKeys {
+  // By color (white, black), piece (pawn, knight, bishop, rook, queen, king)
+  // and square.
+  uint64_t pieces[2][6][64];
+  // By castling rights bits, with white's in the lower two.
+  uint64_t castlings[16];
+  uint64_t en_passant[8];
+  uint64_t flipped;
+};
+
+constexpr ZobristKeys MakeZobristKeys() {
+  ZobristKeys keys{};
+  // SplitMix64.
+  uint64_t state = 0x9e3779b97f4a7c15ULL;
+  auto next = [&state]() {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  };
+  for (auto& color : keys.pieces) {
+    for (auto& piece : color) {
+      for (auto& square : piece) square = next();
+    }
+  }
+  // No castling rights must hash to 0, like an empty board.
+  for (int i = 1; i < 16; i++) keys.castlings[i] = next();
+  for (auto& file : keys.en_passant) file = next();
+  keys.flipped = next();
+  return keys;
+}
+
+// Constant initialized, so it's ready for kStartposBoard below.
+constexpr ZobristKeys kZobrist = MakeZobristKeys();
+
+enum ZobristPieceIndex { kPawn, kKnight, kBishop, kRook, kQueen, kKing };
+
+// First rank squares involved in castling with the king and the rook on given
+// files, which works the same for standard and Chess960 positions: the king
+// goes to C1 or G1, the rook to D1 or F1.
+struct CastlingPath {
+  // Squares which must be empty, apart from the king and the rook themselves.
+  uint64_t empty;
+  // Squares the king passes, apart from where it starts and ends, which must
+  // not be attacked.
+  uint64_t walk;
+  uint8_t king_dst;
+  uint8_t rook_dst;
+};
+
+constexpr uint64_t FirstRankSpan(int a, int b) {
+  uint64_t result = 0;
+  for (int i = std::min(a, b); i <= std::max(a, b); ++i) result |= 1ULL << i;
+  return result;
+}
+
+struct CastlingPaths {
+  // By king file and rook file.
+  CastlingPath paths[8][8];
+};
+
+constexpr CastlingPaths MakeCastlingPaths() {
+  CastlingPaths result{};
+  for (int king = 0; king < 8; ++king) {
+    for (int rook = 0; rook < 8; ++rook) {
+      if (king == rook) continue;
+      auto& path = result.paths[king][rook];
+      path.king_dst = rook > king ? ChessBoard::G1 : ChessBoard::C1;
+      path.rook_dst = rook > king ? ChessBoard::F1 : ChessBoard::D1;
+      const uint64_t king_span = FirstRankSpan(king, path.king_dst);
+      path.empty = (king_span | FirstRankSpan(rook, path.rook_dst)) &
+                   ~(1ULL << king) & ~(1ULL << rook);
+      path.walk = king_span & ~(1ULL << king) & ~(1ULL << path.king_dst);
+    }
+  }
+  return result;
+}
+
+constexpr CastlingPaths kCastlingPaths = MakeCastlingPaths();
+}  // namespace
 
 const char* ChessBoard::kStartposFen =
     "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
@@ -65,6 +147,68 @@ void ChessBoard::Mirror() {
   std::swap(our_king_, their_king_);
   castlings_.Mirror();
   flipped_ = !flipped_;
+  zobrist_ ^= kZobrist.flipped;
+}
+
+uint64_t ChessBoard::ZobristPiece(BoardSquare square) const {
+  int color;
+  if (our_pieces_.get(square)) {
+    color = flipped_;
+  } else if (their_pieces_.get(square)) {
+    color = !flipped_;
+  } else {
+    return 0;
+  }
+  int piece;
+  if (square == our_king_ || square == their_king_) {
+    piece = kKing;
+  } else if (pawns().get(square)) {
+    piece = kPawn;
+  } else if (rooks_.get(square)) {
+    piece = bishops_.get(square) ? kQueen : kRook;
+  } else if (bishops_.get(square)) {
+    piece = kBishop;
+  } else {
+    piece = kKnight;
+  }
+  // Mirroring flips the rank, which is the upper three bits.
+  return kZobrist.pieces[color][piece][square.as_int() ^ (flipped_ ? 56 : 0)];
+}
+
+uint64_t ChessBoard::ZobristEnPassant() const {
+  uint64_t key = 0;
+  for (auto square : en_passant()) key ^= kZobrist.en_passant[square.col()];
+  return key;
+}
+
+uint64_t ChessBoard::ZobristCastlings() const {
+  const int rights = castlings_.as_int();
+  return kZobrist.castlings[flipped_ ? ((rights & 0b11) << 2) | (rights >> 2)
+                                     : rights];
+}
+
+uint64_t ChessBoard::ComputeZobrist() const {
+  uint64_t key = ZobristEnPassant() ^ ZobristCastlings();
+  for (auto square : our_pieces_ | their_pieces_) key ^= ZobristPiece(square);
+  if (flipped_) key ^= kZobrist.flipped;
+  return key;
+}
+
+void ChessBoard::UpdateZobrist(const ChessBoard& before) {
+  // A castling king may land where its rook was, so the occupancy of a square
+  // doesn't tell whether its piece changed.
+  const BitBoard changed =
+      (our_pieces_.as_int() ^ before.our_pieces_.as_int()) |
+      (their_pieces_.as_int() ^ before.their_pieces_.as_int()) |
+      (rooks_.as_int() ^ before.rooks_.as_int()) |
+      (bishops_.as_int() ^ before.bishops_.as_int()) |
+      ((pawns_.as_int() ^ before.pawns_.as_int()) & kPawnMask.as_int()) |
+      our_king_.as_board() | before.our_king_.as_board();
+  for (auto square : changed) {
+    zobrist_ ^= before.ZobristPiece(square) ^ ZobristPiece(square);
+  }
+  zobrist_ ^= before.ZobristEnPassant() ^ ZobristEnPassant();
+  zobrist_ ^= before.ZobristCastlings() ^ ZobristCastlings();
 }
 
 namespace {
@@ -425,9 +569,8 @@ void InitializeMagicBitboards() {
                     kBishopDirections);
 }
 
-MoveList ChessBoard::GeneratePseudolegalMoves() const {
-  MoveList result;
-  result.reserve(60);
+FixedMoveList ChessBoard::GeneratePseudolegalMoves() const {
+  FixedMoveList result;
   for (auto source : our_pieces_) {
     // King
     if (source == our_king_) {
@@ -441,43 +584,21 @@ MoveList ChessBoard::GeneratePseudolegalMoves() const {
         result.emplace_back(source, destination);
       }
       // Castlings.
-      auto walk_free = [this](int from, int to, int rook, int king) {
-        for (int i = from; i <= to; ++i) {
-          if (i == rook || i == king) continue;
-          if (our_pieces_.get(i) || their_pieces_.get(i)) return false;
-        }
-        return true;
-      };
-      // @From may be less or greater than @to. @To is not included in check
-      // unless it is the same with @from.
-      auto range_attacked = [this](int from, int to) {
-        if (from == to) return IsUnderAttack(from);
-        const int increment = from < to ? 1 : -1;
-        while (from != to) {
-          if (IsUnderAttack(from)) return true;
-          from += increment;
-        }
-        return false;
-      };
-      const uint8_t king = source.col();
       // For castlings we don't check destination king square for checks, it
       // will be done in legal move check phase.
-      if (castlings_.we_can_000()) {
-        const uint8_t qrook = castlings_.our_queenside_rook();
-        if (walk_free(std::min(static_cast<uint8_t>(C1), qrook),
-                      std::max(static_cast<uint8_t>(D1), king), qrook, king) &&
-            !range_attacked(king, C1)) {
-          result.emplace_back(source, BoardSquare(RANK_1, qrook));
-        }
-      }
-      if (castlings_.we_can_00()) {
-        const uint8_t krook = castlings_.our_kingside_rook();
-        if (walk_free(std::min(static_cast<uint8_t>(F1), king),
-                      std::max(static_cast<uint8_t>(G1), krook), krook, king) &&
-            !range_attacked(king, G1)) {
-          result.emplace_back(source, BoardSquare(RANK_1, krook));
+      auto add_castling = [&](uint8_t rook) {
+        const auto& path = kCastlingPaths.paths[source.col()][rook];
+        if ((our_pieces_ | their_pieces_).intersects(path.empty)) return;
+        if (IsUnderAttack(source)) return;
+        for (auto square : BitBoard(path.walk)) {
+          if (IsUnderAttack(square)) return;
         }
+        result.emplace_back(source, BoardSquare(RANK_1, rook));
+      };
+      if (castlings_.we_can_000()) {
+        add_castling(castlings_.our_queenside_rook());
       }
+      if (castlings_.we_can_00()) add_castling(castlings_.our_kingside_rook());
       continue;
     }
     bool processed_piece = false;
@@ -567,6 +688,13 @@ MoveList ChessBoard::GeneratePseudolegalMoves() const {
 }  // namespace lczero
 
 bool ChessBoard::ApplyMove(Move move) {
+  const ChessBoard before = *this;
+  const bool reset_50_moves = ApplyMoveToPieces(move);
+  UpdateZobrist(before);
+  return reset_50_moves;
+}
+
+bool ChessBoard::ApplyMoveToPieces(Move move) {
   const auto& from = move.from();
   const auto& to = move.to();
   const auto from_row = from.row();
@@ -578,36 +706,28 @@ bool ChessBoard::ApplyMove(Move move) {
   if (from == our_king_) {
     castlings_.reset_we_can_00();
     castlings_.reset_we_can_000();
-    auto do_castling = [this](int king_dst, int rook_src, int rook_dst) {
-      // Remove en passant flags.
-      pawns_ &= kPawnMask;
-      our_pieces_.reset(our_king_);
-      our_pieces_.reset(rook_src);
-      rooks_.reset(rook_src);
-      our_pieces_.set(king_dst);
-      our_pieces_.set(rook_dst);
-      rooks_.set(rook_dst);
-      our_king_ = king_dst;
-    };
     if (from_row == RANK_1 && to_row == RANK_1) {
-      const auto our_rooks = rooks() & our_pieces_;
-      if (our_rooks.get(to)) {
-        // Castling.
-        if (to_col > from_col) {
-          // Kingside.
-          do_castling(G1, to.as_int(), F1);
-        } else {
-          // Queenside.
-          do_castling(C1, to.as_int(), D1);
-        }
-        return false;
+      // Castling is encoded as the king taking its own rook, or with the
+      // legacy e1g1 and e1c1 notation.
+      int rook = -1;
+      if (our_pieces_.get(to)) {
+        rook = to_col;
       } else if (from_col == FILE_E && to_col == FILE_G) {
-        // Non FRC-style e1g1 castling (as opposed to e1h1).
-        do_castling(G1, H1, F1);
-        return false;
+        rook = FILE_H;
       } else if (from_col == FILE_E && to_col == FILE_C) {
-        // Non FRC-style e1c1 castling (as opposed to e1a1).
-        do_castling(C1, A1, D1);
+        rook = FILE_A;
+      }
+      if (rook >= 0) {
+        const auto& path = kCastlingPaths.paths[from_col][rook];
+        // Remove en passant flags.
+        pawns_ &= kPawnMask;
+        our_pieces_.reset(from);
+        our_pieces_.reset(rook);
+        rooks_.reset(rook);
+        our_pieces_.set(path.king_dst);
+        our_pieces_.set(path.rook_dst);
+        rooks_.set(path.rook_dst);
+        our_king_ = path.king_dst;
         return false;
       }
     }
@@ -696,7 +816,7 @@ bool ChessBoard::ApplyMove(Move move) {
   return reset_50_moves;
 }
 
-bool ChessBoard::IsUnderAttack(BoardSquare square) const {
+bool ChessBoard::IsUnderAttack(BoardSquare square, BitBoard occupied) const {
   const int row = square.row();
   const int col = square.col();
   // Check king.
@@ -706,12 +826,11 @@ bool ChessBoard::IsUnderAttack(BoardSquare square) const {
     if (std::abs(krow - row) <= 1 && std::abs(kcol - col) <= 1) return true;
   }
   // Check rooks (and queens).
-  if (GetRookAttacks(square, our_pieces_ | their_pieces_)
-          .intersects(their_pieces_ & rooks_)) {
+  if (GetRookAttacks(square, occupied).intersects(their_pieces_ & rooks_)) {
     return true;
   }
   // Check bishops.
-  if (GetBishopAttacks(square, our_pieces_ | their_pieces_)
+  if (GetBishopAttacks(square, occupied)
           .intersects(their_pieces_ & bishops_)) {
     return true;
   }
@@ -959,50 +1078,201 @@ bool ChessBoard::IsLegalMove(Move move,
   }
 }
 
-MoveList ChessBoard::GenerateLegalMoves() const {
+FixedMoveList ChessBoard::GenerateLegalMoves() const {
   const KingAttackInfo king_attack_info = GenerateKingAttackInfo();
-  MoveList result = GeneratePseudolegalMoves();
-  result.erase(
-      std::remove_if(result.begin(), result.end(),
-                     [&](Move m) { return !IsLegalMove(m, king_attack_info); }),
-      result.end());
+  const BitBoard occupied = our_pieces_ | their_pieces_;
+  // Squares pieces other than the king may move to: any but ours, or when in
+  // check, the checking piece and the squares between it and the king.
+  BitBoard target = BitBoard(~0ULL) - our_pieces_;
+  if (king_attack_info.in_check()) target = king_attack_info.attack_lines_;
+  // The line a pinned piece must stay on, between the king and the pinner.
+  auto pin_line = [&](BoardSquare source) {
+    if (kRookAttacks[our_king_.as_int()].get(source)) {
+      return GetRookAttacks(source, occupied) &
+             kRookAttacks[our_king_.as_int()];
+    }
+    return GetBishopAttacks(source, occupied) &
+           kBishopAttacks[our_king_.as_int()];
+  };
+  FixedMoveList result;
+  for (auto source : our_pieces_) {
+    // King. Its square doesn't block attacks on the squares it moves to.
+    if (source == our_king_) {
+      const BitBoard without_king = occupied - our_king_;
+      for (const auto& delta : kKingMoves) {
+        const auto dst_row = source.row() + delta.first;
+        const auto dst_col = source.col() + delta.second;
+        if (!BoardSquare::IsValid(dst_row, dst_col)) continue;
+        const BoardSquare destination(dst_row, dst_col);
+        if (our_pieces_.get(destination)) continue;
+        if (IsUnderAttack(destination, without_king)) continue;
+        result.emplace_back(source, destination);
+      }
+      if (king_attack_info.in_check()) continue;
+      // Castlings.
+      // The walk is checked with the king still in place, and the destination
+      // with the castled rook in place.
+      auto add_castling = [&](uint8_t rook) {
+        const auto& path = kCastlingPaths.paths[source.col()][rook];
+        if (occupied.intersects(path.empty)) return;
+        for (auto square : BitBoard(path.walk)) {
+          if (IsUnderAttack(square)) return;
+        }
+        BitBoard castled = occupied - our_king_ - BoardSquare(RANK_1, rook);
+        castled.set(path.king_dst);
+        castled.set(path.rook_dst);
+        if (IsUnderAttack(path.king_dst, castled)) return;
+        result.emplace_back(source, BoardSquare(RANK_1, rook));
+      };
+      if (castlings_.we_can_000()) {
+        add_castling(castlings_.our_queenside_rook());
+      }
+      if (castlings_.we_can_00()) add_castling(castlings_.our_kingside_rook());
+      continue;
+    }
+    // Only the king moves out of a double check.
+    if (king_attack_info.in_double_check()) continue;
+    const BitBoard allowed = king_attack_info.is_pinned(source)
+                                 ? target & pin_line(source)
+                                 : target;
+    bool processed_piece = false;
+    // Rook (and queen)
+    if (rooks_.get(source)) {
+      processed_piece = true;
+      for (const auto& destination :
+           GetRookAttacks(source, occupied) & allowed) {
+        result.emplace_back(source, destination);
+      }
+    }
+    // Bishop (and queen)
+    if (bishops_.get(source)) {
+      processed_piece = true;
+      for (const auto& destination :
+           GetBishopAttacks(source, occupied) & allowed) {
+        result.emplace_back(source, destination);
+      }
+    }
+    if (processed_piece) continue;
+    // Pawns.
+    if ((pawns_ & kPawnMask).get(source)) {
+      // Moves forward.
+      {
+        const auto dst_row = source.row() + 1;
+        const auto dst_col = source.col();
+        const BoardSquare destination(dst_row, dst_col);
+
+        if (!occupied.get(destination)) {
+          if (dst_row != RANK_8) {
+            if (allowed.get(destination)) {
+              result.emplace_back(source, destination);
+            }
+            if (dst_row == RANK_3) {
+              // Maybe it'll be possible to move two squares.
+              const BoardSquare double_push(RANK_4, dst_col);
+              if (!occupied.get(double_push) && allowed.get(double_push)) {
+                result.emplace_back(source, double_push);
+              }
+            }
+          } else if (allowed.get(destination)) {
+            // Promotions
+            for (auto promotion : kPromotions) {
+              result.emplace_back(source, destination, promotion);
+            }
+          }
+        }
+      }
+      // Captures.
+      {
+        for (auto direction : {-1, 1}) {
+          const auto dst_row = source.row() + 1;
+          const auto dst_col = source.col() + direction;
+          if (dst_col < 0 || dst_col >= 8) continue;
+          const BoardSquare destination(dst_row, dst_col);
+          if (their_pieces_.get(destination)) {
+            if (!allowed.get(destination)) continue;
+            if (dst_row == RANK_8) {
+              // Promotion.
+              for (auto promotion : kPromotions) {
+                result.emplace_back(source, destination, promotion);
+              }
+            } else {
+              // Ordinary capture.
+              result.emplace_back(source, destination);
+            }
+          } else if (dst_row == RANK_6 && pawns_.get(RANK_8, dst_col)) {
+            // En passant. Complex but rare, as two pawns leave the rank, so
+            // just apply it and check that we are not under check.
+            const Move move(source, destination);
+            ChessBoard board(*this);
+            board.ApplyMoveToPieces(move);
+            if (!board.IsUnderCheck()) result.push_back(move);
+          }
+        }
+      }
+      continue;
+    }
+    // Knight. Pinned knights never stay on the line.
+    for (const auto destination : kKnightAttacks[source.as_int()] & allowed) {
+      result.emplace_back(source, destination);
+    }
+  }
   return result;
 }
 
-void ChessBoard::SetFromFen(std::string fen, int* rule50_ply, int* moves) {
+namespace {
+bool IsFenSpace(char c) { return std::isspace(static_cast<unsigned char>(c)); }
+
+// Returns the next space separated field of @fen after @pos, or an empty one
+// at the end of it, and moves @pos past it.
+std::string_view NextFenField(std::string_view fen, size_t* pos) {
+  while (*pos < fen.size() && IsFenSpace(fen[*pos])) ++*pos;
+  const size_t start = *pos;
+  while (*pos < fen.size() && !IsFenSpace(fen[*pos])) ++*pos;
+  return fen.substr(start, *pos - start);
+}
+}  // namespace
+
+void ChessBoard::SetFromFen(std::string_view fen, int* rule50_ply,
+                            int* moves) {
   Clear();
   int row = 7;
   int col = 0;
 
-  // Remove any trailing whitespaces to detect eof after the last field.
-  fen.erase(std::find_if(fen.rbegin(), fen.rend(),
-                         [](char c) { return !std::isspace(c); })
-                .base(),
-            fen.end());
-
-  std::istringstream fen_str(fen);
-  std::string board;
-  fen_str >> board;
-  std::string who_to_move = "w";
-  if (!fen_str.eof()) fen_str >> who_to_move;
+  auto bad_fen = [fen](const char* reason = "") {
+    return Exception(std::string("Bad fen string") + reason + ": " +
+                     std::string(fen));
+  };
+  auto parse_number = [&bad_fen](std::string_view field, int* value) {
+    if (field.empty()) return;
+    const auto result =
+        std::from_chars(field.data(), field.data() + field.size(), *value);
+    if (result.ec != std::errc() || result.ptr != field.data() + field.size()) {
+      throw bad_fen();
+    }
+  };
+
+  size_t pos = 0;
+  const std::string_view board = NextFenField(fen, &pos);
+  if (board.empty()) throw bad_fen();
+  std::string_view who_to_move = NextFenField(fen, &pos);
+  if (who_to_move.empty()) who_to_move = "w";
   // Assume no castling rights. Other engines, e.g., Stockfish, assume kings and
   // rooks on their initial rows can each castle with the outer-most rook.  Our
   // implementation currently supports 960 castling where white and black rooks
   // have matching columns, so it's unclear which rights to assume.
-  std::string castlings = "-";
-  if (!fen_str.eof()) fen_str >> castlings;
-  std::string en_passant = "-";
-  if (!fen_str.eof()) fen_str >> en_passant;
+  std::string_view castlings = NextFenField(fen, &pos);
+  if (castlings.empty()) castlings = "-";
+  std::string_view en_passant = NextFenField(fen, &pos);
+  if (en_passant.empty()) en_passant = "-";
   int rule50_halfmoves = 0;
-  if (!fen_str.eof()) fen_str >> rule50_halfmoves;
+  parse_number(NextFenField(fen, &pos), &rule50_halfmoves);
   int total_moves = 1;
-  if (!fen_str.eof()) fen_str >> total_moves;
-  if (!fen_str) throw Exception("Bad fen string: " + fen);
+  parse_number(NextFenField(fen, &pos), &total_moves);
 
   for (char c : board) {
     if (c == '/') {
       --row;
-      if (row < 0) throw Exception("Bad fen string (too many rows): " + fen);
+      if (row < 0) throw bad_fen(" (too many rows)");
       col = 0;
       continue;
     }
@@ -1010,7 +1280,7 @@ void ChessBoard::SetFromFen(std::string fen, int* rule50_ply, int* moves) {
       col += c - '0';
       continue;
     }
-    if (col >= 8) throw Exception("Bad fen string (too many columns): " + fen);
+    if (col >= 8) throw bad_fen(" (too many columns)");
 
     if (std::isupper(c)) {
       // White piece.
@@ -1033,13 +1303,13 @@ void ChessBoard::SetFromFen(std::string fen, int* rule50_ply, int* moves) {
       bishops_.set(row, col);
     } else if (c == 'P' || c == 'p') {
       if (row == 7 || row == 0) {
-        throw Exception("Bad fen string (pawn in first/last row): " + fen);
+        throw bad_fen(" (pawn in first/last row)");
       }
       pawns_.set(row, col);
     } else if (c == 'N' || c == 'n') {
       // Do nothing
     } else {
-      throw Exception("Bad fen string: " + fen);
+      throw bad_fen();
     }
     ++col;
   }
@@ -1054,14 +1324,14 @@ void ChessBoard::SetFromFen(std::string fen, int* rule50_ply, int* moves) {
       const int king_col = (is_black ? their_king_ : our_king_).col();
       const auto rooks =
           (is_black ? their_pieces_ : our_pieces_) & ChessBoard::rooks();
-      auto find_rook = [rooks, king_col, fen](bool forward, uint8_t rank) {
+      auto find_rook = [rooks, king_col, &bad_fen](bool forward, uint8_t rank) {
         uint8_t rook;
         for (rook = forward ? FILE_A : FILE_H; rook != king_col;
              rook += 2 * forward - 1) {
           if (rooks.get(rank, rook)) break;
         }
         if (rook == king_col) {
-          throw Exception("Bad fen string (missing rook): " + fen);
+          throw bad_fen(" (missing rook)");
         }
         return rook;
       };
@@ -1100,7 +1370,7 @@ void ChessBoard::SetFromFen(std::string fen, int* rule50_ply, int* moves) {
           castlings_.set_they_can_00();
         }
       } else {
-        throw Exception("Bad fen string (unexpected casting symbol): " + fen);
+        throw bad_fen(" (unexpected casting symbol)");
       }
     }
     castlings_.SetRookPositions(our_left_rook, our_right_rook, their_left_rook,
@@ -1108,16 +1378,18 @@ void ChessBoard::SetFromFen(std::string fen, int* rule50_ply, int* moves) {
   }
 
   if (en_passant != "-") {
-    auto square = BoardSquare(en_passant);
-    if (square.row() != RANK_3 && square.row() != RANK_6)
-      throw Exception("Bad fen string: " + fen + " wrong en passant rank");
-    pawns_.set((square.row() == RANK_3) ? RANK_1 : RANK_8, square.col());
+    if (en_passant.size() != 2 || en_passant[0] < 'a' || en_passant[0] > 'h' ||
+        (en_passant[1] != '3' && en_passant[1] != '6')) {
+      throw bad_fen(" (wrong en passant square)");
+    }
+    pawns_.set(en_passant[1] == '3' ? RANK_1 : RANK_8, en_passant[0] - 'a');
   }
 
+  zobrist_ = ComputeZobrist();
   if (who_to_move == "b" || who_to_move == "B") {
     Mirror();
   } else if (who_to_move != "w" && who_to_move != "W") {
-    throw Exception("Bad fen string (side to move): " + fen);
+    throw bad_fen(" (side to move)");
   }
   if (rule50_ply) *rule50_ply = rule50_halfmoves;
   if (moves) *moves = total_moves;
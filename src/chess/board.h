@@ -29,6 +29,7 @@
 
 #include <cassert>
 #include <string>
+#include <string_view>
 
 #include "chess/bitboard.h"
 #include "utils/hashcat.h"
@@ -72,8 +73,8 @@ class ChessBoard {
   // Sets position from FEN string.
   // If @rule50_ply and @moves are not nullptr, they are filled with number
   // of moves without capture and number of full moves since the beginning of
-  // the game.
-  void SetFromFen(std::string fen, int* rule50_ply = nullptr,
+  // the game. Doesn't allocate unless the string is bad, which throws.
+  void SetFromFen(std::string_view fen, int* rule50_ply = nullptr,
                   int* moves = nullptr);
   // Nullifies the whole structure.
   void Clear();
@@ -84,12 +85,16 @@ class ChessBoard {
 
   // Generates list of possible moves for "ours" (white), but may leave king
   // under check.
-  MoveList GeneratePseudolegalMoves() const;
+  FixedMoveList GeneratePseudolegalMoves() const;
   // Applies the move. (Only for "ours" (white)). Returns true if 50 moves
   // counter should be removed.
   bool ApplyMove(Move move);
   // Checks if the square is under attack from "theirs" (black).
-  bool IsUnderAttack(BoardSquare square) const;
+  bool IsUnderAttack(BoardSquare square) const {
+    return IsUnderAttack(square, our_pieces_ | their_pieces_);
+  }
+  // Same, with the pieces blocking attacks given by @occupied.
+  bool IsUnderAttack(BoardSquare square, BitBoard occupied) const;
   // Generates the king attack info used for legal move detection.
   KingAttackInfo GenerateKingAttackInfo() const;
   // Checks if "our" (white) king is under check.
@@ -98,7 +103,7 @@ class ChessBoard {
   // Checks whether at least one of the sides has mating material.
   bool HasMatingMaterial() const;
   // Generates legal moves.
-  MoveList GenerateLegalMoves() const;
+  FixedMoveList GenerateLegalMoves() const;
   // Check whether pseudolegal move is legal.
   bool IsLegalMove(Move move, const KingAttackInfo& king_attack_info) const;
   // Returns whether two moves are actually the same move in the position.
@@ -108,14 +113,8 @@ class ChessBoard {
   // Returns the same move but with castling encoded in modern way.
   Move GetModernMove(Move move) const;
 
-  uint64_t Hash() const {
-    return HashCat({our_pieces_.as_int(), their_pieces_.as_int(),
-                    rooks_.as_int(), bishops_.as_int(), pawns_.as_int(),
-                    (static_cast<uint32_t>(our_king_.as_int()) << 24) |
-                        (static_cast<uint32_t>(their_king_.as_int()) << 16) |
-                        (static_cast<uint32_t>(castlings_.as_int()) << 8) |
-                        static_cast<uint32_t>(flipped_)});
-  }
+  // Zobrist key of the board, kept up to date by ApplyMove() and Mirror().
+  uint64_t Hash() const { return zobrist_; }
 
   class Castlings {
    public:
@@ -241,8 +240,10 @@ class ChessBoard {
   const Castlings& castlings() const { return castlings_; }
   bool flipped() const { return flipped_; }
 
+  // Equal boards have equal hashes, so comparing those first is a cheap way to
+  // tell most different boards apart.
   bool operator==(const ChessBoard& other) const {
-    return (our_pieces_ == other.our_pieces_) &&
+    return zobrist_ == other.zobrist_ && (our_pieces_ == other.our_pieces_) &&
            (their_pieces_ == other.their_pieces_) && (rooks_ == other.rooks_) &&
            (bishops_ == other.bishops_) && (pawns_ == other.pawns_) &&
            (our_king_ == other.our_king_) &&
@@ -278,6 +279,19 @@ class ChessBoard {
   };
 
  private:
+  // Moves pieces for ApplyMove(), without updating the Zobrist key.
+  bool ApplyMoveToPieces(Move move);
+  // Zobrist key parts of the piece on @square (0 if it's empty), of the en
+  // passant flags and of the castling rights. Keys are for the board as seen
+  // by white, so that Mirror() only has to toggle the side to move.
+  uint64_t ZobristPiece(BoardSquare square) const;
+  uint64_t ZobristEnPassant() const;
+  uint64_t ZobristCastlings() const;
+  // Computes the Zobrist key from scratch.
+  uint64_t ComputeZobrist() const;
+  // Updates the Zobrist key for the squares that differ from @before.
+  void UpdateZobrist(const ChessBoard& before);
+
   // All white pieces.
   BitBoard our_pieces_;
   // All black pieces.
@@ -296,6 +310,8 @@ class ChessBoard {
   BoardSquare their_king_;
   Castlings castlings_;
   bool flipped_ = false;  // aka "Black to move".
+  // Of an empty board with white to move is 0.
+  uint64_t zobrist_ = 0;
 };
 
 }  // namespace lczero
@@ -0,0 +1,146 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "chess/epd.h"
+
+#include <algorithm>
+#include <cctype>
+#include <exception>
+#include <thread>
+
+#include "utils/exception.h"
+#include "utils/files.h"
+
+namespace lczero {
+namespace {
+
+bool IsSpace(char c) { return std::isspace(static_cast<unsigned char>(c)); }
+
+bool IsNumber(std::string_view field) {
+  return !field.empty() && std::all_of(field.begin(), field.end(), [](char c) {
+    return std::isdigit(static_cast<unsigned char>(c));
+  });
+}
+
+struct ParsedChunk {
+  std::vector<Position> positions;
+  // Offset of the first bad line, with its error.
+  size_t error_offset = std::string_view::npos;
+  std::exception_ptr error;
+};
+
+// Parses the lines starting in [@begin, @end) of @text.
+void ParseChunk(std::string_view text, size_t begin, size_t end,
+                ParsedChunk* chunk) {
+  while (begin < end) {
+    size_t line_end = text.find('\n', begin);
+    if (line_end == std::string_view::npos) line_end = text.size();
+    const std::string_view line = text.substr(begin, line_end - begin);
+    const size_t offset = begin;
+    begin = line_end + 1;
+    const auto first = std::find_if_not(line.begin(), line.end(), IsSpace);
+    if (first == line.end() || *first == '#') continue;
+    try {
+      chunk->positions.push_back(ParseEpdPosition(line));
+    } catch (const Exception&) {
+      chunk->error_offset = offset;
+      chunk->error = std::current_exception();
+      return;
+    }
+  }
+}
+
+}  // namespace
+
+Position ParseEpdPosition(std::string_view line) {
+  // Keeps the four position fields and up to two move counters.
+  size_t pos = 0;
+  size_t fen_end = 0;
+  for (int field = 0; field < 6; ++field) {
+    while (pos < line.size() && IsSpace(line[pos])) ++pos;
+    const size_t start = pos;
+    while (pos < line.size() && !IsSpace(line[pos])) ++pos;
+    if (start == pos) break;
+    if (field >= 4 && !IsNumber(line.substr(start, pos - start))) break;
+    fen_end = pos;
+  }
+  ChessBoard board;
+  int rule50_ply;
+  int full_moves;
+  board.SetFromFen(line.substr(0, fen_end), &rule50_ply, &full_moves);
+  return Position(board, rule50_ply,
+                  full_moves * 2 - (board.flipped() ? 1 : 2));
+}
+
+std::vector<Position> ParseEpd(std::string_view text, int threads) {
+  // Chunks of about equal size, each starting at a line start.
+  threads = std::max(1, threads);
+  std::vector<size_t> starts{0};
+  for (int i = 1; i < threads; ++i) {
+    size_t start = std::max(starts.back(), text.size() * i / threads);
+    if (start > 0) start = text.find('\n', start - 1);
+    start = start == std::string_view::npos ? text.size() : start + 1;
+    starts.push_back(std::min(start, text.size()));
+  }
+  starts.push_back(text.size());
+
+  std::vector<ParsedChunk> chunks(threads);
+  std::vector<std::thread> workers;
+  for (int i = 1; i < threads; ++i) {
+    workers.emplace_back(ParseChunk, text, starts[i], starts[i + 1],
+                         &chunks[i]);
+  }
+  ParseChunk(text, starts[0], starts[1], &chunks[0]);
+  for (auto& worker : workers) worker.join();
+
+  size_t total = 0;
+  for (const auto& chunk : chunks) {
+    if (chunk.error) {
+      const auto line =
+          std::count(text.begin(), text.begin() + chunk.error_offset, '\n') + 1;
+      try {
+        std::rethrow_exception(chunk.error);
+      } catch (const Exception& e) {
+        throw Exception("Line " + std::to_string(line) + ": " + e.what());
+      }
+    }
+    total += chunk.positions.size();
+  }
+  std::vector<Position> result;
+  result.reserve(total);
+  for (auto& chunk : chunks) {
+    result.insert(result.end(), chunk.positions.begin(),
+                  chunk.positions.end());
+  }
+  return result;
+}
+
+std::vector<Position> ReadEpdFile(const std::string& filename, int threads) {
+  return ParseEpd(ReadFileToString(filename), threads);
+}
+
+}  // namespace lczero
@@ -0,0 +1,54 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "chess/position.h"
+
+namespace lczero {
+
+// Parses a FEN, or the position of an EPD line, whose operations after the
+// four position fields are ignored. Move counters following them are read
+// like in a FEN. Throws Exception if the position is bad.
+Position ParseEpdPosition(std::string_view line);
+
+// Parses one position per line of @text, skipping empty lines and lines
+// starting with '#'. Lines are split between @threads threads, and positions
+// are returned in the order of the lines. Throws Exception naming the first
+// bad line.
+std::vector<Position> ParseEpd(std::string_view text, int threads = 1);
+
+// Like ParseEpd() for the contents of a (possibly gzipped) file. Throws
+// Exception if it can't be read.
+std::vector<Position> ReadEpdFile(const std::string& filename,
+                                  int threads = 1);
+
+}  // namespace lczero
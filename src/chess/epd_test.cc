@@ -0,0 +1,91 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "chess/epd.h"
+
+#include <gtest/gtest.h>
+
+#include "utils/exception.h"
+
+namespace lczero {
+
+TEST(Epd, ParsesFenAndEpdLines) {
+  const auto fen = ParseEpdPosition(
+      "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R b KQkq e3 5 9");
+  EXPECT_TRUE(fen.IsBlackToMove());
+  EXPECT_EQ(fen.GetRule50Ply(), 5);
+  EXPECT_EQ(fen.GetGamePly(), 17);
+  EXPECT_EQ(GetFen(fen),
+            "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R b KQkq e3 "
+            "5 9");
+
+  const auto epd = ParseEpdPosition(
+      "rnbqkbnr/pp1ppppp/8/2p5/4P3/8/PPPP1PPP/RNBQKBNR w KQkq c6 bm Nf3; "
+      "id \"test\";");
+  EXPECT_FALSE(epd.IsBlackToMove());
+  EXPECT_EQ(epd.GetRule50Ply(), 0);
+  EXPECT_EQ(epd.GetGamePly(), 0);
+  EXPECT_EQ(GetFen(epd),
+            "rnbqkbnr/pp1ppppp/8/2p5/4P3/8/PPPP1PPP/RNBQKBNR w KQkq c6 0 1");
+}
+
+TEST(Epd, ParsesLinesInOrderWithThreads) {
+  std::string text = "# Comment\n\n";
+  std::vector<std::string> fens;
+  for (int i = 0; i < 50; ++i) {
+    fens.push_back("8/8/8/8/8/8/8/K1k5 w - - " + std::to_string(i) + " " +
+                   std::to_string(i + 1));
+    text += fens.back() + " ; extra\n";
+  }
+  for (int threads : {1, 3, 16, 200}) {
+    const auto positions = ParseEpd(text, threads);
+    ASSERT_EQ(positions.size(), fens.size());
+    for (size_t i = 0; i < fens.size(); ++i) {
+      EXPECT_EQ(GetFen(positions[i]), fens[i]);
+    }
+  }
+}
+
+TEST(Epd, ReportsBadLine) {
+  const std::string text =
+      "8/8/8/8/8/8/8/K1k5 w - - 0 1\n"
+      "8/8/8/8/8/8/8/K1k5 x - - 0 1\n";
+  try {
+    ParseEpd(text, 2);
+    FAIL() << "Expected an exception";
+  } catch (const Exception& e) {
+    EXPECT_EQ(std::string(e.what()).rfind("Line 2: ", 0), 0u) << e.what();
+  }
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  lczero::InitializeMagicBitboards();
+  return RUN_ALL_TESTS();
+}
@@ -110,6 +110,8 @@ GameResult PositionHistory::ComputeGameResult() const {
 
 void PositionHistory::Reset(const ChessBoard& board, int rule50_ply,
                             int game_ply) {
+  shared_.reset();
+  shared_length_ = 0;
   positions_.clear();
   positions_.emplace_back(board, rule50_ply, game_ply);
 }
@@ -124,16 +126,39 @@ void PositionHistory::Append(Move m) {
   positions_.back().SetRepetitions(repetitions, cycle_length);
 }
 
+void PositionHistory::Append(Move m, RepetitionTable* repetitions) {
+  positions_.push_back(Position(Last(), m));
+  int cycle_length;
+  const int count = repetitions->Add(*this, &cycle_length);
+  positions_.back().SetRepetitions(count, cycle_length);
+}
+
+PositionHistory PositionHistory::Shared() const {
+  PositionHistory result;
+  if (positions_.empty()) {
+    result.shared_ = shared_;
+  } else {
+    auto positions = std::make_shared<std::vector<Position>>();
+    positions->reserve(GetLength());
+    for (int i = 0; i < GetLength(); ++i) {
+      positions->push_back(GetPositionAt(i));
+    }
+    result.shared_ = std::move(positions);
+  }
+  result.shared_length_ = GetLength();
+  return result;
+}
+
 int PositionHistory::ComputeLastMoveRepetitions(int* cycle_length) const {
   *cycle_length = 0;
-  const auto& last = positions_.back();
-  // TODO(crem) implement hash/cache based solution.
+  const auto& last = Last();
+  // Board comparisons start with the Zobrist keys, so most are cheap.
   if (last.GetRule50Ply() < 4) return 0;
 
-  for (int idx = positions_.size() - 3; idx >= 0; idx -= 2) {
-    const auto& pos = positions_[idx];
+  for (int idx = GetLength() - 3; idx >= 0; idx -= 2) {
+    const auto& pos = GetPositionAt(idx);
     if (pos.GetBoard() == last.GetBoard()) {
-      *cycle_length = positions_.size() - 1 - idx;
+      *cycle_length = GetLength() - 1 - idx;
       return 1 + pos.GetRepetitions();
     }
     if (pos.GetRule50Ply() < 2) return 0;
@@ -142,24 +167,71 @@ int PositionHistory::ComputeLastMoveRepetitions(int* cycle_length) const {
 }
 
 bool PositionHistory::DidRepeatSinceLastZeroingMove() const {
-  for (auto iter = positions_.rbegin(), end = positions_.rend(); iter != end;
-       ++iter) {
-    if (iter->GetRepetitions() > 0) return true;
-    if (iter->GetRule50Ply() == 0) return false;
+  for (int idx = GetLength() - 1; idx >= 0; --idx) {
+    const auto& pos = GetPositionAt(idx);
+    if (pos.GetRepetitions() > 0) return true;
+    if (pos.GetRule50Ply() == 0) return false;
   }
   return false;
 }
 
 uint64_t PositionHistory::HashLast(int positions) const {
   uint64_t hash = positions;
-  for (auto iter = positions_.rbegin(), end = positions_.rend(); iter != end;
-       ++iter) {
+  for (int idx = GetLength() - 1; idx >= 0; --idx) {
     if (!positions--) break;
-    hash = HashCat(hash, iter->Hash());
+    hash = HashCat(hash, GetPositionAt(idx).Hash());
   }
   return HashCat(hash, Last().GetRule50Ply());
 }
 
+void RepetitionTable::Reset(const PositionHistory& history) {
+  Trim(0);
+  for (int idx = 0; idx < history.GetLength(); ++idx) {
+    Push(history.GetPositionAt(idx).GetBoard().Hash());
+  }
+}
+
+void RepetitionTable::Trim(int size) {
+  for (int idx = GetLength() - 1; idx >= size; --idx) {
+    heads_[keys_[idx] % kBuckets] = previous_[idx];
+    keys_.pop_back();
+    previous_.pop_back();
+  }
+}
+
+void RepetitionTable::Push(uint64_t key) {
+  int& head = heads_[key % kBuckets];
+  previous_.push_back(head);
+  head = keys_.size();
+  keys_.push_back(key);
+}
+
+int RepetitionTable::Add(const PositionHistory& history, int* cycle_length) {
+  assert(GetLength() == history.GetLength() - 1);
+  *cycle_length = 0;
+  const auto& last = history.Last();
+  const uint64_t key = last.GetBoard().Hash();
+  const int last_idx = GetLength();
+  int repetitions = 0;
+  if (last.GetRule50Ply() >= 4) {
+    // Walks the bucket from the most recent position back to the last zeroing
+    // move, like ComputeLastMoveRepetitions() walks the history.
+    for (int idx = heads_[key % kBuckets];
+         idx >= 0 && last_idx - idx <= last.GetRule50Ply();
+         idx = previous_[idx]) {
+      if (keys_[idx] != key || (last_idx - idx) % 2 != 0) continue;
+      const auto& pos = history.GetPositionAt(idx);
+      if (pos.GetBoard() == last.GetBoard()) {
+        *cycle_length = last_idx - idx;
+        repetitions = 1 + pos.GetRepetitions();
+        break;
+      }
+    }
+  }
+  Push(key);
+  return repetitions;
+}
+
 std::string GetFen(const Position& pos) {
   std::string result;
   const ChessBoard& board = pos.GetWhiteBoard();
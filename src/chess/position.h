@@ -27,7 +27,10 @@
 
 #pragma once
 
+#include <array>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "chess/board.h"
 
@@ -96,6 +99,8 @@ std::string GetFen(const Position& pos);
 enum class GameResult : uint8_t { UNDECIDED, BLACK_WON, DRAW, WHITE_WON };
 GameResult operator-(const GameResult& res);
 
+class RepetitionTable;
+
 class PositionHistory {
  public:
   PositionHistory() = default;
@@ -106,34 +111,57 @@ class PositionHistory {
   PositionHistory& operator=(PositionHistory&& other) = default;  
 
   // Returns first position of the game (or fen from which it was initialized).
-  const Position& Starting() const { return positions_.front(); }
+  const Position& Starting() const { return GetPositionAt(0); }
 
   // Returns the latest position of the game.
-  const Position& Last() const { return positions_.back(); }
+  const Position& Last() const {
+    return positions_.empty() ? (*shared_)[shared_length_ - 1]
+                              : positions_.back();
+  }
 
   // N-th position of the game, 0-based.
-  const Position& GetPositionAt(int idx) const { return positions_[idx]; }
+  const Position& GetPositionAt(int idx) const {
+    return idx < shared_length_ ? (*shared_)[idx]
+                                : positions_[idx - shared_length_];
+  }
 
   // Trims position to a given size.
   void Trim(int size) {
-    positions_.erase(positions_.begin() + size, positions_.end());
+    if (size <= shared_length_) {
+      positions_.clear();
+      shared_length_ = size;
+    } else {
+      positions_.erase(positions_.begin() + (size - shared_length_),
+                       positions_.end());
+    }
   }
 
   // Can be used to reduce allocation cost while performing a sequence of moves
   // in succession.
-  void Reserve(int size) { positions_.reserve(size); }
+  void Reserve(int size) {
+    if (size > shared_length_) positions_.reserve(size - shared_length_);
+  }
 
   // Number of positions in history.
-  int GetLength() const { return positions_.size(); }
+  int GetLength() const { return shared_length_ + positions_.size(); }
 
   // Resets the position to a given state.
   void Reset(const ChessBoard& board, int rule50_ply, int game_ply);
 
   // Appends a position to history.
   void Append(Move m);
+  // Like Append(), finding the repetitions of the position with @repetitions,
+  // which must index the rest of this history.
+  void Append(Move m, RepetitionTable* repetitions);
 
   // Pops last move from history.
-  void Pop() { positions_.pop_back(); }
+  void Pop() { Trim(GetLength() - 1); }
+
+  // Returns a copy of this history whose positions are kept read-only in
+  // storage shared by all copies of it. Copying the result, or trimming a copy
+  // back to any length not longer than it, doesn't copy any positions; only
+  // positions appended afterwards are owned by each copy.
+  PositionHistory Shared() const;
 
   // Finds the endgame state (win/lose/draw/nothing) for the last position.
   GameResult ComputeGameResult() const;
@@ -150,7 +178,44 @@ class PositionHistory {
  private:
   int ComputeLastMoveRepetitions(int* cycle_length) const;
 
+  // Read-only prefix of the history, of which first shared_length_ positions
+  // are used.
+  std::shared_ptr<const std::vector<Position>> shared_;
+  int shared_length_ = 0;
+  // Positions following the shared prefix.
   std::vector<Position> positions_;
 };
 
+// Index of the positions of a history by their hash, which finds the
+// repetitions of an appended position in constant time rather than comparing
+// it with every position since the last zeroing move. Suits histories which
+// grow and shrink at their end, like the path of a search: trim the table along
+// with the history, and append to the history through the table.
+class RepetitionTable {
+ public:
+  RepetitionTable() { heads_.fill(-1); }
+
+  // Indexes the positions of @history, forgetting the previous ones.
+  void Reset(const PositionHistory& history);
+  // Number of positions indexed.
+  int GetLength() const { return keys_.size(); }
+  // Forgets the positions from @size on.
+  void Trim(int size);
+  // Indexes the last position of @history, which is one longer than the
+  // table. Returns its repetitions, and sets @cycle_length to the plies since
+  // the previous one.
+  int Add(const PositionHistory& history, int* cycle_length);
+
+ private:
+  static constexpr int kBuckets = 1024;
+  void Push(uint64_t key);
+
+  // Hash of the board of each position.
+  std::vector<uint64_t> keys_;
+  // Previous position in the same bucket, or -1.
+  std::vector<int> previous_;
+  // Last position in each bucket, or -1.
+  std::array<int, kBuckets> heads_;
+};
+
 }  // namespace lczero
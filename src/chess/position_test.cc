@@ -56,6 +56,31 @@ TEST(Position, SetFenGetFen) {
   }
 }
 
+TEST(Position, IncrementalHashMatchesFen) {
+  const std::vector<std::string> fens = {
+      ChessBoard::kStartposFen,
+      "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 1 1",
+      "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1",
+      "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+      // Chess960, with rooks next to the king.
+      "1rkr4/pppppppp/8/8/8/8/PPPPPPPP/1RKR4 w DBdb - 0 1"};
+  uint32_t seed = 1;
+  for (const auto& fen : fens) {
+    for (int game = 0; game < 20; game++) {
+      PositionHistory history;
+      history.Reset(ChessBoard(fen), 0, 0);
+      for (int ply = 0; ply < 150; ply++) {
+        const auto& board = history.Last().GetBoard();
+        EXPECT_EQ(board.Hash(), ChessBoard(GetFen(history.Last())).Hash());
+        const auto moves = board.GenerateLegalMoves();
+        if (moves.empty()) break;
+        seed = seed * 1103515245 + 12345;
+        history.Append(moves[(seed >> 16) % moves.size()]);
+      }
+    }
+  }
+}
+
 // https://github.com/LeelaChessZero/lc0/issues/209
 TEST(PositionHistory, ComputeLastMoveRepetitionsWithoutLegalEnPassant) {
   ChessBoard board;
@@ -89,6 +114,75 @@ TEST(PositionHistory, ComputeLastMoveRepetitionsWithLegalEnPassant) {
   EXPECT_EQ(repeated_position.GetRepetitions(), 0);
 }
 
+TEST(RepetitionTable, MatchesHistoryScan) {
+  ChessBoard board;
+  board.SetFromFen(ChessBoard::kStartposFen);
+  PositionHistory scanned;
+  scanned.Reset(board, 0, 0);
+  PositionHistory hashed = scanned;
+  RepetitionTable table;
+  table.Reset(hashed);
+  const std::vector<std::string> moves = {"g1f3", "g8f6", "f3g1", "f6g8",
+                                          "g1f3", "g8f6", "f3g1", "f6g8",
+                                          "e2e4", "g8f6", "g1f3", "f6g8",
+                                          "f3g1", "g8f6", "g1f3", "f6g8"};
+  auto append = [&](size_t i) {
+    const Move move(moves[i], i % 2 == 1);
+    scanned.Append(move);
+    hashed.Append(move, &table);
+    const auto& expected = scanned.Last();
+    const auto& actual = hashed.Last();
+    EXPECT_EQ(actual.GetRepetitions(), expected.GetRepetitions()) << i;
+    EXPECT_EQ(actual.GetPliesSincePrevRepetition(),
+              expected.GetPliesSincePrevRepetition())
+        << i;
+  };
+  for (size_t i = 0; i < moves.size(); ++i) append(i);
+  EXPECT_EQ(hashed.GetPositionAt(8).GetRepetitions(), 2);
+  EXPECT_EQ(hashed.GetPositionAt(4).GetRepetitions(), 1);
+  EXPECT_EQ(hashed.Last().GetRepetitions(), 1);
+  // Going back along the path and down again finds the same repetitions.
+  scanned.Trim(6);
+  hashed.Trim(6);
+  table.Trim(6);
+  for (size_t i = 5; i < moves.size(); ++i) append(i);
+}
+
+TEST(PositionHistory, SharedPrefix) {
+  ChessBoard board;
+  PositionHistory history;
+  board.SetFromFen("3b4/rp1r1k2/8/1RP2p1p/p1KP4/P3P2P/5P2/1R2B3 b - - 2 30");
+  history.Reset(board, 2, 30);
+  history.Append(Move("f7f8", true));
+  history.Append(Move("f2f4", false));
+  history.Append(Move("d7h7", true));
+  const PositionHistory shared = history.Shared();
+  PositionHistory copy = shared;
+  EXPECT_EQ(copy.GetLength(), 4);
+  EXPECT_EQ(copy.Last().Hash(), history.Last().Hash());
+  // Repetitions are found through the shared prefix.
+  copy.Append(Move("c4d3", false));
+  copy.Append(Move("h7d7", true));
+  copy.Append(Move("d3c4", false));
+  EXPECT_EQ(copy.Last().GetRepetitions(), 1);
+  EXPECT_EQ(copy.HashLast(7), [&] {
+    history.Append(Move("c4d3", false));
+    history.Append(Move("h7d7", true));
+    history.Append(Move("d3c4", false));
+    return history.HashLast(7);
+  }());
+  // Trimming into the prefix leaves other copies alone.
+  copy.Trim(3);
+  EXPECT_EQ(copy.GetLength(), 3);
+  EXPECT_EQ(copy.Last().Hash(), history.GetPositionAt(2).Hash());
+  copy.Append(Move("d7h7", true));
+  EXPECT_EQ(copy.Last().Hash(), shared.Last().Hash());
+  copy.Trim(2);
+  copy.Pop();
+  EXPECT_EQ(copy.Last().Hash(), shared.Starting().Hash());
+  EXPECT_EQ(shared.GetLength(), 4);
+}
+
 TEST(PositionHistory, DidRepeatSinceLastZeroingMoveCurent) {
   ChessBoard board;
   PositionHistory history;
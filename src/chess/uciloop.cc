@@ -28,9 +28,9 @@
 #include "uciloop.h"
 
 #include <algorithm>
+#include <cstdio>
 #include <iomanip>
 #include <iostream>
-#include <mutex>
 #include <sstream>
 #include <string>
 #include <unordered_map>
@@ -61,6 +61,7 @@ const std::unordered_map<std::string, std::unordered_set<std::string>>
         {{"quit"}, {}},
         {{"xyzzy"}, {}},
         {{"fen"}, {}},
+        {{"savetree"}, {}},
 };
 
 std::pair<std::string, std::unordered_map<std::string, std::string>>
@@ -127,12 +128,57 @@ bool ContainsKey(const std::unordered_map<std::string, std::string>& params,
                  const std::string& key) {
   return params.find(key) != params.end();
 }
+
+std::string FormatInfo(const ThinkingInfo& info) {
+  std::string res = "info";
+  if (info.player != -1) res += " player " + std::to_string(info.player);
+  if (info.game_id != -1) res += " gameid " + std::to_string(info.game_id);
+  if (info.is_black)
+    res += " side " + std::string(*info.is_black ? "black" : "white");
+  if (info.depth >= 0)
+    res += " depth " + std::to_string(std::max(info.depth, 1));
+  if (info.seldepth >= 0) res += " seldepth " + std::to_string(info.seldepth);
+  if (info.time >= 0) res += " time " + std::to_string(info.time);
+  if (info.nodes >= 0) res += " nodes " + std::to_string(info.nodes);
+  if (info.mate) res += " score mate " + std::to_string(*info.mate);
+  if (info.score) res += " score cp " + std::to_string(*info.score);
+  if (info.wdl) {
+    res += " wdl " + std::to_string(info.wdl->w) + " " +
+           std::to_string(info.wdl->d) + " " + std::to_string(info.wdl->l);
+  }
+  if (info.moves_left) {
+    res += " movesleft " + std::to_string(*info.moves_left);
+  }
+  if (info.hashfull >= 0) res += " hashfull " + std::to_string(info.hashfull);
+  if (info.nps >= 0) res += " nps " + std::to_string(info.nps);
+  if (info.tb_hits >= 0) res += " tbhits " + std::to_string(info.tb_hits);
+  if (info.multipv >= 0) res += " multipv " + std::to_string(info.multipv);
+
+  if (!info.pv.empty()) {
+    res += " pv";
+    for (const auto& move : info.pv) res += " " + move.as_string();
+  }
+  if (!info.comment.empty()) res += " string " + info.comment;
+  return res;
+}
 }  // namespace
 
+UciLoop::UciLoop() : output_thread_([this]() { OutputThread(); }) {}
+
+UciLoop::~UciLoop() {
+  {
+    Mutex::Lock lock(output_mutex_);
+    output_stop_ = true;
+  }
+  output_cv_.notify_all();
+  output_thread_.join();
+}
+
 void UciLoop::RunLoop() {
   std::cout.setf(std::ios::unitbuf);
   std::string line;
   while (std::getline(std::cin, line)) {
+    command_time_ = std::chrono::steady_clock::now();
     LOGFILE << ">> " << line;
     try {
       auto command = ParseCommand(line);
@@ -196,6 +242,7 @@ bool UciLoop::DispatchCommand(
     UCIGOOPTION(nodes);
     UCIGOOPTION(movetime);
 #undef UCIGOOPTION
+    go_params.received = command_time_;
     CmdGo(go_params);
   } else if (command == "stop") {
     CmdStop();
@@ -205,6 +252,8 @@ bool UciLoop::DispatchCommand(
     CmdStart();
   } else if (command == "fen") {
     CmdFen();
+  } else if (command == "savetree") {
+    CmdSaveTree();
   } else if (command == "xyzzy") {
     SendResponse("Nothing happens.");
   } else if (command == "quit") {
@@ -220,11 +269,39 @@ void UciLoop::SendResponse(const std::string& response) {
 }
 
 void UciLoop::SendResponses(const std::vector<std::string>& responses) {
-  static std::mutex output_mutex;
-  std::lock_guard<std::mutex> lock(output_mutex);
-  for (auto& response : responses) {
-    LOGFILE << "<< " << response;
-    std::cout << response << std::endl;
+  {
+    Mutex::Lock lock(output_mutex_);
+    output_queue_.push_back({responses, {}});
+  }
+  output_cv_.notify_one();
+}
+
+void UciLoop::OutputThread() {
+  std::deque<QueuedOutput> queue;
+  std::string buffer;
+  while (true) {
+    {
+      Mutex::Lock lock(output_mutex_);
+      output_cv_.wait(lock.get_raw(), [&]() NO_THREAD_SAFETY_ANALYSIS {
+        return output_stop_ || !output_queue_.empty();
+      });
+      if (output_queue_.empty()) return;
+      queue.swap(output_queue_);
+    }
+    // Everything queued meanwhile goes out with a single write and flush.
+    buffer.clear();
+    auto add_line = [&](const std::string& line) {
+      LOGFILE << "<< " << line;
+      buffer += line;
+      buffer += '\n';
+    };
+    for (const auto& output : queue) {
+      for (const auto& response : output.responses) add_line(response);
+      for (const auto& info : output.infos) add_line(FormatInfo(info));
+    }
+    queue.clear();
+    std::fwrite(buffer.data(), 1, buffer.size(), stdout);
+    std::fflush(stdout);
   }
 }
 
@@ -244,40 +321,11 @@ void UciLoop::SendBestMove(const BestMoveInfo& move) {
 }
 
 void UciLoop::SendInfo(const std::vector<ThinkingInfo>& infos) {
-  std::vector<std::string> reses;
-  for (const auto& info : infos) {
-    std::string res = "info";
-    if (info.player != -1) res += " player " + std::to_string(info.player);
-    if (info.game_id != -1) res += " gameid " + std::to_string(info.game_id);
-    if (info.is_black)
-      res += " side " + std::string(*info.is_black ? "black" : "white");
-    if (info.depth >= 0)
-      res += " depth " + std::to_string(std::max(info.depth, 1));
-    if (info.seldepth >= 0) res += " seldepth " + std::to_string(info.seldepth);
-    if (info.time >= 0) res += " time " + std::to_string(info.time);
-    if (info.nodes >= 0) res += " nodes " + std::to_string(info.nodes);
-    if (info.mate) res += " score mate " + std::to_string(*info.mate);
-    if (info.score) res += " score cp " + std::to_string(*info.score);
-    if (info.wdl) {
-      res += " wdl " + std::to_string(info.wdl->w) + " " +
-             std::to_string(info.wdl->d) + " " + std::to_string(info.wdl->l);
-    }
-    if (info.moves_left) {
-      res += " movesleft " + std::to_string(*info.moves_left);
-    }
-    if (info.hashfull >= 0) res += " hashfull " + std::to_string(info.hashfull);
-    if (info.nps >= 0) res += " nps " + std::to_string(info.nps);
-    if (info.tb_hits >= 0) res += " tbhits " + std::to_string(info.tb_hits);
-    if (info.multipv >= 0) res += " multipv " + std::to_string(info.multipv);
-
-    if (!info.pv.empty()) {
-      res += " pv";
-      for (const auto& move : info.pv) res += " " + move.as_string();
-    }
-    if (!info.comment.empty()) res += " string " + info.comment;
-    reses.push_back(std::move(res));
+  {
+    Mutex::Lock lock(output_mutex_);
+    output_queue_.push_back({{}, infos});
   }
-  SendResponses(reses);
+  output_cv_.notify_one();
 }
 
 }  // namespace lczero
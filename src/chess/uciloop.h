@@ -27,14 +27,19 @@
 
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
 #include <optional>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
 #include "chess/callbacks.h"
 #include "utils/exception.h"
+#include "utils/mutex.h"
 
 namespace lczero {
 
@@ -51,16 +56,22 @@ struct GoParams {
   bool infinite = false;
   std::vector<std::string> searchmoves;
   bool ponder = false;
+  // When the go command was read, if it came from the UCI loop.
+  std::optional<std::chrono::steady_clock::time_point> received;
 };
 
 class UciLoop {
  public:
-  virtual ~UciLoop() {}
+  UciLoop();
+  // Writes out the responses still queued.
+  virtual ~UciLoop();
   virtual void RunLoop();
 
   // Sends response to host.
   void SendResponse(const std::string& response);
-  // Sends responses to host ensuring they are received as a block.
+  // Sends responses to host ensuring they are received as a block. Responses
+  // are queued in order and written out by a separate thread, so that search
+  // threads don't wait for the host to read them.
   virtual void SendResponses(const std::vector<std::string>& responses);
   void SendBestMove(const BestMoveInfo& move);
   void SendInfo(const std::vector<ThinkingInfo>& infos);
@@ -80,6 +91,7 @@ class UciLoop {
     throw Exception("Not supported");
   }
   virtual void CmdFen() { throw Exception("Not supported"); }
+  virtual void CmdSaveTree() { throw Exception("Not supported"); }
   virtual void CmdGo(const GoParams& /*params*/) {
     throw Exception("Not supported");
   }
@@ -91,6 +103,21 @@ class UciLoop {
   bool DispatchCommand(
       const std::string& command,
       const std::unordered_map<std::string, std::string>& params);
+
+  // Responses, or search infos still to be formatted.
+  struct QueuedOutput {
+    std::vector<std::string> responses;
+    std::vector<ThinkingInfo> infos;
+  };
+  void OutputThread();
+
+  // When the command being dispatched was read.
+  std::chrono::steady_clock::time_point command_time_;
+  Mutex output_mutex_{"UciLoop::output_mutex_"};
+  std::condition_variable output_cv_;
+  std::deque<QueuedOutput> output_queue_ GUARDED_BY(output_mutex_);
+  bool output_stop_ GUARDED_BY(output_mutex_) = false;
+  std::thread output_thread_;
 };
 
 }  // namespace lczero
@@ -30,12 +30,20 @@
 #include <algorithm>
 #include <cmath>
 #include <functional>
+#include <thread>
+#include <utility>
 
+#include "chess/callbacks.h"
 #include "mcts/search.h"
 #include "mcts/stoppers/factory.h"
+#include "mcts/stoppers/stoppers.h"
+#include "neural/cache_preload.h"
 #include "utils/commandline.h"
 #include "utils/configfile.h"
+#include "utils/filesystem.h"
+#include "utils/largepages.h"
 #include "utils/logging.h"
+#include "utils/phasetimer.h"
 
 namespace lczero {
 namespace {
@@ -49,8 +57,26 @@ const OptionId kLogFileId{"logfile", "LogFile",
 const OptionId kSyzygyTablebaseId{
     "syzygy-paths", "SyzygyPath",
     "List of Syzygy tablebase directories, list entries separated by system "
-    "separator (\";\" for Windows, \":\" for Linux).",
+    "separator (\";\" for Windows, \":\" for Linux). Entries ending in "
+    "\".tbpack\" are pack files (see scripts/make_syzygy_pack.py), which are "
+    "read into memory in full when loaded.",
     's'};
+const OptionId kSyzygyPreloadId{
+    "syzygy-preload", "SyzygyPreload",
+    "Map Syzygy tablebases of up to this many pieces when they are loaded, "
+    "using all cores, rather than on their first probe during a game. 0 maps "
+    "every table on its first probe."};
+const OptionId kSyzygyLockId{
+    "syzygy-lock", "SyzygyLock",
+    "Lock preloaded Syzygy tablebases of up to this many pieces in memory, so "
+    "that they are never paged out. The others preloaded are read ahead into "
+    "the page cache. Needs a high enough locked memory limit."};
+const OptionId kSyzygyStatsId{
+    "syzygy-stats", "SyzygyStats",
+    "Collect Syzygy probe statistics: latency of probes missing the probe "
+    "cache, page faults taken while probing and probes of each table file. "
+    "They are shown as info string and written to the log after each search, "
+    "to tell which tables are worth keeping on fast storage."};
 const OptionId kPonderId{"", "Ponder",
                          "This option is ignored. Here to please chess GUIs."};
 const OptionId kUciChess960{
@@ -64,8 +90,102 @@ const OptionId kStrictUciTiming{"strict-uci-timing", "StrictTiming",
                                 "The UCI host compensates for lag, waits for "
                                 "the 'readyok' reply before sending 'go' and "
                                 "only then starts timing."};
-const OptionId kPreload{"preload", "",
-                        "Initialize backend and load net on engine startup."};
+const OptionId kPreload{
+    "preload", "",
+    "Start initializing the backend and loading the net and the Syzygy "
+    "tablebases in the background on engine startup."};
+const OptionId kAnalysisTreesId{
+    "analysis-trees", "AnalysisTrees",
+    "Number of search trees to keep for different lines. A position is searched "
+    "in the kept tree which it continues, so analysing several game lines in "
+    "turn doesn't discard the search done on the others. All trees share the "
+    "NN cache."};
+const OptionId kRootParallelSearchesId{
+    "root-parallel-searches", "RootParallelSearches",
+    "Number of independent searches of the position, each with its own tree "
+    "and Threads search threads. The root visits of all of them are merged to "
+    "choose the bestmove, while the PVs and scores shown come from the first "
+    "one. They share the backend and the NN cache."};
+const OptionId kRootParallelNoiseId{
+    "root-parallel-noise", "RootParallelNoise",
+    "Dirichlet noise epsilon (at least NoiseEpsilon) of all but the first of "
+    "the RootParallelSearches, so that they explore different moves."};
+const OptionId kLargePagesId{
+    "large-pages", "LargePages",
+    "Put the search tree and the NN cache on large pages, which cuts TLB "
+    "misses of their random accesses. Uses huge pages reserved by the system, "
+    "else transparent huge pages on Linux; on Windows needs the \"Lock pages "
+    "in memory\" right. Applies to memory allocated after it's set."};
+const OptionId kTreeFileId{
+    "tree-file", "TreeFile",
+    "File the search tree is written to by the \"savetree\" command. When a "
+    "search starts from scratch in the same game position the file was saved "
+    "at, the saved tree is loaded and the search continues from it."};
+const OptionId kPersistentCacheId{
+    "persistent-cache", "PersistentCacheFile",
+    "File of NN evaluations shared by lc0 processes, also running at the same "
+    "time. Positions missing from the NN cache are looked up there and new "
+    "evaluations are appended, so later instances start with a warm cache. "
+    "Entries are kept per network. Not supported on Windows."};
+const OptionId kPersistentCacheSizeId{
+    "persistent-cache-size", "PersistentCacheSizeMb",
+    "Size in MB the PersistentCacheFile may grow to. No evaluations are "
+    "appended once it's reached. Each process also keeps an index of the "
+    "file in memory, of about half its size."};
+const OptionId kPreloadCacheId{
+    "preload-cache", "PreloadCacheFile",
+    "Opening book whose positions are evaluated into the NN cache when the "
+    "network is loaded and after each new game, so that the search in book "
+    "lines starts with a warm cache. Every position along the games of a PGN "
+    "file is taken, or one position per line of a .epd or .fen file."};
+const OptionId kBackgroundNetLoadId{
+    "background-net-load", "BackgroundNetLoad",
+    "When the network settings change, load the new network in the background "
+    "while searches keep using the current one, and swap it in before the "
+    "first search started after it's loaded."};
+const OptionId kNetSwapCacheId{
+    "net-swap-cache", "NetSwapCache",
+    "What happens to the NN cache when a network loaded in the background is "
+    "swapped in: \"clear\" it, or \"keep\" the evaluations of the previous "
+    "network, close enough for successive nets of a training run."};
+const OptionId kMetricsFileId{
+    "metrics-file", "MetricsFile",
+    "File the metrics of the engine are written to periodically, in the "
+    "Prometheus text format (e.g. for the textfile collector of the node "
+    "exporter): nodes, nps, NN batch sizes and backend latency, NN cache hits, "
+    "tree size and memory, garbage collector backlog and tablebase hits."};
+const OptionId kMetricsIntervalId{
+    "metrics-interval", "MetricsInterval",
+    "Seconds between writes of the MetricsFile."};
+const OptionId kLatencyBreakdownId{
+    "latency-breakdown", "LatencyBreakdown",
+    "Reports with each bestmove how long every phase of the move took, from "
+    "reading go to sending bestmove, in an info string and in the log."};
+
+MetricCounter gCacheHitsMetric("lc0_nn_cache_hits_total",
+                               "NN cache lookups which found the position.");
+MetricCounter gCacheLookupsMetric("lc0_nn_cache_lookups_total",
+                                  "NN cache lookups.");
+MetricCounter gCacheEvictionsMetric("lc0_nn_cache_evictions_total",
+                                    "Entries evicted from the NN cache.");
+MetricGauge gCacheEntriesMetric("lc0_nn_cache_entries",
+                                "Positions in the NN cache.");
+MetricGauge gCacheBytesMetric("lc0_nn_cache_bytes",
+                              "Memory used by the NN cache.");
+MetricGauge gTreeBytesMetric("lc0_tree_bytes",
+                             "Memory reserved for the search trees.");
+MetricGauge gGcBacklogMetric(
+    "lc0_gc_backlog_subtrees",
+    "Subtrees waiting for the garbage collector to release them.");
+
+// Whether @position is @base or a position later in the same line.
+bool ContinuesPosition(const CurrentPosition& base,
+                       const CurrentPosition& position) {
+  return base.fen == position.fen &&
+         base.moves.size() <= position.moves.size() &&
+         std::equal(base.moves.begin(), base.moves.end(),
+                    position.moves.begin());
+}
 
 MoveList StringsToMovelist(const std::vector<std::string>& moves,
                            const ChessBoard& board) {
@@ -98,6 +218,8 @@ void EngineController::PopulateOptions(OptionsParser* options) {
   NetworkFactory::PopulateOptions(options);
   options->Add<IntOption>(kThreadsOptionId, 0, 128) = 0;
   options->Add<IntOption>(kNNCacheSizeId, 0, 999999999) = 2000000;
+  options->Add<ChoiceOption>(kNNCacheEvictionId,
+                             GetCacheEvictionPolicyNames()) = "fifo";
   SearchParams::Populate(options);
 
   ConfigFile::PopulateOptions(options);
@@ -109,6 +231,9 @@ void EngineController::PopulateOptions(OptionsParser* options) {
     options->UnhideOption(SearchParams::kMultiPvId);
   }
   options->Add<StringOption>(kSyzygyTablebaseId);
+  options->Add<IntOption>(kSyzygyPreloadId, 0, 7) = 0;
+  options->Add<IntOption>(kSyzygyLockId, 0, 7) = 0;
+  options->Add<BoolOption>(kSyzygyStatsId) = false;
   // Add "Ponder" option to signal to GUIs that we support pondering.
   // This option is currently not used by lc0 in any way.
   options->Add<BoolOption>(kPonderId) = true;
@@ -123,6 +248,20 @@ void EngineController::PopulateOptions(OptionsParser* options) {
   options->HideOption(kStrictUciTiming);
 
   options->Add<BoolOption>(kPreload) = false;
+  options->Add<IntOption>(kAnalysisTreesId, 1, 64) = 1;
+  options->Add<IntOption>(kRootParallelSearchesId, 1, 64) = 1;
+  options->Add<FloatOption>(kRootParallelNoiseId, 0.0f, 1.0f) = 0.1f;
+  options->Add<StringOption>(kTreeFileId);
+  options->Add<BoolOption>(kLargePagesId) = false;
+  options->Add<StringOption>(kPersistentCacheId);
+  options->Add<IntOption>(kPersistentCacheSizeId, 1, 1024 * 1024) = 256;
+  options->Add<StringOption>(kPreloadCacheId);
+  options->Add<BoolOption>(kBackgroundNetLoadId) = false;
+  std::vector<std::string> swap_cache = {"clear", "keep"};
+  options->Add<ChoiceOption>(kNetSwapCacheId, swap_cache) = "clear";
+  options->Add<StringOption>(kMetricsFileId);
+  options->Add<IntOption>(kMetricsIntervalId, 1, 3600) = 15;
+  options->Add<BoolOption>(kLatencyBreakdownId) = false;
 }
 
 void EngineController::ResetMoveTimer() {
@@ -132,38 +271,229 @@ void EngineController::ResetMoveTimer() {
 // Updates values from Uci options.
 void EngineController::UpdateFromUciOptions() {
   SharedLock lock(busy_mutex_);
+  // Loads the network and the Syzygy tables in parallel, unless "isready"
+  // already did.
+  StartInitialization();
 
   // Syzygy tablebases.
   std::string tb_paths = options_.Get<std::string>(kSyzygyTablebaseId);
+  const std::pair<int, int> tb_preload = {options_.Get<int>(kSyzygyPreloadId),
+                                          options_.Get<int>(kSyzygyLockId)};
   if (!tb_paths.empty() && tb_paths != tb_paths_) {
-    syzygy_tb_ = std::make_unique<SyzygyTablebase>();
-    CERR << "Loading Syzygy tablebases from " << tb_paths;
-    if (!syzygy_tb_->init(tb_paths)) {
-      CERR << "Failed to load Syzygy tablebases!";
-      syzygy_tb_ = nullptr;
-    }
+    StartTablebaseLoad(tb_paths, tb_preload);
+    PendingTablebase pending = std::move(*pending_tablebase_);
+    pending_tablebase_.reset();
+    syzygy_tb_ = pending.tablebase.get();
     tb_paths_ = tb_paths;
+    tb_preload_ = pending.preload;
   } else if (tb_paths.empty()) {
+    pending_tablebase_.reset();
     syzygy_tb_ = nullptr;
     tb_paths_.clear();
   }
+  if (syzygy_tb_ && tb_preload.first > 0 && tb_preload != tb_preload_) {
+    const int tables = syzygy_tb_->preload(
+        tb_preload.first, tb_preload.second,
+        std::max(1u, std::thread::hardware_concurrency()));
+    CERR << "Preloaded " << tables << " Syzygy tablebase files.";
+  }
+  tb_preload_ = tb_preload;
+  if (syzygy_tb_) {
+    syzygy_tb_->set_collect_stats(options_.Get<bool>(kSyzygyStatsId));
+  }
 
   // Network.
   const auto network_configuration =
       NetworkFactory::BackendConfiguration(options_);
-  if (network_configuration_ != network_configuration) {
-    network_ = NetworkFactory::LoadNetwork(options_);
+  bool network_changed = false;
+  if (network_ && options_.Get<bool>(kBackgroundNetLoadId)) {
+    network_changed = UpdateNetworkInBackground(network_configuration);
+  } else if (network_configuration_ != network_configuration) {
+    StartNetworkLoad(network_configuration);
+    PendingNetwork pending = std::move(*pending_network_);
+    pending_network_.reset();
+    network_ = pending.network.get();
     network_configuration_ = network_configuration;
+    network_changed = true;
   }
 
+  // Persistent NN cache, whose entries belong to the network.
+  const auto persistent_cache_file =
+      options_.Get<std::string>(kPersistentCacheId);
+  const size_t persistent_cache_bytes =
+      static_cast<size_t>(options_.Get<int>(kPersistentCacheSizeId)) << 20;
+  if (network_changed || persistent_cache_file != persistent_cache_file_ ||
+      persistent_cache_bytes != persistent_cache_bytes_) {
+    cache_.SetPersistentCache(nullptr);
+    persistent_cache_.reset();
+    persistent_cache_file_ = persistent_cache_file;
+    persistent_cache_bytes_ = persistent_cache_bytes;
+    if (!persistent_cache_file.empty()) {
+      persistent_cache_ = std::make_unique<PersistentNNCache>(
+          persistent_cache_file,
+          PersistentNNCache::GetNetworkKey(
+              NetworkFactory::GetWeightsFilename(options_)),
+          persistent_cache_bytes);
+      cache_.SetPersistentCache(persistent_cache_.get());
+    }
+  }
+
+  // Before the cache is resized, so that a new table goes to large pages.
+  LargePages::SetEnabled(options_.Get<bool>(kLargePagesId));
+
   // Cache size.
   cache_.SetCapacity(options_.Get<int>(kNNCacheSizeId));
+  cache_.SetEvictionPolicy(ParseCacheEvictionPolicy(
+      options_.Get<std::string>(kNNCacheEvictionId)));
+
+  // Opening book positions, evaluated into the cache in large batches.
+  const auto preload_cache_file = options_.Get<std::string>(kPreloadCacheId);
+  if (network_changed || preload_cache_file != preload_cache_file_) {
+    preload_cache_file_ = preload_cache_file;
+    if (!preload_cache_file.empty()) {
+      const SearchParams params(options_);
+      const auto start = std::chrono::steady_clock::now();
+      const int evaluated = PreloadNNCache(
+          preload_cache_file, network_.get(), &cache_,
+          params.GetCacheHistoryLength(), params.GetHistoryFill(),
+          network_->GetMiniBatchSize());
+      CERR << "Preloaded " << evaluated << " positions from "
+           << preload_cache_file << " into the NN cache in "
+           << std::chrono::duration_cast<std::chrono::milliseconds>(
+                  std::chrono::steady_clock::now() - start)
+                  .count()
+           << "ms.";
+    }
+  }
 
   // Check whether we can update the move timer in "Go".
   strict_uci_timing_ = options_.Get<bool>(kStrictUciTiming);
+
+  const auto metrics_file = options_.Get<std::string>(kMetricsFileId);
+  const int metrics_interval = options_.Get<int>(kMetricsIntervalId);
+  if (metrics_file != metrics_file_ || metrics_interval != metrics_interval_) {
+    metrics_writer_.reset();
+    metrics_file_ = metrics_file;
+    metrics_interval_ = metrics_interval;
+    if (!metrics_file.empty()) {
+      metrics_writer_ = std::make_unique<MetricsFileWriter>(
+          metrics_file, std::chrono::seconds(metrics_interval),
+          [this]() { CollectMetrics(); });
+    }
+  }
+}
+
+void EngineController::CollectMetrics() {
+  gCacheHitsMetric.Set(cache_.GetHits());
+  gCacheLookupsMetric.Set(cache_.GetLookups());
+  gCacheEvictionsMetric.Set(cache_.GetEvictions());
+  gCacheEntriesMetric.Set(cache_.GetSize());
+  gCacheBytesMetric.Set(cache_.GetMemoryUsage());
+  const TreeMemoryUsage tree = GetTreeMemoryUsage();
+  gTreeBytesMetric.Set(tree.node_bytes + tree.edge_bytes + tree.solid_bytes);
+  gGcBacklogMetric.Set(tree.gc_backlog);
+}
+
+bool EngineController::UpdateNetworkInBackground(
+    const NetworkFactory::BackendConfiguration& configuration) {
+  if (pending_network_ && pending_network_->configuration != configuration) {
+    // The settings changed again while loading. Waits for the stale load, as
+    // it cannot be interrupted.
+    pending_network_.reset();
+  }
+  if (configuration != network_configuration_) {
+    StartNetworkLoad(configuration);
+  }
+  if (!pending_network_ ||
+      pending_network_->network.wait_for(std::chrono::seconds(0)) !=
+          std::future_status::ready) {
+    return false;
+  }
+
+  PendingNetwork pending = std::move(*pending_network_);
+  pending_network_.reset();
+  // Rethrows the error of a failed load, like loading in the foreground.
+  network_ = pending.network.get();
+  network_configuration_ = pending.configuration;
+  if (options_.Get<std::string>(kNetSwapCacheId) == "clear") cache_.Clear();
+  CERR << "Swapped in the network loaded in the background.";
+  return true;
+}
+
+void EngineController::StartNetworkLoad(
+    const NetworkFactory::BackendConfiguration& configuration) {
+  if (pending_network_ && pending_network_->configuration == configuration) {
+    return;
+  }
+  // A stale load cannot be interrupted, so this waits for it.
+  pending_network_.reset();
+  auto& pending = pending_network_.emplace();
+  pending.configuration = configuration;
+  // The loader gets its own values of the network settings, which may be
+  // changed by "setoption" in the meantime.
+  pending.options = std::make_unique<OptionsDict>(&options_);
+  pending.options->Set<std::string>(NetworkFactory::kWeightsId,
+                                    configuration.weights_path);
+  pending.options->Set<std::string>(NetworkFactory::kBackendId,
+                                    configuration.backend);
+  pending.options->Set<std::string>(NetworkFactory::kBackendOptionsId,
+                                    configuration.backend_options);
+  pending.network =
+      std::async(std::launch::async, [options = pending.options.get()]() {
+        return NetworkFactory::LoadNetwork(*options);
+      });
+  CERR << "Loading network in the background.";
+}
+
+void EngineController::StartTablebaseLoad(const std::string& paths,
+                                          const std::pair<int, int>& preload) {
+  if (pending_tablebase_ && pending_tablebase_->paths == paths &&
+      pending_tablebase_->preload == preload) {
+    return;
+  }
+  pending_tablebase_.reset();
+  auto& pending = pending_tablebase_.emplace();
+  pending.paths = paths;
+  pending.preload = preload;
+  pending.tablebase = std::async(std::launch::async, [paths, preload]() {
+    auto tablebase = std::make_unique<SyzygyTablebase>();
+    CERR << "Loading Syzygy tablebases from " << paths;
+    if (!tablebase->init(paths)) {
+      CERR << "Failed to load Syzygy tablebases!";
+      return std::unique_ptr<SyzygyTablebase>();
+    }
+    if (preload.first > 0) {
+      const int tables = tablebase->preload(
+          preload.first, preload.second,
+          std::max(1u, std::thread::hardware_concurrency()));
+      CERR << "Preloaded " << tables << " Syzygy tablebase files.";
+    }
+    return tablebase;
+  });
+}
+
+void EngineController::StartInitialization() {
+  const std::string tb_paths = options_.Get<std::string>(kSyzygyTablebaseId);
+  if (!tb_paths.empty() && tb_paths != tb_paths_) {
+    StartTablebaseLoad(tb_paths, {options_.Get<int>(kSyzygyPreloadId),
+                                  options_.Get<int>(kSyzygyLockId)});
+  }
+  const auto network_configuration =
+      NetworkFactory::BackendConfiguration(options_);
+  if (network_configuration != network_configuration_) {
+    StartNetworkLoad(network_configuration);
+  }
 }
 
 void EngineController::EnsureReady() {
+  StartInitialization();
+  // Errors of the loads are reported by the search which takes them over.
+  if (pending_tablebase_) pending_tablebase_->tablebase.wait();
+  // A network swapped in the background doesn't hold up the ready response.
+  if (pending_network_ &&
+      !(network_ && options_.Get<bool>(kBackgroundNetLoadId))) {
+    pending_network_->network.wait();
+  }
   std::unique_lock<RpSharedMutex> lock(busy_mutex_);
   // If a UCI host is waiting for our ready response, we can consider the move
   // not started until we're done ensuring ready.
@@ -176,8 +506,12 @@ void EngineController::NewGame() {
   ResetMoveTimer();
   SharedLock lock(busy_mutex_);
   cache_.Clear();
-  search_.reset();
+  // The book goes back into the cleared cache.
+  preload_cache_file_.clear();
+  ResetSearch();
   tree_.reset();
+  spare_trees_.clear();
+  helper_trees_.clear();
   CreateFreshTimeManager();
   current_position_ = {ChessBoard::kStartposFen, {}};
   UpdateFromUciOptions();
@@ -190,7 +524,7 @@ void EngineController::SetPosition(const std::string& fen,
   ResetMoveTimer();
   SharedLock lock(busy_mutex_);
   current_position_ = CurrentPosition{fen, moves_str};
-  search_.reset();
+  ResetSearch();
 }
 
 Position EngineController::ApplyPositionMoves() {
@@ -211,16 +545,97 @@ Position EngineController::ApplyPositionMoves() {
 void EngineController::SetupPosition(
     const std::string& fen, const std::vector<std::string>& moves_str) {
   SharedLock lock(busy_mutex_);
-  search_.reset();
+  ResetSearch();
 
   UpdateFromUciOptions();
 
+  const size_t max_trees = options_.Get<int>(kAnalysisTreesId);
+  if (max_trees > 1) {
+    SelectAnalysisTree({fen, moves_str}, max_trees);
+  } else {
+    spare_trees_.clear();
+  }
   if (!tree_) tree_ = std::make_unique<NodeTree>();
+  tree_position_ = {fen, moves_str};
 
   std::vector<Move> moves;
   for (const auto& move : moves_str) moves.emplace_back(move);
   const bool is_same_game = tree_->ResetToPosition(fen, moves);
   if (!is_same_game) CreateFreshTimeManager();
+  LOGFILE << "Reusing " << tree_->GetCurrentHead()->GetN()
+          << " visits of the search tree.";
+  helper_trees_.resize(options_.Get<int>(kRootParallelSearchesId) - 1);
+  for (auto& tree : helper_trees_) {
+    if (!tree) tree = std::make_unique<NodeTree>();
+    tree->ResetToPosition(fen, moves);
+  }
+
+  const std::string tree_file = options_.Get<std::string>(kTreeFileId);
+  if (!tree_file.empty() && tree_->GetCurrentHead()->GetN() == 0 &&
+      GetFileSize(tree_file) > 0) {
+    // A damaged file shouldn't keep the engine from playing.
+    try {
+      if (tree_->LoadHeadFromFile(tree_file)) {
+        CERR << "Loaded search tree of " << tree_->GetCurrentHead()->GetN()
+             << " visits from " << tree_file;
+      }
+    } catch (const Exception& e) {
+      CERR << "Failed to load search tree: " << e.what();
+    }
+  }
+}
+
+void EngineController::SaveTree() {
+  SharedLock lock(busy_mutex_);
+  const std::string tree_file = options_.Get<std::string>(kTreeFileId);
+  if (tree_file.empty()) throw Exception("TreeFile is not set.");
+  if (!tree_) throw Exception("There is no search tree to save.");
+  if (search_) {
+    if (search_->IsSearchActive()) {
+      throw Exception("Cannot save the tree while searching.");
+    }
+    search_->Wait();
+  }
+  tree_->SaveHeadToFile(tree_file);
+  CERR << "Saved search tree of " << tree_->GetCurrentHead()->GetN()
+       << " visits to " << tree_file;
+}
+
+void EngineController::SelectAnalysisTree(const CurrentPosition& position,
+                                          size_t max_trees) {
+  if (tree_ && ContinuesPosition(tree_position_, position)) return;
+  // The kept tree whose line shares most moves with the position, so that as
+  // little search as possible is thrown away.
+  auto best = spare_trees_.end();
+  for (auto iter = spare_trees_.begin(); iter != spare_trees_.end(); ++iter) {
+    if (!ContinuesPosition(iter->first, position)) continue;
+    if (best == spare_trees_.end() ||
+        iter->first.moves.size() > best->first.moves.size()) {
+      best = iter;
+    }
+  }
+  std::unique_ptr<NodeTree> tree;
+  CurrentPosition tree_position;
+  if (best != spare_trees_.end()) {
+    tree = std::move(best->second);
+    tree_position = std::move(best->first);
+    spare_trees_.erase(best);
+  }
+  if (tree_) {
+    // The least recently used tree goes first.
+    if (spare_trees_.size() + 1 >= max_trees) {
+      spare_trees_.erase(spare_trees_.begin());
+    }
+    spare_trees_.emplace_back(std::move(tree_position_), std::move(tree_));
+  }
+  tree_ = std::move(tree);
+  tree_position_ = std::move(tree_position);
+}
+
+void EngineController::ResetSearch() {
+  // The first search uses the helpers until it's destroyed.
+  search_.reset();
+  helper_searches_.clear();
 }
 
 void EngineController::CreateFreshTimeManager() {
@@ -272,11 +687,20 @@ void EngineController::Go(const GoParams& params) {
   if (strict_uci_timing_ || !move_start_time_) ResetMoveTimer();
   go_params_ = params;
 
+  std::shared_ptr<PhaseTimer> phases;
+  if (options_.Get<bool>(kLatencyBreakdownId)) {
+    phases = std::make_shared<PhaseTimer>(
+        params.received.value_or(std::chrono::steady_clock::now()));
+    phases->Mark("uci");
+  }
+
   std::unique_ptr<UciResponder> responder =
       std::make_unique<NonOwningUciRespondForwarder>(uci_responder_.get());
 
   // Setting up current position, now that it's known whether it's ponder or
-  // not.
+  // not. Pondering searches the position before the expected reply, so every
+  // reply of the opponent is searched and a ponder miss still reuses the
+  // subtree of the move actually played.
   if (params.ponder && !current_position_.moves.empty()) {
     std::vector<std::string> moves(current_position_.moves);
     std::string ponder_move = moves.back();
@@ -287,6 +711,7 @@ void EngineController::Go(const GoParams& params) {
   } else {
     SetupPosition(current_position_.fen, current_position_.moves);
   }
+  if (phases) phases->Mark("position");
 
   if (!options_.Get<bool>(kUciChess960)) {
     // Remap FRC castling to legacy castling.
@@ -305,20 +730,53 @@ void EngineController::Go(const GoParams& params) {
   }
 
   auto stopper = time_manager_->GetStopper(params, *tree_.get());
+  const auto searchmoves =
+      StringsToMovelist(params.searchmoves, tree_->HeadPosition().GetBoard());
   search_ = std::make_unique<Search>(
-      *tree_, network_.get(), std::move(responder),
-      StringsToMovelist(params.searchmoves, tree_->HeadPosition().GetBoard()),
+      *tree_, network_.get(), std::move(responder), searchmoves,
       *move_start_time_, std::move(stopper), params.infinite, params.ponder,
-      options_, &cache_, syzygy_tb_.get());
+      options_, &cache_, syzygy_tb_.get(), &thread_pool_);
+
+  // The helpers search until the first search aborts them, and their output
+  // is dropped.
+  OptionsDict helper_options(&options_);
+  helper_options.Set<float>(
+      SearchParams::kNoiseEpsilonId,
+      std::max(options_.Get<float>(SearchParams::kNoiseEpsilonId),
+               options_.Get<float>(kRootParallelNoiseId)));
+  std::vector<Search*> helpers;
+  for (auto& tree : helper_trees_) {
+    helper_searches_.push_back(std::make_unique<Search>(
+        *tree, network_.get(),
+        std::make_unique<CallbackUciResponder>(
+            [](const BestMoveInfo&) {},
+            [](const std::vector<ThinkingInfo>&) {}),
+        searchmoves, *move_start_time_,
+        std::make_unique<ChainedSearchStopper>(), /* infinite */ true,
+        /* ponder */ false, helper_options, &cache_, syzygy_tb_.get(),
+        &thread_pool_));
+    helpers.push_back(helper_searches_.back().get());
+  }
+  search_->SetRootParallelHelpers(std::move(helpers));
+  if (phases) {
+    phases->Mark("search init");
+    search_->SetPhaseTimer(phases);
+  }
+  if (search_->TryInstantMove()) return;
 
   LOGFILE << "Timer started at "
           << FormatTime(SteadyClockToSystemClock(*move_start_time_));
+  for (auto& helper : helper_searches_) {
+    helper->StartThreads(options_.Get<int>(kThreadsOptionId));
+  }
   search_->StartThreads(options_.Get<int>(kThreadsOptionId));
+  if (phases) phases->Mark("thread start");
 }
 
 void EngineController::PonderHit() {
   ResetMoveTimer();
   go_params_.ponder = false;
+  go_params_.received = std::chrono::steady_clock::now();
   Go(go_params_);
 }
 
@@ -340,7 +798,7 @@ void EngineLoop::RunLoop() {
   if (!ConfigFile::Init() || !options_.ProcessAllFlags()) return;
   const auto options = options_.GetOptionsDict();
   Logging::Get().SetFilename(options.Get<std::string>(kLogFileId));
-  if (options.Get<bool>(kPreload)) engine_.NewGame();
+  if (options.Get<bool>(kPreload)) engine_.StartInitialization();
   UciLoop::RunLoop();
 }
 
@@ -380,6 +838,8 @@ void EngineLoop::CmdFen() {
   std::string fen = GetFen(engine_.ApplyPositionMoves());
   return SendResponse(fen);
 }
+void EngineLoop::CmdSaveTree() { engine_.SaveTree(); }
+
 void EngineLoop::CmdGo(const GoParams& params) { engine_.Go(params); }
 
 void EngineLoop::CmdPonderHit() { engine_.PonderHit(); }
@@ -27,6 +27,7 @@
 
 #pragma once
 
+#include <future>
 #include <optional>
 
 #include "chess/uciloop.h"
@@ -34,9 +35,12 @@
 #include "neural/cache.h"
 #include "neural/factory.h"
 #include "neural/network.h"
+#include "neural/persistent_cache.h"
 #include "syzygy/syzygy.h"
+#include "utils/metrics.h"
 #include "utils/mutex.h"
 #include "utils/optionsparser.h"
+#include "utils/threadpool.h"
 
 namespace lczero {
 
@@ -53,14 +57,19 @@ class EngineController {
   ~EngineController() {
     // Make sure search is destructed first, and it still may be running in
     // a separate thread.
-    search_.reset();
+    ResetSearch();
   }
 
   void PopulateOptions(OptionsParser* options);
 
-  // Blocks.
+  // Blocks until the network and the Syzygy tables of the current options are
+  // loaded.
   void EnsureReady();
 
+  // Starts loading the network and the Syzygy tables of the current options
+  // in parallel in the background. They are taken over by the next search.
+  void StartInitialization();
+
   // Must not block.
   void NewGame();
 
@@ -76,13 +85,34 @@ class EngineController {
 
   Position ApplyPositionMoves();
 
+  // Blocks. Saves the tree of the last search to TreeFile.
+  void SaveTree();
+
  private:
   void UpdateFromUciOptions();
+  // Loads a changed network in the background, and swaps in a loaded one.
+  // Returns whether network_ was replaced.
+  bool UpdateNetworkInBackground(
+      const NetworkFactory::BackendConfiguration& configuration);
+  // Starts loading the network in pending_network_, unless it's already
+  // loading.
+  void StartNetworkLoad(
+      const NetworkFactory::BackendConfiguration& configuration);
+  // Same for the Syzygy tables in pending_tablebase_.
+  void StartTablebaseLoad(const std::string& paths,
+                          const std::pair<int, int>& preload);
 
   void SetupPosition(const std::string& fen,
                      const std::vector<std::string>& moves);
+  // Makes tree_ the kept tree which @position continues, or a new one.
+  // Previous tree_ is kept among spare_trees_.
+  void SelectAnalysisTree(const CurrentPosition& position, size_t max_trees);
   void ResetMoveTimer();
+  // Destroys search_ and then its root-parallel helpers.
+  void ResetSearch();
   void CreateFreshTimeManager();
+  // Samples the metrics of the NN cache and the tree memory for MetricsFile.
+  void CollectMetrics();
 
   const OptionsDict& options_;
 
@@ -93,16 +123,50 @@ class EngineController {
   using SharedLock = std::shared_lock<RpSharedMutex>;
 
   std::unique_ptr<TimeManager> time_manager_;
+  // Search threads are kept between moves, as starting them again for every
+  // "go" is a noticeable delay in fast games.
+  ThreadPool thread_pool_;
   std::unique_ptr<Search> search_;
+  // RootParallelSearches other than search_, and their trees.
+  std::vector<std::unique_ptr<Search>> helper_searches_;
+  std::vector<std::unique_ptr<NodeTree>> helper_trees_;
   std::unique_ptr<NodeTree> tree_;
+  // Position the head of tree_ was last set to.
+  CurrentPosition tree_position_;
+  // Trees of other lines kept for AnalysisTrees, least recently used first.
+  std::vector<std::pair<CurrentPosition, std::unique_ptr<NodeTree>>>
+      spare_trees_;
   std::unique_ptr<SyzygyTablebase> syzygy_tb_;
   std::unique_ptr<Network> network_;
+  std::unique_ptr<PersistentNNCache> persistent_cache_;
   NNCache cache_;
 
-  // Store current TB and network settings to track when they change so that
-  // they are reloaded.
+  // Store current TB, network and NN cache file settings to track when they
+  // change so that they are reloaded.
   std::string tb_paths_;
+  // Preloaded and locked tablebase piece counts.
+  std::pair<int, int> tb_preload_;
   NetworkFactory::BackendConfiguration network_configuration_;
+  std::string persistent_cache_file_;
+  size_t persistent_cache_bytes_ = 0;
+  std::string preload_cache_file_;
+
+  // Network being loaded in the background for BackgroundNetLoad.
+  struct PendingNetwork {
+    NetworkFactory::BackendConfiguration configuration;
+    // Settings the loader reads, declared before the future which waits for
+    // the loader on destruction.
+    std::unique_ptr<OptionsDict> options;
+    std::future<std::unique_ptr<Network>> network;
+  };
+  std::optional<PendingNetwork> pending_network_;
+  // Syzygy tables being loaded in the background by StartInitialization().
+  struct PendingTablebase {
+    std::string paths;
+    std::pair<int, int> preload;
+    std::future<std::unique_ptr<SyzygyTablebase>> tablebase;
+  };
+  std::optional<PendingTablebase> pending_tablebase_;
 
   // The current position as given with SetPosition. For normal (ie. non-ponder)
   // search, the tree is set up with this position, however, during ponder we
@@ -114,6 +178,11 @@ class EngineController {
 
   // If true we can reset move_start_time_ in "Go".
   bool strict_uci_timing_;
+
+  // Declared last, as it samples cache_ until destroyed.
+  std::string metrics_file_;
+  int metrics_interval_ = 0;
+  std::unique_ptr<MetricsFileWriter> metrics_writer_;
 };
 
 class EngineLoop : public UciLoop {
@@ -129,6 +198,7 @@ class EngineLoop : public UciLoop {
   void CmdPosition(const std::string& position,
                    const std::vector<std::string>& moves) override;
   void CmdFen() override;
+  void CmdSaveTree() override;
   void CmdGo(const GoParams& params) override;
   void CmdPonderHit() override;
   void CmdStop() override;
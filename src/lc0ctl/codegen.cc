@@ -0,0 +1,153 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "lc0ctl/codegen.h"
+
+#include <sstream>
+
+#include "neural/loader.h"
+#include "neural/network_legacy.h"
+#include "utils/exception.h"
+#include "utils/files.h"
+#include "utils/logging.h"
+#include "utils/optionsparser.h"
+
+namespace lczero {
+namespace {
+
+const OptionId kWeightsFilenameId{"weights", "WeightsFile",
+                                  "Path of the input Lc0 weights file.", 'w'};
+const OptionId kOutputFilenameId{"output", "OutputFile",
+                                 "Path of the C++ source file to write.", 'o'};
+
+bool ProcessParameters(OptionsParser* options) {
+  options->Add<StringOption>(kWeightsFilenameId);
+  options->Add<StringOption>(kOutputFilenameId);
+  if (!options->ProcessAllFlags()) return false;
+  const OptionsDict& dict = options->GetOptionsDict();
+  dict.EnsureExists<std::string>(kWeightsFilenameId);
+  dict.EnsureExists<std::string>(kOutputFilenameId);
+  return true;
+}
+
+// The emitted tower makes the same calls as the generic loop of the blas
+// backends, with the sizes as constants and one unrolled section per block.
+std::string GenerateTower(const WeightsFile& file) {
+  const auto& format = file.format().network_format();
+  if (format.network() ==
+          pblczero::NetworkFormat::NETWORK_ATTENTIONBODY_WITH_HEADFORMAT ||
+      file.weights().encoder_size() > 0) {
+    throw Exception("Only residual networks can be generated for.");
+  }
+  const LegacyWeights weights(file.weights());
+  if (weights.residual.empty()) {
+    throw Exception("The network has no residual blocks.");
+  }
+  const bool mish = format.default_activation() ==
+                    pblczero::NetworkFormat::DEFAULT_ACTIVATION_MISH;
+
+  std::ostringstream out;
+  out << "// Generated by \"lc0 codegen\" for a " << weights.residual.size()
+      << "x" << weights.input.biases.size() << " network. Do not edit.\n\n";
+  out << "#include \"neural/blas/generated_tower.h\"\n";
+  out << "#include \"neural/blas/se_unit.h\"\n";
+  out << "#include \"neural/network.h\"\n\n";
+  out << "namespace lczero {\n";
+  out << "namespace {\n\n";
+  out << "constexpr size_t kFilters = " << weights.input.biases.size()
+      << ";\n";
+  out << "constexpr ActivationFunction kActivation = "
+      << (mish ? "ACTIVATION_MISH" : "ACTIVATION_RELU") << ";\n\n";
+
+  out << "template <bool use_eigen>\n";
+  out << "void Tower(const LegacyWeights& w, size_t batch_size,\n";
+  out << "           WinogradConvolution3<use_eigen>* convolve3, "
+         "float* buffer1,\n";
+  out << "           float* buffer2, float* buffer3) {\n";
+  out << "  convolve3->Forward(batch_size, kInputPlanes, kFilters, buffer1,\n";
+  out << "                     w.input.weights.data(), buffer2,\n";
+  out << "                     w.input.biases.data(), kActivation);\n";
+  for (size_t i = 0; i < weights.residual.size(); i++) {
+    const auto& residual = weights.residual[i];
+    out << "  {\n";
+    out << "    const auto& block = w.residual[" << i << "];\n";
+    out << "    convolve3->Forward(batch_size, kFilters, kFilters, buffer2,\n";
+    out << "                       block.conv1.weights.data(), buffer1,\n";
+    out << "                       block.conv1.biases.data(), kActivation);\n";
+    if (residual.has_se) {
+      out << "    convolve3->Forward(batch_size, kFilters, kFilters, "
+             "buffer1,\n";
+      out << "                       block.conv2.weights.data(), "
+             "buffer3);\n";
+      out << "    ApplySEUnit<use_eigen>(\n";
+      out << "        batch_size, kFilters, " << residual.se.b1.size()
+          << ", buffer3, block.conv2.biases.data(),\n";
+      out << "        buffer2, block.se.w1.data(), block.se.b1.data(),\n";
+      out << "        block.se.w2.data(), block.se.b2.data(), buffer2, "
+             "kActivation);\n";
+    } else {
+      out << "    convolve3->Forward(batch_size, kFilters, kFilters, "
+             "buffer1,\n";
+      out << "                       block.conv2.weights.data(), buffer3,\n";
+      out << "                       block.conv2.biases.data(), kActivation,"
+             "\n";
+      out << "                       buffer2);\n";
+    }
+    out << "  }\n";
+  }
+  out << "}\n\n";
+
+  out << "const TowerShape kShape{kFilters, kActivation, {";
+  for (size_t i = 0; i < weights.residual.size(); i++) {
+    const auto& residual = weights.residual[i];
+    if (i > 0) out << ", ";
+    out << (residual.has_se ? residual.se.b1.size() : 0);
+  }
+  out << "}};\n";
+  out << "\n";
+  out << "}  // namespace\n\n";
+  out << "REGISTER_GENERATED_TOWER(kShape, Tower)\n\n";
+  out << "}  // namespace lczero\n";
+  return out.str();
+}
+
+}  // namespace
+
+void GenerateTowerCmd() {
+  OptionsParser options_parser;
+  if (!ProcessParameters(&options_parser)) return;
+
+  const OptionsDict& dict = options_parser.GetOptionsDict();
+  const auto file =
+      LoadWeightsFromFile(dict.Get<std::string>(kWeightsFilenameId));
+  const std::string output = dict.Get<std::string>(kOutputFilenameId);
+  WriteStringToFile(output, GenerateTower(file));
+  COUT << "Tower source written to " << output
+       << ", build it in with -Dgenerated_towers=" << output << ".";
+}
+
+}  // namespace lczero
@@ -27,18 +27,42 @@
 
 #include "lc0ctl/describenet.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <map>
+#include <sstream>
+
 #include "neural/loader.h"
 #include "neural/onnx/onnx.pb.h"
+#include "utils/files.h"
 #include "utils/optionsparser.h"
+#include "utils/string.h"
+#include "utils/weights_adapter.h"
 
 namespace lczero {
 namespace {
 
 const OptionId kWeightsFilenameId{"weights", "WeightsFile",
                                   "Path of the input Lc0 weights file.", 'w'};
+const OptionId kBatchSizesId{
+    "batch-sizes", "BatchSizes",
+    "Comma separated list of the batch sizes to estimate the cost for."};
+const OptionId kCalibrationFileId{
+    "calibration", "CalibrationFile",
+    "File with the throughput of backends, to predict the nps of the network. "
+    "Each line holds a backend name, a batch size and the GFLOP/s it reaches "
+    "at that batch size, e.g. as the nps of a benchmark run times the GFLOP "
+    "per position reported here for the benchmarked net."};
+const OptionId kBackendId{"backend", "Backend",
+                          "Backend of the calibration file to predict the nps "
+                          "for. All of them by default."};
 
 bool ProcessParameters(OptionsParser* options) {
   options->Add<StringOption>(kWeightsFilenameId);
+  options->Add<StringOption>(kBatchSizesId) = "1,32,256";
+  options->Add<StringOption>(kCalibrationFileId);
+  options->Add<StringOption>(kBackendId);
   if (!options->ProcessAllFlags()) return false;
   const OptionsDict& dict = options->GetOptionsDict();
   dict.EnsureExists<std::string>(kWeightsFilenameId);
@@ -54,6 +78,251 @@ std::string Justify(std::string str, size_t length = 30) {
   return str;
 }
 
+// Cost of one layer for a single position. Activations are the number of
+// values the layer outputs.
+struct LayerCost {
+  std::string name;
+  uint64_t flops = 0;
+  uint64_t params = 0;
+  uint64_t activations = 0;
+};
+
+class CostModel {
+ public:
+  explicit CostModel(const pblczero::Weights& w) {
+    if (w.encoder_size() > 0) {
+      AddAttentionBody(w);
+    } else {
+      AddResidualBody(w);
+    }
+    AddPolicyHead(w);
+    AddValueLikeHead("Value", w.value(), w.ip_val_w(), w.ip_val_b(),
+                     w.ip1_val_w(), w.ip1_val_b(), w.ip2_val_w(),
+                     w.ip2_val_b());
+    AddValueLikeHead("MLH", w.moves_left(), w.ip_mov_w(), w.ip_mov_b(),
+                     w.ip1_mov_w(), w.ip1_mov_b(), w.ip2_mov_w(),
+                     w.ip2_mov_b());
+  }
+
+  const std::vector<LayerCost>& layers() const { return layers_; }
+
+ private:
+  using Layer = pblczero::Weights::Layer;
+  static constexpr uint64_t kSquares = 64;
+
+  static uint64_t Size(const Layer& layer) {
+    return LayerAdapter(layer).size();
+  }
+
+  LayerCost& NewLayer(const std::string& name) {
+    layers_.emplace_back();
+    layers_.back().name = name;
+    return layers_.back();
+  }
+
+  // Weights applied to each square, i.e. a convolution or a dense layer over
+  // the per square embeddings.
+  static void AddPerSquare(LayerCost* cost, const Layer& weights,
+                           const Layer& biases) {
+    cost->flops += 2 * kSquares * Size(weights);
+    cost->params += Size(weights) + Size(biases);
+    cost->activations = std::max(cost->activations, kSquares * Size(biases));
+  }
+
+  // Dense layer applied once to the whole position.
+  static void AddOnce(LayerCost* cost, const Layer& weights,
+                      const Layer& biases) {
+    cost->flops += 2 * Size(weights);
+    cost->params += Size(weights) + Size(biases);
+    cost->activations = std::max(cost->activations, Size(biases));
+  }
+
+  static void AddConv(LayerCost* cost, const pblczero::Weights::ConvBlock& c) {
+    // Batch norm may come instead of biases.
+    const Layer& biases = Size(c.biases()) > 0 ? c.biases() : c.bn_means();
+    AddPerSquare(cost, c.weights(), biases);
+    cost->params += Size(c.bn_stddivs()) + Size(c.bn_gammas()) +
+                    Size(c.bn_betas());
+    if (&biases != &c.bn_means()) cost->params += Size(c.bn_means());
+  }
+
+  void AddResidualBody(const pblczero::Weights& w) {
+    AddConv(&NewLayer("Input"), w.input());
+    for (size_t i = 0; i < w.residual_size(); ++i) {
+      const auto& block = w.residual(i);
+      auto& cost = NewLayer("Block " + std::to_string(i));
+      AddConv(&cost, block.conv1());
+      AddConv(&cost, block.conv2());
+      if (block.has_se()) {
+        cost.flops += 2 * (Size(block.se().w1()) + Size(block.se().w2()));
+        cost.params += Size(block.se().w1()) + Size(block.se().b1()) +
+                       Size(block.se().w2()) + Size(block.se().b2());
+      }
+    }
+  }
+
+  static void AddEncoder(LayerCost* cost,
+                         const pblczero::Weights::EncoderLayer& layer,
+                         int heads, const Layer& smolgen_w) {
+    const auto& mha = layer.mha();
+    AddPerSquare(cost, mha.q_w(), mha.q_b());
+    AddPerSquare(cost, mha.k_w(), mha.k_b());
+    AddPerSquare(cost, mha.v_w(), mha.v_b());
+    // Q*K^T and the product of its softmax with V.
+    const uint64_t depth = Size(mha.q_b());
+    cost->flops += 2 * 2 * kSquares * kSquares * depth;
+    cost->activations =
+        std::max(cost->activations, kSquares * kSquares * heads);
+    if (mha.has_smolgen()) {
+      const auto& smolgen = mha.smolgen();
+      cost->flops += 2 * kSquares * Size(smolgen.compress());
+      cost->params += Size(smolgen.compress());
+      AddOnce(cost, smolgen.dense1_w(), smolgen.dense1_b());
+      AddOnce(cost, smolgen.dense2_w(), smolgen.dense2_b());
+      cost->params += Size(smolgen.ln1_gammas()) + Size(smolgen.ln1_betas()) +
+                      Size(smolgen.ln2_gammas()) + Size(smolgen.ln2_betas());
+      // The shared weights generating the attention logits of every head.
+      cost->flops += 2 * Size(smolgen_w) * heads;
+    }
+    AddPerSquare(cost, mha.dense_w(), mha.dense_b());
+    AddPerSquare(cost, layer.ffn().dense1_w(), layer.ffn().dense1_b());
+    AddPerSquare(cost, layer.ffn().dense2_w(), layer.ffn().dense2_b());
+    cost->params += Size(layer.ln1_gammas()) + Size(layer.ln1_betas()) +
+                    Size(layer.ln2_gammas()) + Size(layer.ln2_betas());
+  }
+
+  void AddAttentionBody(const pblczero::Weights& w) {
+    auto& embedding = NewLayer("Embedding");
+    AddPerSquare(&embedding, w.ip_emb_w(), w.ip_emb_b());
+    embedding.params += Size(w.ip_mult_gate()) + Size(w.ip_add_gate());
+    if (w.has_smolgen_w()) {
+      NewLayer("Smolgen weights").params =
+          Size(w.smolgen_w()) + Size(w.smolgen_b());
+    }
+    for (size_t i = 0; i < w.encoder_size(); ++i) {
+      AddEncoder(&NewLayer("Encoder " + std::to_string(i)), w.encoder(i),
+                 w.headcount(), w.smolgen_w());
+    }
+  }
+
+  void AddPolicyHead(const pblczero::Weights& w) {
+    auto& cost = NewLayer("Policy");
+    if (Size(w.ip2_pol_w()) > 0) {
+      // Attention policy.
+      AddPerSquare(&cost, w.ip_pol_w(), w.ip_pol_b());
+      for (size_t i = 0; i < w.pol_encoder_size(); ++i) {
+        AddEncoder(&NewLayer("Policy encoder " + std::to_string(i)),
+                   w.pol_encoder(i), w.pol_headcount(), w.smolgen_w());
+      }
+      auto& logits = NewLayer("Policy logits");
+      AddPerSquare(&logits, w.ip2_pol_w(), w.ip2_pol_b());
+      AddPerSquare(&logits, w.ip3_pol_w(), w.ip3_pol_b());
+      logits.flops += 2 * kSquares * kSquares * Size(w.ip2_pol_b());
+      logits.params += Size(w.ip4_pol_w());
+      logits.activations = std::max(logits.activations, kSquares * kSquares);
+      return;
+    }
+    if (w.has_policy1()) AddConv(&cost, w.policy1());
+    AddConv(&cost, w.policy());
+    // Dense policy over the policy channels.
+    AddOnce(&cost, w.ip_pol_w(), w.ip_pol_b());
+  }
+
+  void AddValueLikeHead(const std::string& name,
+                        const pblczero::Weights::ConvBlock& conv,
+                        const Layer& embedding_w, const Layer& embedding_b,
+                        const Layer& fc1_w, const Layer& fc1_b,
+                        const Layer& fc2_w, const Layer& fc2_b) {
+    if (Size(fc2_w) == 0) return;
+    auto& cost = NewLayer(name);
+    if (Size(conv.weights()) > 0) AddConv(&cost, conv);
+    AddPerSquare(&cost, embedding_w, embedding_b);
+    AddOnce(&cost, fc1_w, fc1_b);
+    AddOnce(&cost, fc2_w, fc2_b);
+  }
+
+  std::vector<LayerCost> layers_;
+};
+
+// Throughput of a backend in GFLOP/s by batch size.
+using Calibration = std::map<std::string, std::map<int, double>>;
+
+Calibration LoadCalibration(const std::string& filename) {
+  Calibration calibration;
+  std::istringstream file(ReadFileToString(filename));
+  std::string line;
+  while (std::getline(file, line)) {
+    const auto fields = StrSplitAtWhitespace(line);
+    if (fields.empty() || fields[0][0] == '#') continue;
+    if (fields.size() != 3) {
+      throw Exception(
+          "Calibration lines must be <backend> <batch> <GFLOP/s>: " + line);
+    }
+    calibration[fields[0]][std::stoi(fields[1])] = std::stod(fields[2]);
+  }
+  return calibration;
+}
+
+// Interpolates linearly between the calibrated batch sizes.
+double GetGflopsPerSecond(const std::map<int, double>& points, int batch) {
+  auto next = points.lower_bound(batch);
+  if (next == points.end()) return std::prev(next)->second;
+  if (next == points.begin() || next->first == batch) return next->second;
+  auto prev = std::prev(next);
+  return prev->second + (next->second - prev->second) *
+                            (batch - prev->first) /
+                            (next->first - prev->first);
+}
+
+std::string FormatNumber(double value, int precision = 2) {
+  std::ostringstream oss;
+  oss << std::fixed << std::setprecision(precision) << value;
+  return oss.str();
+}
+
+void ShowNetworkCostInfo(const pblczero::Net& weights,
+                         const std::vector<int>& batch_sizes,
+                         const Calibration& calibration,
+                         const std::string& backend) {
+  if (!weights.has_weights()) return;
+  const CostModel model(weights.weights());
+  COUT << "\nCost model (per position)";
+  COUT << "~~~~~~~~~~~~~~~~~~~~~~~~~";
+  uint64_t total_flops = 0;
+  uint64_t total_params = 0;
+  uint64_t max_activations = 0;
+  for (const auto& layer : model.layers()) {
+    COUT << Justify(layer.name) << FormatNumber(layer.flops / 1e6)
+         << " MFLOP, " << layer.params << " params, " << layer.activations
+         << " activations";
+    total_flops += layer.flops;
+    total_params += layer.params;
+    max_activations = std::max(max_activations, layer.activations);
+  }
+  COUT << Justify("Total") << FormatNumber(total_flops / 1e9, 3) << " GFLOP, "
+       << total_params << " params";
+  COUT << Justify("Parameter memory")
+       << FormatNumber(total_params * 4 / 1e6) << " MB fp32, "
+       << FormatNumber(total_params * 2 / 1e6) << " MB fp16";
+
+  COUT << "\nCost model (per batch)";
+  COUT << "~~~~~~~~~~~~~~~~~~~~~~";
+  for (const int batch : batch_sizes) {
+    // The largest layer output, which backends hold along with its input.
+    COUT << Justify("Batch " + std::to_string(batch))
+         << FormatNumber(total_flops * batch / 1e9) << " GFLOP, "
+         << FormatNumber(max_activations * batch * 4 / 1e6)
+         << " MB largest activation (fp32)";
+    for (const auto& [name, points] : calibration) {
+      if (!backend.empty() && name != backend) continue;
+      const double nps =
+          GetGflopsPerSecond(points, batch) * 1e9 / total_flops;
+      COUT << Justify("Predicted nps (" + name + ")")
+           << static_cast<int64_t>(nps);
+    }
+  }
+}
+
 }  // namespace
 
 void ShowNetworkGenericInfo(const pblczero::Net& weights) {
@@ -307,5 +576,17 @@ void DescribeNetworkCmd() {
   auto weights_file =
       LoadWeightsFromFile(dict.Get<std::string>(kWeightsFilenameId));
   ShowAllNetworkInfo(weights_file);
+
+  Calibration calibration;
+  if (dict.OwnExists<std::string>(kCalibrationFileId)) {
+    calibration = LoadCalibration(dict.Get<std::string>(kCalibrationFileId));
+  }
+  const std::string backend = dict.Get<std::string>(kBackendId);
+  if (!backend.empty() && calibration.find(backend) == calibration.end()) {
+    throw Exception("Backend " + backend + " is not in the calibration file.");
+  }
+  ShowNetworkCostInfo(weights_file,
+                      ParseIntList(dict.Get<std::string>(kBatchSizesId)),
+                      calibration, backend);
 }
 }  // namespace lczero
@@ -0,0 +1,214 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "lc0ctl/exportdata.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "trainingdata/reader.h"
+#include "utils/exception.h"
+#include "utils/filesystem.h"
+#include "utils/logging.h"
+#include "utils/optionsparser.h"
+
+namespace lczero {
+namespace {
+
+const OptionId kInputDirId{"input", "InputDir",
+                           "Directory with the training data files."};
+const OptionId kOutputDirId{"output", "OutputDir",
+                            "Directory to write the .npy column files to."};
+
+// Writes one array in the numpy .npy format. The header has a fixed size and
+// is rewritten with the final shape on Close(), so rows can be appended as
+// they come.
+class NpyColumn {
+ public:
+  NpyColumn(const std::string& path, const std::string& dtype, size_t width,
+            size_t item_size)
+      : path_(path), dtype_(dtype), width_(width), item_size_(item_size) {
+    file_ = std::fopen(path.c_str(), "wb");
+    if (!file_) throw Exception("Cannot create " + path);
+    WriteHeader();
+  }
+  ~NpyColumn() {
+    if (file_) std::fclose(file_);
+  }
+
+  void Append(const void* data, size_t rows) {
+    const size_t size = rows * width_ * item_size_;
+    if (std::fwrite(data, 1, size, file_) != size) {
+      throw Exception("Cannot write " + path_);
+    }
+    rows_ += rows;
+  }
+
+  size_t rows() const { return rows_; }
+
+  void Close() {
+    std::fseek(file_, 0, SEEK_SET);
+    WriteHeader();
+    if (std::fclose(file_) != 0) throw Exception("Cannot write " + path_);
+    file_ = nullptr;
+  }
+
+ private:
+  static constexpr size_t kHeaderSize = 128;
+
+  void WriteHeader() {
+    std::string shape = std::to_string(rows_) + ",";
+    if (width_ != 1) shape += " " + std::to_string(width_);
+    std::string header = "\x93NUMPY\x01";
+    header += '\0';
+    std::string dict = "{'descr': '" + dtype_ +
+                       "', 'fortran_order': False, 'shape': (" + shape +
+                       "), }";
+    const size_t dict_size = kHeaderSize - header.size() - 2;
+    dict.resize(dict_size - 1, ' ');
+    dict += '\n';
+    header += static_cast<char>(dict_size & 0xff);
+    header += static_cast<char>(dict_size >> 8);
+    header += dict;
+    std::fwrite(header.data(), 1, header.size(), file_);
+  }
+
+  const std::string path_;
+  const std::string dtype_;
+  const size_t width_;
+  const size_t item_size_;
+  std::FILE* file_;
+  size_t rows_ = 0;
+};
+
+bool ProcessParameters(OptionsParser* options) {
+  options->Add<StringOption>(kInputDirId);
+  options->Add<StringOption>(kOutputDirId);
+  if (!options->ProcessAllFlags()) return false;
+
+  const OptionsDict& dict = options->GetOptionsDict();
+  dict.EnsureExists<std::string>(kInputDirId);
+  dict.EnsureExists<std::string>(kOutputDirId);
+  return true;
+}
+
+}  // namespace
+
+// Columns written, all with one row per position unless noted:
+//   planes          uint64 [N, 104]  packed bitboards as stored in V6 data
+//   input_format    uint32 [N]
+//   board_info      uint8  [N, 8]    castling_us_ooo, castling_us_oo,
+//                                    castling_them_ooo, castling_them_oo,
+//                                    side_to_move_or_enpassant, rule50_count,
+//                                    invariance_info, dummy
+//   targets         float  [N, 15]   root_q, best_q, root_d, best_d, root_m,
+//                                    best_m, plies_left, result_q, result_d,
+//                                    played_q, played_d, played_m, orig_q,
+//                                    orig_d, orig_m
+//   visits          uint32 [N]
+//   move_idx        uint16 [N, 2]    played_idx, best_idx
+//   policy_kld      float  [N]
+//   policy_offsets  uint64 [N + 1]   rows of each position in policy_*
+//   policy_index    uint16 [M]       policy index of the legal moves
+//   policy_value    float  [M]
+//   game_offsets    uint64 [G + 1]   first position of each game
+void ExportTrainingDataCmd() {
+  OptionsParser options_parser;
+  if (!ProcessParameters(&options_parser)) return;
+
+  const OptionsDict& dict = options_parser.GetOptionsDict();
+  const auto input_dir = dict.Get<std::string>(kInputDirId);
+  const auto output_dir = dict.Get<std::string>(kOutputDirId) + "/";
+  CreateDirectory(output_dir);
+
+  NpyColumn planes(output_dir + "planes.npy", "<u8", 104, 8);
+  NpyColumn input_format(output_dir + "input_format.npy", "<u4", 1, 4);
+  NpyColumn board_info(output_dir + "board_info.npy", "|u1", 8, 1);
+  NpyColumn targets(output_dir + "targets.npy", "<f4", 15, 4);
+  NpyColumn visits(output_dir + "visits.npy", "<u4", 1, 4);
+  NpyColumn move_idx(output_dir + "move_idx.npy", "<u2", 2, 2);
+  NpyColumn policy_kld(output_dir + "policy_kld.npy", "<f4", 1, 4);
+  NpyColumn policy_offsets(output_dir + "policy_offsets.npy", "<u8", 1, 8);
+  NpyColumn policy_index(output_dir + "policy_index.npy", "<u2", 1, 2);
+  NpyColumn policy_value(output_dir + "policy_value.npy", "<f4", 1, 4);
+  NpyColumn game_offsets(output_dir + "game_offsets.npy", "<u8", 1, 8);
+
+  uint64_t position_count = 0;
+  uint64_t policy_count = 0;
+  std::vector<uint16_t> indices;
+  std::vector<float> values;
+  for (const auto& name : GetFileList(input_dir)) {
+    std::vector<V6TrainingData> chunks;
+    try {
+      TrainingDataReader reader(input_dir + "/" + name);
+      chunks = reader.ReadAll();
+    } catch (const Exception& e) {
+      CERR << "Skipping " << name << ": " << e.what();
+      continue;
+    }
+    game_offsets.Append(&position_count, 1);
+    for (const auto& chunk : chunks) {
+      // Positions the rescorer marked for deletion.
+      if (chunk.invariance_info & 64) continue;
+      planes.Append(chunk.planes, 1);
+      input_format.Append(&chunk.input_format, 1);
+      board_info.Append(&chunk.castling_us_ooo, 1);
+      targets.Append(&chunk.root_q, 1);
+      visits.Append(&chunk.visits, 1);
+      move_idx.Append(&chunk.played_idx, 1);
+      policy_kld.Append(&chunk.policy_kld, 1);
+      policy_offsets.Append(&policy_count, 1);
+      indices.clear();
+      values.clear();
+      for (uint16_t i = 0; i < 1858; i++) {
+        if (chunk.probabilities[i] < 0.0f) continue;
+        indices.push_back(i);
+        values.push_back(chunk.probabilities[i]);
+      }
+      policy_index.Append(indices.data(), indices.size());
+      policy_value.Append(values.data(), values.size());
+      policy_count += indices.size();
+      ++position_count;
+    }
+  }
+  game_offsets.Append(&position_count, 1);
+  policy_offsets.Append(&policy_count, 1);
+
+  for (auto* column :
+       {&planes, &input_format, &board_info, &targets, &visits, &move_idx,
+        &policy_kld, &policy_offsets, &policy_index, &policy_value,
+        &game_offsets}) {
+    column->Close();
+  }
+  COUT << "Exported " << position_count << " positions of "
+       << game_offsets.rows() - 1 << " games.";
+}
+
+}  // namespace lczero
@@ -29,6 +29,8 @@
 
 #include "neural/loader.h"
 #include "neural/onnx/converter.h"
+#include "neural/onnx/onnx.pb.h"
+#include "utils/exception.h"
 #include "utils/files.h"
 #include "utils/optionsparser.h"
 #include "lc0ctl/describenet.h"
@@ -55,6 +57,20 @@ const OptionId kOutputMlh{"mlh-head-name", "MlhHeadName",
                           "ONNX name to use for the MLH head output node."};
 const OptionId kOnnxToPytorch{"onnx2pytorch", "Onnx2Pytorch",
                           "Only use layer definitions supported by onnx2pytorch."};
+const OptionId kOnnxFuseBias{"fuse-bias", "OnnxFuseBias",
+                             "Emit dense layers as Gemm with fused bias."};
+const OptionId kOnnxFoldPolicyMap{
+    "fold-policy-map", "OnnxFoldPolicyMap",
+    "Gather attention policy promotion logits directly from the move logits."};
+const OptionId kOnnxInt8{"int8", "OnnxInt8",
+                         "Store weights as int8 with DequantizeLinear nodes "
+                         "(QDQ format). Needs opset 13 or higher."};
+const OptionId kOnnxExternalData{
+    "external-data", "OnnxExternalData",
+    "Store the large initializers in a separate file next to the ONNX model, "
+    "named after it with a .data suffix. Needed for models over 2GB."};
+const OptionId kOnnxMlh{"mlh", "OnnxMlh",
+                        "Include the moves left head, if the network has one."};
 
 bool ProcessParameters(OptionsParser* options) {
   options->Add<StringOption>(kInputFilenameId);
@@ -66,6 +82,11 @@ bool ProcessParameters(OptionsParser* options) {
   options->Add<StringOption>(kOutputValue) = "/output/value";
   options->Add<StringOption>(kOutputMlh) = "/output/mlh";
   options->Add<BoolOption>(kOnnxToPytorch) = false;
+  options->Add<BoolOption>(kOnnxFuseBias) = false;
+  options->Add<BoolOption>(kOnnxFoldPolicyMap) = false;
+  options->Add<BoolOption>(kOnnxInt8) = false;
+  options->Add<BoolOption>(kOnnxMlh) = true;
+  options->Add<BoolOption>(kOnnxExternalData) = false;
   if (!options->ProcessAllFlags()) return false;
 
   const OptionsDict& dict = options->GetOptionsDict();
@@ -77,6 +98,41 @@ bool ProcessParameters(OptionsParser* options) {
 
 }  // namespace
 
+// Initializers smaller than this stay in the model, as in the onnx package.
+constexpr size_t kExternalDataThreshold = 1024;
+
+// Writes the model to @filename, streaming the raw data of its large
+// initializers to "@filename.data" instead, and freeing each as it goes.
+void WriteOnnxWithExternalData(const std::string& filename,
+                               pblczero::ModelProto* model) {
+  const std::string data_filename = filename + ".data";
+  std::ofstream data(data_filename, std::ios::binary);
+  if (!data) throw Exception("Cannot create file: " + data_filename);
+  // The location is relative to the directory of the model.
+  const std::string location =
+      data_filename.substr(data_filename.find_last_of("/\\") + 1);
+  size_t offset = 0;
+  for (auto& tensor : *model->mutable_graph()->mutable_initializer()) {
+    const std::string_view raw_data = tensor.raw_data();
+    if (raw_data.size() < kExternalDataThreshold) continue;
+    data.write(raw_data.data(), raw_data.size());
+    auto add_entry = [&](const std::string& key, const std::string& value) {
+      auto* entry = tensor.add_external_data();
+      entry->set_key(key);
+      entry->set_value(value);
+    };
+    add_entry("location", location);
+    add_entry("offset", std::to_string(offset));
+    add_entry("length", std::to_string(raw_data.size()));
+    offset += raw_data.size();
+    tensor.set_data_location(pblczero::TensorProto::EXTERNAL);
+    tensor.clear_raw_data();
+  }
+  data.close();
+  if (!data) throw Exception("Cannot write file: " + data_filename);
+  WriteStringToFile(filename, model->OutputAsString());
+}
+
 void ConvertLeelaToOnnx() {
   OptionsParser options_parser;
   if (!ProcessParameters(&options_parser)) return;
@@ -100,11 +156,22 @@ void ConvertLeelaToOnnx() {
     // onnx2pytorch only needs an alternate layernorm-implementation, so it's currently
     // only enables that. Might need to be extended in the future.
     onnx_options.alternative_layer_normalization = dict.Get<bool>(kOnnxToPytorch);
+    onnx_options.fuse_bias = dict.Get<bool>(kOnnxFuseBias);
+    onnx_options.fold_policy_map = dict.Get<bool>(kOnnxFoldPolicyMap);
+    onnx_options.quantize_int8 = dict.Get<bool>(kOnnxInt8);
+    onnx_options.mlh = dict.Get<bool>(kOnnxMlh);
     weights_file = ConvertWeightsToOnnx(weights_file, onnx_options);
   }
 
   const auto& onnx = weights_file.onnx_model();
-  WriteStringToFile(dict.Get<std::string>(kOutputFilenameId), onnx.model());
+  const std::string output = dict.Get<std::string>(kOutputFilenameId);
+  if (dict.Get<bool>(kOnnxExternalData)) {
+    pblczero::ModelProto model;
+    model.ParseFromString(onnx.model());
+    WriteOnnxWithExternalData(output, &model);
+  } else {
+    WriteStringToFile(output, onnx.model());
+  }
   ShowNetworkOnnxInfo(weights_file, false);
   COUT << "Done.";
 }
@@ -29,12 +29,16 @@
 
 #include <algorithm>
 #include <fstream>
+#include <map>
+#include <memory>
+#include <optional>
 #include <set>
 
 #include "lc0ctl/describenet.h"
 #include "neural/onnx/onnx.pb.h"
 #include "proto/net.pb.h"
 #include "utils/files.h"
+#include "utils/filesystem.h"
 #include "utils/fp16_utils.h"
 #include "utils/optionsparser.h"
 
@@ -417,6 +421,46 @@ bool MaybeFixOnnx(pblczero::ModelProto& model, const OptionsDict& dict,
 
 }  // namespace
 
+// Moves the initializers stored in external data files back into the model,
+// as the weights file embeds the model alone. The files are looked up
+// relative to the directory of @model_filename. Returns whether there were
+// any.
+bool InlineExternalData(pblczero::ModelProto& model,
+                        const std::string& model_filename) {
+  const std::string dir =
+      model_filename.substr(0, model_filename.find_last_of("/\\") + 1);
+  std::map<std::string, std::unique_ptr<MappedFile>> files;
+  bool inlined = false;
+  for (auto& tensor : *model.mutable_graph()->mutable_initializer()) {
+    if (tensor.data_location() != pblczero::TensorProto::EXTERNAL) continue;
+    std::string location;
+    size_t offset = 0;
+    std::optional<size_t> length;
+    for (const auto& entry : tensor.external_data()) {
+      if (entry.key() == "location") {
+        location = entry.value();
+      } else if (entry.key() == "offset") {
+        offset = std::stoull(std::string(entry.value()));
+      } else if (entry.key() == "length") {
+        length = std::stoull(std::string(entry.value()));
+      }
+    }
+    auto& file = files[location];
+    if (!file) file = std::make_unique<MappedFile>(dir + location);
+    if (offset > file->size() ||
+        length.value_or(0) > file->size() - offset) {
+      throw Exception("External data of " + std::string(tensor.name()) +
+                      " is out of bounds of " + location);
+    }
+    tensor.set_raw_data(std::string_view(
+        file->data() + offset, length.value_or(file->size() - offset)));
+    tensor.mutable_external_data()->clear();
+    tensor.clear_data_location();
+    inlined = true;
+  }
+  return inlined;
+}
+
 void ConvertOnnxToLeela() {
   using pblczero::NetworkFormat;
   using pblczero::OnnxModel;
@@ -425,9 +469,12 @@ void ConvertOnnxToLeela() {
 
   const OptionsDict& dict = options_parser.GetOptionsDict();
 
-  auto onnx_model = ReadFileToString(dict.Get<std::string>(kInputFilenameId));
+  const std::string input = dict.Get<std::string>(kInputFilenameId);
+  auto onnx_model = ReadFileToString(input);
   pblczero::ModelProto model;
   model.ParseFromString(onnx_model);
+  // The model has to be serialized again if anything was inlined.
+  const bool inlined = InlineExternalData(model, input);
 
   pblczero::Net out_weights;
   out_weights.set_magic(0x1c0);
@@ -479,15 +526,18 @@ void ConvertOnnxToLeela() {
     onnx->set_output_mlh(dict.Get<std::string>(kOnnxOutputMlhId));
   }
 
-  if (MaybeFixOnnx(model, dict, data_type)) {
+  if (MaybeFixOnnx(model, dict, data_type) || inlined) {
     onnx->set_model(model.OutputAsString());
   } else {
     onnx->set_model(onnx_model);
   }
+  // Only the copy in the weights is needed from here on.
+  onnx_model = std::string();
   if (dict.Get<bool>(kValidateModelId) &&
       !ValidateNetwork(out_weights, model)) {
     return;
   }
+  model = pblczero::ModelProto();
   WriteStringToGzFile(dict.Get<std::string>(kOutputFilenameId),
                       out_weights.OutputAsString());
   ShowNetworkFormatInfo(out_weights);
@@ -0,0 +1,366 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "lc0ctl/quantize.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+#include "chess/position.h"
+#include "neural/encoder.h"
+#include "neural/factory.h"
+#include "neural/loader.h"
+#include "utils/files.h"
+#include "utils/filesystem.h"
+#include "utils/fp16_utils.h"
+#include "utils/optionsparser.h"
+#include "utils/random.h"
+#include "utils/weights_adapter.h"
+#include "version.h"
+
+namespace lczero {
+namespace {
+
+using Layer = pblczero::Weights::Layer;
+
+const OptionId kInputFilenameId{"input", "InputFile",
+                                "Path of the input Lc0 weights file."};
+const OptionId kOutputFilenameId{"output", "OutputFile",
+                                 "Path of the output Lc0 weights file."};
+const OptionId kEncodingId{"encoding", "Encoding",
+                           "Encoding to store the weights in."};
+const OptionId kBackendId{
+    "backend", "Backend",
+    "Backend to compare the outputs of both networks with. The default one "
+    "if empty."};
+const OptionId kBackendOptionsId{"backend-opts", "BackendOptions",
+                                 "Options of the backend."};
+const OptionId kPositionsId{
+    "positions", "Positions",
+    "File with a FEN per line to compare the outputs on. Random positions "
+    "if empty."};
+const OptionId kNumPositionsId{"num-positions", "NumPositions",
+                               "Number of random positions to compare the "
+                               "outputs on, when there is no positions file."};
+const OptionId kMaxQErrorId{
+    "max-q-error", "MaxQError",
+    "The network isn't written if Q differs more than this from the original "
+    "in any position."};
+
+bool ProcessParameters(OptionsParser* options) {
+  options->Add<StringOption>(kInputFilenameId);
+  options->Add<StringOption>(kOutputFilenameId);
+  options->Add<ChoiceOption>(kEncodingId, std::vector<std::string>{
+                                              "LINEAR16", "FLOAT16",
+                                              "BFLOAT16"}) = "FLOAT16";
+  options->Add<StringOption>(kBackendId);
+  options->Add<StringOption>(kBackendOptionsId);
+  options->Add<StringOption>(kPositionsId);
+  options->Add<IntOption>(kNumPositionsId, 1, 100000) = 256;
+  options->Add<FloatOption>(kMaxQErrorId, 0.0f, 2.0f) = 0.01f;
+  if (!options->ProcessAllFlags()) return false;
+
+  const OptionsDict& dict = options->GetOptionsDict();
+  dict.EnsureExists<std::string>(kInputFilenameId);
+  dict.EnsureExists<std::string>(kOutputFilenameId);
+  return true;
+}
+
+void Encode(Layer* layer, Layer::Encoding encoding) {
+  if (!layer->has_params()) return;
+  const std::vector<float> values = LayerAdapter(*layer).as_vector();
+  std::string params;
+  if (encoding == Layer::LINEAR16) {
+    const auto [min, max] = std::minmax_element(values.begin(), values.end());
+    const float min_val = values.empty() ? 0.0f : *min;
+    const float max_val = values.empty() ? 0.0f : *max;
+    const float range = max_val - min_val;
+    params.resize(values.size() * sizeof(uint16_t));
+    for (size_t i = 0; i < values.size(); i++) {
+      const uint16_t value =
+          range > 0.0f ? std::lround((values[i] - min_val) / range * 0xffff)
+                       : 0;
+      memcpy(&params[i * sizeof(value)], &value, sizeof(value));
+    }
+    layer->set_min_val(min_val);
+    layer->set_max_val(max_val);
+  } else {
+    params.resize(values.size() * sizeof(uint16_t));
+    for (size_t i = 0; i < values.size(); i++) {
+      const uint16_t value = encoding == Layer::FLOAT16
+                                 ? FP32toFP16(values[i])
+                                 : FP32toBF16(values[i]);
+      memcpy(&params[i * sizeof(value)], &value, sizeof(value));
+    }
+  }
+  layer->set_params(params);
+  layer->set_encoding(encoding);
+}
+
+// Calls mutable_*() only for the fields present, as it makes them present.
+#define ADD_LAYER(msg, field) \
+  if ((msg)->has_##field()) layers->push_back((msg)->mutable_##field())
+
+void AddLayers(pblczero::Weights::ConvBlock* block,
+               std::vector<Layer*>* layers) {
+  ADD_LAYER(block, weights);
+  ADD_LAYER(block, biases);
+  ADD_LAYER(block, bn_means);
+  ADD_LAYER(block, bn_stddivs);
+  ADD_LAYER(block, bn_gammas);
+  ADD_LAYER(block, bn_betas);
+}
+
+void AddLayers(pblczero::Weights::EncoderLayer* encoder,
+               std::vector<Layer*>* layers) {
+  auto* mha = encoder->mutable_mha();
+  ADD_LAYER(mha, q_w);
+  ADD_LAYER(mha, q_b);
+  ADD_LAYER(mha, k_w);
+  ADD_LAYER(mha, k_b);
+  ADD_LAYER(mha, v_w);
+  ADD_LAYER(mha, v_b);
+  ADD_LAYER(mha, dense_w);
+  ADD_LAYER(mha, dense_b);
+  if (mha->has_smolgen()) {
+    auto* smolgen = mha->mutable_smolgen();
+    ADD_LAYER(smolgen, compress);
+    ADD_LAYER(smolgen, dense1_w);
+    ADD_LAYER(smolgen, dense1_b);
+    ADD_LAYER(smolgen, ln1_gammas);
+    ADD_LAYER(smolgen, ln1_betas);
+    ADD_LAYER(smolgen, dense2_w);
+    ADD_LAYER(smolgen, dense2_b);
+    ADD_LAYER(smolgen, ln2_gammas);
+    ADD_LAYER(smolgen, ln2_betas);
+  }
+  ADD_LAYER(encoder, ln1_gammas);
+  ADD_LAYER(encoder, ln1_betas);
+  auto* ffn = encoder->mutable_ffn();
+  ADD_LAYER(ffn, dense1_w);
+  ADD_LAYER(ffn, dense1_b);
+  ADD_LAYER(ffn, dense2_w);
+  ADD_LAYER(ffn, dense2_b);
+  ADD_LAYER(encoder, ln2_gammas);
+  ADD_LAYER(encoder, ln2_betas);
+}
+
+std::vector<Layer*> GetAllLayers(pblczero::Weights* w) {
+  std::vector<Layer*> result;
+  std::vector<Layer*>* layers = &result;
+  if (w->has_input()) AddLayers(w->mutable_input(), layers);
+  for (auto& residual : *w->mutable_residual()) {
+    AddLayers(residual.mutable_conv1(), layers);
+    AddLayers(residual.mutable_conv2(), layers);
+    if (residual.has_se()) {
+      auto* se = residual.mutable_se();
+      ADD_LAYER(se, w1);
+      ADD_LAYER(se, b1);
+      ADD_LAYER(se, w2);
+      ADD_LAYER(se, b2);
+    }
+  }
+  ADD_LAYER(w, ip_emb_w);
+  ADD_LAYER(w, ip_emb_b);
+  ADD_LAYER(w, ip_mult_gate);
+  ADD_LAYER(w, ip_add_gate);
+  for (auto& encoder : *w->mutable_encoder()) AddLayers(&encoder, layers);
+  for (auto& encoder : *w->mutable_pol_encoder()) AddLayers(&encoder, layers);
+  if (w->has_policy1()) AddLayers(w->mutable_policy1(), layers);
+  if (w->has_policy()) AddLayers(w->mutable_policy(), layers);
+  ADD_LAYER(w, ip_pol_w);
+  ADD_LAYER(w, ip_pol_b);
+  ADD_LAYER(w, ip2_pol_w);
+  ADD_LAYER(w, ip2_pol_b);
+  ADD_LAYER(w, ip3_pol_w);
+  ADD_LAYER(w, ip3_pol_b);
+  ADD_LAYER(w, ip4_pol_w);
+  if (w->has_value()) AddLayers(w->mutable_value(), layers);
+  ADD_LAYER(w, ip_val_w);
+  ADD_LAYER(w, ip_val_b);
+  ADD_LAYER(w, ip1_val_w);
+  ADD_LAYER(w, ip1_val_b);
+  ADD_LAYER(w, ip2_val_w);
+  ADD_LAYER(w, ip2_val_b);
+  if (w->has_moves_left()) AddLayers(w->mutable_moves_left(), layers);
+  ADD_LAYER(w, ip_mov_w);
+  ADD_LAYER(w, ip_mov_b);
+  ADD_LAYER(w, ip1_mov_w);
+  ADD_LAYER(w, ip1_mov_b);
+  ADD_LAYER(w, ip2_mov_w);
+  ADD_LAYER(w, ip2_mov_b);
+  ADD_LAYER(w, smolgen_w);
+  ADD_LAYER(w, smolgen_b);
+  return result;
+}
+
+#undef ADD_LAYER
+
+std::vector<PositionHistory> LoadPositions(const std::string& filename) {
+  std::vector<PositionHistory> result;
+  std::ifstream file(filename);
+  if (!file) throw Exception("Cannot open " + filename);
+  for (std::string fen; std::getline(file, fen);) {
+    if (fen.empty()) continue;
+    ChessBoard board;
+    int rule50_ply;
+    int full_moves;
+    board.SetFromFen(fen, &rule50_ply, &full_moves);
+    result.emplace_back().Reset(board, rule50_ply,
+                                full_moves * 2 - (board.flipped() ? 1 : 2));
+  }
+  return result;
+}
+
+// Positions reached by up to 40 random moves from the initial position.
+std::vector<PositionHistory> RandomPositions(int count) {
+  std::vector<PositionHistory> result;
+  ChessBoard board;
+  board.SetFromFen(ChessBoard::kStartposFen);
+  while (static_cast<int>(result.size()) < count) {
+    PositionHistory game;
+    game.Reset(board, 0, 0);
+    const int plies = Random::Get().GetInt(0, 40);
+    for (int ply = 0; ply < plies; ply++) {
+      if (game.ComputeGameResult() != GameResult::UNDECIDED) break;
+      const auto moves = game.Last().GetBoard().GenerateLegalMoves();
+      game.Append(moves[Random::Get().GetInt(0, moves.size() - 1)]);
+    }
+    result.push_back(std::move(game));
+  }
+  return result;
+}
+
+// Compares the outputs of both networks, and returns the largest Q error.
+float CompareOutputs(Network* original, Network* quantized,
+                     const std::vector<PositionHistory>& positions) {
+  const auto input_format = original->GetCapabilities().input_format;
+  constexpr size_t kBatchSize = 256;
+  float max_q_error = 0.0f;
+  double sum_q_error = 0.0;
+  float max_policy_error = 0.0f;
+  size_t same_best_move = 0;
+  for (size_t start = 0; start < positions.size(); start += kBatchSize) {
+    const size_t end = std::min(positions.size(), start + kBatchSize);
+    auto computation1 = original->NewComputation();
+    auto computation2 = quantized->NewComputation();
+    for (size_t i = start; i < end; i++) {
+      auto planes = EncodePositionForNN(input_format, positions[i], 8,
+                                        FillEmptyHistory::FEN_ONLY, nullptr);
+      computation1->AddInput(InputPlanes(planes));
+      computation2->AddInput(std::move(planes));
+    }
+    computation1->ComputeBlocking();
+    computation2->ComputeBlocking();
+    for (size_t i = 0; i < end - start; i++) {
+      const float q_error =
+          std::abs(computation1->GetQVal(i) - computation2->GetQVal(i));
+      max_q_error = std::max(max_q_error, q_error);
+      sum_q_error += q_error;
+      int best1 = 0;
+      int best2 = 0;
+      for (int j = 0; j < 1858; j++) {
+        const float p1 = computation1->GetPVal(i, j);
+        const float p2 = computation2->GetPVal(i, j);
+        max_policy_error = std::max(max_policy_error, std::abs(p1 - p2));
+        if (p1 > computation1->GetPVal(i, best1)) best1 = j;
+        if (p2 > computation2->GetPVal(i, best2)) best2 = j;
+      }
+      if (best1 == best2) same_best_move++;
+    }
+  }
+  COUT << "Max Q error: " << max_q_error
+       << ", mean Q error: " << sum_q_error / positions.size()
+       << ", max policy logit error: " << max_policy_error
+       << ", same top policy: " << 100.0 * same_best_move / positions.size()
+       << "%";
+  return max_q_error;
+}
+
+}  // namespace
+
+void QuantizeNetworkCmd() {
+  OptionsParser options_parser;
+  if (!ProcessParameters(&options_parser)) return;
+
+  const OptionsDict& dict = options_parser.GetOptionsDict();
+  const std::string input = dict.Get<std::string>(kInputFilenameId);
+  const std::string output = dict.Get<std::string>(kOutputFilenameId);
+  const auto original = LoadWeightsFromFile(input);
+  if (!original.has_weights()) {
+    throw Exception("The network has no weights to quantize.");
+  }
+  Layer::Encoding encoding = Layer::FLOAT16;
+  const std::string encoding_name = dict.Get<std::string>(kEncodingId);
+  if (encoding_name == "LINEAR16") encoding = Layer::LINEAR16;
+  if (encoding_name == "BFLOAT16") encoding = Layer::BFLOAT16;
+
+  auto quantized = original;
+  for (Layer* layer : GetAllLayers(quantized.mutable_weights())) {
+    Encode(layer, encoding);
+  }
+  if (encoding != Layer::LINEAR16) {
+    // Older versions read every layer as LINEAR16.
+    auto* version = quantized.mutable_min_version();
+    if (GetVersionInt(version->major(), version->minor(), version->patch()) <
+        GetVersionInt()) {
+      version->set_major(LC0_VERSION_MAJOR);
+      version->set_minor(LC0_VERSION_MINOR);
+      version->set_patch(LC0_VERSION_PATCH);
+    }
+  }
+
+  std::string backend = dict.Get<std::string>(kBackendId);
+  if (backend.empty()) {
+    const auto backends = NetworkFactory::Get()->GetBackendsList();
+    if (backends.empty()) throw Exception("No backend to compare with.");
+    backend = backends[0];
+  }
+  OptionsDict backend_options;
+  backend_options.AddSubdictFromString(
+      dict.Get<std::string>(kBackendOptionsId));
+  const auto positions =
+      dict.Get<std::string>(kPositionsId).empty()
+          ? RandomPositions(dict.Get<int>(kNumPositionsId))
+          : LoadPositions(dict.Get<std::string>(kPositionsId));
+  COUT << "Comparing the outputs on " << positions.size()
+       << " positions with the " << backend << " backend.";
+  const float max_q_error = CompareOutputs(
+      NetworkFactory::Get()->Create(backend, original, backend_options).get(),
+      NetworkFactory::Get()->Create(backend, quantized, backend_options).get(),
+      positions);
+  if (max_q_error > dict.Get<float>(kMaxQErrorId)) {
+    throw Exception("Q error is over the limit, the network wasn't written.");
+  }
+
+  WriteStringToGzFile(output, quantized.OutputAsString());
+  COUT << "Network written, " << GetFileSize(input) << " bytes before, "
+       << GetFileSize(output) << " bytes after.";
+}
+
+}  // namespace lczero
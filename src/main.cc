@@ -25,13 +25,23 @@
   Program grant you additional permission to convey the resulting work.
 */
 
+#include "analysis/batch.h"
 #include "benchmark/backendbench.h"
 #include "benchmark/benchmark.h"
+#include "benchmark/perft.h"
+#include "benchmark/scalebench.h"
 #include "chess/board.h"
 #include "engine.h"
+#include "lc0ctl/codegen.h"
 #include "lc0ctl/describenet.h"
+#include "lc0ctl/exportdata.h"
 #include "lc0ctl/leela2onnx.h"
 #include "lc0ctl/onnx2leela.h"
+#include "lc0ctl/quantize.h"
+#include "lc0ctl/unpacknet.h"
+#ifndef _WIN32
+#include "neural/remote/server.h"
+#endif
 #include "selfplay/loop.h"
 #include "utils/commandline.h"
 #include "utils/esc_codes.h"
@@ -54,18 +64,39 @@ int main(int argc, const char** argv) {
     CommandLine::RegisterMode("uci", "(default) Act as UCI engine");
     CommandLine::RegisterMode("selfplay", "Play games with itself");
     CommandLine::RegisterMode("benchmark", "Quick benchmark");
+    CommandLine::RegisterMode(
+        "analyze", "Search a stream of positions from stdin concurrently");
     CommandLine::RegisterMode("backendbench",
                               "Quick benchmark of backend only");
+    CommandLine::RegisterMode("perft", "Benchmark of move generation");
+    CommandLine::RegisterMode(
+        "scalebench", "Find the fastest threads, minibatch and backend setup");
     CommandLine::RegisterMode("leela2onnx", "Convert Leela network to ONNX.");
     CommandLine::RegisterMode("onnx2leela",
                               "Convert ONNX network to Leela net.");
     CommandLine::RegisterMode("describenet",
                               "Shows details about the Leela network.");
+    CommandLine::RegisterMode("unpacknet",
+                              "Convert network to uncompressed format.");
+    CommandLine::RegisterMode("quantize",
+                              "Re-encode network weights, e.g. as fp16.");
+    CommandLine::RegisterMode(
+        "codegen", "Emit a blas residual tower specialized for a network.");
+    CommandLine::RegisterMode("exportdata",
+                              "Convert training data to .npy columns.");
+#ifndef _WIN32
+    CommandLine::RegisterMode("serve",
+                              "Serve the network to remote backends.");
+#endif
 
     if (CommandLine::ConsumeCommand("selfplay")) {
       // Selfplay mode.
       SelfPlayLoop loop;
       loop.RunLoop();
+    } else if (CommandLine::ConsumeCommand("analyze")) {
+      // Batch analysis mode.
+      BatchAnalysis analysis;
+      analysis.Run();
     } else if (CommandLine::ConsumeCommand("benchmark")) {
       // Benchmark mode.
       Benchmark benchmark;
@@ -74,12 +105,34 @@ int main(int argc, const char** argv) {
       // Backend Benchmark mode.
       BackendBenchmark benchmark;
       benchmark.Run();
+    } else if (CommandLine::ConsumeCommand("scalebench")) {
+      // Search scaling benchmark mode.
+      ScaleBenchmark benchmark;
+      benchmark.Run();
+    } else if (CommandLine::ConsumeCommand("perft")) {
+      // Move generation benchmark mode.
+      PerftBenchmark perft;
+      perft.Run();
     } else if (CommandLine::ConsumeCommand("leela2onnx")) {
       lczero::ConvertLeelaToOnnx();
     } else if (CommandLine::ConsumeCommand("onnx2leela")) {
       lczero::ConvertOnnxToLeela();
     } else if (CommandLine::ConsumeCommand("describenet")) {
       lczero::DescribeNetworkCmd();
+    } else if (CommandLine::ConsumeCommand("unpacknet")) {
+      lczero::UnpackNetworkCmd();
+    } else if (CommandLine::ConsumeCommand("quantize")) {
+      lczero::QuantizeNetworkCmd();
+    } else if (CommandLine::ConsumeCommand("codegen")) {
+      lczero::GenerateTowerCmd();
+    } else if (CommandLine::ConsumeCommand("exportdata")) {
+      lczero::ExportTrainingDataCmd();
+#ifndef _WIN32
+    } else if (CommandLine::ConsumeCommand("serve")) {
+      // Inference server mode.
+      InferenceServer server;
+      server.Run();
+#endif
     } else {
       // Consuming optional "uci" mode.
       CommandLine::ConsumeCommand("uci");
@@ -0,0 +1,87 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "mcts/batchsize.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace lczero {
+
+namespace {
+// Weight of older samples is multiplied by this for every new one.
+constexpr double kDecay = 0.9;
+// Samples needed before the fit is trusted.
+constexpr int kMinSamples = 4;
+}  // namespace
+
+MinibatchSizeController::MinibatchSizeController(int base_size,
+                                                 float time_share)
+    : base_size_(base_size),
+      min_size_(std::max(1, base_size / 8)),
+      max_size_(std::max({1, base_size, std::min(2 * base_size, 1024)})),
+      time_share_(time_share) {}
+
+void MinibatchSizeController::AddSample(int batch_size, float latency_ms) {
+  if (batch_size <= 0) return;
+  weight_ = weight_ * kDecay + 1.0;
+  sum_b_ = sum_b_ * kDecay + batch_size;
+  sum_t_ = sum_t_ * kDecay + latency_ms;
+  sum_bb_ = sum_bb_ * kDecay + static_cast<double>(batch_size) * batch_size;
+  sum_bt_ = sum_bt_ * kDecay + batch_size * latency_ms;
+  ++samples_;
+
+  const double mean_b = sum_b_ / weight_;
+  const double mean_t = sum_t_ / weight_;
+  const double var_b = sum_bb_ / weight_ - mean_b * mean_b;
+  const double cov_bt = sum_bt_ / weight_ - mean_b * mean_t;
+  if (samples_ >= kMinSamples && var_b > 1.0 && cov_bt > 0.0) {
+    per_eval_ms_ = cov_bt / var_b;
+    fixed_ms_ = std::max(0.0, mean_t - per_eval_ms_ * mean_b);
+  } else {
+    // Not enough spread in batch sizes, assume latency is proportional.
+    per_eval_ms_ = mean_t / mean_b;
+    fixed_ms_ = 0.0f;
+  }
+}
+
+int MinibatchSizeController::GetTargetSize(
+    std::optional<int64_t> remaining_time_ms) {
+  if (!remaining_time_ms || samples_ < kMinSamples || per_eval_ms_ <= 0.0f) {
+    return base_size_;
+  }
+  const double budget_ms = *remaining_time_ms * time_share_;
+  const double size = std::floor((budget_ms - fixed_ms_) / per_eval_ms_);
+  int target = static_cast<int>(
+      std::clamp(size, static_cast<double>(min_size_),
+                 static_cast<double>(max_size_)));
+  dither_up_ = !dither_up_;
+  target += (dither_up_ ? 1 : -1) * (target / 16);
+  return std::clamp(target, min_size_, max_size_);
+}
+
+}  // namespace lczero
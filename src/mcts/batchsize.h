@@ -0,0 +1,74 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+namespace lczero {
+
+// Tunes the minibatch size of a search worker from measured backend latency.
+// It keeps an exponentially weighted linear fit of
+//   latency = fixed_ms + per_eval_ms * batch_size
+// and picks the largest batch whose predicted latency fits into a share of the
+// remaining move time, within [base / 8, 2 * base], growing no further than
+// 1024 unless the base itself is larger. Without a time limit it keeps the
+// base size, as there is no budget to fit.
+class MinibatchSizeController {
+ public:
+  MinibatchSizeController(int base_size, float time_share);
+
+  // Records a backend computation of @batch_size evaluations.
+  void AddSample(int batch_size, float latency_ms);
+  // Returns the minibatch size to gather next, @remaining_time_ms being empty
+  // when the move has no time limit.
+  int GetTargetSize(std::optional<int64_t> remaining_time_ms);
+
+  float GetFixedLatencyMs() const { return fixed_ms_; }
+  float GetPerEvalLatencyMs() const { return per_eval_ms_; }
+
+ private:
+  const int base_size_;
+  const int min_size_;
+  const int max_size_;
+  const float time_share_;
+  // Weighted sums for the fit.
+  double weight_ = 0.0;
+  double sum_b_ = 0.0;
+  double sum_t_ = 0.0;
+  double sum_bb_ = 0.0;
+  double sum_bt_ = 0.0;
+  int samples_ = 0;
+  float fixed_ms_ = 0.0f;
+  float per_eval_ms_ = 0.0f;
+  // Alternates small deviations from the chosen size, so that the fit keeps
+  // seeing different batch sizes.
+  bool dither_up_ = false;
+};
+
+}  // namespace lczero
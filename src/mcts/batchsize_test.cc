@@ -0,0 +1,118 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "mcts/batchsize.h"
+
+#include <gtest/gtest.h>
+
+#include <optional>
+
+namespace lczero {
+namespace {
+
+// Feeds the controller computations taking 2ms plus 0.05ms per evaluation,
+// for batch sizes around @base_size.
+void AddLinearSamples(MinibatchSizeController* controller, int base_size) {
+  for (int i = 0; i < 10; i++) {
+    const int batch_size = base_size + (i % 2 ? 1 : -1) * (base_size / 16);
+    controller->AddSample(batch_size, 2.0f + 0.05f * batch_size);
+  }
+}
+
+TEST(MinibatchSizeController, KeepsBaseSizeUntilFitted) {
+  MinibatchSizeController controller(256, 0.5f);
+  EXPECT_EQ(controller.GetTargetSize(1), 256);
+  controller.AddSample(256, 15.0f);
+  EXPECT_EQ(controller.GetTargetSize(1), 256);
+}
+
+TEST(MinibatchSizeController, FitsLatency) {
+  MinibatchSizeController controller(256, 0.5f);
+  AddLinearSamples(&controller, 256);
+  EXPECT_NEAR(controller.GetFixedLatencyMs(), 2.0f, 0.01f);
+  EXPECT_NEAR(controller.GetPerEvalLatencyMs(), 0.05f, 0.0001f);
+}
+
+TEST(MinibatchSizeController, SmallBudgetShrinksToMinimum) {
+  MinibatchSizeController controller(256, 0.5f);
+  AddLinearSamples(&controller, 256);
+  // Not even the fixed latency fits, so it's the base size / 8, dithered.
+  for (int i = 0; i < 4; i++) {
+    const int size = controller.GetTargetSize(1);
+    EXPECT_GE(size, 32);
+    EXPECT_LE(size, 34);
+  }
+}
+
+TEST(MinibatchSizeController, TypicalBudgetFitsBatch) {
+  MinibatchSizeController controller(256, 0.5f);
+  AddLinearSamples(&controller, 256);
+  // Half of 20ms, minus 2ms fixed, is 160 evaluations, dithered by 1/16.
+  for (int i = 0; i < 4; i++) {
+    const int size = controller.GetTargetSize(20);
+    EXPECT_GE(size, 150);
+    EXPECT_LE(size, 170);
+  }
+}
+
+TEST(MinibatchSizeController, LongBudgetGrowsToMaximum) {
+  MinibatchSizeController controller(256, 0.5f);
+  AddLinearSamples(&controller, 256);
+  for (int i = 0; i < 4; i++) {
+    const int size = controller.GetTargetSize(1000000);
+    EXPECT_GE(size, 480);
+    EXPECT_LE(size, 512);
+  }
+}
+
+TEST(MinibatchSizeController, UnboundedTimeKeepsBaseSize) {
+  MinibatchSizeController controller(256, 0.5f);
+  AddLinearSamples(&controller, 256);
+  for (int i = 0; i < 4; i++) {
+    EXPECT_EQ(controller.GetTargetSize(std::nullopt), 256);
+  }
+}
+
+TEST(MinibatchSizeController, GrowthIsCappedUnlessBaseIsLarger) {
+  MinibatchSizeController capped(800, 0.5f);
+  AddLinearSamples(&capped, 800);
+  EXPECT_LE(capped.GetTargetSize(1000000), 1024);
+  EXPECT_GE(capped.GetTargetSize(1000000), 960);
+
+  MinibatchSizeController large(2000, 0.5f);
+  AddLinearSamples(&large, 2000);
+  EXPECT_LE(large.GetTargetSize(1000000), 2000);
+  EXPECT_GE(large.GetTargetSize(1000000), 1875);
+}
+
+}  // namespace
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
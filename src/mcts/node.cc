@@ -28,20 +28,110 @@
 #include "mcts/node.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <cstring>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <new>
 #include <sstream>
 #include <thread>
+#include <type_traits>
 
 #include "neural/encoder.h"
 #include "neural/network.h"
 #include "utils/exception.h"
+#include "utils/filesystem.h"
 #include "utils/hashcat.h"
+#include "utils/logging.h"
+#include "utils/simd.h"
+#include "utils/slaballoc.h"
+#include "utils/tracing.h"
 
 namespace lczero {
 
+/////////////////////////////////////////////////////////////////////////
+// Node and edge allocation
+/////////////////////////////////////////////////////////////////////////
+
+namespace {
+// Edge arrays are rounded up to a multiple of Node::kEdgesPerSizeClass edges,
+// and the size class is stored in a header in front of the array.
+constexpr int kEdgesPerSizeClass = Node::kEdgesPerSizeClass;
+#ifdef LC0_CHILD_STATS
+// N, N-in-flight, WL and D of the child, after the edges.
+constexpr size_t kChildStatsBytes = 4 * sizeof(uint32_t);
+#else
+constexpr size_t kChildStatsBytes = 0;
+#endif
+// Enough for every legal position, which never has more than 218 moves.
+constexpr int kEdgeSizeClasses = 256 / kEdgesPerSizeClass;
+struct alignas(8) EdgeArrayHeader {
+  uint8_t size_class;
+  // Number of legal moves, more than the edges if edges were dropped.
+  uint8_t num_moves;
+  // Sum of the policy priors of the dropped edges.
+  float dropped_p;
+};
+
+EdgeArrayHeader* GetEdgeArrayHeader(const Edge* edges) {
+  return const_cast<EdgeArrayHeader*>(
+      reinterpret_cast<const EdgeArrayHeader*>(edges) - 1);
+}
+
+// Allocators are never destroyed, as nodes may still be released by the
+// garbage collector during static destruction.
+SlabAllocator& NodeAllocator() {
+  static SlabAllocator* allocator = new SlabAllocator(sizeof(Node));
+  return *allocator;
+}
+
+std::atomic<size_t> gSolidChildrenBytes{0};
+
+SlabAllocator& EdgeAllocator(uint32_t size_class) {
+  static SlabAllocator** allocators = []() {
+    auto** result = new SlabAllocator*[kEdgeSizeClasses];
+    for (int i = 0; i < kEdgeSizeClasses; i++) {
+      result[i] = new SlabAllocator(
+          sizeof(EdgeArrayHeader) +
+          (i + 1) * kEdgesPerSizeClass * (sizeof(Edge) + kChildStatsBytes));
+    }
+    return result;
+  }();
+  return *allocators[size_class];
+}
+}  // namespace
+
+void* Node::operator new(size_t size) {
+  assert(size == sizeof(Node));
+  return NodeAllocator().Allocate();
+}
+
+void Node::operator delete(void* ptr) {
+  if (ptr) NodeAllocator().Free(ptr);
+}
+
+Node* Node::AllocateSolidChildren(size_t count) {
+  gSolidChildrenBytes.fetch_add(count * sizeof(Node),
+                                std::memory_order_relaxed);
+  return std::allocator<Node>().allocate(count);
+}
+
+void Node::FreeSolidChildren(Node* children, size_t count) {
+  std::allocator<Node>().deallocate(children, count);
+  gSolidChildrenBytes.fetch_sub(count * sizeof(Node),
+                                std::memory_order_relaxed);
+}
+
+void EdgeArrayDeleter::operator()(Edge* edges) const {
+  if (!edges) return;
+  auto* header = GetEdgeArrayHeader(edges);
+  EdgeAllocator(header->size_class).Free(header);
+}
+
 /////////////////////////////////////////////////////////////////////////
 // Node garbage collector
 /////////////////////////////////////////////////////////////////////////
@@ -49,73 +139,199 @@ namespace lczero {
 namespace {
 // Periodicity of garbage collection, milliseconds.
 const int kGCIntervalMs = 100;
+// Number of nodes each GC thread releases per kGCIntervalMs at most, so that
+// discarding a huge subtree doesn't take the memory bandwidth of a search.
+const size_t kGCNodesPerTick = 1 << 20;
+// Work above this many pending subtrees in a GC thread is shared with others.
+const size_t kGCLocalQueueSize = 64;
+// Releasing less than this is not worth a line in the log.
+const size_t kGCMinLoggedBytes = 10000000;
 
-// Every kGCIntervalMs milliseconds release nodes in a separate GC thread.
+// Every kGCIntervalMs milliseconds release nodes in separate GC threads.
+// Subtrees are taken apart iteratively, node by node, which lets several
+// threads work on one large subtree and bounds the work done per interval.
 class NodeGarbageCollector {
  public:
-  NodeGarbageCollector() : gc_thread_([this]() { Worker(); }) {}
+  NodeGarbageCollector() {
+    const int threads = std::clamp<int>(
+        std::thread::hardware_concurrency() / 4, 1, 4);
+    for (int i = 0; i < threads; i++) {
+      gc_threads_.emplace_back([this]() { Worker(); });
+    }
+  }
 
   // Takes ownership of a subtree, to dispose it in a separate thread when
   // it has time.
   void AddToGcQueue(std::unique_ptr<Node> node, size_t solid_size = 0) {
     if (!node) return;
     Mutex::Lock lock(gc_mutex_);
-    subtrees_to_gc_.emplace_back(std::move(node));
-    subtrees_to_gc_solid_size_.push_back(solid_size);
+    if (subtrees_to_gc_.empty() && active_threads_ == 0) {
+      busy_since_ = std::chrono::steady_clock::now();
+    }
+    subtrees_to_gc_.push_back({std::move(node), solid_size});
+  }
+
+  // Waits for the collector threads to end the interval in progress and keeps
+  // them from starting another one, or lets them go on.
+  void SetPaused(bool paused) {
+    SharedMutex::Lock lock(pause_mutex_);
+    paused_ = paused;
+  }
+
+  // Number of subtrees waiting in the queue.
+  size_t GetBacklog() const {
+    Mutex::Lock lock(gc_mutex_);
+    return subtrees_to_gc_.size();
+  }
+
+  // Releases queued nodes on the calling thread until about @budget nodes
+  // are released. Returns the number of nodes released.
+  size_t GarbageCollect(size_t budget) {
+    LC0_TRACE_SCOPE("garbage collect");
+    std::vector<Subtree> queue;
+    size_t released = 0;
+    while (!stop_.load() && budget > 0) {
+      {
+        Mutex::Lock lock(gc_mutex_);
+        if (queue.empty()) {
+          if (subtrees_to_gc_.empty()) return released;
+          queue.push_back(std::move(subtrees_to_gc_.back()));
+          subtrees_to_gc_.pop_back();
+          ++active_threads_;
+        } else if (queue.size() > kGCLocalQueueSize) {
+          // Let idle threads help with the rest of the subtree.
+          const size_t shared = queue.size() / 2;
+          for (size_t i = 0; i < shared; i++) {
+            subtrees_to_gc_.push_back(std::move(queue[i]));
+          }
+          queue.erase(queue.begin(), queue.begin() + shared);
+        }
+      }
+      const size_t count = Release(&queue, std::min<size_t>(budget, 1024));
+      released += count;
+      // Solid children may take it over budget.
+      budget -= std::min(budget, count);
+      if (queue.empty()) FinishSubtree();
+    }
+    if (queue.empty()) return released;
+    // Out of budget, the rest waits for the next interval.
+    Mutex::Lock lock(gc_mutex_);
+    for (auto& subtree : queue) subtrees_to_gc_.push_back(std::move(subtree));
+    --active_threads_;
+    return released;
   }
 
   ~NodeGarbageCollector() {
-    // Flips stop flag and waits for a worker thread to stop.
+    // Flips stop flag and waits for worker threads to stop.
     stop_.store(true);
-    gc_thread_.join();
+    for (auto& thread : gc_threads_) thread.join();
+    // Solid subtrees still queued can't be left to the unique_ptr destructor.
+    std::vector<Subtree> queue;
+    {
+      Mutex::Lock lock(gc_mutex_);
+      queue.swap(subtrees_to_gc_);
+    }
+    while (!queue.empty()) Release(&queue, std::numeric_limits<size_t>::max());
   }
 
  private:
-  void GarbageCollect() {
-    while (!stop_.load()) {
-      // Node will be released in destructor when mutex is not locked.
-      std::unique_ptr<Node> node_to_gc;
-      size_t solid_size = 0;
-      {
-        // Lock the mutex and move last subtree from subtrees_to_gc_ into
-        // node_to_gc.
-        Mutex::Lock lock(gc_mutex_);
-        if (subtrees_to_gc_.empty()) return;
-        node_to_gc = std::move(subtrees_to_gc_.back());
-        subtrees_to_gc_.pop_back();
-        solid_size = subtrees_to_gc_solid_size_.back();
-        subtrees_to_gc_solid_size_.pop_back();
+  struct Subtree {
+    std::unique_ptr<Node> node;
+    // Length of the array if node is an array of solid children, 0 otherwise.
+    size_t solid_size;
+  };
+
+  // Takes nodes from the back of @queue and releases them, putting their
+  // children and siblings into @queue, until @budget nodes are released.
+  // Arrays of solid children are released whole, so up to the length of one
+  // array less one more may be. Returns number of nodes released.
+  size_t Release(std::vector<Subtree>* queue, size_t budget) {
+    size_t released = 0;
+    while (!queue->empty() && released < budget) {
+      Subtree subtree = std::move(queue->back());
+      queue->pop_back();
+      const size_t count = std::max<size_t>(subtree.solid_size, 1);
+      for (size_t i = 0; i < count; i++) {
+        Node* node = subtree.node.get() + i;
+        Subtree children{nullptr, 0};
+        Subtree sibling{nullptr, 0};
+        node->DetachForGc(&children.node, &children.solid_size,
+                          &sibling.node);
+        if (sibling.node) queue->push_back(std::move(sibling));
+        if (children.node) queue->push_back(std::move(children));
+        released_bytes_ += node->GetNumEdges() * sizeof(Edge);
       }
+      released_bytes_ += count * sizeof(Node);
+      released += count;
       // Solid is a hack...
-      if (solid_size != 0) {
-        for (size_t i = 0; i < solid_size; i++) {
-          node_to_gc.get()[i].~Node();
+      if (subtree.solid_size != 0) {
+        for (size_t i = 0; i < subtree.solid_size; i++) {
+          subtree.node.get()[i].~Node();
         }
-        std::allocator<Node> alloc;
-        alloc.deallocate(node_to_gc.release(), solid_size);
+        Node::FreeSolidChildren(subtree.node.release(), subtree.solid_size);
       }
     }
+    return released;
+  }
+
+  // Called by a thread which ran out of work taken from the shared queue.
+  void FinishSubtree() {
+    Mutex::Lock lock(gc_mutex_);
+    if (--active_threads_ > 0 || !subtrees_to_gc_.empty()) return;
+    const size_t bytes = released_bytes_.exchange(0);
+    if (bytes < kGCMinLoggedBytes) return;
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                             std::chrono::steady_clock::now() - busy_since_)
+                             .count();
+    LOGFILE << "Node GC released " << bytes / 1000000 << "MB in " << elapsed
+            << "ms.";
   }
 
   void Worker() {
+    LC0_TRACE_THREAD_NAME("node gc");
     while (!stop_.load()) {
       std::this_thread::sleep_for(std::chrono::milliseconds(kGCIntervalMs));
-      GarbageCollect();
+      SharedMutex::SharedLock lock(pause_mutex_);
+      if (!paused_) GarbageCollect(kGCNodesPerTick);
     };
   }
 
-  mutable Mutex gc_mutex_;
-  std::vector<std::unique_ptr<Node>> subtrees_to_gc_ GUARDED_BY(gc_mutex_);
-  std::vector<size_t> subtrees_to_gc_solid_size_ GUARDED_BY(gc_mutex_);
+  mutable Mutex gc_mutex_{"NodeGarbageCollector::gc_mutex_"};
+  std::vector<Subtree> subtrees_to_gc_ GUARDED_BY(gc_mutex_);
+  // Threads holding work taken from subtrees_to_gc_.
+  int active_threads_ GUARDED_BY(gc_mutex_) = 0;
+  // When the queue last became non-empty.
+  std::chrono::steady_clock::time_point busy_since_ GUARDED_BY(gc_mutex_);
+  std::atomic<size_t> released_bytes_{0};
+  // Held by the collector threads for each interval.
+  SharedMutex pause_mutex_{"NodeGarbageCollector::pause_mutex_"};
+  bool paused_ GUARDED_BY(pause_mutex_) = false;
 
   // When true, Worker() should stop and exit.
   std::atomic<bool> stop_{false};
-  std::thread gc_thread_;
+  std::vector<std::thread> gc_threads_;
 };
 
 NodeGarbageCollector gNodeGc;
 }  // namespace
 
+size_t CollectGarbage(size_t max_nodes) {
+  return gNodeGc.GarbageCollect(max_nodes);
+}
+
+void PauseGarbageCollector(bool paused) { gNodeGc.SetPaused(paused); }
+
+TreeMemoryUsage GetTreeMemoryUsage() {
+  TreeMemoryUsage usage;
+  usage.node_bytes = NodeAllocator().GetReservedBytes();
+  for (int i = 0; i < kEdgeSizeClasses; i++) {
+    usage.edge_bytes += EdgeAllocator(i).GetReservedBytes();
+  }
+  usage.solid_bytes = gSolidChildrenBytes.load(std::memory_order_relaxed);
+  usage.gc_backlog = gNodeGc.GetBacklog();
+  return usage;
+}
+
 /////////////////////////////////////////////////////////////////////////
 // Edge
 /////////////////////////////////////////////////////////////////////////
@@ -174,16 +390,49 @@ float Edge::GetP() const {
   return ret;
 }
 
+#if defined(LC0_SIMD_AVX2) || defined(LC0_SIMD_NEON)
+// The vector paths decode the p_ halves of whole Edges at once.
+static_assert(sizeof(Edge) == sizeof(uint32_t), "Unexpected size of Edge");
+#endif
+
 std::string Edge::DebugString() const {
   std::ostringstream oss;
   oss << "Move: " << move_.as_string() << " p_: " << p_ << " GetP: " << GetP();
   return oss.str();
 }
 
-std::unique_ptr<Edge[]> Edge::FromMovelist(const MoveList& moves) {
-  std::unique_ptr<Edge[]> edges = std::make_unique<Edge[]>(moves.size());
-  auto* edge = edges.get();
-  for (const auto move : moves) edge++->move_ = move;
+namespace {
+// Allocates room for @count edges, leaving them uninitialized.
+EdgeArray AllocateEdges(size_t count) {
+  static_assert(std::is_trivially_destructible_v<Edge>,
+                "EdgeArrayDeleter doesn't run destructors.");
+  const uint32_t size_class =
+      count == 0 ? 0 : (count - 1) / kEdgesPerSizeClass;
+  if (size_class >= kEdgeSizeClasses) {
+    throw Exception("Too many moves in a position.");
+  }
+  auto* header =
+      static_cast<EdgeArrayHeader*>(EdgeAllocator(size_class).Allocate());
+  header->size_class = size_class;
+  header->num_moves = count;
+  header->dropped_p = 0.0f;
+  Edge* edges = reinterpret_cast<Edge*>(header + 1);
+  if constexpr (kChildStatsBytes > 0) {
+    const size_t capacity = (size_class + 1) * kEdgesPerSizeClass;
+    std::memset(static_cast<void*>(edges + capacity), 0,
+                capacity * kChildStatsBytes);
+  }
+  return EdgeArray(edges);
+}
+}  // namespace
+
+EdgeArray Edge::FromMovelist(const FixedMoveList& moves) {
+  EdgeArray edges = AllocateEdges(moves.size());
+  Edge* edge = edges.get();
+  for (const auto move : moves) {
+    new (edge) Edge();
+    edge++->move_ = move;
+  }
   return edges;
 }
 
@@ -200,7 +449,7 @@ Node* Node::CreateSingleChildNode(Move move) {
   return child_.get();
 }
 
-void Node::CreateEdges(const MoveList& moves) {
+void Node::CreateEdges(const FixedMoveList& moves) {
   assert(!edges_);
   assert(!child_);
   edges_ = Edge::FromMovelist(moves);
@@ -241,8 +490,39 @@ std::string Node::DebugString() const {
   return oss.str();
 }
 
+void Node::CopyPolicy(int max_needed, float* output) const {
+  if (!edges_) return;
+  const int loops = std::min(static_cast<int>(num_edges_), max_needed);
+  int i = 0;
+  // Same as Edge::GetP() for several edges at once: p_ is the upper half of
+  // each 32 bit edge, so shift it into place and set the exponent bits.
+#if defined(LC0_SIMD_AVX2)
+  const __m256i exponent = _mm256_set1_epi32(3 << 28);
+  for (; i + 8 <= loops; i += 8) {
+    __m256i raw = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(edges_.get() + i));
+    raw = _mm256_or_si256(_mm256_slli_epi32(_mm256_srli_epi32(raw, 16), 12),
+                          exponent);
+    _mm256_storeu_ps(output + i, _mm256_castsi256_ps(raw));
+  }
+#elif defined(LC0_SIMD_NEON)
+  const uint32x4_t exponent = vdupq_n_u32(3 << 28);
+  for (; i + 4 <= loops; i += 4) {
+    uint32x4_t raw =
+        vld1q_u32(reinterpret_cast<const uint32_t*>(edges_.get() + i));
+    raw = vorrq_u32(vshlq_n_u32(vshrq_n_u32(raw, 16), 12), exponent);
+    vst1q_f32(output + i, vreinterpretq_f32_u32(raw));
+  }
+#endif
+  for (; i < loops; i++) {
+    output[i] = edges_[i].GetP();
+  }
+}
+
 bool Node::MakeSolid() {
   if (solid_children_ || num_edges_ == 0 || IsTerminal()) return false;
+  // The array of solid children can't grow with the edges.
+  if (HasDroppedEdges()) return false;
   // Can only make solid if no immediate leaf children are in flight since we
   // allow the search code to hold references to leaf nodes across locks.
   Node* old_child_to_check = child_.get();
@@ -265,10 +545,9 @@ bool Node::MakeSolid() {
   if (total_in_flight != GetNInFlight()) {
     return false;
   }
-  std::allocator<Node> alloc;
-  auto* new_children = alloc.allocate(num_edges_);
+  auto* new_children = AllocateSolidChildren(num_edges_);
   for (int i = 0; i < num_edges_; i++) {
-    new (&(new_children[i])) Node(this, i);
+    ::new (&(new_children[i])) Node(this, i);
   }
   std::unique_ptr<Node> old_child = std::move(child_);
   while (old_child) {
@@ -288,11 +567,106 @@ bool Node::MakeSolid() {
 
 void Node::SortEdges() {
   assert(edges_);
-  assert(!child_);
   // Sorting on raw p_ is the same as sorting on GetP() as a side effect of
   // the encoding, and its noticeably faster.
-  std::sort(edges_.get(), (edges_.get() + num_edges_),
+  if (!child_) {
+    std::sort(edges_.get(), (edges_.get() + num_edges_),
+              [](const Edge& a, const Edge& b) { return a.p_ > b.p_; });
+    return;
+  }
+  // Children are found by the index of their edge, so they are renumbered
+  // along with the edges.
+  std::vector<int> order(num_edges_);
+  for (int i = 0; i < num_edges_; i++) order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [this](int a, int b) {
+    return edges_[a].p_ > edges_[b].p_;
+  });
+  const std::vector<Edge> old_edges(edges_.get(), edges_.get() + num_edges_);
+  std::vector<uint16_t> new_index(num_edges_);
+  for (int i = 0; i < num_edges_; i++) {
+    edges_[i] = old_edges[order[i]];
+    new_index[order[i]] = i;
+  }
+  if (solid_children_) {
+    std::vector<Node> old_children;
+    old_children.reserve(num_edges_);
+    for (int i = 0; i < num_edges_; i++) {
+      old_children.push_back(std::move(child_.get()[i]));
+    }
+    for (int i = 0; i < num_edges_; i++) {
+      Node& child = child_.get()[i];
+      child = std::move(old_children[order[i]]);
+      child.index_ = i;
+      child.UpdateChildrenParents();
+    }
+    RebuildChildStats();
+    return;
+  }
+  std::vector<std::unique_ptr<Node>> children;
+  for (auto child = std::move(child_); child;) {
+    auto next = std::move(child->sibling_);
+    child->index_ = new_index[child->index_];
+    children.push_back(std::move(child));
+    child = std::move(next);
+  }
+  std::sort(children.begin(), children.end(),
+            [](const auto& a, const auto& b) { return a->index_ < b->index_; });
+  std::unique_ptr<Node>* link = &child_;
+  for (auto& child : children) {
+    *link = std::move(child);
+    link = &(*link)->sibling_;
+  }
+  RebuildChildStats();
+}
+
+bool Node::HasDroppedEdges() const {
+  return edges_ && GetEdgeArrayHeader(edges_.get())->num_moves > num_edges_;
+}
+
+float Node::GetDroppedPolicy() const {
+  return edges_ ? GetEdgeArrayHeader(edges_.get())->dropped_p : 0.0f;
+}
+
+void Node::DropEdges(int count) {
+  assert(!child_);
+  if (count >= num_edges_) return;
+  float dropped_p = 0.0f;
+  for (int i = count; i < num_edges_; i++) dropped_p += edges_[i].GetP();
+  EdgeArray edges = AllocateEdges(count);
+  std::memcpy(static_cast<void*>(edges.get()), edges_.get(),
+              count * sizeof(Edge));
+  edges_ = std::move(edges);
+  MarkDroppedEdges(num_edges_, dropped_p);
+  num_edges_ = count;
+}
+
+void Node::RestoreDroppedEdges(const FixedMoveList& moves,
+                               const float* priors) {
+  assert(!solid_children_);
+  assert(num_edges_ + moves.size() ==
+         GetEdgeArrayHeader(edges_.get())->num_moves);
+  EdgeArray edges = AllocateEdges(num_edges_ + moves.size());
+  std::memcpy(static_cast<void*>(edges.get()), edges_.get(),
+              num_edges_ * sizeof(Edge));
+  // Dropped edges were the least likely, keep them behind the others so that
+  // indices of existing children don't change.
+  const float max_p = num_edges_ > 0 ? edges_[num_edges_ - 1].GetP() : 1.0f;
+  for (size_t i = 0; i < moves.size(); i++) {
+    Edge* edge = new (&edges[num_edges_ + i]) Edge();
+    edge->move_ = moves[i];
+    edge->SetP(std::clamp(priors[i], 0.0f, max_p));
+  }
+  std::sort(edges.get() + num_edges_, edges.get() + num_edges_ + moves.size(),
             [](const Edge& a, const Edge& b) { return a.p_ > b.p_; });
+  edges_ = std::move(edges);
+  num_edges_ += moves.size();
+  RebuildChildStats();
+}
+
+void Node::MarkDroppedEdges(int num_moves, float dropped_p) {
+  auto* header = GetEdgeArrayHeader(edges_.get());
+  header->num_moves = num_moves;
+  header->dropped_p = dropped_p;
 }
 
 void Node::MakeTerminal(GameResult result, float plies_left, Terminal type) {
@@ -300,18 +674,19 @@ void Node::MakeTerminal(GameResult result, float plies_left, Terminal type) {
   terminal_type_ = type;
   m_ = plies_left;
   if (result == GameResult::DRAW) {
-    wl_ = 0.0f;
+    SetWLForUpdate(0.0);
     d_ = 1.0f;
   } else if (result == GameResult::WHITE_WON) {
-    wl_ = 1.0f;
+    SetWLForUpdate(1.0);
     d_ = 0.0f;
   } else if (result == GameResult::BLACK_WON) {
-    wl_ = -1.0f;
+    SetWLForUpdate(-1.0);
     d_ = 0.0f;
     // Terminal losses have no uncertainty and no reason for their U value to be
     // comparable to another non-loss choice. Force this by clearing the policy.
     if (GetParent() != nullptr) GetOwnEdge()->SetP(0.0f);
   }
+  PublishStats();
 }
 
 void Node::MakeNotTerminal() {
@@ -321,21 +696,23 @@ void Node::MakeNotTerminal() {
   // If we have edges, we've been extended (1 visit), so include children too.
   if (edges_) {
     n_++;
+    double wl = GetWLForUpdate();
     for (const auto& child : Edges()) {
       const auto n = child.GetN();
       if (n > 0) {
         n_ += n;
         // Flip Q for opponent.
         // Default values don't matter as n is > 0.
-        wl_ += -child.GetWL(0.0f) * n;
+        wl += -child.GetWL(0.0f) * n;
         d_ += child.GetD(0.0f) * n;
       }
     }
 
     // Recompute with current eval (instead of network's) and children's eval.
-    wl_ /= n_;
+    SetWLForUpdate(wl / n_);
     d_ /= n_;
   }
+  PublishStats();
 }
 
 void Node::SetBounds(GameResult lower, GameResult upper) {
@@ -346,16 +723,19 @@ void Node::SetBounds(GameResult lower, GameResult upper) {
 bool Node::TryStartScoreUpdate() {
   if (n_ == 0 && n_in_flight_ > 0) return false;
   ++n_in_flight_;
+  PublishStats();
   return true;
 }
 
 void Node::CancelScoreUpdate(int multivisit) {
   n_in_flight_ -= multivisit;
+  PublishStats();
 }
 
 void Node::FinalizeScoreUpdate(float v, float d, float m, int multivisit) {
   // Recompute Q.
-  wl_ += multivisit * (v - wl_) / (n_ + multivisit);
+  const double wl = GetWLForUpdate();
+  SetWLForUpdate(wl + multivisit * (v - wl) / (n_ + multivisit));
   d_ += multivisit * (d - d_) / (n_ + multivisit);
   m_ += multivisit * (m - m_) / (n_ + multivisit);
 
@@ -363,13 +743,15 @@ void Node::FinalizeScoreUpdate(float v, float d, float m, int multivisit) {
   n_ += multivisit;
   // Decrement virtual loss.
   n_in_flight_ -= multivisit;
+  PublishStats();
 }
 
 void Node::AdjustForTerminal(float v, float d, float m, int multivisit) {
   // Recompute Q.
-  wl_ += multivisit * v / n_;
+  SetWLForUpdate(GetWLForUpdate() + multivisit * v / n_);
   d_ += multivisit * d / n_;
   m_ += multivisit * m / n_;
+  PublishStats();
 }
 
 void Node::RevertTerminalVisits(float v, float d, float m, int multivisit) {
@@ -377,19 +759,54 @@ void Node::RevertTerminalVisits(float v, float d, float m, int multivisit) {
   const int n_new = n_ - multivisit;
   if (n_new <= 0) {
     // If n_new == 0, reset all relevant values to 0.
-    wl_ = 0.0;
+    SetWLForUpdate(0.0);
     d_ = 1.0;
     m_ = 0.0;
     n_ = 0;
   } else {
     // Recompute Q and M.
-    wl_ -= multivisit * (v - wl_) / n_new;
+    const double wl = GetWLForUpdate();
+    SetWLForUpdate(wl - multivisit * (v - wl) / n_new);
     d_ -= multivisit * (d - d_) / n_new;
     m_ -= multivisit * (m - m_) / n_new;
     // Decrement N.
     n_ -= multivisit;
   }
+  PublishStats();
+}
+
+#ifdef LC0_COMPACT_NODES
+double Node::GetWLForUpdate() const {
+  int exponent;
+  std::frexp(wl_, &exponent);
+  // A float has 24 bits of mantissa, the residual 8 more.
+  return wl_ + wl_residual_ * std::ldexp(1.0, exponent - 32);
+}
+
+void Node::SetWLForUpdate(double wl) {
+  wl_ = static_cast<float>(wl);
+  int exponent;
+  std::frexp(wl_, &exponent);
+  const long residual =
+      std::lround((wl - wl_) * std::ldexp(1.0, 32 - exponent));
+  wl_residual_ = static_cast<int8_t>(std::clamp(residual, -128L, 127L));
+}
+#else
+double Node::GetWLForUpdate() const { return wl_; }
+
+void Node::SetWLForUpdate(double wl) { wl_ = wl; }
+#endif
+
+#ifdef LC0_CHILD_STATS
+void Node::RebuildChildStats() {
+  if (!edges_) return;
+  std::memset(static_cast<void*>(ChildStatsArray()), 0,
+              ChildStatsStride() * kChildStatsBytes);
+  for (const auto& child : Edges()) {
+    if (child.HasNode()) child.node()->PublishStats();
+  }
 }
+#endif
 
 void Node::UpdateChildrenParents() {
   if (!solid_children_) {
@@ -406,8 +823,18 @@ void Node::UpdateChildrenParents() {
   }
 }
 
+void Node::DetachForGc(std::unique_ptr<Node>* children, size_t* solid_size,
+                       std::unique_ptr<Node>* sibling) {
+  *solid_size = solid_children_ ? num_edges_ : 0;
+  *children = std::move(child_);
+  solid_children_ = false;
+  *sibling = std::move(sibling_);
+}
+
 void Node::ReleaseChildren() {
   gNodeGc.AddToGcQueue(std::move(child_), solid_children_ ? num_edges_ : 0);
+  solid_children_ = false;
+  RebuildChildStats();
 }
 
 void Node::ReleaseChildrenExceptOne(Node* node_to_save) {
@@ -446,6 +873,7 @@ void Node::ReleaseChildrenExceptOne(Node* node_to_save) {
     num_edges_ = 0;
     edges_.reset();  // Clear edges list.
   }
+  RebuildChildStats();
 }
 
 /////////////////////////////////////////////////////////////////////////
@@ -477,6 +905,8 @@ void NodeTree::MakeMove(Move move) {
     }
   }
   move = board.GetModernMove(move);
+  // The move may have been among dropped edges, then the head starts over.
+  if (!new_head && current_head_->HasChildren()) TrimTreeAtHead();
   current_head_->ReleaseChildrenExceptOne(new_head);
   new_head = current_head_->child_.get();
   current_head_ =
@@ -492,6 +922,7 @@ void NodeTree::TrimTreeAtHead() {
   current_head_->ReleaseChildren();
   *current_head_ = Node(current_head_->GetParent(), current_head_->index_);
   current_head_->sibling_ = std::move(tmp);
+  current_head_->PublishStats();
 }
 
 bool NodeTree::ResetToPosition(const std::string& starting_fen,
@@ -531,6 +962,179 @@ bool NodeTree::ResetToPosition(const std::string& starting_fen,
   return seen_old_head;
 }
 
+namespace {
+// Tree files start with the magic and the format version, followed by the
+// hash of the game history and the subtree in pre-order. A node record holds
+// its stats, its edges as they are in memory, the number of legal moves and
+// the policy of dropped edges, the number of saved children, and then the edge
+// index and the record of each of them. Only visited children are saved.
+const char kTreeFileMagic[4] = {'L', 'c', '0', 'T'};
+const uint32_t kTreeFileVersion = 2;
+
+static_assert(std::is_trivially_copyable_v<Edge>,
+              "Edges are saved as they are in memory.");
+
+template <typename T>
+void WriteValue(std::ostream* out, const T& value) {
+  out->write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Reads a part of a tree file, checking that it's in bounds.
+class TreeFileReader {
+ public:
+  TreeFileReader(const char* data, size_t size)
+      : data_(data), end_(data + size) {}
+
+  const char* ReadBytes(size_t size) {
+    if (static_cast<size_t>(end_ - data_) < size) {
+      throw Exception("Tree file is truncated.");
+    }
+    const char* result = data_;
+    data_ += size;
+    return result;
+  }
+  template <typename T>
+  T Read() {
+    T value;
+    std::memcpy(&value, ReadBytes(sizeof(T)), sizeof(T));
+    return value;
+  }
+
+ private:
+  const char* data_;
+  const char* const end_;
+};
+}  // namespace
+
+void NodeTree::SaveHeadToFile(const std::string& filename) const {
+  std::ofstream out(filename, std::ios::binary);
+  if (!out) throw Exception("Cannot write file: " + filename);
+  WriteHead(&out);
+  if (!out) throw Exception("Cannot write file: " + filename);
+}
+
+bool NodeTree::LoadHeadFromFile(const std::string& filename) {
+  if (current_head_->GetN() > 0 || current_head_->HasChildren()) return false;
+  const MappedFile file(filename);
+  return ReadHead(file.data(), file.size(), filename);
+}
+
+std::string NodeTree::SnapshotHead() const {
+  std::ostringstream out;
+  WriteHead(&out);
+  return out.str();
+}
+
+bool NodeTree::RestoreHead(const std::string& snapshot) {
+  if (current_head_->GetN() > 0 || current_head_->HasChildren()) return false;
+  return ReadHead(snapshot.data(), snapshot.size(), "tree snapshot");
+}
+
+void NodeTree::WriteHead(std::ostream* out) const {
+  out->write(kTreeFileMagic, sizeof(kTreeFileMagic));
+  WriteValue(out, kTreeFileVersion);
+  WriteValue(out, history_.HashLast(history_.GetLength()));
+  // Depth first, with explicit stack as the tree may be deep.
+  std::vector<const Node*> to_save = {current_head_};
+  while (!to_save.empty()) {
+    const Node* node = to_save.back();
+    to_save.pop_back();
+    WriteValue(out, node->n_);
+    WriteValue(out, node->GetWLForUpdate());
+    WriteValue(out, node->d_);
+    WriteValue(out, node->m_);
+    WriteValue(out, static_cast<uint8_t>(node->terminal_type_));
+    WriteValue(out, static_cast<uint8_t>(node->lower_bound_));
+    WriteValue(out, static_cast<uint8_t>(node->upper_bound_));
+    WriteValue(out, node->num_edges_);
+    out->write(reinterpret_cast<const char*>(node->edges_.get()),
+               node->num_edges_ * sizeof(Edge));
+    const uint8_t num_moves =
+        node->edges_ ? GetEdgeArrayHeader(node->edges_.get())->num_moves : 0;
+    WriteValue(out, num_moves);
+    WriteValue(out, node->GetDroppedPolicy());
+    std::vector<const Node*> children;
+    for (const auto& edge : node->Edges()) {
+      if (edge.GetN() > 0) children.push_back(edge.node());
+    }
+    WriteValue(out, static_cast<uint8_t>(children.size()));
+    for (const Node* child : children) {
+      WriteValue(out, static_cast<uint8_t>(child->index_));
+    }
+    // Children are written in order, so they go to the stack in reverse.
+    to_save.insert(to_save.end(), children.rbegin(), children.rend());
+  }
+}
+
+bool NodeTree::ReadHead(const char* data, size_t size,
+                        const std::string& name) {
+  TreeFileReader reader(data, size);
+  if (size < sizeof(kTreeFileMagic) ||
+      std::memcmp(reader.ReadBytes(sizeof(kTreeFileMagic)), kTreeFileMagic,
+                  sizeof(kTreeFileMagic)) != 0 ||
+      reader.Read<uint32_t>() != kTreeFileVersion) {
+    throw Exception("Not a tree file of this version: " + name);
+  }
+  if (reader.Read<uint64_t>() != history_.HashLast(history_.GetLength())) {
+    return false;
+  }
+  try {
+    std::vector<Node*> to_load = {current_head_};
+    while (!to_load.empty()) {
+      Node* node = to_load.back();
+      to_load.pop_back();
+      node->n_ = reader.Read<uint32_t>();
+      node->SetWLForUpdate(reader.Read<double>());
+      node->d_ = reader.Read<float>();
+      node->m_ = reader.Read<float>();
+      node->terminal_type_ =
+          static_cast<Node::Terminal>(reader.Read<uint8_t>() & 3);
+      node->lower_bound_ =
+          static_cast<GameResult>(reader.Read<uint8_t>() & 3);
+      node->upper_bound_ =
+          static_cast<GameResult>(reader.Read<uint8_t>() & 3);
+      node->PublishStats();
+      const int num_edges = reader.Read<uint8_t>();
+      const char* edges = reader.ReadBytes(num_edges * sizeof(Edge));
+      if (num_edges > 0) {
+        node->CreateEdges(FixedMoveList(num_edges));
+        std::memcpy(static_cast<void*>(node->edges_.get()), edges,
+                    num_edges * sizeof(Edge));
+      }
+      const int num_moves = reader.Read<uint8_t>();
+      const float dropped_p = reader.Read<float>();
+      if (num_moves > num_edges) {
+        if (num_edges == 0) {
+          throw Exception("Tree file is damaged: " + name);
+        }
+        node->MarkDroppedEdges(num_moves, dropped_p);
+      }
+      const int num_children = reader.Read<uint8_t>();
+      if (num_children > num_edges) {
+        throw Exception("Tree file is damaged: " + name);
+      }
+      std::vector<Node*> children;
+      std::unique_ptr<Node>* link = &node->child_;
+      int previous_index = -1;
+      for (int i = 0; i < num_children; i++) {
+        const int index = reader.Read<uint8_t>();
+        if (index <= previous_index || index >= num_edges) {
+          throw Exception("Tree file is damaged: " + name);
+        }
+        previous_index = index;
+        *link = std::make_unique<Node>(node, index);
+        children.push_back(link->get());
+        link = &(*link)->sibling_;
+      }
+      to_load.insert(to_load.end(), children.rbegin(), children.rend());
+    }
+  } catch (...) {
+    TrimTreeAtHead();
+    throw;
+  }
+  return true;
+}
+
 void NodeTree::DeallocateTree() {
   // Same as gamebegin_node_.reset(), but actual deallocation will happen in
   // GC thread.
@@ -40,6 +40,7 @@
 #include "neural/encoder.h"
 #include "proto/net.pb.h"
 #include "utils/mutex.h"
+#include "utils/prefetch.h"
 
 namespace lczero {
 
@@ -79,12 +80,26 @@ namespace lczero {
 //                                       | q_ = -0.2  |
 //                                       | sibling_   | -> nullptr
 //                                       +------------+
+//
+// With LC0_CHILD_STATS, the edge array is followed by the statistics which
+// selection reads for every child (N, N-in-flight, WL and D), one array per
+// field. Each child node writes its own entry whenever these change, so that
+// picking a child reads contiguous memory and doesn't touch the child nodes.
 
 class Node;
+class Edge;
+
+// Edge arrays come from slab allocators by size class, so they need a deleter
+// of their own.
+struct EdgeArrayDeleter {
+  void operator()(Edge* edges) const;
+};
+using EdgeArray = std::unique_ptr<Edge[], EdgeArrayDeleter>;
+
 class Edge {
  public:
   // Creates array of edges from the list of moves.
-  static std::unique_ptr<Edge[]> FromMovelist(const MoveList& moves);
+  static EdgeArray FromMovelist(const FixedMoveList& moves);
 
   // Returns move from the point of view of the player making it (if as_opponent
   // is false) or as opponent (if as_opponent is true).
@@ -144,23 +159,31 @@ class Node {
   Node(Node&& move_from) = default;
   Node& operator=(Node&& move_from) = default;
 
+  // Nodes are allocated from a slab allocator shared by all trees. Solid
+  // children arrays are allocated separately.
+  static void* operator new(size_t size);
+  static void operator delete(void* ptr);
+
   // Allocates a new edge and a new node. The node has to be no edges before
   // that.
   Node* CreateSingleChildNode(Move m);
 
   // Creates edges from a movelist. There has to be no edges before that.
-  void CreateEdges(const MoveList& moves);
+  void CreateEdges(const FixedMoveList& moves);
 
   // Gets parent node.
   Node* GetParent() const { return parent_; }
 
   // Returns whether a node has children.
   bool HasChildren() const { return static_cast<bool>(edges_); }
+  // Returns whether any child node has been spawned.
+  bool HasChildNodes() const { return static_cast<bool>(child_); }
 
   // Returns sum of policy priors which have had at least one playout.
   float GetVisitedPolicy() const;
   uint32_t GetN() const { return n_; }
   uint32_t GetNInFlight() const { return n_in_flight_; }
+  bool HasSolidChildren() const { return solid_children_; }
   uint32_t GetChildrenVisits() const { return n_ > 0 ? n_ - 1 : 0; }
   // Returns n = n_if_flight.
   int GetNStarted() const { return n_ + n_in_flight_; }
@@ -179,13 +202,41 @@ class Node {
   Bounds GetBounds() const { return {lower_bound_, upper_bound_}; }
   uint8_t GetNumEdges() const { return num_edges_; }
 
+  // Edge arrays are allocated in multiples of this many edges.
+  static constexpr int kEdgesPerSizeClass = 8;
+
+#ifdef LC0_CHILD_STATS
+  // Statistics of the children, indexed by edge. Entries of edges without a
+  // node, or whose node was released, are zero.
+  struct ChildStats {
+    const uint32_t* n;
+    const uint32_t* n_in_flight;
+    const float* wl;
+    const float* d;
+  };
+  ChildStats GetChildStats() const {
+    const uint32_t* stats = ChildStatsArray();
+    const int stride = ChildStatsStride();
+    return {stats, stats + stride,
+            reinterpret_cast<const float*>(stats + 2 * stride),
+            reinterpret_cast<const float*>(stats + 3 * stride)};
+  }
+#endif
+
   // Output must point to at least max_needed floats.
-  void CopyPolicy(int max_needed, float* output) const {
-    if (!edges_) return;
-    int loops = std::min(static_cast<int>(num_edges_), max_needed);
-    for (int i = 0; i < loops; i++) {
-      output[i] = edges_[i].GetP();
-    }
+  void CopyPolicy(int max_needed, float* output) const;
+
+  // Starts loading the edges and the first children of the node, which are
+  // read as soon as the search descends into it. Only for nodes with visits,
+  // whose edges are no longer written: a node without visits may be extended
+  // by another worker meanwhile.
+  void PrefetchChildren() const {
+    PrefetchForRead(edges_.get());
+    if (!child_) return;
+    PrefetchForRead(child_.get());
+    // Solid children are contiguous, the second one is the most likely to be
+    // compared against the first.
+    if (solid_children_ && num_edges_ > 1) PrefetchForRead(child_.get() + 1);
   }
 
   // Makes the node terminal and sets it's score.
@@ -215,7 +266,10 @@ class Node {
   // When search decides to treat one visit as several (in case of collisions
   // or visiting terminal nodes several times), it amplifies the visit by
   // incrementing n_in_flight.
-  void IncrementNInFlight(int multivisit) { n_in_flight_ += multivisit; }
+  void IncrementNInFlight(int multivisit) {
+    n_in_flight_ += multivisit;
+    PublishStats();
+  }
 
   // Updates max depth, if new depth is larger.
   void UpdateMaxDepth(int depth);
@@ -232,9 +286,15 @@ class Node {
   VisitedNode_Iterator<true> VisitedNodes() const;
   VisitedNode_Iterator<false> VisitedNodes();
 
-  // Deletes all children.
+  // Deletes all child nodes. Edges and own statistics are kept.
   void ReleaseChildren();
 
+  // Takes away the children and the next sibling of this node, so that the
+  // garbage collector can destroy a subtree without recursion. @solid_size is
+  // set to the length of the children array if they are solid, 0 otherwise.
+  void DetachForGc(std::unique_ptr<Node>* children, size_t* solid_size,
+                   std::unique_ptr<Node>* sibling);
+
   // Deletes all children except one.
   // The node provided may be moved, so should not be relied upon to exist
   // afterwards.
@@ -253,8 +313,20 @@ class Node {
   // already done. Returns true if the transformation was performed.
   bool MakeSolid();
 
+  // Sorts edges by policy prior, renumbering the children if there are any.
   void SortEdges();
 
+  // Returns whether edges of the least likely moves were dropped to save
+  // memory, and the sum of their policy priors.
+  bool HasDroppedEdges() const;
+  float GetDroppedPolicy() const;
+  // Keeps only the first @count edges, which must be sorted. Only for nodes
+  // without children.
+  void DropEdges(int count);
+  // Brings back the dropped edges, for @moves with policy priors @priors. The
+  // new edges go after the kept ones, so indices of children don't change.
+  void RestoreDroppedEdges(const FixedMoveList& moves, const float* priors);
+
   // Index in parent edges - useful for correlated ordering.
   uint16_t Index() const { return index_; }
 
@@ -265,19 +337,57 @@ class Node {
       for (int i = 0; i < num_edges_; i++) {
         child_.get()[i].~Node();
       }
-      std::allocator<Node> alloc;
-      alloc.deallocate(child_.release(), num_edges_);
+      FreeSolidChildren(child_.release(), num_edges_);
     }
   }
 
+  // Allocation of arrays of solid children, which are counted separately from
+  // nodes allocated one by one.
+  static Node* AllocateSolidChildren(size_t count);
+  static void FreeSolidChildren(Node* children, size_t count);
+
  private:
   // For each child, ensures that its parent pointer is pointing to this.
   void UpdateChildrenParents();
+  // Records that edges were dropped from a position with @num_moves moves.
+  void MarkDroppedEdges(int num_moves, float dropped_p);
+
+  // Full precision WL, for updates of the average.
+  double GetWLForUpdate() const;
+  void SetWLForUpdate(double wl);
+
+#ifdef LC0_CHILD_STATS
+  // The child stats arrays, each padded to a whole size class, follow the
+  // edges.
+  int ChildStatsStride() const {
+    return (num_edges_ + kEdgesPerSizeClass - 1) / kEdgesPerSizeClass *
+           kEdgesPerSizeClass;
+  }
+  uint32_t* ChildStatsArray() const {
+    return reinterpret_cast<uint32_t*>(edges_.get() + ChildStatsStride());
+  }
+  // Writes the statistics of this node to its entry in the parent.
+  void PublishStats() {
+    if (!parent_) return;
+    uint32_t* stats = parent_->ChildStatsArray();
+    const int stride = parent_->ChildStatsStride();
+    stats[index_] = n_;
+    stats[stride + index_] = n_in_flight_;
+    reinterpret_cast<float*>(stats + 2 * stride)[index_] = wl_;
+    reinterpret_cast<float*>(stats + 3 * stride)[index_] = d_;
+  }
+  // Rewrites all child stats, after children were released or renumbered.
+  void RebuildChildStats();
+#else
+  void PublishStats() {}
+  void RebuildChildStats() {}
+#endif
 
   // To minimize the number of padding bytes and to avoid having unnecessary
   // padding when new fields are added, we arrange the fields by size, largest
   // to smallest.
 
+#ifndef LC0_COMPACT_NODES
   // 8 byte fields.
   // Average value (from value head of neural network) of all visited nodes in
   // subtree. For terminal nodes, eval is stored. This is from the perspective
@@ -285,10 +395,11 @@ class Node {
   // perspective of the player-to-move for the position.
   // WL stands for "W minus L". Is equal to Q if draw score is 0.
   double wl_ = 0.0f;
+#endif
 
   // 8 byte fields on 64-bit platforms, 4 byte on 32-bit.
   // Array of edges.
-  std::unique_ptr<Edge[]> edges_;
+  EdgeArray edges_;
   // Pointer to a parent node. nullptr for the root.
   Node* parent_ = nullptr;
   // Pointer to a first child. nullptr for a leaf node.
@@ -299,6 +410,10 @@ class Node {
   std::unique_ptr<Node> sibling_;
 
   // 4 byte fields.
+#ifdef LC0_COMPACT_NODES
+  // Same as above, with the bits a float lacks kept in wl_residual_.
+  float wl_ = 0.0f;
+#endif
   // Averaged draw probability. Works similarly to WL, except that D is not
   // flipped depending on the side to move.
   float d_ = 0.0f;
@@ -311,11 +426,22 @@ class Node {
   // to pick in MCTS, and also when selecting the best move.
   uint32_t n_in_flight_ = 0;
 
+#ifndef LC0_COMPACT_NODES
   // 2 byte fields.
   // Index of this node is parent's edge list.
   uint16_t index_;
+#endif
 
   // 1 byte fields.
+#ifdef LC0_COMPACT_NODES
+  // Index of this node is parent's edge list, which is never longer than
+  // num_edges_ allows.
+  uint8_t index_;
+  // Rounding error of wl_, in units of 1/256th of its last bit. This makes
+  // wl_ precise enough for the slow drift of averages over billions of
+  // visits, which a plain float would lose.
+  int8_t wl_residual_ = 0;
+#endif
   // Number of edges in @edges_.
   uint8_t num_edges_ = 0;
 
@@ -346,7 +472,13 @@ class Node {
 #endif
 
 // A basic sanity check. This must be adjusted when Node members are adjusted.
+#if defined(LC0_COMPACT_NODES)
 #if defined(__i386__) || (defined(__arm__) && !defined(__aarch64__))
+static_assert(sizeof(Node) == 40, "Unexpected size of Node for 32bit compile");
+#else
+static_assert(sizeof(Node) == 56, "Unexpected size of Node");
+#endif
+#elif defined(__i386__) || (defined(__arm__) && !defined(__aarch64__))
 static_assert(sizeof(Node) == 48, "Unexpected size of Node for 32bit compile");
 #else
 static_assert(sizeof(Node) == 64, "Unexpected size of Node");
@@ -627,6 +759,28 @@ inline VisitedNode_Iterator<false> Node::VisitedNodes() {
   return {*this, child_.get()};
 }
 
+// Memory taken by the search trees of all NodeTree instances.
+struct TreeMemoryUsage {
+  // Bytes of slabs reserved for nodes allocated one by one.
+  size_t node_bytes = 0;
+  // Bytes of slabs reserved for edge arrays.
+  size_t edge_bytes = 0;
+  // Bytes of arrays of solid children.
+  size_t solid_bytes = 0;
+  // Subtrees waiting for the garbage collector to release them.
+  size_t gc_backlog = 0;
+};
+TreeMemoryUsage GetTreeMemoryUsage();
+
+// Releases discarded subtrees on the calling thread, like the garbage
+// collector threads do every interval, until about @max_nodes nodes are
+// released. Returns the number of nodes released.
+size_t CollectGarbage(size_t max_nodes);
+// Stops the garbage collector threads, once done with their interval in
+// progress, or lets them go on. While they are stopped, only CollectGarbage()
+// releases nodes, so that tests know what is left.
+void PauseGarbageCollector(bool paused);
+
 class NodeTree {
  public:
   ~NodeTree() { DeallocateTree(); }
@@ -650,8 +804,23 @@ class NodeTree {
   Node* GetGameBeginNode() const { return gamebegin_node_.get(); }
   const PositionHistory& GetPositionHistory() const { return history_; }
 
+  // Writes the visited part of the subtree under the current head to
+  // @filename, keyed by the game history leading to the head. Throws on error.
+  void SaveHeadToFile(const std::string& filename) const;
+  // If @filename holds a subtree saved with the same game history and the
+  // current head is still unexpanded, attaches the subtree to the head.
+  // Returns whether it did. Throws if the file is damaged.
+  bool LoadHeadFromFile(const std::string& filename);
+  // Same as above, with the subtree kept in memory rather than in a file. The
+  // snapshot may be restored into another tree with the same game history.
+  std::string SnapshotHead() const;
+  bool RestoreHead(const std::string& snapshot);
+
  private:
   void DeallocateTree();
+  void WriteHead(std::ostream* out) const;
+  // @name of the source is for the error messages.
+  bool ReadHead(const char* data, size_t size, const std::string& name);
   // A node which to start search from.
   Node* current_head_ = nullptr;
   // Root node of a game tree.
@@ -0,0 +1,258 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "mcts/node.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <vector>
+
+#include "chess/board.h"
+
+namespace lczero {
+
+namespace {
+// A root with the 20 moves of the start position, each child with 20
+// children of its own, all of them solid. The grandchild at index i has i
+// visits.
+std::unique_ptr<Node> MakeSolidTree() {
+  ChessBoard board;
+  board.SetFromFen(ChessBoard::kStartposFen);
+  const FixedMoveList moves = board.GenerateLegalMoves();
+  EXPECT_EQ(moves.size(), 20u);
+
+  auto root = std::make_unique<Node>(nullptr, 0);
+  root->CreateEdges(moves);
+  for (auto& edge : root->Edges()) {
+    Node* child = edge.GetOrSpawnNode(root.get());
+    child->CreateEdges(moves);
+    int visits = 0;
+    for (auto& grandchild_edge : child->Edges()) {
+      Node* grandchild = grandchild_edge.GetOrSpawnNode(child);
+      for (int i = 0; i < visits; i++) {
+        EXPECT_TRUE(grandchild->TryStartScoreUpdate());
+        grandchild->FinalizeScoreUpdate(0.5f, 0.25f, 0.0f, 1);
+      }
+      visits++;
+    }
+    EXPECT_TRUE(child->MakeSolid());
+  }
+  EXPECT_TRUE(root->MakeSolid());
+  return root;
+}
+
+// Keeps the collector threads out of the way, so that the tests see exactly
+// what CollectGarbage() releases.
+class NodeGarbageCollectorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    PauseGarbageCollector(true);
+    while (CollectGarbage(1000000) > 0) {
+    }
+  }
+  void TearDown() override { PauseGarbageCollector(false); }
+};
+}  // namespace
+
+// Releasing a whole array of solid children may go over the budget of the
+// collector, which must then stop rather than wrap the budget around.
+TEST_F(NodeGarbageCollectorTest, SolidChildrenDontOverrunBudget) {
+  auto root = MakeSolidTree();
+  // The nodes moved into the solid arrays.
+  EXPECT_EQ(CollectGarbage(1000000), 20u + 20 * 20);
+  root->ReleaseChildren();
+
+  // The array of children of the root takes the first step over the budget,
+  // then the arrays of grandchildren are left.
+  EXPECT_EQ(CollectGarbage(3), 20u);
+  EXPECT_EQ(CollectGarbage(1000), 400u);
+  EXPECT_EQ(CollectGarbage(1000), 0u);
+  EXPECT_FALSE(root->HasChildNodes());
+  EXPECT_EQ(root->GetNumEdges(), 20);
+}
+
+TEST_F(NodeGarbageCollectorTest, ReleasesAllButTheKeptSubtree) {
+  auto root = MakeSolidTree();
+  EXPECT_EQ(CollectGarbage(1000000), 20u + 20 * 20);
+  Node* kept = nullptr;
+  int index = 0;
+  for (auto& edge : root->Edges()) {
+    if (index++ == 7) kept = edge.node();
+  }
+  const Move kept_move = root->GetEdgeToNode(kept)->GetMove();
+  root->ReleaseChildrenExceptOne(kept);
+
+  // The old array of children, the kept one moved out of it, and the
+  // grandchildren of the 19 others.
+  EXPECT_EQ(CollectGarbage(1000000), 20u + 19 * 20);
+  EXPECT_EQ(CollectGarbage(1000000), 0u);
+
+  // The kept child and its children are untouched.
+  int children = 0;
+  for (auto& edge : root->Edges()) {
+    if (!edge.HasNode()) continue;
+    children++;
+    kept = edge.node();
+    EXPECT_EQ(edge.GetMove(), kept_move);
+  }
+  ASSERT_EQ(children, 1);
+  EXPECT_EQ(kept->GetParent(), root.get());
+  EXPECT_TRUE(kept->HasSolidChildren());
+  uint32_t visits = 0;
+  for (auto& edge : kept->Edges()) {
+    ASSERT_TRUE(edge.HasNode());
+    EXPECT_EQ(edge.node()->GetParent(), kept);
+    EXPECT_EQ(edge.GetN(), visits);
+    if (visits) EXPECT_EQ(edge.node()->GetWL(), 0.5f);
+    visits++;
+  }
+  EXPECT_EQ(visits, 20u);
+  root->ReleaseChildren();
+  EXPECT_EQ(CollectGarbage(1000000), 21u);
+}
+
+#ifdef LC0_CHILD_STATS
+namespace {
+// Gives @child @visits visits of value @wl, and @in_flight more started.
+void VisitChild(Node* child, int visits, float wl, int in_flight = 0) {
+  for (int i = 0; i < visits; i++) {
+    ASSERT_TRUE(child->TryStartScoreUpdate());
+    child->FinalizeScoreUpdate(wl, 0.25f, 0.0f, 1);
+  }
+  if (in_flight) child->IncrementNInFlight(in_flight);
+}
+
+// Checks that the child stats of @node are those of its children, and zero for
+// edges without a node.
+void ExpectChildStatsMatch(const Node& node) {
+  const Node::ChildStats stats = node.GetChildStats();
+  int index = 0;
+  for (const auto& edge : node.Edges()) {
+    SCOPED_TRACE(index);
+    const Node* child = edge.node();
+    EXPECT_EQ(stats.n[index], child ? child->GetN() : 0u);
+    EXPECT_EQ(stats.n_in_flight[index], child ? child->GetNInFlight() : 0u);
+    EXPECT_EQ(stats.wl[index], child ? child->GetWL() : 0.0f);
+    EXPECT_EQ(stats.d[index], child ? child->GetD() : 0.0f);
+    index++;
+  }
+  EXPECT_EQ(index, node.GetNumEdges());
+}
+
+// A node with the 20 moves of the start position, priors increasing with the
+// index, and some children visited.
+std::unique_ptr<Node> MakeNodeWithChildren() {
+  ChessBoard board;
+  board.SetFromFen(ChessBoard::kStartposFen);
+  auto node = std::make_unique<Node>(nullptr, 0);
+  node->CreateEdges(board.GenerateLegalMoves());
+  int index = 0;
+  for (auto& edge : node->Edges()) edge.edge()->SetP(0.01f * ++index);
+  int visits = 2;
+  for (auto& edge : node->Edges()) {
+    if (edge.edge()->GetP() < 0.05f || edge.edge()->GetP() > 0.15f) continue;
+    VisitChild(edge.GetOrSpawnNode(node.get()), visits, -0.1f * visits,
+               visits % 2);
+    // The visits in flight go through the node too.
+    if (visits % 2) node->IncrementNInFlight(1);
+    visits++;
+  }
+  return node;
+}
+}  // namespace
+
+TEST(NodeChildStats, MatchChildrenAfterSortEdges) {
+  auto node = MakeNodeWithChildren();
+  ExpectChildStatsMatch(*node);
+  node->SortEdges();
+  EXPECT_GT(node->Edges().begin().edge()->GetP(), 0.15f);
+  ExpectChildStatsMatch(*node);
+}
+
+TEST(NodeChildStats, MatchChildrenAfterMakeSolid) {
+  auto node = MakeNodeWithChildren();
+  ASSERT_TRUE(node->MakeSolid());
+  ExpectChildStatsMatch(*node);
+  // Updates of solid children go to the same entries.
+  for (auto& edge : node->Edges()) {
+    if (edge.HasNode()) VisitChild(edge.node(), 1, 0.5f);
+  }
+  ExpectChildStatsMatch(*node);
+  node->SortEdges();
+  ExpectChildStatsMatch(*node);
+  node->ReleaseChildren();
+  ExpectChildStatsMatch(*node);
+  while (CollectGarbage(1000) > 0) {
+  }
+}
+
+TEST(NodeChildStats, MatchChildrenAfterDropAndRestoreEdges) {
+  ChessBoard board;
+  board.SetFromFen(ChessBoard::kStartposFen);
+  Node node(nullptr, 0);
+  node.CreateEdges(board.GenerateLegalMoves());
+  int index = 0;
+  for (auto& edge : node.Edges()) edge.edge()->SetP(1.0f - 0.01f * ++index);
+  FixedMoveList dropped_moves;
+  std::vector<float> dropped_priors;
+  index = 0;
+  for (auto& edge : node.Edges()) {
+    if (index++ < 12) continue;
+    dropped_moves.push_back(edge.GetMove());
+    dropped_priors.push_back(edge.edge()->GetP());
+  }
+  node.DropEdges(12);
+  ASSERT_TRUE(node.HasDroppedEdges());
+  ExpectChildStatsMatch(node);
+  int visits = 1;
+  for (auto& edge : node.Edges()) {
+    VisitChild(edge.GetOrSpawnNode(&node), visits++, 0.2f);
+  }
+  ExpectChildStatsMatch(node);
+  node.RestoreDroppedEdges(dropped_moves, dropped_priors.data());
+  EXPECT_EQ(node.GetNumEdges(), 20);
+  ExpectChildStatsMatch(node);
+  // A child of a restored edge.
+  index = 0;
+  for (auto& edge : node.Edges()) {
+    if (index++ == 15) VisitChild(edge.GetOrSpawnNode(&node), 3, -0.2f);
+  }
+  ExpectChildStatsMatch(node);
+  node.ReleaseChildren();
+  while (CollectGarbage(1000) > 0) {
+  }
+}
+#endif
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  lczero::InitializeMagicBitboards();
+  return RUN_ALL_TESTS();
+}
@@ -55,6 +55,21 @@ FillEmptyHistory EncodeHistoryFill(std::string history_fill) {
   return FillEmptyHistory::NO;
 }
 
+ContemptMode EncodeContemptMode(const std::string& mode) {
+  if (mode == "play") return ContemptMode::PLAY;
+  if (mode == "white_side_analysis") return ContemptMode::WHITE;
+  if (mode == "black_side_analysis") return ContemptMode::BLACK;
+  assert(mode == "disable");
+  return ContemptMode::NONE;
+}
+
+Numa::Placement EncodeThreadPlacement(const std::string& placement) {
+  if (placement == "numa") return Numa::Placement::kNode;
+  if (placement == "cache") return Numa::Placement::kCache;
+  assert(placement == "none");
+  return Numa::Placement::kNone;
+}
+
 float GetContempt(std::string name, std::string contempt_str,
                   float uci_rating_adv) {
   float contempt = uci_rating_adv;
@@ -258,7 +273,8 @@ const OptionId SearchParams::kVerboseStatsId{
     'v'};
 const OptionId SearchParams::kLogLiveStatsId{
     "log-live-stats", "LogLiveStats",
-    "Do VerboseMoveStats on every info update."};
+    "Do VerboseMoveStats on every info update, and show the NN cache hits, "
+    "misses, prefetch hits and collisions of the search by node depth."};
 const OptionId SearchParams::kFpuStrategyId{
     "fpu-strategy", "FpuStrategy",
     "How is an eval of unvisited node determined. \"First Play Urgency\" "
@@ -298,6 +314,12 @@ const OptionId SearchParams::kMaxCollisionVisitsId{
 const OptionId SearchParams::kMaxCollisionEventsId{
     "max-collision-events", "MaxCollisionEvents",
     "Allowed node collision events, per batch."};
+const OptionId SearchParams::kDivertCollisionsId{
+    "divert-collisions", "DivertCollisions",
+    "While gathering a batch, give unexpanded nodes a single visit and pass "
+    "the visits which would collide on a node already being evaluated to the "
+    "next best sibling, so that large batches fill up with distinct positions "
+    "rather than collisions."};
 const OptionId SearchParams::kOutOfOrderEvalId{
     "out-of-order-eval", "OutOfOrderEval",
     "During the gathering of a batch for NN to eval, if position happens to be "
@@ -319,6 +341,32 @@ const OptionId SearchParams::kSyzygyFastPlayId{
     "syzygy-fast-play", "SyzygyFastPlay",
     "With DTZ tablebase files, only allow the network pick from winning moves "
     "that have shortest DTZ to play faster (but not necessarily optimally)."};
+const OptionId SearchParams::kInstantMoveId{
+    "instant-move", "InstantMove",
+    "Play the move without starting the search when there is nothing to "
+    "search: only one legal (or allowed) move, a tablebase win with "
+    "SyzygyFastPlay, or a mate already proven in the reused tree. Searches "
+    "which don't stop on their own (infinite or ponder) always search."};
+const OptionId SearchParams::kSyzygyProbeThreadsId{
+    "syzygy-probe-threads", "SyzygyProbeThreads",
+    "Number of threads probing WDL tablebases in the background while new "
+    "nodes are evaluated by the network, so that search threads don't wait on "
+    "reading the tables. Tablebase results replace the network evaluation "
+    "when the batch is backed up. 0 probes synchronously while extending "
+    "nodes, which saves network evaluations of tablebase positions."};
+const OptionId SearchParams::kSyzygyResolveLeavesId{
+    "syzygy-resolve-leaves", "SyzygyResolveLeaves",
+    "Also resolve new nodes in the tablebases when their 50-move counter isn't "
+    "zero or when the root itself is in the tablebases, checking DTZ against "
+    "the 50-move counter, so that such nodes are never sent to the network. "
+    "Nodes too close to the 50-move limit to tell are still evaluated."};
+const OptionId SearchParams::kSyzygyInTreeDtzId{
+    "syzygy-in-tree-dtz", "SyzygyInTreeDtz",
+    "Probe DTZ tables for won and lost tablebase nodes in the tree and use the "
+    "distance to zeroing as their moves left, so that search prefers the "
+    "fastest conversion among tablebase wins and stops once one is found. "
+    "Also probes the tree when the root is in the tablebases, as "
+    "SyzygyResolveLeaves does."};
 const OptionId SearchParams::kMultiPvId{
     "multipv", "MultiPV",
     "Number of game play lines (principal variations) to show in UCI info "
@@ -364,7 +412,9 @@ const OptionId SearchParams::kMovesLeftQuadraticFactorId{
     "base moves left effect."};
 const OptionId SearchParams::kDisplayCacheUsageId{
     "display-cache-usage", "DisplayCacheUsage",
-    "Display cache fullness through UCI info `hash` section."};
+    "Display cache fullness through UCI info `hash` section, and the cache "
+    "hit rate of the search with the eviction policy in an info string, as "
+    "well as the hit rate of the tablebase probe cache."};
 const OptionId SearchParams::kMaxConcurrentSearchersId{
     "max-concurrent-searchers", "MaxConcurrentSearchers",
     "If not 0, at most this many search workers can be gathering minibatches "
@@ -422,9 +472,15 @@ const OptionId SearchParams::kWDLBookExitBiasId{
     "rate is above 80%; ignored if WDLCalibrationElo is set."};
 const OptionId SearchParams::kNpsLimitId{
     "nps-limit", "NodesPerSecondLimit",
-    "An option to specify an upper limit to the nodes per second searched. The "
-    "accuracy depends on the minibatch size used, increasing for lower sizes, "
-    "and on the length of the search. Zero to disable."};
+    "An option to specify an upper limit to the nodes per second searched. "
+    "Search threads wait after each minibatch until its nodes fit within the "
+    "limit. Zero to disable."};
+const OptionId SearchParams::kNpsLimitGroupId{
+    "nps-limit-group", "NodesPerSecondLimitGroup",
+    "Searches of the engine instances in a process with the same group name "
+    "share one limit of NodesPerSecondLimit nodes per second, the value of the "
+    "search started last, taking turns in its use. Empty for a limit of each "
+    "search on its own."};
 const OptionId SearchParams::kSolidTreeThresholdId{
     "solid-tree-threshold", "SolidTreeThreshold",
     "Only nodes with at least this number of visits will be considered for "
@@ -449,6 +505,10 @@ const OptionId SearchParams::kMinimumWorkPerTaskForProcessingId{
     "minimum-per-task-processing", "MinimumPerTaskProcessing",
     "Processing work won't be split into chunks smaller than this (unless its "
     "more than half of MinimumProcessingWork)."};
+const OptionId SearchParams::kTaskQueueSizeId{
+    "task-queue-size", "TaskQueueSize",
+    "Room for tasks in the queue of each task worker. Tasks which don't fit "
+    "are done by the thread which split them off."};
 const OptionId SearchParams::kIdlingMinimumWorkId{
     "idling-minimum-work", "IdlingMinimumWork",
     "Only early exit gathering due to 'idle' backend if more than this many "
@@ -479,6 +539,67 @@ const OptionId SearchParams::kUCIRatingAdvId{
 const OptionId SearchParams::kSearchSpinBackoffId{
     "search-spin-backoff", "SearchSpinBackoff",
     "Enable backoff for the spin lock that acquires available searcher."};
+const OptionId SearchParams::kMinibatchPipelineDepthId{
+    "minibatch-pipeline-depth", "MinibatchPipelineDepth",
+    "Number of minibatches each search thread may have in flight on the "
+    "backend. With values above 1 the thread gathers the next minibatch while "
+    "the previous ones are still being computed, instead of waiting for each "
+    "computation to finish."};
+const OptionId SearchParams::kConcurrentBackupId{
+    "concurrent-backup", "ConcurrentBackup",
+    "Let search threads back up their minibatches at the same time, locking "
+    "only the nodes being updated rather than the whole tree. Visits which "
+    "may change terminal bounds are still backed up exclusively."};
+const OptionId SearchParams::kBatchedBackupId{
+    "batched-backup", "BatchedBackup",
+    "Back up a minibatch by merging the visits of its nodes on the union of "
+    "their paths to the root, so that every ancestor is updated once per "
+    "minibatch rather than once per node below it."};
+const OptionId SearchParams::kSpeculativePrefetchWidthId{
+    "speculative-prefetch-width", "SpeculativePrefetchWidth",
+    "When a minibatch sent to the backend has room left, fill it with the "
+    "positions after the most likely moves of nodes expanded by the previous "
+    "minibatch, up to this many per node, so that their evaluations are "
+    "already cached when search reaches them. 0 disables."};
+const OptionId SearchParams::kAdaptiveMinibatchId{
+    "adaptive-minibatch", "AdaptiveMinibatch",
+    "Tune the minibatch size and collision limits of each search thread from "
+    "the measured backend latency, between 1/8 and twice MinibatchSize."};
+const OptionId SearchParams::kAdaptiveMinibatchTimeShareId{
+    "adaptive-minibatch-time-share", "AdaptiveMinibatchTimeShare",
+    "With AdaptiveMinibatch, the largest share of the estimated remaining move "
+    "time a single backend computation is allowed to take."};
+const OptionId SearchParams::kFirstMinibatchSizeId{
+    "first-minibatch-size", "FirstMinibatchSize",
+    "Upper limit on the size of the first minibatch of every search, so that "
+    "the first NN computation is sent without waiting for a full batch to be "
+    "gathered. 0 means the first minibatch is not limited separately."};
+const OptionId SearchParams::kTranspositionVisitsId{
+    "transposition-visits", "TranspositionVisits",
+    "When non-zero, a newly extended node which transposes to a node searched "
+    "at least this many times in the current search takes the value of that "
+    "node's subtree instead of the NN eval. Only positions already in the NN "
+    "cache and without repetitions are shared. 0 disables transpositions."};
+const OptionId SearchParams::kThreadPlacementId{
+    "thread-placement", "ThreadPlacement",
+    "Spread search threads over groups of processors, binding each search "
+    "thread together with its task workers and compute threads to one group. "
+    "'numa' uses the NUMA nodes, so that tree nodes are mostly allocated in "
+    "memory local to the threads using them. 'cache' uses the processors "
+    "sharing a last level cache, e.g. the CCDs of chiplet CPUs. When the GPU "
+    "of the backend is known, only the groups close to it are used. Linux "
+    "only."};
+const OptionId SearchParams::kShowMemoryUsageId{
+    "show-memory-usage", "ShowMemoryUsage",
+    "Show the memory taken by search tree nodes, edges and solid children, by "
+    "the NN cache, and the garbage collector backlog in an info string with "
+    "each search info update."};
+const OptionId SearchParams::kEdgesKeptId{
+    "edges-kept", "EdgesKept",
+    "Number of most likely moves kept as edges when a node is expanded. Edges "
+    "of the other moves are dropped to save memory, and made again once the "
+    "node has enough visits to need them, with priors from the NN cache if the "
+    "position is still there. 0 keeps all edges."};
 
 void SearchParams::Populate(OptionsParser* options) {
   // Here the uci optimized defaults" are set.
@@ -520,10 +641,15 @@ void SearchParams::Populate(OptionsParser* options) {
       145000;
   options->Add<FloatOption>(kMaxCollisionVisitsScalingPowerId, 0.01, 100) =
       1.25;
+  options->Add<BoolOption>(kDivertCollisionsId) = false;
   options->Add<BoolOption>(kOutOfOrderEvalId) = true;
   options->Add<FloatOption>(kMaxOutOfOrderEvalsFactorId, 0.0f, 100.0f) = 2.4f;
   options->Add<BoolOption>(kStickyEndgamesId) = true;
   options->Add<BoolOption>(kSyzygyFastPlayId) = false;
+  options->Add<BoolOption>(kInstantMoveId) = true;
+  options->Add<IntOption>(kSyzygyProbeThreadsId, 0, 64) = 0;
+  options->Add<BoolOption>(kSyzygyResolveLeavesId) = false;
+  options->Add<BoolOption>(kSyzygyInTreeDtzId) = false;
   options->Add<IntOption>(kMultiPvId, 1, 500) = 1;
   options->Add<BoolOption>(kPerPvCountersId) = false;
   std::vector<std::string> score_type = {"centipawn",
@@ -563,6 +689,7 @@ void SearchParams::Populate(OptionsParser* options) {
   options->Add<FloatOption>(kWDLDrawRateReferenceId, 0.001f, 0.999f) = 0.5f;
   options->Add<FloatOption>(kWDLBookExitBiasId, -2.0f, 2.0f) = 0.65f;
   options->Add<FloatOption>(kNpsLimitId, 0.0f, 1e6f) = 0.0f;
+  options->Add<StringOption>(kNpsLimitGroupId) = "";
   options->Add<IntOption>(kSolidTreeThresholdId, 1, 2000000000) = 100;
   options->Add<IntOption>(kTaskWorkersPerSearchWorkerId, -1, 128) = -1;
   options->Add<IntOption>(kMinimumWorkSizeForProcessingId, 2, 100000) = 20;
@@ -570,17 +697,32 @@ void SearchParams::Populate(OptionsParser* options) {
   options->Add<IntOption>(kMinimumRemainingWorkSizeForPickingId, 0, 100000) =
       20;
   options->Add<IntOption>(kMinimumWorkPerTaskForProcessingId, 1, 100000) = 8;
+  options->Add<IntOption>(kTaskQueueSizeId, 1, 1024) = 100;
   options->Add<IntOption>(kIdlingMinimumWorkId, 0, 10000) = 0;
   options->Add<IntOption>(kThreadIdlingThresholdId, 0, 128) = 1;
   options->Add<StringOption>(kUCIOpponentId);
   options->Add<FloatOption>(kUCIRatingAdvId, -10000.0f, 10000.0f) = 0.0f;
   options->Add<BoolOption>(kSearchSpinBackoffId) = false;
+  options->Add<IntOption>(kMinibatchPipelineDepthId, 1, 8) = 1;
+  options->Add<BoolOption>(kConcurrentBackupId) = false;
+  options->Add<BoolOption>(kBatchedBackupId) = true;
+  options->Add<IntOption>(kSpeculativePrefetchWidthId, 0, 16) = 0;
+  options->Add<BoolOption>(kAdaptiveMinibatchId) = false;
+  options->Add<FloatOption>(kAdaptiveMinibatchTimeShareId, 0.001f, 1.0f) =
+      0.02f;
+  options->Add<IntOption>(kFirstMinibatchSizeId, 0, 1024) = 0;
+  options->Add<IntOption>(kTranspositionVisitsId, 0, 1000000) = 0;
+  std::vector<std::string> thread_placement = {"none", "numa", "cache"};
+  options->Add<ChoiceOption>(kThreadPlacementId, thread_placement) = "none";
+  options->Add<BoolOption>(kShowMemoryUsageId) = false;
+  options->Add<IntOption>(kEdgesKeptId, 0, 255) = 0;
 
   options->HideOption(kNoiseEpsilonId);
   options->HideOption(kNoiseAlphaId);
   options->HideOption(kLogLiveStatsId);
   options->HideOption(kDisplayCacheUsageId);
   options->HideOption(kRootHasOwnCpuctParamsId);
+  options->HideOption(kTaskQueueSizeId);
   options->HideOption(kCpuctAtRootId);
   options->HideOption(kCpuctBaseAtRootId);
   options->HideOption(kCpuctFactorAtRootId);
@@ -601,8 +743,7 @@ void SearchParams::Populate(OptionsParser* options) {
 }
 
 SearchParams::SearchParams(const OptionsDict& options)
-    : options_(options),
-      kCpuct(options.Get<float>(kCpuctId)),
+    : kCpuct(options.Get<float>(kCpuctId)),
       kCpuctAtRoot(options.Get<float>(
           options.Get<bool>(kRootHasOwnCpuctParamsId) ? kCpuctAtRootId
                                                       : kCpuctId)),
@@ -630,9 +771,14 @@ SearchParams::SearchParams(const OptionsDict& options)
       kPolicySoftmaxTemp(options.Get<float>(kPolicySoftmaxTempId)),
       kMaxCollisionEvents(options.Get<int>(kMaxCollisionEventsId)),
       kMaxCollisionVisits(options.Get<int>(kMaxCollisionVisitsId)),
+      kDivertCollisions(options.Get<bool>(kDivertCollisionsId)),
       kOutOfOrderEval(options.Get<bool>(kOutOfOrderEvalId)),
       kStickyEndgames(options.Get<bool>(kStickyEndgamesId)),
       kSyzygyFastPlay(options.Get<bool>(kSyzygyFastPlayId)),
+      kInstantMove(options.Get<bool>(kInstantMoveId)),
+      kSyzygyProbeThreads(options.Get<int>(kSyzygyProbeThreadsId)),
+      kSyzygyResolveLeaves(options.Get<bool>(kSyzygyResolveLeavesId)),
+      kSyzygyInTreeDtz(options.Get<bool>(kSyzygyInTreeDtzId)),
       kHistoryFill(EncodeHistoryFill(options.Get<std::string>(kHistoryFillId))),
       kMiniBatchSize(options.Get<int>(kMiniBatchSizeId)),
       kMovesLeftMaxEffect(options.Get<float>(kMovesLeftMaxEffectId)),
@@ -677,6 +823,7 @@ SearchParams::SearchParams(const OptionsDict& options)
           options.Get<int>(kMinimumRemainingWorkSizeForPickingId)),
       kMinimumWorkPerTaskForProcessing(
           options.Get<int>(kMinimumWorkPerTaskForProcessingId)),
+      kTaskQueueSize(options.Get<int>(kTaskQueueSizeId)),
       kIdlingMinimumWork(options.Get<int>(kIdlingMinimumWorkId)),
       kThreadIdlingThreshold(options.Get<int>(kThreadIdlingThresholdId)),
       kMaxCollisionVisitsScalingStart(
@@ -685,6 +832,43 @@ SearchParams::SearchParams(const OptionsDict& options)
           options.Get<int>(kMaxCollisionVisitsScalingEndId)),
       kMaxCollisionVisitsScalingPower(
           options.Get<float>(kMaxCollisionVisitsScalingPowerId)),
-      kSearchSpinBackoff(options_.Get<bool>(kSearchSpinBackoffId)) {}
+      kSearchSpinBackoff(options.Get<bool>(kSearchSpinBackoffId)),
+      kMinibatchPipelineDepth(options.Get<int>(kMinibatchPipelineDepthId)),
+      kConcurrentBackup(options.Get<bool>(kConcurrentBackupId)),
+      kBatchedBackup(options.Get<bool>(kBatchedBackupId)),
+      kSpeculativePrefetchWidth(
+          options.Get<int>(kSpeculativePrefetchWidthId)),
+      kAdaptiveMinibatch(options.Get<bool>(kAdaptiveMinibatchId)),
+      kAdaptiveMinibatchTimeShare(
+          options.Get<float>(kAdaptiveMinibatchTimeShareId)),
+      kFirstMinibatchSize(options.Get<int>(kFirstMinibatchSizeId)),
+      kTranspositionVisits(options.Get<int>(kTranspositionVisitsId)),
+      kThreadPlacement(EncodeThreadPlacement(
+          options.Get<std::string>(kThreadPlacementId))),
+      kShowMemoryUsage(options.Get<bool>(kShowMemoryUsageId)),
+      kEdgesKept(options.Get<int>(kEdgesKeptId)),
+      kMaxPrefetchBatch(options.Get<int>(kMaxPrefetchBatchId)),
+      kTemperature(options.Get<float>(kTemperatureId)),
+      kTemperatureVisitOffset(options.Get<float>(kTemperatureVisitOffsetId)),
+      kTempDecayMoves(options.Get<int>(kTempDecayMovesId)),
+      kTempDecayDelayMoves(options.Get<int>(kTempDecayDelayMovesId)),
+      kTemperatureCutoffMove(options.Get<int>(kTemperatureCutoffMoveId)),
+      kTemperatureEndgame(options.Get<float>(kTemperatureEndgameId)),
+      kTemperatureWinpctCutoff(
+          options.Get<float>(kTemperatureWinpctCutoffId)),
+      kVerboseStats(options.Get<bool>(kVerboseStatsId)),
+      kLogLiveStats(options.Get<bool>(kLogLiveStatsId)),
+      kMultiPv(options.Get<int>(kMultiPvId)),
+      kPerPvCounters(options.Get<bool>(kPerPvCountersId)),
+      kScoreType(options.Get<std::string>(kScoreTypeId)),
+      kContemptMode(
+          EncodeContemptMode(options.Get<std::string>(kContemptModeId))),
+      kNpsLimitGroup(options.Get<std::string>(kNpsLimitGroupId)),
+      kSelectionProfiles{
+          SelectionProfile{kCpuct, kCpuctFactor, kCpuctBase, 1.0f / kCpuctBase,
+                           kFpuAbsolute, kFpuValue},
+          SelectionProfile{kCpuctAtRoot, kCpuctFactorAtRoot, kCpuctBaseAtRoot,
+                           1.0f / kCpuctBaseAtRoot, kFpuAbsoluteAtRoot,
+                           kFpuValueAtRoot}} {}
 
 }  // namespace lczero
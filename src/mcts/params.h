@@ -27,8 +27,11 @@
 
 #pragma once
 
+#include <array>
+
 #include "neural/encoder.h"
 #include "utils/optionsdict.h"
+#include "utils/numa.h"
 #include "utils/optionsparser.h"
 
 namespace lczero {
@@ -50,14 +53,23 @@ class SearchParams {
     float diff;
   };
 
+  // The constants of node selection, at the root or below it, derived once
+  // from the parameters for the hot loops of the search.
+  struct SelectionProfile {
+    float cpuct;
+    float cpuct_factor;
+    float cpuct_base;
+    float inverse_cpuct_base;
+    bool fpu_absolute;
+    float fpu_value;
+  };
+
   // Populates UciOptions with search parameters.
   static void Populate(OptionsParser* options);
 
   // Parameter getters.
   int GetMiniBatchSize() const { return kMiniBatchSize; }
-  int GetMaxPrefetchBatch() const {
-    return options_.Get<int>(kMaxPrefetchBatchId);
-  }
+  int GetMaxPrefetchBatch() const { return kMaxPrefetchBatch; }
   float GetCpuct(bool at_root) const { return at_root ? kCpuctAtRoot : kCpuct; }
   float GetCpuctBase(bool at_root) const {
     return at_root ? kCpuctBaseAtRoot : kCpuctBase;
@@ -66,27 +78,22 @@ class SearchParams {
     return at_root ? kCpuctFactorAtRoot : kCpuctFactor;
   }
   bool GetTwoFoldDraws() const { return kTwoFoldDraws; }
-  float GetTemperature() const { return options_.Get<float>(kTemperatureId); }
-  float GetTemperatureVisitOffset() const {
-    return options_.Get<float>(kTemperatureVisitOffsetId);
-  }
-  int GetTempDecayMoves() const { return options_.Get<int>(kTempDecayMovesId); }
-  int GetTempDecayDelayMoves() const {
-    return options_.Get<int>(kTempDecayDelayMovesId);
-  }
-  int GetTemperatureCutoffMove() const {
-    return options_.Get<int>(kTemperatureCutoffMoveId);
-  }
-  float GetTemperatureEndgame() const {
-    return options_.Get<float>(kTemperatureEndgameId);
-  }
+  float GetTemperature() const { return kTemperature; }
+  float GetTemperatureVisitOffset() const { return kTemperatureVisitOffset; }
+  int GetTempDecayMoves() const { return kTempDecayMoves; }
+  int GetTempDecayDelayMoves() const { return kTempDecayDelayMoves; }
+  int GetTemperatureCutoffMove() const { return kTemperatureCutoffMove; }
+  float GetTemperatureEndgame() const { return kTemperatureEndgame; }
   float GetTemperatureWinpctCutoff() const {
-    return options_.Get<float>(kTemperatureWinpctCutoffId);
+    return kTemperatureWinpctCutoff;
   }
   float GetNoiseEpsilon() const { return kNoiseEpsilon; }
   float GetNoiseAlpha() const { return kNoiseAlpha; }
-  bool GetVerboseStats() const { return options_.Get<bool>(kVerboseStatsId); }
-  bool GetLogLiveStats() const { return options_.Get<bool>(kLogLiveStatsId); }
+  bool GetVerboseStats() const { return kVerboseStats; }
+  bool GetLogLiveStats() const { return kLogLiveStats; }
+  const SelectionProfile& GetSelectionProfile(bool at_root) const {
+    return kSelectionProfiles[at_root];
+  }
   bool GetFpuAbsolute(bool at_root) const {
     return at_root ? kFpuAbsoluteAtRoot : kFpuAbsolute;
   }
@@ -97,14 +104,17 @@ class SearchParams {
   float GetPolicySoftmaxTemp() const { return kPolicySoftmaxTemp; }
   int GetMaxCollisionEvents() const { return kMaxCollisionEvents; }
   int GetMaxCollisionVisits() const { return kMaxCollisionVisits; }
+  bool GetDivertCollisions() const { return kDivertCollisions; }
   bool GetOutOfOrderEval() const { return kOutOfOrderEval; }
   bool GetStickyEndgames() const { return kStickyEndgames; }
   bool GetSyzygyFastPlay() const { return kSyzygyFastPlay; }
-  int GetMultiPv() const { return options_.Get<int>(kMultiPvId); }
-  bool GetPerPvCounters() const { return options_.Get<bool>(kPerPvCountersId); }
-  std::string GetScoreType() const {
-    return options_.Get<std::string>(kScoreTypeId);
-  }
+  bool GetInstantMove() const { return kInstantMove; }
+  int GetSyzygyProbeThreads() const { return kSyzygyProbeThreads; }
+  bool GetSyzygyResolveLeaves() const { return kSyzygyResolveLeaves; }
+  bool GetSyzygyInTreeDtz() const { return kSyzygyInTreeDtz; }
+  int GetMultiPv() const { return kMultiPv; }
+  bool GetPerPvCounters() const { return kPerPvCounters; }
+  const std::string& GetScoreType() const { return kScoreType; }
   FillEmptyHistory GetHistoryFill() const { return kHistoryFill; }
   float GetMovesLeftMaxEffect() const { return kMovesLeftMaxEffect; }
   float GetMovesLeftThreshold() const { return kMovesLeftThreshold; }
@@ -117,14 +127,7 @@ class SearchParams {
   bool GetDisplayCacheUsage() const { return kDisplayCacheUsage; }
   int GetMaxConcurrentSearchers() const { return kMaxConcurrentSearchers; }
   float GetDrawScore() const { return kDrawScore; }
-  ContemptMode GetContemptMode() const {
-    std::string mode = options_.Get<std::string>(kContemptModeId);
-    if (mode == "play") return ContemptMode::PLAY;
-    if (mode == "white_side_analysis") return ContemptMode::WHITE;
-    if (mode == "black_side_analysis") return ContemptMode::BLACK;
-    assert(mode == "disable");
-    return ContemptMode::NONE;
-  }
+  ContemptMode GetContemptMode() const { return kContemptMode; }
   float GetWDLRescaleRatio() const { return kWDLRescaleParams.ratio; }
   float GetWDLRescaleDiff() const { return kWDLRescaleParams.diff; }
   float GetWDLMaxS() const { return kWDLMaxS; }
@@ -133,6 +136,7 @@ class SearchParams {
     return kMaxOutOfOrderEvalsFactor;
   }
   float GetNpsLimit() const { return kNpsLimit; }
+  const std::string& GetNpsLimitGroup() const { return kNpsLimitGroup; }
   int GetSolidTreeThreshold() const { return kSolidTreeThreshold; }
 
   int GetTaskWorkersPerSearchWorker() const {
@@ -150,6 +154,7 @@ class SearchParams {
   int GetMinimumWorkPerTaskForProcessing() const {
     return kMinimumWorkPerTaskForProcessing;
   }
+  int GetTaskQueueSize() const { return kTaskQueueSize; }
   int GetIdlingMinimumWork() const { return kIdlingMinimumWork; }
   int GetThreadIdlingThreshold() const { return kThreadIdlingThreshold; }
   int GetMaxCollisionVisitsScalingStart() const {
@@ -162,6 +167,21 @@ class SearchParams {
     return kMaxCollisionVisitsScalingPower;
   }
   bool GetSearchSpinBackoff() const { return kSearchSpinBackoff; }
+  int GetMinibatchPipelineDepth() const { return kMinibatchPipelineDepth; }
+  bool GetConcurrentBackup() const { return kConcurrentBackup; }
+  bool GetBatchedBackup() const { return kBatchedBackup; }
+  int GetSpeculativePrefetchWidth() const {
+    return kSpeculativePrefetchWidth;
+  }
+  bool GetAdaptiveMinibatch() const { return kAdaptiveMinibatch; }
+  float GetAdaptiveMinibatchTimeShare() const {
+    return kAdaptiveMinibatchTimeShare;
+  }
+  int GetFirstMinibatchSize() const { return kFirstMinibatchSize; }
+  int GetTranspositionVisits() const { return kTranspositionVisits; }
+  Numa::Placement GetThreadPlacement() const { return kThreadPlacement; }
+  bool GetShowMemoryUsage() const { return kShowMemoryUsage; }
+  int GetEdgesKept() const { return kEdgesKept; }
 
   // Search parameter IDs.
   static const OptionId kMiniBatchSizeId;
@@ -193,9 +213,14 @@ class SearchParams {
   static const OptionId kPolicySoftmaxTempId;
   static const OptionId kMaxCollisionEventsId;
   static const OptionId kMaxCollisionVisitsId;
+  static const OptionId kDivertCollisionsId;
   static const OptionId kOutOfOrderEvalId;
   static const OptionId kStickyEndgamesId;
   static const OptionId kSyzygyFastPlayId;
+  static const OptionId kInstantMoveId;
+  static const OptionId kSyzygyProbeThreadsId;
+  static const OptionId kSyzygyResolveLeavesId;
+  static const OptionId kSyzygyInTreeDtzId;
   static const OptionId kMultiPvId;
   static const OptionId kPerPvCountersId;
   static const OptionId kScoreTypeId;
@@ -221,12 +246,14 @@ class SearchParams {
   static const OptionId kWDLBookExitBiasId;
   static const OptionId kMaxOutOfOrderEvalsFactorId;
   static const OptionId kNpsLimitId;
+  static const OptionId kNpsLimitGroupId;
   static const OptionId kSolidTreeThresholdId;
   static const OptionId kTaskWorkersPerSearchWorkerId;
   static const OptionId kMinimumWorkSizeForProcessingId;
   static const OptionId kMinimumWorkSizeForPickingId;
   static const OptionId kMinimumRemainingWorkSizeForPickingId;
   static const OptionId kMinimumWorkPerTaskForProcessingId;
+  static const OptionId kTaskQueueSizeId;
   static const OptionId kIdlingMinimumWorkId;
   static const OptionId kThreadIdlingThresholdId;
   static const OptionId kMaxCollisionVisitsScalingStartId;
@@ -235,15 +262,22 @@ class SearchParams {
   static const OptionId kUCIOpponentId;
   static const OptionId kUCIRatingAdvId;
   static const OptionId kSearchSpinBackoffId;
+  static const OptionId kMinibatchPipelineDepthId;
+  static const OptionId kConcurrentBackupId;
+  static const OptionId kBatchedBackupId;
+  static const OptionId kSpeculativePrefetchWidthId;
+  static const OptionId kAdaptiveMinibatchId;
+  static const OptionId kAdaptiveMinibatchTimeShareId;
+  static const OptionId kFirstMinibatchSizeId;
+  static const OptionId kTranspositionVisitsId;
+  static const OptionId kThreadPlacementId;
+  static const OptionId kShowMemoryUsageId;
+  static const OptionId kEdgesKeptId;
 
  private:
-  const OptionsDict& options_;
-  // Cached parameter values. Values have to be cached if either:
-  // 1. Parameter is accessed often and has to be cached for performance
-  // reasons.
-  // 2. Parameter has to stay the same during the search.
-  // TODO(crem) Some of those parameters can be converted to be dynamic after
-  //            trivial search optimizations.
+  // Parameter values, all read from the options once at construction: so
+  // that they stay the same during the search, and the getters on hot paths
+  // don't do string lookups in the options dictionary.
   const float kCpuct;
   const float kCpuctAtRoot;
   const float kCpuctBase;
@@ -261,9 +295,14 @@ class SearchParams {
   const float kPolicySoftmaxTemp;
   const int kMaxCollisionEvents;
   const int kMaxCollisionVisits;
+  const bool kDivertCollisions;
   const bool kOutOfOrderEval;
   const bool kStickyEndgames;
   const bool kSyzygyFastPlay;
+  const bool kInstantMove;
+  const int kSyzygyProbeThreads;
+  const bool kSyzygyResolveLeaves;
+  const bool kSyzygyInTreeDtz;
   const FillEmptyHistory kHistoryFill;
   const int kMiniBatchSize;
   const float kMovesLeftMaxEffect;
@@ -287,12 +326,41 @@ class SearchParams {
   const int kMinimumWorkSizeForPicking;
   const int kMinimumRemainingWorkSizeForPicking;
   const int kMinimumWorkPerTaskForProcessing;
+  const int kTaskQueueSize;
   const int kIdlingMinimumWork;
   const int kThreadIdlingThreshold;
   const int kMaxCollisionVisitsScalingStart;
   const int kMaxCollisionVisitsScalingEnd;
   const float kMaxCollisionVisitsScalingPower;
   const bool kSearchSpinBackoff;
+  const int kMinibatchPipelineDepth;
+  const bool kConcurrentBackup;
+  const bool kBatchedBackup;
+  const int kSpeculativePrefetchWidth;
+  const bool kAdaptiveMinibatch;
+  const float kAdaptiveMinibatchTimeShare;
+  const int kFirstMinibatchSize;
+  const int kTranspositionVisits;
+  const Numa::Placement kThreadPlacement;
+  const bool kShowMemoryUsage;
+  const int kEdgesKept;
+  const int kMaxPrefetchBatch;
+  const float kTemperature;
+  const float kTemperatureVisitOffset;
+  const int kTempDecayMoves;
+  const int kTempDecayDelayMoves;
+  const int kTemperatureCutoffMove;
+  const float kTemperatureEndgame;
+  const float kTemperatureWinpctCutoff;
+  const bool kVerboseStats;
+  const bool kLogLiveStats;
+  const int kMultiPv;
+  const bool kPerPvCounters;
+  const std::string kScoreType;
+  const ContemptMode kContemptMode;
+  const std::string kNpsLimitGroup;
+  // Indexed by at_root, set from the values above.
+  const std::array<SelectionProfile, 2> kSelectionProfiles;
 };
 
 }  // namespace lczero
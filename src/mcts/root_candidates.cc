@@ -0,0 +1,114 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "mcts/root_candidates.h"
+
+#include <cassert>
+
+namespace lczero {
+
+ChildRank ChildRank::FromEdge(const EdgeAndNode& edge, float draw_score) {
+  ChildRank result;
+  result.n = edge.GetN();
+  // Default doesn't matter here so long as it's the same for all children, as
+  // it's only used for those with N==0.
+  result.q = edge.GetQ(0.0f, draw_score);
+  result.p = edge.GetP();
+  result.m = edge.GetM(0.0f);
+  // Not safe to access IsTerminal if GetN is 0.
+  if (result.n == 0 || !edge.IsTerminal()) return result;
+  result.is_terminal = true;
+  result.is_tb_terminal = edge.IsTbTerminal();
+  // This default isn't used as wl is only checked for a terminal edge.
+  const auto wl = edge.GetWL(0.0f);
+  if (!wl) return result;
+  if (result.is_tb_terminal) {
+    result.rank = wl < 0.0 ? kTablebaseLoss : kTablebaseWin;
+  } else {
+    result.rank = wl < 0.0 ? kTerminalLoss : kTerminalWin;
+  }
+  return result;
+}
+
+bool IsBetterChild(const ChildRank& a, const ChildRank& b) {
+  // If moves have different outcomes, prefer better outcome.
+  if (a.rank != b.rank) return a.rank > b.rank;
+
+  // If both are terminal draws, try to make it shorter.
+  if (a.rank == ChildRank::kNonTerminal && a.is_terminal && b.is_terminal) {
+    if (a.is_tb_terminal != b.is_tb_terminal) {
+      // Prefer non-tablebase draws.
+      return a.is_tb_terminal < b.is_tb_terminal;
+    }
+    // Prefer shorter draws.
+    return a.m < b.m;
+  }
+
+  // Neither is terminal, use standard rule.
+  if (a.rank == ChildRank::kNonTerminal) {
+    // Prefer largest playouts then eval then prior.
+    if (a.n != b.n) return a.n > b.n;
+    if (a.q != b.q) return a.q > b.q;
+    return a.p > b.p;
+  }
+
+  // Both variants are winning, prefer shortest win.
+  if (a.rank > ChildRank::kNonTerminal) return a.m < b.m;
+
+  // Both variants are losing, prefer longest losses.
+  return a.m > b.m;
+}
+
+void RootCandidates::Reset(int num_children) {
+  ranked_.clear();
+  positions_.assign(num_children, -1);
+}
+
+void RootCandidates::Update(int index, const ChildRank& rank) {
+  assert(index >= 0 && index < GetNumChildren());
+  int pos = positions_[index];
+  if (pos < 0) {
+    pos = ranked_.size();
+    ranked_.push_back({index, rank});
+  }
+  const Entry entry{index, rank};
+  // Children between the old and the new position move by one.
+  while (pos > 0 && IsBetterChild(rank, ranked_[pos - 1].rank)) {
+    ranked_[pos] = ranked_[pos - 1];
+    positions_[ranked_[pos].index] = pos;
+    pos--;
+  }
+  while (pos + 1 < GetSize() && IsBetterChild(ranked_[pos + 1].rank, rank)) {
+    ranked_[pos] = ranked_[pos + 1];
+    positions_[ranked_[pos].index] = pos;
+    pos++;
+  }
+  ranked_[pos] = entry;
+  positions_[index] = pos;
+}
+
+}  // namespace lczero
@@ -0,0 +1,101 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "mcts/node.h"
+
+namespace lczero {
+
+// The stats of a child which decide whether it's a better move than another.
+struct ChildRank {
+  // Lists edge types from less desirable to more desirable.
+  enum EdgeRank : uint8_t {
+    kTerminalLoss,
+    kTablebaseLoss,
+    kNonTerminal,  // Non terminal or terminal draw.
+    kTablebaseWin,
+    kTerminalWin,
+  };
+
+  static ChildRank FromEdge(const EdgeAndNode& edge, float draw_score);
+
+  EdgeRank rank = kNonTerminal;
+  // Only set for children with visits, as it's not safe to access otherwise.
+  bool is_terminal = false;
+  bool is_tb_terminal = false;
+  uint32_t n = 0;
+  float q = 0.0f;
+  float p = 0.0f;
+  float m = 0.0f;
+};
+
+// Returns whether child @a is preferred to @b as the best move, using the
+// following criteria:
+// * Prefer shorter terminal wins / avoid shorter terminal losses.
+// * Largest number of playouts.
+// * If two nodes have equal number:
+//   * If that number is 0, the one with larger prior wins.
+//   * If that number is larger than 0, the one with larger eval wins.
+bool IsBetterChild(const ChildRank& a, const ChildRank& b);
+
+// Children of the root ordered by IsBetterChild(), kept in order as their
+// stats change rather than sorted whenever the best ones are needed. Children
+// are identified by their index in the edges of the root.
+class RootCandidates {
+ public:
+  // Forgets all children, and makes room for @num_children of them.
+  void Reset(int num_children);
+  // Sets the stats of child @index, adding it if it wasn't ranked, and moves it
+  // as far as its rank changed. That's usually not far, as a backup changes
+  // the stats of one child by one visit.
+  void Update(int index, const ChildRank& rank);
+
+  // Number of children the candidates were reset for, ranked or not.
+  int GetNumChildren() const { return positions_.size(); }
+  // Number of ranked children.
+  int GetSize() const { return ranked_.size(); }
+  // Returns the index of the child at @position, the best being at 0.
+  int GetIndex(int position) const { return ranked_[position].index; }
+  // Returns the position of child @index, or -1 if it isn't ranked.
+  int GetPosition(int index) const { return positions_[index]; }
+
+ private:
+  struct Entry {
+    int index;
+    ChildRank rank;
+  };
+  // Best first.
+  std::vector<Entry> ranked_;
+  // Position in ranked_ by child index.
+  std::vector<int> positions_;
+};
+
+}  // namespace lczero
@@ -0,0 +1,145 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "mcts/root_candidates.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+
+namespace lczero {
+namespace {
+
+ChildRank MakeRank(uint32_t n, float q, float p) {
+  ChildRank rank;
+  rank.n = n;
+  rank.q = q;
+  rank.p = p;
+  return rank;
+}
+
+ChildRank MakeTerminal(ChildRank::EdgeRank edge_rank, float m) {
+  ChildRank rank = MakeRank(1, 0.0f, 0.1f);
+  rank.rank = edge_rank;
+  rank.is_terminal = true;
+  rank.m = m;
+  return rank;
+}
+
+// Checks that the ranked children are in order and that their positions
+// match.
+void ExpectRanked(const RootCandidates& candidates,
+                  const std::vector<ChildRank>& ranks) {
+  for (int pos = 0; pos < candidates.GetSize(); pos++) {
+    const int index = candidates.GetIndex(pos);
+    EXPECT_EQ(candidates.GetPosition(index), pos);
+    if (pos == 0) continue;
+    EXPECT_FALSE(
+        IsBetterChild(ranks[index], ranks[candidates.GetIndex(pos - 1)]))
+        << "at position " << pos;
+  }
+}
+
+TEST(RootCandidates, StayRankedAsVisitsGrow) {
+  constexpr int kChildren = 30;
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+  std::vector<ChildRank> ranks;
+  RootCandidates candidates;
+  candidates.Reset(kChildren);
+  for (int i = 0; i < kChildren; i++) {
+    ranks.push_back(MakeRank(0, 0.0f, uniform(gen)));
+    candidates.Update(i, ranks.back());
+  }
+  ExpectRanked(candidates, ranks);
+  EXPECT_EQ(candidates.GetSize(), kChildren);
+
+  // Visits go mostly to the children with high priors, as in a search.
+  std::discrete_distribution<int> pick(kChildren, 0.0, 1.0, [&](double x) {
+    return ranks[static_cast<int>(x * kChildren)].p;
+  });
+  for (int i = 0; i < 5000; i++) {
+    const int index = pick(gen);
+    ranks[index].n++;
+    ranks[index].q = uniform(gen) * 2.0f - 1.0f;
+    candidates.Update(index, ranks[index]);
+  }
+  ExpectRanked(candidates, ranks);
+}
+
+TEST(RootCandidates, TerminalsGoFirstAndLast) {
+  std::vector<ChildRank> ranks = {
+      MakeRank(100, 0.1f, 0.5f),
+      MakeRank(50, 0.2f, 0.3f),
+      MakeRank(10, 0.3f, 0.2f),
+  };
+  RootCandidates candidates;
+  candidates.Reset(ranks.size());
+  for (size_t i = 0; i < ranks.size(); i++) candidates.Update(i, ranks[i]);
+  EXPECT_EQ(candidates.GetIndex(0), 0);
+
+  // A proven loss drops to the end despite its visits.
+  ranks[0] = MakeTerminal(ChildRank::kTerminalLoss, 3.0f);
+  candidates.Update(0, ranks[0]);
+  EXPECT_EQ(candidates.GetIndex(2), 0);
+  EXPECT_EQ(candidates.GetIndex(0), 1);
+
+  // A proven win goes first, and a shorter one before it.
+  ranks[2] = MakeTerminal(ChildRank::kTerminalWin, 5.0f);
+  candidates.Update(2, ranks[2]);
+  EXPECT_EQ(candidates.GetIndex(0), 2);
+  ranks[1] = MakeTerminal(ChildRank::kTerminalWin, 3.0f);
+  candidates.Update(1, ranks[1]);
+  EXPECT_EQ(candidates.GetIndex(0), 1);
+  EXPECT_EQ(candidates.GetIndex(1), 2);
+  ExpectRanked(candidates, ranks);
+}
+
+TEST(RootCandidates, OnlyUpdatedChildrenAreRanked) {
+  RootCandidates candidates;
+  candidates.Reset(4);
+  candidates.Update(3, MakeRank(2, 0.0f, 0.1f));
+  candidates.Update(1, MakeRank(5, 0.0f, 0.1f));
+  EXPECT_EQ(candidates.GetNumChildren(), 4);
+  EXPECT_EQ(candidates.GetSize(), 2);
+  EXPECT_EQ(candidates.GetIndex(0), 1);
+  EXPECT_EQ(candidates.GetIndex(1), 3);
+  EXPECT_EQ(candidates.GetPosition(0), -1);
+  EXPECT_EQ(candidates.GetPosition(2), -1);
+
+  candidates.Reset(2);
+  EXPECT_EQ(candidates.GetSize(), 0);
+  EXPECT_EQ(candidates.GetNumChildren(), 2);
+}
+
+}  // namespace
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,182 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "mcts/root_stability.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace lczero {
+
+RootStabilityTracker::Child RootStabilityTracker::Child::FromEdge(
+    const EdgeAndNode& edge) {
+  Child result;
+  result.n = edge.GetN();
+  result.wl = edge.GetWL(0.0f);
+  result.d = edge.GetD(0.0f);
+  result.m = edge.GetM(0.0f);
+  // Not safe to access IsTerminal if GetN is 0.
+  if (result.n > 0 && edge.IsTerminal()) {
+    result.is_terminal = true;
+    result.is_tb_terminal = edge.IsTbTerminal();
+  }
+  return result;
+}
+
+void RootStabilityTracker::Reset(const std::vector<Child>& children,
+                                 float draw_score) {
+  children_ = children;
+  draw_score_ = draw_score;
+  visits_.clear();
+  total_ = 0;
+  wins_ = 0;
+  losses_ = 0;
+  not_resigning_ = 0;
+  for (const auto& child : children_) {
+    visits_.push_back(child.n);
+    total_ += child.n;
+    wins_ += IsWin(child);
+    losses_ += IsLoss(child);
+    not_resigning_ += IsNotResigning(child);
+  }
+  FindLargest();
+  FindMateDepth();
+  reference_.clear();
+  reference_total_ = 0;
+}
+
+void RootStabilityTracker::Update(int index, const Child& child) {
+  assert(index >= 0 && index < GetNumChildren());
+  Child& old = children_[index];
+  wins_ += IsWin(child) - IsWin(old);
+  losses_ += IsLoss(child) - IsLoss(old);
+  not_resigning_ += IsNotResigning(child) - IsNotResigning(old);
+  const bool mate_changed = IsMate(old) || IsMate(child);
+  const uint32_t old_n = old.n;
+  old = child;
+  visits_[index] = child.n;
+  total_ = total_ - old_n + child.n;
+  if (mate_changed) FindMateDepth();
+
+  if (child.n < old_n) {
+    // Only happens when visits are reverted, so it's fine to start over.
+    FindLargest();
+    reference_.clear();
+    reference_total_ = 0;
+  } else if (child.n > old_n) {
+    if (index == largest_) {
+      // Stays the largest.
+    } else if (child.n > GetN(largest_)) {
+      second_largest_ = largest_;
+      largest_ = index;
+    } else if (index != second_largest_ &&
+               child.n > GetN(second_largest_)) {
+      second_largest_ = index;
+    }
+    if (reference_total_ > 0 && reference_[index] > 0) {
+      reference_o_log_n_ +=
+          reference_[index] * (std::log(child.n) - std::log(old_n));
+    }
+  }
+
+  if (kld_gain_interval_ == 0 ||
+      total_ < reference_total_ + kld_gain_interval_) {
+    return;
+  }
+  if (reference_total_ > 0) {
+    // The sum of o/O * log((o/O) / (n/N)) over the children, with O and N the
+    // reference and the current total visits.
+    const double o = reference_total_;
+    const double n = total_;
+    const double kld = (reference_o_log_o_ - reference_o_log_n_) / o +
+                       std::log(n) - std::log(o);
+    kld_gain_per_node_ = kld / (n - o);
+    kld_gain_samples_++;
+  }
+  TakeKldReference();
+}
+
+void RootStabilityTracker::SetKldGainInterval(int interval) {
+  if (interval == kld_gain_interval_) return;
+  kld_gain_interval_ = interval;
+  reference_.clear();
+  reference_total_ = 0;
+}
+
+void RootStabilityTracker::FindLargest() {
+  largest_ = -1;
+  second_largest_ = -1;
+  for (int i = 0; i < GetNumChildren(); i++) {
+    const uint32_t n = children_[i].n;
+    if (n > GetN(largest_)) {
+      second_largest_ = largest_;
+      largest_ = i;
+    } else if (n > GetN(second_largest_)) {
+      second_largest_ = i;
+    }
+  }
+}
+
+void RootStabilityTracker::FindMateDepth() {
+  mate_depth_ = std::numeric_limits<int>::max();
+  for (const auto& child : children_) {
+    if (!IsMate(child)) continue;
+    mate_depth_ =
+        std::min(mate_depth_, static_cast<int>(std::round(child.m)) / 2 + 1);
+  }
+}
+
+void RootStabilityTracker::TakeKldReference() {
+  reference_ = visits_;
+  reference_total_ = total_;
+  reference_o_log_o_ = 0.0;
+  for (const uint32_t o : reference_) {
+    if (o > 0) reference_o_log_o_ += o * std::log(o);
+  }
+  reference_o_log_n_ = reference_o_log_o_;
+}
+
+bool RootStabilityTracker::IsWin(const Child& child) const {
+  return child.n > 0 && child.is_terminal && child.wl > 0.0f;
+}
+
+bool RootStabilityTracker::IsLoss(const Child& child) const {
+  return child.n > 0 && child.is_terminal && child.wl < 0.0f;
+}
+
+bool RootStabilityTracker::IsNotResigning(const Child& child) const {
+  // Hardcoded resign threshold, because there is no available parameter.
+  return child.n > 0 && child.wl + draw_score_ * child.d > -0.98f;
+}
+
+bool RootStabilityTracker::IsMate(const Child& child) const {
+  return child.n > 0 && child.is_terminal && child.wl == 1.0f &&
+         !child.is_tb_terminal;
+}
+
+}  // namespace lczero
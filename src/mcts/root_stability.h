@@ -0,0 +1,120 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "mcts/node.h"
+
+namespace lczero {
+
+// Keeps the stats of the root children which the stoppers look at, updated as
+// the children change rather than gathered from the root for every stopper
+// check: the visit gap between the two most visited children, the proven
+// outcomes and the KL divergence gain of the visit distribution.
+class RootStabilityTracker {
+ public:
+  struct Child {
+    static Child FromEdge(const EdgeAndNode& edge);
+
+    uint32_t n = 0;
+    float wl = 0.0f;
+    float d = 0.0f;
+    float m = 0.0f;
+    // Only set for children with visits.
+    bool is_terminal = false;
+    bool is_tb_terminal = false;
+  };
+
+  // Starts over with @children. @draw_score tells the value of a child for
+  // MayResign().
+  void Reset(const std::vector<Child>& children, float draw_score);
+  // Sets the stats of child @index.
+  void Update(int index, const Child& child);
+  // Samples the KL divergence gain every @interval visits to the children, or
+  // never for 0. The sampling starts over when the interval changes.
+  void SetKldGainInterval(int interval);
+
+  int GetNumChildren() const { return children_.size(); }
+  const std::vector<Child>& GetChildren() const { return children_; }
+  const std::vector<uint32_t>& GetVisits() const { return visits_; }
+  uint32_t GetLargestN() const { return GetN(largest_); }
+  uint32_t GetSecondLargestN() const { return GetN(second_largest_); }
+  bool IsWinFound() const { return wins_ > 0; }
+  int GetNumLosingChildren() const { return losses_; }
+  // Whether all visited children are nearly lost.
+  bool MayResign() const { return not_resigning_ == 0; }
+  // Moves to the shortest mate found, not counting tablebase wins.
+  int GetMateDepth() const { return mate_depth_; }
+  // KL divergence of the visit distribution at the end of the last sampled
+  // interval from the one at its start, per visit in between.
+  double GetKldGainPerNode() const { return kld_gain_per_node_; }
+  // Number of intervals sampled since the tracker was created.
+  int64_t GetKldGainSamples() const { return kld_gain_samples_; }
+
+ private:
+  uint32_t GetN(int index) const {
+    return index < 0 ? 0 : children_[index].n;
+  }
+  void FindLargest();
+  void FindMateDepth();
+  // Starts the next interval at the current visits.
+  void TakeKldReference();
+  // Contributions of a child to the counters.
+  bool IsWin(const Child& child) const;
+  bool IsLoss(const Child& child) const;
+  bool IsNotResigning(const Child& child) const;
+  bool IsMate(const Child& child) const;
+
+  std::vector<Child> children_;
+  std::vector<uint32_t> visits_;
+  float draw_score_ = 0.0f;
+  uint64_t total_ = 0;
+  // Indices of the two most visited children, -1 if none.
+  int largest_ = -1;
+  int second_largest_ = -1;
+  int wins_ = 0;
+  int losses_ = 0;
+  int not_resigning_ = 0;
+  int mate_depth_ = std::numeric_limits<int>::max();
+
+  int kld_gain_interval_ = 0;
+  // Visits at the start of the interval, none until the first interval.
+  std::vector<uint32_t> reference_;
+  uint64_t reference_total_ = 0;
+  // Sums over the children with reference visits o of o * log(o) and
+  // o * log(n), the latter kept up to date as n changes.
+  double reference_o_log_o_ = 0.0;
+  double reference_o_log_n_ = 0.0;
+  double kld_gain_per_node_ = 0.0;
+  int64_t kld_gain_samples_ = 0;
+};
+
+}  // namespace lczero
@@ -0,0 +1,169 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "mcts/root_stability.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+
+namespace lczero {
+namespace {
+
+using Child = RootStabilityTracker::Child;
+
+Child Visited(uint32_t n, float wl) {
+  Child child;
+  child.n = n;
+  child.wl = wl;
+  return child;
+}
+
+Child Terminal(float wl, float m, bool tb = false) {
+  Child child = Visited(1, wl);
+  child.m = m;
+  child.is_terminal = true;
+  child.is_tb_terminal = tb;
+  return child;
+}
+
+// KL divergence of the visits @n from the visits @o, as KldGainStopper used
+// to compute it.
+double Kld(const std::vector<uint32_t>& o, const std::vector<uint32_t>& n) {
+  double o_total = 0.0;
+  double n_total = 0.0;
+  for (size_t i = 0; i < o.size(); i++) {
+    o_total += o[i];
+    n_total += n[i];
+  }
+  double kld = 0.0;
+  for (size_t i = 0; i < o.size(); i++) {
+    if (o[i] == 0) continue;
+    const double o_p = o[i] / o_total;
+    const double n_p = n[i] / n_total;
+    kld += o_p * std::log(o_p / n_p);
+  }
+  return kld;
+}
+
+TEST(RootStabilityTracker, SamplesKldGainAsVisitsGrow) {
+  constexpr int kChildren = 20;
+  constexpr int kInterval = 100;
+  std::mt19937 gen(7);
+  std::vector<uint32_t> visits(kChildren);
+  RootStabilityTracker tracker;
+  tracker.Reset(std::vector<Child>(kChildren), 0.0f);
+  tracker.SetKldGainInterval(kInterval);
+
+  std::vector<uint32_t> reference;
+  uint64_t reference_total = 0;
+  uint64_t total = 0;
+  int64_t samples = 0;
+  for (int i = 0; i < 20000; i++) {
+    // The favourite changes over time, which the gain has to follow.
+    const int favourite = (i / 3000) % kChildren;
+    std::uniform_int_distribution<int> any(0, kChildren - 1);
+    const int index = gen() % 2 ? favourite : any(gen);
+    const uint32_t multivisit = 1 + gen() % 3;
+    visits[index] += multivisit;
+    total += multivisit;
+    tracker.Update(index, Visited(visits[index], 0.0f));
+    if (total < reference_total + kInterval) continue;
+    if (reference_total > 0) {
+      samples++;
+      ASSERT_EQ(tracker.GetKldGainSamples(), samples);
+      EXPECT_NEAR(tracker.GetKldGainPerNode(),
+                  Kld(reference, visits) / (total - reference_total), 1e-9);
+    }
+    reference = visits;
+    reference_total = total;
+  }
+  EXPECT_GT(samples, 100);
+  EXPECT_EQ(tracker.GetVisits(), visits);
+}
+
+TEST(RootStabilityTracker, KeepsTheTwoLargest) {
+  constexpr int kChildren = 10;
+  std::mt19937 gen(3);
+  std::vector<uint32_t> visits(kChildren);
+  RootStabilityTracker tracker;
+  tracker.Reset(std::vector<Child>(kChildren), 0.0f);
+  for (int i = 0; i < 2000; i++) {
+    const int index = gen() % kChildren;
+    visits[index] += 1 + gen() % 4;
+    tracker.Update(index, Visited(visits[index], 0.0f));
+    auto sorted = visits;
+    std::sort(sorted.rbegin(), sorted.rend());
+    ASSERT_EQ(tracker.GetLargestN(), sorted[0]);
+    ASSERT_EQ(tracker.GetSecondLargestN(), sorted[1]);
+  }
+  // Reverted visits are found again.
+  const int largest = std::max_element(visits.begin(), visits.end()) -
+                      visits.begin();
+  visits[largest] = 0;
+  tracker.Update(largest, Visited(0, 0.0f));
+  auto sorted = visits;
+  std::sort(sorted.rbegin(), sorted.rend());
+  EXPECT_EQ(tracker.GetLargestN(), sorted[0]);
+  EXPECT_EQ(tracker.GetSecondLargestN(), sorted[1]);
+}
+
+TEST(RootStabilityTracker, CountsProvenChildren) {
+  RootStabilityTracker tracker;
+  tracker.Reset({Visited(10, -0.99f), Visited(5, -0.99f), Child(), Child()},
+                0.0f);
+  EXPECT_FALSE(tracker.IsWinFound());
+  EXPECT_EQ(tracker.GetNumLosingChildren(), 0);
+  EXPECT_TRUE(tracker.MayResign());
+  EXPECT_EQ(tracker.GetMateDepth(), std::numeric_limits<int>::max());
+
+  tracker.Update(2, Visited(1, 0.5f));
+  EXPECT_FALSE(tracker.MayResign());
+  tracker.Update(2, Terminal(-1.0f, 4.0f));
+  EXPECT_TRUE(tracker.MayResign());
+  EXPECT_EQ(tracker.GetNumLosingChildren(), 1);
+
+  tracker.Update(3, Terminal(1.0f, 5.0f));
+  EXPECT_TRUE(tracker.IsWinFound());
+  EXPECT_EQ(tracker.GetMateDepth(), 3);
+  tracker.Update(1, Terminal(1.0f, 1.0f));
+  EXPECT_EQ(tracker.GetMateDepth(), 1);
+  // Tablebase wins are not mates.
+  tracker.Update(1, Terminal(1.0f, 1.0f, /* tb= */ true));
+  EXPECT_EQ(tracker.GetMateDepth(), 3);
+}
+
+}  // namespace
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
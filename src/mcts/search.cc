@@ -34,15 +34,20 @@
 #include <iomanip>
 #include <iostream>
 #include <iterator>
+#include <limits>
 #include <sstream>
 #include <thread>
 
 #include "mcts/node.h"
 #include "neural/cache.h"
 #include "neural/encoder.h"
+#include "neural/shared/policy.h"
 #include "utils/fastmath.h"
+#include "utils/metrics.h"
 #include "utils/random.h"
+#include "utils/simd.h"
 #include "utils/spinhelper.h"
+#include "utils/tracing.h"
 
 namespace lczero {
 
@@ -50,6 +55,14 @@ namespace {
 // Maximum delay between outputting "uci info" when nothing interesting happens.
 const int kUciInfoMinimumFrequencyMs = 5000;
 
+MetricCounter gNodesMetric("lc0_nodes_total",
+                           "Playouts added to search trees.");
+MetricCounter gTbHitsMetric("lc0_tb_hits_total",
+                            "Search nodes resolved by tablebase probes.");
+MetricGauge gNpsMetric("lc0_nps", "Nodes per second of the latest search.");
+MetricGauge gTreeNodesMetric("lc0_tree_nodes",
+                             "Nodes in the tree of the latest search.");
+
 MoveList MakeRootMoveFilter(const MoveList& searchmoves,
                             SyzygyTablebase* syzygy_tb,
                             const PositionHistory& history, bool fast_play,
@@ -110,7 +123,11 @@ class MEvaluator {
   // Calculates the utility for favoring shorter wins and longer losses.
   float GetMUtility(Node* child, float q) const {
     if (!enabled_ || !parent_within_threshold_) return 0.0f;
-    const float child_m = child->GetM();
+    return GetMUtility(child->GetM(), q);
+  }
+
+  float GetMUtility(float child_m, float q) const {
+    if (!enabled_ || !parent_within_threshold_) return 0.0f;
     float m = std::clamp(m_slope_ * (child_m - parent_m_), -m_cap_, m_cap_);
     m *= FastSign(-q);
     if (q_threshold_ > 0.0f && q_threshold_ < 1.0f) {
@@ -155,13 +172,22 @@ Search::Search(const NodeTree& tree, Network* network,
                std::chrono::steady_clock::time_point start_time,
                std::unique_ptr<SearchStopper> stopper, bool infinite,
                bool ponder, const OptionsDict& options, NNCache* cache,
-               SyzygyTablebase* syzygy_tb)
+               SyzygyTablebase* syzygy_tb, ThreadPool* thread_pool)
     : ok_to_respond_bestmove_(!infinite && !ponder),
+      ponder_(ponder),
       stopper_(std::move(stopper)),
+      own_thread_pool_(thread_pool ? nullptr : std::make_unique<ThreadPool>()),
+      thread_pool_(thread_pool ? thread_pool : own_thread_pool_.get()),
       root_node_(tree.GetCurrentHead()),
       cache_(cache),
+      initial_cache_hits_(cache->GetHits()),
+      initial_cache_lookups_(cache->GetLookups()),
+      initial_cache_evictions_(cache->GetEvictions()),
+      initial_tb_cache_hits_(syzygy_tb ? syzygy_tb->probe_cache_hits() : 0),
+      initial_tb_cache_lookups_(
+          syzygy_tb ? syzygy_tb->probe_cache_lookups() : 0),
       syzygy_tb_(syzygy_tb),
-      played_history_(tree.GetPositionHistory()),
+      played_history_(tree.GetPositionHistory().Shared()),
       network_(network),
       params_(options),
       searchmoves_(searchmoves),
@@ -175,6 +201,19 @@ Search::Search(const NodeTree& tree, Network* network,
     pending_searchers_.store(params_.GetMaxConcurrentSearchers(),
                              std::memory_order_release);
   }
+  if (syzygy_tb_ && params_.GetSyzygyProbeThreads() > 0) {
+    tb_prober_ = std::make_unique<AsyncWdlProber>(
+        syzygy_tb_, params_.GetSyzygyProbeThreads());
+  }
+  if (params_.GetNpsLimit() > 0) {
+    // Nodes of 50ms may be searched at once, so that batches needn't be split.
+    const double burst = std::max(1.0, params_.GetNpsLimit() * 0.05);
+    const auto group = params_.GetNpsLimitGroup();
+    nps_limiter_ =
+        group.empty()
+            ? std::make_shared<TokenBucket>(params_.GetNpsLimit(), burst)
+            : GetSharedTokenBucket(group, params_.GetNpsLimit(), burst);
+  }
   contempt_mode_ = params_.GetContemptMode();
   // Make sure the contempt mode is never "play" beyond this point.
   if (contempt_mode_ == ContemptMode::PLAY) {
@@ -196,6 +235,16 @@ Search::Search(const NodeTree& tree, Network* network,
                            : ContemptMode::WHITE;
     }
   }
+  SharedMutex::Lock lock(nodes_mutex_);
+  // Root moves are all looked at, e.g. for searchmoves or verbose stats.
+  if (root_node_->HasDroppedEdges()) {
+    RestoreDroppedEdges(root_node_, played_history_);
+  }
+  if (params_.GetNoiseEpsilon() && root_node_->HasChildren()) {
+    AddNoiseToReusedRoot();
+  }
+  MakeReusedTreeSolid();
+  ResetRootChildren();
 }
 
 namespace {
@@ -258,9 +307,10 @@ inline double WDLRescale(float& v, float& d, float wdl_rescale_ratio,
 }
 }  // namespace
 
-void Search::SendUciInfo() REQUIRES(nodes_mutex_) REQUIRES(counters_mutex_) {
+std::vector<ThinkingInfo> Search::GetUciInfo()
+    REQUIRES_SHARED(nodes_mutex_) REQUIRES(counters_mutex_) {
   const auto max_pv = params_.GetMultiPv();
-  const auto edges = GetBestChildrenNoTemperature(root_node_, max_pv, 0);
+  const auto edges = GetBestRootChildren(max_pv);
   const auto score_type = params_.GetScoreType();
   const auto per_pv_counters = params_.GetPerPvCounters();
   const auto display_cache_usage = params_.GetDisplayCacheUsage();
@@ -273,8 +323,12 @@ void Search::SendUciInfo() REQUIRES(nodes_mutex_) REQUIRES(counters_mutex_) {
   common_info.depth = cum_depth_ / (total_playouts_ ? total_playouts_ : 1);
   common_info.seldepth = max_depth_;
   common_info.time = GetTimeSinceStart();
+  int64_t helper_playouts = 0;
+  for (const Search* helper : helpers_) {
+    helper_playouts += helper->GetTotalPlayouts();
+  }
   if (!per_pv_counters) {
-    common_info.nodes = total_playouts_ + initial_visits_;
+    common_info.nodes = total_playouts_ + initial_visits_ + helper_playouts;
   }
   if (display_cache_usage) {
     common_info.hashfull =
@@ -286,7 +340,8 @@ void Search::SendUciInfo() REQUIRES(nodes_mutex_) REQUIRES(counters_mutex_) {
             std::chrono::steady_clock::now() - *nps_start_time_)
             .count();
     if (time_since_first_batch_ms > 0) {
-      common_info.nps = total_playouts_ * 1000 / time_since_first_batch_ms;
+      common_info.nps = (total_playouts_ + helper_playouts) * 1000 /
+                        time_since_first_batch_ms;
     }
   }
   common_info.tb_hits = tb_hits_.load(std::memory_order_acquire);
@@ -379,33 +434,74 @@ void Search::SendUciInfo() REQUIRES(nodes_mutex_) REQUIRES(counters_mutex_) {
   if (current_best_edge_ && !edges.empty()) {
     last_outputted_info_edge_ = current_best_edge_.edge();
   }
+  return uci_infos;
+}
 
+void Search::SendUciInfo() REQUIRES(nodes_mutex_) REQUIRES(counters_mutex_) {
+  auto uci_infos = GetUciInfo();
+  Mutex::Lock output_lock(output_mutex_);
   uci_responder_->OutputThinkingInfo(&uci_infos);
 }
 
 // Decides whether anything important changed in stats and new info should be
 // shown to a user.
+bool Search::IsInfoDue() const REQUIRES_SHARED(nodes_mutex_)
+    REQUIRES(counters_mutex_) {
+  return !bestmove_is_sent_ && current_best_edge_ &&
+         (current_best_edge_.edge() != last_outputted_info_edge_ ||
+          last_outputted_uci_info_.depth !=
+              static_cast<int>(cum_depth_ /
+                               (total_playouts_ ? total_playouts_ : 1)) ||
+          last_outputted_uci_info_.seldepth != max_depth_ ||
+          last_outputted_uci_info_.time + kUciInfoMinimumFrequencyMs <
+              GetTimeSinceStart());
+}
+
 void Search::MaybeOutputInfo() {
+  if (lean_) return;
+  std::vector<ThinkingInfo> uci_infos;
+  std::unique_lock<Mutex> output_lock;
+  {
+    // This runs after every batch and mostly finds nothing to send. Neither
+    // that check nor building the PVs blocks the workers.
+    SharedMutex::SharedLock lock(nodes_mutex_);
+    Mutex::Lock counters_lock(counters_mutex_);
+    if (!IsInfoDue()) return;
+    uci_infos = GetUciInfo();
+    // Taken before the search locks are released, so that the bestmove
+    // response cannot overtake this info.
+    output_lock = std::unique_lock<Mutex>(output_mutex_);
+  }
+  // Writing out doesn't hold up the workers, which matters for a slow reader
+  // and a high MultiPV.
+  uci_responder_->OutputThinkingInfo(&uci_infos);
+  output_lock.unlock();
+
+  if (!params_.GetLogLiveStats() && !params_.GetShowMemoryUsage() &&
+      !params_.GetDisplayCacheUsage() &&
+      !(syzygy_tb_ && syzygy_tb_->collect_stats()) &&
+      !stop_.load(std::memory_order_acquire)) {
+    return;
+  }
   SharedMutex::Lock lock(nodes_mutex_);
   Mutex::Lock counters_lock(counters_mutex_);
-  if (!bestmove_is_sent_ && current_best_edge_ &&
-      (current_best_edge_.edge() != last_outputted_info_edge_ ||
-       last_outputted_uci_info_.depth !=
-           static_cast<int>(cum_depth_ /
-                            (total_playouts_ ? total_playouts_ : 1)) ||
-       last_outputted_uci_info_.seldepth != max_depth_ ||
-       last_outputted_uci_info_.time + kUciInfoMinimumFrequencyMs <
-           GetTimeSinceStart())) {
-    SendUciInfo();
-    if (params_.GetLogLiveStats()) {
-      SendMovesStats();
-    }
-    if (stop_.load(std::memory_order_acquire) && !ok_to_respond_bestmove_) {
-      std::vector<ThinkingInfo> info(1);
-      info.back().comment =
-          "WARNING: Search has reached limit and does not make any progress.";
-      uci_responder_->OutputThinkingInfo(&info);
-    }
+  if (bestmove_is_sent_) return;
+  if (params_.GetLogLiveStats()) {
+    SendMovesStats();
+    SendCacheDepthStats();
+  }
+  if (params_.GetShowMemoryUsage()) SendMemoryUsage();
+  if (params_.GetDisplayCacheUsage()) SendCacheUsage();
+  if (syzygy_tb_ && syzygy_tb_->collect_stats()) {
+    std::vector<ThinkingInfo> info(1);
+    info.back().comment = syzygy_tb_->stats_summary();
+    uci_responder_->OutputThinkingInfo(&info);
+  }
+  if (stop_.load(std::memory_order_acquire) && !ok_to_respond_bestmove_) {
+    std::vector<ThinkingInfo> info(1);
+    info.back().comment =
+        "WARNING: Search has reached limit and does not make any progress.";
+    uci_responder_->OutputThinkingInfo(&info);
   }
 }
 
@@ -432,28 +528,86 @@ float Search::GetDrawScore(bool is_odd_depth) const {
 namespace {
 inline float GetFpu(const SearchParams& params, Node* node, bool is_root_node,
                     float draw_score) {
-  const auto value = params.GetFpuValue(is_root_node);
-  return params.GetFpuAbsolute(is_root_node)
-             ? value
+  const auto& profile = params.GetSelectionProfile(is_root_node);
+  return profile.fpu_absolute
+             ? profile.fpu_value
              : -node->GetQ(-draw_score) -
-                   value * std::sqrt(node->GetVisitedPolicy());
+                   profile.fpu_value * std::sqrt(node->GetVisitedPolicy());
 }
 
 // Faster version for if visited_policy is readily available already.
 inline float GetFpu(const SearchParams& params, Node* node, bool is_root_node,
                     float draw_score, float visited_pol) {
-  const auto value = params.GetFpuValue(is_root_node);
-  return params.GetFpuAbsolute(is_root_node)
-             ? value
-             : -node->GetQ(-draw_score) - value * std::sqrt(visited_pol);
+  const auto& profile = params.GetSelectionProfile(is_root_node);
+  return profile.fpu_absolute ? profile.fpu_value
+                              : -node->GetQ(-draw_score) -
+                                    profile.fpu_value * std::sqrt(visited_pol);
 }
 
 inline float ComputeCpuct(const SearchParams& params, uint32_t N,
                           bool is_root_node) {
-  const float init = params.GetCpuct(is_root_node);
-  const float k = params.GetCpuctFactor(is_root_node);
-  const float base = params.GetCpuctBase(is_root_node);
-  return init + (k ? k * FastLog((N + base) / base) : 0.0f);
+  const auto& profile = params.GetSelectionProfile(is_root_node);
+  if (!profile.cpuct_factor) return profile.cpuct;
+  return profile.cpuct +
+         profile.cpuct_factor *
+             FastLog((N + profile.cpuct_base) * profile.inverse_cpuct_base);
+}
+
+// Sets utilities of edges still marked as lowest() to @value.
+inline void FillUnvisitedUtilities(float* util, int count, float value) {
+  constexpr float kUnset = std::numeric_limits<float>::lowest();
+  int i = 0;
+#if defined(LC0_SIMD_AVX2)
+  const __m256 unset = _mm256_set1_ps(kUnset);
+  const __m256 fill = _mm256_set1_ps(value);
+  for (; i + 8 <= count; i += 8) {
+    const __m256 u = _mm256_loadu_ps(util + i);
+    const __m256 mask = _mm256_cmp_ps(u, unset, _CMP_EQ_OQ);
+    _mm256_storeu_ps(util + i, _mm256_blendv_ps(u, fill, mask));
+  }
+#elif defined(LC0_SIMD_NEON)
+  const float32x4_t unset = vdupq_n_f32(kUnset);
+  const float32x4_t fill = vdupq_n_f32(value);
+  for (; i + 4 <= count; i += 4) {
+    const float32x4_t u = vld1q_f32(util + i);
+    vst1q_f32(util + i, vbslq_f32(vceqq_f32(u, unset), fill, u));
+  }
+#endif
+  for (; i < count; i++) {
+    if (util[i] == kUnset) util[i] = value;
+  }
+}
+
+// Computes PUCT scores of edges [start, end). Uses the same operations as the
+// scalar formula, so results are identical on every path.
+inline void ComputePuctScores(const float* pol, const int* nstarted,
+                              const float* util, float puct_mult, int start,
+                              int end, float* score) {
+  int i = start;
+#if defined(LC0_SIMD_AVX2)
+  const __m256 mult = _mm256_set1_ps(puct_mult);
+  const __m256i one = _mm256_set1_epi32(1);
+  for (; i + 8 <= end; i += 8) {
+    const __m256i n = _mm256_add_epi32(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(nstarted + i)),
+        one);
+    const __m256 u = _mm256_div_ps(
+        _mm256_mul_ps(_mm256_loadu_ps(pol + i), mult), _mm256_cvtepi32_ps(n));
+    _mm256_storeu_ps(score + i, _mm256_add_ps(u, _mm256_loadu_ps(util + i)));
+  }
+#elif defined(LC0_SIMD_NEON)
+  const float32x4_t mult = vdupq_n_f32(puct_mult);
+  const int32x4_t one = vdupq_n_s32(1);
+  for (; i + 4 <= end; i += 4) {
+    const int32x4_t n = vaddq_s32(vld1q_s32(nstarted + i), one);
+    const float32x4_t u = vdivq_f32(vmulq_f32(vld1q_f32(pol + i), mult),
+                                    vcvtq_f32_s32(n));
+    vst1q_f32(score + i, vaddq_f32(u, vld1q_f32(util + i)));
+  }
+#endif
+  for (; i < end; i++) {
+    score[i] = pol[i] * puct_mult / (1 + nstarted[i]) + util[i];
+  }
 }
 }  // namespace
 
@@ -508,7 +662,7 @@ std::vector<std::string> Search::GetVerboseStats(Node* node) const {
       v = n->GetQ(sign * draw_score);
     } else {
       NNCacheLock nneval = GetCachedNNEval(n);
-      if (nneval) v = -nneval->q;
+      if (nneval) v = -nneval->GetQ();
     }
     if (v) {
       print(oss, "(V: ", sign * *v, ") ", 7, 4);
@@ -560,6 +714,90 @@ std::vector<std::string> Search::GetVerboseStats(Node* node) const {
   return infos;
 }
 
+void Search::SendMemoryUsage() const {
+  const TreeMemoryUsage tree = GetTreeMemoryUsage();
+  std::ostringstream oss;
+  oss << "memory nodes " << tree.node_bytes / 1000000 << "MB edges "
+      << tree.edge_bytes / 1000000 << "MB solid "
+      << tree.solid_bytes / 1000000 << "MB nncache "
+      << cache_->GetMemoryUsage() / 1000000 << "MB (" << cache_->GetSize()
+      << " entries) gc-backlog " << tree.gc_backlog << " subtrees";
+  std::vector<ThinkingInfo> info(1);
+  info.back().comment = oss.str();
+  uci_responder_->OutputThinkingInfo(&info);
+}
+
+void Search::SendPhaseTimes() {
+  if (!phase_timer_) return;
+  phase_timer_->Mark("bestmove");
+  const std::string report = "phases " + phase_timer_->Report();
+  LOGFILE << report;
+  std::vector<ThinkingInfo> info(1);
+  info.back().comment = report;
+  uci_responder_->OutputThinkingInfo(&info);
+}
+
+void Search::SendCacheUsage() const {
+  const uint64_t hits = cache_->GetHits() - initial_cache_hits_;
+  const uint64_t lookups = cache_->GetLookups() - initial_cache_lookups_;
+  std::ostringstream oss;
+  oss << "nncache " << GetCacheEvictionPolicyName(cache_->GetEvictionPolicy())
+      << " hits " << std::fixed << std::setprecision(1)
+      << (lookups ? 100.0 * hits / lookups : 0.0) << "% (" << hits << " of "
+      << lookups << " lookups) evictions "
+      << cache_->GetEvictions() - initial_cache_evictions_;
+  std::vector<ThinkingInfo> info(1);
+  info.back().comment = oss.str();
+  if (syzygy_tb_) {
+    const uint64_t tb_hits =
+        syzygy_tb_->probe_cache_hits() - initial_tb_cache_hits_;
+    const uint64_t tb_lookups =
+        syzygy_tb_->probe_cache_lookups() - initial_tb_cache_lookups_;
+    std::ostringstream tb_oss;
+    tb_oss << "tbcache hits " << std::fixed << std::setprecision(1)
+           << (tb_lookups ? 100.0 * tb_hits / tb_lookups : 0.0) << "% ("
+           << tb_hits << " of " << tb_lookups << " probes) tbhits "
+           << tb_hits_.load(std::memory_order_acquire);
+    info.emplace_back();
+    info.back().comment = tb_oss.str();
+  }
+  uci_responder_->OutputThinkingInfo(&info);
+}
+
+void Search::SendCacheDepthStats() const {
+  std::vector<ThinkingInfo> infos;
+  Mutex::Lock lock(cache_stats_mutex_);
+  for (int depth = 0; depth <= kMaxCacheStatsDepth; depth++) {
+    const auto& counts = cache_depth_stats_[depth];
+    const uint64_t lookups = counts.hits + counts.misses;
+    const uint64_t prefetches = counts.prefetch_hits + counts.prefetch_misses;
+    if (lookups + prefetches + counts.collisions == 0) continue;
+    std::ostringstream oss;
+    oss << "nncache depth " << depth
+        << (depth == kMaxCacheStatsDepth ? "+" : "") << " hits "
+        << counts.hits << " misses " << counts.misses << " (" << std::fixed
+        << std::setprecision(1)
+        << (lookups ? 100.0 * counts.hits / lookups : 0.0)
+        << "%) prefetch-hits " << counts.prefetch_hits << " of " << prefetches
+        << " collisions " << counts.collisions;
+    infos.emplace_back();
+    infos.back().comment = oss.str();
+  }
+  if (!infos.empty()) uci_responder_->OutputThinkingInfo(&infos);
+}
+
+void Search::AddCacheDepthStats(const CacheDepthStats& stats) {
+  Mutex::Lock lock(cache_stats_mutex_);
+  for (int depth = 0; depth <= kMaxCacheStatsDepth; depth++) {
+    auto& counts = cache_depth_stats_[depth];
+    counts.hits += stats[depth].hits;
+    counts.misses += stats[depth].misses;
+    counts.prefetch_hits += stats[depth].prefetch_hits;
+    counts.prefetch_misses += stats[depth].prefetch_misses;
+    counts.collisions += stats[depth].collisions;
+  }
+}
+
 void Search::SendMovesStats() const REQUIRES(counters_mutex_) {
   auto move_stats = GetVerboseStats(root_node_);
 
@@ -611,28 +849,54 @@ void Search::MaybeTriggerStop(const IterationStats& stats,
   if (params_.GetNpsLimit() > 0) {
     hints->UpdateEstimatedNps(params_.GetNpsLimit());
   }
+  // This runs after every batch, so the stoppers are asked holding only
+  // counters_mutex_, and the workers are only blocked to prune or to respond.
+  std::optional<int64_t> tree_size_limit;
+  {
+    Mutex::Lock lock(counters_mutex_);
+    // Already responded bestmove, nothing to do here.
+    if (bestmove_is_sent_) return;
+    // Don't stop when the root node is not yet expanded.
+    if (stats.total_nodes == 0) return;
+
+    if (!stop_.load(std::memory_order_acquire)) {
+      if (stopper_->ShouldStop(stats, hints)) FireStopInternal();
+    }
+    if (const auto interval = hints->GetKldGainInterval()) {
+      kld_gain_interval_.store(*interval, std::memory_order_relaxed);
+    }
+    tree_size_limit = hints->GetTreeSizeLimit();
+    const bool prune = tree_size_limit &&
+                       !stop_.load(std::memory_order_acquire) &&
+                       stats.tree_nodes > *tree_size_limit;
+    const bool respond =
+        stop_.load(std::memory_order_acquire) && ok_to_respond_bestmove_;
+    if (!prune && !respond) return;
+  }
+
   SharedMutex::Lock nodes_lock(nodes_mutex_);
   Mutex::Lock lock(counters_mutex_);
-  // Already responded bestmove, nothing to do here.
   if (bestmove_is_sent_) return;
-  // Don't stop when the root node is not yet expanded.
-  if (total_playouts_ + initial_visits_ == 0) return;
-
-  if (!stop_.load(std::memory_order_acquire)) {
-    if (stopper_->ShouldStop(stats, hints)) FireStopInternal();
+  // Another thread may have pruned since the stats were taken.
+  if (tree_size_limit && !stop_.load(std::memory_order_acquire) &&
+      total_playouts_ + initial_visits_ - pruned_visits_ > *tree_size_limit) {
+    PruneTree(*tree_size_limit);
   }
 
   // If we are the first to see that stop is needed.
   if (stop_.load(std::memory_order_acquire) && ok_to_respond_bestmove_ &&
       !bestmove_is_sent_) {
-    SendUciInfo();
+    if (!lean_) SendUciInfo();
     EnsureBestMoveKnown();
-    SendMovesStats();
+    Mutex::Lock output_lock(output_mutex_);
+    if (!lean_ || params_.GetVerboseStats()) SendMovesStats();
+    SendPhaseTimes();
     BestMoveInfo info(final_bestmove_, final_pondermove_);
     uci_responder_->OutputBestMove(&info);
     stopper_->OnSearchDone(stats);
     bestmove_is_sent_ = true;
     current_best_edge_ = EdgeAndNode();
+    for (Search* helper : helpers_) helper->Abort();
   }
 }
 
@@ -665,6 +929,11 @@ std::int64_t Search::GetTotalPlayouts() const {
   return total_playouts_;
 }
 
+std::int64_t Search::GetTotalBatches() const {
+  SharedMutex::SharedLock lock(nodes_mutex_);
+  return total_batches_;
+}
+
 void Search::ResetBestMove() {
   SharedMutex::Lock nodes_lock(nodes_mutex_);
   Mutex::Lock lock(counters_mutex_);
@@ -703,9 +972,15 @@ void Search::EnsureBestMoveKnown() REQUIRES(nodes_mutex_)
     }
   }
 
-  auto bestmove_edge = temperature
-                           ? GetBestRootChildWithTemperature(temperature)
-                           : GetBestChildNoTemperature(root_node_, 0);
+  EdgeAndNode bestmove_edge;
+  if (temperature) {
+    bestmove_edge = GetBestRootChildWithTemperature(temperature);
+  } else if (helpers_.empty()) {
+    bestmove_edge = GetBestChildNoTemperature(root_node_, 0);
+  } else {
+    const auto edges = GetBestRootChildren(1);
+    if (!edges.empty()) bestmove_edge = edges[0];
+  }
   final_bestmove_ = bestmove_edge.GetMove(played_history_.IsBlackToMove());
 
   if (bestmove_edge.GetN() > 0 && bestmove_edge.node()->HasChildren()) {
@@ -714,6 +989,14 @@ void Search::EnsureBestMoveKnown() REQUIRES(nodes_mutex_)
   }
 }
 
+namespace {
+bool IsBetterChild(const EdgeAndNode& a, const EdgeAndNode& b,
+                   float draw_score) {
+  return IsBetterChild(ChildRank::FromEdge(a, draw_score),
+                       ChildRank::FromEdge(b, draw_score));
+}
+}  // namespace
+
 // Returns @count children with most visits.
 std::vector<EdgeAndNode> Search::GetBestChildrenNoTemperature(Node* parent,
                                                               int count,
@@ -721,14 +1004,11 @@ std::vector<EdgeAndNode> Search::GetBestChildrenNoTemperature(Node* parent,
   // Even if Edges is populated at this point, its a race condition to access
   // the node, so exit quickly.
   if (parent->GetN() == 0) return {};
+  if (parent == root_node_ && AreRootChildrenTracked()) {
+    return GetRootCandidates(count);
+  }
   const bool is_odd_depth = (depth % 2) == 1;
   const float draw_score = GetDrawScore(is_odd_depth);
-  // Best child is selected using the following criteria:
-  // * Prefer shorter terminal wins / avoid shorter terminal losses.
-  // * Largest number of playouts.
-  // * If two nodes have equal number:
-  //   * If that number is 0, the one with larger prior wins.
-  //   * If that number is larger than 0, the one with larger eval wins.
   std::vector<EdgeAndNode> edges;
   for (auto& edge : parent->Edges()) {
     if (parent == root_node_ && !root_move_filter_.empty() &&
@@ -741,83 +1021,196 @@ std::vector<EdgeAndNode> Search::GetBestChildrenNoTemperature(Node* parent,
   const auto middle = (static_cast<int>(edges.size()) > count)
                           ? edges.begin() + count
                           : edges.end();
-  std::partial_sort(
-      edges.begin(), middle, edges.end(),
-      [draw_score](const auto& a, const auto& b) {
-        // The function returns "true" when a is preferred to b.
-
-        // Lists edge types from less desirable to more desirable.
-        enum EdgeRank {
-          kTerminalLoss,
-          kTablebaseLoss,
-          kNonTerminal,  // Non terminal or terminal draw.
-          kTablebaseWin,
-          kTerminalWin,
-        };
-
-        auto GetEdgeRank = [](const EdgeAndNode& edge) {
-          // This default isn't used as wl only checked for case edge is
-          // terminal.
-          const auto wl = edge.GetWL(0.0f);
-          // Not safe to access IsTerminal if GetN is 0.
-          if (edge.GetN() == 0 || !edge.IsTerminal() || !wl) {
-            return kNonTerminal;
-          }
-          if (edge.IsTbTerminal()) {
-            return wl < 0.0 ? kTablebaseLoss : kTablebaseWin;
-          }
-          return wl < 0.0 ? kTerminalLoss : kTerminalWin;
-        };
-
-        // If moves have different outcomes, prefer better outcome.
-        const auto a_rank = GetEdgeRank(a);
-        const auto b_rank = GetEdgeRank(b);
-        if (a_rank != b_rank) return a_rank > b_rank;
-
-        // If both are terminal draws, try to make it shorter.
-        // Not safe to access IsTerminal if GetN is 0.
-        if (a_rank == kNonTerminal && a.GetN() != 0 && b.GetN() != 0 &&
-            a.IsTerminal() && b.IsTerminal()) {
-          if (a.IsTbTerminal() != b.IsTbTerminal()) {
-            // Prefer non-tablebase draws.
-            return a.IsTbTerminal() < b.IsTbTerminal();
-          }
-          // Prefer shorter draws.
-          return a.GetM(0.0f) < b.GetM(0.0f);
-        }
-
-        // Neither is terminal, use standard rule.
-        if (a_rank == kNonTerminal) {
-          // Prefer largest playouts then eval then prior.
-          if (a.GetN() != b.GetN()) return a.GetN() > b.GetN();
-          // Default doesn't matter here so long as they are the same as either
-          // both are N==0 (thus we're comparing equal defaults) or N!=0 and
-          // default isn't used.
-          if (a.GetQ(0.0f, draw_score) != b.GetQ(0.0f, draw_score)) {
-            return a.GetQ(0.0f, draw_score) > b.GetQ(0.0f, draw_score);
-          }
-          return a.GetP() > b.GetP();
-        }
+  std::partial_sort(edges.begin(), middle, edges.end(),
+                    [draw_score](const auto& a, const auto& b) {
+                      return IsBetterChild(a, b, draw_score);
+                    });
 
-        // Both variants are winning, prefer shortest win.
-        if (a_rank > kNonTerminal) {
-          return a.GetM(0.0f) < b.GetM(0.0f);
-        }
+  if (count < static_cast<int>(edges.size())) {
+    edges.resize(count);
+  }
+  return edges;
+}
 
-        // Both variants are losing, prefer longest losses.
-        return a.GetM(0.0f) > b.GetM(0.0f);
+std::vector<EdgeAndNode> Search::GetBestRootChildren(int count) const {
+  if (helpers_.empty()) {
+    return GetBestChildrenNoTemperature(root_node_, count, 0);
+  }
+  auto edges = GetBestChildrenNoTemperature(
+      root_node_, std::numeric_limits<int>::max(), 0);
+  // Visits and the visit weighted value sums, over all searches.
+  struct Merged {
+    EdgeAndNode edge;
+    uint64_t n;
+    double wl;
+    double d;
+  };
+  std::vector<Merged> merged;
+  for (const auto& edge : edges) {
+    const uint32_t n = edge.GetN();
+    merged.push_back({edge, n, n * edge.GetWL(0.0f), n * edge.GetD(0.0f)});
+  }
+  for (const Search* helper : helpers_) {
+    for (const auto& stats : helper->GetRootMoveStats()) {
+      auto iter = std::find_if(merged.begin(), merged.end(), [&](auto& x) {
+        return x.edge.GetMove() == stats.move;
       });
+      if (iter == merged.end()) continue;
+      iter->n += stats.n;
+      iter->wl += stats.n * stats.wl;
+      iter->d += stats.n * stats.d;
+    }
+  }
+  // Proven wins stay first and proven losses last, as this tree knows them
+  // exactly. The rest goes by visits, then by value.
+  auto is_proven = [](const Merged& x) {
+    return x.edge.GetN() != 0 && x.edge.IsTerminal() &&
+           x.edge.GetWL(0.0f) != 0.0f;
+  };
+  const float draw_score = GetDrawScore(false);
+  auto first = std::find_if_not(merged.begin(), merged.end(), is_proven);
+  auto last = std::find_if(first, merged.end(), is_proven);
+  std::stable_sort(first, last, [draw_score](const auto& a, const auto& b) {
+    if (a.n != b.n) return a.n > b.n;
+    if (a.n == 0) return false;
+    return (a.wl + draw_score * a.d) / a.n > (b.wl + draw_score * b.d) / b.n;
+  });
+  edges.clear();
+  for (const auto& x : merged) {
+    if (static_cast<int>(edges.size()) >= count) break;
+    edges.push_back(x.edge);
+  }
+  return edges;
+}
 
-  if (count < static_cast<int>(edges.size())) {
-    edges.resize(count);
+bool Search::AreRootChildrenTracked() const {
+  return !root_children_stale_.load(std::memory_order_acquire) &&
+         root_candidates_.GetNumChildren() == root_node_->GetNumEdges();
+}
+
+std::vector<EdgeAndNode> Search::GetRootCandidates(int count) const {
+  count = std::min(count, root_candidates_.GetSize());
+  std::vector<EdgeAndNode> edges(count);
+  // One pass over the children picks them out, there's nothing to compare.
+  int index = 0;
+  int found = 0;
+  for (auto& edge : root_node_->Edges()) {
+    if (found == count) break;
+    const int position = root_candidates_.GetPosition(index++);
+    if (position < 0 || position >= count) continue;
+    edges[position] = edge;
+    found++;
   }
   return edges;
 }
 
-// Returns a child with most visits.
+std::vector<RootStabilityTracker::Child> Search::GetRootChildStats() const {
+  std::vector<RootStabilityTracker::Child> children;
+  for (const auto& edge : root_node_->Edges()) {
+    children.push_back(RootStabilityTracker::Child::FromEdge(edge));
+  }
+  return children;
+}
+
+void Search::ResetRootChildren() REQUIRES(nodes_mutex_) {
+  root_children_stale_.store(false, std::memory_order_release);
+  root_candidates_.Reset(root_node_->GetNumEdges());
+  const float draw_score = GetDrawScore(false);
+  int index = 0;
+  for (auto& edge : root_node_->Edges()) {
+    if (root_move_filter_.empty() ||
+        std::find(root_move_filter_.begin(), root_move_filter_.end(),
+                  edge.GetMove()) != root_move_filter_.end()) {
+      root_candidates_.Update(index, ChildRank::FromEdge(edge, draw_score));
+    }
+    index++;
+  }
+  root_stability_.SetKldGainInterval(
+      kld_gain_interval_.load(std::memory_order_relaxed));
+  root_stability_.Reset(GetRootChildStats(), GetDrawScore(true));
+}
+
+void Search::UpdateRootChild(Node* child) REQUIRES(nodes_mutex_) {
+  if (!AreRootChildrenTracked()) {
+    ResetRootChildren();
+    return;
+  }
+  const EdgeAndNode edge(root_node_->GetEdgeToNode(child), child);
+  root_stability_.SetKldGainInterval(
+      kld_gain_interval_.load(std::memory_order_relaxed));
+  root_stability_.Update(child->Index(),
+                         RootStabilityTracker::Child::FromEdge(edge));
+  // Children outside of the filter were never ranked.
+  if (root_candidates_.GetPosition(child->Index()) < 0) return;
+  root_candidates_.Update(child->Index(),
+                          ChildRank::FromEdge(edge, GetDrawScore(false)));
+}
+
+void Search::UpdateRootChildren(std::vector<uint16_t>* indices)
+    REQUIRES(nodes_mutex_) {
+  if (indices->empty()) return;
+  if (!AreRootChildrenTracked()) {
+    ResetRootChildren();
+    return;
+  }
+  std::sort(indices->begin(), indices->end());
+  indices->erase(std::unique(indices->begin(), indices->end()),
+                 indices->end());
+  root_stability_.SetKldGainInterval(
+      kld_gain_interval_.load(std::memory_order_relaxed));
+  const float draw_score = GetDrawScore(false);
+  auto next = indices->begin();
+  int index = 0;
+  for (auto& edge : root_node_->Edges()) {
+    if (next == indices->end()) break;
+    if (index == *next) {
+      root_stability_.Update(index,
+                             RootStabilityTracker::Child::FromEdge(edge));
+      if (root_candidates_.GetPosition(index) >= 0) {
+        root_candidates_.Update(index, ChildRank::FromEdge(edge, draw_score));
+      }
+      ++next;
+    }
+    index++;
+  }
+}
+
+std::vector<Search::RootMoveStats> Search::GetRootMoveStats() const {
+  SharedMutex::SharedLock lock(nodes_mutex_);
+  std::vector<RootMoveStats> result;
+  // Edges may be populated while N is still 0, see above.
+  if (root_node_->GetN() == 0) return result;
+  for (const auto& edge : root_node_->Edges()) {
+    if (edge.GetN() == 0) continue;
+    result.push_back(
+        {edge.GetMove(), edge.GetN(), edge.GetWL(0.0f), edge.GetD(0.0f)});
+  }
+  return result;
+}
+
+// Returns a child with most visits. A single pass without allocating, as it
+// runs on backups which change the best root child and on every ply of PVs.
 EdgeAndNode Search::GetBestChildNoTemperature(Node* parent, int depth) const {
-  auto res = GetBestChildrenNoTemperature(parent, 1, depth);
-  return res.empty() ? EdgeAndNode() : res.front();
+  if (parent->GetN() == 0) return {};
+  if (parent == root_node_ && AreRootChildrenTracked()) {
+    if (root_candidates_.GetSize() == 0) return {};
+    const int best = root_candidates_.GetIndex(0);
+    int index = 0;
+    for (auto& edge : parent->Edges()) {
+      if (index++ == best) return edge;
+    }
+  }
+  const float draw_score = GetDrawScore((depth % 2) == 1);
+  EdgeAndNode best;
+  for (auto& edge : parent->Edges()) {
+    if (parent == root_node_ && !root_move_filter_.empty() &&
+        std::find(root_move_filter_.begin(), root_move_filter_.end(),
+                  edge.GetMove()) == root_move_filter_.end()) {
+      continue;
+    }
+    if (!best || IsBetterChild(edge, best, draw_score)) best = edge;
+  }
+  return best;
 }
 
 // Returns a child of a root chosen according to weighted-by-temperature visit
@@ -892,14 +1285,17 @@ void Search::StartThreads(size_t how_many) {
   thread_count_.store(how_many, std::memory_order_release);
   // First thread is a watchdog thread.
   if (threads_.size() == 0) {
-    threads_.emplace_back([this]() { WatchdogThread(); });
+    threads_.push_back(thread_pool_->Run([this]() {
+      LC0_TRACE_THREAD_NAME("watchdog");
+      WatchdogThread();
+    }));
   }
   // Start working threads.
   for (size_t i = 0; i < how_many; i++) {
-    threads_.emplace_back([this, i]() {
+    threads_.push_back(thread_pool_->Run([this, i]() {
       SearchWorker worker(this, params_, i);
       worker.RunBlocking();
-    });
+    }));
   }
   LOGFILE << "Search started. "
           << std::chrono::duration_cast<std::chrono::milliseconds>(
@@ -913,6 +1309,87 @@ void Search::RunBlocking(size_t threads) {
   Wait();
 }
 
+void Search::RunBlockingLean(size_t threads) {
+  lean_ = true;
+  if (threads == 0) threads = network_->GetThreads() + !network_->IsCpu();
+  thread_count_.store(threads, std::memory_order_release);
+  {
+    Mutex::Lock lock(threads_mutex_);
+    for (size_t i = 1; i < threads; i++) {
+      threads_.push_back(thread_pool_->Run([this, i]() {
+        SearchWorker worker(this, params_, i);
+        worker.RunBlocking();
+      }));
+    }
+  }
+  {
+    SearchWorker worker(this, params_, 0);
+    worker.RunBlocking();
+  }
+  Wait();
+}
+
+bool Search::TryInstantMove() {
+  if (!params_.GetInstantMove() || !ok_to_respond_bestmove_) return false;
+  IterationStats stats;
+  PopulateCommonIterationStats(&stats);
+
+  SharedMutex::Lock nodes_lock(nodes_mutex_);
+  Mutex::Lock lock(counters_mutex_);
+  if (bestmove_is_sent_) return false;
+  const bool is_black_to_move = played_history_.IsBlackToMove();
+  MoveList moves = root_move_filter_;
+  if (moves.empty()) {
+    const auto legal_moves =
+        played_history_.Last().GetBoard().GenerateLegalMoves();
+    moves.assign(legal_moves.begin(), legal_moves.end());
+  }
+  if (moves.empty()) return false;
+  std::string reason;
+  if (moves.size() == 1) {
+    reason = "Only one possible move.";
+  } else if (params_.GetSyzygyFastPlay() && root_is_in_dtz_ &&
+             searchmoves_.empty()) {
+    // All the moves left by the root probe keep the win with the shortest
+    // DTZ, so there is no point in searching among them.
+    ProbeState state;
+    if (syzygy_tb_->probe_wdl(played_history_.Last(), &state) == WDL_WIN &&
+        state != FAIL) {
+      reason = "Tablebase win.";
+    }
+  }
+  if (!reason.empty()) {
+    final_bestmove_ = moves[0];
+    if (is_black_to_move) final_bestmove_.Mirror();
+  } else if (root_move_filter_.empty() && root_node_->GetN() > 0) {
+    for (const auto& edge : root_node_->Edges()) {
+      if (edge.GetN() > 0 && edge.IsTerminal() && !edge.IsTbTerminal() &&
+          edge.GetWL(0.0f) > 0.0f) {
+        reason = "Mate found.";
+        break;
+      }
+    }
+    if (reason.empty()) return false;
+    SendUciInfo();
+    EnsureBestMoveKnown();
+  } else {
+    return false;
+  }
+  LOGFILE << reason << " Moving without search.";
+  Mutex::Lock output_lock(output_mutex_);
+  std::vector<ThinkingInfo> infos(1);
+  infos.back().comment = reason;
+  uci_responder_->OutputThinkingInfo(&infos);
+  SendPhaseTimes();
+  BestMoveInfo info(final_bestmove_, final_pondermove_);
+  uci_responder_->OutputBestMove(&info);
+  stopper_->OnSearchDone(stats);
+  bestmove_is_sent_ = true;
+  FireStopInternal();
+  for (Search* helper : helpers_) helper->Abort();
+  return true;
+}
+
 bool Search::IsSearchActive() const {
   return !stop_.load(std::memory_order_acquire);
 }
@@ -929,18 +1406,45 @@ void Search::PopulateCommonIterationStats(IterationStats* stats) {
     }
   }
   stats->total_nodes = total_playouts_ + initial_visits_;
+  stats->tree_nodes = stats->total_nodes - pruned_visits_;
   stats->nodes_since_movestart = total_playouts_;
   stats->batches_since_movestart = total_batches_;
   stats->average_depth = cum_depth_ / (total_playouts_ ? total_playouts_ : 1);
+  gTreeNodesMetric.Set(stats->tree_nodes);
+  if (stats->time_since_first_batch > 0) {
+    gNpsMetric.Set(total_playouts_ * 1000.0 / stats->time_since_first_batch);
+  }
   stats->edge_n.clear();
+  stats->largest_n = 0;
+  stats->second_largest_n = 0;
   stats->win_found = false;
   stats->may_resign = true;
   stats->num_losing_edges = 0;
   stats->time_usage_hint_ = IterationStats::TimeUsageHint::kNormal;
   stats->mate_depth = std::numeric_limits<int>::max();
+  stats->kld_gain_per_node = root_stability_.GetKldGainPerNode();
+  stats->kld_gain_samples = root_stability_.GetKldGainSamples();
 
   // If root node hasn't finished first visit, none of this code is safe.
   if (root_node_->GetN() > 0) {
+    // The backups keep root_stability_ up to date, except right after the
+    // root got new edges, until a backup goes through one of them.
+    RootStabilityTracker untracked;
+    const RootStabilityTracker* tracker = &root_stability_;
+    if (!AreRootChildrenTracked()) {
+      untracked.Reset(GetRootChildStats(), GetDrawScore(true));
+      tracker = &untracked;
+    }
+    stats->edge_n = tracker->GetVisits();
+    stats->largest_n = tracker->GetLargestN();
+    stats->second_largest_n = tracker->GetSecondLargestN();
+    stats->win_found = tracker->IsWinFound();
+    stats->num_losing_edges = tracker->GetNumLosingChildren();
+    stats->may_resign = tracker->MayResign();
+    stats->mate_depth = tracker->GetMateDepth();
+
+    // The M utility depends on the root's own value, so this goes over the
+    // tracked children every time.
     const auto draw_score = GetDrawScore(true);
     const float fpu =
         GetFpu(params_, root_node_, /* is_root_node */ true, draw_score);
@@ -950,31 +1454,12 @@ void Search::PopulateCommonIterationStats(IterationStats* stats) {
     const auto m_evaluator = network_->GetCapabilities().has_mlh()
                                  ? MEvaluator(params_, root_node_)
                                  : MEvaluator();
-    for (const auto& edge : root_node_->Edges()) {
-      const auto n = edge.GetN();
-      const auto q = edge.GetQ(fpu, draw_score);
-      const auto m = m_evaluator.GetMUtility(edge, q);
+    for (const auto& child : tracker->GetChildren()) {
+      const auto n = child.n;
+      const auto q = n > 0 ? child.wl + draw_score * child.d : fpu;
+      const auto m = n > 0 ? m_evaluator.GetMUtility(child.m, q)
+                           : m_evaluator.GetDefaultMUtility();
       const auto q_plus_m = q + m;
-      stats->edge_n.push_back(n);
-      if (n > 0 && edge.IsTerminal() && edge.GetWL(0.0f) > 0.0f) {
-        stats->win_found = true;
-      }
-      if (n > 0 && edge.IsTerminal() && edge.GetWL(0.0f) < 0.0f) {
-        stats->num_losing_edges += 1;
-      }
-      if (n > 0 && edge.IsTerminal() && edge.GetWL(0.0f) == 1.0f &&
-          !edge.IsTbTerminal()) {
-        stats->mate_depth =
-            std::min(stats->mate_depth,
-                     static_cast<int>(std::round(edge.GetM(0.0f))) / 2 + 1);
-      }
-
-      // If game is resignable, no need for moving quicker. This allows
-      // proving mate when losing anyway for better score output.
-      // Hardcoded resign threshold, because there is no available parameter.
-      if (n > 0 && q > -0.98f) {
-        stats->may_resign = false;
-      }
       if (max_n < n) {
         max_n = n;
         max_n_has_max_q_plus_m = false;
@@ -1024,6 +1509,7 @@ void Search::WatchdogThread() {
 }
 
 void Search::FireStopInternal() {
+  if (phase_timer_) phase_timer_->Mark("search");
   stop_.store(true, std::memory_order_release);
   watchdog_cv_.notify_all();
 }
@@ -1048,7 +1534,7 @@ void Search::Abort() {
 void Search::Wait() {
   Mutex::Lock lock(threads_mutex_);
   while (!threads_.empty()) {
-    threads_.back().join();
+    threads_.back().get();
     threads_.pop_back();
   }
 }
@@ -1071,6 +1557,11 @@ Search::~Search() {
     SharedMutex::Lock lock(nodes_mutex_);
     CancelSharedCollisions();
   }
+  if (picking_tasks_run_.load() > 0) {
+    LOGFILE << "Picking tasks run: " << picking_tasks_run_.load()
+            << ", stolen from other queues: " << picking_tasks_stolen_.load();
+  }
+  if (syzygy_tb_ && syzygy_tb_->collect_stats()) syzygy_tb_->LogStats();
   LOGFILE << "Search destroyed.";
 }
 
@@ -1079,76 +1570,68 @@ Search::~Search() {
 //////////////////////////////////////////////////////////////////////////////
 
 void SearchWorker::RunTasks(int tid) {
+  LC0_TRACE_THREAD_NAME("search task worker");
+  Numa::BindThreadToCpus(cpus_);
+  TaskWorkspace* workspace = &task_workspaces_[tid];
   while (true) {
-    PickTask* task = nullptr;
-    int id = 0;
-    {
-      int spins = 0;
-      while (true) {
-        int nta = tasks_taken_.load(std::memory_order_acquire);
-        int tc = task_count_.load(std::memory_order_acquire);
-        if (nta < tc) {
-          int val = 0;
-          if (task_taking_started_.compare_exchange_weak(
-                  val, 1, std::memory_order_acq_rel,
-                  std::memory_order_relaxed)) {
-            nta = tasks_taken_.load(std::memory_order_acquire);
-            tc = task_count_.load(std::memory_order_acquire);
-            // We got the spin lock, double check we're still in the clear.
-            if (nta < tc) {
-              id = tasks_taken_.fetch_add(1, std::memory_order_acq_rel);
-              task = &picking_tasks_[id];
-              task_taking_started_.store(0, std::memory_order_release);
-              break;
-            }
-            task_taking_started_.store(0, std::memory_order_release);
-          }
-          SpinloopPause();
+    int slot = -1;
+    int spins = 0;
+    while (true) {
+      int tc = task_count_.load(std::memory_order_acquire);
+      if (tc > 0) {
+        slot = TakeTask(workspace->task_queue);
+        if (slot >= 0) break;
+      }
+      if (tc != -1) {
+        spins++;
+        if (spins >= 512) {
+          std::this_thread::yield();
           spins = 0;
-          continue;
-        } else if (tc != -1) {
-          spins++;
-          if (spins >= 512) {
-            std::this_thread::yield();
-            spins = 0;
-          } else {
-            SpinloopPause();
-          }
-          continue;
+        } else {
+          SpinloopPause();
         }
-        spins = 0;
-        // Looks like sleep time.
-        Mutex::Lock lock(picking_tasks_mutex_);
-        // Refresh them now we have the lock.
-        nta = tasks_taken_.load(std::memory_order_acquire);
-        tc = task_count_.load(std::memory_order_acquire);
-        if (tc != -1) continue;
-        if (nta >= tc && exiting_) return;
-        task_added_.wait(lock.get_raw());
-        // And refresh again now we're awake.
-        nta = tasks_taken_.load(std::memory_order_acquire);
-        tc = task_count_.load(std::memory_order_acquire);
-        if (nta >= tc && exiting_) return;
+        continue;
       }
+      spins = 0;
+      // Looks like sleep time.
+      Mutex::Lock lock(picking_tasks_mutex_);
+      // Refresh now we have the lock.
+      if (task_count_.load(std::memory_order_acquire) != -1) continue;
+      if (exiting_) return;
+      task_added_.wait(lock.get_raw());
     }
-    if (task != nullptr) {
-      switch (task->task_type) {
-        case PickTask::kGathering: {
-          PickNodesToExtendTask(task->start, task->base_depth,
-                                task->collision_limit, task->moves_to_base,
-                                &(task->results), &(task_workspaces_[tid]));
-          break;
-        }
-        case PickTask::kProcessing: {
-          ProcessPickedTask(task->start_idx, task->end_idx,
-                            &(task_workspaces_[tid]));
-          break;
-        }
-      }
-      picking_tasks_[id].complete = true;
-      completed_tasks_.fetch_add(1, std::memory_order_acq_rel);
+    RunTask(slot, workspace);
+  }
+}
+
+int SearchWorker::TakeTask(int queue) {
+  if (auto slot = task_queues_[queue]->Pop()) return *slot;
+  const int queues = static_cast<int>(task_queues_.size());
+  for (int i = 1; i < queues; i++) {
+    if (auto slot = task_queues_[(queue + i) % queues]->Steal()) {
+      tasks_stolen_.fetch_add(1, std::memory_order_relaxed);
+      return *slot;
+    }
+  }
+  return -1;
+}
+
+void SearchWorker::RunTask(int slot, TaskWorkspace* workspace) {
+  PickTask& task = picking_tasks_[slot];
+  switch (task.task_type) {
+    case PickTask::kGathering: {
+      PickNodesToExtendTask(task.start, task.base_depth, task.collision_limit,
+                            task.moves_to_base, &(task.results), workspace);
+      break;
+    }
+    case PickTask::kProcessing: {
+      ProcessPickedTask(task.start_idx, task.end_idx, workspace);
+      break;
     }
   }
+  tasks_run_.fetch_add(1, std::memory_order_relaxed);
+  completed_tasks_.fetch_add(1, std::memory_order_acq_rel);
+  completed_tasks_spot_.WakeAll(&completed_tasks_);
 }
 
 void SearchWorker::ExecuteOneIteration() {
@@ -1157,8 +1640,11 @@ void SearchWorker::ExecuteOneIteration() {
 
   if (params_.GetMaxConcurrentSearchers() != 0) {
     std::unique_ptr<SpinHelper> spin_helper;
+    // Spins, then parks until another searcher gives up its slot.
+    std::optional<AdaptiveSpinHelper> waiter;
     if (params_.GetSearchSpinBackoff()) {
       spin_helper = std::make_unique<ExponentialBackoffSpinHelper>();
+      waiter.emplace(&search_->pending_searchers_spot_);
     } else {
       // This is a hard spin lock to reduce latency but at the expense of busy
       // wait cpu usage. If search worker count is large, this is probably a
@@ -1178,7 +1664,11 @@ void SearchWorker::ExecuteOneIteration() {
       int available =
           search_->pending_searchers_.load(std::memory_order_acquire);
       if (available == 0) {
-        spin_helper->Wait();
+        if (waiter) {
+          waiter->Wait(&search_->pending_searchers_, 0);
+        } else {
+          spin_helper->Wait();
+        }
         continue;
       }
 
@@ -1200,43 +1690,66 @@ void SearchWorker::ExecuteOneIteration() {
   CollectCollisions();
 
   // 3. Prefetch into cache.
+  const int gathered_misses = computation_->GetCacheMisses();
   MaybePrefetchIntoCache();
+  if (record_cache_stats_) RecordCacheStats();
+  SetComputationPriority(gathered_misses);
 
   if (params_.GetMaxConcurrentSearchers() != 0) {
     search_->pending_searchers_.fetch_add(1, std::memory_order_acq_rel);
-  }
+    search_->pending_searchers_spot_.WakeAll(&search_->pending_searchers_);
+  }
+
+  if (pipeline_depth_ > 1) {
+    // 4. Hand the NN computation over to the compute thread. Steps 5-7 run for
+    // every minibatch which has already been computed, and block on the
+    // oldest one only when the pipeline is full.
+    SubmitCurrentBatch();
+    while (!pipeline_.empty()) {
+      if (pipeline_.size() < static_cast<size_t>(pipeline_depth_)) {
+        Mutex::Lock lock(pipeline_mutex_);
+        if (!pipeline_.front()->computed) break;
+      }
+      RetireOldestBatch();
+    }
+  } else {
+    // 4. Run NN computation.
+    const auto compute_start = std::chrono::steady_clock::now();
+    RunNNComputation();
+    search_->backend_waiting_counter_.fetch_add(-1, std::memory_order_relaxed);
+    if (minibatch_controller_) {
+      UpdateMinibatchSize(
+          computation_->GetCacheMisses(),
+          std::chrono::duration<float, std::milli>(
+              std::chrono::steady_clock::now() - compute_start)
+              .count());
+    }
 
-  // 4. Run NN computation.
-  RunNNComputation();
-  search_->backend_waiting_counter_.fetch_add(-1, std::memory_order_relaxed);
+    // 5. Retrieve NN computations (and terminal values) into nodes.
+    FetchMinibatchResults();
 
-  // 5. Retrieve NN computations (and terminal values) into nodes.
-  FetchMinibatchResults();
+    // 6. Propagate the new nodes' information to all their parents in the
+    // tree.
+    DoBackupUpdate();
 
-  // 6. Propagate the new nodes' information to all their parents in the tree.
-  DoBackupUpdate();
+    // 7. Update the Search's status and progress information.
+    UpdateCounters();
+  }
 
-  // 7. Update the Search's status and progress information.
-  UpdateCounters();
+  // If required, wait until the nodes just searched are within the nps limit.
+  if (search_->nps_limiter_) WaitForNpsLimit();
+}
 
-  // If required, waste time to limit nps.
-  if (params_.GetNpsLimit() > 0) {
-    while (search_->IsSearchActive()) {
-      int64_t time_since_first_batch_ms = 0;
-      {
-        Mutex::Lock lock(search_->counters_mutex_);
-        time_since_first_batch_ms = search_->GetTimeSinceFirstBatch();
-      }
-      if (time_since_first_batch_ms <= 0) {
-        time_since_first_batch_ms = search_->GetTimeSinceStart();
-      }
-      auto nps = search_->GetTotalPlayouts() * 1e3f / time_since_first_batch_ms;
-      if (nps > params_.GetNpsLimit()) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
-      } else {
-        break;
-      }
-    }
+void SearchWorker::WaitForNpsLimit() {
+  if (iteration_playouts_ == 0) return;
+  const auto deadline = search_->nps_limiter_->Take(iteration_playouts_);
+  // Wakes up now and then to notice the search being stopped.
+  while (search_->IsSearchActive()) {
+    const auto now = std::chrono::steady_clock::now();
+    if (now >= deadline) break;
+    std::this_thread::sleep_for(
+        std::min<std::chrono::steady_clock::duration>(
+            deadline - now, std::chrono::milliseconds(10)));
   }
 }
 
@@ -1247,6 +1760,7 @@ void SearchWorker::InitializeIteration(
   computation_ = std::make_unique<CachingComputation>(std::move(computation),
                                                       search_->cache_);
   computation_->Reserve(target_minibatch_size_);
+  iteration_playouts_ = 0;
   minibatch_.clear();
   minibatch_.reserve(2 * target_minibatch_size_);
 }
@@ -1277,6 +1791,7 @@ int CalculateCollisionsLeft(int64_t nodes, const SearchParams& params) {
 }  // namespace
 
 void SearchWorker::GatherMinibatch() {
+  LC0_TRACE_SCOPE("gather minibatch");
   // Total number of nodes to process.
   int minibatch_size = 0;
   int cur_n = 0;
@@ -1290,6 +1805,24 @@ void SearchWorker::GatherMinibatch() {
       latest_time_manager_hints_.GetEstimatedRemainingPlayouts();
   int collisions_left = CalculateCollisionsLeft(
       std::min(static_cast<int64_t>(cur_n), remaining_n), params_);
+  if (minibatch_controller_) {
+    // Scale collisions along with the tuned minibatch size.
+    collisions_left = static_cast<int>(std::max<int64_t>(
+        1, static_cast<int64_t>(collisions_left) * target_minibatch_size_ /
+               base_minibatch_size_));
+  }
+  last_collision_limit_ = collisions_left;
+
+  // The first minibatch of a search is kept small, so that the backend starts
+  // working as soon as possible instead of waiting for a full batch.
+  int batch_limit = target_minibatch_size_;
+  if (params_.GetFirstMinibatchSize() > 0 &&
+      search_->first_batch_pending_.load(std::memory_order_relaxed) &&
+      search_->first_batch_pending_.exchange(false,
+                                             std::memory_order_relaxed)) {
+    batch_limit = std::min(batch_limit, params_.GetFirstMinibatchSize());
+    collisions_left = std::min(collisions_left, batch_limit);
+  }
 
   // Number of nodes processed out of order.
   number_out_of_order_ = 0;
@@ -1299,7 +1832,7 @@ void SearchWorker::GatherMinibatch() {
   // Gather nodes to process in the current batch.
   // If we had too many nodes out of order, also interrupt the iteration so
   // that search can exit.
-  while (minibatch_size < target_minibatch_size_ &&
+  while (minibatch_size < batch_limit &&
          number_out_of_order_ < max_out_of_order_) {
     // If there's something to process without touching slow neural net, do it.
     if (minibatch_size > 0 && computation_->GetCacheMisses() == 0) return;
@@ -1321,7 +1854,7 @@ void SearchWorker::GatherMinibatch() {
     int new_start = static_cast<int>(minibatch_.size());
 
     PickNodesToExtend(
-        std::min({collisions_left, target_minibatch_size_ - minibatch_size,
+        std::min({collisions_left, batch_limit - minibatch_size,
                   max_out_of_order_ - number_out_of_order_}));
 
     // Count the non-collisions.
@@ -1354,13 +1887,14 @@ void SearchWorker::GatherMinibatch() {
         }
         ++found;
         if (found == per_worker) {
-          picking_tasks_.emplace_back(ppt_start, i + 1);
-          task_count_.fetch_add(1, std::memory_order_acq_rel);
+          const int slot = NewTaskSlot();
+          if (slot < 0) break;
+          picking_tasks_[slot].SetProcessing(ppt_start, i + 1);
+          // The rest is processed below if the queue is full.
+          if (!PublishTask(slot, main_workspace_.task_queue)) break;
           ppt_start = i + 1;
           found = 0;
-          if (picking_tasks_.size() == static_cast<size_t>(num_tasks - 1)) {
-            break;
-          }
+          if (slot + 1 == num_tasks - 1) break;
         }
       }
     }
@@ -1409,6 +1943,15 @@ void SearchWorker::GatherMinibatch() {
         // Since minibatch_[i] holds cache lock, this is guaranteed to succeed.
         computation_->AddInputByHash(minibatch_[i].hash,
                                      std::move(minibatch_[i].lock));
+      } else if (minibatch_[i].position) {
+        const InputBuffers buffers = computation_->AddInputInPlace(
+            minibatch_[i].hash,
+            std::move(minibatch_[i].probabilities_to_cache));
+        if (buffers.masks) {
+          EncodeChildPositionForNN(*minibatch_[i].parent_planes,
+                                   *minibatch_[i].position, buffers);
+        }
+        minibatch_[i].parent_planes.reset();
       } else {
         computation_->AddInput(minibatch_[i].hash,
                                std::move(minibatch_[i].input_planes),
@@ -1444,8 +1987,19 @@ void SearchWorker::GatherMinibatch() {
 
 void SearchWorker::ProcessPickedTask(int start_idx, int end_idx,
                                      TaskWorkspace* workspace) {
+  // The cache lookup of a node waits until the next node is extended, so that
+  // the cache slot prefetched when its hash became known has arrived by then.
+  // The waiting node keeps its history for encoding in case of a miss.
   auto& history = workspace->history;
+  auto& pending_history = workspace->pending_history;
   history = search_->played_history_;
+  pending_history = search_->played_history_;
+  if (workspace->repetitions.GetLength() == 0) {
+    workspace->repetitions.Reset(search_->played_history_);
+  }
+  workspace->parent_planes.reset();
+  workspace->parent_planes_node = nullptr;
+  NodeToProcess* pending = nullptr;
 
   for (int i = start_idx; i < end_idx; i++) {
     auto& picked_node = minibatch_[i];
@@ -1456,58 +2010,112 @@ void SearchWorker::ProcessPickedTask(int start_idx, int end_idx,
     // of the game), it means that we already visited this node before.
     if (picked_node.IsExtendable()) {
       // Node was never visited, extend it.
-      ExtendNode(node, picked_node.depth, picked_node.moves_to_visit, &history);
+      ExtendNode(node, picked_node.depth, picked_node.moves_to_visit, &history,
+                 &workspace->repetitions, &picked_node.tb_probe);
       if (!node->IsTerminal()) {
         picked_node.nn_queried = true;
-        const auto hash = history.HashLast(params_.GetCacheHistoryLength() + 1);
-        picked_node.hash = hash;
-        picked_node.lock = NNCacheLock(search_->cache_, hash);
-        picked_node.is_cache_hit = picked_node.lock;
-        if (!picked_node.is_cache_hit) {
-          int transform;
-          picked_node.input_planes = EncodePositionForNN(
-              search_->network_->GetCapabilities().input_format, history, 8,
-              params_.GetHistoryFill(), &transform);
-          picked_node.probability_transform = transform;
-
-          std::vector<uint16_t>& moves = picked_node.probabilities_to_cache;
-          // Legal moves are known, use them.
-          moves.reserve(node->GetNumEdges());
-          for (const auto& edge : node->Edges()) {
-            moves.emplace_back(edge.GetMove().as_nn_index(transform));
-          }
-        } else {
-          picked_node.probability_transform = TransformForPosition(
-              search_->network_->GetCapabilities().input_format, history);
-        }
+        picked_node.hash =
+            history.HashLast(params_.GetCacheHistoryLength() + 1);
+        search_->cache_->Prefetch(picked_node.hash);
       }
     }
-    if (params_.GetOutOfOrderEval() && picked_node.CanEvalOutOfOrder()) {
-      // Perform out of order eval for the last entry in minibatch_.
-      FetchSingleNodeResult(&picked_node, picked_node, 0);
-      picked_node.ooo_completed = true;
-    }
+    if (pending) FinishPickedNode(pending, pending_history, workspace);
+    pending = &picked_node;
+    std::swap(history, pending_history);
   }
+  if (pending) FinishPickedNode(pending, pending_history, workspace);
 }
 
-#define MAX_TASKS 100
+void SearchWorker::FinishPickedNode(NodeToProcess* picked_node,
+                                    const PositionHistory& history,
+                                    TaskWorkspace* workspace) {
+  if (picked_node->nn_queried) {
+    Node* node = picked_node->node;
+    const auto hash = picked_node->hash;
+    picked_node->lock = NNCacheLock(search_->cache_, hash);
+    if (!picked_node->lock && search_->cache_->LoadFromPersistent(hash)) {
+      picked_node->lock = NNCacheLock(search_->cache_, hash);
+    }
+    picked_node->is_cache_hit = picked_node->lock;
+    // Repeated positions may be draws depending on the path, so they are
+    // never shared.
+    if (params_.GetTranspositionVisits() > 0 &&
+        history.Last().GetRepetitions() == 0) {
+      if (picked_node->is_cache_hit) {
+        picked_node->is_transposition = search_->GetTranspositionValue(
+            hash, node, &picked_node->v, &picked_node->d, &picked_node->m);
+      }
+      search_->AddTransposition(hash, node);
+    }
+    if (!picked_node->is_cache_hit) {
+      const auto input_format =
+          search_->network_->GetCapabilities().input_format;
+      // Siblings share all history planes but the first block, so those are
+      // encoded once per parent.
+      const Node* parent = node->GetParent();
+      if (!parent || parent != workspace->parent_planes_node) {
+        workspace->parent_planes = std::make_shared<const ParentHistoryPlanes>(
+            EncodeParentHistory(input_format, history, 8,
+                                params_.GetHistoryFill()));
+        workspace->parent_planes_node = parent;
+      }
+      const int transform = TransformForPosition(input_format, history);
+      if (computation_->CanAddInputInPlace()) {
+        picked_node->parent_planes = workspace->parent_planes;
+        picked_node->position = history.Last();
+      } else {
+        picked_node->input_planes = EncodeChildPositionForNN(
+            *workspace->parent_planes, history.Last(), nullptr);
+      }
+
+      std::vector<uint16_t>& moves = picked_node->probabilities_to_cache;
+      // Legal moves are known, use them.
+      moves.reserve(node->GetNumEdges());
+      for (const auto& edge : node->Edges()) {
+        moves.emplace_back(edge.GetMove().as_nn_index(transform));
+      }
+    }
+  }
+  if (params_.GetOutOfOrderEval() && picked_node->CanEvalOutOfOrder()) {
+    // Perform out of order eval for the last entry in minibatch_.
+    FetchSingleNodeResult(picked_node, *picked_node, 0);
+    picked_node->ooo_completed = true;
+  }
+}
 
 void SearchWorker::ResetTasks() {
   task_count_.store(0, std::memory_order_release);
-  tasks_taken_.store(0, std::memory_order_release);
+  task_slots_used_.store(0, std::memory_order_release);
   completed_tasks_.store(0, std::memory_order_release);
-  picking_tasks_.clear();
-  // Reserve because resizing breaks pointers held by the task threads.
-  picking_tasks_.reserve(MAX_TASKS);
+}
+
+int SearchWorker::NewTaskSlot() {
+  const int slot = task_slots_used_.fetch_add(1, std::memory_order_acq_rel);
+  return slot < kMaxTasks ? slot : -1;
+}
+
+bool SearchWorker::PublishTask(int slot, int queue) {
+  // Counted first, so that a worker can't complete the task before it is.
+  task_count_.fetch_add(1, std::memory_order_acq_rel);
+  if (task_queues_[queue]->Push(slot)) return true;
+  task_count_.fetch_sub(1, std::memory_order_acq_rel);
+  return false;
 }
 
 int SearchWorker::WaitForTasks() {
-  // Spin lock, other tasks should be done soon.
+  // Other tasks should be done soon. Run some of them here rather than idling
+  // in the meantime, and only park once there is nothing left to take.
+  AdaptiveSpinHelper waiter(&completed_tasks_spot_);
   while (true) {
     int completed = completed_tasks_.load(std::memory_order_acquire);
     int todo = task_count_.load(std::memory_order_acquire);
     if (todo == completed) return completed;
-    SpinloopPause();
+    const int slot = TakeTask(main_workspace_.task_queue);
+    if (slot >= 0) {
+      RunTask(slot, &main_workspace_);
+    } else {
+      waiter.Wait(&completed_tasks_, completed);
+    }
   }
 }
 
@@ -1528,7 +2136,9 @@ void SearchWorker::PickNodesToExtend(int collision_limit) {
                         &minibatch_, &main_workspace_);
 
   WaitForTasks();
-  for (int i = 0; i < static_cast<int>(picking_tasks_.size()); i++) {
+  const int tasks =
+      std::min(task_slots_used_.load(std::memory_order_acquire), kMaxTasks);
+  for (int i = 0; i < tasks; i++) {
     for (int j = 0; j < static_cast<int>(picking_tasks_[i].results.size());
          j++) {
       minibatch_.emplace_back(std::move(picking_tasks_[i].results[j]));
@@ -1568,6 +2178,8 @@ void SearchWorker::EnsureNodeTwoFoldCorrectForDepth(Node* child_node,
     }
     // Mark the prior twofold draw as non terminal to extend it again.
     child_node->MakeNotTerminal();
+    // The visits of a root child went down, which no backup will tell.
+    search_->root_children_stale_.store(true, std::memory_order_release);
     // When reverting the visits, we also need to revert the initial
     // visits, as we reused fewer nodes than anticipated.
     search_->initial_visits_ -= terminal_visits;
@@ -1578,6 +2190,22 @@ void SearchWorker::EnsureNodeTwoFoldCorrectForDepth(Node* child_node,
 }
 
 void SearchWorker::PickNodesToExtendTask(
+    Node* node, int base_depth, int collision_limit,
+    const std::vector<Move>& moves_to_base,
+    std::vector<NodeToProcess>* receiver, TaskWorkspace* workspace) {
+  // The moves left utility is evaluated for every child of every node on the
+  // way, so only the picking without it is compiled without its branches.
+  if (moves_left_support_) {
+    PickNodesToExtendTaskImpl<true>(node, base_depth, collision_limit,
+                                    moves_to_base, receiver, workspace);
+  } else {
+    PickNodesToExtendTaskImpl<false>(node, base_depth, collision_limit,
+                                     moves_to_base, receiver, workspace);
+  }
+}
+
+template <bool kMovesLeft>
+void SearchWorker::PickNodesToExtendTaskImpl(
     Node* node, int base_depth, int collision_limit,
     const std::vector<Move>& moves_to_base,
     std::vector<NodeToProcess>* receiver,
@@ -1621,9 +2249,10 @@ void SearchWorker::PickNodesToExtendTask(
   const float even_draw_score = search_->GetDrawScore(false);
   const float odd_draw_score = search_->GetDrawScore(true);
   const auto& root_move_filter = search_->root_move_filter_;
-  auto m_evaluator = moves_left_support_ ? MEvaluator(params_) : MEvaluator();
+  auto m_evaluator = kMovesLeft ? MEvaluator(params_) : MEvaluator();
 
   int max_limit = std::numeric_limits<int>::max();
+  const bool divert_collisions = params_.GetDivertCollisions();
 
   current_path.push_back(-1);
   while (current_path.size() > 0) {
@@ -1671,6 +2300,17 @@ void SearchWorker::PickNodesToExtendTask(
         // as its not handled on the path to it, since there isn't one.
         node->IncrementNInFlight(cur_limit);
       }
+      // Selection below may look at edges past the kept ones, bring the
+      // dropped edges back before it does.
+      if (node->HasDroppedEdges() &&
+          node->GetNStarted() + cur_limit + 2 > node->GetNumEdges()) {
+        auto& history = workspace->history;
+        history = search_->played_history_;
+        for (size_t i = 0; i + 1 < current_path.size() + base_depth; i++) {
+          history.Append(moves_to_path[i]);
+        }
+        search_->RestoreDroppedEdges(node, history);
+      }
 
       // Create visits_to_perform new back entry for this level.
       if (vtp_buffer.size() > 0) {
@@ -1705,27 +2345,74 @@ void SearchWorker::PickNodesToExtendTask(
       const float draw_score = ((current_path.size() + base_depth) % 2 == 0)
                                    ? odd_draw_score
                                    : even_draw_score;
-      m_evaluator.SetParent(node);
+      if constexpr (kMovesLeft) m_evaluator.SetParent(node);
       float visited_pol = 0.0f;
-      for (Node* child : node->VisitedNodes()) {
-        int index = child->Index();
-        visited_pol += current_pol[index];
-        float q = child->GetQ(draw_score);
-        current_util[index] = q + m_evaluator.GetMUtility(child, q);
+#ifdef LC0_CHILD_STATS
+      const Node::ChildStats child_stats = node->GetChildStats();
+      // Without moves left utility, Q is all that is needed from the children.
+      constexpr bool kVisitChildren = kMovesLeft;
+      if constexpr (!kVisitChildren) {
+        for (int i = 0; i < node->GetNumEdges(); i++) {
+          if (child_stats.n[i] == 0) continue;
+          visited_pol += current_pol[i];
+          current_util[i] = child_stats.wl[i] + draw_score * child_stats.d[i];
+        }
       }
-      const float fpu =
-          GetFpu(params_, node, is_root_node, draw_score, visited_pol);
-      for (int i = 0; i < max_needed; i++) {
-        if (current_util[i] == std::numeric_limits<float>::lowest()) {
-          current_util[i] = fpu + m_evaluator.GetDefaultMUtility();
+#else
+      constexpr bool kVisitChildren = true;
+#endif
+      if constexpr (kVisitChildren) {
+        for (Node* child : node->VisitedNodes()) {
+          int index = child->Index();
+          visited_pol += current_pol[index];
+          float q = child->GetQ(draw_score);
+          if constexpr (kMovesLeft) q += m_evaluator.GetMUtility(child, q);
+          current_util[index] = q;
         }
       }
+      float fpu = GetFpu(params_, node, is_root_node, draw_score, visited_pol);
+      if constexpr (kMovesLeft) fpu += m_evaluator.GetDefaultMUtility();
+      FillUnvisitedUtilities(current_util.data(), max_needed, fpu);
 
       const float cpuct = ComputeCpuct(params_, node->GetN(), is_root_node);
       const float puct_mult =
           cpuct * std::sqrt(std::max(node->GetChildrenVisits(), 1u));
       int cache_filled_idx = -1;
+      // No edge before this one has nstarted == 0.
+      int first_unstarted_idx = 0;
       while (cur_limit > 0) {
+        // Walk the edges up to where the scan below stops for non-root nodes,
+        // one past the first unstarted edge, and compute all their scores in
+        // one go. At root the scan may need to go further, then it fills the
+        // rest itself.
+        while (first_unstarted_idx <= cache_filled_idx &&
+               current_nstarted[first_unstarted_idx] > 0) {
+          ++first_unstarted_idx;
+        }
+        const int fill_start = cache_filled_idx + 1;
+        while (cache_filled_idx + 1 < max_needed &&
+               cache_filled_idx <= first_unstarted_idx) {
+          const int idx = ++cache_filled_idx;
+          if (idx == 0) {
+            cur_iters[idx] = node->Edges();
+          } else {
+            cur_iters[idx] = cur_iters[idx - 1];
+            ++cur_iters[idx];
+          }
+#ifdef LC0_CHILD_STATS
+          current_nstarted[idx] =
+              child_stats.n[idx] + child_stats.n_in_flight[idx];
+#else
+          current_nstarted[idx] = cur_iters[idx].GetNStarted();
+#endif
+          if (idx == first_unstarted_idx && current_nstarted[idx] > 0) {
+            ++first_unstarted_idx;
+          }
+        }
+        ComputePuctScores(current_pol.data(), current_nstarted.data(),
+                          current_util.data(), puct_mult, fill_start,
+                          cache_filled_idx + 1, current_score.data());
+
         // Perform UCT for current node.
         float best = std::numeric_limits<float>::lowest();
         int best_idx = -1;
@@ -1741,7 +2428,12 @@ void SearchWorker::PickNodesToExtendTask(
               cur_iters[idx] = cur_iters[idx - 1];
               ++cur_iters[idx];
             }
+#ifdef LC0_CHILD_STATS
+            current_nstarted[idx] =
+                child_stats.n[idx] + child_stats.n_in_flight[idx];
+#else
             current_nstarted[idx] = cur_iters[idx].GetNStarted();
+#endif
           }
           int nstarted = current_nstarted[idx];
           const float util = current_util[idx];
@@ -1829,10 +2521,25 @@ void SearchWorker::PickNodesToExtendTask(
           if (child_node->GetN() > 0 && !child_node->IsTerminal()) {
             child_node->IncrementNInFlight(new_visits);
             current_nstarted[best_idx] += new_visits;
+          } else if (divert_collisions && child_node->GetN() == 0) {
+            // The rest would only collide on the new leaf, pick again.
+            (*visits_to_perform.back())[best_idx] -= new_visits;
+            cur_limit += new_visits;
+            new_visits = 0;
           }
           current_score[best_idx] = current_pol[best_idx] * puct_mult /
                                         (1 + current_nstarted[best_idx]) +
                                     current_util[best_idx];
+        } else if (divert_collisions &&
+                   second_best > std::numeric_limits<float>::lowest()) {
+          // Another gather is evaluating this leaf. Take it out of this
+          // node's selection and pick again, which goes to the next best
+          // sibling. The score only changes when the edge is scored again,
+          // i.e. on the next visit to this node.
+          (*visits_to_perform.back())[best_idx] -= new_visits;
+          cur_limit += new_visits;
+          current_score[best_idx] = std::numeric_limits<float>::lowest();
+          continue;
         }
         if ((decremented &&
              (child_node->GetN() == 0 || child_node->IsTerminal()))) {
@@ -1853,6 +2560,16 @@ void SearchWorker::PickNodesToExtendTask(
         }
       }
       is_root_node = false;
+      // The walk below descends into every child with visits, start loading
+      // what it reads first for all of them. Children without visits are
+      // leaves or collisions, whose edges their own worker may be writing.
+      for (int i = 0; i <= vtp_last_filled.back(); i++) {
+        if ((*visits_to_perform.back())[i] == 0) continue;
+        const Node* child_node = cur_iters[i].node();
+        if (child_node && child_node->GetN() > 0) {
+          child_node->PrefetchChildren();
+        }
+      }
       // Actively do any splits now rather than waiting for potentially long
       // tree walk to get there.
       for (int i = 0; i <= vtp_last_filled.back(); i++) {
@@ -1868,24 +2585,21 @@ void SearchWorker::PickNodesToExtendTask(
           // Don't split if not expanded or terminal.
           if (child_node->GetN() == 0 || child_node->IsTerminal()) continue;
 
-          bool passed = false;
-          {
-            // Multiple writers, so need mutex here.
-            Mutex::Lock lock(picking_tasks_mutex_);
-            // Ensure not to exceed size of reservation.
-            if (picking_tasks_.size() < MAX_TASKS) {
-              moves_to_path.push_back(cur_iters[i].GetMove());
-              picking_tasks_.emplace_back(
-                  child_node, current_path.size() - 1 + base_depth + 1,
-                  moves_to_path, child_limit);
-              moves_to_path.pop_back();
-              task_count_.fetch_add(1, std::memory_order_acq_rel);
-              task_added_.notify_all();
-              passed = true;
-              passed_off += child_limit;
-            }
-          }
-          if (passed) {
+          // Slots are handed out atomically, no lock needed with multiple
+          // writers.
+          const int slot = NewTaskSlot();
+          if (slot >= 0) {
+            moves_to_path.push_back(cur_iters[i].GetMove());
+            picking_tasks_[slot].SetGathering(
+                child_node, current_path.size() - 1 + base_depth + 1,
+                moves_to_path, child_limit);
+            moves_to_path.pop_back();
+            // The visits stay with this walk if the queue is full.
+            if (!PublishTask(slot, workspace->task_queue)) continue;
+            // Idle task workers are also kept busy by WaitForTasks(), so a
+            // missed wakeup only costs some parallelism.
+            task_added_.notify_all();
+            passed_off += child_limit;
             (*visits_to_perform.back())[i] = 0;
           }
         }
@@ -1924,13 +2638,15 @@ void SearchWorker::PickNodesToExtendTask(
   }
 }
 
-void SearchWorker::ExtendNode(Node* node, int depth,
-                              const std::vector<Move>& moves_to_node,
-                              PositionHistory* history) {
+void SearchWorker::ExtendNode(
+    Node* node, int depth, const std::vector<Move>& moves_to_node,
+    PositionHistory* history, RepetitionTable* repetitions,
+    std::future<AsyncWdlProber::Result>* tb_probe) {
   // Initialize position sequence with pre-move position.
   history->Trim(search_->played_history_.GetLength());
+  repetitions->Trim(search_->played_history_.GetLength());
   for (size_t i = 0; i < moves_to_node.size(); i++) {
-    history->Append(moves_to_node[i]);
+    history->Append(moves_to_node[i], repetitions);
   }
 
   // We don't need the mutex because other threads will see that N=0 and
@@ -1980,39 +2696,23 @@ void SearchWorker::ExtendNode(Node* node, int depth,
     }
 
     // Neither by-position or by-rule termination, but maybe it's a TB position.
-    if (search_->syzygy_tb_ && !search_->root_is_in_dtz_ &&
-        board.castlings().no_legal_castle() &&
-        history->Last().GetRule50Ply() == 0 &&
+    if (search_->syzygy_tb_ && board.castlings().no_legal_castle() &&
         (board.ours() | board.theirs()).count() <=
             search_->syzygy_tb_->max_cardinality()) {
-      ProbeState state;
-      const WDLScore wdl =
-          search_->syzygy_tb_->probe_wdl(history->Last(), &state);
-      // Only fail state means the WDL is wrong, probe_wdl may produce correct
-      // result with a stat other than OK.
-      if (state != FAIL) {
-        // TB nodes don't have NN evaluation, assign M from parent node.
-        float m = 0.0f;
-        // Need a lock to access parent, in case MakeSolid is in progress.
-        {
-          SharedMutex::SharedLock lock(search_->nodes_mutex_);
-          auto parent = node->GetParent();
-          if (parent) {
-            m = std::max(0.0f, parent->GetM() - 1.0f);
+      if (!search_->root_is_in_dtz_ && history->Last().GetRule50Ply() == 0) {
+        if (search_->tb_prober_) {
+          *tb_probe = search_->tb_prober_->Probe(history->Last());
+        } else {
+          ProbeState state;
+          const WDLScore wdl =
+              search_->syzygy_tb_->probe_wdl(history->Last(), &state);
+          if (MakeTablebaseTerminal(node, wdl, state, &history->Last())) {
+            return;
           }
         }
-        // If the colors seem backwards, check the checkmate check above.
-        if (wdl == WDL_WIN) {
-          node->MakeTerminal(GameResult::BLACK_WON, m,
-                             Node::Terminal::Tablebase);
-        } else if (wdl == WDL_LOSS) {
-          node->MakeTerminal(GameResult::WHITE_WON, m,
-                             Node::Terminal::Tablebase);
-        } else {  // Cursed wins and blessed losses count as draws.
-          node->MakeTerminal(GameResult::DRAW, m, Node::Terminal::Tablebase);
-        }
-        search_->tb_hits_.fetch_add(1, std::memory_order_acq_rel);
-        return;
+      } else if (params_.GetSyzygyResolveLeaves() ||
+                 params_.GetSyzygyInTreeDtz()) {
+        if (ResolveTablebaseLeaf(node, history->Last())) return;
       }
     }
   }
@@ -2021,12 +2721,77 @@ void SearchWorker::ExtendNode(Node* node, int depth,
   node->CreateEdges(legal_moves);
 }
 
+bool SearchWorker::ResolveTablebaseLeaf(Node* node, const Position& pos) {
+  ProbeState state;
+  WDLScore wdl = search_->syzygy_tb_->probe_wdl(pos, &state);
+  if (state == FAIL) return false;
+  const int rule50 = pos.GetRule50Ply();
+  // WDL assumes the 50-move counter was just reset. Otherwise a win or loss
+  // only stands if DTZ says it's converted before the counter runs out.
+  if (rule50 != 0 && (wdl == WDL_WIN || wdl == WDL_LOSS)) {
+    const int dtz = std::abs(search_->syzygy_tb_->probe_dtz(pos, &state));
+    if (state == FAIL) return false;
+    // DTZ may be off by one, so results near the limit are left to the
+    // network. Same margins as the rescorer uses.
+    if (rule50 + dtz > 101) {
+      wdl = WDL_DRAW;
+    } else if (rule50 + dtz >= 99) {
+      return false;
+    }
+  }
+  return MakeTablebaseTerminal(node, wdl, state, &pos);
+}
+
+bool SearchWorker::MakeTablebaseTerminal(Node* node, WDLScore wdl,
+                                         ProbeState state,
+                                         const Position* pos) {
+  // Only fail state means the WDL is wrong, probe_wdl may produce correct
+  // result with a stat other than OK.
+  if (state == FAIL) return false;
+  // TB nodes don't have NN evaluation, assign M from DTZ when asked to, so
+  // that shorter wins and longer losses are preferred, or from parent node.
+  float m = -1.0f;
+  if (pos && params_.GetSyzygyInTreeDtz() &&
+      (wdl == WDL_WIN || wdl == WDL_LOSS)) {
+    ProbeState dtz_state;
+    const int dtz = search_->syzygy_tb_->probe_dtz(*pos, &dtz_state);
+    if (dtz_state != FAIL) m = std::abs(dtz);
+  }
+  if (m < 0.0f) {
+    m = 0.0f;
+    // Need a lock to access parent, in case MakeSolid is in progress.
+    SharedMutex::SharedLock lock(search_->nodes_mutex_);
+    auto parent = node->GetParent();
+    if (parent) {
+      m = std::max(0.0f, parent->GetM() - 1.0f);
+    }
+  }
+  // If the colors seem backwards, check the checkmate check in ExtendNode().
+  if (wdl == WDL_WIN) {
+    node->MakeTerminal(GameResult::BLACK_WON, m, Node::Terminal::Tablebase);
+  } else if (wdl == WDL_LOSS) {
+    node->MakeTerminal(GameResult::WHITE_WON, m, Node::Terminal::Tablebase);
+  } else {  // Cursed wins and blessed losses count as draws.
+    node->MakeTerminal(GameResult::DRAW, m, Node::Terminal::Tablebase);
+  }
+  search_->tb_hits_.fetch_add(1, std::memory_order_acq_rel);
+  gTbHitsMetric.Add();
+  return true;
+}
+
 // Returns whether node was already in cache.
 bool SearchWorker::AddNodeToComputation(Node* node) {
   const auto hash = history_.HashLast(params_.GetCacheHistoryLength() + 1);
-  if (search_->cache_->ContainsKey(hash)) {
-    return true;
-  }
+  const bool cached = search_->cache_->ContainsKey(hash) ||
+                      search_->cache_->LoadFromPersistent(hash);
+  if (record_cache_stats_) {
+    const int depth = std::min<int>(
+        history_.GetLength() - search_->played_history_.GetLength(),
+        Search::kMaxCacheStatsDepth);
+    auto& counts = cache_depth_stats_[depth];
+    ++(cached ? counts.prefetch_hits : counts.prefetch_misses);
+  }
+  if (cached) return true;
   int transform;
   auto planes =
       EncodePositionForNN(search_->network_->GetCapabilities().input_format,
@@ -2034,20 +2799,19 @@ bool SearchWorker::AddNodeToComputation(Node* node) {
 
   std::vector<uint16_t> moves;
 
-  if (node && node->HasChildren()) {
-    // Legal moves are known, use them.
+  // The cache keeps policy by legal move ordinal, so moves must be legal and
+  // in move generation order. Edges are, unless sorted or dropped already.
+  if (node && node->HasChildren() && node->GetN() == 0 &&
+      !node->HasDroppedEdges()) {
     moves.reserve(node->GetNumEdges());
     for (const auto& edge : node->Edges()) {
       moves.emplace_back(edge.GetMove().as_nn_index(transform));
     }
   } else {
-    // Cache pseudolegal moves. A bit of a waste, but faster.
-    const auto& pseudolegal_moves =
-        history_.Last().GetBoard().GeneratePseudolegalMoves();
-    moves.reserve(pseudolegal_moves.size());
-    for (auto iter = pseudolegal_moves.begin(), end = pseudolegal_moves.end();
-         iter != end; ++iter) {
-      moves.emplace_back(iter->as_nn_index(transform));
+    const auto legal_moves = history_.Last().GetBoard().GenerateLegalMoves();
+    moves.reserve(legal_moves.size());
+    for (const auto& move : legal_moves) {
+      moves.emplace_back(move.as_nn_index(transform));
     }
   }
 
@@ -2057,6 +2821,7 @@ bool SearchWorker::AddNodeToComputation(Node* node) {
 
 // 2b. Copy collisions into shared collisions.
 void SearchWorker::CollectCollisions() {
+  LC0_TRACE_SCOPE("collect collisions");
   SharedMutex::Lock lock(search_->nodes_mutex_);
 
   for (const NodeToProcess& node_to_process : minibatch_) {
@@ -2067,9 +2832,24 @@ void SearchWorker::CollectCollisions() {
   }
 }
 
+void SearchWorker::RecordCacheStats() {
+  for (const auto& node_to_process : minibatch_) {
+    auto& counts = cache_depth_stats_[std::min<int>(
+        node_to_process.depth, Search::kMaxCacheStatsDepth)];
+    if (node_to_process.IsCollision()) {
+      ++counts.collisions;
+    } else if (node_to_process.nn_queried) {
+      ++(node_to_process.is_cache_hit ? counts.hits : counts.misses);
+    }
+  }
+  search_->AddCacheDepthStats(cache_depth_stats_);
+  cache_depth_stats_ = {};
+}
+
 // 3. Prefetch into cache.
 // ~~~~~~~~~~~~~~~~~~~~~~~
 void SearchWorker::MaybePrefetchIntoCache() {
+  LC0_TRACE_SCOPE("prefetch");
   // TODO(mooskagh) Remove prefetch into cache if node collisions work well.
   // If there are requests to NN, but the batch is not full, try to prefetch
   // nodes which are likely useful in future.
@@ -2082,6 +2862,45 @@ void SearchWorker::MaybePrefetchIntoCache() {
         search_->root_node_,
         params_.GetMaxPrefetchBatch() - computation_->GetCacheMisses(), false);
   }
+  // Only use room in a batch which has to be computed anyway.
+  if (params_.GetSpeculativePrefetchWidth() > 0 &&
+      computation_->GetCacheMisses() > 0 &&
+      computation_->GetCacheMisses() < target_minibatch_size_) {
+    SpeculativePrefetch(target_minibatch_size_ -
+                        computation_->GetCacheMisses());
+  }
+  speculative_moves_.clear();
+  speculative_path_ends_.clear();
+}
+
+void SearchWorker::SpeculativePrefetch(int budget) {
+  // Positions already in this batch.
+  std::vector<uint64_t> batch_hashes;
+  for (const auto& node_to_process : minibatch_) {
+    if (node_to_process.nn_queried && !node_to_process.is_cache_hit) {
+      batch_hashes.push_back(node_to_process.hash);
+    }
+  }
+  std::sort(batch_hashes.begin(), batch_hashes.end());
+  size_t path_start = 0;
+  for (const size_t path_end : speculative_path_ends_) {
+    if (budget <= 0 || search_->stop_.load(std::memory_order_acquire)) break;
+    history_.Trim(search_->played_history_.GetLength());
+    for (size_t i = path_start; i < path_end; i++) {
+      history_.Append(speculative_moves_[i]);
+    }
+    path_start = path_end;
+    const auto hash = history_.HashLast(params_.GetCacheHistoryLength() + 1);
+    if (std::binary_search(batch_hashes.begin(), batch_hashes.end(), hash)) {
+      continue;
+    }
+    if (!AddNodeToComputation(nullptr)) {
+      batch_hashes.insert(
+          std::upper_bound(batch_hashes.begin(), batch_hashes.end(), hash),
+          hash);
+      --budget;
+    }
+  }
 }
 
 // Prefetches up to @budget nodes into cache. Returns number of nodes
@@ -2173,19 +2992,164 @@ int SearchWorker::PrefetchIntoCache(Node* node, int budget, bool is_odd_depth) {
   return total_budget_spent;
 }
 
+// 3b. Set computation priority.
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void SearchWorker::SetComputationPriority(int gathered_misses) {
+  auto priority = ComputationPriority::kNormal;
+  // Mostly prefetched positions, which nothing waits for yet.
+  if (computation_->GetCacheMisses() > 2 * gathered_misses) {
+    priority = ComputationPriority::kSpeculative;
+  }
+  // The search can't go anywhere before the root is evaluated.
+  for (const auto& node_to_process : minibatch_) {
+    if (node_to_process.nn_queried &&
+        node_to_process.node == search_->root_node_) {
+      priority = ComputationPriority::kCritical;
+      break;
+    }
+  }
+  // Nothing waits for a pondering search, whose batches only run when the
+  // searches on their own clock leave the backend idle.
+  if (search_->ponder_) priority = ComputationPriority::kBackground;
+  computation_->SetPriority(priority);
+}
+
 // 4. Run NN computation.
 // ~~~~~~~~~~~~~~~~~~~~~~
-void SearchWorker::RunNNComputation() { computation_->ComputeBlocking(); }
+void SearchWorker::RunNNComputation() {
+  LC0_TRACE_SCOPE("nn computation");
+  computation_->ComputeBlocking();
+}
+
+// 4b. Pipelined NN computation.
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+void SearchWorker::SubmitCurrentBatch() {
+  auto batch = std::make_unique<InFlightBatch>();
+  batch->minibatch = std::move(minibatch_);
+  batch->computation = std::move(computation_);
+  batch->number_out_of_order = number_out_of_order_;
+  {
+    Mutex::Lock lock(pipeline_mutex_);
+    compute_queue_.push_back(batch.get());
+    pipeline_cv_.notify_all();
+  }
+  pipeline_.push_back(std::move(batch));
+}
+
+void SearchWorker::RunComputations(int id) {
+  LC0_TRACE_THREAD_NAME("search compute");
+  search_->network_->InitThread(id);
+  Numa::BindThreadToCpus(cpus_);
+  try {
+    while (true) {
+      InFlightBatch* batch = nullptr;
+      {
+        Mutex::Lock lock(pipeline_mutex_);
+        while (compute_queue_.empty()) {
+          if (compute_exiting_) return;
+          pipeline_cv_.wait(lock.get_raw());
+        }
+        batch = compute_queue_.front();
+        compute_queue_.pop_front();
+      }
+      const auto compute_start = std::chrono::steady_clock::now();
+      {
+        LC0_TRACE_SCOPE("nn computation");
+        batch->computation->ComputeBlocking();
+      }
+      search_->backend_waiting_counter_.fetch_add(-1,
+                                                  std::memory_order_relaxed);
+      const float compute_ms = std::chrono::duration<float, std::milli>(
+                                   std::chrono::steady_clock::now() -
+                                   compute_start)
+                                   .count();
+      Mutex::Lock lock(pipeline_mutex_);
+      batch->compute_ms = compute_ms;
+      batch->computed = true;
+      pipeline_cv_.notify_all();
+    }
+  } catch (std::exception& e) {
+    std::cerr << "Unhandled exception in compute thread: " << e.what()
+              << std::endl;
+    abort();
+  }
+}
+
+void SearchWorker::RetireOldestBatch() {
+  std::unique_ptr<InFlightBatch> batch = std::move(pipeline_.front());
+  pipeline_.pop_front();
+  {
+    LC0_TRACE_SCOPE("wait nn computation");
+    Mutex::Lock lock(pipeline_mutex_);
+    while (!batch->computed) pipeline_cv_.wait(lock.get_raw());
+  }
+  minibatch_ = std::move(batch->minibatch);
+  computation_ = std::move(batch->computation);
+  number_out_of_order_ = batch->number_out_of_order;
+  if (minibatch_controller_) {
+    UpdateMinibatchSize(computation_->GetCacheMisses(), batch->compute_ms);
+  }
+
+  // 5. Retrieve NN computations (and terminal values) into nodes.
+  FetchMinibatchResults();
+
+  // 6. Propagate the new nodes' information to all their parents in the tree.
+  DoBackupUpdate();
+
+  // 7. Update the Search's status and progress information.
+  UpdateCounters();
+}
+
+void SearchWorker::UpdateMinibatchSize(int batch_size, float latency_ms) {
+  if (batch_size == 0) return;
+  minibatch_controller_->AddSample(batch_size, latency_ms);
+  const int64_t remaining_time_ms =
+      latest_time_manager_hints_.GetEstimatedRemainingTimeMs();
+  target_minibatch_size_ = minibatch_controller_->GetTargetSize(
+      remaining_time_ms < StoppersHints::kUnknownRemainingTimeMs
+          ? std::optional<int64_t>(remaining_time_ms)
+          : std::nullopt);
+  max_out_of_order_ =
+      std::max(1, static_cast<int>(params_.GetMaxOutOfOrderEvalsFactor() *
+                                   target_minibatch_size_));
+}
 
 // 5. Retrieve NN computations (and terminal values) into nodes.
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 void SearchWorker::FetchMinibatchResults() {
+  LC0_TRACE_SCOPE("fetch results");
   // Populate NN/cached results, or terminal results, into nodes.
   int idx_in_computation = 0;
   for (auto& node_to_process : minibatch_) {
     FetchSingleNodeResult(&node_to_process, *computation_, idx_in_computation);
     if (node_to_process.nn_queried) ++idx_in_computation;
   }
+  if (params_.GetSpeculativePrefetchWidth() > 0) {
+    CollectSpeculativeCandidates();
+  }
+}
+
+void SearchWorker::CollectSpeculativeCandidates() {
+  const int width = params_.GetSpeculativePrefetchWidth();
+  speculative_moves_.clear();
+  speculative_path_ends_.clear();
+  for (const auto& node_to_process : minibatch_) {
+    // Only fresh NN evaluations have their edges sorted by the new policy.
+    if (!node_to_process.nn_queried || node_to_process.is_cache_hit) continue;
+    if (static_cast<int>(speculative_path_ends_.size()) >=
+        target_minibatch_size_) {
+      break;
+    }
+    int taken = 0;
+    for (const auto& edge : node_to_process.node->Edges()) {
+      if (taken++ >= width) break;
+      speculative_moves_.insert(speculative_moves_.end(),
+                                node_to_process.moves_to_visit.begin(),
+                                node_to_process.moves_to_visit.end());
+      speculative_moves_.push_back(edge.GetMove());
+      speculative_path_ends_.push_back(speculative_moves_.size());
+    }
+  }
 }
 
 template <typename Computation>
@@ -2203,53 +3167,40 @@ void SearchWorker::FetchSingleNodeResult(NodeToProcess* node_to_process,
     return;
   }
   // For NN results, we need to populate policy as well as value.
-  // First the value...
-  auto v = -computation.GetQVal(idx_in_computation);
-  auto d = computation.GetDVal(idx_in_computation);
-  if (params_.GetWDLRescaleRatio() != 1.0f ||
-      (params_.GetWDLRescaleDiff() != 0.0f &&
-       search_->contempt_mode_ != ContemptMode::NONE)) {
-    // Check whether root moves are from the set perspective.
-    bool root_stm = (search_->contempt_mode_ == ContemptMode::BLACK) ==
-                    search_->played_history_.Last().IsBlackToMove();
-    auto sign = (root_stm ^ (node_to_process->depth & 1)) ? 1.0f : -1.0f;
-    WDLRescale(v, d, params_.GetWDLRescaleRatio(),
-               search_->contempt_mode_ == ContemptMode::NONE
-                   ? 0
-                   : params_.GetWDLRescaleDiff(),
-               sign, false, params_.GetWDLMaxS());
-  }
-  node_to_process->v = v;
-  node_to_process->d = d;
-  node_to_process->m = computation.GetMVal(idx_in_computation);
+  // First the value, unless it was already taken from a transposition...
+  if (!node_to_process->is_transposition) {
+    auto v = -computation.GetQVal(idx_in_computation);
+    auto d = computation.GetDVal(idx_in_computation);
+    if (params_.GetWDLRescaleRatio() != 1.0f ||
+        (params_.GetWDLRescaleDiff() != 0.0f &&
+         search_->contempt_mode_ != ContemptMode::NONE)) {
+      // Check whether root moves are from the set perspective.
+      bool root_stm = (search_->contempt_mode_ == ContemptMode::BLACK) ==
+                      search_->played_history_.Last().IsBlackToMove();
+      auto sign = (root_stm ^ (node_to_process->depth & 1)) ? 1.0f : -1.0f;
+      WDLRescale(v, d, params_.GetWDLRescaleRatio(),
+                 search_->contempt_mode_ == ContemptMode::NONE
+                     ? 0
+                     : params_.GetWDLRescaleDiff(),
+                 sign, false, params_.GetWDLMaxS());
+    }
+    node_to_process->v = v;
+    node_to_process->d = d;
+    node_to_process->m = computation.GetMVal(idx_in_computation);
+  }
   // ...and secondly, the policy data.
-  // Calculate maximum first.
-  float max_p = -std::numeric_limits<float>::infinity();
-  // Intermediate array to store values when processing policy.
   // There are never more than 256 valid legal moves in any legal position.
   std::array<float, 256> intermediate;
+  // Edges of a new node are in move generation order, as cached policies are.
+  const int num_edges = node->GetNumEdges();
+  for (int i = 0; i < num_edges; i++) {
+    intermediate[i] = computation.GetPVal(idx_in_computation, i);
+  }
+  PolicySoftmax(num_edges, intermediate.data(),
+                params_.GetPolicySoftmaxTemp(), intermediate.data());
   int counter = 0;
   for (auto& edge : node->Edges()) {
-    float p = computation.GetPVal(
-        idx_in_computation,
-        edge.GetMove().as_nn_index(node_to_process->probability_transform));
-    intermediate[counter++] = p;
-    max_p = std::max(max_p, p);
-  }
-  float total = 0.0;
-  for (int i = 0; i < counter; i++) {
-    // Perform softmax and take into account policy softmax temperature T.
-    // Note that we want to calculate (exp(p-max_p))^(1/T) = exp((p-max_p)/T).
-    float p =
-        FastExp((intermediate[i] - max_p) / params_.GetPolicySoftmaxTemp());
-    intermediate[i] = p;
-    total += p;
-  }
-  counter = 0;
-  // Normalize P values to add up to 1.0.
-  const float scale = total > 0.0f ? 1.0f / total : 1.0f;
-  for (auto& edge : node->Edges()) {
-    edge.edge()->SetP(intermediate[counter++] * scale);
+    edge.edge()->SetP(intermediate[counter++]);
   }
   // Add Dirichlet noise if enabled and at root.
   if (params_.GetNoiseEpsilon() && node == search_->root_node_) {
@@ -2257,24 +3208,488 @@ void SearchWorker::FetchSingleNodeResult(NodeToProcess* node_to_process,
                         params_.GetNoiseAlpha());
   }
   node->SortEdges();
+  if (params_.GetEdgesKept() > 0 && node != search_->root_node_) {
+    node->DropEdges(params_.GetEdgesKept());
+  }
+  // A tablebase result, when there is one, replaces the network's value.
+  if (node_to_process->tb_probe.valid()) {
+    const auto probe = node_to_process->tb_probe.get();
+    if (MakeTablebaseTerminal(node, probe.wdl, probe.state)) {
+      node_to_process->v = node->GetWL();
+      node_to_process->d = node->GetD();
+      node_to_process->m = node->GetM();
+    }
+  }
 }
 
 // 6. Propagate the new nodes' information to all their parents in the tree.
 // ~~~~~~~~~~~~~~
 void SearchWorker::DoBackupUpdate() {
+  LC0_TRACE_SCOPE("backup");
+  if (params_.GetConcurrentBackup()) {
+    DoConcurrentBackupUpdate();
+    return;
+  }
   // Nodes mutex for doing node updates.
   SharedMutex::Lock lock(search_->nodes_mutex_);
 
   bool work_done = number_out_of_order_ > 0;
+  if (params_.GetBatchedBackup()) {
+    for (const NodeToProcess& node_to_process : minibatch_) {
+      if (!node_to_process.IsCollision()) work_done = true;
+    }
+    DoBatchedBackupUpdate();
+  } else {
+    for (const NodeToProcess& node_to_process : minibatch_) {
+      DoBackupUpdateSingleNode(node_to_process);
+      if (!node_to_process.IsCollision()) {
+        work_done = true;
+      }
+    }
+  }
+  if (!work_done) return;
+  search_->CancelSharedCollisions();
+  if (++search_->total_batches_ == 1 && search_->phase_timer_) {
+    search_->phase_timer_->Mark("first batch");
+  }
+}
+
+void SearchWorker::DoBatchedBackupUpdate() REQUIRES(search_->nodes_mutex_) {
+  Node* const root = search_->root_node_;
+  int64_t playouts = 0;
   for (const NodeToProcess& node_to_process : minibatch_) {
-    DoBackupUpdateSingleNode(node_to_process);
-    if (!node_to_process.IsCollision()) {
+    if (node_to_process.IsCollision()) continue;
+    Node* node = node_to_process.node;
+    // The first visit to a terminal may set bounds on its ancestors, which
+    // has to go one node at a time.
+    if (params_.GetStickyEndgames() && node->IsTerminal() && !node->GetN()) {
+      // That backup may make the ancestors solid, moving the nodes still on
+      // the stack, so those have to be updated first.
+      while (!backup_stack_.empty()) PopBackupStack();
+      DoBackupUpdateSingleNode(node_to_process);
+      continue;
+    }
+    // Minibatches are mostly gathered depth first, so consecutive nodes share
+    // most of their paths. Visits stay on the stack for as long as the nodes
+    // that follow are below them.
+    backup_path_.clear();
+    for (Node* n = node;; n = n->GetParent()) {
+      backup_path_.push_back(n);
+      if (n == root) break;
+    }
+    size_t common = 0;
+    while (common < backup_stack_.size() && common < backup_path_.size() &&
+           backup_stack_[common].node ==
+               backup_path_[backup_path_.size() - 1 - common]) {
+      common++;
+    }
+    while (backup_stack_.size() > common) PopBackupStack();
+    for (size_t i = backup_path_.size() - common; i-- > 0;) {
+      backup_stack_.push_back({backup_path_[i]});
+    }
+    BackupSums& sums = backup_stack_.back();
+    const int multivisit = node_to_process.multivisit;
+    sums.v += double{node_to_process.v} * multivisit;
+    sums.d += double{node_to_process.d} * multivisit;
+    sums.m += double{node_to_process.m} * multivisit;
+    sums.visits += multivisit;
+
+    playouts += multivisit;
+    search_->cum_depth_ += node_to_process.depth * multivisit;
+    search_->max_depth_ = std::max(search_->max_depth_, node_to_process.depth);
+  }
+  while (!backup_stack_.empty()) PopBackupStack();
+
+  if (playouts > 0) {
+    search_->current_best_edge_ = search_->GetBestChildNoTemperature(root, 0);
+  }
+  search_->total_playouts_ += playouts;
+  iteration_playouts_ += playouts;
+  gNodesMetric.Add(playouts);
+}
+
+void SearchWorker::PopBackupStack() REQUIRES(search_->nodes_mutex_) {
+  BackupSums sums = backup_stack_.back();
+  backup_stack_.pop_back();
+  Node* n = sums.node;
+  // A terminal backs up its own value rather than the ones from below.
+  if (n->IsTerminal()) {
+    sums.v = double{n->GetWL()} * sums.visits;
+    sums.d = double{n->GetD()} * sums.visits;
+    sums.m = double{n->GetM()} * sums.visits;
+  }
+  n->FinalizeScoreUpdate(sums.v / sums.visits, sums.d / sums.visits,
+                         sums.m / sums.visits, sums.visits);
+  if (n->GetParent() == search_->root_node_) search_->UpdateRootChild(n);
+  // All the nodes below with visits were backed up, so they may move.
+  if (n->GetN() >= static_cast<uint32_t>(params_.GetSolidTreeThreshold())) {
+    search_->MakeSolid(n);
+  }
+  if (backup_stack_.empty()) return;
+  // Q is flipped for the opponent, and M is a move further from the end.
+  BackupSums& parent = backup_stack_.back();
+  parent.v -= sums.v;
+  parent.d += sums.d;
+  parent.m += sums.m + sums.visits;
+  parent.visits += sums.visits;
+}
+
+void SearchWorker::DoConcurrentBackupUpdate() {
+  bool work_done = number_out_of_order_ > 0;
+  std::vector<const NodeToProcess*> exclusive_updates;
+  std::vector<std::pair<uint16_t, Node*>> solid_candidates;
+  // Root children are re-ranked under the exclusive lock, by index as the root
+  // may be made solid before that.
+  std::vector<uint16_t> root_children;
+  int64_t playouts = 0;
+  uint64_t cum_depth = 0;
+  uint16_t max_depth = 0;
+  {
+    SharedMutex::SharedLock lock(search_->nodes_mutex_);
+    for (const NodeToProcess& node_to_process : minibatch_) {
+      if (node_to_process.IsCollision()) continue;
       work_done = true;
+      if (!DoConcurrentBackupUpdateSingleNode(
+              node_to_process, &solid_candidates, &root_children)) {
+        exclusive_updates.push_back(&node_to_process);
+        continue;
+      }
+      playouts += node_to_process.multivisit;
+      cum_depth += node_to_process.depth * node_to_process.multivisit;
+      max_depth = std::max(max_depth, node_to_process.depth);
+    }
+    // Has to be queued before releasing the lock, see solid_candidates_.
+    if (!solid_candidates.empty()) {
+      SpinMutex::Lock candidates_lock(search_->solid_candidates_mutex_);
+      search_->solid_candidates_.insert(search_->solid_candidates_.end(),
+                                        solid_candidates.begin(),
+                                        solid_candidates.end());
     }
   }
   if (!work_done) return;
+
+  SharedMutex::Lock lock(search_->nodes_mutex_);
+  search_->MakePendingSolid();
+  for (const NodeToProcess* node_to_process : exclusive_updates) {
+    DoBackupUpdateSingleNode(*node_to_process);
+  }
+  search_->total_playouts_ += playouts;
+  iteration_playouts_ += playouts;
+  gNodesMetric.Add(playouts);
+  search_->cum_depth_ += cum_depth;
+  search_->max_depth_ = std::max(search_->max_depth_, max_depth);
+  search_->UpdateRootChildren(&root_children);
+  // Concurrent updates don't track the best root child as they go.
+  if (playouts > 0) {
+    search_->current_best_edge_ =
+        search_->GetBestChildNoTemperature(search_->root_node_, 0);
+  }
   search_->CancelSharedCollisions();
-  search_->total_batches_ += 1;
+  if (++search_->total_batches_ == 1 && search_->phase_timer_) {
+    search_->phase_timer_->Mark("first batch");
+  }
+}
+
+bool SearchWorker::DoConcurrentBackupUpdateSingleNode(
+    const NodeToProcess& node_to_process,
+    std::vector<std::pair<uint16_t, Node*>>* solid_candidates,
+    std::vector<uint16_t>* root_children) {
+  Node* node = node_to_process.node;
+  // Setting bounds reads and writes siblings, which needs the exclusive lock.
+  if (params_.GetStickyEndgames() && node->IsTerminal() && !node->GetN()) {
+    return false;
+  }
+
+  float v = node_to_process.v;
+  float d = node_to_process.d;
+  float m = node_to_process.m;
+  uint16_t depth = node_to_process.depth;
+  const uint32_t solid_threshold =
+      static_cast<uint32_t>(params_.GetSolidTreeThreshold());
+  for (Node* n = node; n != search_->root_node_->GetParent();
+       n = n->GetParent()) {
+    // Terminal status only changes under the exclusive lock, so it's safe to
+    // check without the stats lock.
+    if (n->IsTerminal()) {
+      v = n->GetWL();
+      d = n->GetD();
+      m = n->GetM();
+    }
+    uint32_t new_n;
+    {
+      SpinMutex::Lock stats_lock(search_->GetNodeStatsLock(n));
+      n->FinalizeScoreUpdate(v, d, m, node_to_process.multivisit);
+      new_n = n->GetN();
+    }
+    if (new_n >= solid_threshold && !n->HasSolidChildren() &&
+        !n->IsTerminal()) {
+      solid_candidates->emplace_back(depth, n);
+    }
+    if (n->GetParent() == search_->root_node_) {
+      root_children->push_back(n->Index());
+    }
+    v = -v;
+    m++;
+    depth--;
+  }
+  return true;
+}
+
+void Search::MakePendingSolid() REQUIRES(nodes_mutex_) {
+  std::vector<std::pair<uint16_t, Node*>> candidates;
+  {
+    SpinMutex::Lock lock(solid_candidates_mutex_);
+    if (solid_candidates_.empty()) return;
+    candidates.swap(solid_candidates_);
+  }
+  // Children have to be made solid before their parents move them.
+  std::sort(candidates.begin(), candidates.end(),
+            std::greater<std::pair<uint16_t, Node*>>());
+  candidates.erase(std::unique(candidates.begin(), candidates.end()),
+                   candidates.end());
+  for (const auto& [depth, node] : candidates) {
+    if (MakeSolid(node) && node == root_node_) {
+      current_best_edge_ = GetBestChildNoTemperature(root_node_, 0);
+    }
+  }
+}
+
+void Search::RestoreDroppedEdges(Node* node, const PositionHistory& history)
+    REQUIRES(nodes_mutex_) {
+  const auto legal_moves = history.Last().GetBoard().GenerateLegalMoves();
+  FixedMoveList dropped;
+  // Legal move ordinals of the dropped moves, which index cached policy.
+  std::vector<int> dropped_ordinals;
+  for (size_t i = 0; i < legal_moves.size(); i++) {
+    bool kept = false;
+    for (const auto& edge : node->Edges()) {
+      if (edge.GetMove() == legal_moves[i]) {
+        kept = true;
+        break;
+      }
+    }
+    if (kept) continue;
+    dropped.push_back(legal_moves[i]);
+    dropped_ordinals.push_back(i);
+  }
+  // Without the NN eval, all dropped moves get an even share of their policy.
+  std::vector<float> priors(
+      dropped.size(),
+      dropped.empty() ? 0.0f : node->GetDroppedPolicy() / dropped.size());
+  NNCacheLock lock(cache_,
+                   history.HashLast(params_.GetCacheHistoryLength() + 1));
+  if (lock && lock->GetNumMoves() == static_cast<int>(legal_moves.size())) {
+    // Same softmax as in FetchSingleNodeResult(), over all legal moves.
+    std::array<float, 256> policy;
+    for (size_t i = 0; i < legal_moves.size(); i++) policy[i] = lock->GetP(i);
+    PolicySoftmax(legal_moves.size(), policy.data(),
+                  params_.GetPolicySoftmaxTemp(), policy.data());
+    for (size_t i = 0; i < dropped.size(); i++) {
+      priors[i] = policy[dropped_ordinals[i]];
+    }
+  }
+  node->RestoreDroppedEdges(dropped, priors.data());
+}
+
+void Search::AddNoiseToReusedRoot() REQUIRES(nodes_mutex_) {
+  // The priors may hold noise of an earlier search of this root, so they
+  // start over from the NN eval if it's still cached.
+  NNCacheLock lock(cache_, played_history_.HashLast(
+                               params_.GetCacheHistoryLength() + 1));
+  const auto legal_moves =
+      played_history_.Last().GetBoard().GenerateLegalMoves();
+  if (lock && lock->GetNumMoves() == static_cast<int>(legal_moves.size())) {
+    std::array<float, 256> policy;
+    for (size_t i = 0; i < legal_moves.size(); i++) policy[i] = lock->GetP(i);
+    PolicySoftmax(legal_moves.size(), policy.data(),
+                  params_.GetPolicySoftmaxTemp(), policy.data());
+    for (auto& edge : root_node_->Edges()) {
+      for (size_t i = 0; i < legal_moves.size(); i++) {
+        if (edge.GetMove() == legal_moves[i]) {
+          edge.edge()->SetP(policy[i]);
+          break;
+        }
+      }
+    }
+  }
+  ApplyDirichletNoise(root_node_, params_.GetNoiseEpsilon(),
+                      params_.GetNoiseAlpha());
+  // Children are picked in the order of the edges while unvisited.
+  root_node_->SortEdges();
+}
+
+void Search::MakeReusedTreeSolid() REQUIRES(nodes_mutex_) {
+  // Only nodes above the threshold can have descendants above it, so the walk
+  // stays within the small top part of the tree.
+  const uint32_t solid_threshold =
+      static_cast<uint32_t>(params_.GetSolidTreeThreshold());
+  if (root_node_->GetN() < solid_threshold) return;
+  std::vector<Node*> to_visit = {root_node_};
+  while (!to_visit.empty()) {
+    Node* node = to_visit.back();
+    to_visit.pop_back();
+    MakeSolid(node);
+    for (Node* child : node->VisitedNodes()) {
+      if (child->GetN() >= solid_threshold) to_visit.push_back(child);
+    }
+  }
+}
+
+bool Search::MakeSolid(Node* node) REQUIRES(nodes_mutex_) {
+  if (params_.GetTranspositionVisits() == 0) return node->MakeSolid();
+  std::vector<const Node*> old_children;
+  old_children.reserve(node->GetNumEdges());
+  for (auto& edge : node->Edges()) old_children.push_back(edge.node());
+  if (!node->MakeSolid()) return false;
+  Mutex::Lock lock(transpositions_mutex_);
+  int idx = 0;
+  for (auto& edge : node->Edges()) {
+    const Node* old_child = old_children[idx++];
+    if (!old_child) continue;
+    auto iter = transposition_keys_.find(old_child);
+    if (iter == transposition_keys_.end()) continue;
+    const uint64_t hash = iter->second;
+    transposition_keys_.erase(iter);
+    transpositions_[hash] = edge.node();
+    transposition_keys_[edge.node()] = hash;
+  }
+  return true;
+}
+
+void Search::PruneTree(int64_t limit) REQUIRES(nodes_mutex_) {
+  // Fraction of the limit freed on top of the excess, so that pruning doesn't
+  // happen after every batch.
+  constexpr float kPruneHeadroom = 0.1f;
+  // Queued nodes may be in the subtrees about to be freed.
+  MakePendingSolid();
+
+  // Nodes with children, parents before their children, and the number of
+  // nodes in their subtrees.
+  struct Subtree {
+    Node* node;
+    size_t parent;
+    int64_t size;
+    bool prunable;
+  };
+  std::vector<Subtree> subtrees{{root_node_, 0, 1, false}};
+  for (size_t i = 0; i < subtrees.size(); i++) {
+    for (auto& edge : subtrees[i].node->Edges()) {
+      if (!edge.HasNode()) continue;
+      if (edge.node()->HasChildNodes()) {
+        subtrees.push_back({edge.node(), i, 1, false});
+      } else {
+        subtrees[i].size++;
+      }
+    }
+  }
+  for (size_t i = subtrees.size(); i-- > 1;) {
+    subtrees[subtrees[i].parent].size += subtrees[i].size;
+  }
+  const int64_t tree_nodes = subtrees[0].size;
+  const int64_t to_free = tree_nodes - limit + limit * kPruneHeadroom;
+
+  // Pruning every node with fewer than T visits whose parent has at least T
+  // frees disjoint subtrees. Visits in flight pass through all the ancestors
+  // of a node, so only nodes without them are safe to prune. Find the lowest
+  // T which frees enough.
+  std::vector<std::pair<uint32_t, int64_t>> events;
+  for (size_t i = 1; i < subtrees.size(); i++) {
+    const Node* node = subtrees[i].node;
+    const uint32_t parent_n = subtrees[subtrees[i].parent].node->GetN();
+    subtrees[i].prunable =
+        node->GetNInFlight() == 0 && !node->IsTerminal() &&
+        node->GetN() < parent_n &&
+        node->GetBounds() ==
+            Node::Bounds{GameResult::BLACK_WON, GameResult::WHITE_WON};
+    if (!subtrees[i].prunable) continue;
+    events.emplace_back(node->GetN() + 1, subtrees[i].size - 1);
+    events.emplace_back(parent_n + 1, 1 - subtrees[i].size);
+  }
+  std::sort(events.begin(), events.end());
+  uint32_t threshold = 0;
+  int64_t freed = 0;
+  int64_t best_freed = 0;
+  for (size_t i = 0; i < events.size() && best_freed < to_free;) {
+    const uint32_t t = events[i].first;
+    for (; i < events.size() && events[i].first == t; i++) {
+      freed += events[i].second;
+    }
+    if (freed > best_freed) {
+      best_freed = freed;
+      threshold = t;
+    }
+  }
+  // From now on, each new visit is counted as one more node of the tree.
+  pruned_visits_ =
+      total_playouts_ + initial_visits_ - (tree_nodes - best_freed);
+  if (to_free <= 0 || best_freed == 0) return;
+
+  const bool transpositions = params_.GetTranspositionVisits() > 0;
+  Mutex::Lock lock(transpositions_mutex_);
+  int pruned = 0;
+  std::vector<Node*> to_visit;
+  for (size_t i = 1; i < subtrees.size(); i++) {
+    Node* node = subtrees[i].node;
+    if (!subtrees[i].prunable || node->GetN() >= threshold ||
+        subtrees[subtrees[i].parent].node->GetN() < threshold) {
+      continue;
+    }
+    if (transpositions) {
+      to_visit.assign(1, node);
+      while (!to_visit.empty()) {
+        Node* cur = to_visit.back();
+        to_visit.pop_back();
+        for (auto& edge : cur->Edges()) {
+          if (!edge.HasNode()) continue;
+          to_visit.push_back(edge.node());
+          auto iter = transposition_keys_.find(edge.node());
+          if (iter == transposition_keys_.end()) continue;
+          transpositions_.erase(iter->second);
+          transposition_keys_.erase(iter);
+        }
+      }
+    }
+    node->ReleaseChildren();
+    pruned++;
+  }
+  LOGFILE << "Pruned " << pruned << " subtrees below " << threshold
+          << " visits, freeing " << best_freed << " of " << tree_nodes
+          << " nodes.";
+}
+
+void Search::AddTransposition(uint64_t hash, Node* node) {
+  Mutex::Lock lock(transpositions_mutex_);
+  if (transpositions_.emplace(hash, node).second) {
+    transposition_keys_[node] = hash;
+  }
+}
+
+bool Search::GetTranspositionValue(uint64_t hash, const Node* node, float* wl,
+                                   float* d, float* m) {
+  // Keeps the transposed node in place while its value is read.
+  SharedMutex::SharedLock nodes_lock(nodes_mutex_);
+  const Node* source;
+  {
+    Mutex::Lock lock(transpositions_mutex_);
+    auto iter = transpositions_.find(hash);
+    if (iter == transpositions_.end() || iter->second == node) return false;
+    source = iter->second;
+  }
+  auto read_value = [&]() {
+    if (source->GetN() <
+        static_cast<uint32_t>(params_.GetTranspositionVisits())) {
+      return false;
+    }
+    *wl = source->GetWL();
+    *d = source->GetD();
+    *m = source->GetM();
+    return true;
+  };
+  if (params_.GetConcurrentBackup()) {
+    SpinMutex::Lock stats_lock(GetNodeStatsLock(source));
+    return read_value();
+  }
+  return read_value();
 }
 
 void SearchWorker::DoBackupUpdateSingleNode(
@@ -2284,6 +3699,8 @@ void SearchWorker::DoBackupUpdateSingleNode(
     // Collisions are handled via shared_collisions instead.
     return;
   }
+  // Queued nodes must be made solid before any of their ancestors.
+  if (params_.GetConcurrentBackup()) search_->MakePendingSolid();
 
   // For the first visit to a terminal, maybe update parent bounds too.
   auto update_parent_bounds =
@@ -2314,7 +3731,7 @@ void SearchWorker::DoBackupUpdateSingleNode(
       n->AdjustForTerminal(v_delta, d_delta, m_delta, n_to_fix);
     }
     if (n->GetN() >= solid_threshold) {
-      if (n->MakeSolid() && n == search_->root_node_) {
+      if (search_->MakeSolid(n) && n == search_->root_node_) {
         // If we make the root solid, the current_best_edge_ becomes invalid and
         // we should repopulate it.
         search_->current_best_edge_ =
@@ -2346,6 +3763,7 @@ void SearchWorker::DoBackupUpdateSingleNode(
     // best edge. Otherwise a visit can only change best edge if its to an edge
     // that isn't already the best and the new n is equal or greater to the old
     // n.
+    if (p == search_->root_node_) search_->UpdateRootChild(n);
     if (p == search_->root_node_ &&
         ((old_update_parent_bounds && n->IsTerminal()) ||
          (n != search_->current_best_edge_.node() &&
@@ -2355,6 +3773,8 @@ void SearchWorker::DoBackupUpdateSingleNode(
     }
   }
   search_->total_playouts_ += node_to_process.multivisit;
+  iteration_playouts_ += node_to_process.multivisit;
+  gNodesMetric.Add(node_to_process.multivisit);
   search_->cum_depth_ += node_to_process.depth * node_to_process.multivisit;
   search_->max_depth_ = std::max(search_->max_depth_, node_to_process.depth);
 }
@@ -2431,7 +3851,10 @@ bool SearchWorker::MaybeSetBounds(Node* p, float m, int* n_to_fix,
 // 7. Update the Search's status and progress information.
 //~~~~~~~~~~~~~~~~~~~~
 void SearchWorker::UpdateCounters() {
+  LC0_TRACE_SCOPE("update counters");
   search_->PopulateCommonIterationStats(&iteration_stats_);
+  iteration_stats_.target_minibatch_size = target_minibatch_size_;
+  iteration_stats_.collision_limit = last_collision_limit_;
   search_->MaybeTriggerStop(iteration_stats_, &latest_time_manager_hints_);
   search_->MaybeOutputInfo();
 
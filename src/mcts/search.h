@@ -29,21 +29,35 @@
 
 #include <array>
 #include <condition_variable>
+#include <deque>
 #include <functional>
 #include <optional>
 #include <shared_mutex>
 #include <thread>
+#include <unordered_map>
 
 #include "chess/callbacks.h"
 #include "chess/uciloop.h"
+#include "mcts/batchsize.h"
 #include "mcts/node.h"
 #include "mcts/params.h"
+#include "mcts/root_candidates.h"
+#include "mcts/root_stability.h"
 #include "mcts/stoppers/timemgr.h"
 #include "neural/cache.h"
+#include "neural/encoder.h"
 #include "neural/network.h"
+#include "syzygy/async_prober.h"
 #include "syzygy/syzygy.h"
 #include "utils/logging.h"
 #include "utils/mutex.h"
+#include "utils/numa.h"
+#include "utils/phasetimer.h"
+#include "utils/spinhelper.h"
+#include "utils/threadpool.h"
+#include "utils/token_bucket.h"
+#include "utils/tracing.h"
+#include "utils/wsdeque.h"
 
 namespace lczero {
 
@@ -55,7 +69,7 @@ class Search {
          std::chrono::steady_clock::time_point start_time,
          std::unique_ptr<SearchStopper> stopper, bool infinite, bool ponder,
          const OptionsDict& options, NNCache* cache,
-         SyzygyTablebase* syzygy_tb);
+         SyzygyTablebase* syzygy_tb, ThreadPool* thread_pool = nullptr);
 
   ~Search();
 
@@ -65,6 +79,18 @@ class Search {
   // Starts search with k threads and wait until it finishes.
   void RunBlocking(size_t threads);
 
+  // Like RunBlocking(), for searches nobody watches (e.g. selfplay): the
+  // calling thread is the first search thread, the stoppers are only checked
+  // by the search threads after every iteration (no watchdog thread), and no
+  // thinking info nor move stats are produced.
+  void RunBlockingLean(size_t threads);
+
+  // When there is nothing to search (only one possible move, a tablebase win
+  // with SyzygyFastPlay or a mate proven in the reused tree), responds with
+  // the bestmove right away and returns true, and then no threads need to be
+  // started. Does nothing for searches which may not respond on their own.
+  bool TryInstantMove();
+
   // Stops search. At the end bestmove will be returned. The function is not
   // blocking, so it returns before search is actually done.
   void Stop();
@@ -88,6 +114,8 @@ class Search {
   Eval GetBestEval(Move* move = nullptr, bool* is_terminal = nullptr) const;
   // Returns the total number of playouts in the search.
   std::int64_t GetTotalPlayouts() const;
+  // Returns the number of minibatches the playouts were gathered in.
+  std::int64_t GetTotalBatches() const;
   // Returns the search parameters.
   const SearchParams& GetParams() const { return params_; }
 
@@ -95,9 +123,49 @@ class Search {
   // from temperature having been applied again.
   void ResetBestMove();
 
+  // Root-parallel search: @helpers search the same root, each in its own tree.
+  // Their root visits are merged into the choice of the best move and into the
+  // info output of this search, and they are aborted once it sent the
+  // bestmove. Must be called before StartThreads().
+  void SetRootParallelHelpers(std::vector<Search*> helpers) {
+    helpers_ = std::move(helpers);
+  }
+
+  // Marks the phases of the search in @phases, and reports them with the
+  // bestmove. Must be called before StartThreads().
+  void SetPhaseTimer(std::shared_ptr<PhaseTimer> phases) {
+    phase_timer_ = std::move(phases);
+  }
+
+  struct RootMoveStats {
+    Move move;
+    uint32_t n;
+    // Value from the point of view of the side to move at the root.
+    float wl;
+    float d;
+  };
+  // Returns the stats of the visited children of the root.
+  std::vector<RootMoveStats> GetRootMoveStats() const;
+
   // Returns NN eval for a given node from cache, if that node is cached.
   NNCacheLock GetCachedNNEval(const Node* node) const;
 
+  // How the nodes at one depth of a search got their NN evaluation.
+  struct CacheDepthCounts {
+    // Nodes picked for the NN found in the cache, and sent to the network.
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    // The same for positions speculatively prefetched into the cache.
+    uint64_t prefetch_hits = 0;
+    uint64_t prefetch_misses = 0;
+    // Picks which hit a node already being evaluated.
+    uint64_t collisions = 0;
+  };
+  // Deeper nodes are counted at this depth.
+  static constexpr int kMaxCacheStatsDepth = 32;
+  using CacheDepthStats =
+      std::array<CacheDepthCounts, kMaxCacheStatsDepth + 1>;
+
  private:
   // Computes the best move, maybe with temperature (according to the settings).
   void EnsureBestMoveKnown();
@@ -109,16 +177,51 @@ class Search {
   std::vector<EdgeAndNode> GetBestChildrenNoTemperature(Node* parent, int count,
                                                         int depth) const;
   EdgeAndNode GetBestRootChildWithTemperature(float temperature) const;
+  // Returns @count children of the root, in the order of
+  // GetBestChildrenNoTemperature() but with the non-terminal children ordered
+  // by the visits summed over this search and its root-parallel helpers.
+  std::vector<EdgeAndNode> GetBestRootChildren(int count) const;
+  // Whether root_candidates_ and root_stability_ track all the children of
+  // the root.
+  bool AreRootChildrenTracked() const;
+  // Returns the @count best children of the root, from root_candidates_.
+  std::vector<EdgeAndNode> GetRootCandidates(int count) const;
+  // Returns the stats of the root children for root_stability_.
+  std::vector<RootStabilityTracker::Child> GetRootChildStats() const;
+  // Tracks the children of the root from scratch.
+  void ResetRootChildren();
+  // Updates the tracking of @child of the root after a backup through it.
+  void UpdateRootChild(Node* child);
+  // Updates the tracking of the children of the root with edge @indices, in
+  // one pass over the children.
+  void UpdateRootChildren(std::vector<uint16_t>* indices);
 
   int64_t GetTimeSinceStart() const;
   int64_t GetTimeSinceFirstBatch() const;
   void MaybeTriggerStop(const IterationStats& stats, StoppersHints* hints);
+  // Whether anything important changed since the last info sent.
+  bool IsInfoDue() const;
   void MaybeOutputInfo();
+  // Builds the info of the PVs and records it as the last sent.
+  std::vector<ThinkingInfo> GetUciInfo();
   void SendUciInfo();  // Requires nodes_mutex_ to be held.
   // Sets stop to true and notifies watchdog thread.
   void FireStopInternal();
 
   void SendMovesStats() const;
+  // Sends an info string with the memory taken by the trees and the NN cache.
+  void SendMemoryUsage() const;
+  // Sends an info string with the NN cache eviction policy and its hit rate
+  // during this search.
+  void SendCacheUsage() const;
+  // Marks the bestmove phase and sends an info string with the time of each
+  // phase of the move, if they are tracked.
+  void SendPhaseTimes();
+  // Sends an info string per depth with the NN cache hits and misses of this
+  // search there.
+  void SendCacheDepthStats() const;
+  // Adds the counts of a search worker.
+  void AddCacheDepthStats(const CacheDepthStats& stats);
   // Function which runs in a separate thread and watches for time and
   // uci `stop` command;
   void WatchdogThread();
@@ -140,7 +243,42 @@ class Search {
   // Ensure that all shared collisions are cancelled and clear them out.
   void CancelSharedCollisions();
 
-  mutable Mutex counters_mutex_ ACQUIRED_AFTER(nodes_mutex_);
+  // Returns the lock protecting @node's statistics during concurrent backups.
+  SpinMutex& GetNodeStatsLock(const Node* node) {
+    return node_stats_locks_[(reinterpret_cast<uintptr_t>(node) / sizeof(Node)) %
+                             kNodeStatsLockStripes];
+  }
+  // Makes solid all nodes queued by concurrent backups, deepest first.
+  void MakePendingSolid();
+  // Brings back the dropped edges of @node, which is at the end of @history.
+  void RestoreDroppedEdges(Node* node, const PositionHistory& history);
+  // Adds noise to the priors of a root which was expanded before the search,
+  // as noise is otherwise only added when the root is expanded.
+  void AddNoiseToReusedRoot();
+  // Makes solid the nodes of a reused tree which reached SolidTreeThreshold
+  // while their children were in flight, or before the threshold was lowered.
+  void MakeReusedTreeSolid();
+  // Makes @node solid. Its children move to a new array, so transposition
+  // entries pointing at them are moved along.
+  bool MakeSolid(Node* node);
+
+  // Frees the children of the least visited nodes so that the tree shrinks
+  // to somewhat below @limit nodes.
+  void PruneTree(int64_t limit);
+
+  // Registers @node as the node of this search for position @hash, unless
+  // there is one already.
+  void AddTransposition(uint64_t hash, Node* node);
+  // If another node of this search with position @hash has at least
+  // TranspositionVisits visits, copies its value and returns true.
+  bool GetTranspositionValue(uint64_t hash, const Node* node, float* wl,
+                             float* d, float* m);
+
+  mutable Mutex counters_mutex_ ACQUIRED_AFTER(nodes_mutex_){
+      "Search::counters_mutex_"};
+  // Held while writing out search info and the bestmove, which is done outside
+  // of the other locks, to keep the order of the responses.
+  Mutex output_mutex_ ACQUIRED_AFTER(counters_mutex_){"Search::output_mutex_"};
   // Tells all threads to stop.
   std::atomic<bool> stop_{false};
   // Condition variable used to watch stop_ variable.
@@ -149,6 +287,9 @@ class Search {
   // If false (e.g. during ponder or `go infinite`) the search stops but nothing
   // is responded until `stop` uci command.
   bool ok_to_respond_bestmove_ GUARDED_BY(counters_mutex_) = true;
+  // Searching on the opponent's time, the batches yield to other searches
+  // sharing the backend.
+  const bool ponder_;
   // There is already one thread that responded bestmove, other threads
   // should not do that.
   bool bestmove_is_sent_ GUARDED_BY(counters_mutex_) = false;
@@ -157,15 +298,36 @@ class Search {
   Move final_bestmove_ GUARDED_BY(counters_mutex_);
   Move final_pondermove_ GUARDED_BY(counters_mutex_);
   std::unique_ptr<SearchStopper> stopper_ GUARDED_BY(counters_mutex_);
-
-  Mutex threads_mutex_;
-  std::vector<std::thread> threads_ GUARDED_BY(threads_mutex_);
+  // Guarded by counters_mutex_ rather than nodes_mutex_, so that the info is
+  // built while the workers keep their shared hold of the tree.
+  Edge* last_outputted_info_edge_ GUARDED_BY(counters_mutex_) = nullptr;
+  ThinkingInfo last_outputted_uci_info_ GUARDED_BY(counters_mutex_);
+
+  // Either owned by the search or shared across searches by the caller.
+  std::unique_ptr<ThreadPool> own_thread_pool_;
+  ThreadPool* const thread_pool_;
+  Mutex threads_mutex_{"Search::threads_mutex_"};
+  std::vector<std::future<void>> threads_ GUARDED_BY(threads_mutex_);
+  // Set by RunBlockingLean() before any thread starts.
+  bool lean_ = false;
 
   Node* root_node_;
   NNCache* cache_;
+  // Cache counters when the search started, as they are kept across searches.
+  const uint64_t initial_cache_hits_;
+  const uint64_t initial_cache_lookups_;
+  const uint64_t initial_cache_evictions_;
+  // Tablebase probe cache counters when the search started.
+  const uint64_t initial_tb_cache_hits_;
+  const uint64_t initial_tb_cache_lookups_;
+  mutable Mutex cache_stats_mutex_{"Search::cache_stats_mutex_"};
+  CacheDepthStats cache_depth_stats_ GUARDED_BY(cache_stats_mutex_);
   SyzygyTablebase* syzygy_tb_;
-  // Fixed positions which happened before the search.
-  const PositionHistory& played_history_;
+  // Probes syzygy_tb_ in the background for the workers, if enabled.
+  std::unique_ptr<AsyncWdlProber> tb_prober_;
+  // Fixed positions which happened before the search, shared by the copies
+  // workers extend.
+  const PositionHistory played_history_;
 
   Network* const network_;
   const SearchParams params_;
@@ -178,28 +340,76 @@ class Search {
   std::atomic<int> tb_hits_{0};
   const MoveList root_move_filter_;
 
-  mutable SharedMutex nodes_mutex_;
+  mutable SharedMutex nodes_mutex_{"Search::nodes_mutex_"};
   EdgeAndNode current_best_edge_ GUARDED_BY(nodes_mutex_);
-  Edge* last_outputted_info_edge_ GUARDED_BY(nodes_mutex_) = nullptr;
-  ThinkingInfo last_outputted_uci_info_ GUARDED_BY(nodes_mutex_);
+  // Children of the root in the order of GetBestChildrenNoTemperature(),
+  // updated by the backups through them. Read holding nodes_mutex_ and
+  // written holding it exclusively.
+  RootCandidates root_candidates_;
+  // The stats of the root children for the stoppers, guarded the same way.
+  RootStabilityTracker root_stability_;
+  // Set when visits of a root child were reverted outside of a backup, so the
+  // tracking has to start over.
+  std::atomic<bool> root_children_stale_{false};
+  // How often root_stability_ samples the KL divergence gain, as asked by the
+  // stoppers.
+  std::atomic<int> kld_gain_interval_{0};
   int64_t total_playouts_ GUARDED_BY(nodes_mutex_) = 0;
   int64_t total_batches_ GUARDED_BY(nodes_mutex_) = 0;
   // Maximum search depth = length of longest path taken in PickNodetoExtend.
   uint16_t max_depth_ GUARDED_BY(nodes_mutex_) = 0;
   // Cumulative depth of all paths taken in PickNodetoExtend.
   uint64_t cum_depth_ GUARDED_BY(nodes_mutex_) = 0;
+  // Visits which are not nodes of the tree, as counted by the last PruneTree.
+  int64_t pruned_visits_ GUARDED_BY(nodes_mutex_) = 0;
 
   std::optional<std::chrono::steady_clock::time_point> nps_start_time_
       GUARDED_BY(counters_mutex_);
+  // Enforces NodesPerSecondLimit, if set.
+  std::shared_ptr<TokenBucket> nps_limiter_;
 
   std::atomic<int> pending_searchers_{0};
+  // Where workers wait for pending_searchers_ with SearchSpinBackoff.
+  ParkingSpot pending_searchers_spot_;
   std::atomic<int> backend_waiting_counter_{0};
   std::atomic<int> thread_count_{0};
+  // Cleared by the worker which gathers the first minibatch of the search.
+  std::atomic<bool> first_batch_pending_{true};
 
   std::vector<std::pair<Node*, int>> shared_collisions_
       GUARDED_BY(nodes_mutex_);
 
+  // Concurrent backups update node statistics holding nodes_mutex_ shared, so
+  // each node is protected by one of these striped locks instead.
+  static constexpr size_t kNodeStatsLockStripes = 1024;
+  std::array<SpinMutex, kNodeStatsLockStripes> node_stats_locks_;
+
+  // Totals over all search workers, for the log.
+  std::atomic<int64_t> picking_tasks_run_{0};
+  std::atomic<int64_t> picking_tasks_stolen_{0};
+  // Nodes (with their depth) which reached SolidTreeThreshold in a concurrent
+  // backup. Making a node solid moves its children, so only the exclusive lock
+  // holder may do that, and it has to process the queue before making any
+  // other node solid. Only appended to while holding nodes_mutex_ shared.
+  SpinMutex solid_candidates_mutex_ ACQUIRED_AFTER(nodes_mutex_){
+      "Search::solid_candidates_mutex_"};
+  std::vector<std::pair<uint16_t, Node*>> solid_candidates_
+      GUARDED_BY(solid_candidates_mutex_);
+
+  // Nodes extended during this search by position hash, and the reverse map
+  // to find the entries of nodes which move when made solid.
+  Mutex transpositions_mutex_ ACQUIRED_AFTER(nodes_mutex_){
+      "Search::transpositions_mutex_"};
+  std::unordered_map<uint64_t, Node*> transpositions_
+      GUARDED_BY(transpositions_mutex_);
+  std::unordered_map<const Node*, uint64_t> transposition_keys_
+      GUARDED_BY(transpositions_mutex_);
+
   std::unique_ptr<UciResponder> uci_responder_;
+  // Searches of the same root whose results are merged into this one.
+  std::vector<Search*> helpers_;
+  // Null unless the phases of the move are reported.
+  std::shared_ptr<PhaseTimer> phase_timer_;
   ContemptMode contempt_mode_;
   friend class SearchWorker;
 };
@@ -214,8 +424,15 @@ class SearchWorker {
         history_(search_->played_history_),
         params_(params),
         moves_left_support_(search_->network_->GetCapabilities().moves_left !=
-                            pblczero::NetworkFormat::MOVES_LEFT_NONE) {
+                            pblczero::NetworkFormat::MOVES_LEFT_NONE),
+        record_cache_stats_(params.GetLogLiveStats()) {
     search_->network_->InitThread(id);
+    // Nodes are allocated by the threads which extend them, so binding keeps
+    // them in memory local to the node's processors.
+    const auto domains = Numa::GetDomains(params_.GetThreadPlacement(),
+                                          search_->network_->GetPciBusId());
+    if (!domains.empty()) cpus_ = domains[id % domains.size()];
+    Numa::BindThreadToCpus(cpus_);
     task_workers_ = params.GetTaskWorkersPerSearchWorker();
     if (task_workers_ < 0) {
       if (search_->network_->IsCpu()) {
@@ -227,16 +444,34 @@ class SearchWorker {
             std::thread::hardware_concurrency() / working_threads - 1, 4U);
       }
     }
+    picking_tasks_.resize(kMaxTasks);
+    // One queue per task worker, plus one for this thread.
+    for (int i = 0; i <= task_workers_; i++) {
+      task_queues_.push_back(std::make_unique<WorkStealingDeque<int>>(
+          params.GetTaskQueueSize()));
+    }
+    main_workspace_.task_queue = task_workers_;
+    task_workspaces_.reserve(task_workers_);
     for (int i = 0; i < task_workers_; i++) {
       task_workspaces_.emplace_back();
-      task_threads_.emplace_back([this, i]() {
-        this->RunTasks(i);
-      });
+      task_workspaces_.back().task_queue = i;
+      task_threads_.push_back(
+          search_->thread_pool_->Run([this, i]() { this->RunTasks(i); }));
+    }
+    pipeline_depth_ = params_.GetMinibatchPipelineDepth();
+    if (pipeline_depth_ > 1) {
+      compute_thread_ = search_->thread_pool_->Run(
+          [this, id]() { this->RunComputations(id); });
     }
     target_minibatch_size_ = params_.GetMiniBatchSize();
     if (target_minibatch_size_ == 0) {
       target_minibatch_size_ = search_->network_->GetMiniBatchSize();
     }
+    base_minibatch_size_ = target_minibatch_size_;
+    if (params_.GetAdaptiveMinibatch()) {
+      minibatch_controller_ = std::make_unique<MinibatchSizeController>(
+          base_minibatch_size_, params_.GetAdaptiveMinibatchTimeShare());
+    }
     max_out_of_order_ =
         std::max(1, static_cast<int>(params_.GetMaxOutOfOrderEvalsFactor() *
                                      target_minibatch_size_));
@@ -250,12 +485,25 @@ class SearchWorker {
       task_added_.notify_all();
     }
     for (size_t i = 0; i < task_threads_.size(); i++) {
-      task_threads_[i].join();
+      task_threads_[i].get();
+    }
+    search_->picking_tasks_run_.fetch_add(tasks_run_.load(),
+                                          std::memory_order_relaxed);
+    search_->picking_tasks_stolen_.fetch_add(tasks_stolen_.load(),
+                                             std::memory_order_relaxed);
+    if (compute_thread_.valid()) {
+      {
+        Mutex::Lock lock(pipeline_mutex_);
+        compute_exiting_ = true;
+        pipeline_cv_.notify_all();
+      }
+      compute_thread_.get();
     }
   }
 
   // Runs iterations while needed.
   void RunBlocking() {
+    LC0_TRACE_THREAD_NAME("search worker");
     LOGFILE << "Started search thread.";
     try {
       // A very early stop may arrive before this point, so the test is at the
@@ -263,6 +511,9 @@ class SearchWorker {
       do {
         ExecuteOneIteration();
       } while (search_->IsSearchActive());
+      // Minibatches still in flight hold virtual loss in the tree, so they
+      // have to be backed up before the search can complete.
+      while (!pipeline_.empty()) RetireOldestBatch();
     } catch (std::exception& e) {
       std::cerr << "Unhandled exception in worker thread: " << e.what()
                 << std::endl;
@@ -294,6 +545,9 @@ class SearchWorker {
   // 3. Prefetch into cache.
   void MaybePrefetchIntoCache();
 
+  // 3b. Tell the backend how urgent the NN computation is.
+  void SetComputationPriority(int gathered_misses);
+
   // 4. Run NN computation.
   void RunNNComputation();
 
@@ -306,12 +560,15 @@ class SearchWorker {
   // 7. Update the Search's status and progress information.
   void UpdateCounters();
 
+  // 8. Wait until the nodes of the iteration are within NodesPerSecondLimit.
+  void WaitForNpsLimit();
+
  private:
   struct NodeToProcess {
     bool IsExtendable() const { return !is_collision && !node->IsTerminal(); }
     bool IsCollision() const { return is_collision; }
     bool CanEvalOutOfOrder() const {
-      return is_cache_hit || node->IsTerminal();
+      return (is_cache_hit || node->IsTerminal()) && !tb_probe.valid();
     }
 
     // The node to extend.
@@ -330,8 +587,9 @@ class SearchWorker {
     uint16_t depth;
     bool nn_queried = false;
     bool is_cache_hit = false;
+    // Value was taken from a transposition, only policy comes from the cache.
+    bool is_transposition = false;
     bool is_collision = false;
-    int probability_transform = 0;
 
     // Details only populated in the multigather path.
 
@@ -343,7 +601,12 @@ class SearchWorker {
     NNCacheLock lock;
     std::vector<uint16_t> probabilities_to_cache;
     InputPlanes input_planes;
-    mutable int last_idx = 0;
+    // For backends taking the input in place, the planes are rather encoded
+    // when the node is added to the computation, from these.
+    std::shared_ptr<const ParentHistoryPlanes> parent_planes;
+    std::optional<Position> position;
+    // Tablebase probe running while the node is evaluated by the network.
+    std::future<AsyncWdlProber::Result> tb_probe;
     bool ooo_completed = false;
 
     static NodeToProcess Collision(Node* node, uint16_t depth,
@@ -361,25 +624,14 @@ class SearchWorker {
     // Methods to allow NodeToProcess to conform as a 'Computation'. Only safe
     // to call if is_cache_hit is true in the multigather path.
 
-    float GetQVal(int) const { return lock->q; }
+    float GetQVal(int) const { return lock->GetQ(); }
 
-    float GetDVal(int) const { return lock->d; }
+    float GetDVal(int) const { return lock->GetD(); }
 
-    float GetMVal(int) const { return lock->m; }
+    float GetMVal(int) const { return lock->GetM(); }
 
-    float GetPVal(int, int move_id) const {
-      const auto& moves = lock->p;
-
-      int total_count = 0;
-      while (total_count < moves.size()) {
-        // Optimization: usually moves are stored in the same order as queried.
-        const auto& move = moves[last_idx++];
-        if (last_idx == moves.size()) last_idx = 0;
-        if (move.first == move_id) return move.second;
-        ++total_count;
-      }
-      assert(false);  // Move not found.
-      return 0;
+    float GetPVal(int, int move_ordinal) const {
+      return lock->GetP(move_ordinal);
     }
 
    private:
@@ -401,6 +653,17 @@ class SearchWorker {
     std::vector<int> current_path;
     std::vector<Move> moves_to_path;
     PositionHistory history;
+    // Indexes history, or the search's played history before the first node
+    // is extended.
+    RepetitionTable repetitions;
+    // History of the node whose cache lookup waits in ProcessPickedTask().
+    PositionHistory pending_history;
+    // History planes of the children of parent_planes_node, shared by the
+    // siblings picked one after another.
+    std::shared_ptr<const ParentHistoryPlanes> parent_planes;
+    const Node* parent_planes_node = nullptr;
+    // Index of the task queue this workspace's thread owns.
+    int task_queue = 0;
     TaskWorkspace() {
       vtp_buffer.reserve(30);
       visits_to_perform.reserve(30);
@@ -413,36 +676,73 @@ class SearchWorker {
 
   struct PickTask {
     enum PickTaskType { kGathering, kProcessing };
-    PickTaskType task_type;
+    PickTaskType task_type = kGathering;
 
     // For task type gathering.
-    Node* start;
-    int base_depth;
-    int collision_limit;
+    Node* start = nullptr;
+    int base_depth = 0;
+    int collision_limit = 0;
     std::vector<Move> moves_to_base;
     std::vector<NodeToProcess> results;
 
     // Task type post gather processing.
-    int start_idx;
-    int end_idx;
-
-    bool complete = false;
-
-    PickTask(Node* node, uint16_t depth, const std::vector<Move>& base_moves,
-             int collision_limit)
-        : task_type(kGathering),
-          start(node),
-          base_depth(depth),
-          collision_limit(collision_limit),
-          moves_to_base(base_moves) {}
-    PickTask(int start_idx, int end_idx)
-        : task_type(kProcessing), start_idx(start_idx), end_idx(end_idx) {}
+    int start_idx = 0;
+    int end_idx = 0;
+
+    // Task slots are reused between batches to keep the vectors allocated.
+    void SetGathering(Node* node, uint16_t depth,
+                      const std::vector<Move>& base_moves, int limit) {
+      task_type = kGathering;
+      start = node;
+      base_depth = depth;
+      collision_limit = limit;
+      moves_to_base = base_moves;
+      results.clear();
+    }
+    void SetProcessing(int first, int last) {
+      task_type = kProcessing;
+      start_idx = first;
+      end_idx = last;
+    }
+  };
+
+  // A minibatch which has been handed to the backend while the worker moved on
+  // to gathering the next one. Only used when MinibatchPipelineDepth > 1.
+  struct InFlightBatch {
+    std::vector<NodeToProcess> minibatch;
+    std::unique_ptr<CachingComputation> computation;
+    int number_out_of_order = 0;
+    // Set by the compute thread under pipeline_mutex_.
+    bool computed = false;
+    float compute_ms = 0.0f;
   };
 
   NodeToProcess PickNodeToExtend(int collision_limit);
   bool AddNodeToComputation(Node* node);
   int PrefetchIntoCache(Node* node, int budget, bool is_odd_depth);
+  // Remembers the most likely children of the nodes just evaluated.
+  void CollectSpeculativeCandidates();
+  // Adds up to @budget remembered children to the computation.
+  void SpeculativePrefetch(int budget);
   void DoBackupUpdateSingleNode(const NodeToProcess& node_to_process);
+  // Backs up the nodes of the minibatch which can't set bounds together,
+  // merging their visits on the shared parts of their paths so that an
+  // ancestor is updated once for a run of nodes below it rather than once per
+  // node.
+  void DoBatchedBackupUpdate();
+  // Applies the visits gathered on the top of backup_stack_ and passes them
+  // on to the entry below.
+  void PopBackupStack();
+  // Backs up the minibatch holding nodes_mutex_ shared where possible, so that
+  // several workers can update disjoint parts of the tree at the same time.
+  void DoConcurrentBackupUpdate();
+  // Returns false without changing anything if the node has to be backed up
+  // under the exclusive lock (e.g. because it may set bounds on its parents).
+  // Adds the edge index of the root child it went through to @root_children.
+  bool DoConcurrentBackupUpdateSingleNode(
+      const NodeToProcess& node_to_process,
+      std::vector<std::pair<uint16_t, Node*>>* solid_candidates,
+      std::vector<uint16_t>* root_children);
   // Returns whether a node's bounds were set based on its children.
   bool MaybeSetBounds(Node* p, float m, int* n_to_fix, float* v_delta,
                       float* d_delta, float* m_delta) const;
@@ -452,17 +752,63 @@ class SearchWorker {
                              const std::vector<Move>& moves_to_base,
                              std::vector<NodeToProcess>* receiver,
                              TaskWorkspace* workspace);
+  // Specialized for whether the moves left head is used.
+  template <bool kMovesLeft>
+  void PickNodesToExtendTaskImpl(Node* starting_point, int base_depth,
+                                 int collision_limit,
+                                 const std::vector<Move>& moves_to_base,
+                                 std::vector<NodeToProcess>* receiver,
+                                 TaskWorkspace* workspace);
   void EnsureNodeTwoFoldCorrectForDepth(Node* node, int depth);
   void ProcessPickedTask(int batch_start, int batch_end,
                          TaskWorkspace* workspace);
+  // Counts the cache hits, misses and collisions of the minibatch and passes
+  // them to the search with the prefetch counts.
+  void RecordCacheStats();
+  // Looks up a node extended by ProcessPickedTask() in the NN cache, encodes it
+  // for the network on a miss, and evaluates it out of order if it can be.
+  void FinishPickedNode(NodeToProcess* picked_node,
+                        const PositionHistory& history,
+                        TaskWorkspace* workspace);
+  // Creates the edges of a new node, or makes it terminal. A tablebase probe
+  // may rather be started in @tb_probe, to be applied by
+  // FetchSingleNodeResult(). @repetitions indexes @history.
   void ExtendNode(Node* node, int depth, const std::vector<Move>& moves_to_add,
-                  PositionHistory* history);
+                  PositionHistory* history, RepetitionTable* repetitions,
+                  std::future<AsyncWdlProber::Result>* tb_probe);
+  // Makes @node terminal according to a tablebase probe, unless it failed.
+  // Returns whether it did. @pos, the position of @node when known, is
+  // probed for DTZ if in-tree DTZ is enabled.
+  bool MakeTablebaseTerminal(Node* node, WDLScore wdl, ProbeState state,
+                             const Position* pos = nullptr);
+  // Probes @pos, the position of @node, accounting for its 50-move counter,
+  // and makes @node terminal if the result is certain. Returns whether it did.
+  bool ResolveTablebaseLeaf(Node* node, const Position& pos);
   template <typename Computation>
   void FetchSingleNodeResult(NodeToProcess* node_to_process,
                              const Computation& computation,
                              int idx_in_computation);
+  // Feeds a measured backend computation to the minibatch size controller.
+  void UpdateMinibatchSize(int batch_size, float latency_ms);
   void RunTasks(int tid);
+  // Reserves a slot in picking_tasks_, returns -1 if all are taken.
+  int NewTaskSlot();
+  // Makes the task in @slot available to task workers, starting from @queue.
+  // Returns false if @queue is full, the caller then has to do the task.
+  [[nodiscard]] bool PublishTask(int slot, int queue);
+  // Takes a task from @queue, or else steals one from another queue. Returns
+  // the slot or -1 if nothing is available.
+  int TakeTask(int queue);
+  // Runs the task in @slot using @workspace.
+  void RunTask(int slot, TaskWorkspace* workspace);
+  // Body of the per worker thread which runs pipelined NN computations.
+  void RunComputations(int id);
+  // Hands the current minibatch over to the compute thread.
+  void SubmitCurrentBatch();
+  // Waits for the oldest in flight minibatch and runs stages 5-7 on it.
+  void RetireOldestBatch();
   void ResetTasks();
+  // Waits for all published tasks to complete, helping with them meanwhile.
   // Returns how many tasks there were.
   int WaitForTasks();
 
@@ -472,29 +818,74 @@ class SearchWorker {
   std::unique_ptr<CachingComputation> computation_;
   int task_workers_;
   int target_minibatch_size_;
+  // Target size before any adaptive tuning.
+  int base_minibatch_size_;
+  std::unique_ptr<MinibatchSizeController> minibatch_controller_;
+  int last_collision_limit_ = 0;
   int max_out_of_order_;
   // History is reset and extended by PickNodeToExtend().
   PositionHistory history_;
   int number_out_of_order_ = 0;
+  // Playouts backed up in the current iteration, out of order ones included.
+  int iteration_playouts_ = 0;
+  // Visits gathered on a node by DoBatchedBackupUpdate(), with the values
+  // summed over them.
+  struct BackupSums {
+    Node* node;
+    double v = 0.0;
+    double d = 0.0;
+    double m = 0.0;
+    int visits = 0;
+  };
+  // The path from the root to the last node backed up.
+  std::vector<BackupSums> backup_stack_;
+  std::vector<Node*> backup_path_;
   const SearchParams& params_;
   std::unique_ptr<Node> precached_node_;
   const bool moves_left_support_;
   IterationStats iteration_stats_;
   StoppersHints latest_time_manager_hints_;
+  // Counts of the current iteration, only kept with LogLiveStats.
+  const bool record_cache_stats_;
+  Search::CacheDepthStats cache_depth_stats_;
+  // Paths from the root to likely next leaves, for SpeculativePrefetch().
+  // Stored flat, speculative_path_ends_ holds where each path ends.
+  std::vector<Move> speculative_moves_;
+  std::vector<size_t> speculative_path_ends_;
 
   // Multigather task related fields.
 
-  Mutex picking_tasks_mutex_;
+  static constexpr int kMaxTasks = 100;
+  Mutex picking_tasks_mutex_{"SearchWorker::picking_tasks_mutex_"};
+  // Resized to kMaxTasks once since task threads hold pointers into it.
   std::vector<PickTask> picking_tasks_;
+  std::vector<std::unique_ptr<WorkStealingDeque<int>>> task_queues_;
+  std::atomic<int> task_slots_used_ = 0;
   std::atomic<int> task_count_ = -1;
-  std::atomic<int> task_taking_started_ = 0;
-  std::atomic<int> tasks_taken_ = 0;
   std::atomic<int> completed_tasks_ = 0;
+  // Where WaitForTasks() waits for completed_tasks_ to change.
+  ParkingSpot completed_tasks_spot_;
+  std::atomic<int64_t> tasks_run_ = 0;
+  std::atomic<int64_t> tasks_stolen_ = 0;
   std::condition_variable task_added_;
-  std::vector<std::thread> task_threads_;
+  std::vector<std::future<void>> task_threads_;
+  // Processors this worker and its helper threads run on, empty if not bound.
+  std::vector<int> cpus_;
   std::vector<TaskWorkspace> task_workspaces_;
   TaskWorkspace main_workspace_;
   bool exiting_ = false;
+
+  // Minibatch pipelining related fields.
+
+  int pipeline_depth_ = 1;
+  // Owned by the search thread, oldest first.
+  std::deque<std::unique_ptr<InFlightBatch>> pipeline_;
+  Mutex pipeline_mutex_{"SearchWorker::pipeline_mutex_"};
+  // Batches waiting for the compute thread, oldest first.
+  std::deque<InFlightBatch*> compute_queue_ GUARDED_BY(pipeline_mutex_);
+  bool compute_exiting_ GUARDED_BY(pipeline_mutex_) = false;
+  std::condition_variable pipeline_cv_;
+  std::future<void> compute_thread_;
 };
 
 }  // namespace lczero
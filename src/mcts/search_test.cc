@@ -0,0 +1,174 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "mcts/search.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <vector>
+
+#include "mcts/params.h"
+#include "mcts/stoppers/stoppers.h"
+#include "neural/cache.h"
+#include "neural/network.h"
+#include "utils/hashcat.h"
+#include "utils/optionsparser.h"
+
+namespace lczero {
+namespace {
+
+// Evaluates positions by their hash, the policy sharp enough for the tree to
+// grow a few plies deep.
+class HashComputation : public NetworkComputation {
+ public:
+  void AddInput(InputPlanes&& input) override {
+    uint64_t hash = 0;
+    for (const auto& plane : input) hash = HashCat({hash, plane.mask});
+    inputs_.push_back(hash);
+  }
+  void ComputeBlocking() override {}
+  int GetBatchSize() const override { return inputs_.size(); }
+  float GetQVal(int sample) const override {
+    return (static_cast<int>(inputs_[sample] % 2000) - 1000) / 1000.0f;
+  }
+  float GetDVal(int) const override { return 0.0f; }
+  float GetMVal(int) const override { return 0.0f; }
+  float GetPVal(int sample, int move_id) const override {
+    return HashCat({inputs_[sample], static_cast<uint64_t>(move_id)}) % 1000 *
+           0.003f;
+  }
+
+ private:
+  std::vector<uint64_t> inputs_;
+};
+
+class HashNetwork : public Network {
+ public:
+  const NetworkCapabilities& GetCapabilities() const override {
+    return capabilities_;
+  }
+  std::unique_ptr<NetworkComputation> NewComputation() override {
+    return std::make_unique<HashComputation>();
+  }
+
+ private:
+  NetworkCapabilities capabilities_{
+      pblczero::NetworkFormat::INPUT_CLASSICAL_112_PLANE,
+      pblczero::NetworkFormat::MOVES_LEFT_NONE};
+};
+
+// Checks that all the visits of the subtree have been backed up, returns the
+// number of nodes checked.
+int CheckVisits(const Node* node) {
+  EXPECT_EQ(node->GetNInFlight(), 0u);
+  uint32_t children_visits = 0;
+  int nodes = 1;
+  for (const auto& edge : node->Edges()) {
+    if (!edge.node()) continue;
+    EXPECT_EQ(edge.node()->GetParent(), node);
+    children_visits += edge.GetN();
+    nodes += CheckVisits(edge.node());
+  }
+  // Terminals, including those proven by their children, stop the visits.
+  if (!node->IsTerminal()) {
+    EXPECT_EQ(node->GetChildrenVisits(), children_visits);
+  }
+  return nodes;
+}
+
+// Without out of order evaluation, the first visits of the mates are backed up
+// one node at a time in the middle of the batches, and may make solid the
+// ancestors of the visits which are batched before them.
+TEST(Search, BatchedBackupWithTerminalsAndSolidTree) {
+  OptionsParser parser;
+  SearchParams::Populate(&parser);
+  OptionsDict* options = parser.GetMutableOptions();
+  options->Set<int>(SearchParams::kSolidTreeThresholdId, 3);
+  options->Set<int>(SearchParams::kMiniBatchSizeId, 256);
+  options->Set<bool>(SearchParams::kBatchedBackupId, true);
+  options->Set<bool>(SearchParams::kStickyEndgamesId, true);
+  options->Set<bool>(SearchParams::kOutOfOrderEvalId, false);
+
+  // Both sides have a back rank mate.
+  NodeTree tree;
+  tree.ResetToPosition("r5k1/5ppp/8/8/8/8/5PPP/3R2K1 w - - 0 1", {});
+  HashNetwork network;
+  NNCache cache(1000);
+  Search search(tree, &network,
+                std::make_unique<CallbackUciResponder>(
+                    [](const BestMoveInfo&) {},
+                    [](const std::vector<ThinkingInfo>&) {}),
+                MoveList(), std::chrono::steady_clock::now(),
+                std::make_unique<VisitsStopper>(20000, false),
+                /* infinite */ false, /* ponder */ false,
+                parser.GetOptionsDict(), &cache, nullptr);
+  search.RunBlocking(1);
+
+  EXPECT_GT(CheckVisits(tree.GetCurrentHead()), 1000);
+}
+
+// Task queues with room for a single task overflow all the time, the picking
+// and processing work which doesn't fit is done by the thread which split it.
+TEST(Search, TasksWhichDontFitTheQueueAreNotLost) {
+  OptionsParser parser;
+  SearchParams::Populate(&parser);
+  OptionsDict* options = parser.GetMutableOptions();
+  options->Set<int>(SearchParams::kMiniBatchSizeId, 256);
+  options->Set<int>(SearchParams::kTaskWorkersPerSearchWorkerId, 2);
+  options->Set<int>(SearchParams::kTaskQueueSizeId, 1);
+  options->Set<int>(SearchParams::kMinimumWorkSizeForProcessingId, 2);
+  options->Set<int>(SearchParams::kMinimumWorkPerTaskForProcessingId, 1);
+  options->Set<int>(SearchParams::kMinimumWorkSizeForPickingId, 1);
+  options->Set<int>(SearchParams::kMinimumRemainingWorkSizeForPickingId, 0);
+
+  NodeTree tree;
+  tree.ResetToPosition(ChessBoard::kStartposFen, {});
+  HashNetwork network;
+  NNCache cache(1000);
+  Search search(tree, &network,
+                std::make_unique<CallbackUciResponder>(
+                    [](const BestMoveInfo&) {},
+                    [](const std::vector<ThinkingInfo>&) {}),
+                MoveList(), std::chrono::steady_clock::now(),
+                std::make_unique<VisitsStopper>(20000, false),
+                /* infinite */ false, /* ponder */ false,
+                parser.GetOptionsDict(), &cache, nullptr);
+  search.RunBlocking(1);
+
+  EXPECT_GE(tree.GetCurrentHead()->GetN(), 20000u);
+  EXPECT_GT(CheckVisits(tree.GetCurrentHead()), 1000);
+}
+
+}  // namespace
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  lczero::InitializeMagicBitboards();
+  return RUN_ALL_TESTS();
+}
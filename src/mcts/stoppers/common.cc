@@ -33,6 +33,13 @@ const OptionId kNNCacheSizeId{
     "nncache", "NNCacheSize",
     "Number of positions to store in a memory cache. A large cache can speed "
     "up searching, but takes memory."};
+const OptionId kNNCacheEvictionId{
+    "nncache-eviction", "NNCacheEviction",
+    "Which positions a full NN cache drops first. \"fifo\" drops the oldest; "
+    "\"clock\" gives a position looked up since it was last considered "
+    "another round; \"frequency\" gives as many rounds as it had lookups, up "
+    "to three. The latter two keep more of the positions search keeps coming "
+    "back to when the cache is smaller than the tree."};
 
 namespace {
 const OptionId kRamLimitMbId{
@@ -42,6 +49,11 @@ const OptionId kRamLimitMbId{
     "terminal node counted several times, and the estimation assumes that all "
     "positions have 30 possible moves. When set to 0, no RAM limit is "
     "enforced."};
+const OptionId kRamLimitPruneId{
+    "ramlimit-prune", "RamLimitPrune",
+    "When the RamLimitMb estimation is reached, free the least visited "
+    "subtrees and keep searching instead of stopping. The freed nodes keep "
+    "their visits and value, and are grown again when search needs them."};
 const OptionId kMinimumKLDGainPerNodeId{
     "minimum-kldgain-per-node", "MinimumKLDGainPerNode",
     "If greater than 0 search will abort unless the last "
@@ -80,6 +92,7 @@ void PopulateCommonStopperOptions(RunType for_what, OptionsParser* options) {
 
   if (for_what == RunType::kUci || for_what == RunType::kSimpleUci) {
     options->Add<IntOption>(kRamLimitMbId, 0, 100000000) = 0;
+    options->Add<BoolOption>(kRamLimitPruneId) = false;
     options->HideOption(kMinimumKLDGainPerNodeId);
     options->HideOption(kKLDGainAverageIntervalId);
     options->HideOption(kNodesAsPlayoutsId);
@@ -121,7 +134,8 @@ void PopulateCommonUciStoppers(ChainedSearchStopper* stopper,
   if (ram_limit) {
     stopper->AddStopper(std::make_unique<MemoryWatchingStopper>(
         cache_size_mb, ram_limit,
-        options.Get<float>(kSmartPruningFactorId) > 0.0f));
+        options.Get<float>(kSmartPruningFactorId) > 0.0f,
+        options.Get<bool>(kRamLimitPruneId)));
   }
 
   // "go nodes" stopper.
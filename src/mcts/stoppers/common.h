@@ -39,6 +39,7 @@ void PopulateCommonStopperOptions(RunType for_what, OptionsParser* options);
 // Option ID for a cache size. It's used from multiple places and there's no
 // really nice place to declare, so let it be here.
 extern const OptionId kNNCacheSizeId;
+extern const OptionId kNNCacheEvictionId;
 
 // Populates KLDGain and SmartPruning stoppers.
 void PopulateIntrinsicStoppers(ChainedSearchStopper* stopper,
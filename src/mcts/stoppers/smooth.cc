@@ -27,6 +27,7 @@
 
 #include "mcts/stoppers/smooth.h"
 
+#include <cmath>
 #include <functional>
 #include <iomanip>
 #include <optional>
@@ -97,6 +98,17 @@ class Params {
   // Force a use of piggybank during the first few milliseconds of the move.
   float force_piggybank_ms() const { return force_piggybank_ms_; }
 
+  // Period over which the KL divergence gain of root visits is measured.
+  int64_t kld_gain_update_period_ms() const {
+    return kld_gain_update_period_ms_;
+  }
+  // KLD gain per second above which the move may use the piggybank, as more
+  // time still changes its result. 0 disables.
+  float piggybank_kld_gain() const { return piggybank_kld_gain_; }
+  // KLD gain per second below which the move stops before its deadline, as
+  // more time hardly changes its result. 0 disables.
+  float min_kld_gain() const { return min_kld_gain_; }
+
   // Move overhead.
   int64_t move_overhead_ms() const { return move_overhead_ms_; }
   // Returns a function function that estimates remaining moves.
@@ -122,6 +134,9 @@ class Params {
   const float bestmove_optimism_;
   const float overtaker_optimism_;
   const float force_piggybank_ms_;
+  const int64_t kld_gain_update_period_ms_;
+  const float piggybank_kld_gain_;
+  const float min_kld_gain_;
   const MovesLeftEstimator moves_left_estimator_;
 };
 
@@ -168,6 +183,11 @@ Params::Params(const OptionsDict& params, int64_t move_overhead)
       overtaker_optimism_(
           params.GetOrDefault<float>("overtaker-optimism", 4.0f)),
       force_piggybank_ms_(params.GetOrDefault<int>("force-piggybank-ms", 1000)),
+      kld_gain_update_period_ms_(
+          params.GetOrDefault<int>("kld-gain-update-period-ms", 500)),
+      piggybank_kld_gain_(
+          params.GetOrDefault<float>("piggybank-kld-gain", 0.0f)),
+      min_kld_gain_(params.GetOrDefault<float>("min-kld-gain", 0.0f)),
       moves_left_estimator_(CreateMovesLeftEstimator(params)) {}
 
 // Returns the updated value of @from, towards @to by the number of halves
@@ -247,12 +267,33 @@ class VisitsTrendWatcher {
   std::vector<uint32_t> last_visits_ GUARDED_BY(mutex_);
 };
 
+// Measures how fast the root visit distribution still changes, as its KL
+// divergence from the distribution one period earlier, per second.
+class KldGainWatcher {
+ public:
+  explicit KldGainWatcher(int64_t update_period_ms)
+      : update_period_ms_(update_period_ms) {}
+
+  // Returns the gain per second of the last full period, if there was one.
+  std::optional<float> Update(int64_t timestamp,
+                              const std::vector<uint32_t>& visits);
+
+ private:
+  const int64_t update_period_ms_;
+
+  Mutex mutex_;
+  int64_t prev_timestamp_ GUARDED_BY(mutex_) = 0;
+  std::vector<uint32_t> prev_visits_ GUARDED_BY(mutex_);
+  std::optional<float> gain_per_second_ GUARDED_BY(mutex_);
+};
+
 class SmoothStopper : public SearchStopper {
  public:
   SmoothStopper(int64_t deadline_ms, int64_t allowed_piggybank_use_ms,
                 float nps_update_period, float bestmove_optimism,
                 float overtaker_optimism, int64_t forces_piggybank_ms,
-                SmoothTimeManager* manager);
+                int64_t kld_gain_update_period_ms, float piggybank_kld_gain,
+                float min_kld_gain, SmoothTimeManager* manager);
 
  private:
   bool ShouldStop(const IterationStats& stats, StoppersHints* hints) override;
@@ -261,8 +302,11 @@ class SmoothStopper : public SearchStopper {
   const int64_t deadline_ms_;
   const int64_t allowed_piggybank_use_ms_;
   const int64_t forced_piggybank_use_ms_;
+  const float piggybank_kld_gain_;
+  const float min_kld_gain_;
 
   VisitsTrendWatcher visits_trend_watcher_;
+  KldGainWatcher kld_gain_watcher_;
   SmoothTimeManager* const manager_;
   std::atomic_flag used_piggybank_;
 };
@@ -460,7 +504,9 @@ class SmoothTimeManager : public TimeManager {
     return std::make_unique<SmoothStopper>(
         move_allocated_time_ms_, allowed_piggybank_time_ms,
         params_.trend_nps_update_period_ms(), params_.bestmove_optimism(),
-        params_.overtaker_optimism(), params_.force_piggybank_ms(), this);
+        params_.overtaker_optimism(), params_.force_piggybank_ms(),
+        params_.kld_gain_update_period_ms(), params_.piggybank_kld_gain(),
+        params_.min_kld_gain(), this);
   }
 
   void UpdateTreeReuseFactor(int64_t new_move_nodes) REQUIRES(mutex_) {
@@ -563,17 +609,52 @@ bool VisitsTrendWatcher::IsBestmoveBeingOvertaken(
   return false;
 }
 
+std::optional<float> KldGainWatcher::Update(
+    int64_t timestamp, const std::vector<uint32_t>& visits) {
+  Mutex::Lock lock(mutex_);
+  if (prev_visits_.size() != visits.size()) {
+    prev_visits_ = visits;
+    prev_timestamp_ = timestamp;
+    return gain_per_second_;
+  }
+  if (timestamp < prev_timestamp_ + update_period_ms_) return gain_per_second_;
+  double prev_total = 0.0;
+  double new_total = 0.0;
+  for (size_t i = 0; i < visits.size(); ++i) {
+    prev_total += prev_visits_[i];
+    new_total += visits[i];
+  }
+  if (prev_total > 0.0 && new_total > prev_total) {
+    double kld = 0.0;
+    for (size_t i = 0; i < visits.size(); ++i) {
+      if (prev_visits_[i] == 0 || visits[i] == 0) continue;
+      const double o_p = prev_visits_[i] / prev_total;
+      const double n_p = visits[i] / new_total;
+      kld += o_p * std::log(o_p / n_p);
+    }
+    gain_per_second_ = kld * 1000.0 / (timestamp - prev_timestamp_);
+  }
+  prev_visits_ = visits;
+  prev_timestamp_ = timestamp;
+  return gain_per_second_;
+}
+
 SmoothStopper::SmoothStopper(int64_t deadline_ms,
                              int64_t allowed_piggybank_use_ms,
                              float nps_update_period, float bestmove_optimism,
                              float overtaker_optimism,
                              int64_t forced_piggybank_use_ms,
+                             int64_t kld_gain_update_period_ms,
+                             float piggybank_kld_gain, float min_kld_gain,
                              SmoothTimeManager* manager)
     : deadline_ms_(deadline_ms),
       allowed_piggybank_use_ms_(allowed_piggybank_use_ms),
       forced_piggybank_use_ms_(forced_piggybank_use_ms),
+      piggybank_kld_gain_(piggybank_kld_gain),
+      min_kld_gain_(min_kld_gain),
       visits_trend_watcher_(nps_update_period, bestmove_optimism,
                             overtaker_optimism),
+      kld_gain_watcher_(kld_gain_update_period_ms),
       manager_(manager) {
   used_piggybank_.clear();
 }
@@ -588,13 +669,23 @@ bool SmoothStopper::ShouldStop(const IterationStats& stats,
   }
 
   visits_trend_watcher_.Update(stats.time_since_movestart, stats.edge_n);
+  const auto kld_gain =
+      kld_gain_watcher_.Update(stats.time_since_movestart, stats.edge_n);
   const auto deadline_with_piggybank = deadline_ms_ + allowed_piggybank_use_ms_;
   const bool force_use_piggybank =
       stats.time_since_first_batch <= forced_piggybank_use_ms_;
+  const bool high_kld_gain = piggybank_kld_gain_ > 0.0f && kld_gain &&
+                             *kld_gain >= piggybank_kld_gain_;
   const bool use_piggybank =
       (stats.time_usage_hint_ == IterationStats::TimeUsageHint::kNeedMoreTime ||
-       force_use_piggybank ||
+       force_use_piggybank || high_kld_gain ||
        visits_trend_watcher_.IsBestmoveBeingOvertaken(deadline_with_piggybank));
+  if (min_kld_gain_ > 0.0f && kld_gain && *kld_gain < min_kld_gain_ &&
+      !use_piggybank) {
+    LOGFILE << "Stopping search: KLD gain per second too small. gain="
+            << *kld_gain << " elapsed=" << stats.time_since_movestart;
+    return true;
+  }
   const int64_t time_limit =
       use_piggybank ? deadline_with_piggybank : deadline_ms_;
   hints->UpdateEstimatedNps(nps);
@@ -611,7 +702,8 @@ bool SmoothStopper::ShouldStop(const IterationStats& stats,
                       ? "requested by search."
                   : force_use_piggybank
                       ? "forced used in the beginning of the move."
-                      : "bestmove can be overtaken.");
+                  : high_kld_gain ? "KLD gain is high."
+                                  : "bestmove can be overtaken.");
     }
   }
   if (stats.time_since_movestart >= time_limit) {
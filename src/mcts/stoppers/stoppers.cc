@@ -94,22 +94,32 @@ bool PlayoutsStopper::ShouldStop(const IterationStats& stats,
 namespace {
 const size_t kAvgNodeSize =
     sizeof(Node) + MemoryWatchingStopper::kAvgMovesPerPosition * sizeof(Edge);
+// Each move takes 12 bits of policy.
 const size_t kAvgCacheItemSize =
     NNCache::GetItemStructSize() + sizeof(CachedNNRequest) +
-    sizeof(CachedNNRequest::IdxAndProb) *
-        MemoryWatchingStopper::kAvgMovesPerPosition;
+    MemoryWatchingStopper::kAvgMovesPerPosition * 3 / 2;
 }  // namespace
 
 MemoryWatchingStopper::MemoryWatchingStopper(int cache_size, int ram_limit_mb,
-                                             bool populate_remaining_playouts)
+                                             bool populate_remaining_playouts,
+                                             bool prune)
     : VisitsStopper(
           (ram_limit_mb * 1000000LL - cache_size * kAvgCacheItemSize) /
               kAvgNodeSize,
-          populate_remaining_playouts) {
+          populate_remaining_playouts && !prune),
+      prune_(prune) {
   LOGFILE << "RAM limit " << ram_limit_mb << "MB. Cache takes "
           << cache_size * kAvgCacheItemSize / 1000000
           << "MB. Remaining memory is enough for " << GetVisitsLimit()
-          << " nodes.";
+          << " nodes." << (prune_ ? " Least visited subtrees will be pruned."
+                                  : "");
+}
+
+bool MemoryWatchingStopper::ShouldStop(const IterationStats& stats,
+                                       StoppersHints* hints) {
+  if (!prune_) return VisitsStopper::ShouldStop(stats, hints);
+  hints->UpdateTreeSizeLimit(GetVisitsLimit());
+  return false;
 }
 
 ///////////////////////////
@@ -161,26 +171,18 @@ bool MateStopper::ShouldStop(const IterationStats& stats, StoppersHints*) {
 KldGainStopper::KldGainStopper(float min_gain, int average_interval)
     : min_gain_(min_gain), average_interval_(average_interval) {}
 
-bool KldGainStopper::ShouldStop(const IterationStats& stats, StoppersHints*) {
+bool KldGainStopper::ShouldStop(const IterationStats& stats,
+                                StoppersHints* hints) {
+  // The search samples the gain as the root visits change, so that there's
+  // nothing to go over here.
+  hints->UpdateKldGainInterval(average_interval_);
   Mutex::Lock lock(mutex_);
-  const auto new_child_nodes = stats.total_nodes - 1.0;
-  if (new_child_nodes < prev_child_nodes_ + average_interval_) return false;
-
-  const auto new_visits = stats.edge_n;
-  if (!prev_visits_.empty()) {
-    double kldgain = 0.0;
-    for (decltype(new_visits)::size_type i = 0; i < new_visits.size(); i++) {
-      double o_p = prev_visits_[i] / prev_child_nodes_;
-      double n_p = new_visits[i] / new_child_nodes;
-      if (prev_visits_[i] != 0) kldgain += o_p * log(o_p / n_p);
-    }
-    if (kldgain / (new_child_nodes - prev_child_nodes_) < min_gain_) {
-      LOGFILE << "Stopping search: KLDGain per node too small.";
-      return true;
-    }
+  if (stats.kld_gain_samples == checked_samples_) return false;
+  checked_samples_ = stats.kld_gain_samples;
+  if (stats.kld_gain_per_node < min_gain_) {
+    LOGFILE << "Stopping search: KLDGain per node too small.";
+    return true;
   }
-  prev_visits_ = new_visits;
-  prev_child_nodes_ = new_child_nodes;
   return false;
 }
 
@@ -242,17 +244,8 @@ bool SmartPruningStopper::ShouldStop(const IterationStats& stats,
   hints->UpdateEstimatedRemainingPlayouts(remaining_playouts);
   if (stats.batches_since_movestart < minimum_batches_) return false;
 
-  uint32_t largest_n = 0;
-  uint32_t second_largest_n = 0;
-  for (auto n : stats.edge_n) {
-    if (n > largest_n) {
-      second_largest_n = largest_n;
-      largest_n = n;
-    } else if (n > second_largest_n) {
-      second_largest_n = n;
-    }
-  }
-
+  const uint32_t largest_n = stats.largest_n;
+  const uint32_t second_largest_n = stats.second_largest_n;
   if (remaining_playouts < (largest_n - second_largest_n)) {
     LOGFILE << std::fixed << remaining_playouts
             << " playouts remaining. Best move has " << largest_n
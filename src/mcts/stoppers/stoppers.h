@@ -84,8 +84,14 @@ class MemoryWatchingStopper : public VisitsStopper {
  public:
   // Must be in sync with description at kRamLimitMbId.
   static constexpr size_t kAvgMovesPerPosition = 30;
+  // With @prune set, never stops but hints the search to keep its tree within
+  // the limit.
   MemoryWatchingStopper(int cache_size, int ram_limit_mb,
-                        bool populate_remaining_playouts);
+                        bool populate_remaining_playouts, bool prune = false);
+  bool ShouldStop(const IterationStats&, StoppersHints*) override;
+
+ private:
+  const bool prune_;
 };
 
 // Stops after time budget is gone.
@@ -131,8 +137,8 @@ class KldGainStopper : public SearchStopper {
   const double min_gain_;
   const int average_interval_;
   Mutex mutex_;
-  std::vector<uint32_t> prev_visits_ GUARDED_BY(mutex_);
-  double prev_child_nodes_ GUARDED_BY(mutex_) = 0.0;
+  // IterationStats::kld_gain_samples when last checked.
+  int64_t checked_samples_ GUARDED_BY(mutex_) = 0;
 };
 
 // Does many things:
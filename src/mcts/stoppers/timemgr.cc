@@ -54,14 +54,33 @@ std::optional<float> StoppersHints::GetEstimatedNps() const {
   return estimated_nps_;
 }
 
+void StoppersHints::UpdateTreeSizeLimit(int64_t v) {
+  if (!tree_size_limit_ || v < *tree_size_limit_) tree_size_limit_ = v;
+}
+
+std::optional<int64_t> StoppersHints::GetTreeSizeLimit() const {
+  return tree_size_limit_;
+}
+
+void StoppersHints::UpdateKldGainInterval(int v) {
+  if (!kld_gain_interval_ || v < *kld_gain_interval_) kld_gain_interval_ = v;
+}
+
+std::optional<int> StoppersHints::GetKldGainInterval() const {
+  return kld_gain_interval_;
+}
+
 void StoppersHints::Reset() {
-  // Slightly more than 3 years.
-  remaining_time_ms_ = 100000000000;
+  remaining_time_ms_ = kUnknownRemainingTimeMs;
   // Type for N in nodes is currently uint32_t, so set limit in order not to
   // overflow it.
   remaining_playouts_ = 4000000000;
   // NPS is not known.
   estimated_nps_.reset();
+  // No limit on the tree size.
+  tree_size_limit_.reset();
+  // No KL divergence gain sampling.
+  kld_gain_interval_.reset();
 }
 
 }  // namespace lczero
\ No newline at end of file
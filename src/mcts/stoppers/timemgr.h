@@ -44,11 +44,25 @@ struct IterationStats {
   int64_t time_since_movestart = 0;
   int64_t time_since_first_batch = 0;
   int64_t total_nodes = 0;
+  // Estimate of nodes still in the tree, as total_nodes minus the visits of
+  // pruned subtrees.
+  int64_t tree_nodes = 0;
   int64_t nodes_since_movestart = 0;
   int64_t batches_since_movestart = 0;
   int average_depth = 0;
+  // Minibatch size and collision limit currently used by the reporting search
+  // thread.
+  int target_minibatch_size = 0;
+  int collision_limit = 0;
   int mate_depth = std::numeric_limits<int>::max();
   std::vector<uint32_t> edge_n;
+  // Visits of the two most visited root children.
+  uint32_t largest_n = 0;
+  uint32_t second_largest_n = 0;
+  // KL divergence gain per node of the root visits over the last sampled
+  // interval (see KldGainInterval hint), and the number of intervals sampled.
+  double kld_gain_per_node = 0.0;
+  int64_t kld_gain_samples = 0;
 
   // TODO: remove this in favor of time_usage_hint_=kImmediateMove when
   // smooth time manager is the default.
@@ -65,8 +79,15 @@ struct IterationStats {
 // expect running out of time.
 // 2. EstimatedPlayouts -- for smart pruning at root (not pick root nodes that
 // cannot potentially become good).
+// 3. TreeSizeLimit -- for the search to prune least visited subtrees rather
+// than grow the tree past that many nodes.
+// 4. KldGainInterval -- for the search to sample the KL divergence gain of the
+// root visits every that many nodes.
 class StoppersHints {
  public:
+  // Remaining time until a stopper estimates it, slightly more than 3 years.
+  static constexpr int64_t kUnknownRemainingTimeMs = 100000000000;
+
   StoppersHints();
   void Reset();
   void UpdateEstimatedRemainingTimeMs(int64_t v);
@@ -75,11 +96,17 @@ class StoppersHints {
   int64_t GetEstimatedRemainingPlayouts() const;
   void UpdateEstimatedNps(float v);
   std::optional<float> GetEstimatedNps() const;
+  void UpdateTreeSizeLimit(int64_t v);
+  std::optional<int64_t> GetTreeSizeLimit() const;
+  void UpdateKldGainInterval(int v);
+  std::optional<int> GetKldGainInterval() const;
 
  private:
   int64_t remaining_time_ms_;
   int64_t remaining_playouts_;
   std::optional<float> estimated_nps_;
+  std::optional<int64_t> tree_size_limit_;
+  std::optional<int> kld_gain_interval_;
 };
 
 // Interface for search stopper.
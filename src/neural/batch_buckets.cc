@@ -0,0 +1,137 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "neural/batch_buckets.h"
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+
+#include "utils/exception.h"
+#include "utils/string.h"
+
+namespace lczero {
+
+ThroughputCurve ReadThroughputCurve(const std::string& filename) {
+  std::ifstream file(filename);
+  if (!file) throw Exception("Unable to read throughput curve " + filename);
+  ThroughputCurve curve;
+  int batch_size;
+  float nps;
+  while (file >> batch_size >> nps) {
+    if (batch_size > 0 && nps > 0.0f) curve.emplace_back(batch_size, nps);
+  }
+  std::sort(curve.begin(), curve.end());
+  if (curve.empty()) throw Exception("Empty throughput curve " + filename);
+  return curve;
+}
+
+void WriteThroughputCurve(const std::string& filename,
+                          const ThroughputCurve& curve) {
+  std::ofstream file(filename);
+  for (const auto& point : curve) {
+    file << point.first << " " << point.second << "\n";
+  }
+  if (!file) throw Exception("Unable to write throughput curve " + filename);
+}
+
+BatchBuckets::BatchBuckets(std::vector<int> sizes) : sizes_(std::move(sizes)) {
+  std::sort(sizes_.begin(), sizes_.end());
+  sizes_.erase(std::unique(sizes_.begin(), sizes_.end()), sizes_.end());
+  if (sizes_.empty() || sizes_.front() <= 0) {
+    throw Exception("Batch buckets need positive sizes.");
+  }
+}
+
+BatchBuckets BatchBuckets::Uniform(int max_batch_size, int count) {
+  count = std::clamp(count, 1, std::max(max_batch_size, 1));
+  std::vector<int> sizes;
+  for (int i = 0; i < count; i++) {
+    sizes.push_back(static_cast<int>(1LL * max_batch_size * (i + 1) / count));
+  }
+  return BatchBuckets(std::move(sizes));
+}
+
+BatchBuckets BatchBuckets::FromCurve(const ThroughputCurve& curve, int count) {
+  if (curve.empty()) throw Exception("Empty throughput curve.");
+  const int n = curve.size();
+  count = std::clamp(count, 1, n);
+  // A batch padded to the size of point j takes time(j), the batch sizes from
+  // point i (exclusive) to j (inclusive) padded to j cost
+  // (size(j) - size(i)) * time(j) together. cost[c][j] is the least cost of
+  // the batch sizes up to point j with c + 1 buckets, the last one at j.
+  auto size = [&](int j) { return curve[j].first; };
+  auto time = [&](int j) { return curve[j].first / curve[j].second; };
+  const double kInf = std::numeric_limits<double>::infinity();
+  std::vector<std::vector<double>> cost(count, std::vector<double>(n, kInf));
+  std::vector<std::vector<int>> prev(count, std::vector<int>(n, -1));
+  for (int j = 0; j < n; j++) cost[0][j] = 1.0 * size(j) * time(j);
+  for (int c = 1; c < count; c++) {
+    for (int j = c; j < n; j++) {
+      for (int i = c - 1; i < j; i++) {
+        const double total =
+            cost[c - 1][i] + 1.0 * (size(j) - size(i)) * time(j);
+        if (total < cost[c][j]) {
+          cost[c][j] = total;
+          prev[c][j] = i;
+        }
+      }
+    }
+  }
+  std::vector<int> sizes;
+  for (int c = count - 1, j = n - 1; j >= 0; j = prev[c][j], c--) {
+    sizes.push_back(size(j));
+  }
+  return BatchBuckets(std::move(sizes));
+}
+
+BatchBuckets BatchBuckets::FromOptions(const OptionsDict& options,
+                                       int max_batch_size, int default_steps) {
+  if (options.Exists<std::string>("buckets")) {
+    return BatchBuckets(ParseIntList(options.Get<std::string>("buckets")));
+  }
+  const int steps = options.GetOrDefault<int>("steps", default_steps);
+  if (options.Exists<std::string>("batch_curve")) {
+    auto curve = ReadThroughputCurve(options.Get<std::string>("batch_curve"));
+    curve.erase(std::remove_if(curve.begin(), curve.end(),
+                               [&](const auto& point) {
+                                 return point.first > max_batch_size;
+                               }),
+                curve.end());
+    if (!curve.empty()) return FromCurve(curve, steps);
+  }
+  return Uniform(max_batch_size, steps);
+}
+
+int BatchBuckets::Index(int batch_size) const {
+  const auto iter = std::lower_bound(sizes_.begin(), sizes_.end(), batch_size);
+  if (iter == sizes_.end()) return sizes_.size() - 1;
+  return iter - sizes_.begin();
+}
+
+}  // namespace lczero
@@ -0,0 +1,79 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "utils/optionsdict.h"
+
+namespace lczero {
+
+// Throughput of a backend by batch size, as (batch size, nodes per second)
+// in increasing batch size.
+using ThroughputCurve = std::vector<std::pair<int, float>>;
+
+// Reads a curve written by WriteThroughputCurve(). Throws Exception if the
+// file can't be read.
+ThroughputCurve ReadThroughputCurve(const std::string& filename);
+// Writes one "<batch size> <nps>" line per point.
+void WriteThroughputCurve(const std::string& filename,
+                          const ThroughputCurve& curve);
+
+// The batch sizes a backend compiles or tunes for. A batch is padded to the
+// smallest bucket that holds it, and larger ones are split at the largest.
+class BatchBuckets {
+ public:
+  // @count buckets of equal steps up to @max_batch_size.
+  static BatchBuckets Uniform(int max_batch_size, int count);
+  // The @count buckets of @curve which waste the least time on padding for
+  // batch sizes evenly spread up to the largest point of the curve. The
+  // largest point is always a bucket.
+  static BatchBuckets FromCurve(const ThroughputCurve& curve, int count);
+  // From the backend options: a "buckets" list of sizes, or the "steps"
+  // buckets chosen from the curve in the "batch_curve" file, or else
+  // Uniform(@max_batch_size, steps).
+  static BatchBuckets FromOptions(const OptionsDict& options,
+                                  int max_batch_size, int default_steps);
+
+  const std::vector<int>& sizes() const { return sizes_; }
+  int max() const { return sizes_.back(); }
+  // Index of the bucket for @batch_size, the largest one if none holds it.
+  int Index(int batch_size) const;
+  // The bucket for @batch_size.
+  int Snap(int batch_size) const { return sizes_[Index(batch_size)]; }
+
+ private:
+  explicit BatchBuckets(std::vector<int> sizes);
+
+  std::vector<int> sizes_;
+};
+
+}  // namespace lczero
@@ -0,0 +1,75 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "neural/batch_buckets.h"
+
+#include <gtest/gtest.h>
+
+namespace lczero {
+
+TEST(BatchBuckets, Uniform) {
+  const auto buckets = BatchBuckets::Uniform(100, 4);
+  EXPECT_EQ(buckets.sizes(), std::vector<int>({25, 50, 75, 100}));
+  EXPECT_EQ(buckets.Snap(1), 25);
+  EXPECT_EQ(buckets.Snap(26), 50);
+  EXPECT_EQ(buckets.Snap(100), 100);
+  EXPECT_EQ(buckets.Snap(150), 100);
+  EXPECT_EQ(buckets.Index(75), 2);
+}
+
+TEST(BatchBuckets, FromCurveKeepsLargest) {
+  const ThroughputCurve curve = {{16, 1000.0f}, {32, 2000.0f}, {64, 3000.0f}};
+  EXPECT_EQ(BatchBuckets::FromCurve(curve, 1).sizes(), std::vector<int>({64}));
+  EXPECT_EQ(BatchBuckets::FromCurve(curve, 3).sizes(),
+            std::vector<int>({16, 32, 64}));
+  EXPECT_EQ(BatchBuckets::FromCurve(curve, 10).sizes(),
+            std::vector<int>({16, 32, 64}));
+}
+
+TEST(BatchBuckets, FromCurveSkipsFlatPart) {
+  // Batches up to 128 take the same time, so buckets below 128 save nothing.
+  // Beyond, the time doubles with the batch size: {512, 1024} cost
+  // 512 * 0.4 + 512 * 0.8 for the batch sizes up to 1024, less than
+  // {128, 1024} with 128 * 0.1 + 896 * 0.8.
+  const ThroughputCurve curve = {{32, 320.0f},   {64, 640.0f},
+                                 {128, 1280.0f}, {256, 1280.0f},
+                                 {512, 1280.0f}, {1024, 1280.0f}};
+  EXPECT_EQ(BatchBuckets::FromCurve(curve, 2).sizes(),
+            std::vector<int>({512, 1024}));
+  EXPECT_EQ(BatchBuckets::FromCurve(curve, 3).sizes(),
+            std::vector<int>({256, 512, 1024}));
+  EXPECT_EQ(BatchBuckets::FromCurve(curve, 4).sizes(),
+            std::vector<int>({128, 256, 512, 1024}));
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
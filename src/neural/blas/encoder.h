@@ -21,6 +21,7 @@
 #include <cmath>
 
 #include "neural/shared/activation.h"
+#include "utils/cppattributes.h"
 
 #ifdef USE_ISPC
 #include "layer_norm_ispc.h"
@@ -28,6 +29,7 @@
 
 namespace lczero {
 
+SIMD_CLONES
 void LayerNorm2DWithSkipConnection(const size_t batch_size,
                                    const size_t channels, float* data,
                                    const float alpha, const float* skip,
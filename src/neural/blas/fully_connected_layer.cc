@@ -23,6 +23,9 @@
 #include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
 
 #include <Eigen/Dense>
 
@@ -35,8 +38,43 @@ void ApplyBias(size_t batch_size, const size_t output_size, const float* biases,
     Activate(output_size, batch_outputs, biases, batch_outputs, activation);
   }
 }
+
+std::shared_mutex packed_weights_mutex;
+std::unordered_map<const float*, const float*> packed_weights;
 }  // namespace
 
+PackedWeights::PackedWeights([[maybe_unused]] const size_t input_size,
+                             [[maybe_unused]] const size_t output_size,
+                             const float* weights,
+                             [[maybe_unused]] const size_t max_batch_size)
+    : weights_(weights) {
+#ifdef USE_MKL
+  // Same operand as in Forward1D(), the transposed weights as matrix A.
+  const auto size = cblas_sgemm_pack_get_size(
+      CblasAMatrix, (int)output_size, (int)max_batch_size, (int)input_size);
+  packed_ = static_cast<float*>(mkl_malloc(size, 64));
+  cblas_sgemm_pack(CblasColMajor, CblasAMatrix, CblasTrans, (int)output_size,
+                   (int)max_batch_size, (int)input_size, 1.0f, weights,
+                   (int)input_size, packed_);
+  std::unique_lock<std::shared_mutex> lock(packed_weights_mutex);
+  packed_weights[weights_] = packed_;
+#endif
+}
+
+PackedWeights::~PackedWeights() {
+#ifdef USE_MKL
+  std::unique_lock<std::shared_mutex> lock(packed_weights_mutex);
+  packed_weights.erase(weights_);
+  mkl_free(packed_);
+#endif
+}
+
+const float* PackedWeights::Find(const float* weights) {
+  std::shared_lock<std::shared_mutex> lock(packed_weights_mutex);
+  auto it = packed_weights.find(weights);
+  return it == packed_weights.end() ? nullptr : it->second;
+}
+
 template <typename T>
 using EigenVectorMap = Eigen::Map<Eigen::Matrix<T, Eigen::Dynamic, 1>>;
 template <typename T>
@@ -90,6 +128,18 @@ void FullyConnectedLayer<false>::Forward1D(
     // passing a matrix A[m][n], the value should be m.
     //    cblas_sgemm(CblasRowMajor, TransA, TransB, M, N, K, alpha, A, lda, B,
     //                ldb, beta, C, N);
+#ifdef USE_MKL
+    if (const float* packed = PackedWeights::Find(weights)) {
+      cblas_sgemm_compute(CblasColMajor, CblasPacked, CblasNoTrans,
+                          (int)output_size, (int)batch_size, (int)input_size,
+                          packed, (int)input_size, inputs, (int)input_size,
+                          0.0f, outputs, (int)output_size);
+      if (biases != nullptr) {
+        ApplyBias(batch_size, output_size, biases, activation, outputs);
+      }
+      return;
+    }
+#endif
     cblas_sgemm(CblasColMajor, CblasTrans, CblasNoTrans,
                 (int)output_size,   // M
                 (int)batch_size,    // N
@@ -42,4 +42,24 @@ class FullyConnectedLayer {
 
 };
 
+// Weights of a fully connected layer packed once into the internal GEMM format
+// of MKL, which otherwise repacks them on every call. While it lives, the
+// batched Forward1D() calls with the original weights use the packed copy.
+// Nothing is packed with other BLAS libraries.
+class PackedWeights {
+ public:
+  PackedWeights(const size_t input_size, const size_t output_size,
+                const float* weights, const size_t max_batch_size);
+  ~PackedWeights();
+  PackedWeights(const PackedWeights&) = delete;
+  PackedWeights& operator=(const PackedWeights&) = delete;
+
+  // Returns the packed copy of @weights, or nullptr if there is none.
+  static const float* Find(const float* weights);
+
+ private:
+  const float* weights_;
+  float* packed_ = nullptr;
+};
+
 }  // namespace lczero
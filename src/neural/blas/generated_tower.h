@@ -0,0 +1,120 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "neural/blas/winograd_convolution3.h"
+#include "neural/network_legacy.h"
+#include "neural/shared/activation.h"
+
+namespace lczero {
+
+// Residual towers specialized for a single network architecture, as emitted
+// by "lc0 codegen" and built into the blas backends with the
+// generated_towers build option. Their shapes are compile time constants and
+// their blocks are unrolled, so the per-block branches and size lookups of
+// the generic loop are gone. A blas network runs the tower registered for
+// its architecture, if any, in place of that loop.
+
+// The architecture a generated tower was emitted for.
+struct TowerShape {
+  size_t filters;
+  ActivationFunction activation;
+  // Output size of the first SE layer of each block, 0 for blocks without SE.
+  std::vector<size_t> se_channels;
+
+  bool operator==(const TowerShape& other) const {
+    return filters == other.filters && activation == other.activation &&
+           se_channels == other.se_channels;
+  }
+};
+
+inline TowerShape GetTowerShape(const LegacyWeights& weights,
+                                ActivationFunction activation) {
+  TowerShape shape{weights.input.biases.size(), activation, {}};
+  for (const auto& residual : weights.residual) {
+    shape.se_channels.push_back(residual.has_se ? residual.se.b1.size() : 0);
+  }
+  return shape;
+}
+
+// Runs the input convolution and the residual tower on the encoded planes in
+// @buffer1, leaving the tower output in @buffer2. All buffers are sized as
+// for the generic loop.
+template <bool use_eigen>
+using GeneratedTower = void (*)(const LegacyWeights& weights,
+                                size_t batch_size,
+                                WinogradConvolution3<use_eigen>* convolve3,
+                                float* buffer1, float* buffer2,
+                                float* buffer3);
+
+template <bool use_eigen>
+class GeneratedTowers {
+ public:
+  // Returns the tower for @shape, or nullptr if none was built in.
+  static GeneratedTower<use_eigen> Find(const TowerShape& shape) {            \
+    for (const auto& entry : Get()) {
+      if (entry.first == shape) return entry.second;
+    }
+    return nullptr;
+  }
+
+  struct Registration {
+    Registration(TowerShape shape, GeneratedTower<use_eigen> tower) {
+      Get().emplace_back(std::move(shape), tower);
+    }
+  };
+
+ private:
+  static std::vector<std::pair<TowerShape, GeneratedTower<use_eigen>>>& Get() {
+    static std::vector<std::pair<TowerShape, GeneratedTower<use_eigen>>>
+        towers;
+    return towers;
+  }
+};
+
+#define REGISTER_GENERATED_TOWER_WITH_COUNTER2(shape, tower, counter)         \
+  namespace {                                                                 \
+  static GeneratedTowers<false>::Registration regBlasTower##counter(          \
+      shape, tower<false>);                                                   \
+  static GeneratedTowers<true>::Registration regEigenTower##counter(          \
+      shape, tower<true>);                                                    \
+  }
+#define REGISTER_GENERATED_TOWER_WITH_COUNTER(shape, tower, counter) \
+  REGISTER_GENERATED_TOWER_WITH_COUNTER2(shape, tower, counter)
+
+// Registers a generated tower for both blas variants.
+// @shape -- TowerShape the tower was generated for.
+// @tower -- function template on use_eigen matching GeneratedTower.
+#define REGISTER_GENERATED_TOWER(shape, tower) \
+  REGISTER_GENERATED_TOWER_WITH_COUNTER(shape, tower, __LINE__)
+
+}  // namespace lczero
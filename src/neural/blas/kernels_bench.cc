@@ -0,0 +1,329 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+// Microbenchmarks of the CPU kernels of the BLAS backend at the shapes of
+// common networks, to catch regressions of single kernels which end-to-end
+// backendbench numbers hide. Run with "meson test --benchmark", or directly:
+//   kernels_bench [--filter=<substring>] [--min-time=<seconds>]
+//                 [--json=<file>]
+// Kernels using Eigen are named "eigen", the ones using the BLAS library the
+// backend was built with "blas".
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "neural/blas/convolution1.h"
+#include "neural/blas/fully_connected_layer.h"
+#include "neural/blas/se_unit.h"
+#include "neural/blas/winograd_convolution3.h"
+#include "neural/shared/activation.h"
+
+namespace lczero {
+namespace {
+
+constexpr size_t kSquares = 64;
+constexpr size_t kWinogradTile = 16;
+
+std::vector<float> RandomVector(size_t size) {
+  std::mt19937 gen(size);
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  std::vector<float> result(size);
+  for (auto& x : result) x = dist(gen);
+  return result;
+}
+
+struct KernelBenchmark {
+  std::string name;
+  // Positions per call and floating point operations per call, 0 if not
+  // meaningful.
+  size_t batch;
+  double flops;
+  // Called once, returns the function to time. The buffers live in its
+  // closure.
+  std::function<std::function<void()>()> setup;
+};
+
+struct KernelResult {
+  std::string name;
+  size_t batch;
+  int iterations;
+  double median_us;
+  double min_us;
+  double gflops;
+};
+
+// Times @benchmark for at least @min_time, after a warm-up call.
+KernelResult Run(const KernelBenchmark& benchmark, double min_time) {
+  const auto run = benchmark.setup();
+  run();
+  std::vector<double> times;
+  double total = 0;
+  while (total < min_time || times.size() < 5) {
+    const auto start = std::chrono::steady_clock::now();
+    run();
+    const double seconds = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+    times.push_back(seconds);
+    total += seconds;
+  }
+  std::sort(times.begin(), times.end());
+  const double median = times[times.size() / 2];
+  return {benchmark.name,
+          benchmark.batch,
+          static_cast<int>(times.size()),
+          median * 1e6,
+          times.front() * 1e6,
+          benchmark.flops / median / 1e9};
+}
+
+// Residual tower of 128x10, 256x20 and 512x15 networks at batch sizes of a
+// single position and of typical CPU minibatches.
+const std::vector<int> kFilters = {128, 256, 512};
+const std::vector<int> kBatches = {1, 16, 64};
+
+template <bool use_eigen>
+void AddKernelBenchmarks(const std::string& variant,
+                         std::vector<KernelBenchmark>* benchmarks) {
+  auto name = [&](const std::string& kernel, std::vector<size_t> args) {
+    std::string result = kernel + "/" + variant;
+    for (const auto arg : args) result += "/" + std::to_string(arg);
+    return result;
+  };
+
+  for (const size_t channels : kFilters) {
+    for (const size_t batch : kBatches) {
+      const double flops = 2.0 * batch * kSquares * 9 * channels * channels;
+      benchmarks->push_back(
+          {name("WinogradConvolution3", {batch, channels}), batch, flops,
+           [=]() -> std::function<void()> {
+             auto convolution =
+                 std::make_shared<WinogradConvolution3<use_eigen>>(
+                     batch, channels, channels);
+             auto input = RandomVector(batch * channels * kSquares);
+             auto weights = RandomVector(kWinogradTile * channels * channels);
+             std::vector<float> output(batch * channels * kSquares);
+             return [=]() mutable {
+               convolution->Forward(batch, channels, channels, input.data(),
+                                    weights.data(), output.data());
+             };
+           }});
+      // The fused variant of residual blocks: convolution, bias, residual and
+      // ReLU.
+      benchmarks->push_back(
+          {name("WinogradConvolution3Fused", {batch, channels}), batch, flops,
+           [=]() -> std::function<void()> {
+             auto convolution =
+                 std::make_shared<WinogradConvolution3<use_eigen>>(
+                     batch, channels, channels);
+             auto input = RandomVector(batch * channels * kSquares);
+             auto weights = RandomVector(kWinogradTile * channels * channels);
+             auto biases = RandomVector(channels);
+             auto residual = RandomVector(batch * channels * kSquares);
+             std::vector<float> output(batch * channels * kSquares);
+             return [=]() mutable {
+               convolution->Forward(batch, channels, channels, input.data(),
+                                    weights.data(), output.data(),
+                                    biases.data(), ACTIVATION_RELU,
+                                    residual.data());
+             };
+           }});
+    }
+  }
+
+  // Policy and value head 1x1 convolutions.
+  for (const size_t input_channels : kFilters) {
+    for (const size_t batch : {1, 64}) {
+      for (const size_t output_channels : {size_t{32}, input_channels}) {
+        benchmarks->push_back(
+            {name("Convolution1", {batch, input_channels, output_channels}),
+             batch, 2.0 * batch * kSquares * input_channels * output_channels,
+             [=]() -> std::function<void()> {
+               auto input = RandomVector(batch * input_channels * kSquares);
+               auto weights = RandomVector(input_channels * output_channels);
+               std::vector<float> output(batch * output_channels * kSquares);
+               return [=]() mutable {
+                 Convolution1<use_eigen>::Forward(
+                     batch, input_channels, output_channels, input.data(),
+                     weights.data(), output.data());
+               };
+             }});
+      }
+    }
+  }
+
+  // Value head layers.
+  for (const size_t batch : {1, 64}) {
+    for (const auto& [inputs, outputs] :
+         {std::pair<size_t, size_t>{32 * kSquares, 128}, {128, 3}}) {
+      benchmarks->push_back(
+          {name("FullyConnected", {batch, inputs, outputs}), batch,
+           2.0 * batch * inputs * outputs, [=]() -> std::function<void()> {
+             auto input = RandomVector(batch * inputs);
+             auto weights = RandomVector(inputs * outputs);
+             auto biases = RandomVector(outputs);
+             std::vector<float> output(batch * outputs);
+             return [=]() mutable {
+               FullyConnectedLayer<use_eigen>::Forward1D(
+                   batch, inputs, outputs, input.data(), weights.data(),
+                   biases.data(), ACTIVATION_RELU, output.data());
+             };
+           }});
+    }
+  }
+
+  // SE units with a ratio of 4.
+  for (const size_t channels : kFilters) {
+    for (const size_t batch : {1, 64}) {
+      const size_t se_outputs = channels / 4;
+      benchmarks->push_back(
+          {name("SEUnit", {batch, channels, se_outputs}), batch, 0.0,
+           [=]() -> std::function<void()> {
+             auto input = RandomVector(batch * channels * kSquares);
+             auto biases = RandomVector(channels);
+             auto residual = RandomVector(batch * channels * kSquares);
+             auto w1 = RandomVector(channels * se_outputs);
+             auto b1 = RandomVector(se_outputs);
+             auto w2 = RandomVector(2 * channels * se_outputs);
+             auto b2 = RandomVector(2 * channels);
+             std::vector<float> output(batch * channels * kSquares);
+             return [=]() mutable {
+               ApplySEUnit<use_eigen>(batch, channels, se_outputs,
+                                      input.data(), biases.data(),
+                                      residual.data(), w1.data(), b1.data(),
+                                      w2.data(), b2.data(), output.data(),
+                                      ACTIVATION_RELU);
+             };
+           }});
+    }
+  }
+}
+
+void AddActivationBenchmarks(std::vector<KernelBenchmark>* benchmarks) {
+  const size_t batch = 64;
+  const size_t channels = 256;
+  for (const auto& [activation, name] :
+       {std::pair{ACTIVATION_RELU, "relu"}, {ACTIVATION_MISH, "mish"},
+        {ACTIVATION_SWISH, "swish"}, {ACTIVATION_SELU, "selu"}}) {
+    benchmarks->push_back(
+        {std::string("BiasActivate/") + name + "/64/256", batch, 0.0,
+         [=]() -> std::function<void()> {
+           auto data = RandomVector(batch * channels * kSquares);
+           auto biases = RandomVector(channels);
+           return [=]() mutable {
+             BiasActivate(batch, channels, data.data(), biases.data(),
+                          activation);
+           };
+         }});
+  }
+  benchmarks->push_back(
+      {"BiasResidual/relu/64/256", batch, 0.0, [=]() -> std::function<void()> {
+         auto data = RandomVector(batch * channels * kSquares);
+         auto biases = RandomVector(channels);
+         auto residual = RandomVector(batch * channels * kSquares);
+         return [=]() mutable {
+           BiasResidual(batch, channels, data.data(), biases.data(),
+                        residual.data(), ACTIVATION_RELU);
+         };
+       }});
+}
+
+void WriteJson(const std::string& filename,
+               const std::vector<KernelResult>& results) {
+  std::ofstream out(filename);
+  out << "{\"benchmarks\": [";
+  for (size_t i = 0; i < results.size(); i++) {
+    const auto& r = results[i];
+    out << (i ? ",\n  " : "\n  ") << "{\"name\": \"" << r.name
+        << "\", \"batch\": " << r.batch << ", \"iterations\": " << r.iterations
+        << ", \"median_us\": " << r.median_us << ", \"min_us\": " << r.min_us
+        << ", \"gflops\": " << r.gflops << "}";
+  }
+  out << "\n]}\n";
+}
+
+int Main(int argc, char** argv) {
+  std::string filter;
+  std::string json;
+  double min_time = 0.2;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    auto value = [&](const std::string& flag) {
+      return arg.rfind(flag + "=", 0) == 0 ? arg.substr(flag.size() + 1)
+                                           : std::string();
+    };
+    if (!value("--filter").empty()) {
+      filter = value("--filter");
+    } else if (!value("--json").empty()) {
+      json = value("--json");
+    } else if (!value("--min-time").empty()) {
+      min_time = std::stod(value("--min-time"));
+    } else {
+      std::fprintf(stderr,
+                   "Usage: %s [--filter=<substring>] [--min-time=<seconds>] "
+                   "[--json=<file>]\n",
+                   argv[0]);
+      return 1;
+    }
+  }
+
+  std::vector<KernelBenchmark> benchmarks;
+  AddKernelBenchmarks<true>("eigen", &benchmarks);
+#ifdef USE_BLAS
+  AddKernelBenchmarks<false>("blas", &benchmarks);
+#endif
+  AddActivationBenchmarks(&benchmarks);
+
+  std::vector<KernelResult> results;
+  std::printf("%-48s %10s %12s %12s %10s %12s\n", "kernel", "iterations",
+              "median_us", "min_us", "gflops", "positions/s");
+  for (const auto& benchmark : benchmarks) {
+    if (benchmark.name.find(filter) == std::string::npos) continue;
+    const auto result = Run(benchmark, min_time);
+    std::printf("%-48s %10d %12.1f %12.1f %10.2f %12.0f\n",
+                result.name.c_str(), result.iterations, result.median_us,
+                result.min_us, result.gflops,
+                result.batch * 1e6 / result.median_us);
+    std::fflush(stdout);
+    results.push_back(result);
+  }
+  if (!json.empty()) WriteJson(json, results);
+  return 0;
+}
+
+}  // namespace
+}  // namespace lczero
+
+int main(int argc, char** argv) { return lczero::Main(argc, argv); }
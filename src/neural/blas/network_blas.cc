@@ -18,14 +18,22 @@
 
 #include <Eigen/Core>
 #include <algorithm>
+#include <array>
 #include <cassert>
 #include <cmath>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
 
 #include "neural/blas/blas.h"
 #include "neural/blas/convolution1.h"
 #include "neural/blas/encoder.h"
 #include "neural/blas/fully_connected_layer.h"
+#include "neural/blas/generated_tower.h"
 #include "neural/blas/se_unit.h"
 #include "neural/blas/winograd_convolution3.h"
 #include "neural/factory.h"
@@ -33,9 +41,11 @@
 #include "neural/network_legacy.h"
 #include "neural/shared/activation.h"
 #include "neural/shared/attention_policy_map.h"
-#include "neural/shared/policy_map.h"
+#include "neural/shared/buffer_planner.h"
+#include "neural/shared/policy.h"
 #include "neural/shared/winograd_filter.h"
 #include "utils/numa.h"
+#include "utils/threadpool.h"
 
 #ifdef USE_DNNL
 #include <omp.h>
@@ -48,11 +58,18 @@
 namespace lczero {
 namespace {
 
+// The weights of a blas network, converted for the backend. Immutable once
+// built, they are shared by the networks of a process loading the same file.
+struct BlasWeights {
+  explicit BlasWeights(const pblczero::Weights& weights) : weights(weights) {}
+  LegacyWeights weights;
+  // Packed copies of the encoder GEMM weights, with MKL.
+  std::vector<std::unique_ptr<PackedWeights>> packed;
+};
+
+// Working memory of a computation slice, laid out by a BufferPlanner.
 struct Buffers {
-  std::vector<float> buffer1;
-  std::vector<float> buffer2;
-  std::vector<float> buffer3;
-  std::vector<float> buffer4;
+  std::vector<float> arena;
 };
 
 template <bool use_eigen>
@@ -114,11 +131,18 @@ class BlasComputation : public NetworkComputation {
   }
 
  private:
+  // Computes the samples from @begin to @end of the batch, with buffers of
+  // its own so that slices can run in parallel.
+  void ComputeSlice(size_t begin, size_t end);
   void EncodePlanes(const InputPlanes& sample, float* buffer);
-  void MakeEncoderLayer(std::vector<float>& head_buffer,
-                        std::vector<float>& head_buffer2,
-                        std::vector<float>& head_buffer3,
-                        std::vector<float>& head_buffer4, size_t batch_size,
+  // Sizes of the four buffers MakeEncoderLayer() works in, for
+  // @batch_size samples.
+  static std::array<size_t, 4> EncoderBufferSizes(
+      const LegacyWeights::EncoderLayer& layer, size_t embedding_size,
+      int heads, size_t batch_size);
+  void MakeEncoderLayer(float* head_buffer, float* head_buffer2,
+                        float* head_buffer3, float* head_buffer4,
+                        size_t batch_size,
                         const LegacyWeights::EncoderLayer& layer,
                         int embedding_size, int heads,
                         ActivationFunction smolgen_activation,
@@ -158,7 +182,8 @@ class BlasNetwork : public Network {
 
   std::unique_ptr<NetworkComputation> NewComputation() override {
     return std::make_unique<BlasComputation<use_eigen>>(
-        this, weights_, max_batch_size_, wdl_, moves_left_, conv_policy_,
+        this, weights_->weights, max_batch_size_, wdl_, moves_left_,
+        conv_policy_,
         default_activation_, smolgen_activation_, ffn_activation_, attn_policy_,
         attn_body_);
   }
@@ -167,7 +192,7 @@ class BlasNetwork : public Network {
     return capabilities_;
   }
 
-  int GetMiniBatchSize() const override { return 7; }
+  int GetMiniBatchSize() const override { return 7 * batch_threads_; }
 
   bool IsCpu() const override { return true; }
 
@@ -189,12 +214,20 @@ class BlasNetwork : public Network {
     free_buffers_.push_back(std::move(buffers));
   }
 
+  // Number of threads a batch is split across.
+  int GetBatchThreads() const { return batch_threads_; }
+  ThreadPool* GetThreadPool() { return &thread_pool_; }
+  // The tower generated for this architecture, nullptr if none was built in.
+  GeneratedTower<use_eigen> GetGeneratedTower() const {
+    return generated_tower_;
+  }
+
  private:
   // A cap on the max batch size since it consumes a lot of memory
   static constexpr auto kHardMaxBatchSize = 2048;
 
   const NetworkCapabilities capabilities_;
-  LegacyWeights weights_;
+  std::shared_ptr<const BlasWeights> weights_;
   size_t max_batch_size_;
   bool wdl_;
   bool moves_left_;
@@ -204,8 +237,11 @@ class BlasNetwork : public Network {
   ActivationFunction ffn_activation_;
   bool attn_policy_;
   bool attn_body_;
+  GeneratedTower<use_eigen> generated_tower_ = nullptr;
+  int batch_threads_;
   std::mutex buffers_lock_;
   std::vector<std::unique_ptr<Buffers>> free_buffers_;
+  ThreadPool thread_pool_;
 };
 
 template <bool use_eigen>
@@ -256,14 +292,37 @@ void vec_adjust(std::vector<float>& vec, size_t size) {
   }
 }
 
+template <bool use_eigen>
+std::array<size_t, 4> BlasComputation<use_eigen>::EncoderBufferSizes(
+    const LegacyWeights::EncoderLayer& layer, size_t embedding_size, int heads,
+    size_t batch_size) {
+  const size_t d_model = layer.mha.k_b.size();
+  const size_t dff_size = layer.ffn.dense1_b.size();
+  const size_t hidden_channels =
+      layer.mha.has_smolgen ? layer.mha.smolgen.compress.size() / embedding_size
+                            : 0;
+  const size_t hidden_sz =
+      layer.mha.has_smolgen ? layer.mha.smolgen.dense1_b.size() : 0;
+  const size_t gen_sz_outputs =
+      layer.mha.has_smolgen ? layer.mha.smolgen.dense2_b.size() : 0;
+  return {
+      batch_size * std::max(d_model, embedding_size) * kSquares,
+      batch_size * std::max(std::max(d_model, hidden_channels) * kSquares,
+                            gen_sz_outputs),
+      batch_size * std::max(std::max(3 * d_model, embedding_size) * kSquares,
+                            hidden_sz),
+      batch_size * kSquares *
+          std::max(kSquares * static_cast<size_t>(heads), dff_size)};
+}
+
 template <bool use_eigen>
 void BlasComputation<use_eigen>::MakeEncoderLayer(
-    std::vector<float>& head_buffer, std::vector<float>& head_buffer2,
-    std::vector<float>& head_buffer3, std::vector<float>& head_buffer4,
-    size_t batch_size, const LegacyWeights::EncoderLayer& layer,
+    float* head_buffer, float* head_buffer2, float* head_buffer3,
+    float* head_buffer4, size_t batch_size,
+    const LegacyWeights::EncoderLayer& layer,
     int embedding_size, int heads, ActivationFunction smolgen_activation,
     ActivationFunction ffn_activation, float alpha) {
-  const int d_model = layer.mha.q_b.size();
+  const int d_model = layer.mha.k_b.size();
   const int dff_size = layer.ffn.dense1_b.size();
   const int hidden_channels =
       layer.mha.has_smolgen ? layer.mha.smolgen.compress.size() / embedding_size
@@ -273,18 +332,6 @@ void BlasComputation<use_eigen>::MakeEncoderLayer(
   const int gen_sz_outputs =
       layer.mha.has_smolgen ? layer.mha.smolgen.dense2_b.size() : 0;
 
-  const int largest_batch_size = std::min(max_batch_size_, planes_.size());
-
-  vec_adjust(head_buffer, largest_batch_size * d_model * kSquares);
-  vec_adjust(head_buffer2,
-             largest_batch_size *
-                 std::max(std::max(d_model, hidden_channels) * kSquares,
-                          gen_sz_outputs));
-  vec_adjust(head_buffer3,
-             largest_batch_size * std::max(d_model * kSquares, hidden_sz));
-  vec_adjust(head_buffer4,
-             batch_size * kSquares * std::max(kSquares * heads, dff_size));
-
   // Smolgen.
   if (layer.mha.has_smolgen) {
     const float* input = &head_buffer[0];
@@ -294,47 +341,45 @@ void BlasComputation<use_eigen>::MakeEncoderLayer(
     FullyConnectedLayer<use_eigen>::Forward1D(
         batch_size * kSquares, embedding_size, hidden_channels, input,
         layer.mha.smolgen.compress.data(), (const float*)nullptr,
-        ACTIVATION_NONE, head_buffer2.data());
+        ACTIVATION_NONE, head_buffer2);
 
     // Dense 1.
     FullyConnectedLayer<use_eigen>::Forward1D(
-        batch_size, kSquares * hidden_channels, hidden_sz, head_buffer2.data(),
+        batch_size, kSquares * hidden_channels, hidden_sz, head_buffer2,
         layer.mha.smolgen.dense1_w.data(), layer.mha.smolgen.dense1_b.data(),
-        smolgen_activation, head_buffer3.data());
+        smolgen_activation, head_buffer3);
     // Layer Norm + skip connection.
-    LayerNorm2DWithSkipConnection(batch_size, hidden_sz, head_buffer3.data(),
+    LayerNorm2DWithSkipConnection(batch_size, hidden_sz, head_buffer3,
                                   0.0f, (const float*)nullptr,
                                   layer.mha.smolgen.ln1_gammas.data(),
                                   layer.mha.smolgen.ln1_betas.data(), 1e-3);
 
     // Dense 2.
     FullyConnectedLayer<use_eigen>::Forward1D(
-        batch_size, hidden_sz, gen_sz_outputs, head_buffer3.data(),
+        batch_size, hidden_sz, gen_sz_outputs, head_buffer3,
         layer.mha.smolgen.dense2_w.data(), layer.mha.smolgen.dense2_b.data(),
-        smolgen_activation, head_buffer2.data());
+        smolgen_activation, head_buffer2);
     // Layer Norm + skip connection.
     LayerNorm2DWithSkipConnection(
-        batch_size, gen_sz_outputs, head_buffer2.data(), 0.0f,
+        batch_size, gen_sz_outputs, head_buffer2, 0.0f,
         (const float*)nullptr, layer.mha.smolgen.ln2_gammas.data(),
         layer.mha.smolgen.ln2_betas.data(), 1e-3);
 
     // Global smolgen weights.
     FullyConnectedLayer<use_eigen>::Forward1D(
         batch_size * heads, gen_sz_outputs / heads, kSquares * kSquares,
-        head_buffer2.data(), weights_.smolgen_w.data(), (const float*)nullptr,
+        head_buffer2, weights_.smolgen_w.data(), (const float*)nullptr,
         ACTIVATION_NONE, QK);
   }
 
-  // Q
+  // Q, K and V in a single GEMM: the network constructor concatenates the
+  // three projections into q_w and q_b, so each row of head_buffer3 holds the
+  // query, key and value of one square.
+  const int qkv_size = 3 * d_model;
   FullyConnectedLayer<use_eigen>::Forward1D(
-      batch_size * kSquares, embedding_size, d_model, head_buffer.data(),
+      batch_size * kSquares, embedding_size, qkv_size, head_buffer,
       layer.mha.q_w.data(), layer.mha.q_b.data(), ACTIVATION_NONE,
-      head_buffer2.data());
-  // K
-  FullyConnectedLayer<use_eigen>::Forward1D(
-      batch_size * kSquares, embedding_size, d_model, head_buffer.data(),
-      layer.mha.k_w.data(), layer.mha.k_b.data(), ACTIVATION_NONE,
-      head_buffer3.data());
+      head_buffer3);
 
   // MHA (Q, K, V)
   const int depth = d_model / heads;
@@ -342,12 +387,12 @@ void BlasComputation<use_eigen>::MakeEncoderLayer(
 
   // MHA is done per batch since there's a fourth dimension introduced.
   for (auto batch = size_t{0}; batch < batch_size; batch++) {
-    auto batchStart = batch * kSquares * d_model;
+    auto batchStart = batch * kSquares * qkv_size;
 
     float* QK = &head_buffer4[batch * kSquares * kSquares * heads];
 
-    const float* Q = &head_buffer2[batchStart];
-    const float* K = &head_buffer3[batchStart];
+    const float* Q = &head_buffer3[batchStart];
+    const float* K = &head_buffer3[batchStart + d_model];
 
     // matmul(Q, K) for all heads per batch.
 
@@ -362,14 +407,14 @@ void BlasComputation<use_eigen>::MakeEncoderLayer(
             beta * C_mat +
             scaling *
                 ConstEigenStridedMatrixMap<float>(
-                    B, depth, kSquares, Eigen::OuterStride<>(heads * depth))
+                    B, depth, kSquares, Eigen::OuterStride<>(qkv_size))
                     .transpose() *
                 ConstEigenStridedMatrixMap<float>(
-                    A, depth, kSquares, Eigen::OuterStride<>(heads * depth));
+                    A, depth, kSquares, Eigen::OuterStride<>(qkv_size));
       } else {
 #ifdef USE_BLAS
         cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, kSquares, kSquares,
-                    depth, scaling, A, heads * depth, B, heads * depth, beta, C,
+                    depth, scaling, A, qkv_size, B, qkv_size, beta, C,
                     kSquares);
 #else
         // Should never get here.
@@ -381,28 +426,32 @@ void BlasComputation<use_eigen>::MakeEncoderLayer(
 
   // Apply Softmax.
   float* QK = &head_buffer4[0];
-  for (size_t h = 0; h < batch_size * heads * kSquares * kSquares;
-       h += kSquares) {
+  const size_t qk_rows = batch_size * heads * kSquares;
+  if (use_eigen) {
+    // Each row of QK is a column here, so Eigen can vectorize the exp and the
+    // reductions over all the rows at once.
+    auto QK_arr = Eigen::Map<Eigen::Array<float, kSquares, Eigen::Dynamic>>(
+        QK, kSquares, qk_rows);
+    const Eigen::Array<float, 1, Eigen::Dynamic> max =
+        QK_arr.colwise().maxCoeff();
+    QK_arr = (QK_arr.rowwise() - max).exp();
+    const Eigen::Array<float, 1, Eigen::Dynamic> sum = QK_arr.colwise().sum();
+    QK_arr.rowwise() /= sum;
+  } else {
+    for (size_t h = 0; h < qk_rows * kSquares; h += kSquares) {
 #if defined(USE_ISPC)
-    if (!use_eigen) {
       ispc::SoftmaxActivation(kSquares, QK + h, QK + h);
-      continue;
-    }
+#else
+      SoftmaxActivation(kSquares, QK + h, QK + h);
 #endif
-    SoftmaxActivation(kSquares, QK + h, QK + h);
+    }
   }
 
-  // V
-  FullyConnectedLayer<use_eigen>::Forward1D(
-      batch_size * kSquares, embedding_size, d_model, head_buffer.data(),
-      layer.mha.v_w.data(), layer.mha.v_b.data(), ACTIVATION_NONE,
-      head_buffer3.data());
-
   for (auto batch = size_t{0}; batch < batch_size; batch++) {
     auto batchStart = batch * kSquares * d_model;
     // matmul(softmax(QK), V) for all heads per batch.
     float* attn = &head_buffer2[batchStart];
-    const float* V = &head_buffer3[batchStart];
+    const float* V = &head_buffer3[batch * kSquares * qkv_size + 2 * d_model];
     const float* QK = &head_buffer4[batch * kSquares * kSquares * heads];
     for (auto h = 0; h < heads; h++) {
       const float* A = &QK[h * kSquares * kSquares];
@@ -410,16 +459,16 @@ void BlasComputation<use_eigen>::MakeEncoderLayer(
       float* C = &attn[h * depth];
       if (use_eigen) {
         auto C_mat = EigenStridedMatrixMap<float>(
-            C, depth, kSquares, Eigen::OuterStride<>(heads * depth));
+            C, depth, kSquares, Eigen::OuterStride<>(d_model));
         C_mat.noalias() =
             ConstEigenStridedMatrixMap<float>(
-                B, depth, kSquares, Eigen::OuterStride<>(heads * depth)) *
+                B, depth, kSquares, Eigen::OuterStride<>(qkv_size)) *
             ConstEigenMatrixMap<float>(A, kSquares, kSquares);
       } else {
 #ifdef USE_BLAS
         cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, kSquares, depth,
-                    kSquares, 1.0f, A, kSquares, B, heads * depth, 0.0f, C,
-                    heads * depth);
+                    kSquares, 1.0f, A, kSquares, B, qkv_size, 0.0f, C,
+                    d_model);
 #endif
       }
     }
@@ -427,36 +476,65 @@ void BlasComputation<use_eigen>::MakeEncoderLayer(
 
   // Fully connected final MHA layer.
   FullyConnectedLayer<use_eigen>::Forward1D(
-      batch_size * kSquares, d_model, embedding_size, head_buffer2.data(),
+      batch_size * kSquares, d_model, embedding_size, head_buffer2,
       layer.mha.dense_w.data(), layer.mha.dense_b.data(), ACTIVATION_NONE,
-      head_buffer3.data());
+      head_buffer3);
 
   // Layer Norm + skip connection.
   LayerNorm2DWithSkipConnection(batch_size * kSquares, embedding_size,
-                                head_buffer.data(), 1.0f / alpha,
-                                head_buffer3.data(), layer.ln1_gammas.data(),
+                                head_buffer, 1.0f / alpha,
+                                head_buffer3, layer.ln1_gammas.data(),
                                 layer.ln1_betas.data(), 1e-6);
 
   // FFN.
   FullyConnectedLayer<use_eigen>::Forward1D(
-      batch_size * kSquares, embedding_size, dff_size, head_buffer.data(),
+      batch_size * kSquares, embedding_size, dff_size, head_buffer,
       layer.ffn.dense1_w.data(), layer.ffn.dense1_b.data(), ffn_activation,
-      head_buffer4.data());
+      head_buffer4);
 
   FullyConnectedLayer<use_eigen>::Forward1D(
       batch_size * kSquares, dff_size, layer.ffn.dense2_b.size(),
-      head_buffer4.data(), layer.ffn.dense2_w.data(), layer.ffn.dense2_b.data(),
-      ACTIVATION_NONE, head_buffer3.data());
+      head_buffer4, layer.ffn.dense2_w.data(), layer.ffn.dense2_b.data(),
+      ACTIVATION_NONE, head_buffer3);
 
   // Layer Norm + skip connection.
   LayerNorm2DWithSkipConnection(batch_size * kSquares, embedding_size,
-                                head_buffer.data(), 1.0f / alpha,
-                                head_buffer3.data(), layer.ln2_gammas.data(),
+                                head_buffer, 1.0f / alpha,
+                                head_buffer3, layer.ln2_gammas.data(),
                                 layer.ln2_betas.data(), 1e-6);
 }
 
 template <bool use_eigen>
 void BlasComputation<use_eigen>::ComputeBlocking() {
+  const auto total_batches = planes_.size();
+  q_values_.resize(wdl_ ? 3 * total_batches : total_batches);
+  policies_.resize(total_batches);
+  if (moves_left_) m_values_.resize(total_batches);
+
+  // The batch is split in contiguous slices, all but the first computed on
+  // the thread pool of the network. Each one runs the whole network with
+  // single threaded BLAS calls, which suits the small 8x8 convolutions and
+  // GEMMs better than threading inside BLAS.
+  const size_t slices =
+      std::min(static_cast<size_t>(network_->GetBatchThreads()), total_batches);
+  std::vector<std::future<void>> futures;
+  for (size_t i = 1; i < slices; i++) {
+    const size_t slice_begin = total_batches * i / slices;
+    const size_t slice_end = total_batches * (i + 1) / slices;
+    futures.push_back(
+        network_->GetThreadPool()->Run([this, slice_begin, slice_end]() {
+#ifdef USE_DNNL
+          omp_set_num_threads(1);
+#endif
+          ComputeSlice(slice_begin, slice_end);
+        }));
+  }
+  ComputeSlice(0, slices > 1 ? total_batches / slices : total_batches);
+  for (auto& future : futures) future.get();
+}
+
+template <bool use_eigen>
+void BlasComputation<use_eigen>::ComputeSlice(size_t begin, size_t end) {
   // Retrieve network key dimensions from the weights structure.
   const auto num_value_channels = weights_.ip1_val_b.size();
   const auto num_moves_channels = weights_.ip1_mov_b.size();
@@ -485,8 +563,7 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
           : output_channels;
 
   // Determine the largest batch for allocations.
-  const auto total_batches = planes_.size();
-  const auto largest_batch_size = std::min(max_batch_size_, total_batches);
+  const auto largest_batch_size = std::min(max_batch_size_, end - begin);
 
   /* Typically
    input_channels = 112
@@ -508,41 +585,92 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
                                weights_.ip_pol_b.size());
   }
 
-  std::unique_ptr<Buffers> buffers = network_->GetBuffers();
-
-  // Allocate data for the whole batch.
-  std::vector<float>& buffer1 = buffers->buffer1;
-  vec_adjust(buffer1, largest_batch_size * max_channels * kSquares);
-  std::vector<float>& buffer2 = buffers->buffer2;
-  vec_adjust(buffer2, largest_batch_size * max_channels * kSquares);
-  std::vector<float>& buffer3 = buffers->buffer3;
-  vec_adjust(buffer3, largest_batch_size *
-                          std::max(max_channels * kSquares, max_fc_channels));
-  std::vector<float>& head_buffer = buffers->buffer4;
-  vec_adjust(head_buffer, largest_batch_size * max_head_planes * kSquares);
-
-  // Output values.
-  q_values_.reserve(wdl_ ? 3 * total_batches : total_batches);
-  policies_.reserve(total_batches);
-  if (moves_left_) m_values_.resize(total_batches);
-
-  WinogradConvolution3<use_eigen> convolve3(largest_batch_size, max_channels,
-                                            max_output_channels);
+  // Plan the working memory over two steps, the body and the heads. Only
+  // buffer1 and buffer2 carry data from one to the other, so the scratch of
+  // each step, e.g. the FFN intermediate of the encoders, can share memory
+  // with that of the other.
+  constexpr int kBody = 0;
+  constexpr int kHeads = 1;
+  const size_t activations = largest_batch_size * max_channels * kSquares;
+  std::array<size_t, 4> body_sizes = {activations, activations, activations,
+                                      0};
+  std::array<size_t, 4> head_sizes = {
+      activations, activations,
+      largest_batch_size * std::max(max_channels * kSquares, max_fc_channels),
+      largest_batch_size * max_head_planes * kSquares};
+  auto add_encoder_sizes = [&](std::array<size_t, 4>* sizes,
+                               const LegacyWeights::EncoderLayer& layer,
+                               size_t embedding_size, int heads) {
+    const auto encoder_sizes =
+        EncoderBufferSizes(layer, embedding_size, heads, largest_batch_size);
+    for (size_t i = 0; i < sizes->size(); i++) {
+      (*sizes)[i] = std::max((*sizes)[i], encoder_sizes[i]);
+    }
+  };
+  for (const auto& layer : weights_.encoder) {
+    add_encoder_sizes(&body_sizes, layer, output_channels,
+                      weights_.encoder_head_count);
+  }
+  if (attn_policy_) {
+    // The policy encoders run on buffer2 with buffer1 as scratch, and Q and
+    // K land in buffer1 and buffer3.
+    const size_t policy_size = largest_batch_size * kSquares *
+                               std::max(weights_.ip_pol_b.size(),
+                                        weights_.ip2_pol_b.size());
+    for (auto& size : head_sizes) size = std::max(size, policy_size);
+    std::swap(head_sizes[0], head_sizes[1]);
+    for (const auto& layer : weights_.pol_encoder) {
+      add_encoder_sizes(&head_sizes, layer, weights_.ip_pol_b.size(),
+                        weights_.pol_encoder_head_count);
+    }
+    std::swap(head_sizes[0], head_sizes[1]);
+  }
+  const bool needs_winograd = num_res_blocks > 0 || conv_policy_;
+
+  BufferPlanner planner(16);
+  const int buffer1_id =
+      planner.Add(std::max(body_sizes[0], head_sizes[0]), kBody, kHeads);
+  const int buffer2_id =
+      planner.Add(std::max(body_sizes[1], head_sizes[1]), kBody, kHeads);
+  const int body_buffer3_id = planner.Add(body_sizes[2], kBody, kBody);
+  const int body_buffer4_id = planner.Add(body_sizes[3], kBody, kBody);
+  const int head_buffer3_id = planner.Add(head_sizes[2], kHeads, kHeads);
+  const int head_buffer4_id = planner.Add(head_sizes[3], kHeads, kHeads);
+  const int winograd_id = planner.Add(
+      needs_winograd
+          ? WinogradConvolution3<use_eigen>::ScratchSize(
+                largest_batch_size, max_channels, max_output_channels)
+          : 0,
+      kBody, conv_policy_ ? kHeads : kBody);
+  planner.Plan();
 
-  for (size_t start = 0; start < total_batches; start += largest_batch_size) {
-    const auto batch_size = std::min(total_batches - start, largest_batch_size);
+  std::unique_ptr<Buffers> buffers = network_->GetBuffers();
+  vec_adjust(buffers->arena, planner.GetArenaSize());
+  float* const arena = buffers->arena.data();
+  float* const buffer1 = arena + planner.GetOffset(buffer1_id);
+  float* const buffer2 = arena + planner.GetOffset(buffer2_id);
+
+  WinogradConvolution3<use_eigen> convolve3(
+      needs_winograd ? largest_batch_size : 0, max_channels,
+      max_output_channels, arena + planner.GetOffset(winograd_id));
+
+  for (size_t start = begin; start < end; start += largest_batch_size) {
+    const auto batch_size = std::min(end - start, largest_batch_size);
+    float* buffer3 = arena + planner.GetOffset(body_buffer3_id);
+    float* head_buffer = arena + planner.GetOffset(body_buffer4_id);
     for (size_t j = 0; j < batch_size; j++) {
       EncodePlanes(planes_[start + j], &buffer1[j * kSquares * kInputPlanes]);
     }
 
-    if (num_res_blocks > 0) {
+    if (auto tower = network_->GetGeneratedTower()) {
+      tower(weights_, batch_size, &convolve3, buffer1, buffer2,
+            buffer3);
+    } else if (num_res_blocks > 0) {
       // Input convolution
       convolve3.Forward(batch_size, kInputPlanes, output_channels,
-                        buffer1.data(), weights_.input.weights.data(),
-                        buffer2.data());
-
-      BiasActivate(batch_size, output_channels, buffer2.data(),
-                   weights_.input.biases.data(), default_activation_);
+                        buffer1, weights_.input.weights.data(),
+                        buffer2, weights_.input.biases.data(),
+                        default_activation_);
 
       // Residual tower
       for (auto& residual : weights_.residual) {
@@ -551,25 +679,25 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
         const auto& se = residual.se;
 
         convolve3.Forward(batch_size, output_channels, output_channels,
-                          buffer2.data(), conv1.weights.data(), buffer1.data());
-
-        BiasActivate(batch_size, output_channels, buffer1.data(),
-                     conv1.biases.data(), default_activation_);
-
-        convolve3.Forward(batch_size, output_channels, output_channels,
-                          buffer1.data(), conv2.weights.data(), buffer3.data());
+                          buffer2, conv1.weights.data(), buffer1,
+                          conv1.biases.data(), default_activation_);
 
         if (residual.has_se) {
+          convolve3.Forward(batch_size, output_channels, output_channels,
+                            buffer1, conv2.weights.data(),
+                            buffer3);
           // No relu if followed by SE-unit and residual/bias is added later
           auto se_fc_outputs = se.b1.size();
           ApplySEUnit<use_eigen>(
-              batch_size, output_channels, se_fc_outputs, buffer3.data(),
-              conv2.biases.data(), buffer2.data(), se.w1.data(), se.b1.data(),
-              se.w2.data(), se.b2.data(), buffer2.data(), default_activation_);
+              batch_size, output_channels, se_fc_outputs, buffer3,
+              conv2.biases.data(), buffer2, se.w1.data(), se.b1.data(),
+              se.w2.data(), se.b2.data(), buffer2, default_activation_);
         } else {
-          BiasResidual(batch_size, output_channels, buffer2.data(),
-                       conv2.biases.data(), buffer3.data(),
-                       default_activation_);
+          // The residual sum lands in buffer2.
+          convolve3.Forward(batch_size, output_channels, output_channels,
+                            buffer1, conv2.weights.data(),
+                            buffer3, conv2.biases.data(),
+                            default_activation_, buffer2);
         }
       }
     }
@@ -602,9 +730,9 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
 
       // Input embedding.
       FullyConnectedLayer<use_eigen>::Forward1D(
-          batch_size * kSquares, input_size, embedding_size, buffer3.data(),
+          batch_size * kSquares, input_size, embedding_size, buffer3,
           weights_.ip_emb_w.data(), weights_.ip_emb_b.data(),
-          default_activation_, buffer1.data());
+          default_activation_, buffer1);
 
       // Input gating
       if (weights_.ip_mult_gate.size() > 0 && weights_.ip_add_gate.size() > 0) {
@@ -630,17 +758,20 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
       }
     }
 
+    buffer3 = arena + planner.GetOffset(head_buffer3_id);
+    head_buffer = arena + planner.GetOffset(head_buffer4_id);
+
     // Preserve buffer1 and buffer2, used for policy and moves left heads.
     // Value head
     if (attn_body_) {
       FullyConnectedLayer<use_eigen>::Forward1D(
           batch_size * kSquares, weights_.ip_emb_b.size(),
-          num_value_input_planes, buffer1.data(), weights_.ip_val_w.data(),
-          weights_.ip_val_b.data(), default_activation_, head_buffer.data());
+          num_value_input_planes, buffer1, weights_.ip_val_w.data(),
+          weights_.ip_val_b.data(), default_activation_, head_buffer);
     } else {
       Convolution1<use_eigen>::Forward(
-          batch_size, output_channels, num_value_input_planes, buffer2.data(),
-          weights_.value.weights.data(), head_buffer.data());
+          batch_size, output_channels, num_value_input_planes, buffer2,
+          weights_.value.weights.data(), head_buffer);
 
       BiasActivate(batch_size, num_value_input_planes, &head_buffer[0],
                    weights_.value.biases.data(), default_activation_);
@@ -648,16 +779,16 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
 
     FullyConnectedLayer<use_eigen>::Forward1D(
         batch_size, num_value_input_planes * kSquares, num_value_channels,
-        head_buffer.data(), weights_.ip1_val_w.data(),
+        head_buffer, weights_.ip1_val_w.data(),
         weights_.ip1_val_b.data(),
         default_activation_,  // Activation On
-        buffer3.data());
+        buffer3);
 
     // Now get the score
     if (wdl_) {
       std::vector<float> wdl(3 * batch_size);
       FullyConnectedLayer<use_eigen>::Forward1D(
-          batch_size, num_value_channels, 3, buffer3.data(),
+          batch_size, num_value_channels, 3, buffer3,
           weights_.ip2_val_w.data(), weights_.ip2_val_b.data(),
           ACTIVATION_NONE,  // Activation Off
           wdl.data());
@@ -666,9 +797,9 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
         std::vector<float> wdl_softmax(3);
         SoftmaxActivation(3, &wdl[j * 3], wdl_softmax.data());
 
-        q_values_.emplace_back(wdl_softmax[0]);
-        q_values_.emplace_back(wdl_softmax[1]);
-        q_values_.emplace_back(wdl_softmax[2]);
+        q_values_[3 * (start + j) + 0] = wdl_softmax[0];
+        q_values_[3 * (start + j) + 1] = wdl_softmax[1];
+        q_values_[3 * (start + j) + 2] = wdl_softmax[2];
       }
     } else {
       for (size_t j = 0; j < batch_size; j++) {
@@ -677,7 +808,7 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
                              &buffer3[j * num_value_channels]) +
                          weights_.ip2_val_b[0];
 
-        q_values_.emplace_back(std::tanh(winrate));
+        q_values_[start + j] = std::tanh(winrate);
       }
     }
 
@@ -686,12 +817,12 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
       if (attn_body_) {
         FullyConnectedLayer<use_eigen>::Forward1D(
             batch_size * kSquares, weights_.ip_emb_b.size(),
-            num_moves_input_planes, buffer1.data(), weights_.ip_mov_w.data(),
-            weights_.ip_mov_b.data(), default_activation_, head_buffer.data());
+            num_moves_input_planes, buffer1, weights_.ip_mov_w.data(),
+            weights_.ip_mov_b.data(), default_activation_, head_buffer);
       } else {
         Convolution1<use_eigen>::Forward(
-            batch_size, output_channels, num_moves_input_planes, buffer2.data(),
-            weights_.moves_left.weights.data(), head_buffer.data());
+            batch_size, output_channels, num_moves_input_planes, buffer2,
+            weights_.moves_left.weights.data(), head_buffer);
 
         BiasActivate(batch_size, num_moves_input_planes, &head_buffer[0],
                      weights_.moves_left.biases.data(), default_activation_);
@@ -699,14 +830,14 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
 
       FullyConnectedLayer<use_eigen>::Forward1D(
           batch_size, num_moves_input_planes * kSquares, num_moves_channels,
-          head_buffer.data(), weights_.ip1_mov_w.data(),
+          head_buffer, weights_.ip1_mov_w.data(),
           weights_.ip1_mov_b.data(),
           default_activation_,  // Activation On
-          buffer3.data());
+          buffer3);
 
       std::vector<float> output_moves_left(batch_size);
       FullyConnectedLayer<use_eigen>::Forward1D(
-          batch_size, num_moves_channels, 1, buffer3.data(),
+          batch_size, num_moves_channels, 1, buffer3,
           weights_.ip2_mov_w.data(), weights_.ip2_mov_b.data(),
           ACTIVATION_RELU,  // Specifically Relu
           &m_values_[start]);
@@ -730,11 +861,11 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
       // Policy Embedding.
       FullyConnectedLayer<use_eigen>::Forward1D(
           batch_size * kSquares, output_channels, policy_embedding_size,
-          buffer1.data(), weights_.ip_pol_w.data(), weights_.ip_pol_b.data(),
+          buffer1, weights_.ip_pol_w.data(), weights_.ip_pol_b.data(),
           attn_body_
               ? default_activation_
               : ACTIVATION_SELU,  // SELU activation hardcoded for apmish nets.
-          buffer2.data());
+          buffer2);
 
       const size_t policy_d_model = weights_.ip2_pol_b.size();
 
@@ -749,13 +880,13 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
       // Q
       FullyConnectedLayer<use_eigen>::Forward1D(
           batch_size * kSquares, policy_embedding_size, policy_d_model,
-          buffer2.data(), weights_.ip2_pol_w.data(), weights_.ip2_pol_b.data(),
-          ACTIVATION_NONE, buffer1.data());
+          buffer2, weights_.ip2_pol_w.data(), weights_.ip2_pol_b.data(),
+          ACTIVATION_NONE, buffer1);
       // K
       FullyConnectedLayer<use_eigen>::Forward1D(
           batch_size * kSquares, policy_embedding_size, policy_d_model,
-          buffer2.data(), weights_.ip3_pol_w.data(), weights_.ip3_pol_b.data(),
-          ACTIVATION_NONE, buffer3.data());
+          buffer2, weights_.ip3_pol_w.data(), weights_.ip3_pol_b.data(),
+          ACTIVATION_NONE, buffer3);
       const float scaling = 1.0f / sqrtf(policy_d_model);
       for (auto batch = size_t{0}; batch < batch_size; batch++) {
         const float* A = &buffer1[batch * 64 * policy_d_model];
@@ -813,66 +944,54 @@ void BlasComputation<use_eigen>::ComputeBlocking() {
       // Mapping from attention policy to lc0 policy
       for (auto batch = size_t{0}; batch < batch_size; batch++) {
         std::vector<float> policy(num_output_policy);
-        for (auto i = 0; i < 64 * 64 + 8 * 24; i++) {
-          auto j = kAttnPolicyMap[i];
-          if (j >= 0) {
-            policy[j] = head_buffer[batch * (64 * 64 + 8 * 24) + i];
-          }
-        }
-        policies_.emplace_back(std::move(policy));
+        MapPolicy(PolicyMapping::kAttention, 1,
+                  &head_buffer[batch * (64 * 64 + 8 * 24)], 0, policy.data());
+        policies_[start + batch] = std::move(policy);
       }
     } else if (conv_policy_) {
       assert(!attn_body_);  // not supported with attention body
       convolve3.Forward(batch_size, output_channels, output_channels,
-                        buffer2.data(), weights_.policy1.weights.data(),
-                        buffer1.data());
-
-      BiasActivate(batch_size, output_channels, buffer1.data(),
-                   weights_.policy1.biases.data(), default_activation_);
+                        buffer2, weights_.policy1.weights.data(),
+                        buffer1, weights_.policy1.biases.data(),
+                        default_activation_);
 
       convolve3.Forward(batch_size, output_channels, num_policy_input_planes,
-                        buffer1.data(), weights_.policy.weights.data(),
-                        head_buffer.data());
-
-      BiasActivate(batch_size, num_policy_input_planes, head_buffer.data(),
-                   weights_.policy.biases.data(), ACTIVATION_NONE);
+                        buffer1, weights_.policy.weights.data(),
+                        head_buffer, weights_.policy.biases.data(),
+                        ACTIVATION_NONE);
 
       // Mapping from convolutional policy to lc0 policy
       for (auto batch = size_t{0}; batch < batch_size; batch++) {
         std::vector<float> policy(num_output_policy);
-        for (auto i = 0; i < kPolicyUsedPlanes * kSquares; i++) {
-          auto j = kConvPolicyMap[i];
-          if (j >= 0) {
-            policy[j] =
-                head_buffer[batch * num_policy_input_planes * kSquares + i];
-          }
-        }
-        policies_.emplace_back(std::move(policy));
+        MapPolicy(PolicyMapping::kConvolution, 1,
+                  &head_buffer[batch * num_policy_input_planes * kSquares], 0,
+                  policy.data());
+        policies_[start + batch] = std::move(policy);
       }
 
     } else {
       assert(!attn_body_);  // not supported with attention body
       Convolution1<use_eigen>::Forward(
-          batch_size, output_channels, num_policy_input_planes, buffer2.data(),
-          weights_.policy.weights.data(), head_buffer.data());
+          batch_size, output_channels, num_policy_input_planes, buffer2,
+          weights_.policy.weights.data(), head_buffer);
 
       BiasActivate(batch_size, num_policy_input_planes, &head_buffer[0],
                    weights_.policy.biases.data(), default_activation_);
 
       FullyConnectedLayer<use_eigen>::Forward1D(
           batch_size, num_policy_input_planes * kSquares, num_output_policy,
-          head_buffer.data(), weights_.ip_pol_w.data(),
+          head_buffer, weights_.ip_pol_w.data(),
           weights_.ip_pol_b.data(),
           ACTIVATION_NONE,  // Activation Off
-          buffer3.data());
+          buffer3);
 
       for (size_t j = 0; j < batch_size; j++) {
         std::vector<float> policy(num_output_policy);
 
         // Get the moves
-        policy.assign(buffer3.begin() + j * num_output_policy,
-                      buffer3.begin() + (j + 1) * num_output_policy);
-        policies_.emplace_back(std::move(policy));
+        policy.assign(buffer3 + j * num_output_policy,
+                      buffer3 + (j + 1) * num_output_policy);
+        policies_[start + j] = std::move(policy);
       }
     }
   }
@@ -889,16 +1008,112 @@ void BlasComputation<use_eigen>::EncodePlanes(const InputPlanes& sample,
   }
 }
 
+// Converts the weights of @file for the backend: transformed for the
+// Winograd convolutions, with the encoder QKV projections fused and, with MKL,
+// prepacked.
+template <bool use_eigen>
+std::shared_ptr<const BlasWeights> ConvertWeights(const WeightsFile& file,
+                                                  size_t max_batch_size) {
+  auto result = std::make_shared<BlasWeights>(file.weights());
+  LegacyWeights& weights = result->weights;
+  const bool conv_policy = file.format().network_format().policy() ==
+                           pblczero::NetworkFormat::POLICY_CONVOLUTION;
+
+  // Concatenate the Q, K and V projections of the encoders, so that they are
+  // computed as one larger GEMM. The fused weights replace q_w and q_b, k_b
+  // keeps its size to give d_model.
+  auto fuse_qkv = [](LegacyWeights::EncoderLayer& layer) {
+    auto& mha = layer.mha;
+    mha.q_w.insert(mha.q_w.end(), mha.k_w.begin(), mha.k_w.end());
+    mha.q_w.insert(mha.q_w.end(), mha.v_w.begin(), mha.v_w.end());
+    mha.q_b.insert(mha.q_b.end(), mha.k_b.begin(), mha.k_b.end());
+    mha.q_b.insert(mha.q_b.end(), mha.v_b.begin(), mha.v_b.end());
+    mha.k_w = {};
+    mha.v_w = {};
+    mha.v_b = {};
+  };
+  for (auto& layer : weights.encoder) fuse_qkv(layer);
+  for (auto& layer : weights.pol_encoder) fuse_qkv(layer);
+
+  // Prepack the weights of the encoder GEMMs, which run on batch size times
+  // 64 rows.
+  if (!use_eigen) {
+    const size_t max_rows = max_batch_size * 64;
+    auto pack = [&](const std::vector<float>& w, size_t input_size) {
+      if (w.empty()) return;
+      result->packed.push_back(std::make_unique<PackedWeights>(
+          input_size, w.size() / input_size, w.data(), max_rows));
+    };
+    auto pack_encoder = [&](const LegacyWeights::EncoderLayer& layer) {
+      const size_t embedding_size = layer.ln1_gammas.size();
+      const size_t d_model = layer.mha.k_b.size();
+      pack(layer.mha.q_w, embedding_size);
+      pack(layer.mha.dense_w, d_model);
+      pack(layer.ffn.dense1_w, embedding_size);
+      pack(layer.ffn.dense2_w, layer.ffn.dense1_b.size());
+      if (layer.mha.has_smolgen) {
+        pack(layer.mha.smolgen.compress, embedding_size);
+      }
+    };
+    for (const auto& layer : weights.encoder) pack_encoder(layer);
+    for (const auto& layer : weights.pol_encoder) pack_encoder(layer);
+  }
+
+  const auto inputChannels = kInputPlanes;
+  const auto channels = static_cast<int>(weights.input.biases.size());
+  const auto residual_blocks = weights.residual.size();
+
+  weights.input.weights =
+      WinogradFilterTransformF(weights.input.weights, channels, inputChannels);
+
+  // residual blocks
+  for (size_t i = 0; i < residual_blocks; i++) {
+    auto& residual = weights.residual[i];
+    auto& conv1 = residual.conv1;
+    auto& conv2 = residual.conv2;
+
+    conv1.weights = WinogradFilterTransformF(conv1.weights, channels, channels);
+    conv2.weights = WinogradFilterTransformF(conv2.weights, channels, channels);
+  }
+
+  if (conv_policy) {
+    weights.policy1.weights =
+        WinogradFilterTransformF(weights.policy1.weights, channels, channels);
+    auto pol_channels = weights.policy.biases.size();
+    weights.policy.weights = WinogradFilterTransformF(weights.policy.weights,
+                                                      pol_channels, channels);
+  }
+
+  return result;
+}
+
+// Returns the weights converted for @key by another network in this process,
+// or else the ones returned by @build, which are shared from then on.
+std::shared_ptr<const BlasWeights> GetSharedWeights(
+    const std::string& key,
+    const std::function<std::shared_ptr<const BlasWeights>()>& build) {
+  static std::mutex mutex;
+  static std::map<std::string, std::weak_ptr<const BlasWeights>> shared;
+  std::lock_guard<std::mutex> lock(mutex);
+  auto& entry = shared[key];
+  auto result = entry.lock();
+  if (!result) {
+    result = build();
+    entry = result;
+  }
+  return result;
+}
+
 template <bool use_eigen>
 BlasNetwork<use_eigen>::BlasNetwork(const WeightsFile& file,
                                     const OptionsDict& options)
     : capabilities_{file.format().network_format().input(),
-                    file.format().network_format().moves_left()},
-      weights_(file.weights()) {
+                    file.format().network_format().moves_left()} {
   Numa::Init();
 
   max_batch_size_ =
       static_cast<size_t>(options.GetOrDefault<int>("batch_size", 256));
+  batch_threads_ = std::max(options.GetOrDefault<int>("batch_threads", 1), 1);
 
   wdl_ = file.format().network_format().value() ==
          pblczero::NetworkFormat::VALUE_WDL;
@@ -937,29 +1152,18 @@ BlasNetwork<use_eigen>::BlasNetwork(const WeightsFile& file,
     max_batch_size_ = kHardMaxBatchSize;
   }
 
-  const auto inputChannels = kInputPlanes;
-  const auto channels = static_cast<int>(weights_.input.biases.size());
-  const auto residual_blocks = weights_.residual.size();
-
-  weights_.input.weights =
-      WinogradFilterTransformF(weights_.input.weights, channels, inputChannels);
-
-  // residual blocks
-  for (size_t i = 0; i < residual_blocks; i++) {
-    auto& residual = weights_.residual[i];
-    auto& conv1 = residual.conv1;
-    auto& conv2 = residual.conv2;
-
-    conv1.weights = WinogradFilterTransformF(conv1.weights, channels, channels);
-    conv2.weights = WinogradFilterTransformF(conv2.weights, channels, channels);
-  }
-
-  if (conv_policy_) {
-    weights_.policy1.weights =
-        WinogradFilterTransformF(weights_.policy1.weights, channels, channels);
-    auto pol_channels = weights_.policy.biases.size();
-    weights_.policy.weights = WinogradFilterTransformF(weights_.policy.weights,
-                                                       pol_channels, channels);
+  // Networks of this process loading the same file share the converted
+  // weights, unless disabled.
+  if (options.GetOrDefault<bool>("share_weights", true)) {
+    const std::string key =
+        std::string(use_eigen ? "eigen " : "blas ") +
+        std::to_string(max_batch_size_) + " " +
+        std::to_string(std::hash<std::string>()(file.OutputAsString()));
+    weights_ = GetSharedWeights(key, [&]() {
+      return ConvertWeights<use_eigen>(file, max_batch_size_);
+    });
+  } else {
+    weights_ = ConvertWeights<use_eigen>(file, max_batch_size_);
   }
 
   if (use_eigen) {
@@ -1001,6 +1205,17 @@ BlasNetwork<use_eigen>::BlasNetwork(const WeightsFile& file,
 #endif
     CERR << "BLAS max batch size is " << max_batch_size_ << ".";
   }
+  if (batch_threads_ > 1) {
+    CERR << "Splitting batches across " << batch_threads_ << " threads.";
+  }
+
+  if (!attn_body_ && !weights_->weights.residual.empty()) {
+    generated_tower_ = GeneratedTowers<use_eigen>::Find(
+        GetTowerShape(weights_->weights, default_activation_));
+    if (generated_tower_) {
+      CERR << "Using the residual tower generated for this network.";
+    }
+  }
 }
 
 template <bool use_eigen>
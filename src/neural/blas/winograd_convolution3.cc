@@ -43,8 +43,17 @@ template <bool use_eigen>
 WinogradConvolution3<use_eigen>::WinogradConvolution3(
     const size_t max_batch_size, const size_t max_input_layers,
     const size_t max_output_layers)
-    : V_(max_batch_size * kWinogradTile * max_input_layers * kTiles),
-      M_(max_batch_size * kWinogradTile * max_output_layers * kTiles) {}
+    : storage_(ScratchSize(max_batch_size, max_input_layers,
+                           max_output_layers)),
+      V_(storage_.data()),
+      M_(V_ + max_batch_size * kWinogradTile * max_input_layers * kTiles) {}
+
+template <bool use_eigen>
+WinogradConvolution3<use_eigen>::WinogradConvolution3(
+    const size_t max_batch_size, const size_t max_input_layers,
+    const size_t, float* scratch)
+    : V_(scratch),
+      M_(V_ + max_batch_size * kWinogradTile * max_input_layers * kTiles) {}
 
 template <bool use_eigen>
 void WinogradConvolution3<use_eigen>::Forward(const size_t batch_size,
@@ -53,9 +62,30 @@ void WinogradConvolution3<use_eigen>::Forward(const size_t batch_size,
                                               const float* input,
                                               const float* weights,
                                               float* output) {
+  Forward(batch_size, input_channels, output_channels, input, weights, output,
+          nullptr, ACTIVATION_NONE);
+}
+
+template <bool use_eigen>
+void WinogradConvolution3<use_eigen>::Forward(
+    const size_t batch_size, const size_t input_channels,
+    const size_t output_channels, const float* input, const float* weights,
+    float* output, const float* biases, const ActivationFunction activation,
+    float* residual) {
   TransformIn(batch_size, input, input_channels);
   Sgemm(batch_size, weights, input_channels, output_channels);
-  TransformOut(batch_size, output, output_channels);
+  const auto sample_size = kSquares * output_channels;
+  for (size_t batch_index = 0; batch_index < batch_size; batch_index++) {
+    float* output_batch = output + batch_index * sample_size;
+    TransformOut(batch_size, batch_index, output_batch, output_channels);
+    if (biases == nullptr) continue;
+    if (residual != nullptr) {
+      BiasResidual(1, output_channels, residual + batch_index * sample_size,
+                   biases, output_batch, activation);
+    } else {
+      BiasActivate(1, output_channels, output_batch, biases, activation);
+    }
+  }
 }
 
 template <bool use_eigen>
@@ -259,68 +289,67 @@ void WinogradConvolution3<true>::Sgemm(const size_t batch_size,
 
 template <bool use_eigen>
 void WinogradConvolution3<use_eigen>::TransformOut(const size_t batch_size,
+                                                   const size_t batch_index,
                                                    float* output,
                                                    const size_t channels) {
 #ifndef USE_ISPC
 
   float m[kWinogradTile];
 
-  for (size_t batch_index = 0; batch_index < batch_size; batch_index++) {
-    const float* M_batch = &M_[channels * kTiles * batch_index];
-    float* output_batch = output + batch_index * kWidth * kHeight * channels;
+  const float* M_batch = &M_[channels * kTiles * batch_index];
 
-    for (size_t channel = 0; channel < channels; channel++) {
-      const float* M_channel = M_batch + channel;
-      float* output_channel = output_batch + channel * (kHeight * kWidth);
+  for (size_t channel = 0; channel < channels; channel++) {
+    const float* M_channel = M_batch + channel;
+    float* output_channel = output + channel * (kHeight * kWidth);
 
-      for (int block_x = 0; block_x < kWtiles; block_x++) {
-        for (int block_y = 0; block_y < kWtiles; block_y++) {
-          const auto x = 2 * block_x;
-          const auto y = 2 * block_y;
+    for (int block_x = 0; block_x < kWtiles; block_x++) {
+      for (int block_y = 0; block_y < kWtiles; block_y++) {
+        const auto x = 2 * block_x;
+        const auto y = 2 * block_y;
 
-          const auto b = block_y * kWtiles + block_x;
-          const float* M_wtile = M_channel + channels * b;
-          const auto M_incr = channels * kTiles * batch_size;
+        const auto b = block_y * kWtiles + block_x;
+        const float* M_wtile = M_channel + channels * b;
+        const auto M_incr = channels * kTiles * batch_size;
 
-          for (int wTile = 0; wTile < kWinogradTile; wTile++) {
-            m[wTile] = *M_wtile;
-            M_wtile += M_incr;
-          }
+        for (int wTile = 0; wTile < kWinogradTile; wTile++) {
+          m[wTile] = *M_wtile;
+          M_wtile += M_incr;
+        }
 
-          // Calculates transpose(A).temp_m.A
-          //    A = [1.0,  0.0],
-          //        [1.0,  1.0],
-          //        [1.0, -1.0],
-          //        [0.0, -1.0]]
+        // Calculates transpose(A).temp_m.A
+        //    A = [1.0,  0.0],
+        //        [1.0,  1.0],
+        //        [1.0, -1.0],
+        //        [0.0, -1.0]]
 
-          auto o11 = m[0 * 4 + 0] + m[0 * 4 + 1] + m[0 * 4 + 2] + m[1 * 4 + 0] +
-                     m[1 * 4 + 1] + m[1 * 4 + 2] + m[2 * 4 + 0] + m[2 * 4 + 1] +
-                     m[2 * 4 + 2];
+        auto o11 = m[0 * 4 + 0] + m[0 * 4 + 1] + m[0 * 4 + 2] + m[1 * 4 + 0] +
+                   m[1 * 4 + 1] + m[1 * 4 + 2] + m[2 * 4 + 0] + m[2 * 4 + 1] +
+                   m[2 * 4 + 2];
 
-          auto o12 = m[0 * 4 + 1] - m[0 * 4 + 2] - m[0 * 4 + 3] + m[1 * 4 + 1] -
-                     m[1 * 4 + 2] - m[1 * 4 + 3] + m[2 * 4 + 1] - m[2 * 4 + 2] -
-                     m[2 * 4 + 3];
+        auto o12 = m[0 * 4 + 1] - m[0 * 4 + 2] - m[0 * 4 + 3] + m[1 * 4 + 1] -
+                   m[1 * 4 + 2] - m[1 * 4 + 3] + m[2 * 4 + 1] - m[2 * 4 + 2] -
+                   m[2 * 4 + 3];
 
-          auto o21 = m[1 * 4 + 0] + m[1 * 4 + 1] + m[1 * 4 + 2] - m[2 * 4 + 0] -
-                     m[2 * 4 + 1] - m[2 * 4 + 2] - m[3 * 4 + 0] - m[3 * 4 + 1] -
-                     m[3 * 4 + 2];
+        auto o21 = m[1 * 4 + 0] + m[1 * 4 + 1] + m[1 * 4 + 2] - m[2 * 4 + 0] -
+                   m[2 * 4 + 1] - m[2 * 4 + 2] - m[3 * 4 + 0] - m[3 * 4 + 1] -
+                   m[3 * 4 + 2];
 
-          auto o22 = m[1 * 4 + 1] - m[1 * 4 + 2] - m[1 * 4 + 3] - m[2 * 4 + 1] +
-                     m[2 * 4 + 2] + m[2 * 4 + 3] - m[3 * 4 + 1] + m[3 * 4 + 2] +
-                     m[3 * 4 + 3];
+        auto o22 = m[1 * 4 + 1] - m[1 * 4 + 2] - m[1 * 4 + 3] - m[2 * 4 + 1] +
+                   m[2 * 4 + 2] + m[2 * 4 + 3] - m[3 * 4 + 1] + m[3 * 4 + 2] +
+                   m[3 * 4 + 3];
 
-          output_channel[(y)*kWidth + (x)] = o11;
-          output_channel[(y)*kWidth + (x + 1)] = o12;
-          output_channel[(y + 1) * kWidth + (x)] = o21;
-          output_channel[(y + 1) * kWidth + (x + 1)] = o22;
-        }
+        output_channel[(y)*kWidth + (x)] = o11;
+        output_channel[(y)*kWidth + (x + 1)] = o12;
+        output_channel[(y + 1) * kWidth + (x)] = o21;
+        output_channel[(y + 1) * kWidth + (x + 1)] = o22;
       }
     }
   }
 
 #else  // USE_ISPC
 
-  ispc::winograd_TransformOut_ispc(batch_size, &M_[0], channels, output);
+  ispc::winograd_TransformOutSample_ispc(batch_size, batch_index, &M_[0],
+                                         channels, output);
 
 #endif  // USE_ISPC
 }
@@ -21,6 +21,8 @@
 #include <cstddef>
 #include <vector>
 
+#include "neural/shared/activation.h"
+
 namespace lczero {
 
 // Convolution 3x3 on a 8x8 board using the Winograd algorithm.
@@ -44,11 +46,33 @@ class WinogradConvolution3 {
                        const size_t max_input_layers,
                        const size_t max_output_layers);
 
+  // Uses @scratch, of ScratchSize() floats for the same sizes, instead of
+  // allocating memory.
+  WinogradConvolution3(const size_t max_batch_size,
+                       const size_t max_input_layers,
+                       const size_t max_output_layers, float* scratch);
+
+  static size_t ScratchSize(const size_t max_batch_size,
+                            const size_t max_input_layers,
+                            const size_t max_output_layers) {
+    return max_batch_size * kWinogradTile * kTiles *
+           (max_input_layers + max_output_layers);
+  }
+
   // Forward inference, batched.
   void Forward(const size_t batch_size, const size_t input_channels,
                const size_t output_channels, const float* input,
                const float* weights, float* output);
 
+  // Forward inference followed by the bias and activation, applied to each
+  // sample right after its output transform while it's still in cache. With
+  // a @residual the result is added to it in place, as in BiasResidual(), and
+  // @output is only a temporary.
+  void Forward(const size_t batch_size, const size_t input_channels,
+               const size_t output_channels, const float* input,
+               const float* weights, float* output, const float* biases,
+               const ActivationFunction activation, float* residual = nullptr);
+
  private:
   void TransformIn(const size_t batch_size, const float* input,
                    const size_t channels);
@@ -56,8 +80,9 @@ class WinogradConvolution3 {
   void Sgemm(const size_t batch_size, const float* weights,
              const size_t input_channels, const size_t output_channels);
 
-  void TransformOut(const size_t batch_size, float* output,
-                    const size_t channels);
+  // Transforms the output of sample @batch_index to @output.
+  void TransformOut(const size_t batch_size, const size_t batch_index,
+                    float* output, const size_t channels);
 
   static constexpr auto kWidth = 8;
   static constexpr auto kHeight = 8;
@@ -69,7 +94,8 @@ class WinogradConvolution3 {
   static constexpr auto kWinogradAlpha = 4;
   static constexpr auto kWinogradTile = kWinogradAlpha * kWinogradAlpha;
 
-  std::vector<float> V_;
-  std::vector<float> M_;
+  std::vector<float> storage_;
+  float* V_;
+  float* M_;
 };
 }  // namespace lczero
@@ -25,10 +25,163 @@
   Program grant you additional permission to convey the resulting work.
 */
 #include "neural/cache.h"
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <limits>
+#include <string>
+
+#include "neural/persistent_cache.h"
+#include "utils/metrics.h"
+#include "utils/slaballoc.h"
+#include "utils/tracing.h"
 
 namespace lczero {
+namespace {
+MetricCounter gEvaluationsMetric("lc0_nn_evaluations_total",
+                                 "Positions evaluated by the backend.");
+MetricCounter gDuplicatesMetric(
+    "lc0_nn_duplicate_inputs_total",
+    "Inputs sharing the evaluation of the same position in their batch.");
+MetricHistogram gBatchSizeMetric("lc0_nn_batch_size",
+                                 "Positions per backend computation.", 0, 4);
+MetricHistogram gBackendLatencyMetric(
+    "lc0_backend_latency_seconds", "Duration of backend computations.", -5, 2);
+
+// Raw policy steps per unit, and the largest distance from the maximum which
+// can be stored in 12 bits. Priors further away are e^-32 times the largest
+// one and don't matter.
+constexpr float kPolicyScale = 128.0f;
+constexpr int kMaxPolicyCode = 4095;
+// Request sizes are rounded up to multiples of this.
+constexpr size_t kSizeClassBytes = 8;
+constexpr int kMaxMoves = std::numeric_limits<uint8_t>::max();
+
+size_t GetPolicyBytes(int num_moves) { return (num_moves * 3 + 1) / 2; }
+
+size_t GetRequestBytes(int num_moves) {
+  return sizeof(CachedNNRequest) + GetPolicyBytes(num_moves);
+}
+
+// Serialized values: q, d and m as fp16, then the number of moves.
+constexpr size_t kSerializedHeaderBytes = 3 * sizeof(uint16_t) + 1;
+
+constexpr int kSizeClasses =
+    (sizeof(CachedNNRequest) + (kMaxMoves * 3 + 1) / 2 + kSizeClassBytes - 1) /
+    kSizeClassBytes;
+
+SlabAllocator& RequestAllocator(int size_class) {
+  static SlabAllocator** allocators = []() {
+    auto** result = new SlabAllocator*[kSizeClasses];
+    for (int i = 0; i < kSizeClasses; i++) {
+      result[i] = new SlabAllocator((i + 1) * kSizeClassBytes);
+    }
+    return result;
+  }();
+  return *allocators[size_class];
+}
+}  // namespace
+
+std::unique_ptr<CachedNNRequest> CachedNNRequest::Create(int num_moves) {
+  assert(num_moves <= kMaxMoves);
+  num_moves = std::min(num_moves, kMaxMoves);
+  const int size_class =
+      (GetRequestBytes(num_moves) + kSizeClassBytes - 1) / kSizeClassBytes - 1;
+  void* ptr = RequestAllocator(size_class).Allocate();
+  std::unique_ptr<CachedNNRequest> request(new (ptr) CachedNNRequest());
+  request->num_moves_ = num_moves;
+  request->size_class_ = size_class;
+  return request;
+}
+
+void CachedNNRequest::operator delete(void* ptr) {
+  RequestAllocator(static_cast<CachedNNRequest*>(ptr)->size_class_).Free(ptr);
+}
+
+size_t CachedNNRequest::GetAllocatedBytes() const {
+  return (size_class_ + 1) * kSizeClassBytes;
+}
+
+void CachedNNRequest::SetValues(float q, float d, float m) {
+  q_ = FP32toFP16(q);
+  d_ = FP32toFP16(d);
+  m_ = FP32toFP16(m);
+}
+
+void CachedNNRequest::SetPolicy(const float* raw) {
+  const float max_p = *std::max_element(raw, raw + num_moves_);
+  uint8_t* bytes = policy();
+  std::fill(bytes, bytes + GetPolicyBytes(num_moves_), 0);
+  for (int i = 0; i < num_moves_; i++) {
+    const int code = static_cast<int>(std::min<float>(
+        std::lround((max_p - raw[i]) * kPolicyScale), kMaxPolicyCode));
+    // Two moves take three bytes, the even one the lower 12 bits.
+    uint8_t* b = bytes + i * 3 / 2;
+    if (i % 2 == 0) {
+      b[0] = code & 0xff;
+      b[1] |= code >> 8;
+    } else {
+      b[0] |= (code & 0x0f) << 4;
+      b[1] = code >> 4;
+    }
+  }
+}
+
+float CachedNNRequest::GetP(int ordinal) const {
+  if (ordinal >= num_moves_) return -kMaxPolicyCode / kPolicyScale;
+  const uint8_t* b = policy() + ordinal * 3 / 2;
+  const int code = ordinal % 2 == 0 ? b[0] | (b[1] & 0x0f) << 8
+                                    : b[0] >> 4 | b[1] << 4;
+  return -code / kPolicyScale;
+}
+
+size_t CachedNNRequest::GetSerializedSize() const {
+  return kSerializedHeaderBytes + GetPolicyBytes(num_moves_);
+}
+
+void CachedNNRequest::Serialize(char* out) const {
+  const uint16_t values[] = {q_, d_, m_};
+  std::memcpy(out, values, sizeof(values));
+  out[sizeof(values)] = num_moves_;
+  std::memcpy(out + kSerializedHeaderBytes, policy(),
+              GetPolicyBytes(num_moves_));
+}
+
+size_t CachedNNRequest::ReadSerializedSize(const char* data, size_t size) {
+  if (size < kSerializedHeaderBytes) return 0;
+  const uint8_t num_moves = data[3 * sizeof(uint16_t)];
+  const size_t result = kSerializedHeaderBytes + GetPolicyBytes(num_moves);
+  return result <= size ? result : 0;
+}
+
+std::unique_ptr<CachedNNRequest> CachedNNRequest::Deserialize(const char* data,
+                                                              size_t size) {
+  if (ReadSerializedSize(data, size) == 0) return nullptr;
+  const uint8_t num_moves = data[3 * sizeof(uint16_t)];
+  auto request = Create(num_moves);
+  uint16_t values[3];
+  std::memcpy(values, data, sizeof(values));
+  request->q_ = values[0];
+  request->d_ = values[1];
+  request->m_ = values[2];
+  std::memcpy(request->policy(), data + kSerializedHeaderBytes,
+              GetPolicyBytes(num_moves));
+  return request;
+}
+
+bool NNCache::LoadFromPersistent(uint64_t hash) {
+  PersistentNNCache* persistent = GetPersistentCache();
+  if (!persistent) return false;
+  auto request = persistent->Lookup(hash);
+  if (!request) return false;
+  Insert(hash, std::move(request));
+  return true;
+}
+
 CachingComputation::CachingComputation(
     std::unique_ptr<NetworkComputation> parent, NNCache* cache)
     : parent_(std::move(parent)), cache_(cache) {}
@@ -41,6 +194,9 @@ int CachingComputation::GetBatchSize() const { return batch_.size(); }
 
 bool CachingComputation::AddInputByHash(uint64_t hash) {
   NNCacheLock lock(cache_, hash);
+  if (!lock && cache_->LoadFromPersistent(hash)) {
+    lock = NNCacheLock(cache_, hash);
+  }
   if (!lock) return false;
   AddInputByHash(hash, std::move(lock));
   return true;
@@ -60,78 +216,116 @@ void CachingComputation::PopCacheHit() {
   batch_.pop_back();
 }
 
+bool CachingComputation::AddDuplicate(
+    uint64_t hash, std::vector<uint16_t>&& probabilities_to_cache) {
+  const auto iter = idx_in_parent_by_hash_.find(hash);
+  if (iter == idx_in_parent_by_hash_.end()) return false;
+  batch_.emplace_back();
+  batch_.back().hash = hash;
+  batch_.back().idx_in_parent = iter->second;
+  batch_.back().duplicate = true;
+  batch_.back().probabilities_to_cache = std::move(probabilities_to_cache);
+  ++duplicates_;
+  return true;
+}
+
 void CachingComputation::AddInput(
     uint64_t hash, InputPlanes&& input,
     std::vector<uint16_t>&& probabilities_to_cache) {
   if (AddInputByHash(hash)) return;
+  if (AddDuplicate(hash, std::move(probabilities_to_cache))) return;
+  const int idx_in_parent = parent_->GetBatchSize();
+  idx_in_parent_by_hash_.emplace(hash, idx_in_parent);
   batch_.emplace_back();
   batch_.back().hash = hash;
-  batch_.back().idx_in_parent = parent_->GetBatchSize();
-  batch_.back().probabilities_to_cache = probabilities_to_cache;
-  parent_->AddInput(std::move(input));
+  batch_.back().idx_in_parent = idx_in_parent;
+  batch_.back().probabilities_to_cache = std::move(probabilities_to_cache);
+  parent_->AddInputWithMoves(std::move(input),
+                             batch_.back().probabilities_to_cache);
+}
+
+InputBuffers CachingComputation::AddInputInPlace(
+    uint64_t hash, std::vector<uint16_t>&& probabilities_to_cache) {
+  if (AddInputByHash(hash)) return {};
+  if (AddDuplicate(hash, std::move(probabilities_to_cache))) return {};
+  const int idx_in_parent = parent_->GetBatchSize();
+  idx_in_parent_by_hash_.emplace(hash, idx_in_parent);
+  batch_.emplace_back();
+  batch_.back().hash = hash;
+  batch_.back().idx_in_parent = idx_in_parent;
+  batch_.back().probabilities_to_cache = std::move(probabilities_to_cache);
+  return parent_->AddInputInPlace(batch_.back().probabilities_to_cache);
 }
 
 void CachingComputation::PopLastInputHit() {
   assert(!batch_.empty());
-  assert(batch_.back().idx_in_parent == -1);
+  assert(batch_.back().idx_in_parent == -1 || batch_.back().duplicate);
+  if (batch_.back().duplicate) --duplicates_;
   batch_.pop_back();
 }
 
 void CachingComputation::ComputeBlocking() {
   if (parent_->GetBatchSize() == 0) return;
-  parent_->ComputeBlocking();
+  {
+    LC0_TRACE_SCOPE("backend compute");
+    const auto start = std::chrono::steady_clock::now();
+    parent_->ComputeBlocking();
+    gBackendLatencyMetric.Add(std::chrono::duration<double>(
+                                  std::chrono::steady_clock::now() - start)
+                                  .count());
+  }
+  gEvaluationsMetric.Add(parent_->GetBatchSize());
+  if (duplicates_ > 0) gDuplicatesMetric.Add(duplicates_);
+  gBatchSizeMetric.Add(parent_->GetBatchSize());
+  LC0_TRACE_SCOPE("cache fill");
 
-  // Fill cache with data from NN.
+  // Fill cache with data from NN. New evaluations also go to the persistent
+  // tier, all in one write.
+  PersistentNNCache* persistent = cache_->GetPersistentCache();
+  std::string persistent_batch;
   for (const auto& item : batch_) {
-    if (item.idx_in_parent == -1) continue;
-    auto req =
-        std::make_unique<CachedNNRequest>(item.probabilities_to_cache.size());
-    req->q = parent_->GetQVal(item.idx_in_parent);
-    req->d = parent_->GetDVal(item.idx_in_parent);
-    req->m = parent_->GetMVal(item.idx_in_parent);
-    int idx = 0;
-    for (auto x : item.probabilities_to_cache) {
-      req->p[idx++] =
-          std::make_pair(x, parent_->GetPVal(item.idx_in_parent, x));
+    if (item.idx_in_parent == -1 || item.duplicate) continue;
+    auto req = CachedNNRequest::Create(item.probabilities_to_cache.size());
+    req->SetValues(parent_->GetQVal(item.idx_in_parent),
+                   parent_->GetDVal(item.idx_in_parent),
+                   parent_->GetMVal(item.idx_in_parent));
+    std::array<float, 256> raw;
+    for (int i = 0; i < req->GetNumMoves(); i++) {
+      raw[i] = parent_->GetLegalPVal(item.idx_in_parent, i,
+                                     item.probabilities_to_cache[i]);
     }
+    req->SetPolicy(raw.data());
+    if (persistent) persistent->AddToBatch(&persistent_batch, item.hash, *req);
     cache_->Insert(item.hash, std::move(req));
   }
+  if (persistent) persistent->Append(persistent_batch);
 }
 
 float CachingComputation::GetQVal(int sample) const {
   const auto& item = batch_[sample];
   if (item.idx_in_parent >= 0) return parent_->GetQVal(item.idx_in_parent);
-  return item.lock->q;
+  return item.lock->GetQ();
 }
 
 float CachingComputation::GetDVal(int sample) const {
   const auto& item = batch_[sample];
   if (item.idx_in_parent >= 0) return parent_->GetDVal(item.idx_in_parent);
-  return item.lock->d;
+  return item.lock->GetD();
 }
 
 float CachingComputation::GetMVal(int sample) const {
   const auto& item = batch_[sample];
   if (item.idx_in_parent >= 0) return parent_->GetMVal(item.idx_in_parent);
-  return item.lock->m;
+  return item.lock->GetM();
 }
 
-float CachingComputation::GetPVal(int sample, int move_id) const {
+float CachingComputation::GetPVal(int sample, int move_ordinal) const {
   auto& item = batch_[sample];
-  if (item.idx_in_parent >= 0)
-    return parent_->GetPVal(item.idx_in_parent, move_id);
-  const auto& moves = item.lock->p;
-
-  int total_count = 0;
-  while (total_count < moves.size()) {
-    // Optimization: usually moves are stored in the same order as queried.
-    const auto& move = moves[item.last_idx++];
-    if (item.last_idx == moves.size()) item.last_idx = 0;
-    if (move.first == move_id) return move.second;
-    ++total_count;
+  if (item.idx_in_parent >= 0) {
+    return parent_->GetLegalPVal(item.idx_in_parent, move_ordinal,
+                                 item.probabilities_to_cache[move_ordinal]);
   }
-  assert(false);  // Move not found.
-  return 0;
+  return item.lock->GetP(move_ordinal);
 }
 
 }  // namespace lczero
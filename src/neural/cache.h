@@ -26,36 +26,109 @@
 */
 #pragma once
 
+#include <unordered_map>
+
 #include "neural/network.h"
 #include "utils/cache.h"
-#include "utils/smallarray.h"
+#include "utils/fp16_utils.h"
 
 namespace lczero {
 
-struct CachedNNRequest {
-  CachedNNRequest(size_t size) : p(size) {}
-  typedef std::pair<uint16_t, float> IdxAndProb;
-  float q;
-  float d;
-  float m;
-  // TODO(mooskagh) Don't really need index if using perfect hash.
-  SmallArray<IdxAndProb> p;
+// Network output for one position, quantized to take little memory. Values
+// are fp16. Policy is kept for the legal moves in move generation order, as
+// 12 bit distances of the raw policy from its maximum, so only differences
+// between moves (which is all the softmax needs) survive. Allocated from
+// slabs together with the policy, which follows the struct.
+class CachedNNRequest {
+ public:
+  // Allocates a request for @num_moves legal moves.
+  static std::unique_ptr<CachedNNRequest> Create(int num_moves);
+  static void operator delete(void* ptr);
+
+  float GetQ() const { return FP16toFP32(q_); }
+  float GetD() const { return FP16toFP32(d_); }
+  float GetM() const { return FP16toFP32(m_); }
+  void SetValues(float q, float d, float m);
+
+  int GetNumMoves() const { return num_moves_; }
+  // Returns raw policy of legal move @ordinal, shifted so that the maximum is
+  // 0. Ordinals past the stored moves, e.g. after a hash collision, get the
+  // lowest value.
+  float GetP(int ordinal) const;
+  // Sets raw policy of all the moves.
+  void SetPolicy(const float* raw);
+  // Bytes taken by the request, including the policy.
+  size_t GetAllocatedBytes() const;
+
+  // Size of the request in the serialized format: values, move count and
+  // policy, in native byte order.
+  size_t GetSerializedSize() const;
+  void Serialize(char* out) const;
+  // Returns the size of a request serialized at @data, or 0 if it doesn't fit
+  // in @size bytes.
+  static size_t ReadSerializedSize(const char* data, size_t size);
+  // Reads a request written by Serialize() from at most @size bytes of @data.
+  // Returns nullptr if it's truncated.
+  static std::unique_ptr<CachedNNRequest> Deserialize(const char* data,
+                                                      size_t size);
+
+ private:
+  CachedNNRequest() = default;
+  uint8_t* policy() { return reinterpret_cast<uint8_t*>(this + 1); }
+  const uint8_t* policy() const {
+    return reinterpret_cast<const uint8_t*>(this + 1);
+  }
+
+  uint16_t q_;
+  uint16_t d_;
+  uint16_t m_;
+  uint8_t num_moves_;
+  uint8_t size_class_;
+};
+
+inline size_t GetCacheValueBytes(const CachedNNRequest& request) {
+  return request.GetAllocatedBytes();
+}
+
+class PersistentNNCache;
+
+class NNCache : public HashKeyedCache<CachedNNRequest> {
+ public:
+  using HashKeyedCache::HashKeyedCache;
+
+  // Sets the file backed tier behind this cache, nullptr for none. It's
+  // consulted on misses, and CachingComputation appends new evaluations to it.
+  void SetPersistentCache(PersistentNNCache* cache) {
+    persistent_.store(cache, std::memory_order_release);
+  }
+  PersistentNNCache* GetPersistentCache() const {
+    return persistent_.load(std::memory_order_acquire);
+  }
+  // Copies the evaluation of @hash from the persistent tier into this cache.
+  // Returns whether it was found there.
+  bool LoadFromPersistent(uint64_t hash);
+
+ private:
+  std::atomic<PersistentNNCache*> persistent_{nullptr};
 };
 
-typedef HashKeyedCache<CachedNNRequest> NNCache;
 typedef HashKeyedCacheLock<CachedNNRequest> NNCacheLock;
 
 // Wraps around NetworkComputation and caches result.
 // While it mostly repeats NetworkComputation interface, it's not derived
-// from it, as AddInput() needs hash and index of probabilities to store.
+// from it, as AddInput() needs hash and index of probabilities to store, and
+// policy is queried by legal move ordinal rather than by index.
 class CachingComputation {
  public:
   CachingComputation(std::unique_ptr<NetworkComputation> parent,
                      NNCache* cache);
 
   // How many inputs are not found in cache and will be forwarded to a wrapped
-  // computation.
+  // computation. Repeated positions are forwarded once.
   int GetCacheMisses() const;
+  // How many inputs repeat a position already forwarded by this computation,
+  // and share its evaluation.
+  int GetDuplicates() const { return duplicates_; }
   // Total number of times AddInput/AddInputByHash were (successfully) called.
   int GetBatchSize() const;
   // Adds input by hash only. If that hash is not in cache, returns false
@@ -66,12 +139,25 @@ class CachingComputation {
   void AddInputByHash(uint64_t hash, NNCacheLock&& lock);
   // Adds a sample to the batch.
   // @hash is a hash to store/lookup it in the cache.
-  // @probabilities_to_cache is which indices of policy head to store.
+  // @probabilities_to_cache is which indices of policy head to store. These
+  // must be the legal moves in move generation order.
   void AddInput(uint64_t hash, InputPlanes&& input,
                 std::vector<uint16_t>&& probabilities_to_cache);
+  // Whether the wrapped computation supports AddInputInPlace().
+  bool CanAddInputInPlace() const { return parent_->CanAddInputInPlace(); }
+  // Like AddInput(), returning where to encode the planes of the sample in the
+  // input buffers of the wrapped computation. Returns empty buffers if @hash
+  // is found in the cache by now or was already added to this computation,
+  // then there is nothing to encode.
+  InputBuffers AddInputInPlace(uint64_t hash,
+                               std::vector<uint16_t>&& probabilities_to_cache);
   // Undos last AddInput. If it was a cache miss, the it's actually not removed
   // from parent's batch.
   void PopLastInputHit();
+  // Sets the priority of the wrapped computation.
+  void SetPriority(ComputationPriority priority) {
+    parent_->SetPriority(priority);
+  }
   // Do the computation.
   void ComputeBlocking();
   // Returns Q value of @sample.
@@ -80,8 +166,9 @@ class CachingComputation {
   float GetDVal(int sample) const;
   // Returns estimated remaining moves.
   float GetMVal(int sample) const;
-  // Returns P value @move_id of @sample.
-  float GetPVal(int sample, int move_id) const;
+  // Returns P value of legal move @move_ordinal of @sample, counted in move
+  // generation order. Values of cache hits are shifted by the maximum.
+  float GetPVal(int sample, int move_ordinal) const;
   // Pops last input from the computation. Only allowed for inputs which were
   // cached.
   void PopCacheHit();
@@ -94,13 +181,23 @@ class CachingComputation {
     uint64_t hash;
     NNCacheLock lock;
     int idx_in_parent = -1;
+    // Shares the parent's sample of an earlier item with the same hash, which
+    // fills the cache.
+    bool duplicate = false;
     std::vector<uint16_t> probabilities_to_cache;
-    mutable int last_idx = 0;
   };
 
+  // Adds an item for @hash if it's already forwarded to the parent. Returns
+  // whether it was.
+  bool AddDuplicate(uint64_t hash,
+                    std::vector<uint16_t>&& probabilities_to_cache);
+
   std::unique_ptr<NetworkComputation> parent_;
   NNCache* cache_;
   std::vector<WorkItem> batch_;
+  // Sample in the parent of every hash forwarded to it.
+  std::unordered_map<uint64_t, int> idx_in_parent_by_hash_;
+  int duplicates_ = 0;
 };
 
 }  // namespace lczero
@@ -0,0 +1,156 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "neural/cache_preload.h"
+
+#include <algorithm>
+#include <cctype>
+#include <memory>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "chess/epd.h"
+#include "chess/pgn.h"
+#include "chess/position.h"
+#include "utils/exception.h"
+
+namespace lczero {
+namespace {
+
+bool HasExtension(const std::string& filename, const std::string& extension) {
+  if (filename.size() < extension.size()) return false;
+  return std::equal(extension.rbegin(), extension.rend(), filename.rbegin(),
+                    [](char a, char b) { return a == std::tolower(b); });
+}
+
+class CachePreloader {
+ public:
+  CachePreloader(Network* network, NNCache* cache, int cache_history_length,
+                 FillEmptyHistory history_fill, int batch_size)
+      : network_(network),
+        cache_(cache),
+        cache_history_length_(cache_history_length),
+        history_fill_(history_fill),
+        batch_size_(std::max(batch_size, 1)) {
+    NewComputation();
+  }
+
+  // Queues the last position of @history unless it's cached or terminal.
+  void Add(const PositionHistory& history) {
+    const auto hash = history.HashLast(cache_history_length_ + 1);
+    if (pending_.count(hash) || cache_->ContainsKey(hash) ||
+        cache_->LoadFromPersistent(hash)) {
+      return;
+    }
+    const auto legal_moves = history.Last().GetBoard().GenerateLegalMoves();
+    if (legal_moves.empty()) return;
+    int transform;
+    auto planes =
+        EncodePositionForNN(network_->GetCapabilities().input_format, history,
+                            8, history_fill_, &transform);
+    std::vector<uint16_t> moves;
+    moves.reserve(legal_moves.size());
+    for (const auto& move : legal_moves) {
+      moves.emplace_back(move.as_nn_index(transform));
+    }
+    computation_->AddInput(hash, std::move(planes), std::move(moves));
+    pending_.insert(hash);
+    if (static_cast<int>(pending_.size()) >= batch_size_) Flush();
+  }
+
+  // Evaluates the queued positions, which stores them in the cache.
+  void Flush() {
+    if (pending_.empty()) return;
+    computation_->ComputeBlocking();
+    evaluated_ += pending_.size();
+    pending_.clear();
+    NewComputation();
+  }
+
+  int GetEvaluated() const { return evaluated_; }
+
+ private:
+  void NewComputation() {
+    computation_ = std::make_unique<CachingComputation>(
+        network_->NewComputation(), cache_);
+    computation_->Reserve(batch_size_);
+  }
+
+  Network* const network_;
+  NNCache* const cache_;
+  const int cache_history_length_;
+  const FillEmptyHistory history_fill_;
+  const int batch_size_;
+  std::unique_ptr<CachingComputation> computation_;
+  std::unordered_set<uint64_t> pending_;
+  int evaluated_ = 0;
+};
+
+}  // namespace
+
+int PreloadNNCache(const std::string& filename, Network* network,
+                   NNCache* cache, int cache_history_length,
+                   FillEmptyHistory history_fill, int batch_size) {
+  CachePreloader preloader(network, cache, cache_history_length, history_fill,
+                           batch_size);
+  PositionHistory history;
+  if (HasExtension(filename, ".epd") || HasExtension(filename, ".fen")) {
+    for (const auto& position :
+         ReadEpdFile(filename, std::thread::hardware_concurrency())) {
+      history.Reset(position.GetBoard(), position.GetRule50Ply(),
+                    position.GetGamePly());
+      preloader.Add(history);
+    }
+    preloader.Flush();
+    return preloader.GetEvaluated();
+  }
+
+  PgnReader reader;
+  reader.AddPgnFile(filename);
+  for (const auto& opening : reader.ReleaseGames()) {
+    ChessBoard board;
+    int no_capture_ply;
+    int full_moves;
+    board.SetFromFen(opening.start_fen, &no_capture_ply, &full_moves);
+    history.Reset(board, no_capture_ply,
+                  full_moves * 2 - (board.flipped() ? 1 : 2));
+    preloader.Add(history);
+    for (Move move : opening.moves) {
+      // Book moves are from white's point of view, history wants them from
+      // the side to move's.
+      if (history.IsBlackToMove()) move.Mirror();
+      history.Append(history.Last().GetBoard().GetModernMove(move));
+      preloader.Add(history);
+    }
+  }
+  preloader.Flush();
+  return preloader.GetEvaluated();
+}
+
+}  // namespace lczero
@@ -0,0 +1,51 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#pragma once
+
+#include <string>
+
+#include "neural/cache.h"
+#include "neural/encoder.h"
+#include "neural/network.h"
+
+namespace lczero {
+
+// Evaluates the positions of an opening book with @network and stores them in
+// @cache, so that searches from book lines start with a warm cache. A file
+// ending in .epd or .fen holds one position per line, anything else is read
+// as (possibly gzipped) PGN and every position along each game is taken.
+// Positions are keyed like the search keys them, from @cache_history_length
+// and @history_fill, and evaluated @batch_size at a time. Positions already in
+// the cache are skipped. Returns the number of positions evaluated. Throws
+// Exception if the file can't be read.
+int PreloadNNCache(const std::string& filename, Network* network,
+                   NNCache* cache, int cache_history_length,
+                   FillEmptyHistory history_fill, int batch_size);
+
+}  // namespace lczero
@@ -0,0 +1,111 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include <gtest/gtest.h>
+
+#include "neural/cache.h"
+
+namespace lczero {
+namespace {
+
+// Evaluates sample i to q = i / 10 and the policy to the move index, counting
+// the samples it gets.
+class CountingComputation : public NetworkComputation {
+ public:
+  void AddInput(InputPlanes&& /*input*/) override { ++batch_size_; }
+  void ComputeBlocking() override { ++computed_; }
+  int GetBatchSize() const override { return batch_size_; }
+  float GetQVal(int sample) const override { return sample / 10.0f; }
+  float GetDVal(int /*sample*/) const override { return 0.0f; }
+  float GetPVal(int /*sample*/, int move_id) const override {
+    return move_id;
+  }
+  float GetMVal(int /*sample*/) const override { return 0.0f; }
+  int computed() const { return computed_; }
+
+ private:
+  int batch_size_ = 0;
+  int computed_ = 0;
+};
+
+TEST(CachingComputation, RepeatedPositionsAreEvaluatedOnce) {
+  NNCache cache(100);
+  auto parent = std::make_unique<CountingComputation>();
+  const CountingComputation* counting = parent.get();
+  CachingComputation computation(std::move(parent), &cache);
+  computation.AddInput(1, {}, {0, 1});
+  computation.AddInput(2, {}, {0, 1});
+  computation.AddInput(1, {}, {0, 1});
+  EXPECT_EQ(computation.GetBatchSize(), 3);
+  EXPECT_EQ(computation.GetCacheMisses(), 2);
+  EXPECT_EQ(computation.GetDuplicates(), 1);
+
+  computation.ComputeBlocking();
+  EXPECT_EQ(counting->computed(), 1);
+  EXPECT_FLOAT_EQ(computation.GetQVal(0), 0.0f);
+  EXPECT_FLOAT_EQ(computation.GetQVal(1), 0.1f);
+  EXPECT_FLOAT_EQ(computation.GetQVal(2), 0.0f);
+  EXPECT_FLOAT_EQ(computation.GetPVal(2, 1), computation.GetPVal(0, 1));
+  EXPECT_EQ(cache.GetSize(), 2);
+}
+
+TEST(CachingComputation, PoppedDuplicateIsNotCounted) {
+  NNCache cache(100);
+  CachingComputation computation(std::make_unique<CountingComputation>(),
+                                 &cache);
+  computation.AddInput(1, {}, {0});
+  computation.AddInput(1, {}, {0});
+  computation.PopLastInputHit();
+  EXPECT_EQ(computation.GetBatchSize(), 1);
+  EXPECT_EQ(computation.GetDuplicates(), 0);
+  computation.ComputeBlocking();
+  EXPECT_EQ(cache.GetSize(), 1);
+}
+
+TEST(CachingComputation, CachedPositionsAreNotForwarded) {
+  NNCache cache(100);
+  {
+    CachingComputation computation(std::make_unique<CountingComputation>(),
+                                   &cache);
+    computation.AddInput(1, {}, {0});
+    computation.ComputeBlocking();
+  }
+  CachingComputation computation(std::make_unique<CountingComputation>(),
+                                 &cache);
+  computation.AddInput(1, {}, {0});
+  computation.AddInput(1, {}, {0});
+  EXPECT_EQ(computation.GetCacheMisses(), 0);
+  EXPECT_EQ(computation.GetDuplicates(), 0);
+}
+
+}  // namespace
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -29,6 +29,9 @@
 #include <cassert>
 
 #include "cuda_common.h"
+#if CUDART_VERSION >= 11080
+#include <cuda_fp8.h>
+#endif
 #include "neural/shared/activation.h"
 #include "neural/shared/attention_policy_map.h"
 #include "winograd_helper.inc"
@@ -492,6 +495,42 @@ void expandPlanes_Fp32_NCHW(float* output, const uint64_t* masks,
   ReportCUDAErrors(cudaGetLastError());
 }
 
+// One warp per sample.
+__global__ void gather_legal_policy_kernel(float* output, const float* policy,
+                                           const int* offsets,
+                                           const uint16_t* moves, int N) {
+  const int sample = (threadIdx.x + blockDim.x * blockIdx.x) / 32;
+  const int lane = threadIdx.x % 32;
+  if (sample >= N) return;
+
+  const int begin = offsets[sample];
+  const int end = offsets[sample + 1];
+  const float* logits = policy + sample * kNumOutputPolicy;
+
+  float maxval = -INFINITY;
+  for (int i = begin + lane; i < end; i += 32) {
+    maxval = max(maxval, logits[moves[i]]);
+  }
+  maxval = warpMax(maxval);
+  float sum = 0.0f;
+  for (int i = begin + lane; i < end; i += 32) {
+    sum += exp(logits[moves[i]] - maxval);
+  }
+  const float shift = maxval + log(warpReduce(sum));
+  for (int i = begin + lane; i < end; i += 32) {
+    output[i] = logits[moves[i]] - shift;
+  }
+}
+
+void gatherLegalPolicy(float* output, const float* policy, const int* offsets,
+                       const uint16_t* moves, int N, cudaStream_t stream) {
+  const int blockSize = 128;
+  int blocks = DivUp(N * 32, blockSize);
+  gather_legal_policy_kernel<<<blocks, blockSize, 0, stream>>>(
+      output, policy, offsets, moves, N);
+  ReportCUDAErrors(cudaGetLastError());
+}
+
 // TODO: Can optimize using shared memory if this becomes a bottleneck.
 __global__ void expandPlanes_kernel_Fp16_NHWC(half* output,
                                               const uint64_t* masks,
@@ -930,6 +969,88 @@ void Softmax(int N, int C, T* output, const T* input, const T* input2,
   ReportCUDAErrors(cudaGetLastError());
 }
 
+// Scaled dot product attention of one head of one position per block, with
+// the 64x64 attention weights kept in shared memory. K and V of the head are
+// staged in shared memory, each warp then computes whole rows: a lane gets two
+// of the 64 logits, the softmax is done with warp reductions and the lanes
+// split the depth for the product with V.
+constexpr int kFusedMhaWarps = 8;
+
+template <typename T>
+__global__ void fused_mha_kernel(T* output, const T* q, const T* k,
+                                 const T* v, const T* bias, int heads,
+                                 int depth, int d_model, float factor) {
+  extern __shared__ float shmem[];
+  // Odd stride so that the lanes reading different rows of K don't conflict.
+  const int k_stride = depth | 1;
+  float* k_s = shmem;
+  float* v_s = k_s + 64 * k_stride;
+  float* q_s = v_s + 64 * depth;
+  float* p_s = q_s + kFusedMhaWarps * depth;
+
+  const int n = blockIdx.x / heads;
+  const int h = blockIdx.x % heads;
+  const size_t base = (size_t)n * 64 * d_model + h * depth;
+
+  for (int i = threadIdx.x; i < 64 * depth; i += blockDim.x) {
+    const int row = i / depth;
+    const int d = i % depth;
+    const size_t index = base + row * d_model + d;
+    k_s[row * k_stride + d] = (float)k[index];
+    v_s[row * depth + d] = (float)v[index];
+  }
+  __syncthreads();
+
+  const int warp = threadIdx.x / 32;
+  const int lane = threadIdx.x % 32;
+  float* q_row = q_s + warp * depth;
+  float* p_row = p_s + warp * 64;
+  for (int row = warp; row < 64; row += kFusedMhaWarps) {
+    const size_t row_base = base + row * d_model;
+    for (int d = lane; d < depth; d += 32) {
+      q_row[d] = (float)q[row_base + d] * factor;
+    }
+    __syncwarp();
+
+    float x[2];
+    for (int i = 0; i < 2; i++) {
+      const int j = lane + 32 * i;
+      float sum = 0.0f;
+      for (int d = 0; d < depth; d++) sum += q_row[d] * k_s[j * k_stride + d];
+      if (bias != nullptr) {
+        sum += (float)bias[((size_t)blockIdx.x * 64 + row) * 64 + j];
+      }
+      x[i] = sum;
+    }
+    const float maxval = warpMax(max(x[0], x[1]));
+    x[0] = exp(x[0] - maxval);
+    x[1] = exp(x[1] - maxval);
+    const float scale = 1.0f / warpReduce(x[0] + x[1]);
+    p_row[lane] = x[0] * scale;
+    p_row[lane + 32] = x[1] * scale;
+    __syncwarp();
+
+    for (int d = lane; d < depth; d += 32) {
+      float sum = 0.0f;
+      for (int j = 0; j < 64; j++) sum += p_row[j] * v_s[j * depth + d];
+      output[row_base + d] = (T)sum;
+    }
+    __syncwarp();
+  }
+}
+
+template <typename T>
+void FusedMHA(T* output, const T* q, const T* k, const T* v, const T* bias,
+              int N, int heads, int depth, float factor, cudaStream_t stream) {
+  const int shared_size =
+      (64 * (depth | 1) + 64 * depth + kFusedMhaWarps * (depth + 64)) *
+      sizeof(float);
+  fused_mha_kernel<T><<<N * heads, kFusedMhaWarps * 32, shared_size, stream>>>(
+      output, q, k, v, bias, heads, depth, heads * depth, factor);
+
+  ReportCUDAErrors(cudaGetLastError());
+}
+
 __device__ __forceinline__ float shared_sum_for_layer_norm(float x) {
   // compute warp-wide sum
   float s = warpReduce(x);
@@ -1292,6 +1413,96 @@ void applyInputGating(T* output, const T* input, const T* mult, const T* add,
   ReportCUDAErrors(cudaGetLastError());
 }
 
+// Largest absolute value, as the bits of a non-negative float order like ints.
+template <typename T>
+__global__ void absMax_kernel(float* max, const T* input, int size) {
+  float local_max = 0.0f;
+  for (int i = blockIdx.x * blockDim.x + threadIdx.x; i < size;
+       i += blockDim.x * gridDim.x) {
+    local_max = fmaxf(local_max, fabsf((float)input[i]));
+  }
+  for (int offset = 16; offset > 0; offset /= 2) {
+    local_max =
+        fmaxf(local_max, __shfl_down_sync(0xFFFFFFFF, local_max, offset));
+  }
+  if ((threadIdx.x & 31) == 0) {
+    atomicMax((int*)max, __float_as_int(local_max));
+  }
+}
+
+template <typename T>
+void absMax(float* max, const T* input, int size, cudaStream_t stream) {
+  const int kBlockSize = 256;
+  const int blocks = std::min(DivUp(size, kBlockSize), 1024);
+  absMax_kernel<<<blocks, kBlockSize, 0, stream>>>(max, input, size);
+  ReportCUDAErrors(cudaGetLastError());
+}
+
+template <typename T>
+__global__ void quantizeInt8_kernel(int8_t* output, const T* input,
+                                    float scale, int size) {
+  int i = threadIdx.x + blockDim.x * blockIdx.x;
+  if (i < size) {
+    const float val = rintf((float)input[i] * scale);
+    output[i] = (int8_t)fminf(fmaxf(val, -127.0f), 127.0f);
+  }
+}
+
+template <typename T>
+void quantizeInt8(int8_t* output, const T* input, float scale, int size,
+                  cudaStream_t stream) {
+  const int kBlockSize = 256;
+  int blocks = DivUp(size, kBlockSize);
+  quantizeInt8_kernel<<<blocks, kBlockSize, 0, stream>>>(output, input, scale,
+                                                         size);
+  ReportCUDAErrors(cudaGetLastError());
+}
+
+#if CUDART_VERSION >= 11080
+template <typename T>
+__global__ void quantizeFp8_kernel(uint8_t* output, const T* input,
+                                   float scale, int size) {
+  int i = threadIdx.x + blockDim.x * blockIdx.x;
+  if (i < size) {
+    output[i] = __nv_cvt_float_to_fp8((float)input[i] * scale, __NV_SATFINITE,
+                                      __NV_E4M3);
+  }
+}
+#endif
+
+template <typename T>
+void quantizeFp8(uint8_t* output, const T* input, float scale, int size,
+                 cudaStream_t stream) {
+#if CUDART_VERSION >= 11080
+  const int kBlockSize = 256;
+  int blocks = DivUp(size, kBlockSize);
+  quantizeFp8_kernel<<<blocks, kBlockSize, 0, stream>>>(output, input, scale,
+                                                        size);
+  ReportCUDAErrors(cudaGetLastError());
+#else
+  throw Exception("Fp8 needs CUDA 11.8 or later.");
+#endif
+}
+
+template <typename T>
+__global__ void dequantizeInt32_kernel(T* output, const int32_t* input,
+                                       const float* scales, int size,
+                                       int cols) {
+  int i = threadIdx.x + blockDim.x * blockIdx.x;
+  if (i < size) output[i] = (T)((float)input[i] * scales[i % cols]);
+}
+
+template <typename T>
+void dequantizeInt32(T* output, const int32_t* input, const float* scales,
+                     int rows, int cols, cudaStream_t stream) {
+  const int kBlockSize = 256;
+  const int size = rows * cols;
+  int blocks = DivUp(size, kBlockSize);
+  dequantizeInt32_kernel<<<blocks, kBlockSize, 0, stream>>>(
+      output, input, scales, size, cols);
+  ReportCUDAErrors(cudaGetLastError());
+}
+
 // Template instantiation.
 template void copyTypeConverted<half, float>(half* op, float* ip, int N,
                                              cudaStream_t stream);
@@ -1526,6 +1737,14 @@ template void Softmax<half>(int N, int C, half* output, const half* input,
 template void Softmax<float>(int N, int C, float* output, const float* input,
                              const float* input2, cudaStream_t stream);
 
+template void FusedMHA<half>(half* output, const half* q, const half* k,
+                             const half* v, const half* bias, int N, int heads,
+                             int depth, float factor, cudaStream_t stream);
+template void FusedMHA<float>(float* output, const float* q, const float* k,
+                              const float* v, const float* bias, int N,
+                              int heads, int depth, float factor,
+                              cudaStream_t stream);
+
 template void LayerNorm<half>(int N, int C, half* output, const half* input,
                               const half* bias, const half* skip,
                               const half* gammas, const half* betas, float ep,
@@ -1579,5 +1798,28 @@ template void applyInputGating<float>(float* output, const float* input,
                                       const float* mult, const float* add,
                                       int N, int C, int output_size,
                                       cudaStream_t stream);
+
+template void absMax<half>(float* max, const half* input, int size,
+                           cudaStream_t stream);
+template void absMax<float>(float* max, const float* input, int size,
+                            cudaStream_t stream);
+
+template void quantizeInt8<half>(int8_t* output, const half* input,
+                                 float scale, int size, cudaStream_t stream);
+template void quantizeInt8<float>(int8_t* output, const float* input,
+                                  float scale, int size, cudaStream_t stream);
+
+template void quantizeFp8<half>(uint8_t* output, const half* input,
+                                float scale, int size, cudaStream_t stream);
+template void quantizeFp8<float>(uint8_t* output, const float* input,
+                                 float scale, int size, cudaStream_t stream);
+
+template void dequantizeInt32<half>(half* output, const int32_t* input,
+                                    const float* scales, int rows, int cols,
+                                    cudaStream_t stream);
+template void dequantizeInt32<float>(float* output, const int32_t* input,
+                                     const float* scales, int rows, int cols,
+                                     cudaStream_t stream);
+
 }  // namespace cudnn_backend
 }  // namespace lczero
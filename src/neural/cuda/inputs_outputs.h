@@ -25,6 +25,8 @@
   Program grant you additional permission to convey the resulting work.
 */
 
+#include <unordered_map>
+
 #include "neural/network.h"
 
 namespace lczero {
@@ -33,7 +35,8 @@ namespace cudnn_backend {
 struct InputsOutputs {
   InputsOutputs(int maxBatchSize, bool wdl, bool moves_left,
                 size_t tensor_mem_size = 0, size_t scratch_size = 0,
-                bool cublasDisableTensorCores = false) {
+                bool cublasDisableTensorCores = false,
+                bool pooled_memory = false) {
     ReportCUDAErrors(cudaHostAlloc(
         &input_masks_mem_, maxBatchSize * kInputPlanes * sizeof(uint64_t),
         cudaHostAllocMapped));
@@ -49,6 +52,23 @@ struct InputsOutputs {
     ReportCUDAErrors(cudaHostAlloc(
         &op_policy_mem_, maxBatchSize * kNumOutputPolicy * sizeof(float), 0));
 
+    ReportCUDAErrors(cudaHostAlloc(&legal_offsets_mem_,
+                                   (maxBatchSize + 1) * sizeof(int),
+                                   cudaHostAllocMapped));
+    ReportCUDAErrors(cudaHostGetDevicePointer(&legal_offsets_mem_gpu_,
+                                              legal_offsets_mem_, 0));
+    ReportCUDAErrors(cudaHostAlloc(
+        &legal_moves_mem_, maxBatchSize * kMaxLegalMoves * sizeof(uint16_t),
+        cudaHostAllocMapped));
+    ReportCUDAErrors(
+        cudaHostGetDevicePointer(&legal_moves_mem_gpu_, legal_moves_mem_, 0));
+    ReportCUDAErrors(
+        cudaHostAlloc(&op_legal_policy_mem_,
+                      maxBatchSize * kMaxLegalMoves * sizeof(float), 0));
+    ReportCUDAErrors(
+        cudaMalloc(&op_legal_policy_mem_gpu_,
+                   maxBatchSize * kMaxLegalMoves * sizeof(float)));
+
     // Seperate device memory copy for policy output.
     // It's faster to write to device memory and then copy to host memory
     // than having the kernel write directly to it.
@@ -68,14 +88,17 @@ struct InputsOutputs {
                                                 op_moves_left_mem_, 0));
     }
 
-    // memory for network execution managed inside this structure
+    // memory for network execution managed inside this structure, unless it
+    // comes from a ScratchPool for each evaluation
     if (tensor_mem_size) {
       multi_stream_ = true;
       ReportCUDAErrors(cudaStreamCreate(&stream_));
-      ReportCUDAErrors(cudaMalloc(&scratch_mem_, scratch_size));
-      for (auto& mem : tensor_mem_) {
-        ReportCUDAErrors(cudaMalloc(&mem, tensor_mem_size));
-        ReportCUDAErrors(cudaMemsetAsync(mem, 0, tensor_mem_size, stream_));
+      if (!pooled_memory) {
+        ReportCUDAErrors(cudaMalloc(&scratch_mem_, scratch_size));
+        for (auto& mem : tensor_mem_) {
+          ReportCUDAErrors(cudaMalloc(&mem, tensor_mem_size));
+          ReportCUDAErrors(cudaMemsetAsync(mem, 0, tensor_mem_size, stream_));
+        }
       }
       ReportCUBLASErrors(cublasCreate(&cublas_));
       ReportCUBLASErrors(cublasSetMathMode(
@@ -91,8 +114,15 @@ struct InputsOutputs {
     ReportCUDAErrors(cudaFreeHost(input_val_mem_));
     ReportCUDAErrors(cudaFreeHost(op_policy_mem_));
     ReportCUDAErrors(cudaFree(op_policy_mem_gpu_));
+    ReportCUDAErrors(cudaFreeHost(legal_offsets_mem_));
+    ReportCUDAErrors(cudaFreeHost(legal_moves_mem_));
+    ReportCUDAErrors(cudaFreeHost(op_legal_policy_mem_));
+    ReportCUDAErrors(cudaFree(op_legal_policy_mem_gpu_));
     ReportCUDAErrors(cudaFreeHost(op_value_mem_));
 
+    for (auto& graph : graphs_) {
+      if (graph.second.exec) cudaGraphExecDestroy(graph.second.exec);
+    }
     if (multi_stream_) {
       for (auto mem : tensor_mem_) {
         if (mem) ReportCUDAErrors(cudaFree(mem));
@@ -121,11 +151,24 @@ struct InputsOutputs {
   // This is a seperate copy.
   float* op_policy_mem_gpu_;
 
+  // Legal moves of the samples as policy indices, the moves of sample i are
+  // from legal_offsets_mem_[i] to legal_offsets_mem_[i + 1]. When every
+  // sample has them (compact_policy_) only their log softmax is copied back,
+  // into op_legal_policy_mem_ at the same positions.
+  static constexpr int kMaxLegalMoves = 256;
+  int* legal_offsets_mem_;
+  uint16_t* legal_moves_mem_;
+  float* op_legal_policy_mem_;
+  int* legal_offsets_mem_gpu_;
+  uint16_t* legal_moves_mem_gpu_;
+  float* op_legal_policy_mem_gpu_;
+  bool compact_policy_ = false;
+
   // memory needed to run the network owned by InputsOutputs when multi_stream
   // is enabled
   bool multi_stream_;
-  void* tensor_mem_[3];
-  void* scratch_mem_;
+  void* tensor_mem_[3] = {};
+  void* scratch_mem_ = nullptr;
   void** offset_pointers_ = nullptr;
   void** head_offset_pointers_ = nullptr;
 
@@ -134,6 +177,14 @@ struct InputsOutputs {
 
   // cublas handle used to run the network
   cublasHandle_t cublas_;
+
+  // Forward passes captured on stream_ with the cuda_graphs option, by batch
+  // size. A batch size is run once uncaptured before it's captured.
+  struct ForwardGraph {
+    cudaGraphExec_t exec = nullptr;
+    bool warmed_up = false;
+  };
+  std::unordered_map<int, ForwardGraph> graphs_;
 };
 
 }  // namespace cudnn_backend
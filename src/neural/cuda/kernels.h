@@ -87,6 +87,13 @@ void expandPlanes_Fp16_NHWC(half* output, const uint64_t* masks,
 void expandPlanes_Fp16_NCHW(half* output, const uint64_t* masks,
                             const float* values, int n, cudaStream_t stream);
 
+// Writes the log softmax of the policy logits of the legal moves of each of
+// @N samples to @output. The moves of sample i are the policy indices in
+// @moves from @offsets[i] to @offsets[i + 1], the output is at the same
+// positions.
+void gatherLegalPolicy(float* output, const float* policy, const int* offsets,
+                       const uint16_t* moves, int N, cudaStream_t stream);
+
 // Perform global avg pool.
 template <typename T>
 void globalAvgPool(int N, int C, T* output, const T* input,
@@ -135,6 +142,15 @@ template <typename T>
 void Softmax(int N, int C, T* output, const T* input, const T* input2,
              cudaStream_t stream);
 
+// Attention of @N positions with @heads heads of @depth over 64 tokens:
+// output = softmax(factor * q * k^T + bias) * v per head, with q, k, v and
+// output in (N, 64, heads * depth) layout and the optional bias (smolgen) in
+// (N, heads, 64, 64). Needs depth <= kMaxFusedMhaDepth.
+constexpr int kMaxFusedMhaDepth = 64;
+template <typename T>
+void FusedMHA(T* output, const T* q, const T* k, const T* v, const T* bias,
+              int N, int heads, int depth, float factor, cudaStream_t stream);
+
 template <typename T>
 void LayerNorm(int N, int C, T* output, const T* input, const T* bias,
                const T* skip, const T* gammas, const T* betas, float ep,
@@ -153,5 +169,26 @@ void inputPreprocessForAttentionBody(T* output, const T* input,
 template <typename T>
 void applyInputGating(T* output, const T* input, const T* mult, const T* add,
                       int N, int HW, int C, cudaStream_t stream);
+
+// Raises *max to the largest absolute value of @size elements of @input.
+template <typename T>
+void absMax(float* max, const T* input, int size, cudaStream_t stream);
+
+// Rounds @input multiplied by @scale to int8, saturating at +-127.
+template <typename T>
+void quantizeInt8(int8_t* output, const T* input, float scale, int size,
+                  cudaStream_t stream);
+
+// Rounds @input multiplied by @scale to the bits of fp8 E4M3 values,
+// saturating at +-448. Needs CUDA 11.8.
+template <typename T>
+void quantizeFp8(uint8_t* output, const T* input, float scale, int size,
+                 cudaStream_t stream);
+
+// Converts the int32 results of an int8 GEMM back, scaling column c of the
+// @rows x @cols row major matrix by scales[c].
+template <typename T>
+void dequantizeInt32(T* output, const int32_t* input, const float* scales,
+                     int rows, int cols, cudaStream_t stream);
 }  // namespace cudnn_backend
 }  // namespace lczero
@@ -26,8 +26,13 @@
 */
 #include "layers.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
 #include <vector>
 
 #include "cuda_common.h"
@@ -102,6 +107,146 @@ namespace cudnn_backend {
 // than using multiple passes. The flag can be set to false for debugging.
 static constexpr bool kUseFusedSELayer = true;
 
+GemmTuner& GemmTuner::Get() {
+  static GemmTuner tuner;
+  return tuner;
+}
+
+void GemmTuner::Configure(const std::string& filename, bool tune) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  filename_ = filename;
+  tune_ = tune;
+  std::ifstream file(filename);
+  std::string line;
+  // Lines are "<gpu name>\t<fp16> <transa> <transb> <m> <n> <k>\t<algo>".
+  while (std::getline(file, line)) {
+    const auto tab1 = line.find('\t');
+    const auto tab2 = line.rfind('\t');
+    if (tab1 == std::string::npos || tab1 == tab2) continue;
+    std::istringstream fields(line.substr(tab1 + 1));
+    int fp16, transa, transb, algo;
+    Shape shape;
+    if (!(fields >> fp16 >> transa >> transb >> shape.m >> shape.n >>
+          shape.k >> algo)) {
+      continue;
+    }
+    shape.fp16 = fp16;
+    shape.transa = static_cast<cublasOperation_t>(transa);
+    shape.transb = static_cast<cublasOperation_t>(transb);
+    algos_[{line.substr(0, tab1), shape}] =
+        static_cast<cublasGemmAlgo_t>(algo);
+  }
+}
+
+const std::string& GemmTuner::DeviceName() {
+  int device;
+  ReportCUDAErrors(cudaGetDevice(&device));
+  if (device >= static_cast<int>(device_names_.size())) {
+    device_names_.resize(device + 1);
+  }
+  if (device_names_[device].empty()) {
+    cudaDeviceProp prop;
+    ReportCUDAErrors(cudaGetDeviceProperties(&prop, device));
+    device_names_[device] = prop.name;
+  }
+  return device_names_[device];
+}
+
+cublasGemmAlgo_t GemmTuner::GetAlgo(
+    const Shape& shape, cudaStream_t stream,
+    const std::function<bool(cublasGemmAlgo_t)>& run) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (algos_.empty() && !tune_) return CUBLAS_GEMM_DEFAULT;
+  const auto key = std::make_pair(DeviceName(), shape);
+  const auto iter = algos_.find(key);
+  if (iter != algos_.end()) return iter->second;
+  if (!tune_) return CUBLAS_GEMM_DEFAULT;
+  // Nothing can be timed while a CUDA graph is captured.
+  cudaStreamCaptureStatus capture;
+  ReportCUDAErrors(cudaStreamIsCapturing(stream, &capture));
+  if (capture != cudaStreamCaptureStatusNone) return CUBLAS_GEMM_DEFAULT;
+
+  const cublasGemmAlgo_t algo = Tune(shape, stream, run);
+  algos_[key] = algo;
+  std::ofstream file(filename_, std::ios::app);
+  file << key.first << "\t" << shape.fp16 << " " << shape.transa << " "
+       << shape.transb << " " << shape.m << " " << shape.n << " " << shape.k
+       << "\t" << algo << "\n";
+  return algo;
+}
+
+cublasGemmAlgo_t GemmTuner::Tune(
+    const Shape& shape, cudaStream_t stream,
+    const std::function<bool(cublasGemmAlgo_t)>& run) {
+  std::vector<cublasGemmAlgo_t> candidates = {CUBLAS_GEMM_DEFAULT,
+                                              CUBLAS_GEMM_DEFAULT_TENSOR_OP};
+  for (int i = CUBLAS_GEMM_ALGO0; i <= CUBLAS_GEMM_ALGO23; i++) {
+    candidates.push_back(static_cast<cublasGemmAlgo_t>(i));
+  }
+  for (int i = CUBLAS_GEMM_ALGO0_TENSOR_OP; i <= CUBLAS_GEMM_ALGO15_TENSOR_OP;
+       i++) {
+    candidates.push_back(static_cast<cublasGemmAlgo_t>(i));
+  }
+
+  constexpr int kRuns = 3;
+  cudaEvent_t start, stop;
+  ReportCUDAErrors(cudaEventCreate(&start));
+  ReportCUDAErrors(cudaEventCreate(&stop));
+  cublasGemmAlgo_t best = CUBLAS_GEMM_DEFAULT;
+  float best_time = std::numeric_limits<float>::max();
+  for (const auto algo : candidates) {
+    // The first run also checks that the algorithm supports the shape.
+    if (!run(algo)) continue;
+    ReportCUDAErrors(cudaEventRecord(start, stream));
+    for (int i = 0; i < kRuns; i++) run(algo);
+    ReportCUDAErrors(cudaEventRecord(stop, stream));
+    ReportCUDAErrors(cudaEventSynchronize(stop));
+    float time;
+    ReportCUDAErrors(cudaEventElapsedTime(&time, start, stop));
+    if (time < best_time) {
+      best_time = time;
+      best = algo;
+    }
+  }
+  ReportCUDAErrors(cudaEventDestroy(start));
+  ReportCUDAErrors(cudaEventDestroy(stop));
+  return best;
+}
+
+template <typename DataType>
+static void cublasXgemm(cublasHandle_t handle, cublasOperation_t transa,
+                        cublasOperation_t transb, int m, int n, int k,
+                        float alpha, const DataType* A, int lda,
+                        const DataType* B, int ldb, float beta, DataType* C,
+                        int ldc) {
+  const bool fp16 = std::is_same<half, DataType>::value;
+  unsigned short alpha_h = FP32toFP16(alpha);
+  unsigned short beta_h = FP32toFP16(beta);
+  const void* alpha_p = fp16 ? (const void*)&alpha_h : (const void*)&alpha;
+  const void* beta_p = fp16 ? (const void*)&beta_h : (const void*)&beta;
+  const cudaDataType_t type = fp16 ? CUDA_R_16F : CUDA_R_32F;
+  auto run = [&](cublasGemmAlgo_t algo) {
+    return cublasGemmEx(handle, transa, transb, m, n, k, alpha_p, A, type, lda,
+                        B, type, ldb, beta_p, C, type, ldc, type,
+                        algo) == CUBLAS_STATUS_SUCCESS;
+  };
+  cublasGemmAlgo_t algo = CUBLAS_GEMM_DEFAULT;
+  // Tuning runs the GEMM repeatedly, so it has to overwrite its output.
+  if (beta == 0.0f) {
+    cudaStream_t stream;
+    ReportCUBLASErrors(cublasGetStream(handle, &stream));
+    // Row counts are rounded up to powers of two, so that the batch sizes
+    // share a few tuned shapes.
+    int rows = 1;
+    while (rows < n) rows *= 2;
+    algo = GemmTuner::Get().GetAlgo({fp16, transa, transb, m, rows, k}, stream,
+                                    run);
+  }
+  ReportCUBLASErrors(cublasGemmEx(handle, transa, transb, m, n, k, alpha_p, A,
+                                  type, lda, B, type, ldb, beta_p, C, type,
+                                  ldc, type, algo));
+}
+
 template <typename DataType>
 BaseLayer<DataType>::BaseLayer(int c, int h, int w, BaseLayer* ip, bool nhwc)
     : input_(ip), C(c), H(h), W(w), nhwc_(nhwc), use_gemm_ex_(false) {}
@@ -631,15 +776,12 @@ void FCLayer<half>::Eval(int N, half* output_tensor, const half* input_tensor,
   const int num_outputs = C * H * W;
   const int num_inputs = input_->GetC() * input_->GetH() * input_->GetW();
 
-  // half alpha = float2half_rn(1.0f), beta = float2half_rn(0.0f);
-  const __half_raw one_h{0x3C00};
-  const __half_raw zero_h{0};
-  half alpha = one_h;
-  half beta = zero_h;
-  ReportCUBLASErrors(cublasHgemm(cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs,
-                                 N, num_inputs, &alpha, weights_, num_inputs,
-                                 input_tensor, num_inputs, &beta, output_tensor,
-                                 num_outputs));
+  if (!quantized_ ||
+      !quantized_->Eval(N, output_tensor, input_tensor, cublas, stream)) {
+    cublasXgemm<half>(cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, N,
+                      num_inputs, 1.0f, weights_, num_inputs, input_tensor,
+                      num_inputs, 0.0f, output_tensor, num_outputs);
+  }
 
   if (use_bias_ || (act_ != ACTIVATION_NONE)) {
     addVectors(output_tensor, biases_, output_tensor, num_outputs * N,
@@ -656,11 +798,12 @@ void FCLayer<float>::Eval(int N, float* output_tensor,
   const int num_outputs = C * H * W;
   const int num_inputs = input_->GetC() * input_->GetH() * input_->GetW();
 
-  float alpha = 1.0f, beta = 0.0f;
-  ReportCUBLASErrors(cublasSgemm(cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs,
-                                 N, num_inputs, &alpha, weights_, num_inputs,
-                                 input_tensor, num_inputs, &beta, output_tensor,
-                                 num_outputs));
+  if (!quantized_ ||
+      !quantized_->Eval(N, output_tensor, input_tensor, cublas, stream)) {
+    cublasXgemm<float>(cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, N,
+                       num_inputs, 1.0f, weights_, num_inputs, input_tensor,
+                       num_inputs, 0.0f, output_tensor, num_outputs);
+  }
 
   if (use_bias_ || (act_ != ACTIVATION_NONE)) {
     addVectors(output_tensor, biases_, output_tensor, num_outputs * N,
@@ -1576,23 +1719,330 @@ EncoderBlock<DataType>::EncoderBlock(
   }
 }
 
+namespace {
+float ToFloat(float x) { return x; }
+float ToFloat(half x) {
+  uint16_t bits;
+  std::memcpy(&bits, &x, sizeof(bits));
+  return FP16toFP32(bits);
+}
+}  // namespace
+
+// FP8 GEMMs need cublasLt, and CUDA 11.8 for the E4M3 type.
+#if defined(USE_CUBLASLT) && CUDART_VERSION >= 11080
+#define USE_FP8_GEMM
+#endif
+
 template <typename DataType>
-static void cublasXgemm(cublasHandle_t handle, cublasOperation_t transa,
-                        cublasOperation_t transb, int m, int n, int k,
-                        float alpha, const DataType* A, int lda,
-                        const DataType* B, int ldb, float beta, DataType* C,
-                        int ldc) {
-  const bool fp16 = std::is_same<half, DataType>::value;
-  if (fp16) {
-    unsigned short alpha_h = FP32toFP16(alpha);
-    unsigned short beta_h = FP32toFP16(beta);
-    ReportCUBLASErrors(cublasHgemm(
-        handle, transa, transb, m, n, k, (const half*)&alpha_h, (const half*)A,
-        lda, (const half*)B, ldb, (const half*)&beta_h, (half*)C, ldc));
+QuantizedGemm<DataType>::QuantizedGemm(const DataType* weights,
+                                       int num_outputs, int num_inputs,
+                                       QuantizedContext<DataType>* context)
+    : num_outputs_(num_outputs),
+      num_inputs_(num_inputs),
+      context_(context),
+      max_quantized_(context->type() == Quantization::kFp8 ? 448.0f : 127.0f),
+      weight_scales_(num_outputs) {
+  const size_t size = static_cast<size_t>(num_outputs) * num_inputs;
+  ReportCUDAErrors(cudaMalloc(&weights_, size));
+  ReportCUDAErrors(cudaMalloc(&input_range_, sizeof(float)));
+  ReportCUDAErrors(cudaMemset(input_range_, 0, sizeof(float)));
+  if (context->type() == Quantization::kFp8) {
+    // A single scale, so the weights are quantized where they are.
+    absMax(input_range_, weights, static_cast<int>(size), 0);
+    float range;
+    ReportCUDAErrors(cudaMemcpy(&range, input_range_, sizeof(float),
+                                cudaMemcpyDeviceToHost));
+    weight_scales_.assign(1, range > 0.0f ? range / max_quantized_ : 1.0f);
+    quantizeFp8(reinterpret_cast<uint8_t*>(weights_), weights,
+                1.0f / weight_scales_[0], static_cast<int>(size), 0);
+    ReportCUDAErrors(cudaMemset(input_range_, 0, sizeof(float)));
+    ReportCUDAErrors(cudaMalloc(&output_scales_, 2 * sizeof(float)));
+    context->Register(this);
+    return;
+  }
+
+  std::vector<DataType> cpu_weights(size);
+  ReportCUDAErrors(cudaMemcpy(cpu_weights.data(), weights,
+                              size * sizeof(DataType),
+                              cudaMemcpyDeviceToHost));
+  std::vector<int8_t> quantized(size);
+  for (int o = 0; o < num_outputs; o++) {
+    const DataType* row = &cpu_weights[static_cast<size_t>(o) * num_inputs];
+    float range = 0.0f;
+    for (int i = 0; i < num_inputs; i++) {
+      range = std::max(range, std::abs(ToFloat(row[i])));
+    }
+    weight_scales_[o] = range > 0.0f ? range / max_quantized_ : 1.0f;
+    for (int i = 0; i < num_inputs; i++) {
+      quantized[static_cast<size_t>(o) * num_inputs + i] =
+          static_cast<int8_t>(std::lround(ToFloat(row[i]) / weight_scales_[o]));
+    }
+  }
+  ReportCUDAErrors(cudaMemcpy(weights_, quantized.data(), size,
+                              cudaMemcpyHostToDevice));
+  ReportCUDAErrors(cudaMalloc(&output_scales_, num_outputs * sizeof(float)));
+  context->Register(this);
+}
+
+template <typename DataType>
+QuantizedGemm<DataType>::~QuantizedGemm() {
+  ReportCUDAErrors(cudaFree(weights_));
+  ReportCUDAErrors(cudaFree(output_scales_));
+  ReportCUDAErrors(cudaFree(input_range_));
+}
+
+template <typename DataType>
+bool QuantizedGemm<DataType>::IsSupported(Quantization type, int num_outputs,
+                                          int num_inputs) {
+  switch (type) {
+    case Quantization::kInt8:
+#if CUDART_VERSION >= 11020
+      // Int8 tensor core GEMMs need leading dimensions which are multiples
+      // of 4.
+      return num_outputs % 4 == 0 && num_inputs % 4 == 0;
+#else
+      return false;
+#endif
+    case Quantization::kFp8:
+#ifdef USE_FP8_GEMM
+      // And fp8 ones multiples of 16.
+      return num_outputs % 16 == 0 && num_inputs % 16 == 0;
+#else
+      return false;
+#endif
+  }
+  return false;
+}
+
+template <typename DataType>
+bool QuantizedGemm<DataType>::Eval(int rows, DataType* output,
+                                   const DataType* input,
+                                   cublasHandle_t cublas,
+                                   cudaStream_t stream) const {
+  if (!context_->IsCalibrated()) {
+    absMax(input_range_, input, rows * num_inputs_, stream);
+    return false;
+  }
+  if (context_->type() == Quantization::kFp8) {
+    return EvalFp8(rows, output, input, stream);
+  }
+#if CUDART_VERSION >= 11020
+  const int32_t alpha = 1;
+  const int32_t beta = 0;
+  for (int start = 0; start < rows; start += kMaxRows) {
+    const int chunk = std::min(kMaxRows, rows - start);
+    int8_t* quantized;
+    int32_t* result;
+    ReportCUDAErrors(cudaMallocAsync(&quantized, chunk * num_inputs_, stream));
+    ReportCUDAErrors(cudaMallocAsync(
+        &result, sizeof(int32_t) * chunk * num_outputs_, stream));
+    quantizeInt8(quantized, input + start * num_inputs_, input_scale_,
+                 chunk * num_inputs_, stream);
+    ReportCUBLASErrors(cublasGemmEx(
+        cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs_, chunk, num_inputs_,
+        &alpha, weights_, CUDA_R_8I, num_inputs_, quantized, CUDA_R_8I,
+        num_inputs_, &beta, result, CUDA_R_32I, num_outputs_,
+        CUBLAS_COMPUTE_32I, CUBLAS_GEMM_DEFAULT));
+    dequantizeInt32(output + start * num_outputs_, result, output_scales_,
+                    chunk, num_outputs_, stream);
+    ReportCUDAErrors(cudaFreeAsync(quantized, stream));
+    ReportCUDAErrors(cudaFreeAsync(result, stream));
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+template <typename DataType>
+bool QuantizedGemm<DataType>::EvalFp8(int rows, DataType* output,
+                                      const DataType* input,
+                                      cudaStream_t stream) const {
+#ifdef USE_FP8_GEMM
+  // cublasLt only has fp8 GEMMs with the first operand transposed, which is
+  // the layout of the weights. It scales the result by the weight and input
+  // scales, so the output comes out in DataType directly.
+  const cudaDataType_t output_type =
+      std::is_same<half, DataType>::value ? CUDA_R_16F : CUDA_R_32F;
+  const cublasOperation_t transa = CUBLAS_OP_T;
+  const cublasOperation_t transb = CUBLAS_OP_N;
+  const float* weight_scale = output_scales_;
+  const float* input_scale = output_scales_ + 1;
+  cublasLtMatmulDesc_t desc;
+  ReportCUBLASErrors(
+      cublasLtMatmulDescCreate(&desc, CUBLAS_COMPUTE_32F, CUDA_R_32F));
+  ReportCUBLASErrors(cublasLtMatmulDescSetAttribute(
+      desc, CUBLASLT_MATMUL_DESC_TRANSA, &transa, sizeof(transa)));
+  ReportCUBLASErrors(cublasLtMatmulDescSetAttribute(
+      desc, CUBLASLT_MATMUL_DESC_TRANSB, &transb, sizeof(transb)));
+  ReportCUBLASErrors(cublasLtMatmulDescSetAttribute(
+      desc, CUBLASLT_MATMUL_DESC_A_SCALE_POINTER, &weight_scale,
+      sizeof(weight_scale)));
+  ReportCUBLASErrors(cublasLtMatmulDescSetAttribute(
+      desc, CUBLASLT_MATMUL_DESC_B_SCALE_POINTER, &input_scale,
+      sizeof(input_scale)));
+
+  const float alpha = 1.0f;
+  const float beta = 0.0f;
+  for (int start = 0; start < rows; start += kMaxRows) {
+    const int chunk = std::min(kMaxRows, rows - start);
+    cublasLtMatrixLayout_t weights_layout, input_layout, output_layout;
+    ReportCUBLASErrors(cublasLtMatrixLayoutCreate(
+        &weights_layout, CUDA_R_8F_E4M3, num_inputs_, num_outputs_,
+        num_inputs_));
+    ReportCUBLASErrors(cublasLtMatrixLayoutCreate(
+        &input_layout, CUDA_R_8F_E4M3, num_inputs_, chunk, num_inputs_));
+    ReportCUBLASErrors(cublasLtMatrixLayoutCreate(
+        &output_layout, output_type, num_outputs_, chunk, num_outputs_));
+
+    uint8_t* quantized;
+    ReportCUDAErrors(cudaMallocAsync(&quantized, chunk * num_inputs_, stream));
+    quantizeFp8(quantized, input + start * num_inputs_, input_scale_,
+                chunk * num_inputs_, stream);
+    DataType* result = output + start * num_outputs_;
+    ReportCUBLASErrors(cublasLtMatmul(
+        context_->cublaslt(), desc, &alpha, weights_, weights_layout,
+        quantized, input_layout, &beta, result, output_layout, result,
+        output_layout, nullptr, nullptr, 0, stream));
+    ReportCUDAErrors(cudaFreeAsync(quantized, stream));
+
+    ReportCUBLASErrors(cublasLtMatrixLayoutDestroy(weights_layout));
+    ReportCUBLASErrors(cublasLtMatrixLayoutDestroy(input_layout));
+    ReportCUBLASErrors(cublasLtMatrixLayoutDestroy(output_layout));
+  }
+  ReportCUBLASErrors(cublasLtMatmulDescDestroy(desc));
+  return true;
+#else
+  (void)rows;
+  (void)output;
+  (void)input;
+  (void)stream;
+  return false;
+#endif
+}
+
+template <typename DataType>
+float QuantizedGemm<DataType>::GetInputRange() const {
+  float range;
+  ReportCUDAErrors(cudaMemcpy(&range, input_range_, sizeof(float),
+                              cudaMemcpyDeviceToHost));
+  return range;
+}
+
+template <typename DataType>
+void QuantizedGemm<DataType>::SetInputRange(float range) {
+  // An input never seen gets the scale of values up to 1.
+  if (!(range > 0.0f)) range = 1.0f;
+  input_scale_ = max_quantized_ / range;
+  std::vector<float> output_scales;
+  if (context_->type() == Quantization::kFp8) {
+    output_scales = {weight_scales_[0], 1.0f / input_scale_};
   } else {
-    ReportCUBLASErrors(cublasSgemm(handle, transa, transb, m, n, k, &alpha,
-                                   (const float*)A, lda, (const float*)B, ldb,
-                                   &beta, (float*)C, ldc));
+    output_scales.resize(num_outputs_);
+    for (int o = 0; o < num_outputs_; o++) {
+      output_scales[o] = weight_scales_[o] / input_scale_;
+    }
+  }
+  ReportCUDAErrors(cudaMemcpy(output_scales_, output_scales.data(),
+                              output_scales.size() * sizeof(float),
+                              cudaMemcpyHostToDevice));
+  ReportCUDAErrors(
+      cudaMemcpy(input_range_, &range, sizeof(float), cudaMemcpyHostToDevice));
+}
+
+template <typename DataType>
+QuantizedContext<DataType>::QuantizedContext(Quantization type)
+    : type_(type) {
+#ifdef USE_CUBLASLT
+  if (type == Quantization::kFp8) {
+    ReportCUBLASErrors(cublasLtCreate(&cublaslt_));
+  }
+#endif
+}
+
+template <typename DataType>
+QuantizedContext<DataType>::~QuantizedContext() {
+#ifdef USE_CUBLASLT
+  if (cublaslt_) cublasLtDestroy(cublaslt_);
+#endif
+}
+
+template <typename DataType>
+void QuantizedContext<DataType>::FinishCalibration() {
+  ReportCUDAErrors(cudaDeviceSynchronize());
+  for (auto* gemm : gemms_) gemm->SetInputRange(gemm->GetInputRange());
+  calibrated_.store(true, std::memory_order_release);
+}
+
+template <typename DataType>
+bool QuantizedContext<DataType>::Load(const std::string& filename) {
+  std::ifstream file(filename);
+  if (!file) return false;
+  size_t count = 0;
+  file >> count;
+  if (!file || count != gemms_.size()) {
+    throw Exception("Quantization scales in " + filename +
+                    " are not for this network.");
+  }
+  for (auto* gemm : gemms_) {
+    float range;
+    if (!(file >> range)) {
+      throw Exception("Bad quantization scales in " + filename);
+    }
+    gemm->SetInputRange(range);
+  }
+  calibrated_.store(true, std::memory_order_release);
+  return true;
+}
+
+template <typename DataType>
+void QuantizedContext<DataType>::Save(const std::string& filename) const {
+  std::ofstream file(filename);
+  file << gemms_.size() << "\n";
+  for (const auto* gemm : gemms_) file << gemm->GetInputRange() << "\n";
+  if (!file) {
+    throw Exception("Unable to write quantization scales to " + filename);
+  }
+}
+
+template <typename DataType>
+void FCLayer<DataType>::EnableQuantization(
+    QuantizedContext<DataType>* context) {
+  const int num_outputs = C * H * W;
+  const int num_inputs = input_->GetC() * input_->GetH() * input_->GetW();
+  if (QuantizedGemm<DataType>::IsSupported(context->type(), num_outputs,
+                                           num_inputs)) {
+    quantized_ = std::make_unique<QuantizedGemm<DataType>>(
+        weights_, num_outputs, num_inputs, context);
+  }
+}
+
+template <typename DataType>
+void EncoderBlock<DataType>::EnableQuantization(
+    QuantizedContext<DataType>* context) {
+  const int d_model = mha_q_size_;
+  auto supported = [&](int num_outputs, int num_inputs) {
+    return QuantizedGemm<DataType>::IsSupported(context->type(), num_outputs,
+                                                num_inputs);
+  };
+  if (supported(d_model, embedding_op_size_)) {
+    for (int i = 0; i < 3; i++) {
+      mha_qkv_quantized_[i] = std::make_unique<QuantizedGemm<DataType>>(
+          mha_qkv_w + i * embedding_op_size_ * d_model, d_model,
+          embedding_op_size_, context);
+    }
+  }
+  if (supported(embedding_op_size_, d_model)) {
+    mha_dense_quantized_ = std::make_unique<QuantizedGemm<DataType>>(
+        mha_dense_w, embedding_op_size_, d_model, context);
+  }
+  if (supported(ffn_dense1_size_, embedding_op_size_)) {
+    ffn_dense1_quantized_ = std::make_unique<QuantizedGemm<DataType>>(
+        ffn_dense1_w, ffn_dense1_size_, embedding_op_size_, context);
+  }
+  if (supported(embedding_op_size_, ffn_dense1_size_)) {
+    ffn_dense2_quantized_ = std::make_unique<QuantizedGemm<DataType>>(
+        ffn_dense2_w, embedding_op_size_, ffn_dense1_size_, context);
   }
 }
 
@@ -1731,10 +2181,22 @@ void EncoderBlock<DataType>::Eval(int N, DataType* in_out_tensor,
     mha_k = mha_q + num_outputs * max_batch;
     mha_v = mha_k + num_outputs * max_batch;
 
-    cublasXGemmStridedBatched<DataType>(
-        cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, batch, num_inputs, 1.0f,
-        mha_qkv_w, num_inputs, num_inputs * num_outputs, in_out_tensor,
-        num_inputs, 0, 0.0f, mha_q, num_outputs, num_outputs * max_batch, 3);
+    bool computed = false;
+    if (mha_qkv_quantized_[0]) {
+      // Every gemm has to run so that all of them are calibrated.
+      computed = true;
+      for (int i = 0; i < 3; i++) {
+        computed &= mha_qkv_quantized_[i]->Eval(
+            batch, mha_q + i * num_outputs * max_batch, in_out_tensor, cublas,
+            stream);
+      }
+    }
+    if (!computed) {
+      cublasXGemmStridedBatched<DataType>(
+          cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, batch, num_inputs,
+          1.0f, mha_qkv_w, num_inputs, num_inputs * num_outputs, in_out_tensor,
+          num_inputs, 0, 0.0f, mha_q, num_outputs, num_outputs * max_batch, 3);
+    }
     addBiasBatched<DataType>(mha_q, mha_q, mha_qkv_b, 3, batch, num_outputs,
                              max_batch, ACTIVATION_NONE, stream);
   }
@@ -1758,96 +2220,114 @@ void EncoderBlock<DataType>::Eval(int N, DataType* in_out_tensor,
   // shape(k)[-1] = depth
   float factor = 1.0f / sqrt((float)depth);
 
-  // matmul_qk = tf.matmul(q, k, transpose_b=True)
-  {
-    if (*offset_pointers == nullptr) {
-      std::vector<DataType*> offsets(encoder_heads_ * max_batch_size_ * 5);
-      for (int i = 0; i < encoder_heads_ * max_batch_size_; i++) {
-        int h = i % encoder_heads_;
-        int n = i / encoder_heads_;
-        offsets[i] = mha_k + h * depth + 64 * d_model * n;
-        offsets[i + encoder_heads_ * max_batch_size_] =
-            mha_q + h * depth + 64 * d_model * n;
-        offsets[i + 2 * encoder_heads_ * max_batch_size_] =
-            buffer1 + i * 64 * 64;
-        offsets[i + 3 * encoder_heads_ * max_batch_size_] =
-            mha_v + h * depth + 64 * d_model * n;
-        offsets[i + 4 * encoder_heads_ * max_batch_size_] =
-            buffer2 + h * depth + 64 * d_model * n;
+  // The attention of the usual head depths is computed by one kernel without
+  // writing the attention weights to memory. Its output goes to buffer1, as
+  // buffer2 still holds the smolgen weights it reads.
+  const bool fused_mha = depth <= kMaxFusedMhaDepth;
+  DataType* mha_out = fused_mha ? buffer1 : buffer2;
+  DataType* mha_dense_out = fused_mha ? buffer2 : buffer1;
+  if (fused_mha) {
+    FusedMHA<DataType>(buffer1, mha_q, mha_k, mha_v,
+                       has_smolgen_ ? buffer2 : nullptr, N, encoder_heads_,
+                       depth, factor, stream);
+  } else {
+    // matmul_qk = tf.matmul(q, k, transpose_b=True)
+    {
+      if (*offset_pointers == nullptr) {
+        std::vector<DataType*> offsets(encoder_heads_ * max_batch_size_ * 5);
+        for (int i = 0; i < encoder_heads_ * max_batch_size_; i++) {
+          int h = i % encoder_heads_;
+          int n = i / encoder_heads_;
+          offsets[i] = mha_k + h * depth + 64 * d_model * n;
+          offsets[i + encoder_heads_ * max_batch_size_] =
+              mha_q + h * depth + 64 * d_model * n;
+          offsets[i + 2 * encoder_heads_ * max_batch_size_] =
+              buffer1 + i * 64 * 64;
+          offsets[i + 3 * encoder_heads_ * max_batch_size_] =
+              mha_v + h * depth + 64 * d_model * n;
+          offsets[i + 4 * encoder_heads_ * max_batch_size_] =
+              buffer2 + h * depth + 64 * d_model * n;
+        }
+        ReportCUDAErrors(cudaMalloc(
+            (void**)offset_pointers,
+            encoder_heads_ * max_batch_size_ * 5 * sizeof(DataType*)));
+        ReportCUDAErrors(
+            cudaMemcpy(*offset_pointers, offsets.data(),
+                       encoder_heads_ * max_batch_size_ * 5 * sizeof(DataType*),
+                       cudaMemcpyHostToDevice));
       }
-      ReportCUDAErrors(
-          cudaMalloc((void**)offset_pointers,
-                     encoder_heads_ * max_batch_size_ * 5 * sizeof(DataType*)));
-      ReportCUDAErrors(
-          cudaMemcpy(*offset_pointers, offsets.data(),
-                     encoder_heads_ * max_batch_size_ * 5 * sizeof(DataType*),
-                     cudaMemcpyHostToDevice));
+      cublasXGemmBatched<DataType>(
+          cublas, CUBLAS_OP_T, CUBLAS_OP_N, 64 /*M*/, 64 /*N*/,
+          depth /*K*/,  // A/B, and M/N are swapped for row-major to col-major
+                        // transform
+          factor,       // to handle "/ tf.math.sqrt(dk)"
+          *offset_pointers,  // mha_k + offset /*A*/,
+          d_model /*LDA*/,   // (d_model = depth * encoder_heads_) to skip over
+                             // other "depth" slices / heads
+          // 64 * d_model,     /*strideA*/
+          *offset_pointers +
+              encoder_heads_ * max_batch_size_,  // mha_q + offset /*B*/,
+          d_model /*LDB*/,  // to skip over other other "depth" slices / heads
+          // 64 * d_model,     /*strideB*/
+          0.0f,
+          *offset_pointers + encoder_heads_ * max_batch_size_ *
+                                 2,  // buffer1 + outOffset /*C*/,  // output
+                                     // (matmul_qk) goes to buffer1
+          64 /*LDC*/,
+          // 64 * 64 /*strideC*/,
+          N * encoder_heads_);
+    }
+
+    // attention_weights = tf.nn.softmax(scaled_attention_logits, axis = -1)
+    // attention_weights -> buffer1
+    if (has_smolgen_) {
+      // Add smolgen weights to the scaled matmul_qk attention logits before
+      // softmax.
+      Softmax(encoder_heads_ * N * 64, 64, buffer1, buffer1, buffer2, stream);
+    } else {
+      Softmax(encoder_heads_ * N * 64, 64, buffer1, buffer1,
+              (const DataType*)nullptr, stream);
+    }
+
+    {
+      cublasXGemmBatched<DataType>(
+          cublas, CUBLAS_OP_N, CUBLAS_OP_N, depth /*M*/, 64 /*N*/, 64 /*K*/,
+          1.0f,
+          *offset_pointers + encoder_heads_ * max_batch_size_ *
+                                 3,  // mha_v + offset /*A*/,  // "v" matrix
+          d_model /*LDA*/,  // to skip over other "depth" slices / heads
+          // 64 * d_model,          /*strideA*/
+          *offset_pointers + encoder_heads_ * max_batch_size_ *
+                                 2,  // buffer1 + weightsOffset /*B*/,
+          64 /*LDB*/,                // 64 * 64, /*strideB*/
+          0.0f,
+          *offset_pointers +
+              encoder_heads_ * max_batch_size_ *
+                  4,  // buffer2 + offset /*C*/,  // output goes to buffer2
+          d_model /*LDC*/,
+          // 64 * d_model /*strideC*/,
+          N * encoder_heads_);
     }
-    cublasXGemmBatched<DataType>(
-        cublas, CUBLAS_OP_T, CUBLAS_OP_N, 64 /*M*/, 64 /*N*/,
-        depth /*K*/,  // A/B, and M/N are swapped for row-major to col-major
-                      // transform
-        factor,       // to handle "/ tf.math.sqrt(dk)"
-        *offset_pointers,  // mha_k + offset /*A*/,
-        d_model /*LDA*/,   // (d_model = depth * encoder_heads_) to skip over
-                           // other "depth" slices / heads
-        // 64 * d_model,     /*strideA*/
-        *offset_pointers +
-            encoder_heads_ * max_batch_size_,  // mha_q + offset /*B*/,
-        d_model /*LDB*/,  // to skip over other other "depth" slices / heads
-        // 64 * d_model,     /*strideB*/
-        0.0f,
-        *offset_pointers + encoder_heads_ * max_batch_size_ *
-                               2,  // buffer1 + outOffset /*C*/,  // output
-                                   // (matmul_qk) goes to buffer1
-        64 /*LDC*/,
-        // 64 * 64 /*strideC*/,
-        N * encoder_heads_);
-  }
-
-  // attention_weights = tf.nn.softmax(scaled_attention_logits, axis = -1)
-  // attention_weights -> buffer1
-  if (has_smolgen_) {
-    // Add smolgen weights to the scaled matmul_qk attention logits before
-    // softmax.
-    Softmax(encoder_heads_ * N * 64, 64, buffer1, buffer1, buffer2, stream);
-  } else {
-    Softmax(encoder_heads_ * N * 64, 64, buffer1, buffer1,
-            (const DataType*)nullptr, stream);
   }
 
-  {
-    cublasXGemmBatched<DataType>(
-        cublas, CUBLAS_OP_N, CUBLAS_OP_N, depth /*M*/, 64 /*N*/, 64 /*K*/, 1.0f,
-        *offset_pointers + encoder_heads_ * max_batch_size_ *
-                               3,  // mha_v + offset /*A*/,  // "v" matrix
-        d_model /*LDA*/,           // to skip over other "depth" slices / heads
-        // 64 * d_model,          /*strideA*/
-        *offset_pointers + encoder_heads_ * max_batch_size_ *
-                               2,  // buffer1 + weightsOffset /*B*/,
-        64 /*LDB*/,                // 64 * 64, /*strideB*/
-        0.0f,
-        *offset_pointers +
-            encoder_heads_ * max_batch_size_ *
-                4,  // buffer2 + offset /*C*/,  // output goes to buffer2
-        d_model /*LDC*/,
-        // 64 * d_model /*strideC*/,
-        N * encoder_heads_);
-  }
-
-  // #final dense layer (mha_dense), buffer2 -> buffer1
+  // #final dense layer (mha_dense), mha_out -> mha_dense_out
   {
     const int num_inputs = d_model;
     const int num_outputs = embedding_op_size_;
     const int batch = N * 64;
-    cublasXgemm(cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, batch,
-                num_inputs, 1.0f, (const DataType*)mha_dense_w, num_inputs,
-                buffer2, num_inputs, 0.0f, buffer1, num_outputs);
+    if (!mha_dense_quantized_ ||
+        !mha_dense_quantized_->Eval(batch, mha_dense_out, mha_out, cublas,
+                               stream)) {
+      cublasXgemm(cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, batch,
+                  num_inputs, 1.0f, (const DataType*)mha_dense_w, num_inputs,
+                  mha_out, num_inputs, 0.0f, mha_dense_out, num_outputs);
+    }
   }
 
   // LN1: skip connection and layer normalization (also bias add of prev gemm)
-  // buffer1/in_out_tensor -> scratch
-  LayerNorm<DataType>(N * 64, embedding_op_size_, scratch, buffer1, mha_dense_b,
+  // mha_dense_out/in_out_tensor -> scratch
+  LayerNorm<DataType>(N * 64, embedding_op_size_, scratch, mha_dense_out,
+                      mha_dense_b,
                       in_out_tensor, ln1_gammas, ln1_betas, 1e-6, alpha_,
                       ACTIVATION_NONE, stream);
 
@@ -1856,9 +2336,13 @@ void EncoderBlock<DataType>::Eval(int N, DataType* in_out_tensor,
     const int num_inputs = embedding_op_size_;
     const int num_outputs = ffn_dense1_size_;  // encoder_dff
     const int batch = N * 64;
-    cublasXgemm(cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, batch,
-                num_inputs, 1.0f, (const DataType*)ffn_dense1_w, num_inputs,
-                scratch, num_inputs, 0.0f, in_out_tensor, num_outputs);
+    if (!ffn_dense1_quantized_ ||
+        !ffn_dense1_quantized_->Eval(batch, in_out_tensor, scratch, cublas,
+                                stream)) {
+      cublasXgemm(cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, batch,
+                  num_inputs, 1.0f, (const DataType*)ffn_dense1_w, num_inputs,
+                  scratch, num_inputs, 0.0f, in_out_tensor, num_outputs);
+    }
     addBiasBatched(in_out_tensor, in_out_tensor, ffn_dense1_b, 1, batch,
                    num_outputs, ffn_activation_, stream);
   }
@@ -1868,9 +2352,13 @@ void EncoderBlock<DataType>::Eval(int N, DataType* in_out_tensor,
     const int num_inputs = ffn_dense1_size_;  // encoder_dff
     const int num_outputs = embedding_op_size_;
     const int batch = N * 64;
-    cublasXgemm(cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, batch,
-                num_inputs, 1.0f, (const DataType*)ffn_dense2_w, num_inputs,
-                in_out_tensor, num_inputs, 0.0f, buffer1, num_outputs);
+    if (!ffn_dense2_quantized_ ||
+        !ffn_dense2_quantized_->Eval(batch, buffer1, in_out_tensor, cublas,
+                                stream)) {
+      cublasXgemm(cublas, CUBLAS_OP_T, CUBLAS_OP_N, num_outputs, batch,
+                  num_inputs, 1.0f, (const DataType*)ffn_dense2_w, num_inputs,
+                  in_out_tensor, num_inputs, 0.0f, buffer1, num_outputs);
+    }
   }
 
   // LN2: skip connection and layer normilization (also bias add of prev gemm)
@@ -1975,6 +2463,12 @@ AttentionPolicyHead<DataType>::~AttentionPolicyHead() {
   for (const auto pEnc : encoder_weights_) delete pEnc;
 }
 
+template <typename DataType>
+void AttentionPolicyHead<DataType>::EnableQuantization(
+    QuantizedContext<DataType>* context) {
+  for (const auto pEnc : encoder_weights_) pEnc->EnableQuantization(context);
+}
+
 template <typename DataType>
 EncoderBlock<DataType>::~EncoderBlock() {
   ReportCUDAErrors(cudaFree(mha_q_w));
@@ -2098,6 +2592,12 @@ AttentionBody<DataType>::~AttentionBody() {
   for (const auto pEnc : encoder_weights_) delete pEnc;
 }
 
+template <typename DataType>
+void AttentionBody<DataType>::EnableQuantization(
+    QuantizedContext<DataType>* context) {
+  for (const auto pEnc : encoder_weights_) pEnc->EnableQuantization(context);
+}
+
 template <typename DataType>
 void AttentionBody<DataType>::Eval(int N, DataType* output,
                                    const DataType* input,
@@ -2197,6 +2697,12 @@ template class AttentionBody<float>;
 template class EmbeddingLayer<half>;
 template class EmbeddingLayer<float>;
 
+template class QuantizedGemm<half>;
+template class QuantizedGemm<float>;
+
+template class QuantizedContext<half>;
+template class QuantizedContext<float>;
+
 // Misc error handling stuff.
 #ifdef USE_CUDNN
 void CudnnError(cudnnStatus_t status, const char* file, const int& line) {
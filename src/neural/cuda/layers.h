@@ -27,8 +27,19 @@
 #pragma once
 
 #include <cublas_v2.h>
+#ifdef USE_CUBLASLT
+#include <cublasLt.h>
+#endif
 
+#include <atomic>
 #include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <vector>
 
 #include "cuda_common.h"
 #include "neural/network_legacy.h"
@@ -43,6 +54,146 @@ typedef void* cudnnHandle_t;
 namespace lczero {
 namespace cudnn_backend {
 
+template <typename DataType>
+class QuantizedContext;
+
+// Number formats of the quantized GEMMs.
+enum class Quantization {
+  kInt8,
+  // E4M3, with tensor core GEMMs on SM 8.9 and later through cublasLt.
+  kFp8,
+};
+
+// A GEMM of quantized weights and inputs, the inputs quantized with a scale
+// calibrated for the layer. Int8 weights have a scale per output, fp8 weights
+// one for the tensor. It computes output = weights * input like the float
+// GEMMs of the layers, with the weights num_outputs x num_inputs row major and
+// one input per row. The quantized input and int32 result are held in memory
+// from the stream ordered allocator.
+template <typename DataType>
+class QuantizedGemm {
+ public:
+  // Quantizes @weights in GPU memory and registers with @context.
+  QuantizedGemm(const DataType* weights, int num_outputs, int num_inputs,
+                QuantizedContext<DataType>* context);
+  ~QuantizedGemm();
+
+  // Whether this build has @type GEMMs of these dimensions.
+  static bool IsSupported(Quantization type, int num_outputs, int num_inputs);
+
+  // Computes @rows outputs of @input into @output, without bias. While the
+  // context is calibrating only records the range of the input and returns
+  // false, the caller then computes in float.
+  bool Eval(int rows, DataType* output, const DataType* input,
+            cublasHandle_t cublas, cudaStream_t stream) const;
+
+  // Largest absolute input value recorded.
+  float GetInputRange() const;
+  // Sets the input scale so that @range maps to the quantized range.
+  void SetInputRange(float range);
+
+ private:
+  // Rows computed at a time, to bound the temporary memory.
+  static constexpr int kMaxRows = 16384;
+
+  bool EvalFp8(int rows, DataType* output, const DataType* input,
+               cudaStream_t stream) const;
+
+  const int num_outputs_;
+  const int num_inputs_;
+  const QuantizedContext<DataType>* const context_;
+  // Largest quantized value.
+  const float max_quantized_;
+  std::vector<float> weight_scales_;
+  float input_scale_ = 1.0f;
+  // GPU side.
+  int8_t* weights_ = nullptr;
+  // Int8: per output, weight scale times input scale. Fp8: the weight and
+  // input scales, which cublasLt applies.
+  float* output_scales_ = nullptr;
+  float* input_range_ = nullptr;
+};
+
+// The quantized mode of a network. Its QuantizedGemms record the range of
+// their inputs while the network still computes in float, until the
+// calibration is finished and they compute quantized. Input ranges can be
+// saved and loaded to skip the calibration, they don't depend on the format.
+template <typename DataType>
+class QuantizedContext {
+ public:
+  explicit QuantizedContext(Quantization type);
+  ~QuantizedContext();
+
+  Quantization type() const { return type_; }
+#ifdef USE_CUBLASLT
+  cublasLtHandle_t cublaslt() const { return cublaslt_; }
+#endif
+
+  void Register(QuantizedGemm<DataType>* gemm) { gemms_.push_back(gemm); }
+  bool IsCalibrated() const {
+    return calibrated_.load(std::memory_order_acquire);
+  }
+  // Sets the input scales from the ranges recorded so far.
+  void FinishCalibration();
+  // Loads the input ranges in @filename and finishes the calibration. Returns
+  // false if there's no such file, throws if it's not for this network.
+  bool Load(const std::string& filename);
+  void Save(const std::string& filename) const;
+
+ private:
+  const Quantization type_;
+#ifdef USE_CUBLASLT
+  cublasLtHandle_t cublaslt_ = nullptr;
+#endif
+  std::vector<QuantizedGemm<DataType>*> gemms_;
+  std::atomic<bool> calibrated_{false};
+};
+
+// Chooses the cublas algorithm of the GEMMs of the layers by GPU and GEMM
+// shape. With tuning on, every algorithm is timed the first time a shape runs
+// and the fastest one is kept. Choices are appended to a file and read back
+// on the next start, so a shape is only tuned once per GPU model.
+class GemmTuner {
+ public:
+  struct Shape {
+    bool fp16;
+    cublasOperation_t transa;
+    cublasOperation_t transb;
+    int m;
+    int n;
+    int k;
+    bool operator<(const Shape& other) const {
+      return std::tie(fp16, transa, transb, m, n, k) <
+             std::tie(other.fp16, other.transa, other.transb, other.m, other.n,
+                      other.k);
+    }
+  };
+
+  static GemmTuner& Get();
+
+  // Reads the choices in @filename. Shapes not in it are tuned if @tune is
+  // set, or else get the default algorithm.
+  void Configure(const std::string& filename, bool tune);
+
+  // Returns the algorithm for a GEMM of @shape on the current device. To tune
+  // it @run is called to enqueue the GEMM with each algorithm on @stream, it
+  // returns false when the algorithm doesn't support the shape.
+  cublasGemmAlgo_t GetAlgo(const Shape& shape, cudaStream_t stream,
+                           const std::function<bool(cublasGemmAlgo_t)>& run);
+
+ private:
+  cublasGemmAlgo_t Tune(const Shape& shape, cudaStream_t stream,
+                        const std::function<bool(cublasGemmAlgo_t)>& run);
+  const std::string& DeviceName();
+
+  std::mutex mutex_;
+  std::string filename_;
+  bool tune_ = false;
+  // By GPU name and shape.
+  std::map<std::pair<std::string, Shape>, cublasGemmAlgo_t> algos_;
+  std::vector<std::string> device_names_;
+};
+
 // The Layer objects only hold memory for weights, biases, etc
 // memory for input and output tensors is provided by caller of Eval.
 
@@ -66,6 +217,9 @@ class BaseLayer {
                     cudnnHandle_t cudnn, cublasHandle_t cublas,
                     cudaStream_t stream, DataType*** = nullptr) = 0;
 
+  // Makes the layer compute its supported GEMMs quantized from now on.
+  virtual void EnableQuantization(QuantizedContext<DataType>* /*context*/) {}
+
  protected:
   BaseLayer* input_;
 
@@ -143,12 +297,14 @@ class FCLayer : public BaseLayer<DataType> {
             const DataType* input2, void* scratch, size_t scratch_size,
             cudnnHandle_t cudnn, cublasHandle_t cublas, cudaStream_t stream,
             DataType*** = nullptr) override;
+  void EnableQuantization(QuantizedContext<DataType>* context) override;
 
  private:
   const bool use_bias_;
   const ActivationFunction act_;
   DataType* weights_ = nullptr;
   DataType* biases_ = nullptr;
+  std::unique_ptr<QuantizedGemm<DataType>> quantized_;
 };
 
 template <typename DataType>
@@ -347,6 +503,9 @@ class EncoderBlock {
             DataType* scratch2, cublasHandle_t cublas, cudaStream_t stream,
             DataType*** offset_pointers) const;
 
+  // Computes the QKV projections and dense layers quantized.
+  void EnableQuantization(QuantizedContext<DataType>* context);
+
   // all GPU side pointers
   DataType *mha_q_w, *mha_q_b;
   DataType *mha_k_w, *mha_k_b;
@@ -392,6 +551,11 @@ class EncoderBlock {
   int smol_global_size_;
 
   const int max_batch_size_;
+
+  std::unique_ptr<QuantizedGemm<DataType>> mha_qkv_quantized_[3];
+  std::unique_ptr<QuantizedGemm<DataType>> mha_dense_quantized_;
+  std::unique_ptr<QuantizedGemm<DataType>> ffn_dense1_quantized_;
+  std::unique_ptr<QuantizedGemm<DataType>> ffn_dense2_quantized_;
 };
 
 // The Attention policy head implementation
@@ -415,6 +579,7 @@ class AttentionPolicyHead : public BaseLayer<DataType> {
             const DataType* input2, void* scratch, size_t scratch_size,
             cudnnHandle_t cudnn, cublasHandle_t cublas, cudaStream_t stream,
             DataType*** = nullptr) override;
+  void EnableQuantization(QuantizedContext<DataType>* context) override;
 
  private:
   // GPU allocations to hold various weights used by the attention policy head
@@ -480,6 +645,7 @@ class AttentionBody : public BaseLayer<DataType> {
             const DataType* input2, void* scratch, size_t scratch_size,
             cudnnHandle_t cudnn, cublasHandle_t cublas, cudaStream_t stream,
             DataType*** = nullptr) override;
+  void EnableQuantization(QuantizedContext<DataType>* context) override;
 
  private:
   // GPU allocations to hold various weights used by the attention policy head
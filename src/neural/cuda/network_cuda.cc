@@ -25,16 +25,21 @@
   Program grant you additional permission to convey the resulting work.
 */
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <functional>
+#include <limits>
 #include <list>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <string>
 
 #include "cuda_common.h"
 #include "inputs_outputs.h"
 #include "kernels.h"
 #include "layers.h"
+#include "scratch_pool.h"
 #include "neural/factory.h"
 #include "neural/network_legacy.h"
 #include "neural/shared/activation.h"
@@ -42,6 +47,7 @@
 #include "neural/shared/policy_map.h"
 #include "utils/bititer.h"
 #include "utils/exception.h"
+#include "utils/filesystem.h"
 
 namespace lczero {
 using namespace cudnn_backend;
@@ -137,10 +143,46 @@ class CudaNetworkComputation : public NetworkComputation {
       i++;
     }
 
+    // No legal moves, the full policy of the batch is needed.
+    inputs_outputs_->compact_policy_ = false;
+    int* offsets = inputs_outputs_->legal_offsets_mem_;
+    offsets[batch_size_ + 1] = offsets[batch_size_];
+
     batch_size_++;
   }
 
+  void AddInputWithMoves(InputPlanes&& input,
+                         const std::vector<uint16_t>& moves) override {
+    int* offsets = inputs_outputs_->legal_offsets_mem_;
+    const int count =
+        std::min<int>(moves.size(), InputsOutputs::kMaxLegalMoves);
+    std::copy(moves.begin(), moves.begin() + count,
+              inputs_outputs_->legal_moves_mem_ + offsets[batch_size_]);
+    const bool compact_policy = inputs_outputs_->compact_policy_;
+    AddInput(std::move(input));
+    offsets[batch_size_] += count;
+    inputs_outputs_->compact_policy_ = compact_policy;
+  }
+
+  bool CanAddInputInPlace() const override { return true; }
+
+  InputBuffers AddInputInPlace(const std::vector<uint16_t>& moves) override {
+    int* offsets = inputs_outputs_->legal_offsets_mem_;
+    const int count =
+        std::min<int>(moves.size(), InputsOutputs::kMaxLegalMoves);
+    std::copy(moves.begin(), moves.begin() + count,
+              inputs_outputs_->legal_moves_mem_ + offsets[batch_size_]);
+    offsets[batch_size_ + 1] = offsets[batch_size_] + count;
+    const InputBuffers buffers{
+        &inputs_outputs_->input_masks_mem_[batch_size_ * kInputPlanes],
+        &inputs_outputs_->input_val_mem_[batch_size_ * kInputPlanes]};
+    batch_size_++;
+    return buffers;
+  }
+
   void ComputeBlocking() override;
+  void Submit() override;
+  void Wait() override;
 
   int GetBatchSize() const override { return batch_size_; }
 
@@ -164,6 +206,24 @@ class CudaNetworkComputation : public NetworkComputation {
   }
 
   float GetPVal(int sample, int move_id) const override {
+    if (inputs_outputs_->compact_policy_) {
+      const int* offsets = inputs_outputs_->legal_offsets_mem_;
+      for (int i = offsets[sample]; i < offsets[sample + 1]; i++) {
+        if (inputs_outputs_->legal_moves_mem_[i] == move_id) {
+          return inputs_outputs_->op_legal_policy_mem_[i];
+        }
+      }
+      return -std::numeric_limits<float>::infinity();
+    }
+    return inputs_outputs_->op_policy_mem_[sample * kNumOutputPolicy + move_id];
+  }
+
+  float GetLegalPVal(int sample, int move_ordinal,
+                     int move_id) const override {
+    if (inputs_outputs_->compact_policy_) {
+      return inputs_outputs_->op_legal_policy_mem_
+          [inputs_outputs_->legal_offsets_mem_[sample] + move_ordinal];
+    }
     return inputs_outputs_->op_policy_mem_[sample * kNumOutputPolicy + move_id];
   }
 
@@ -184,9 +244,33 @@ class CudaNetworkComputation : public NetworkComputation {
   CudaNetwork<DataType>* network_;
 };
 
+template <typename DataType>
+using CudaLayerStack = std::vector<std::unique_ptr<BaseLayer<DataType>>>;
+
+// Returns the layers built for @key by another network in this process, or
+// else the ones returned by @build, which are shared from then on.
+template <typename DataType>
+std::shared_ptr<CudaLayerStack<DataType>> GetSharedLayers(
+    const std::string& key,
+    const std::function<std::shared_ptr<CudaLayerStack<DataType>>()>& build) {
+  static std::mutex mutex;
+  static std::map<std::string, std::weak_ptr<CudaLayerStack<DataType>>>
+      layers;
+  std::lock_guard<std::mutex> lock(mutex);
+  auto& entry = layers[key];
+  auto result = entry.lock();
+  if (!result) {
+    result = build();
+    entry = result;
+  }
+  return result;
+}
+
 template <typename DataType>
 class CudaNetwork : public Network {
  public:
+  using LayerStack = CudaLayerStack<DataType>;
+
   CudaNetwork(const WeightsFile& file, const OptionsDict& options)
       : capabilities_{file.format().network_format().input(),
                       file.format().network_format().moves_left()} {
@@ -217,6 +301,11 @@ class CudaNetwork : public Network {
     showDeviceInfo(deviceProp);
 
     l2_cache_size_ = deviceProp.l2CacheSize;
+    char pci_bus_id[32];
+    if (cudaDeviceGetPCIBusId(pci_bus_id, sizeof(pci_bus_id), gpu_id_) ==
+        cudaSuccess) {
+      pci_bus_id_ = pci_bus_id;
+    }
     sm_count_ = deviceProp.multiProcessorCount;
 
     allow_cache_opt_ = options.GetOrDefault<bool>("cache_opt", false);
@@ -224,8 +313,38 @@ class CudaNetwork : public Network {
     // Select GPU to run on (for *the current* thread).
     ReportCUDAErrors(cudaSetDevice(gpu_id_));
 
+    // The cublas algorithms of the layer GEMMs tuned earlier are read from
+    // tuner_file, with tune the missing ones are tuned on first use.
+    {
+      std::string tuner_file;
+      if (options.IsDefault<std::string>("tuner_file")) {
+        tuner_file = GetUserCacheDirectory();
+        if (!tuner_file.empty()) {
+          tuner_file += "lc0/";
+          CreateDirectory(tuner_file);
+        }
+        tuner_file += "lc0_cuda_tuning";
+      } else {
+        tuner_file = options.Get<std::string>("tuner_file");
+      }
+      GemmTuner::Get().Configure(tuner_file,
+                                 options.GetOrDefault<bool>("tune", false));
+    }
+
     multi_stream_ = options.GetOrDefault<bool>("multi_stream", false);
 
+    // The forward pass is captured into CUDA graphs on the streams of
+    // multi_stream mode, as the default stream can't be captured.
+    use_cuda_graphs_ = options.GetOrDefault<bool>("cuda_graphs", false);
+    if (use_cuda_graphs_) {
+#if CUDART_VERSION < 11040
+      throw Exception("CUDA graphs need CUDA 11.4 or later.");
+#endif
+      multi_stream_ = true;
+      // Setting the L2 persistence window can't be captured.
+      allow_cache_opt_ = false;
+    }
+
     // layout used by cuda backend is nchw.
     has_tensor_cores_ = false;
     constexpr bool fp16 = std::is_same<half, DataType>::value;
@@ -351,7 +470,129 @@ class CudaNetwork : public Network {
 
     ActivationFunction act = mish_net ? ACTIVATION_MISH : ACTIVATION_RELU;
 
-    // 2. Build the network, and copy the weights to GPU memory.
+    wdl_ = file.format().network_format().value() ==
+           pblczero::NetworkFormat::VALUE_WDL;
+    moves_left_ = (file.format().network_format().moves_left() ==
+                   pblczero::NetworkFormat::MOVES_LEFT_V1) &&
+                  options.GetOrDefault<bool>("mlh", true);
+
+    // Gemms can run quantized to int8, or to fp8 on SM 8.9 (Ada) and later.
+    const bool int8 = options.GetOrDefault<bool>("int8", false);
+    const bool fp8 = options.GetOrDefault<bool>("fp8", false);
+    if (int8 && fp8) throw Exception("Only one of int8 and fp8 can be set.");
+    if (fp8) {
+#if !defined(USE_CUBLASLT) || CUDART_VERSION < 11080
+      throw Exception("Fp8 needs a build with cublasLt and CUDA 11.8.");
+#endif
+      if (deviceProp.major * 10 + deviceProp.minor < 89) {
+        throw Exception("Fp8 needs a GPU with SM 8.9 or later.");
+      }
+    }
+
+    // 2. Build the network, and copy the weights to GPU memory. Networks of
+    // the same weights and settings on a GPU share the read-only layers,
+    // except quantized ones which are calibrated for each network.
+    if (options.GetOrDefault<bool>("share_weights", true) && !int8 && !fp8) {
+      const std::string key =
+          std::to_string(gpu_id_) + " " + std::to_string(max_batch_size_) +
+          " " + std::to_string(use_res_block_winograd_fuse_opt_) + " " +
+          std::to_string(moves_left_) + " " +
+          std::to_string(std::hash<std::string>()(file.OutputAsString()));
+      layers_ = GetSharedLayers<DataType>(key, [&]() {
+        BuildLayers(file, weights, act, use_gemm_ex,
+                    deviceProp.sharedMemPerBlockOptin);
+        return layers_;
+      });
+    } else {
+      BuildLayers(file, weights, act, use_gemm_ex,
+                  deviceProp.sharedMemPerBlockOptin);
+    }
+    for (auto& layer : *layers_) network_.push_back(layer.get());
+
+    // 3. Allocate GPU memory for running the network:
+    //    - three buffers of max size are enough (one to hold input, second to
+    //      hold output and third to hold skip connection's input).
+
+    // size of input to the network
+    size_t maxSize = max_batch_size_ * kNumInputPlanes * 64 * sizeof(DataType);
+
+    // take max size of all layers
+    for (auto& layer : network_) {
+      maxSize = std::max(maxSize, layer->GetOutputSize(max_batch_size_));
+    }
+
+    if ((attn_policy_ || use_res_block_winograd_fuse_opt_ || attn_body_) &&
+        (scratch_size_ > maxSize)) {
+      maxSize = scratch_size_;
+    }
+
+    if (!multi_stream_) {
+      for (auto& mem : tensor_mem_) {
+        ReportCUDAErrors(cudaMalloc(&mem, maxSize));
+        ReportCUDAErrors(cudaMemset(mem, 0, maxSize));
+      }
+    }
+
+    tensor_mem_size_ = multi_stream_ ? maxSize : 0;
+
+    if (multi_stream_) {
+      // Evaluations use the memory of their InputsOutputs or scratch pool.
+      ReportCUDAErrors(cudaFree(scratch_mem_));
+      scratch_mem_ = nullptr;
+      // The pool is shared with the other networks using the same layers.
+      // Captured graphs keep the addresses of their buffers, so they need
+      // their own.
+      if (options.GetOrDefault<bool>("scratch_pool", true) &&
+          !use_cuda_graphs_) {
+        scratch_pool_ = ScratchPool::Get(gpu_id_, tensor_mem_size_,
+                                         scratch_size_, layers_.get());
+      }
+    }
+
+    // Quantized gemms need the range of their inputs, which is either loaded
+    // from @int8_scales or measured over the first batches evaluated in float.
+    // The ranges don't depend on the format, so int8 and fp8 share them.
+    if (int8 || fp8) {
+      quantized_context_ = std::make_unique<QuantizedContext<DataType>>(
+          fp8 ? Quantization::kFp8 : Quantization::kInt8);
+      for (auto& layer : network_) {
+        layer->EnableQuantization(quantized_context_.get());
+      }
+      scales_file_ = options.GetOrDefault<std::string>("int8_scales", "");
+      calibration_batches_ =
+          options.GetOrDefault<int>("int8_calibration_batches", 64);
+      if (!scales_file_.empty() && quantized_context_->Load(scales_file_)) {
+        CERR << "Loaded quantization scales from " << scales_file_;
+      } else if (use_cuda_graphs_) {
+        throw Exception("Quantization calibration can't run with cuda_graphs.");
+      } else {
+        CERR << "Calibrating quantization scales on the first "
+             << calibration_batches_ << " batches.";
+      }
+#if CUDART_VERSION >= 11020
+      // The quantized gemms allocate their temporaries from the stream
+      // ordered pool, which shouldn't give memory back between evaluations.
+      cudaMemPool_t mempool;
+      uint64_t threshold = UINT64_MAX;
+      ReportCUDAErrors(cudaDeviceGetDefaultMemPool(&mempool, gpu_id_));
+      ReportCUDAErrors(cudaMemPoolSetAttribute(
+          mempool, cudaMemPoolAttrReleaseThreshold, &threshold));
+#endif
+    }
+
+    // pre-allocate one InputsOutputs object
+    // The first call to allocate memory, create cublas,
+    // strem, etc takes really long (600 ms)
+    std::unique_ptr<InputsOutputs> io = GetInputsOutputs();
+  }
+
+  // Builds the layers into layers_, and copies the weights to GPU memory.
+  void BuildLayers(const WeightsFile& file, const LegacyWeights& weights,
+                   ActivationFunction act, bool use_gemm_ex,
+                   size_t shared_mem_per_block) {
+    const int kNumInputPlanes = kInputPlanes;
+    const int kNumFilters = numFilters_;
+    layers_ = std::make_shared<LayerStack>();
 
     // Input conv only used if there are residual blocks in the network
     if (numBlocks_ > 0) {
@@ -362,7 +603,7 @@ class CudaNetwork : public Network {
             false, 0, use_gemm_ex, use_res_block_winograd_fuse_opt_);
         inputConv->LoadWeights(&weights.input.weights[0],
                                &weights.input.biases[0], scratch_mem_);
-        network_.emplace_back(std::move(inputConv));
+        layers_->emplace_back(std::move(inputConv));
       }
 
       // Residual block.
@@ -374,7 +615,7 @@ class CudaNetwork : public Network {
           auto layer = std::make_unique<ResidualBlock<DataType>>(
               getLastLayer(), kNumFilters, has_se, se_k, use_gemm_ex,
               block == 0, block == (numBlocks_ - 1), act,
-              deviceProp.sharedMemPerBlockOptin);
+              shared_mem_per_block);
           layer->LoadWeights0(&weights.residual[block].conv1.weights[0],
                               &weights.residual[block].conv1.biases[0],
                               scratch_mem_);
@@ -387,7 +628,7 @@ class CudaNetwork : public Network {
                                  &weights.residual[block].se.w2[0],
                                  &weights.residual[block].se.b2[0],
                                  scratch_mem_);
-          network_.emplace_back(std::move(layer));
+          layers_->emplace_back(std::move(layer));
         } else {
           auto conv1 = std::make_unique<FusedWinogradConvSELayer<DataType>>(
               getLastLayer(), kNumFilters, 8, 8, kNumFilters, act, true, false,
@@ -395,7 +636,7 @@ class CudaNetwork : public Network {
           conv1->LoadWeights(&weights.residual[block].conv1.weights[0],
                              &weights.residual[block].conv1.biases[0],
                              scratch_mem_);
-          network_.emplace_back(std::move(conv1));
+          layers_->emplace_back(std::move(conv1));
 
           auto conv2 = std::make_unique<FusedWinogradConvSELayer<DataType>>(
               getLastLayer(), kNumFilters, 8, 8, kNumFilters, act, true, true,
@@ -409,7 +650,7 @@ class CudaNetwork : public Network {
                                  &weights.residual[block].se.w2[0],
                                  &weights.residual[block].se.b2[0],
                                  scratch_mem_);
-          network_.emplace_back(std::move(conv2));
+          layers_->emplace_back(std::move(conv2));
         }
       }
       resi_last_ = getLastLayer();
@@ -434,7 +675,7 @@ class CudaNetwork : public Network {
       auto attention_body = std::make_unique<AttentionBody<DataType>>(
           weights, scratch_mem_, activations, numBlocks_,
           numBlocks_ > 0 ? kNumFilters : kInputPlanes, max_batch_size_);
-      network_.emplace_back(std::move(attention_body));
+      layers_->emplace_back(std::move(attention_body));
 
       encoder_last_ = getLastLayer();
     }
@@ -444,12 +685,12 @@ class CudaNetwork : public Network {
       auto AttentionPolicy = std::make_unique<AttentionPolicyHead<DataType>>(
           getLastLayer(), weights, scratch_mem_, attn_body_, act,
           max_batch_size_);
-      network_.emplace_back(std::move(AttentionPolicy));
+      layers_->emplace_back(std::move(AttentionPolicy));
 
       auto policymap = std::make_unique<PolicyMapLayer<DataType>>(
           getLastLayer(), kNumOutputPolicy, 1, 1, 64 * 64 + 8 * 24, true);
       policymap->LoadWeights(kAttnPolicyMap, scratch_mem_);
-      network_.emplace_back(std::move(policymap));
+      layers_->emplace_back(std::move(policymap));
 
     } else if (conv_policy_) {
       assert(!attn_body_);  // not supported with attention body
@@ -458,7 +699,7 @@ class CudaNetwork : public Network {
           0, use_gemm_ex);
       conv1->LoadWeights(&weights.policy1.weights[0],
                          &weights.policy1.biases[0], scratch_mem_);
-      network_.emplace_back(std::move(conv1));
+      layers_->emplace_back(std::move(conv1));
 
       auto pol_channels = weights.policy.biases.size();
 
@@ -468,13 +709,13 @@ class CudaNetwork : public Network {
           true, false, false, 0, use_gemm_ex);
       conv2->LoadWeights(&weights.policy.weights[0], &weights.policy.biases[0],
                          scratch_mem_);
-      network_.emplace_back(std::move(conv2));
+      layers_->emplace_back(std::move(conv2));
 
       auto policymap = std::make_unique<PolicyMapLayer<DataType>>(
           getLastLayer(), kNumOutputPolicy, 1, 1, 73 * 8 * 8, false);
       policymap->LoadWeights(kConvPolicyMap, scratch_mem_);
 
-      network_.emplace_back(std::move(policymap));
+      layers_->emplace_back(std::move(policymap));
     } else {
       assert(!attn_body_);  // not supported with attention body
       auto convPol = std::make_unique<Conv1Layer<DataType>>(
@@ -482,13 +723,13 @@ class CudaNetwork : public Network {
           true, use_gemm_ex);
       convPol->LoadWeights(&weights.policy.weights[0],
                            &weights.policy.biases[0], scratch_mem_);
-      network_.emplace_back(std::move(convPol));
+      layers_->emplace_back(std::move(convPol));
 
       auto FCPol = std::make_unique<FCLayer<DataType>>(
           getLastLayer(), weights.ip_pol_b.size(), 1, 1, true, ACTIVATION_NONE);
       FCPol->LoadWeights(&weights.ip_pol_w[0], &weights.ip_pol_b[0],
                          scratch_mem_);
-      network_.emplace_back(std::move(FCPol));
+      layers_->emplace_back(std::move(FCPol));
     }
 
     // Value head.
@@ -497,24 +738,22 @@ class CudaNetwork : public Network {
         auto embedded_val = std::make_unique<EmbeddingLayer<DataType>>(
             encoder_last_, weights.ip_val_w, weights.ip_val_b, scratch_mem_,
             act);
-        network_.emplace_back(std::move(embedded_val));
+        layers_->emplace_back(std::move(embedded_val));
       } else {
         auto convVal = std::make_unique<Conv1Layer<DataType>>(
             resi_last_, weights.value.biases.size(), 8, 8, kNumFilters, act,
             true, use_gemm_ex);
         convVal->LoadWeights(&weights.value.weights[0],
                              &weights.value.biases[0], scratch_mem_);
-        network_.emplace_back(std::move(convVal));
+        layers_->emplace_back(std::move(convVal));
       }
 
       auto FCVal1 = std::make_unique<FCLayer<DataType>>(
           getLastLayer(), weights.ip1_val_b.size(), 1, 1, true, act);
       FCVal1->LoadWeights(&weights.ip1_val_w[0], &weights.ip1_val_b[0],
                           scratch_mem_);
-      network_.emplace_back(std::move(FCVal1));
+      layers_->emplace_back(std::move(FCVal1));
 
-      wdl_ = file.format().network_format().value() ==
-             pblczero::NetworkFormat::VALUE_WDL;
       auto fc2_tanh = !wdl_;
 
       auto FCVal2 = std::make_unique<FCLayer<DataType>>(
@@ -522,107 +761,48 @@ class CudaNetwork : public Network {
           fc2_tanh ? ACTIVATION_TANH : ACTIVATION_NONE);
       FCVal2->LoadWeights(&weights.ip2_val_w[0], &weights.ip2_val_b[0],
                           scratch_mem_);
-      network_.emplace_back(std::move(FCVal2));
+      layers_->emplace_back(std::move(FCVal2));
     }
 
     // Moves left head
-    moves_left_ = (file.format().network_format().moves_left() ==
-                   pblczero::NetworkFormat::MOVES_LEFT_V1) &&
-                  options.GetOrDefault<bool>("mlh", true);
     if (moves_left_) {
       if (attn_body_) {
         auto embedded_mov = std::make_unique<EmbeddingLayer<DataType>>(
             encoder_last_, weights.ip_mov_w, weights.ip_mov_b, scratch_mem_,
             act);
-        network_.emplace_back(std::move(embedded_mov));
+        layers_->emplace_back(std::move(embedded_mov));
       } else {
         auto convMov = std::make_unique<Conv1Layer<DataType>>(
             resi_last_, weights.moves_left.biases.size(), 8, 8, kNumFilters,
             act, true, use_gemm_ex);
         convMov->LoadWeights(&weights.moves_left.weights[0],
                              &weights.moves_left.biases[0], scratch_mem_);
-        network_.emplace_back(std::move(convMov));
+        layers_->emplace_back(std::move(convMov));
       }
       auto FCMov1 = std::make_unique<FCLayer<DataType>>(
           getLastLayer(), weights.ip1_mov_b.size(), 1, 1, true, act);
       FCMov1->LoadWeights(&weights.ip1_mov_w[0], &weights.ip1_mov_b[0],
                           scratch_mem_);
-      network_.emplace_back(std::move(FCMov1));
+      layers_->emplace_back(std::move(FCMov1));
 
       auto FCMov2 = std::make_unique<FCLayer<DataType>>(getLastLayer(), 1, 1, 1,
                                                         true, ACTIVATION_RELU);
       FCMov2->LoadWeights(&weights.ip2_mov_w[0], &weights.ip2_mov_b[0],
                           scratch_mem_);
-      network_.emplace_back(std::move(FCMov2));
-    }
-
-    // 3. Allocate GPU memory for running the network:
-    //    - three buffers of max size are enough (one to hold input, second to
-    //      hold output and third to hold skip connection's input).
-
-    // size of input to the network
-    size_t maxSize = max_batch_size_ * kNumInputPlanes * 64 * sizeof(DataType);
-
-    // take max size of all layers
-    for (auto& layer : network_) {
-      maxSize = std::max(maxSize, layer->GetOutputSize(max_batch_size_));
+      layers_->emplace_back(std::move(FCMov2));
     }
-
-    if ((attn_policy_ || use_res_block_winograd_fuse_opt_ || attn_body_) &&
-        (scratch_size_ > maxSize)) {
-      maxSize = scratch_size_;
-    }
-
-    if (!multi_stream_) {
-      for (auto& mem : tensor_mem_) {
-        ReportCUDAErrors(cudaMalloc(&mem, maxSize));
-        ReportCUDAErrors(cudaMemset(mem, 0, maxSize));
-      }
-    }
-
-    tensor_mem_size_ = multi_stream_ ? maxSize : 0;
-
-    // pre-allocate one InputsOutputs object
-    // The first call to allocate memory, create cublas,
-    // strem, etc takes really long (600 ms)
-    std::unique_ptr<InputsOutputs> io = GetInputsOutputs();
   }
 
-  void forwardEval(InputsOutputs* io, int batchSize) {
-    if (!multi_stream_) lock_.lock();
-
-#ifdef DEBUG_RAW_NPS
-    auto t_start = std::chrono::high_resolution_clock::now();
-#endif
-
+  // Enqueues the network evaluation of @batchSize inputs of @io on @stream,
+  // from expanding the input planes to copying the outputs back to the host.
+  void enqueueForward(InputsOutputs* io, int batchSize, DataType** tensor_mem,
+                      void* scratch_mem, DataType*** offset_pointers,
+                      DataType*** head_offset_pointers, cudaStream_t stream,
+                      cublasHandle_t cublas) {
     // Expand packed planes to full planes.
     uint64_t* ipDataMasks = io->input_masks_mem_gpu_;
     float* ipDataValues = io->input_val_mem_gpu_;
 
-    DataType* tensor_mem[3];
-    void* scratch_mem;
-    DataType*** offset_pointers;
-    DataType*** head_offset_pointers;
-    cudaStream_t stream;
-    cublasHandle_t cublas;
-    if (multi_stream_) {
-      // We use tensor and scratch memory from InputOutputs (so that multiple
-      // requests can run in parallel)
-      for (int i = 0; i < 3; i++) tensor_mem[i] = (DataType*)io->tensor_mem_[i];
-      scratch_mem = io->scratch_mem_;
-      offset_pointers = (DataType***)&io->offset_pointers_;
-      head_offset_pointers = (DataType***)&io->head_offset_pointers_;
-      stream = io->stream_;
-      cublas = io->cublas_;
-    } else {
-      for (int i = 0; i < 3; i++) tensor_mem[i] = tensor_mem_[i];
-      scratch_mem = scratch_mem_;
-      offset_pointers = (DataType***)&offset_pointers_;
-      head_offset_pointers = (DataType***)&head_offset_pointers_;
-      stream = 0;  // default stream
-      cublas = cublas_;
-    }
-
     bool fp16 = std::is_same<half, DataType>::value;
     if (fp16) {
       expandPlanes_Fp16_NCHW((half*)(tensor_mem[0]), ipDataMasks, ipDataValues,
@@ -785,12 +965,6 @@ class CudaNetwork : public Network {
       }
     }
 
-    // Copy policy output from device memory to host memory.
-    ReportCUDAErrors(
-        cudaMemcpyAsync(io->op_policy_mem_, io->op_policy_mem_gpu_,
-                        sizeof(float) * kNumOutputPolicy * batchSize,
-                        cudaMemcpyDeviceToHost, stream));
-
     // value head
     network_[l++]->Eval(batchSize, spare1, flow, nullptr, scratch_mem,
                         scratch_size_, nullptr, cublas,
@@ -849,14 +1023,133 @@ class CudaNetwork : public Network {
                             stream);
       }
     }
+  }
 
-    if (multi_stream_) {
-      ReportCUDAErrors(cudaStreamSynchronize(stream));
+  void forwardEval(InputsOutputs* io, int batchSize) {
+    forwardSubmit(io, batchSize);
+    forwardWait(io, batchSize);
+  }
+
+  // Starts the evaluation of @io. With multi_stream it's only enqueued on the
+  // stream of @io, and the caller can fill the inputs of another
+  // InputsOutputs before forwardWait(). Otherwise it's complete on return,
+  // as the network memory is shared by all evaluations.
+  void forwardSubmit(InputsOutputs* io, int batchSize) {
+    if (!multi_stream_) lock_.lock();
+
+#ifdef DEBUG_RAW_NPS
+    auto t_start = std::chrono::high_resolution_clock::now();
+#endif
+
+    DataType* tensor_mem[3];
+    void* scratch_mem;
+    DataType*** offset_pointers;
+    DataType*** head_offset_pointers;
+    cudaStream_t stream;
+    cublasHandle_t cublas;
+    ScratchPool::Slot* slot = nullptr;
+    if (scratch_pool_) {
+      // Tensor and scratch memory of the pool, held only until the
+      // evaluation is enqueued.
+      slot = scratch_pool_->Acquire(io->stream_);
+      for (int i = 0; i < 3; i++) {
+        tensor_mem[i] = (DataType*)slot->tensor_mem[i];
+      }
+      scratch_mem = slot->scratch_mem;
+      offset_pointers = (DataType***)&slot->offset_pointers;
+      head_offset_pointers = (DataType***)&slot->head_offset_pointers;
+      stream = io->stream_;
+      cublas = io->cublas_;
+    } else if (multi_stream_) {
+      // We use tensor and scratch memory from InputOutputs (so that multiple
+      // requests can run in parallel)
+      for (int i = 0; i < 3; i++) tensor_mem[i] = (DataType*)io->tensor_mem_[i];
+      scratch_mem = io->scratch_mem_;
+      offset_pointers = (DataType***)&io->offset_pointers_;
+      head_offset_pointers = (DataType***)&io->head_offset_pointers_;
+      stream = io->stream_;
+      cublas = io->cublas_;
+    } else {
+      for (int i = 0; i < 3; i++) tensor_mem[i] = tensor_mem_[i];
+      scratch_mem = scratch_mem_;
+      offset_pointers = (DataType***)&offset_pointers_;
+      head_offset_pointers = (DataType***)&head_offset_pointers_;
+      stream = 0;  // default stream
+      cublas = cublas_;
+    }
+
+    if (use_cuda_graphs_) {
+      // Graphs are captured for a few batch sizes, smaller batches are padded.
+      // Padded samples get empty input planes and their outputs are ignored.
+      const int padded_batch_size = GetGraphBatchSize(batchSize);
+      std::fill(io->input_masks_mem_ + batchSize * kInputPlanes,
+                io->input_masks_mem_ + padded_batch_size * kInputPlanes, 0);
+      auto& graph = io->graphs_[padded_batch_size];
+      if (graph.exec) {
+        ReportCUDAErrors(cudaGraphLaunch(graph.exec, stream));
+      } else if (!graph.warmed_up) {
+        // The first run of a batch size allocates what the layers need
+        // lazily, which can't be captured.
+        enqueueForward(io, padded_batch_size, tensor_mem, scratch_mem,
+                       offset_pointers, head_offset_pointers, stream, cublas);
+        graph.warmed_up = true;
+      } else {
+        cudaGraph_t captured;
+        ReportCUDAErrors(cudaStreamBeginCapture(
+            stream, cudaStreamCaptureModeThreadLocal));
+        enqueueForward(io, padded_batch_size, tensor_mem, scratch_mem,
+                       offset_pointers, head_offset_pointers, stream, cublas);
+        ReportCUDAErrors(cudaStreamEndCapture(stream, &captured));
+        ReportCUDAErrors(
+            cudaGraphInstantiateWithFlags(&graph.exec, captured, 0));
+        ReportCUDAErrors(cudaGraphDestroy(captured));
+        ReportCUDAErrors(cudaGraphLaunch(graph.exec, stream));
+      }
     } else {
+      enqueueForward(io, batchSize, tensor_mem, scratch_mem, offset_pointers,
+                     head_offset_pointers, stream, cublas);
+    }
+    if (slot) scratch_pool_->Release(slot, stream);
+
+    // Copy policy output from device memory to host memory, only that of the
+    // legal moves if every sample has them.
+    if (io->compact_policy_) {
+      gatherLegalPolicy(io->op_legal_policy_mem_gpu_, io->op_policy_mem_gpu_,
+                        io->legal_offsets_mem_gpu_, io->legal_moves_mem_gpu_,
+                        batchSize, stream);
+      ReportCUDAErrors(cudaMemcpyAsync(
+          io->op_legal_policy_mem_, io->op_legal_policy_mem_gpu_,
+          sizeof(float) * io->legal_offsets_mem_[batchSize],
+          cudaMemcpyDeviceToHost, stream));
+    } else {
+      ReportCUDAErrors(
+          cudaMemcpyAsync(io->op_policy_mem_, io->op_policy_mem_gpu_,
+                          sizeof(float) * kNumOutputPolicy * batchSize,
+                          cudaMemcpyDeviceToHost, stream));
+    }
+
+    if (!multi_stream_) {
       ReportCUDAErrors(cudaDeviceSynchronize());
       // The next thread can start using the GPU now.
       lock_.unlock();
     }
+  }
+
+  // Waits for the evaluation of @io started by forwardSubmit() and finishes
+  // the outputs on the host.
+  void forwardWait(InputsOutputs* io, int batchSize) {
+    if (multi_stream_) {
+      ReportCUDAErrors(cudaStreamSynchronize(io->stream_));
+    }
+
+    if (quantized_context_ && !quantized_context_->IsCalibrated() &&
+        ++calibration_batches_seen_ == calibration_batches_) {
+      quantized_context_->FinishCalibration();
+      if (!scales_file_.empty()) {
+        quantized_context_->Save(scales_file_);
+      }
+      CERR << "Quantization calibration done.";
+    }
 
     if (wdl_) {
       // Value softmax done cpu side.
@@ -903,6 +1196,8 @@ class CudaNetwork : public Network {
 
   int GetThreads() const override { return 1 + multi_stream_; }
 
+  std::string GetPciBusId() const override { return pci_bus_id_; }
+
   std::unique_ptr<NetworkComputation> NewComputation() override {
     // Set correct gpu id for this computation (as it might have been called
     // from a different thread).
@@ -916,7 +1211,8 @@ class CudaNetwork : public Network {
     if (free_inputs_outputs_.empty()) {
       return std::make_unique<InputsOutputs>(
           max_batch_size_, wdl_, moves_left_, tensor_mem_size_, scratch_size_,
-          !has_tensor_cores_ && std::is_same<half, DataType>::value);
+          !has_tensor_cores_ && std::is_same<half, DataType>::value,
+          scratch_pool_ != nullptr);
     } else {
       std::unique_ptr<InputsOutputs> resource =
           std::move(free_inputs_outputs_.front());
@@ -938,6 +1234,7 @@ class CudaNetwork : public Network {
  private:
   const NetworkCapabilities capabilities_;
   int gpu_id_;
+  std::string pci_bus_id_;
   int l2_cache_size_;
   int sm_count_;
   int max_batch_size_;
@@ -947,6 +1244,20 @@ class CudaNetwork : public Network {
                                           // tower
   bool multi_stream_;                     // run multiple parallel network evals
   bool allow_cache_opt_;  // try to fit residual block activations in L2 cache
+  bool use_cuda_graphs_;  // replay captured forward passes
+
+  // Set when the gemms run in int8 or fp8.
+  std::unique_ptr<QuantizedContext<DataType>> quantized_context_;
+  std::string scales_file_;
+  int calibration_batches_ = 0;
+  std::atomic<int> calibration_batches_seen_{0};
+
+  // Returns the batch size for which a CUDA graph is captured to evaluate
+  // @batch_size inputs: multiples of 8 up to 64, coarser steps beyond.
+  int GetGraphBatchSize(int batch_size) const {
+    const int step = batch_size <= 64 ? 8 : batch_size <= 256 ? 32 : 128;
+    return std::min((batch_size + step - 1) / step * step, max_batch_size_);
+  }
 
   // Currently only one NN Eval can happen a time (we can fix this if needed
   // by allocating more memory).
@@ -959,8 +1270,10 @@ class CudaNetwork : public Network {
   bool attn_policy_;
   bool attn_body_;
   int num_encoder_blocks_;
-  std::vector<std::unique_ptr<BaseLayer<DataType>>> network_;
-  BaseLayer<DataType>* getLastLayer() { return network_.back().get(); }
+  // Owns the layers, possibly together with other networks on the GPU.
+  std::shared_ptr<LayerStack> layers_;
+  std::vector<BaseLayer<DataType>*> network_;
+  BaseLayer<DataType>* getLastLayer() { return layers_->back().get(); }
 
   BaseLayer<DataType>* resi_last_;
   BaseLayer<DataType>* encoder_last_;
@@ -970,6 +1283,9 @@ class CudaNetwork : public Network {
 
   // this copy is used only for initialization when multi-stream is enabled
   void* scratch_mem_;
+  // Tensor and scratch memory of the evaluations with multi_stream, unless
+  // they use that of their InputsOutputs.
+  std::shared_ptr<ScratchPool> scratch_pool_;
   // this is only used when multi-stream is disabled
   void** offset_pointers_ = nullptr;
   void** head_offset_pointers_ = nullptr;
@@ -1038,6 +1354,8 @@ CudaNetworkComputation<DataType>::CudaNetworkComputation(
     : wdl_(wdl), moves_left_(moves_left), network_(network) {
   batch_size_ = 0;
   inputs_outputs_ = network_->GetInputsOutputs();
+  inputs_outputs_->legal_offsets_mem_[0] = 0;
+  inputs_outputs_->compact_policy_ = true;
 }
 
 template <typename DataType>
@@ -1050,6 +1368,16 @@ void CudaNetworkComputation<DataType>::ComputeBlocking() {
   network_->forwardEval(inputs_outputs_.get(), GetBatchSize());
 }
 
+template <typename DataType>
+void CudaNetworkComputation<DataType>::Submit() {
+  network_->forwardSubmit(inputs_outputs_.get(), GetBatchSize());
+}
+
+template <typename DataType>
+void CudaNetworkComputation<DataType>::Wait() {
+  network_->forwardWait(inputs_outputs_.get(), GetBatchSize());
+}
+
 template <typename DataType>
 std::unique_ptr<Network> MakeCudaNetwork(const std::optional<WeightsFile>& w,
                                          const OptionsDict& options) {
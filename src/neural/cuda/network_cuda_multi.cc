@@ -0,0 +1,318 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <numeric>
+#include <thread>
+
+#include "cuda_common.h"
+#include "neural/factory.h"
+#include "utils/exception.h"
+#include "utils/logging.h"
+#include "utils/numa.h"
+#include "utils/string.h"
+
+namespace lczero {
+namespace {
+
+class MultiGpuNetwork;
+
+// A batch evaluated by one or more GPUs, each of them computing a slice.
+class MultiGpuComputation : public NetworkComputation {
+ public:
+  MultiGpuComputation(MultiGpuNetwork* network) : network_(network) {}
+
+  void AddInput(InputPlanes&& input) override { planes_.emplace_back(input); }
+
+  void ComputeBlocking() override;
+
+  int GetBatchSize() const override { return planes_.size(); }
+
+  float GetQVal(int sample) const override {
+    const auto& slice = slices_[slice_of_sample_[sample]];
+    return slice.computation->GetQVal(sample - slice.start);
+  }
+
+  float GetDVal(int sample) const override {
+    const auto& slice = slices_[slice_of_sample_[sample]];
+    return slice.computation->GetDVal(sample - slice.start);
+  }
+
+  float GetMVal(int sample) const override {
+    const auto& slice = slices_[slice_of_sample_[sample]];
+    return slice.computation->GetMVal(sample - slice.start);
+  }
+
+  float GetPVal(int sample, int move_id) const override {
+    const auto& slice = slices_[slice_of_sample_[sample]];
+    return slice.computation->GetPVal(sample - slice.start, move_id);
+  }
+
+  struct Slice {
+    MultiGpuComputation* parent;
+    int start;
+    int size;
+    // The device the slice is sized for, or -1 for any.
+    int device;
+    std::unique_ptr<NetworkComputation> computation;
+  };
+
+  // Computes @slice on @network, called from the device worker threads.
+  void ComputeSlice(Slice* slice, Network* network) {
+    slice->computation = network->NewComputation();
+    for (int i = slice->start; i < slice->start + slice->size; i++) {
+      slice->computation->AddInput(std::move(planes_[i]));
+    }
+    slice->computation->ComputeBlocking();
+  }
+
+  void NotifyComplete() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (--pending_ == 0) cv_.notify_one();
+  }
+
+ private:
+  MultiGpuNetwork* const network_;
+  std::vector<InputPlanes> planes_;
+  std::vector<Slice> slices_;
+  std::vector<int> slice_of_sample_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  int pending_ = 0;
+};
+
+// Owns a backend per GPU and evaluates batches on whichever GPUs are free,
+// from a queue shared by all of them. Batches large enough are split between
+// the GPUs in proportion to the throughput measured on each, so that GPUs of
+// different speed finish their slices at about the same time.
+class MultiGpuNetwork : public Network {
+ public:
+  MultiGpuNetwork(const std::optional<WeightsFile>& weights,
+                  const OptionsDict& options) {
+    const std::string backend =
+        options.GetOrDefault<std::string>("backend", "cuda-auto");
+    minimum_split_size_ = options.GetOrDefault<int>("minimum-split-size", 32);
+    std::vector<int> gpus;
+    if (options.Exists<std::string>("gpus")) {
+      gpus = ParseIntList(options.Get<std::string>("gpus"));
+    } else {
+      int count;
+      ReportCUDAErrors(cudaGetDeviceCount(&count));
+      gpus.resize(count);
+      std::iota(gpus.begin(), gpus.end(), 0);
+    }
+    if (gpus.empty()) throw Exception("No GPU to run on.");
+
+    for (const int gpu : gpus) {
+      OptionsDict device_options(&options);
+      device_options.Set<int>("gpu", gpu);
+      auto device = std::make_unique<Device>();
+      device->network =
+          NetworkFactory::Get()->Create(backend, weights, device_options);
+      if (devices_.empty()) {
+        capabilities_ = device->network->GetCapabilities();
+      } else {
+        capabilities_.Merge(device->network->GetCapabilities());
+      }
+      mini_batch_size_ += device->network->GetMiniBatchSize();
+      threads_per_device_ = std::max(threads_per_device_,
+                                     device->network->GetThreads());
+      devices_.emplace_back(std::move(device));
+    }
+    CERR << "Running on " << devices_.size() << " GPUs.";
+
+    for (int i = 0; i < static_cast<int>(devices_.size()); i++) {
+      for (int j = 0; j < devices_[i]->network->GetThreads(); j++) {
+        threads_.emplace_back([this, i]() { Worker(i); });
+      }
+    }
+  }
+
+  ~MultiGpuNetwork() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      abort_ = true;
+    }
+    cv_.notify_all();
+    for (auto& thread : threads_) thread.join();
+    // Unstuck waiting computations.
+    for (auto* slice : queue_) slice->parent->NotifyComplete();
+  }
+
+  std::unique_ptr<NetworkComputation> NewComputation() override {
+    return std::make_unique<MultiGpuComputation>(this);
+  }
+
+  const NetworkCapabilities& GetCapabilities() const override {
+    return capabilities_;
+  }
+
+  int GetMiniBatchSize() const override { return mini_batch_size_; }
+
+  int GetThreads() const override {
+    return threads_per_device_ * devices_.size();
+  }
+
+  std::string GetPciBusId() const override {
+    return devices_.size() == 1 ? devices_[0]->network->GetPciBusId() : "";
+  }
+
+  // Splits @batch_size samples into slices for the fastest GPUs, with sizes
+  // in proportion to their throughput and at least minimum-split-size.
+  void Split(int batch_size, std::vector<MultiGpuComputation::Slice>* slices) {
+    std::vector<std::pair<float, int>> speeds;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (int i = 0; i < static_cast<int>(devices_.size()); i++) {
+        speeds.emplace_back(devices_[i]->speed, i);
+      }
+    }
+    const int count =
+        std::clamp(batch_size / std::max(minimum_split_size_, 1), 1,
+                   static_cast<int>(speeds.size()));
+    if (count == 1) {
+      slices->push_back({nullptr, 0, batch_size, -1, nullptr});
+      return;
+    }
+    std::partial_sort(speeds.begin(), speeds.begin() + count, speeds.end(),
+                      std::greater<>());
+    float total_speed = 0.0f;
+    for (int i = 0; i < count; i++) total_speed += speeds[i].first;
+    float cumulative_speed = 0.0f;
+    int start = 0;
+    for (int i = 0; i < count; i++) {
+      cumulative_speed += speeds[i].first;
+      const int end =
+          i == count - 1
+              ? batch_size
+              : static_cast<int>(batch_size * cumulative_speed / total_speed);
+      if (end > start) {
+        slices->push_back(
+            {nullptr, start, end - start, speeds[i].second, nullptr});
+      }
+      start = std::max(start, end);
+    }
+  }
+
+  void Enqueue(MultiGpuComputation::Slice* slice) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.push_back(slice);
+    }
+    cv_.notify_all();
+  }
+
+ private:
+  struct Device {
+    std::unique_ptr<Network> network;
+    // Samples per second, averaged over the recent batches. All devices
+    // start out equal until measured.
+    float speed = 1.0f;
+    bool measured = false;
+  };
+
+  void Worker(int device_idx) {
+    Device* device = devices_[device_idx].get();
+    Numa::BindThreadNearDevice(device->network->GetPciBusId());
+    while (true) {
+      MultiGpuComputation::Slice* slice;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&] { return abort_ || !queue_.empty(); });
+        if (abort_) return;
+        // Prefer the slices sized for this device, but take any other slice
+        // rather than wait while this device is free.
+        auto iter = std::find_if(queue_.begin(), queue_.end(), [&](auto* s) {
+          return s->device == device_idx || s->device == -1;
+        });
+        if (iter == queue_.end()) iter = queue_.begin();
+        slice = *iter;
+        queue_.erase(iter);
+      }
+      const auto start = std::chrono::steady_clock::now();
+      slice->parent->ComputeSlice(slice, device->network.get());
+      const std::chrono::duration<float> elapsed =
+          std::chrono::steady_clock::now() - start;
+      if (elapsed.count() > 0.0f) {
+        const float speed = slice->size / elapsed.count();
+        std::lock_guard<std::mutex> lock(mutex_);
+        device->speed =
+            device->measured ? 0.9f * device->speed + 0.1f * speed : speed;
+        device->measured = true;
+      }
+      slice->parent->NotifyComplete();
+    }
+  }
+
+  std::vector<std::unique_ptr<Device>> devices_;
+  NetworkCapabilities capabilities_;
+  int mini_batch_size_ = 0;
+  int threads_per_device_ = 1;
+  int minimum_split_size_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<MultiGpuComputation::Slice*> queue_;
+  bool abort_ = false;
+
+  std::vector<std::thread> threads_;
+};
+
+void MultiGpuComputation::ComputeBlocking() {
+  if (GetBatchSize() == 0) return;
+  network_->Split(GetBatchSize(), &slices_);
+  slice_of_sample_.resize(GetBatchSize());
+  for (size_t i = 0; i < slices_.size(); i++) {
+    slices_[i].parent = this;
+    std::fill_n(slice_of_sample_.begin() + slices_[i].start, slices_[i].size,
+                i);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_ = slices_.size();
+  }
+  for (auto& slice : slices_) network_->Enqueue(&slice);
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this]() { return pending_ == 0; });
+}
+
+std::unique_ptr<Network> MakeMultiGpuNetwork(
+    const std::optional<WeightsFile>& weights, const OptionsDict& options) {
+  return std::make_unique<MultiGpuNetwork>(weights, options);
+}
+
+REGISTER_NETWORK("cuda-multi", MakeMultiGpuNetwork, -1000)
+
+}  // namespace
+}  // namespace lczero
@@ -109,6 +109,17 @@ class CudnnNetworkComputation : public NetworkComputation {
     batch_size_++;
   }
 
+  bool CanAddInputInPlace() const override { return true; }
+
+  InputBuffers AddInputInPlace(
+      const std::vector<uint16_t>& /*moves*/) override {
+    const InputBuffers buffers{
+        &inputs_outputs_->input_masks_mem_[batch_size_ * kInputPlanes],
+        &inputs_outputs_->input_val_mem_[batch_size_ * kInputPlanes]};
+    batch_size_++;
+    return buffers;
+  }
+
   void ComputeBlocking() override;
 
   int GetBatchSize() const override { return batch_size_; }
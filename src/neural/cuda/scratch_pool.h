@@ -0,0 +1,149 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#pragma once
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+#include "cuda_common.h"
+
+namespace lczero {
+namespace cudnn_backend {
+
+// The tensor and scratch memory of multi_stream evaluations, shared by the
+// networks with the same layers on a GPU. A slot is only held while its
+// evaluation is enqueued; the next user of a slot on another stream is
+// ordered after it by an event, so the pool only grows to the number of
+// evaluations in flight on the GPU rather than one set per InputsOutputs.
+class ScratchPool {
+ public:
+  struct Slot {
+    void* tensor_mem[3] = {};
+    void* scratch_mem = nullptr;
+    // Cached by the attention layers, they depend on the addresses above.
+    void** offset_pointers = nullptr;
+    void** head_offset_pointers = nullptr;
+    // Recorded when the last evaluation using the slot was enqueued.
+    cudaEvent_t done;
+  };
+
+  ScratchPool(int gpu_id, size_t tensor_mem_size, size_t scratch_size)
+      : gpu_id_(gpu_id),
+        tensor_mem_size_(tensor_mem_size),
+        scratch_size_(scratch_size) {}
+
+  ~ScratchPool() {
+    cudaSetDevice(gpu_id_);
+    for (auto& slot : slots_) {
+      cudaEventSynchronize(slot->done);
+      for (auto mem : slot->tensor_mem) cudaFree(mem);
+      cudaFree(slot->scratch_mem);
+      if (slot->offset_pointers) cudaFree(slot->offset_pointers);
+      if (slot->head_offset_pointers) cudaFree(slot->head_offset_pointers);
+      cudaEventDestroy(slot->done);
+    }
+  }
+
+  // Returns the pool of @gpu_id for the buffer sizes and layers of @owner,
+  // creating it if no network uses one yet.
+  static std::shared_ptr<ScratchPool> Get(int gpu_id, size_t tensor_mem_size,
+                                          size_t scratch_size,
+                                          const void* owner) {
+    static std::mutex mutex;
+    static std::map<std::tuple<int, size_t, size_t, const void*>,
+                    std::weak_ptr<ScratchPool>>
+        pools;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& entry = pools[{gpu_id, tensor_mem_size, scratch_size, owner}];
+    auto pool = entry.lock();
+    if (!pool) {
+      pool = std::make_shared<ScratchPool>(gpu_id, tensor_mem_size,
+                                           scratch_size);
+      entry = pool;
+    }
+    return pool;
+  }
+
+  // Takes a slot for an evaluation enqueued next on @stream. A slot whose
+  // last evaluation is done is preferred, a new one is allocated otherwise.
+  Slot* Acquire(cudaStream_t stream) {
+    Slot* slot = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (auto iter = free_.begin(); iter != free_.end(); ++iter) {
+        if (cudaEventQuery((*iter)->done) == cudaSuccess) {
+          slot = *iter;
+          free_.erase(iter);
+          break;
+        }
+      }
+    }
+    if (slot) {
+      // Cheap when the event is complete, it only orders the memory reuse.
+      ReportCUDAErrors(cudaStreamWaitEvent(stream, slot->done, 0));
+      return slot;
+    }
+
+    auto new_slot = std::make_unique<Slot>();
+    ReportCUDAErrors(cudaMalloc(&new_slot->scratch_mem, scratch_size_));
+    for (auto& mem : new_slot->tensor_mem) {
+      ReportCUDAErrors(cudaMalloc(&mem, tensor_mem_size_));
+      ReportCUDAErrors(cudaMemsetAsync(mem, 0, tensor_mem_size_, stream));
+    }
+    ReportCUDAErrors(
+        cudaEventCreateWithFlags(&new_slot->done, cudaEventDisableTiming));
+    slot = new_slot.get();
+    std::lock_guard<std::mutex> lock(mutex_);
+    slots_.push_back(std::move(new_slot));
+    return slot;
+  }
+
+  // Returns @slot to the pool after the work enqueued on @stream so far.
+  void Release(Slot* slot, cudaStream_t stream) {
+    ReportCUDAErrors(cudaEventRecord(slot->done, stream));
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(slot);
+  }
+
+ private:
+  const int gpu_id_;
+  const size_t tensor_mem_size_;
+  const size_t scratch_size_;
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<Slot>> slots_;
+  std::deque<Slot*> free_;
+};
+
+}  // namespace cudnn_backend
+}  // namespace lczero
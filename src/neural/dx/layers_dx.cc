@@ -227,14 +227,17 @@ GemmMetaCommand::GemmMetaCommand(DxContext* dx_context, int rows, int cols,
     }
 
     if (temp_size) {
-      dx_context->CreateAlloc(temp_size, D3D12_HEAP_TYPE_DEFAULT,
-                              scratch_data_temporary_[i], fp16);
+      for (int slot = 0; slot < dx_context->getInflightBatches(); slot++) {
+        dx_context->CreateAlloc(temp_size, D3D12_HEAP_TYPE_DEFAULT,
+                                scratch_data_temporary_[slot][i], fp16);
+      }
     }
 
     GemmInitDesc initDesc = {};
     initDesc.PersistentResource =
         scratch_data_persistent_[i].desc_handle_scalar;
-    initDesc.TemporaryResource = scratch_data_temporary_[i].desc_handle_scalar;
+    initDesc.TemporaryResource =
+        scratch_data_temporary_[0][i].desc_handle_scalar;
 
     dx_context->getCommandList()->InitializeMetaCommand(
         meta_commands_[i], &initDesc, sizeof(initDesc));
@@ -245,7 +248,8 @@ GemmMetaCommand::GemmMetaCommand(DxContext* dx_context, int rows, int cols,
 
 void GemmMetaCommand::PerformGemm(int rows, DXAlloc A, DXAlloc B,
                                   DXAlloc output,
-                                  ID3D12GraphicsCommandList4* command_list) {
+                                  ID3D12GraphicsCommandList4* command_list,
+                                  int slot) {
   if (!create_succeeded_) throw Exception("Metacommand not created");
 
   int index = 0;
@@ -255,7 +259,7 @@ void GemmMetaCommand::PerformGemm(int rows, DXAlloc A, DXAlloc B,
 
   ID3D12MetaCommand* meta_command = meta_commands_[index];
   DXAlloc& scratch_persistent = scratch_data_persistent_[index];
-  DXAlloc& scratch_temporary = scratch_data_temporary_[index];
+  DXAlloc& scratch_temporary = scratch_data_temporary_[slot][index];
 
   GemmExecuteDesc exec_desc = {};
   exec_desc.AResource = A.desc_handle_scalar;
@@ -269,8 +273,11 @@ void GemmMetaCommand::PerformGemm(int rows, DXAlloc A, DXAlloc B,
 
 GemmMetaCommand::~GemmMetaCommand() {
   for (int i = 0; i < kMaxMetacommands; i++) {
-    if (scratch_data_temporary_[i].resource)
-      scratch_data_temporary_[i].resource->Release();
+    for (auto& scratch_temporary : scratch_data_temporary_) {
+      if (scratch_temporary[i].resource) {
+        scratch_temporary[i].resource->Release();
+      }
+    }
     if (scratch_data_persistent_[i].resource)
       scratch_data_persistent_[i].resource->Release();
     if (meta_commands_[i]) meta_commands_[i]->Release();
@@ -345,14 +352,17 @@ ConvMetaCommand::ConvMetaCommand(DxContext* dx_context, int C, int K, int H,
     }
 
     if (temp_size) {
-      dx_context->CreateAlloc(temp_size, D3D12_HEAP_TYPE_DEFAULT,
-                              scratch_data_temporary_[i], fp16);
+      for (int slot = 0; slot < dx_context->getInflightBatches(); slot++) {
+        dx_context->CreateAlloc(temp_size, D3D12_HEAP_TYPE_DEFAULT,
+                                scratch_data_temporary_[slot][i], fp16);
+      }
     }
 
     InitConvDesc initDesc = {};
     initDesc.PersistentResource =
         scratch_data_persistent_[i].desc_handle_scalar;
-    initDesc.TemporaryResource = scratch_data_temporary_[i].desc_handle_scalar;
+    initDesc.TemporaryResource =
+        scratch_data_temporary_[0][i].desc_handle_scalar;
 
     dx_context->getCommandList()->InitializeMetaCommand(
         meta_commands_[i], &initDesc, sizeof(initDesc));
@@ -363,14 +373,15 @@ ConvMetaCommand::ConvMetaCommand(DxContext* dx_context, int C, int K, int H,
 
 void ConvMetaCommand::PerformConv(int batch, DXAlloc input, DXAlloc filter,
                                   DXAlloc bias, DXAlloc output,
-                                  ID3D12GraphicsCommandList4* command_list) {
+                                  ID3D12GraphicsCommandList4* command_list,
+                                  int slot) {
   if (!create_succeeded_) throw Exception("Metacommand not created");
 
   int index = DivUp(batch, 8) - 1;
 
   ID3D12MetaCommand* meta_command = meta_commands_[index];
   DXAlloc& scratch_persistent = scratch_data_persistent_[index];
-  DXAlloc& scratch_temporary = scratch_data_temporary_[index];
+  DXAlloc& scratch_temporary = scratch_data_temporary_[slot][index];
 
   ExecuteConvDesc exec_desc = {};
   exec_desc.InputResource = input.desc_handle_scalar;
@@ -385,8 +396,11 @@ void ConvMetaCommand::PerformConv(int batch, DXAlloc input, DXAlloc filter,
 
 ConvMetaCommand::~ConvMetaCommand() {
   for (int i = 0; i < kMaxMetacommands; i++) {
-    if (scratch_data_temporary_[i].resource)
-      scratch_data_temporary_[i].resource->Release();
+    for (auto& scratch_temporary : scratch_data_temporary_) {
+      if (scratch_temporary[i].resource) {
+        scratch_temporary[i].resource->Release();
+      }
+    }
     if (scratch_data_persistent_[i].resource)
       scratch_data_persistent_[i].resource->Release();
     if (meta_commands_[i]) meta_commands_[i]->Release();
@@ -545,7 +559,7 @@ void ConvLayer::LoadSEWeights(float* w1, float* b1, float* w2, float* b2) {
 
 void ConvLayer::Eval(int N, DXAlloc output, DXAlloc input, DXAlloc input2,
                      DXAlloc scratch, DXAlloc scratch2,
-                     ID3D12GraphicsCommandList4* command_list) {
+                     ID3D12GraphicsCommandList4* command_list, int slot) {
   // Use winograd for filter size of 3, when GEMM metacommand is available,
   // Or when GEMM metacommand isn't available but Convolution metacommand is
   // also not available (compute shader matrix multiply path).
@@ -572,7 +586,7 @@ void ConvLayer::Eval(int N, DXAlloc output, DXAlloc input, DXAlloc input2,
     // 2. Gemm (scratch -> scratch2)
     if (meta_command_gemm_ && meta_command_gemm_->IsAvailable())
       meta_command_gemm_->PerformGemm(N * 4, scratch, transformed_weights_,
-                                      scratch2, command_list);
+                                      scratch2, command_list, slot);
     else
       shader_wrapper_->MatrixMultiply(command_list, scratch2, scratch,
                                       transformed_weights_, N * 4, C, c_input_,
@@ -588,10 +602,10 @@ void ConvLayer::Eval(int N, DXAlloc output, DXAlloc input, DXAlloc input2,
   } else if (meta_command_conv_ && meta_command_conv_->IsAvailable()) {
     if (skip_add_ || has_se_)
       meta_command_conv_->PerformConv(N, input, weights_, biases_, scratch,
-                                      command_list);
+                                      command_list, slot);
     else
       meta_command_conv_->PerformConv(N, input, weights_, biases_, output,
-                                      command_list);
+                                      command_list, slot);
     if (has_se_) {
       dx_context_->UavBarrier(command_list);
       shader_wrapper_->Se(command_list, output, scratch, input2, biases_, w1_,
@@ -686,12 +700,13 @@ void FCLayer::LoadWeights(float* cpuWeight, float* cpuBias,
 
 void FCLayer::Eval(int N, DXAlloc output, DXAlloc input, DXAlloc /*input2*/,
                    DXAlloc /*scratch*/, DXAlloc /*scratch2*/,
-                   ID3D12GraphicsCommandList4* command_list) {
+                   ID3D12GraphicsCommandList4* command_list, int slot) {
   int num_outputs = C * H * W;
   int num_inputs = input_->GetC() * input_->GetH() * input_->GetW();
 
   if (meta_command_->IsAvailable())
-    meta_command_->PerformGemm(N, input, weights_, output, command_list);
+    meta_command_->PerformGemm(N, input, weights_, output, command_list,
+                               slot);
   else
     shader_wrapper_->MatrixMultiply(command_list, output, input, weights_,
                                     DivUp(N, 8) * 8, num_outputs, num_inputs, 1,
@@ -727,7 +742,8 @@ void PolicyMapLayer::LoadWeights(const short* cpuWeights) {
 void PolicyMapLayer::Eval(int N, DXAlloc output, DXAlloc input,
                           DXAlloc /*input2*/, DXAlloc /*scratch*/,
                           DXAlloc /*scratch2*/,
-                          ID3D12GraphicsCommandList4* command_list) {
+                          ID3D12GraphicsCommandList4* command_list,
+                          int /*slot*/) {
   int inputSize =
       this->input_->GetC() * this->input_->GetH() * this->input_->GetW();
   int outputSize = this->C * this->H * this->W;
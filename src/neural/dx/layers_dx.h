@@ -38,6 +38,9 @@ namespace dx_backend {
 
 class DxContext;
 constexpr int kMaxSupportedBatchSize = 256;
+// Upper limit of batches that can be evaluated concurrently on the GPU, each
+// in-flight batch uses its own slot of tensor and metacommand scratch memory.
+constexpr int kMaxInflightBatches = 4;
 
 // The Layer objects only hold memory for weights, biases, etc
 // memory for input and output tensors is provided by caller of Eval.
@@ -56,9 +59,10 @@ class BaseLayer {
   }
 
   // input2 is optional (skip connection).
+  // slot is the in-flight batch slot the evaluation is recorded for.
   virtual void Eval(int N, DXAlloc output, DXAlloc input, DXAlloc input2,
                     DXAlloc scratch, DXAlloc scratch2,
-                    ID3D12GraphicsCommandList4* command_list) = 0;
+                    ID3D12GraphicsCommandList4* command_list, int slot) = 0;
 
  protected:
   BaseLayer* input_;
@@ -86,7 +90,9 @@ class GemmMetaCommand {
   ID3D12MetaCommand* meta_commands_[kMaxMetacommands];
 
   DXAlloc scratch_data_persistent_[kMaxMetacommands];
-  DXAlloc scratch_data_temporary_[kMaxMetacommands];
+  // Temporary resources are written during execution, so every in-flight
+  // slot needs its own.
+  DXAlloc scratch_data_temporary_[kMaxInflightBatches][kMaxMetacommands];
 
   bool rows_known_;
   bool create_succeeded_;
@@ -97,7 +103,7 @@ class GemmMetaCommand {
   ~GemmMetaCommand();
 
   void PerformGemm(int rows, DXAlloc A, DXAlloc B, DXAlloc Output,
-                   ID3D12GraphicsCommandList4* command_list);
+                   ID3D12GraphicsCommandList4* command_list, int slot);
 
   bool IsAvailable() { return create_succeeded_; }
 };
@@ -111,7 +117,9 @@ class ConvMetaCommand {
   ID3D12MetaCommand* meta_commands_[kMaxMetacommands];
 
   DXAlloc scratch_data_persistent_[kMaxMetacommands];
-  DXAlloc scratch_data_temporary_[kMaxMetacommands];
+  // Temporary resources are written during execution, so every in-flight
+  // slot needs its own.
+  DXAlloc scratch_data_temporary_[kMaxInflightBatches][kMaxMetacommands];
   bool create_succeeded_;
   bool use_bias_;
 
@@ -121,7 +129,8 @@ class ConvMetaCommand {
   ~ConvMetaCommand();
 
   void PerformConv(int batch, DXAlloc input, DXAlloc filter, DXAlloc bias,
-                   DXAlloc output, ID3D12GraphicsCommandList4* command_list);
+                   DXAlloc output, ID3D12GraphicsCommandList4* command_list,
+                   int slot);
 
   bool IsAvailable() { return create_succeeded_; }
 };
@@ -146,7 +155,7 @@ class ConvLayer : public BaseLayer {
   void LoadSEWeights(float* w1, float* b1, float* w2, float* b2);
   void Eval(int N, DXAlloc output, DXAlloc input, DXAlloc input2,
             DXAlloc scratch, DXAlloc scratch2,
-            ID3D12GraphicsCommandList4* command_list) override;
+            ID3D12GraphicsCommandList4* command_list, int slot) override;
 
  private:
   const int c_input_;
@@ -182,7 +191,7 @@ class FCLayer : public BaseLayer {
   void LoadWeights(float* cpu_weight, float* cpu_bias, DxContext* dx_context);
   void Eval(int N, DXAlloc output, DXAlloc input, DXAlloc input2,
             DXAlloc scratch, DXAlloc scratch2,
-            ID3D12GraphicsCommandList4* command_list) override;
+            ID3D12GraphicsCommandList4* command_list, int slot) override;
 
  private:
   const bool use_bias_;
@@ -205,7 +214,7 @@ class PolicyMapLayer : public BaseLayer {
   void LoadWeights(const short* cpu_weights);
   void Eval(int N, DXAlloc output, DXAlloc input, DXAlloc input2,
             DXAlloc scratch, DXAlloc scratch2,
-            ID3D12GraphicsCommandList4* command_list) override;
+            ID3D12GraphicsCommandList4* command_list, int slot) override;
 
  private:
   const int used_size_;
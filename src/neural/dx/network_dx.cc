@@ -165,6 +165,8 @@ void DxContext::DumpTensor(const char*, DXAlloc, int, bool, bool) {}
 
 DxContext::DxContext(const OptionsDict& options) {
   gpu_id_ = options.GetOrDefault<int>("gpu", 0);
+  inflight_batches_ = std::clamp(options.GetOrDefault<int>("inflight", 2), 1,
+                                 kMaxInflightBatches);
 
   IDXGIFactory4* pFactory = nullptr;
   IDXGIAdapter* pAdapter = nullptr;
@@ -640,15 +642,36 @@ DxNetwork::DxNetwork(const WeightsFile& file, const OptionsDict& options)
   // Every 4x4 block of input/output is transfored to 6x6 block.
   max_size *= (size_t)ceil(36.0 / 16.0);
 
-  for (auto& mem : tensor_mem_) {
-    dx_context_.CreateAlloc(max_size, D3D12_HEAP_TYPE_DEFAULT, mem, fp16_);
+  // Each in-flight batch gets its own set, and its own compute queue.
+  D3D12_COMMAND_QUEUE_DESC queue_desc = {};
+  queue_desc.Flags = D3D12_COMMAND_QUEUE_FLAG_NONE;
+  queue_desc.Type = D3D12_COMMAND_LIST_TYPE_COMPUTE;
+  for (int i = 0; i < dx_context_.getInflightBatches(); i++) {
+    auto slot = std::make_unique<InflightSlot>();
+    ReportDxErrors(dx_context_.getDevice()->CreateCommandQueue(
+        &queue_desc, IID_PPV_ARGS(&slot->queue)));
+    slot->fence_val = 0ull;
+    ReportDxErrors(dx_context_.getDevice()->CreateFence(
+        slot->fence_val, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&slot->fence)));
+    for (auto& mem : slot->tensor_mem) {
+      dx_context_.CreateAlloc(max_size, D3D12_HEAP_TYPE_DEFAULT, mem, fp16_);
+    }
+    slots_.push_back(std::move(slot));
   }
+  next_slot_ = 0;
 }
 
 void DxNetwork::Eval(InputsOutputsDx* io, int batch_size) {
   if (batch_size > kMaxSupportedBatchSize)
     throw Exception("Unsupported batch size: " + std::to_string(batch_size));
 
+  // Batches are spread over the slots round robin. Waiting for the slot lock
+  // only happens when more evaluations than slots are being recorded.
+  const int slot_idx = next_slot_++ % slots_.size();
+  InflightSlot& slot = *slots_[slot_idx];
+  std::unique_lock<std::mutex> slot_lock(slot.lock);
+  DXAlloc* tensor_mem = slot.tensor_mem;
+
 #ifdef DEBUG_DUMP_PER_LAYER_DATA
   lock_.lock();
   ID3D12GraphicsCommandList4* cl = dx_context_.getCommandList();
@@ -664,97 +687,98 @@ void DxNetwork::Eval(InputsOutputsDx* io, int batch_size) {
   CD3DX12_RESOURCE_BARRIER barrier;
 
   barrier = CD3DX12_RESOURCE_BARRIER::Transition(
-      tensor_mem_[1].resource, D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+      tensor_mem[1].resource, D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
       D3D12_RESOURCE_STATE_COPY_DEST);
   cl->ResourceBarrier(1, &barrier);
 
   barrier = CD3DX12_RESOURCE_BARRIER::Transition(
-      tensor_mem_[2].resource, D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+      tensor_mem[2].resource, D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
       D3D12_RESOURCE_STATE_COPY_DEST);
   cl->ResourceBarrier(1, &barrier);
 
-  cl->CopyBufferRegion(tensor_mem_[1].resource, 0,
+  cl->CopyBufferRegion(tensor_mem[1].resource, 0,
                        io->input_masks_mem_gpu_.resource, 0,
                        sizeof(uint64_t) * batch_size * kInputPlanes);
-  cl->CopyBufferRegion(tensor_mem_[2].resource, 0,
+  cl->CopyBufferRegion(tensor_mem[2].resource, 0,
                        io->input_val_mem_gpu_.resource, 0,
                        sizeof(float) * batch_size * kInputPlanes);
 
   barrier = CD3DX12_RESOURCE_BARRIER::Transition(
-      tensor_mem_[1].resource, D3D12_RESOURCE_STATE_COPY_DEST,
+      tensor_mem[1].resource, D3D12_RESOURCE_STATE_COPY_DEST,
       D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
   cl->ResourceBarrier(1, &barrier);
 
   barrier = CD3DX12_RESOURCE_BARRIER::Transition(
-      tensor_mem_[2].resource, D3D12_RESOURCE_STATE_COPY_DEST,
+      tensor_mem[2].resource, D3D12_RESOURCE_STATE_COPY_DEST,
       D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
   cl->ResourceBarrier(1, &barrier);
 
   dx_context_.UavBarrier(cl);
 
   dx_context_.getShaderWrapper()->ExpandPlanes(
-      cl, tensor_mem_[0], tensor_mem_[1], tensor_mem_[2], batch_size, fp16_);
+      cl, tensor_mem[0], tensor_mem[1], tensor_mem[2], batch_size, fp16_);
 
 #else
   dx_context_.getShaderWrapper()->ExpandPlanes(
-      cl, tensor_mem_[0], io->input_masks_mem_gpu_, io->input_val_mem_gpu_,
+      cl, tensor_mem[0], io->input_masks_mem_gpu_, io->input_val_mem_gpu_,
       batch_size, fp16_);
 #endif
 
   dx_context_.UavBarrier(cl);
 
   // Debug logging (not compiled by default)
-  dx_context_.DumpTensor("After expand planes", tensor_mem_[0], 1024, fp16_);
+  dx_context_.DumpTensor("After expand planes", tensor_mem[0], 1024, fp16_);
 
   int l = 0;
 
   //-----------------------------------///---------------------------------------
   // Input Conv
-  network_[l++]->Eval(batch_size, tensor_mem_[2], tensor_mem_[0], DXAlloc(),
-                      tensor_mem_[1], tensor_mem_[3], cl);
+  network_[l++]->Eval(batch_size, tensor_mem[2], tensor_mem[0], DXAlloc(),
+                      tensor_mem[1], tensor_mem[3], cl, slot_idx);
   dx_context_.UavBarrier(cl);
 
-  dx_context_.DumpTensor("After input conv", tensor_mem_[2], 1024, fp16_);
+  dx_context_.DumpTensor("After input conv", tensor_mem[2], 1024, fp16_);
 
   //-----------------------------------///---------------------------------------
 
   // Residual tower.
   for (int block = 0; block < num_blocks_; block++) {
     // conv1
-    network_[l++]->Eval(batch_size, tensor_mem_[0], tensor_mem_[2], DXAlloc(),
-                        tensor_mem_[1], tensor_mem_[3], cl);
+    network_[l++]->Eval(batch_size, tensor_mem[0], tensor_mem[2], DXAlloc(),
+                        tensor_mem[1], tensor_mem[3], cl, slot_idx);
     dx_context_.UavBarrier(cl);
 
     // conv2
-    network_[l++]->Eval(batch_size, tensor_mem_[2], tensor_mem_[0],
-                        tensor_mem_[2], tensor_mem_[1], tensor_mem_[3], cl);
+    network_[l++]->Eval(batch_size, tensor_mem[2], tensor_mem[0],
+                        tensor_mem[2], tensor_mem[1], tensor_mem[3], cl,
+                        slot_idx);
     dx_context_.UavBarrier(cl);
   }
 
-  dx_context_.DumpTensor("After Residual tower", tensor_mem_[2], 1024, fp16_);
+  dx_context_.DumpTensor("After Residual tower", tensor_mem[2], 1024, fp16_);
 
   //-----------------------------------///---------------------------------------
 
   // Policy head.
   if (has_conv_policy_) {
     // Policy conv1.
-    network_[l++]->Eval(batch_size, tensor_mem_[0], tensor_mem_[2], DXAlloc(),
-                        tensor_mem_[1], tensor_mem_[3], cl);
+    network_[l++]->Eval(batch_size, tensor_mem[0], tensor_mem[2], DXAlloc(),
+                        tensor_mem[1], tensor_mem[3], cl, slot_idx);
     dx_context_.UavBarrier(cl);
 
-    dx_context_.DumpTensor("After policy conv1", tensor_mem_[0], 1024, fp16_);
+    dx_context_.DumpTensor("After policy conv1", tensor_mem[0], 1024, fp16_);
 
     // Policy conv2
-    network_[l++]->Eval(batch_size, tensor_mem_[1], tensor_mem_[0], DXAlloc(),
-                        tensor_mem_[1], tensor_mem_[3], cl);
+    network_[l++]->Eval(batch_size, tensor_mem[1], tensor_mem[0], DXAlloc(),
+                        tensor_mem[1], tensor_mem[3], cl, slot_idx);
 
     dx_context_.UavBarrier(cl);
 
-    dx_context_.DumpTensor("After policy conv2", tensor_mem_[1], 1024, fp16_);
+    dx_context_.DumpTensor("After policy conv2", tensor_mem[1], 1024, fp16_);
 
     // Policy Map layer  (writes directly to system memory).
-    network_[l++]->Eval(batch_size, io->op_policy_mem_gpu_, tensor_mem_[1],
-                        DXAlloc(), DXAlloc(), DXAlloc(), cl);
+    network_[l++]->Eval(batch_size, io->op_policy_mem_gpu_, tensor_mem[1],
+                        DXAlloc(), DXAlloc(), DXAlloc(), cl, slot_idx);
 
     // Output of policy map layer is always FP32.
     dx_context_.DumpTensor("After policy map", io->op_policy_mem_gpu_, 1024,
@@ -762,13 +786,13 @@ void DxNetwork::Eval(InputsOutputsDx* io, int batch_size) {
 
   } else {
     // Policy conv.
-    network_[l++]->Eval(batch_size, tensor_mem_[0], tensor_mem_[2], DXAlloc(),
-                        tensor_mem_[1], tensor_mem_[3], cl);
+    network_[l++]->Eval(batch_size, tensor_mem[0], tensor_mem[2], DXAlloc(),
+                        tensor_mem[1], tensor_mem[3], cl, slot_idx);
     dx_context_.UavBarrier(cl);
 
     // Policy FC (writes directly to system memory).
-    network_[l++]->Eval(batch_size, io->op_policy_mem_gpu_, tensor_mem_[0],
-                        DXAlloc(), tensor_mem_[1], tensor_mem_[3], cl);
+    network_[l++]->Eval(batch_size, io->op_policy_mem_gpu_, tensor_mem[0],
+                        DXAlloc(), tensor_mem[1], tensor_mem[3], cl, slot_idx);
   }
 
   //-----------------------------------///---------------------------------------
@@ -776,22 +800,22 @@ void DxNetwork::Eval(InputsOutputsDx* io, int batch_size) {
   // Value head.
 
   // Value conv.
-  network_[l++]->Eval(batch_size, tensor_mem_[0], tensor_mem_[2], DXAlloc(),
-                      tensor_mem_[1], tensor_mem_[3], cl);
+  network_[l++]->Eval(batch_size, tensor_mem[0], tensor_mem[2], DXAlloc(),
+                      tensor_mem[1], tensor_mem[3], cl, slot_idx);
   dx_context_.UavBarrier(cl);
 
-  dx_context_.DumpTensor("After value conv", tensor_mem_[0], 1024, fp16_);
+  dx_context_.DumpTensor("After value conv", tensor_mem[0], 1024, fp16_);
 
   // value FC1.
-  network_[l++]->Eval(batch_size, tensor_mem_[1], tensor_mem_[0], DXAlloc(),
-                      DXAlloc(), DXAlloc(), cl);
+  network_[l++]->Eval(batch_size, tensor_mem[1], tensor_mem[0], DXAlloc(),
+                      DXAlloc(), DXAlloc(), cl, slot_idx);
   dx_context_.UavBarrier(cl);
 
-  dx_context_.DumpTensor("After value fc1", tensor_mem_[1], 128, fp16_);
+  dx_context_.DumpTensor("After value fc1", tensor_mem[1], 128, fp16_);
 
   // value FC2.
-  network_[l++]->Eval(batch_size, io->op_value_mem_gpu_, tensor_mem_[1],
-                      DXAlloc(), DXAlloc(), DXAlloc(), cl);
+  network_[l++]->Eval(batch_size, io->op_value_mem_gpu_, tensor_mem[1],
+                      DXAlloc(), DXAlloc(), DXAlloc(), cl, slot_idx);
 
   dx_context_.DumpTensor("After value fc2", io->op_value_mem_gpu_, 8, fp16_);
 
@@ -800,23 +824,23 @@ void DxNetwork::Eval(InputsOutputsDx* io, int batch_size) {
   // Moves left head.
   if (moves_left_) {
     // Moves left conv.
-    network_[l++]->Eval(batch_size, tensor_mem_[0], tensor_mem_[2], DXAlloc(),
-                        tensor_mem_[1], tensor_mem_[3], cl);
+    network_[l++]->Eval(batch_size, tensor_mem[0], tensor_mem[2], DXAlloc(),
+                        tensor_mem[1], tensor_mem[3], cl, slot_idx);
     dx_context_.UavBarrier(cl);
 
-    dx_context_.DumpTensor("After moves left conv", tensor_mem_[0], 1024,
+    dx_context_.DumpTensor("After moves left conv", tensor_mem[0], 1024,
                            fp16_);
 
     // Moves left FC1.
-    network_[l++]->Eval(batch_size, tensor_mem_[1], tensor_mem_[0], DXAlloc(),
-                        DXAlloc(), DXAlloc(), cl);
+    network_[l++]->Eval(batch_size, tensor_mem[1], tensor_mem[0], DXAlloc(),
+                        DXAlloc(), DXAlloc(), cl, slot_idx);
     dx_context_.UavBarrier(cl);
 
-    dx_context_.DumpTensor("After moves left fc1", tensor_mem_[1], 512, fp16_);
+    dx_context_.DumpTensor("After moves left fc1", tensor_mem[1], 512, fp16_);
 
     // Moves left FC2.
-    network_[l++]->Eval(batch_size, io->op_moves_left_mem_gpu_, tensor_mem_[1],
-                        DXAlloc(), DXAlloc(), DXAlloc(), cl);
+    network_[l++]->Eval(batch_size, io->op_moves_left_mem_gpu_, tensor_mem[1],
+                        DXAlloc(), DXAlloc(), DXAlloc(), cl, slot_idx);
 
     dx_context_.DumpTensor("After moves left fc2", io->op_moves_left_mem_gpu_,
                            8, fp16_);
@@ -827,15 +851,16 @@ void DxNetwork::Eval(InputsOutputsDx* io, int batch_size) {
   dx_context_.FlushAndWait();
   lock_.unlock();
 #else
-  // TODO: Get rid of this lock once we move the Command Queue also to
-  // InputsOutputs structure This isn't a bottleneck anyway (for CPU side perf).
-  // The hope is that we will get some GPU side parallelism with multiple async
-  // compute queues.
-  lock_.lock();
-  uint64_t fence = dx_context_.FlushCL(cl);
-  lock_.unlock();
-
-  dx_context_.WaitForGpu(fence);
+  cl->Close();
+  slot.queue->ExecuteCommandLists(1, (ID3D12CommandList**)&cl);
+  const uint64_t fence = ++slot.fence_val;
+  slot.queue->Signal(slot.fence, fence);
+  slot_lock.unlock();
+
+  // Spin like DxContext::WaitForGpu(), batches of the other slots can be
+  // recorded and run on the GPU in the meantime.
+  while (slot.fence->GetCompletedValue() < fence)
+    ;
   io->needs_reset_ = true;
 #endif
 
@@ -920,8 +945,12 @@ void DxNetwork::Eval(InputsOutputsDx* io, int batch_size) {
 DxNetwork::~DxNetwork() {
   dx_context_.FlushAndWait();
   // Free memory and destroy all dx objects.
-  for (auto mem : tensor_mem_) {
-    mem.resource->Release();
+  for (auto& slot : slots_) {
+    while (slot->fence->GetCompletedValue() < slot->fence_val)
+      ;
+    for (auto mem : slot->tensor_mem) mem.resource->Release();
+    slot->fence->Release();
+    slot->queue->Release();
   }
 }
 
@@ -1034,11 +1063,12 @@ InputsOutputsDx::InputsOutputsDx(int maxBatchSize, DxContext* dx_context,
   op_value_mem_final_ = new float[maxBatchSize * (wdl ? 3 : 1)];
   if (moves_left) op_moves_left_mem_final_ = new float[maxBatchSize];
 
+  // Submitted to the compute queue of an in-flight slot.
   ReportDxErrors(dx_context->getDevice()->CreateCommandAllocator(
-      D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&command_allocator_)));
+      D3D12_COMMAND_LIST_TYPE_COMPUTE, IID_PPV_ARGS(&command_allocator_)));
 
   ReportDxErrors(dx_context->getDevice()->CreateCommandList(
-      1, D3D12_COMMAND_LIST_TYPE_DIRECT, command_allocator_, NULL,
+      1, D3D12_COMMAND_LIST_TYPE_COMPUTE, command_allocator_, NULL,
       IID_PPV_ARGS(&command_list_)));
 }
 
@@ -81,7 +81,8 @@ struct InputsOutputsDx {
   float* op_value_mem_final_;
   float* op_moves_left_mem_final_;
 
-  // For recording GPU commands.
+  // For recording GPU commands (compute command list, one per in-flight
+  // evaluation).
   ID3D12GraphicsCommandList4* command_list_;
   ID3D12CommandAllocator* command_allocator_;
 
@@ -168,6 +169,7 @@ class DxContext {
   DXAlloc readback_scratch_mem_;
 
   int gpu_id_;
+  int inflight_batches_;
 
  public:
   DxContext(const OptionsDict& options);
@@ -176,6 +178,7 @@ class DxContext {
   ID3D12Device5* getDevice() { return device_; }
   ID3D12GraphicsCommandList4* getCommandList() { return command_list_; }
   ShaderWrapper* getShaderWrapper() { return &shader_wrapper_; }
+  int getInflightBatches() const { return inflight_batches_; }
 
   // util functions
   void CreateAlloc(size_t size, D3D12_HEAP_TYPE type, DXAlloc& alloc,
@@ -217,10 +220,24 @@ class DxNetwork : public Network {
   DxContext dx_context_;
   int max_batch_size_;
 
-  // Currently only one NN Eval can happen a time (we can fix this if needed
-  // by allocating more memory).
+  // Only used to serialize evaluations when dumping per layer data.
   mutable std::mutex lock_;
 
+  // GPU state of one in-flight batch. Every slot submits to its own compute
+  // queue, so batches recorded for different slots can overlap on the GPU,
+  // while batches sharing a slot are ordered by its queue.
+  struct InflightSlot {
+    ID3D12CommandQueue* queue;
+    ID3D12Fence* fence;
+    uint64_t fence_val;
+    // In device memory.
+    DXAlloc tensor_mem[4];
+    // Held while recording and submitting.
+    std::mutex lock;
+  };
+  std::vector<std::unique_ptr<InflightSlot>> slots_;
+  std::atomic<unsigned int> next_slot_;
+
   // Network Properties.
   int num_blocks_;
   bool has_se_;
@@ -246,9 +263,6 @@ class DxNetwork : public Network {
   std::unique_ptr<ConvMetaCommand> resi_block_conv_2_metacommand_;
   std::unique_ptr<ConvMetaCommand> policy_conv_metacommand_;
 
-  // In device memory.
-  DXAlloc tensor_mem_[4];
-
   mutable std::mutex inputs_outputs_lock_;
   std::list<std::unique_ptr<InputsOutputsDx>> free_inputs_outputs_;
 };
@@ -33,20 +33,6 @@ namespace lczero {
 
 namespace {
 
-int CompareTransposing(BitBoard board, int initial_transform) {
-  uint64_t value = board.as_int();
-  if ((initial_transform & FlipTransform) != 0) {
-    value = ReverseBitsInBytes(value);
-  }
-  if ((initial_transform & MirrorTransform) != 0) {
-    value = ReverseBytesInBytes(value);
-  }
-  auto alternative = TransposeBitsInBytes(value);
-  if (value < alternative) return -1;
-  if (value > alternative) return 1;
-  return 0;
-}
-
 int ChooseTransform(const ChessBoard& board) {
   // If there are any castling options no transform is valid.
   // Even using FRC rules, king and queen side castle moves are not symmetrical.
@@ -73,30 +59,22 @@ int ChooseTransform(const ChessBoard& board) {
   if ((our_king & 0xE0C08000ULL) != 0) {
     transform |= TransposeTransform;
   } else if ((our_king & 0x10204080ULL) != 0) {
-    auto outcome = CompareTransposing(board.ours() | board.theirs(), transform);
-    if (outcome == -1) return transform;
-    if (outcome == 1) return transform | TransposeTransform;
-    outcome = CompareTransposing(board.ours(), transform);
-    if (outcome == -1) return transform;
-    if (outcome == 1) return transform | TransposeTransform;
-    outcome = CompareTransposing(board.kings(), transform);
-    if (outcome == -1) return transform;
-    if (outcome == 1) return transform | TransposeTransform;
-    outcome = CompareTransposing(board.queens(), transform);
-    if (outcome == -1) return transform;
-    if (outcome == 1) return transform | TransposeTransform;
-    outcome = CompareTransposing(board.rooks(), transform);
-    if (outcome == -1) return transform;
-    if (outcome == 1) return transform | TransposeTransform;
-    outcome = CompareTransposing(board.knights(), transform);
-    if (outcome == -1) return transform;
-    if (outcome == 1) return transform | TransposeTransform;
-    outcome = CompareTransposing(board.bishops(), transform);
-    if (outcome == -1) return transform;
-    if (outcome == 1) return transform | TransposeTransform;
-    // If all piece types are symmetrical and ours is symmetrical and
-    // ours+theirs is symmetrical, everything is symmetrical, so transpose is a
-    // no-op.
+    // The first of these boards which isn't symmetrical decides. If all piece
+    // types are symmetrical and ours is symmetrical and ours+theirs is
+    // symmetrical, everything is symmetrical, so transpose is a no-op.
+    uint64_t boards[] = {(board.ours() | board.theirs()).as_int(),
+                         board.ours().as_int(),
+                         board.kings().as_int(),
+                         board.queens().as_int(),
+                         board.rooks().as_int(),
+                         board.knights().as_int(),
+                         board.bishops().as_int()};
+    for (auto& value : boards) value = TransformBits(value, transform);
+    for (const auto value : boards) {
+      const auto transposed = TransposeBitsInBytes(value);
+      if (value < transposed) return transform;
+      if (value > transposed) return transform | TransposeTransform;
+    }
   }
   return transform;
 }
@@ -122,128 +100,160 @@ bool Is960CastlingFormat(pblczero::NetworkFormat::InputFormat input_format) {
   return input_format >= pblczero::NetworkFormat::INPUT_112_WITH_CASTLING_PLANE;
 }
 
-int TransformForPosition(pblczero::NetworkFormat::InputFormat input_format,
-                         const PositionHistory& history) {
-  if (!IsCanonicalFormat(input_format)) {
-    return 0;
-  }
-  const ChessBoard& board = history.Last().GetBoard();
-  return ChooseTransform(board);
-}
+namespace {
 
-InputPlanes EncodePositionForNN(
-    pblczero::NetworkFormat::InputFormat input_format,
-    const PositionHistory& history, int history_planes,
-    FillEmptyHistory fill_empty_history, int* transform_out) {
-  InputPlanes result(kAuxPlaneBase + 8);
+// Castling rights value of ParentHistoryPlanes::castlings for boards with
+// different rights.
+constexpr int kMixedCastlings = -1;
 
-  int transform = 0;
-  // Canonicalization format needs to stop early to avoid applying transform in
-  // history across incompatible transitions.  It is also more canonical since
-  // history before these points is not relevant to the final result.
-  bool stop_early = IsCanonicalFormat(input_format);
-  // When stopping early, we want to know if castlings has changed, so capture
-  // it for the first board.
-  ChessBoard::Castlings castlings;
-  {
-    const ChessBoard& board = history.Last().GetBoard();
-    const bool we_are_black = board.flipped();
-    if (IsCanonicalFormat(input_format)) {
-      transform = ChooseTransform(board);
+// Planes of a sample in the input buffers of a backend, accessed like
+// InputPlanes.
+class InputBufferPlanes {
+ public:
+  struct PlaneRef {
+    void SetAll() { mask = ~0ull; }
+    void Fill(float val) {
+      SetAll();
+      value = val;
     }
-    switch (input_format) {
-      case pblczero::NetworkFormat::INPUT_CLASSICAL_112_PLANE: {
-        // "Legacy" input planes with:
-        // - Plane 104 (0-based) filled with 1 if we can castle queenside.
-        // - Plane 105 filled with ones if we can castle kingside.
-        // - Plane 106 filled with ones if they can castle queenside.
-        // - Plane 107 filled with ones if they can castle kingside.
-        if (board.castlings().we_can_000()) result[kAuxPlaneBase + 0].SetAll();
-        if (board.castlings().we_can_00()) result[kAuxPlaneBase + 1].SetAll();
-        if (board.castlings().they_can_000()) {
-          result[kAuxPlaneBase + 2].SetAll();
-        }
-        if (board.castlings().they_can_00()) result[kAuxPlaneBase + 3].SetAll();
-        break;
-      }
+    std::uint64_t& mask;
+    float& value;
+  };
+
+  explicit InputBufferPlanes(const InputBuffers& buffers) : buffers_(buffers) {
+    std::fill_n(buffers_.masks, kInputPlanes, 0ull);
+    std::fill_n(buffers_.values, kInputPlanes, 1.0f);
+  }
+  PlaneRef operator[](int idx) const {
+    return {buffers_.masks[idx], buffers_.values[idx]};
+  }
+
+ private:
+  const InputBuffers buffers_;
+};
 
-      case pblczero::NetworkFormat::INPUT_112_WITH_CASTLING_PLANE:
-      case pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION:
-      case pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION_HECTOPLIES:
-      case pblczero::NetworkFormat::
-          INPUT_112_WITH_CANONICALIZATION_HECTOPLIES_ARMAGEDDON:
-      case pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION_V2:
-      case pblczero::NetworkFormat::
-          INPUT_112_WITH_CANONICALIZATION_V2_ARMAGEDDON: {
-        // - Plane 104 for positions of rooks (both white and black) which
-        // have
-        // a-side (queenside) castling right.
-        // - Plane 105 for positions of rooks (both white and black) which have
-        // h-side (kingside) castling right.
-        const auto& cast = board.castlings();
-        result[kAuxPlaneBase + 0].mask =
-            (cast.we_can_000()
-                 ? BoardSquare(ChessBoard::A1 + cast.our_queenside_rook())
-                       .as_board()
-                 : 0) |
-            (cast.they_can_000()
-                 ? BoardSquare(ChessBoard::A8 + cast.their_queenside_rook())
-                       .as_board()
-                 : 0);
-        result[kAuxPlaneBase + 1].mask =
-            (cast.we_can_00()
-                 ? BoardSquare(ChessBoard::A1 + cast.our_kingside_rook())
-                       .as_board()
-                 : 0) |
-            (cast.they_can_00()
-                 ? BoardSquare(ChessBoard::A8 + cast.their_kingside_rook())
-                       .as_board()
-                 : 0);
-        break;
+// Fills the aux planes of @position, the last position of the encoding.
+template <typename Planes>
+void EncodeAuxPlanes(pblczero::NetworkFormat::InputFormat input_format,
+                     const Position& position, Planes* planes) {
+  Planes& result = *planes;
+  const ChessBoard& board = position.GetBoard();
+  const bool we_are_black = board.flipped();
+  switch (input_format) {
+    case pblczero::NetworkFormat::INPUT_CLASSICAL_112_PLANE: {
+      // "Legacy" input planes with:
+      // - Plane 104 (0-based) filled with 1 if we can castle queenside.
+      // - Plane 105 filled with ones if we can castle kingside.
+      // - Plane 106 filled with ones if they can castle queenside.
+      // - Plane 107 filled with ones if they can castle kingside.
+      if (board.castlings().we_can_000()) result[kAuxPlaneBase + 0].SetAll();
+      if (board.castlings().we_can_00()) result[kAuxPlaneBase + 1].SetAll();
+      if (board.castlings().they_can_000()) {
+        result[kAuxPlaneBase + 2].SetAll();
       }
-      default:
-        throw Exception("Unsupported input plane encoding " +
-                        std::to_string(input_format));
-    };
-    if (IsCanonicalFormat(input_format)) {
-      result[kAuxPlaneBase + 4].mask = board.en_passant().as_int();
-    } else {
-      if (we_are_black) result[kAuxPlaneBase + 4].SetAll();
-    }
-    if (IsHectopliesFormat(input_format)) {
-      result[kAuxPlaneBase + 5].Fill(history.Last().GetRule50Ply() / 100.0f);
-    } else {
-      result[kAuxPlaneBase + 5].Fill(history.Last().GetRule50Ply());
-    }
-    // Plane kAuxPlaneBase + 6 used to be movecount plane, now it's all zeros
-    // unless we need it for canonical armageddon side to move.
-    if (IsCanonicalArmageddonFormat(input_format)) {
-      if (we_are_black) result[kAuxPlaneBase + 6].SetAll();
+      if (board.castlings().they_can_00()) result[kAuxPlaneBase + 3].SetAll();
+      break;
     }
-    // Plane kAuxPlaneBase + 7 is all ones to help NN find board edges.
-    result[kAuxPlaneBase + 7].SetAll();
-    if (stop_early) {
-      castlings = board.castlings();
+
+    case pblczero::NetworkFormat::INPUT_112_WITH_CASTLING_PLANE:
+    case pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION:
+    case pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION_HECTOPLIES:
+    case pblczero::NetworkFormat::
+        INPUT_112_WITH_CANONICALIZATION_HECTOPLIES_ARMAGEDDON:
+    case pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION_V2:
+    case pblczero::NetworkFormat::
+        INPUT_112_WITH_CANONICALIZATION_V2_ARMAGEDDON: {
+      // - Plane 104 for positions of rooks (both white and black) which
+      // have
+      // a-side (queenside) castling right.
+      // - Plane 105 for positions of rooks (both white and black) which have
+      // h-side (kingside) castling right.
+      const auto& cast = board.castlings();
+      result[kAuxPlaneBase + 0].mask =
+          (cast.we_can_000()
+               ? BoardSquare(ChessBoard::A1 + cast.our_queenside_rook())
+                     .as_board()
+               : 0) |
+          (cast.they_can_000()
+               ? BoardSquare(ChessBoard::A8 + cast.their_queenside_rook())
+                     .as_board()
+               : 0);
+      result[kAuxPlaneBase + 1].mask =
+          (cast.we_can_00()
+               ? BoardSquare(ChessBoard::A1 + cast.our_kingside_rook())
+                     .as_board()
+               : 0) |
+          (cast.they_can_00()
+               ? BoardSquare(ChessBoard::A8 + cast.their_kingside_rook())
+                     .as_board()
+               : 0);
+      break;
     }
+    default:
+      throw Exception("Unsupported input plane encoding " +
+                      std::to_string(input_format));
+  };
+  if (IsCanonicalFormat(input_format)) {
+    result[kAuxPlaneBase + 4].mask = board.en_passant().as_int();
+  } else {
+    if (we_are_black) result[kAuxPlaneBase + 4].SetAll();
+  }
+  if (IsHectopliesFormat(input_format)) {
+    result[kAuxPlaneBase + 5].Fill(position.GetRule50Ply() / 100.0f);
+  } else {
+    result[kAuxPlaneBase + 5].Fill(position.GetRule50Ply());
   }
-  bool skip_non_repeats =
+  // Plane kAuxPlaneBase + 6 used to be movecount plane, now it's all zeros
+  // unless we need it for canonical armageddon side to move.
+  if (IsCanonicalArmageddonFormat(input_format)) {
+    if (we_are_black) result[kAuxPlaneBase + 6].SetAll();
+  }
+  // Plane kAuxPlaneBase + 7 is all ones to help NN find board edges.
+  result[kAuxPlaneBase + 7].SetAll();
+}
+
+// Encodes the boards of @history from @history_idx backwards into the plane
+// blocks from @i on, as the history of the position at @current_idx. Stops
+// where the history ends or stops being relevant for @input_format. Changes
+// of castling rights also stop it when @castlings, the rights of the encoded
+// position, are given. Otherwise the rights of the boards up to each written
+// block go to @block_castlings, to decide later. Returns the index of the
+// block after the last one written.
+int EncodeHistoryBoards(pblczero::NetworkFormat::InputFormat input_format,
+                        const PositionHistory& history, int current_idx,
+                        int history_idx, int i, bool flip, int history_planes,
+                        FillEmptyHistory fill_empty_history,
+                        const int* castlings, int* block_castlings,
+                        InputPlanes* planes) {
+  InputPlanes& result = *planes;
+  // Canonicalization format needs to stop early to avoid applying transform in
+  // history across incompatible transitions.  It is also more canonical since
+  // history before these points is not relevant to the final result.
+  const bool stop_early = IsCanonicalFormat(input_format);
+  const bool skip_non_repeats =
       input_format ==
           pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION_V2 ||
       input_format == pblczero::NetworkFormat::
                           INPUT_112_WITH_CANONICALIZATION_V2_ARMAGEDDON;
-  bool flip = false;
-  int history_idx = history.GetLength() - 1;
-  for (int i = 0; i < std::min(history_planes, kMoveHistory);
-       ++i, --history_idx) {
+  int seen_castlings = kMixedCastlings - 1;
+  for (; i < std::min(history_planes, kMoveHistory); ++i, --history_idx) {
     const Position& position =
         history.GetPositionAt(history_idx < 0 ? 0 : history_idx);
     const ChessBoard& board =
         flip ? position.GetThemBoard() : position.GetBoard();
     // Castling changes can't be repeated, so we can stop early.
-    if (stop_early && board.castlings().as_int() != castlings.as_int()) break;
+    if (stop_early && castlings) {
+      if (board.castlings().as_int() != *castlings) break;
+    } else if (stop_early) {
+      const int board_castlings = board.castlings().as_int();
+      seen_castlings = seen_castlings == kMixedCastlings - 1 ||
+                               seen_castlings == board_castlings
+                           ? board_castlings
+                           : kMixedCastlings;
+    }
     // Enpassants can't be repeated, but we do need to always send the current
     // position.
-    if (stop_early && history_idx != history.GetLength() - 1 &&
+    if (stop_early && history_idx != current_idx &&
         !board.en_passant().empty()) {
       break;
     }
@@ -288,6 +298,7 @@ InputPlanes EncodePositionForNN(
     result[base + 11].mask = (board.theirs() & board.kings()).as_int();
 
     if (repetitions >= 1) result[base + 12].SetAll();
+    if (block_castlings) block_castlings[i] = seen_castlings;
 
     // If en passant flag is set, undo last pawn move by removing the pawn from
     // the new square and putting into pre-move square.
@@ -304,27 +315,156 @@ InputPlanes EncodePositionForNN(
     if (history_idx > 0) flip = !flip;
     // If no capture no pawn is 0, the previous was start of game, capture or
     // pawn push, so no need to go back further if stopping early.
-    if (stop_early && position.GetRule50Ply() == 0) break;
+    if (stop_early && position.GetRule50Ply() == 0) {
+      ++i;
+      break;
+    }
   }
-  if (transform != NoTransform) {
-    // Transform all masks.
-    for (int i = 0; i <= kAuxPlaneBase + 4; i++) {
-      auto v = result[i].mask;
-      if (v == 0 || v == ~0ULL) continue;
-      if ((transform & FlipTransform) != 0) {
-        v = ReverseBitsInBytes(v);
-      }
-      if ((transform & MirrorTransform) != 0) {
-        v = ReverseBytesInBytes(v);
-      }
-      if ((transform & TransposeTransform) != 0) {
-        v = TransposeBitsInBytes(v);
+  return i;
+}
+
+template <int kTransform, typename Planes>
+void ApplyTransform(Planes* planes) {
+  // Most planes are empty, which is cheaper to skip than to transform.
+  for (int i = 0; i <= kAuxPlaneBase + 4; i++) {
+    const auto v = (*planes)[i].mask;
+    if (v == 0 || v == ~0ULL) continue;
+    (*planes)[i].mask = TransformBits(v, kTransform);
+  }
+}
+
+// Dispatches to a loop for each transform, so that the transform isn't
+// decoded again for each plane.
+template <typename Planes>
+void ApplyTransform(int transform, Planes* planes) {
+  switch (transform) {
+    case NoTransform:
+      return;
+    case FlipTransform:
+      return ApplyTransform<FlipTransform>(planes);
+    case MirrorTransform:
+      return ApplyTransform<MirrorTransform>(planes);
+    case FlipTransform | MirrorTransform:
+      return ApplyTransform<FlipTransform | MirrorTransform>(planes);
+    case TransposeTransform:
+      return ApplyTransform<TransposeTransform>(planes);
+    case FlipTransform | TransposeTransform:
+      return ApplyTransform<FlipTransform | TransposeTransform>(planes);
+    case MirrorTransform | TransposeTransform:
+      return ApplyTransform<MirrorTransform | TransposeTransform>(planes);
+    default:
+      return ApplyTransform<FlipTransform | MirrorTransform |
+                            TransposeTransform>(planes);
+  }
+}
+
+}  // namespace
+
+int TransformForPosition(pblczero::NetworkFormat::InputFormat input_format,
+                         const PositionHistory& history) {
+  if (!IsCanonicalFormat(input_format)) {
+    return 0;
+  }
+  const ChessBoard& board = history.Last().GetBoard();
+  return ChooseTransform(board);
+}
+
+InputPlanes EncodePositionForNN(
+    pblczero::NetworkFormat::InputFormat input_format,
+    const PositionHistory& history, int history_planes,
+    FillEmptyHistory fill_empty_history, int* transform_out) {
+  InputPlanes result(kAuxPlaneBase + 8);
+  const Position& position = history.Last();
+  const int transform = TransformForPosition(input_format, history);
+  EncodeAuxPlanes(input_format, position, &result);
+  const int castlings = position.GetBoard().castlings().as_int();
+  const int current_idx = history.GetLength() - 1;
+  EncodeHistoryBoards(input_format, history, current_idx, current_idx, 0,
+                      false, history_planes, fill_empty_history, &castlings,
+                      nullptr, &result);
+  ApplyTransform(transform, &result);
+  if (transform_out) *transform_out = transform;
+  return result;
+}
+
+ParentHistoryPlanes EncodeParentHistory(
+    pblczero::NetworkFormat::InputFormat input_format,
+    const PositionHistory& history, int history_planes,
+    FillEmptyHistory fill_empty_history) {
+  ParentHistoryPlanes parent;
+  parent.input_format = input_format;
+  parent.history_planes = history_planes;
+  parent.planes.resize(kAuxPlaneBase);
+  const int current_idx = history.GetLength() - 1;
+  // Block 0 is the encoded position itself, after which the history is seen
+  // from the other side, unless the history is only made up by repeating it.
+  parent.end_block = EncodeHistoryBoards(
+      input_format, history, current_idx, current_idx - 1, 1, current_idx > 0,
+      history_planes, fill_empty_history, nullptr, parent.castlings.data(),
+      &parent.planes);
+  return parent;
+}
+
+namespace {
+
+template <typename Planes>
+int EncodeChildPlanes(const ParentHistoryPlanes& parent, const Position& child,
+                      Planes* planes) {
+  Planes& result = *planes;
+  const auto input_format = parent.input_format;
+  const ChessBoard& board = child.GetBoard();
+  const int transform =
+      IsCanonicalFormat(input_format) ? ChooseTransform(board) : 0;
+  EncodeAuxPlanes(input_format, child, &result);
+  if (parent.history_planes > 0) {
+    const int repetitions = child.GetRepetitions();
+    result[0].mask = (board.ours() & board.pawns()).as_int();
+    result[1].mask = (board.ours() & board.knights()).as_int();
+    result[2].mask = (board.ours() & board.bishops()).as_int();
+    result[3].mask = (board.ours() & board.rooks()).as_int();
+    result[4].mask = (board.ours() & board.queens()).as_int();
+    result[5].mask = (board.ours() & board.kings()).as_int();
+    result[6].mask = (board.theirs() & board.pawns()).as_int();
+    result[7].mask = (board.theirs() & board.knights()).as_int();
+    result[8].mask = (board.theirs() & board.bishops()).as_int();
+    result[9].mask = (board.theirs() & board.rooks()).as_int();
+    result[10].mask = (board.theirs() & board.queens()).as_int();
+    result[11].mask = (board.theirs() & board.kings()).as_int();
+    if (repetitions >= 1) result[12].SetAll();
+
+    const bool stop_early = IsCanonicalFormat(input_format);
+    // Zeroing moves cut the history of canonical formats.
+    const int end_block =
+        stop_early && child.GetRule50Ply() == 0 ? 1 : parent.end_block;
+    const int castlings = board.castlings().as_int();
+    for (int i = 1; i < end_block; i++) {
+      if (stop_early && parent.castlings[i] != castlings) break;
+      for (int j = i * kPlanesPerBoard; j < (i + 1) * kPlanesPerBoard; j++) {
+        result[j].mask = parent.planes[j].mask;
+        result[j].value = parent.planes[j].value;
       }
-      result[i].mask = v;
     }
   }
+  ApplyTransform(transform, &result);
+  return transform;
+}
+
+}  // namespace
+
+InputPlanes EncodeChildPositionForNN(const ParentHistoryPlanes& parent,
+                                     const Position& child,
+                                     int* transform_out) {
+  InputPlanes result(kAuxPlaneBase + 8);
+  const int transform = EncodeChildPlanes(parent, child, &result);
   if (transform_out) *transform_out = transform;
   return result;
 }
 
+void EncodeChildPositionForNN(const ParentHistoryPlanes& parent,
+                              const Position& child,
+                              const InputBuffers& buffers) {
+  InputBufferPlanes result(buffers);
+  EncodeChildPlanes(parent, child, &result);
+}
+
 }  // namespace lczero
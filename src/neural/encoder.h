@@ -27,6 +27,8 @@
 
 #pragma once
 
+#include <array>
+
 #include "chess/position.h"
 #include "neural/network.h"
 #include "proto/net.pb.h"
@@ -49,6 +51,37 @@ InputPlanes EncodePositionForNN(
     const PositionHistory& history, int history_planes,
     FillEmptyHistory fill_empty_history, int* transform_out);
 
+// History planes shared by the encodings of positions reached by one move
+// from the same position, computed once for all of them.
+struct ParentHistoryPlanes {
+  pblczero::NetworkFormat::InputFormat input_format;
+  int history_planes = 0;
+  // Planes of the history blocks, untransformed. Block 0 stays empty.
+  InputPlanes planes;
+  // Castling rights seen by the encoding up to each block, to cut the history
+  // of canonical formats.
+  std::array<int, kMoveHistory> castlings{};
+  // Index of the block after the last one encoded.
+  int end_block = 1;
+};
+
+// Encodes the history of the last position in history, for it and any other
+// position reached by one move from the same position.
+ParentHistoryPlanes EncodeParentHistory(
+    pblczero::NetworkFormat::InputFormat input_format,
+    const PositionHistory& history, int history_planes,
+    FillEmptyHistory fill_empty_history);
+
+// Same as EncodePositionForNN for a position with the history given by
+// @parent, only encoding the position itself.
+InputPlanes EncodeChildPositionForNN(const ParentHistoryPlanes& parent,
+                                     const Position& child,
+                                     int* transform_out);
+// Same, encoding the planes in place into the input buffers of a backend.
+void EncodeChildPositionForNN(const ParentHistoryPlanes& parent,
+                              const Position& child,
+                              const InputBuffers& buffers);
+
 bool IsCanonicalFormat(pblczero::NetworkFormat::InputFormat input_format);
 bool IsCanonicalArmageddonFormat(
     pblczero::NetworkFormat::InputFormat input_format);
@@ -20,6 +20,9 @@
 
 #include <gtest/gtest.h>
 
+#include <string>
+#include <vector>
+
 namespace lczero {
 
 auto kAllSquaresMask = std::numeric_limits<std::uint64_t>::max();
@@ -531,6 +534,100 @@ TEST(EncodePositionForNN, EncodeEarlyGameFlipFormat3) {
   EXPECT_EQ(their_king_plane.value, 1.0f);
 }
 
+namespace {
+
+void ExpectSamePlanes(const InputPlanes& expected, const InputPlanes& actual) {
+  ASSERT_EQ(expected.size(), actual.size());
+  for (size_t i = 0; i < expected.size(); i++) {
+    EXPECT_EQ(expected[i].mask, actual[i].mask) << "plane " << i;
+    EXPECT_EQ(expected[i].value, actual[i].value) << "plane " << i;
+  }
+}
+
+// Checks that encoding the last position of @history from the history planes
+// of its parent matches the full encoding.
+void CheckEncodingFromParent(const PositionHistory& history) {
+  const pblczero::NetworkFormat::InputFormat kFormats[] = {
+      pblczero::NetworkFormat::INPUT_CLASSICAL_112_PLANE,
+      pblczero::NetworkFormat::INPUT_112_WITH_CASTLING_PLANE,
+      pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION,
+      pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION_HECTOPLIES,
+      pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION_V2,
+      pblczero::NetworkFormat::INPUT_112_WITH_CANONICALIZATION_V2_ARMAGEDDON,
+  };
+  const FillEmptyHistory kFills[] = {FillEmptyHistory::NO,
+                                     FillEmptyHistory::FEN_ONLY,
+                                     FillEmptyHistory::ALWAYS};
+  for (const auto format : kFormats) {
+    for (const auto fill : kFills) {
+      for (const int history_planes : {1, 8}) {
+        SCOPED_TRACE(testing::Message()
+                     << "format " << format << " fill "
+                     << static_cast<int>(fill) << " planes " << history_planes
+                     << " ply " << history.GetLength());
+        int expected_transform;
+        const InputPlanes expected = EncodePositionForNN(
+            format, history, history_planes, fill, &expected_transform);
+        const ParentHistoryPlanes parent =
+            EncodeParentHistory(format, history, history_planes, fill);
+        int transform;
+        const InputPlanes actual =
+            EncodeChildPositionForNN(parent, history.Last(), &transform);
+        EXPECT_EQ(expected_transform, transform);
+        ExpectSamePlanes(expected, actual);
+
+        // Buffers start dirty, as backends reuse them.
+        std::vector<uint64_t> masks(kInputPlanes, 0x1234);
+        std::vector<float> values(kInputPlanes, 0.5f);
+        EncodeChildPositionForNN(parent, history.Last(),
+                                 InputBuffers{masks.data(), values.data()});
+        for (int i = 0; i < kInputPlanes; i++) {
+          EXPECT_EQ(expected[i].mask, masks[i]) << "plane " << i;
+          EXPECT_EQ(expected[i].value, values[i]) << "plane " << i;
+        }
+      }
+    }
+  }
+}
+
+// Checks encodings from the parent for every child of the last position of
+// @parent_history.
+void CheckChildEncodings(const PositionHistory& parent_history) {
+  PositionHistory history = parent_history;
+  for (const Move move : history.Last().GetBoard().GenerateLegalMoves()) {
+    history.Append(move);
+    CheckEncodingFromParent(history);
+    history.Pop();
+  }
+}
+
+void CheckGame(const std::string& fen, const std::vector<std::string>& moves) {
+  ChessBoard board;
+  int rule50_ply;
+  int game_move;
+  board.SetFromFen(fen, &rule50_ply, &game_move);
+  PositionHistory history;
+  history.Reset(board, rule50_ply, game_move * 2);
+  CheckEncodingFromParent(history);
+  CheckChildEncodings(history);
+  for (const auto& uci : moves) {
+    history.Append(Move(uci, history.IsBlackToMove()));
+    CheckChildEncodings(history);
+  }
+}
+
+}  // namespace
+
+TEST(EncodePositionForNN, ChildEncodingMatchesFullEncoding) {
+  // Repetitions, then castling.
+  CheckGame(ChessBoard::kStartposFen,
+            {"g1f3", "g8f6", "f3g1", "f6g8", "g1f3", "g8f6", "e2e4", "e7e5",
+             "f1c4", "f8c5", "e1h1", "e8h8", "f1e1", "f8e8", "e1f1", "e8f8"});
+  // En passant and castling rights lost by king moves.
+  CheckGame("r3k2r/pppp1ppp/8/4p3/8/8/PPPPPPPP/R3K2R w KQkq e6 0 5",
+            {"d2d4", "e5e4", "f2f4", "e4f3", "e1d1", "e8d8", "d1e1", "d8e8"});
+}
+
 }  // namespace lczero
 
 int main(int argc, char** argv) {
@@ -79,9 +79,12 @@ void NetworkFactory::RegisterNetwork(const std::string& name,
   std::sort(factories_.begin(), factories_.end());
 }
 
-std::vector<std::string> NetworkFactory::GetBackendsList() const {
+std::vector<std::string> NetworkFactory::GetBackendsList(
+    int min_priority) const {
   std::vector<std::string> result;
-  for (const auto& x : factories_) result.emplace_back(x.name);
+  for (const auto& x : factories_) {
+    if (x.priority >= min_priority) result.emplace_back(x.name);
+  }
   return result;
 }
 
@@ -136,4 +139,11 @@ std::unique_ptr<Network> NetworkFactory::LoadNetwork(
   return ptr;
 }
 
+std::string NetworkFactory::GetWeightsFilename(const OptionsDict& options) {
+  const std::string net_path = options.Get<std::string>(kWeightsId);
+  if (net_path == kAutoDiscover) return DiscoverWeightsFile();
+  if (net_path == kEmbed) return CommandLine::BinaryName();
+  return net_path;
+}
+
 }  // namespace lczero
@@ -28,6 +28,7 @@
 #pragma once
 
 #include <functional>
+#include <limits>
 #include <optional>
 #include <string>
 
@@ -59,7 +60,9 @@ class NetworkFactory {
   static void PopulateOptions(OptionsParser* options);
 
   // Returns list of backend names, sorted by priority (higher priority first).
-  std::vector<std::string> GetBackendsList() const;
+  // Only backends of at least @min_priority are listed.
+  std::vector<std::string> GetBackendsList(
+      int min_priority = std::numeric_limits<int>::min()) const;
 
   // Creates a backend given name and config.
   std::unique_ptr<Network> Create(const std::string& network,
@@ -69,6 +72,9 @@ class NetworkFactory {
   // Helper function to load the network from the options. Returns nullptr
   // if no network options changed since the previous call.
   static std::unique_ptr<Network> LoadNetwork(const OptionsDict& options);
+  // Returns the weights file LoadNetwork() loads with @options, with the
+  // autodiscover and embed special values resolved.
+  static std::string GetWeightsFilename(const OptionsDict& options);
 
   // Parameter IDs.
   static const OptionId kWeightsId;
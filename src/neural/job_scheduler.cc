@@ -0,0 +1,137 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "neural/job_scheduler.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace lczero {
+
+JobScheduler::JobScheduler(int slots, double half_life)
+    : slots_(slots), half_life_(half_life), free_slots_(slots) {}
+
+int JobScheduler::AddJob(const std::string& name, int priority, float quota) {
+  Mutex::Lock lock(mutex_);
+  for (size_t i = 0; i < jobs_.size(); i++) {
+    if (jobs_[i].name != name) continue;
+    jobs_[i].priority = priority;
+    jobs_[i].quota = quota;
+    return i;
+  }
+  jobs_.push_back({name, priority, quota});
+  return jobs_.size() - 1;
+}
+
+JobScheduler::Slot JobScheduler::Acquire(int job, int samples) {
+  Mutex::Lock lock(mutex_);
+  if (slots_ <= 0) {
+    Account(job, samples);
+    return Slot();
+  }
+  Waiter waiter{job, samples, next_ticket_++};
+  waiting_.push_back(&waiter);
+  GrantSlots();
+  cv_.wait(lock.get_raw(), [&waiter]() { return waiter.granted; });
+  return Slot(this);
+}
+
+void JobScheduler::Release() {
+  Mutex::Lock lock(mutex_);
+  free_slots_++;
+  GrantSlots();
+}
+
+void JobScheduler::GrantSlots() {
+  bool granted = false;
+  while (free_slots_ > 0 && !waiting_.empty()) {
+    auto first = waiting_.begin();
+    for (auto iter = waiting_.begin(); iter != waiting_.end(); ++iter) {
+      if (GoesFirst(**iter, **first)) first = iter;
+    }
+    Waiter* waiter = *first;
+    waiting_.erase(first);
+    free_slots_--;
+    Account(waiter->job, waiter->samples);
+    waiter->granted = true;
+    granted = true;
+  }
+  if (granted) cv_.notify_all();
+}
+
+bool JobScheduler::GoesFirst(const Waiter& a, const Waiter& b) const {
+  const double deficit_a = QuotaDeficit(a.job);
+  const double deficit_b = QuotaDeficit(b.job);
+  if (deficit_a > 0 || deficit_b > 0) {
+    if (deficit_a != deficit_b) return deficit_a > deficit_b;
+  }
+  const int priority_a = jobs_[a.job].priority;
+  const int priority_b = jobs_[b.job].priority;
+  if (priority_a != priority_b) return priority_a > priority_b;
+  return a.ticket < b.ticket;
+}
+
+double JobScheduler::QuotaDeficit(int job) const {
+  const float quota = jobs_[job].quota;
+  if (quota <= 0.0f) return -1.0;
+  const double share =
+      total_recent_ > 0.0 ? jobs_[job].recent / total_recent_ : 0.0;
+  // Relative to the quota, so that small quotas count as much as large ones.
+  return (quota - share) / quota;
+}
+
+void JobScheduler::Account(int job, int samples) {
+  const double decay = std::exp2(-samples / half_life_);
+  total_recent_ = 0.0;
+  for (auto& other : jobs_) {
+    other.recent *= decay;
+    total_recent_ += other.recent;
+  }
+  jobs_[job].recent += samples;
+  total_recent_ += samples;
+  jobs_[job].batches++;
+  jobs_[job].samples += samples;
+}
+
+std::vector<JobScheduler::JobStats> JobScheduler::GetStats() const {
+  Mutex::Lock lock(mutex_);
+  std::vector<JobStats> stats;
+  for (const auto& job : jobs_) {
+    const double share =
+        total_recent_ > 0.0 ? job.recent / total_recent_ : 0.0;
+    stats.push_back({job.name, job.priority, job.quota,
+                     static_cast<float>(share), job.batches, job.samples});
+  }
+  return stats;
+}
+
+int JobScheduler::GetWaiting() const {
+  Mutex::Lock lock(mutex_);
+  return waiting_.size();
+}
+
+}  // namespace lczero
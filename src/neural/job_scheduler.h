@@ -0,0 +1,131 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "utils/mutex.h"
+
+namespace lczero {
+
+// Shares a backend between jobs, e.g. the selfplay, rescoring and analysis
+// processes served by one inference server, by letting at most a number of
+// their batches compute at the same time. A free slot goes to the waiting
+// batch which comes first by:
+// * the jobs which got less than their quota, a guaranteed share of the
+//   recently computed samples, go first, furthest below the quota first;
+// * then the jobs with higher priority;
+// * then the batch which waited longest.
+// The recent samples of a job decay by half over every half_life samples
+// computed by all jobs.
+class JobScheduler {
+ public:
+  // Without @slots (0), batches never wait and are only counted.
+  explicit JobScheduler(int slots, double half_life = 100000.0);
+
+  // Returns the id of the job named @name, adding it if there is none yet.
+  // The priority and quota of an existing job are updated.
+  int AddJob(const std::string& name, int priority, float quota);
+
+  // A slot taken for one batch, given back on destruction.
+  class Slot {
+   public:
+    Slot() = default;
+    explicit Slot(JobScheduler* scheduler) : scheduler_(scheduler) {}
+    ~Slot() {
+      if (scheduler_) scheduler_->Release();
+    }
+    Slot(Slot&& other) : scheduler_(other.scheduler_) {
+      other.scheduler_ = nullptr;
+    }
+    Slot(const Slot&) = delete;
+    Slot& operator=(const Slot&) = delete;
+    Slot& operator=(Slot&&) = delete;
+
+   private:
+    JobScheduler* scheduler_ = nullptr;
+  };
+  // Waits until the batch of @samples samples of job @job may compute.
+  [[nodiscard]] Slot Acquire(int job, int samples);
+
+  struct JobStats {
+    std::string name;
+    int priority;
+    float quota;
+    // Share of the recently computed samples.
+    float share;
+    uint64_t batches;
+    uint64_t samples;
+  };
+  std::vector<JobStats> GetStats() const;
+  // Number of batches waiting for a slot.
+  int GetWaiting() const;
+
+ private:
+  struct Job {
+    std::string name;
+    int priority;
+    float quota;
+    // Decaying count of the samples computed.
+    double recent = 0.0;
+    uint64_t batches = 0;
+    uint64_t samples = 0;
+  };
+  struct Waiter {
+    int job;
+    int samples;
+    uint64_t ticket;
+    bool granted = false;
+  };
+
+  void Release();
+  // Gives the free slots to the waiters which go first.
+  void GrantSlots() REQUIRES(mutex_);
+  // Whether waiter @a goes before waiter @b.
+  bool GoesFirst(const Waiter& a, const Waiter& b) const REQUIRES(mutex_);
+  // How far job @job is below its quota, negative if it isn't.
+  double QuotaDeficit(int job) const REQUIRES(mutex_);
+  // Counts a batch of job @job as computed.
+  void Account(int job, int samples) REQUIRES(mutex_);
+
+  const int slots_;
+  const double half_life_;
+  mutable Mutex mutex_{"JobScheduler::mutex_"};
+  std::condition_variable cv_;
+  std::vector<Job> jobs_ GUARDED_BY(mutex_);
+  std::vector<Waiter*> waiting_ GUARDED_BY(mutex_);
+  int free_slots_ GUARDED_BY(mutex_);
+  uint64_t next_ticket_ GUARDED_BY(mutex_) = 0;
+  // Sum of the recent samples of all jobs.
+  double total_recent_ GUARDED_BY(mutex_) = 0.0;
+};
+
+}  // namespace lczero
@@ -0,0 +1,121 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "neural/job_scheduler.h"
+
+#include <gtest/gtest.h>
+
+#include <mutex>
+#include <thread>
+
+namespace lczero {
+namespace {
+
+// Queues a batch of @samples samples for each of @jobs in order, while the
+// only slot is taken, then frees the slot and returns the order in which the
+// batches got it.
+std::vector<int> GrantOrder(JobScheduler* scheduler, int holder,
+                            const std::vector<int>& jobs, int samples = 1) {
+  std::vector<int> order;
+  std::mutex order_mutex;
+  std::vector<std::thread> threads;
+  {
+    auto slot = scheduler->Acquire(holder, samples);
+    for (size_t i = 0; i < jobs.size(); i++) {
+      threads.emplace_back([&, i]() {
+        auto slot = scheduler->Acquire(jobs[i], samples);
+        std::lock_guard<std::mutex> lock(order_mutex);
+        order.push_back(i);
+      });
+      while (scheduler->GetWaiting() < static_cast<int>(i + 1)) {
+        std::this_thread::yield();
+      }
+    }
+  }
+  for (auto& thread : threads) thread.join();
+  return order;
+}
+
+// Computes @batches batches of @samples samples of job @job, one at a time.
+void Compute(JobScheduler* scheduler, int job, int batches, int samples) {
+  for (int i = 0; i < batches; i++) {
+    auto slot = scheduler->Acquire(job, samples);
+  }
+}
+
+}  // namespace
+
+TEST(JobScheduler, HigherPriorityGoesFirst) {
+  JobScheduler scheduler(1);
+  const int low = scheduler.AddJob("low", 0, 0.0f);
+  const int high = scheduler.AddJob("high", 5, 0.0f);
+  EXPECT_EQ(GrantOrder(&scheduler, low, {low, low, high, low}),
+            (std::vector<int>{2, 0, 1, 3}));
+}
+
+TEST(JobScheduler, SameNameIsSameJob) {
+  JobScheduler scheduler(1);
+  const int job = scheduler.AddJob("selfplay", 0, 0.0f);
+  EXPECT_EQ(scheduler.AddJob("rescore", 0, 0.0f), job + 1);
+  EXPECT_EQ(scheduler.AddJob("selfplay", 3, 0.5f), job);
+  const auto stats = scheduler.GetStats();
+  ASSERT_EQ(stats.size(), 2u);
+  EXPECT_EQ(stats[job].priority, 3);
+  EXPECT_FLOAT_EQ(stats[job].quota, 0.5f);
+}
+
+TEST(JobScheduler, JobBelowQuotaGoesFirst) {
+  JobScheduler scheduler(1);
+  const int analysis = scheduler.AddJob("analysis", 10, 0.0f);
+  const int selfplay = scheduler.AddJob("selfplay", 0, 0.25f);
+  Compute(&scheduler, analysis, 10, 100);
+  EXPECT_EQ(GrantOrder(&scheduler, analysis, {analysis, selfplay}, 100),
+            (std::vector<int>{1, 0}));
+  // Above its quota, the selfplay job waits for the higher priority one.
+  Compute(&scheduler, selfplay, 10, 100);
+  EXPECT_EQ(GrantOrder(&scheduler, analysis, {selfplay, analysis}, 100),
+            (std::vector<int>{1, 0}));
+}
+
+TEST(JobScheduler, WithoutSlotsBatchesAreOnlyCounted) {
+  JobScheduler scheduler(0);
+  const int job = scheduler.AddJob("job", 0, 0.0f);
+  auto slot1 = scheduler.Acquire(job, 10);
+  auto slot2 = scheduler.Acquire(job, 20);
+  const auto stats = scheduler.GetStats();
+  ASSERT_EQ(stats.size(), 1u);
+  EXPECT_EQ(stats[0].batches, 2u);
+  EXPECT_EQ(stats[0].samples, 30u);
+  EXPECT_FLOAT_EQ(stats[0].share, 1.0f);
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -36,6 +36,7 @@
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <string_view>
 
 #include "proto/net.pb.h"
 #include "utils/commandline.h"
@@ -142,7 +143,19 @@ void FixOlderWeightsFile(WeightsFile* file) {
   }
 }
 
-WeightsFile ParseWeightsProto(const std::string& buffer) {
+// Whether the file starts with the gzip magic. Unreadable files are reported
+// as compressed so that the gzip path produces the error.
+bool IsGzipFile(const std::string& filename) {
+  FILE* fp = fopen(filename.c_str(), "rb");
+  if (!fp) return true;
+  unsigned char magic[2] = {};
+  const bool is_gzip = fread(magic, 1, 2, fp) == 2 && magic[0] == 0x1f &&
+                       magic[1] == 0x8b;
+  fclose(fp);
+  return is_gzip;
+}
+
+WeightsFile ParseWeightsProto(std::string_view buffer) {
   WeightsFile net;
   net.ParseFromString(buffer);
 
@@ -174,12 +187,7 @@ WeightsFile ParseWeightsProto(const std::string& buffer) {
   return net;
 }
 
-}  // namespace
-
-WeightsFile LoadWeightsFromFile(const std::string& filename) {
-  FloatVectors vecs;
-  auto buffer = DecompressGzip(filename);
-
+WeightsFile ParseWeightsBuffer(std::string_view buffer) {
   if (buffer.size() < 2) {
     throw Exception("Invalid weight file: too small.");
   }
@@ -195,6 +203,18 @@ WeightsFile LoadWeightsFromFile(const std::string& filename) {
   return ParseWeightsProto(buffer);
 }
 
+}  // namespace
+
+WeightsFile LoadWeightsFromFile(const std::string& filename) {
+  if (filename != CommandLine::BinaryName() && !IsGzipFile(filename)) {
+    // Uncompressed nets are parsed straight from the mapped pages, without
+    // an intermediate copy of the whole file.
+    const MappedFile file(filename);
+    return ParseWeightsBuffer({file.data(), file.size()});
+  }
+  return ParseWeightsBuffer(DecompressGzip(filename));
+}
+
 std::string DiscoverWeightsFile() {
   const int kMinFileSize = 500000;  // 500 KB
 
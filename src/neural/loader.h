@@ -40,7 +40,8 @@ using FloatVectors = std::vector<FloatVector>;
 
 using WeightsFile = pblczero::Net;
 
-// Read weights file and fill the weights structure.
+// Read weights file and fill the weights structure. Uncompressed files are
+// memory mapped instead of read.
 WeightsFile LoadWeightsFromFile(const std::string& filename);
 
 // Tries to find a file which looks like a weights file, and located in
@@ -25,6 +25,10 @@
   Program grant you additional permission to convey the resulting work.
 */
 #pragma once
+#include <unistd.h>
+
+#include <cstdlib>
+#include <new>
 #include <vector>
 
 namespace lczero {
@@ -33,12 +37,34 @@ namespace metal_backend {
 static int kNumOutputPolicy = 1858;
 static int kInputPlanes = 112;
 
+// Sub-batches are padded up to a bucket size so that the compiled graph for
+// the bucket can be reused. Buffers have room for the padding of the last
+// sub-batch.
+static int kMaxBatchPadding = 32;
+
+inline int BatchBucket(int batch_size) {
+  if (batch_size <= 64) return (batch_size + 7) / 8 * 8;
+  return (batch_size + kMaxBatchPadding - 1) / kMaxBatchPadding *
+         kMaxBatchPadding;
+}
+
 struct InputsOutputs {
   InputsOutputs(int maxBatchSize, bool wdl, bool moves_left, bool conv_policy,
                 bool attn_policy) {
     input_masks_mem_.reserve(maxBatchSize * kInputPlanes);
     input_val_mem_.reserve(maxBatchSize * kInputPlanes);
-    input_val_mem_expanded_.reserve(maxBatchSize * kInputPlanes * 64);
+    maxBatchSize += kMaxBatchPadding;
+
+    // Page aligned, so that the GPU can read it in place on unified memory.
+    const size_t page = getpagesize();
+    input_val_mem_expanded_size_ =
+        (maxBatchSize * kInputPlanes * 64 * sizeof(float) + page - 1) / page *
+        page;
+    if (posix_memalign(reinterpret_cast<void**>(&input_val_mem_expanded_),
+                       page, input_val_mem_expanded_size_) != 0) {
+      throw std::bad_alloc();
+    }
+
     op_policy_mem_.reserve(maxBatchSize * kNumOutputPolicy);
     op_value_mem_.reserve(maxBatchSize * (wdl ? 3 : 1));
 
@@ -58,11 +84,14 @@ struct InputsOutputs {
       op_policy_raw_mem_.reserve(maxBatchSize * 73 * 64);
     }
   }
-  ~InputsOutputs() {}
+  ~InputsOutputs() { free(input_val_mem_expanded_); }
+  InputsOutputs(const InputsOutputs&) = delete;
+  InputsOutputs& operator=(const InputsOutputs&) = delete;
 
   std::vector<uint64_t> input_masks_mem_;
   std::vector<float> input_val_mem_;
-  std::vector<float> input_val_mem_expanded_;
+  float* input_val_mem_expanded_;
+  size_t input_val_mem_expanded_size_;
   std::vector<float> op_policy_mem_;
   std::vector<float> op_value_mem_;
   std::vector<float> op_moves_left_mem_;
@@ -46,6 +46,7 @@ static MPSImageFeatureChannelFormat fcFormat = MPSImageFeatureChannelFormatFloat
   @public
     // Keep the device and command queue objects around for ease of use.
     MPSGraphDevice * _device;
+    id<MTLDevice> _mtlDevice;
     id<MTLCommandQueue> _queue;
 
     // Input tensor and tensor data placeholders.
@@ -54,11 +55,19 @@ static MPSImageFeatureChannelFormat fcFormat = MPSImageFeatureChannelFormatFloat
     // Variables to track results of graph inference.
     NSArray<MPSGraphTensor *> * _resultTensors;
     NSArray<MPSGraphTensor *> * _targetTensors;
-    NSMutableDictionary<NSNumber *, MPSGraphTensorDataDictionary *> * _resultDataDicts;
     NSMutableDictionary<NSString *, NSObject *> * _readVariables;
 
-    // Variables for triple buffering
-    dispatch_semaphore_t _doubleBufferingSemaphore;
+    // Graph compiled for each batch bucket, see BatchBucket().
+    NSMutableDictionary<NSNumber *, MPSGraphExecutable *> * _executables;
+
+    // Limits the number of command buffers in flight.
+    dispatch_semaphore_t _inflightSemaphore;
+
+    // Signalled by each command buffer with the value it was given, so that
+    // callers wait for their own sub-batches only.
+    id<MTLSharedEvent> _sharedEvent;
+    MTLSharedEventListener * _eventListener;
+    uint64_t _eventValue;
 
     // Global smolgen weights.
     float * __nullable _globalSmolgenWeights;
@@ -170,11 +179,16 @@ static MPSImageFeatureChannelFormat fcFormat = MPSImageFeatureChannelFormatFloat
                                                           inputs:(float * __nonnull)inputs
                                                          outputs:(float * __nonnull * __nonnull)outputBuffers;
 
--(nonnull MPSCommandBuffer *) runCommandSubBatchWithInputs:(float * __nonnull)inputs
-                                                  subBatch:(NSUInteger)subBatch
-                                              subBatchSize:(NSUInteger)subBatchSize;
+-(nonnull MPSGraphExecutable *) executableForBatchSize:(NSUInteger)batchSize;
+
+-(nonnull MPSGraphTensorData *) inputTensorDataWithInputs:(float * __nonnull)inputs
+                                                batchSize:(NSUInteger)batchSize;
+
+-(nonnull NSArray<MPSGraphTensorData *> *) runCommandSubBatchWithInputs:(float * __nonnull)inputs
+                                                           subBatchSize:(NSUInteger)subBatchSize;
 
--(void) copyResultsToBuffers:(float * __nonnull * __nonnull)outputBuffers
-                subBatchSize:(NSUInteger)subBatchSize;
+-(void) copyResults:(NSArray<NSArray<MPSGraphTensorData *> *> * __nonnull)results
+          toBuffers:(float * __nonnull * __nonnull)outputBuffers
+       subBatchSize:(NSUInteger)subBatchSize;
 
 @end
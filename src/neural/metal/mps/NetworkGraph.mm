@@ -27,6 +27,7 @@
 
 #import "neural/network_legacy.h"
 #import "NetworkGraph.h"
+#import "neural/metal/metal_common.h"
 #import <vector>
 
 static MPSGraphConvolution2DOpDescriptor * __nonnull convolution2DDescriptor = [MPSGraphConvolution2DOpDescriptor descriptorWithStrideInX:1
@@ -47,9 +48,12 @@ static MPSGraphPooling2DOpDescriptor * __nonnull averagePoolingDescriptor = [MPS
 
 static const NSUInteger kNumPolicyOutputs = 1858;
 
-// Maximum number of metal command buffers that can run simultaneously.
+// Maximum number of command buffers a batch is split into.
 static const NSUInteger kMaxInflightBuffers = 2;
 
+// Maximum number of command buffers in flight, across batches.
+static const NSUInteger kMaxInflightCommandBuffers = 4;
+
 // Minimum batch size below which parallel command buffers will not be used.
 static const NSInteger kMinSubBatchSize = 20;
 
@@ -126,11 +130,15 @@ static const NSInteger kMinSubBatchSize = 20;
 {
     self = [super init];
     _device = [MPSGraphDevice deviceWithMTLDevice:device];
+    _mtlDevice = device;
     _queue = [device newCommandQueue];
     _resultTensors = @[];
     _readVariables = [[NSMutableDictionary alloc] init];
-    _doubleBufferingSemaphore = dispatch_semaphore_create(kMaxInflightBuffers);
-    _resultDataDicts = [NSMutableDictionary dictionaryWithCapacity:kMaxInflightBuffers];
+    _executables = [[NSMutableDictionary alloc] init];
+    _inflightSemaphore = dispatch_semaphore_create(kMaxInflightCommandBuffers);
+    _sharedEvent = [device newSharedEvent];
+    _eventListener = [[MTLSharedEventListener alloc] init];
+    _eventValue = 0;
 
     return self;
 }
@@ -146,80 +154,142 @@ static const NSInteger kMinSubBatchSize = 20;
     NSUInteger subBatchSize = batchSize / splits;
     NSUInteger inputDataLength = subBatchSize * [_inputTensor sizeOfDimensions:@[@1, @2, @3]];
 
-
-    // Split batchSize into smaller sub-batches and run using double-buffering.
-    NSUInteger subBatch = 0;
-    MPSCommandBuffer * commandBuffer;
-    for (subBatch = 0; subBatch < splits - 1; subBatch++) {
-        commandBuffer = [self runCommandSubBatchWithInputs:inputs + subBatch * inputDataLength
-                                  subBatch:subBatch
-                              subBatchSize:subBatchSize];
+    // Only encoding is serialized. Other threads can encode their batches
+    // while these command buffers run.
+    NSMutableArray<NSArray<MPSGraphTensorData *> *> * results = [NSMutableArray arrayWithCapacity:splits];
+    uint64_t lastEventValue;
+    @synchronized (self) {
+        NSUInteger subBatch = 0;
+        for (subBatch = 0; subBatch < splits - 1; subBatch++) {
+            [results addObject:[self runCommandSubBatchWithInputs:inputs + subBatch * inputDataLength
+                                                     subBatchSize:subBatchSize]];
+        }
+        // Last sub-batch may be smaller or larger than others.
+        [results addObject:[self runCommandSubBatchWithInputs:inputs + subBatch * inputDataLength
+                                                 subBatchSize:batchSize - subBatch * subBatchSize]];
+        lastEventValue = _eventValue;
     }
-    // Last sub-batch may be smaller or larger than others.
-    MPSCommandBuffer * latestCommandBuffer = [self runCommandSubBatchWithInputs:inputs + subBatch * inputDataLength
-                                                                       subBatch:subBatch
-                                                                   subBatchSize:batchSize - subBatch * subBatchSize];
 
-    // Wait for the last batch to be processed.
-    [latestCommandBuffer waitUntilCompleted];
-    [commandBuffer waitUntilCompleted];
+    // Command buffers of a queue complete in commit order, so reaching the
+    // last value means all sub-batches are done.
+    dispatch_semaphore_t done = dispatch_semaphore_create(0);
+    [_sharedEvent notifyListener:_eventListener
+                         atValue:lastEventValue
+                           block:^(id<MTLSharedEvent> event, uint64_t value) {
+        dispatch_semaphore_signal(done);
+    }];
+    dispatch_semaphore_wait(done, DISPATCH_TIME_FOREVER);
 
-    [self copyResultsToBuffers:outputBuffers subBatchSize:subBatchSize];
+    [self copyResults:results toBuffers:outputBuffers subBatchSize:subBatchSize];
 
     return _resultTensors;
 }
 
--(nonnull MPSCommandBuffer *) runCommandSubBatchWithInputs:(float * __nonnull)inputs
-                                                  subBatch:(NSUInteger)subBatch
-                                              subBatchSize:(NSUInteger)subBatchSize
+-(nonnull MPSGraphExecutable *) executableForBatchSize:(NSUInteger)batchSize
 {
-    // Double buffering semaphore to correctly double buffer iterations.
-    dispatch_semaphore_wait(_doubleBufferingSemaphore, DISPATCH_TIME_FOREVER);
+    MPSGraphExecutable * executable = _executables[@(batchSize)];
+    if (executable != nil) {
+        return executable;
+    }
 
-    // Create command buffer for this sub-batch.
-    MPSCommandBuffer * commandBuffer = [MPSCommandBuffer commandBufferFromCommandQueue:_queue];
+    MPSShape * shape = @[@(batchSize), _inputTensor.shape[1], _inputTensor.shape[2], _inputTensor.shape[3]];
+    MPSGraphShapedType * inputType = [[MPSGraphShapedType alloc] initWithShape:shape
+                                                                      dataType:_inputTensor.dataType];
+
+    executable = [self compileWithDevice:_device
+                                   feeds:@{_inputTensor : inputType}
+                           targetTensors:_targetTensors
+                        targetOperations:nil
+                   compilationDescriptor:nil];
+
+    _executables[@(batchSize)] = executable;
+    return executable;
+}
 
-    MPSShape * shape = @[@(subBatchSize), _inputTensor.shape[1], _inputTensor.shape[2], _inputTensor.shape[3]];
+-(nonnull MPSGraphTensorData *) inputTensorDataWithInputs:(float * __nonnull)inputs
+                                                batchSize:(NSUInteger)batchSize
+{
+    MPSShape * shape = @[@(batchSize), _inputTensor.shape[1], _inputTensor.shape[2], _inputTensor.shape[3]];
+    NSUInteger length = batchSize * [_inputTensor sizeOfDimensions:@[@1, @2, @3]] * sizeof(float);
+
+    if (@available(macOS 13.0, *)) {
+        if (_mtlDevice.hasUnifiedMemory) {
+            // Let the GPU read the input buffer in place. Its allocation is
+            // page aligned and padded to whole pages, see InputsOutputs.
+            const uintptr_t page = getpagesize();
+            const uintptr_t start = (uintptr_t)inputs / page * page;
+            const uintptr_t end = ((uintptr_t)inputs + length + page - 1) / page * page;
+            id<MTLBuffer> buffer = [_mtlDevice newBufferWithBytesNoCopy:(void *)start
+                                                                 length:end - start
+                                                                options:MTLResourceStorageModeShared
+                                                            deallocator:nil];
+            if (buffer != nil) {
+                MPSNDArrayDescriptor * descriptor = [MPSNDArrayDescriptor descriptorWithDataType:_inputTensor.dataType
+                                                                                           shape:shape];
+                MPSNDArray * ndarray = [[MPSNDArray alloc] initWithBuffer:buffer
+                                                                   offset:(uintptr_t)inputs - start
+                                                               descriptor:descriptor];
+                return [[MPSGraphTensorData alloc] initWithMPSNDArray:ndarray];
+            }
+        }
+    }
 
     NSData * inputData = [NSData dataWithBytesNoCopy:inputs
-                                              length:subBatchSize * sizeof(float)
+                                              length:length
                                         freeWhenDone:NO];
 
-    MPSGraphTensorData * inputTensorData = [[MPSGraphTensorData alloc] initWithDevice:_device
-                                                                                 data:inputData
-                                                                                shape:shape
-                                                                             dataType:_inputTensor.dataType];
+    return [[MPSGraphTensorData alloc] initWithDevice:_device
+                                                 data:inputData
+                                                shape:shape
+                                             dataType:_inputTensor.dataType];
+}
+
+-(nonnull NSArray<MPSGraphTensorData *> *) runCommandSubBatchWithInputs:(float * __nonnull)inputs
+                                                           subBatchSize:(NSUInteger)subBatchSize
+{
+    // Pad to the bucket size so that the compiled graph can be reused. The
+    // padded rows are ignored when copying the results.
+    NSUInteger bucketSize = lczero::metal_backend::BatchBucket((int)subBatchSize);
+    MPSGraphExecutable * executable = [self executableForBatchSize:bucketSize];
 
-    // Create execution descriptor with block to update results for each iteration.
-    MPSGraphExecutionDescriptor * executionDescriptor = [[MPSGraphExecutionDescriptor alloc] init];
-    executionDescriptor.completionHandler = ^(MPSGraphTensorDataDictionary * resultDictionary, NSError * error) {
-        _resultDataDicts[@(subBatch)] = resultDictionary;
+    // Wait until a command buffer slot is free.
+    dispatch_semaphore_wait(_inflightSemaphore, DISPATCH_TIME_FOREVER);
 
-        // Release double buffering semaphore for the next training iteration to be encoded.
-        dispatch_semaphore_signal(_doubleBufferingSemaphore);
+    // Create command buffer for this sub-batch.
+    MPSCommandBuffer * commandBuffer = [MPSCommandBuffer commandBufferFromCommandQueue:_queue];
+
+    MPSGraphExecutableExecutionDescriptor * executionDescriptor = [[MPSGraphExecutableExecutionDescriptor alloc] init];
+    executionDescriptor.completionHandler = ^(NSArray<MPSGraphTensorData *> * results, NSError * error) {
+        // Release the slot for the next command buffer to be encoded.
+        dispatch_semaphore_signal(_inflightSemaphore);
     };
 
-    [self encodeToCommandBuffer:commandBuffer
-                            feeds:@{_inputTensor : inputTensorData}
-                    targetTensors:_targetTensors
-                 targetOperations:nil
-              executionDescriptor:executionDescriptor];
+    NSArray<MPSGraphTensorData *> * results = [executable encodeToCommandBuffer:commandBuffer
+                                                                    inputsArray:@[[self inputTensorDataWithInputs:inputs
+                                                                                                        batchSize:bucketSize]]
+                                                                   resultsArray:nil
+                                                            executionDescriptor:executionDescriptor];
+
+    [commandBuffer encodeSignalEvent:_sharedEvent value:++_eventValue];
 
     // Commit the command buffer
     [commandBuffer commit];
-    return commandBuffer;
+    return results;
 }
 
 
--(void) copyResultsToBuffers:(float * __nonnull * __nonnull)outputBuffers
-                subBatchSize:(NSUInteger)subBatchSize
+-(void) copyResults:(NSArray<NSArray<MPSGraphTensorData *> *> * __nonnull)results
+          toBuffers:(float * __nonnull * __nonnull)outputBuffers
+       subBatchSize:(NSUInteger)subBatchSize
 {
-    // Copy results for batch back into the output buffers.
+    // Copy results for batch back into the output buffers. Sub-batches are
+    // copied in order, so the padded rows of one are overwritten by the next
+    // and those of the last one land in the padding of the output buffers.
     for (NSUInteger rsIdx = 0; rsIdx < [_resultTensors count]; rsIdx++) {
         NSUInteger outputDataLength = [_resultTensors[rsIdx] sizeOfDimensions:@[@1, @2, @3]] * subBatchSize;
-        for (NSUInteger subBatch = 0; subBatch < [_resultDataDicts count]; subBatch++) {
-            [[_resultDataDicts[@(subBatch)][_resultTensors[rsIdx]] mpsndarray] readBytes:outputBuffers[rsIdx] + subBatch * outputDataLength
-                                                                     strideBytes:nil];
+        for (NSUInteger subBatch = 0; subBatch < [results count]; subBatch++) {
+            [[results[subBatch][rsIdx] mpsndarray] readBytes:outputBuffers[rsIdx] + subBatch * outputDataLength
+                                                 strideBytes:nil];
         }
     }
 }
@@ -37,8 +37,7 @@
 #include "mps/MetalNetworkBuilder.h"
 #include "neural/factory.h"
 #include "neural/network_legacy.h"
-#include "neural/shared/attention_policy_map.h"
-#include "neural/shared/policy_map.h"
+#include "neural/shared/policy.h"
 #include "utils/bititer.h"
 #include "utils/exception.h"
 
@@ -158,9 +157,8 @@ void MetalNetwork::forwardEval(InputsOutputs* io, int batchSize) {
     }
   }
 
-  // Metal is not thread-safe, so lock is needed.
-  lock_.lock();
-
+  // The graph serializes encoding itself, batches from several threads are
+  // in flight at once.
   if (attn_policy_ || conv_policy_) {
     /**
      * @todo policy map implementation has bug in MPSGraph (GatherND not working
@@ -178,9 +176,6 @@ void MetalNetwork::forwardEval(InputsOutputs* io, int batchSize) {
           &io->input_val_mem_expanded_[0], batchSize,
           {&io->op_policy_raw_mem_[0], &io->op_value_mem_[0]});
     }
-    // The next thread can start using the GPU now.
-    lock_.unlock();
-
     if (attn_policy_) {
       // Promotion offset calculation.
       for (size_t batch = 0; batch < batchSize; batch++) {
@@ -198,26 +193,14 @@ void MetalNetwork::forwardEval(InputsOutputs* io, int batchSize) {
         }
       }
       // Mapping from attention policy to lc0 policy
-      for (size_t batch = 0; batch < batchSize; batch++) {
-        for (size_t i = 0; i < 64 * 64 + 8 * 24; i++) {
-          size_t j = kAttnPolicyMap[i];
-          if (j >= 0) {
-            io->op_policy_mem_[batch * 1858 + j] =
-                io->op_policy_raw_mem_[batch * (64 * 64 + 8 * 24) + i];
-          }
-        }
-      }
+      MapPolicy(PolicyMapping::kAttention, batchSize,
+                io->op_policy_raw_mem_.data(), 64 * 64 + 8 * 24,
+                io->op_policy_mem_.data());
     } else if (conv_policy_) {
       // Mapping from convolutional policy to lc0 policy
-      for (size_t batch = 0; batch < batchSize; batch++) {
-        for (size_t i = 0; i < 73 * 64; i++) {
-          short j = kConvPolicyMap[i];
-          if (j >= 0) {
-            io->op_policy_mem_[batch * 1858 + j] =
-                io->op_policy_raw_mem_[batch * 80 * 64 + i];
-          }
-        }
-      }
+      MapPolicy(PolicyMapping::kConvolution, batchSize,
+                io->op_policy_raw_mem_.data(), 80 * 64,
+                io->op_policy_mem_.data());
     }
 
   } else {
@@ -229,9 +212,6 @@ void MetalNetwork::forwardEval(InputsOutputs* io, int batchSize) {
       builder_->forwardEval(&io->input_val_mem_expanded_[0], batchSize,
                             {&io->op_policy_mem_[0], &io->op_value_mem_[0]});
     }
-
-    // The next thread can start using the GPU now.
-    lock_.unlock();
   }
 }
 
@@ -59,6 +59,17 @@ class MetalNetworkComputation : public NetworkComputation {
     batch_size_++;
   }
 
+  bool CanAddInputInPlace() const override { return true; }
+
+  InputBuffers AddInputInPlace(
+      const std::vector<uint16_t>& /*moves*/) override {
+    const InputBuffers buffers{
+        &inputs_outputs_->input_masks_mem_[batch_size_ * kInputPlanes],
+        &inputs_outputs_->input_val_mem_[batch_size_ * kInputPlanes]};
+    batch_size_++;
+    return buffers;
+  }
+
   void ComputeBlocking() override;
 
   int GetBatchSize() const override { return batch_size_; }
@@ -152,10 +163,6 @@ class MetalNetwork : public Network {
   std::mutex inputs_outputs_lock_;
   std::list<std::unique_ptr<InputsOutputs>> free_inputs_outputs_;
   std::unique_ptr<MetalNetworkBuilder> builder_;
-
-  // Metal not really good at multi-threading, so we need to do one NN eval at a
-  // time.
-  mutable std::mutex lock_;
 };
 
 }  // namespace metal_backend
@@ -28,10 +28,12 @@
 #pragma once
 
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "proto/net.pb.h"
 #include "utils/exception.h"
+#include "utils/fixedvector.h"
 
 namespace lczero {
 
@@ -50,15 +52,64 @@ struct InputPlane {
   std::uint64_t mask = 0ull;
   float value = 1.0f;
 };
-using InputPlanes = std::vector<InputPlane>;
+// Inline, so that encoding a position doesn't allocate.
+using InputPlanes = FixedVector<InputPlane, kInputPlanes>;
+
+// Input of a sample in the buffers of a backend: kInputPlanes plane masks and
+// values, laid out like InputPlanes.
+struct InputBuffers {
+  std::uint64_t* masks = nullptr;
+  float* values = nullptr;
+};
+
+// How urgently the results of a computation are needed. Backends that queue
+// computations of several callers serve the more urgent ones first.
+enum class ComputationPriority {
+  // Blocks the search, e.g. the evaluation of the root.
+  kCritical,
+  kNormal,
+  // Mostly fills the cache ahead of time.
+  kSpeculative,
+  // Searches on the opponent's time (pondering), yielding to the callers on
+  // their own clock.
+  kBackground,
+};
+constexpr int kNumComputationPriorities = 4;
 
 // An interface to implement by computing backends.
 class NetworkComputation {
  public:
   // Adds a sample to the batch.
   virtual void AddInput(InputPlanes&& input) = 0;
+  // Like AddInput(), also giving the policy indices of the legal moves of the
+  // sample. Backends may then only compute the policy of these moves, which is
+  // read with GetLegalPVal().
+  virtual void AddInputWithMoves(InputPlanes&& input,
+                                 const std::vector<uint16_t>& /*moves*/) {
+    AddInput(std::move(input));
+  }
+  // Whether AddInputInPlace() is supported.
+  virtual bool CanAddInputInPlace() const { return false; }
+  // Like AddInputWithMoves(), for backends keeping the inputs in buffers of
+  // their own. Returns where the caller encodes the planes of the sample, which
+  // it must do before the computation starts. Saves copying the planes.
+  virtual InputBuffers AddInputInPlace(const std::vector<uint16_t>& /*moves*/) {
+    throw Exception("In place input is not supported by the backend.");
+  }
   // Do the computation.
   virtual void ComputeBlocking() = 0;
+  // Alternatively to ComputeBlocking(), starts the computation with Submit()
+  // and waits for the results with Wait(), so that the caller can prepare the
+  // next batch in the meantime. Backends without asynchronous evaluation
+  // compute everything in Submit().
+  virtual void Submit() { ComputeBlocking(); }
+  virtual void Wait() {}
+  // Sets the priority, before ComputeBlocking() or Submit() is called.
+  // Computations wrapping others forward it.
+  virtual void SetPriority(ComputationPriority priority) {
+    priority_ = priority;
+  }
+  ComputationPriority GetPriority() const { return priority_; }
   // Returns how many times AddInput() was called.
   virtual int GetBatchSize() const = 0;
   // Returns Q value of @sample.
@@ -67,7 +118,18 @@ class NetworkComputation {
   // Returns P value @move_id of @sample.
   virtual float GetPVal(int sample, int move_id) const = 0;
   virtual float GetMVal(int sample) const = 0;
+  // Returns P value of the legal move @move_ordinal of a sample added with
+  // AddInputWithMoves(), whose policy index is @move_id. Only differences
+  // between the values of a sample are meaningful: backends may return the
+  // log of the probabilities rather than the raw logits.
+  virtual float GetLegalPVal(int sample, int /*move_ordinal*/,
+                             int move_id) const {
+    return GetPVal(sample, move_id);
+  }
   virtual ~NetworkComputation() = default;
+
+ protected:
+  ComputationPriority priority_ = ComputationPriority::kNormal;
 };
 
 // The plan:
@@ -110,6 +172,9 @@ class Network {
   virtual void InitThread(int /*id*/) {}
   virtual bool IsCpu() const { return false; }
   virtual int GetMiniBatchSize() const { return 256; }
+  // PCI bus id of the device computing the network, e.g. "0000:65:00.0",
+  // empty unless that's a single known PCI device.
+  virtual std::string GetPciBusId() const { return {}; }
   virtual ~Network() = default;
 };
 
@@ -0,0 +1,210 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include "chess/position.h"
+#include "neural/encoder.h"
+#include "neural/factory.h"
+#include "utils/exception.h"
+#include "utils/filesystem.h"
+#include "utils/logging.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+namespace lczero {
+namespace {
+
+// Backends below this priority, i.e. the wrappers and the test backends, are
+// only candidates when listed explicitly.
+constexpr int kMinCandidatePriority = 10;
+
+std::string GetHostName() {
+#ifdef _WIN32
+  const char* name = std::getenv("COMPUTERNAME");
+  return name ? name : "";
+#else
+  char name[256] = {};
+  gethostname(name, sizeof(name) - 1);
+  return name;
+#endif
+}
+
+// The shape of the net rather than its weights decides the fastest backend,
+// so later nets of a training run reuse the decision.
+std::string GetNetKey(const std::optional<WeightsFile>& weights) {
+  if (!weights) return "none";
+  const auto& format = weights->format().network_format();
+  const auto& w = weights->weights();
+  std::ostringstream key;
+  key << format.network() << '/' << format.input() << '/' << format.policy()
+      << '/' << format.value() << '/' << format.moves_left() << "/res"
+      << w.residual_size() << 'x' << w.input().weights().params().size()
+      << "/enc" << w.encoder_size() << 'x' << w.ip_emb_b().params().size()
+      << "/onnx" << weights->onnx_model().model().size();
+  return key.str();
+}
+
+// Positions per second of @network on @batches batches of @batch_size.
+double MeasureThroughput(Network* network, int batch_size, int batches) {
+  PositionHistory history;
+  history.Reset(ChessBoard(ChessBoard::kStartposFen), 0, 1);
+  const auto input =
+      EncodePositionForNN(network->GetCapabilities().input_format, history, 8,
+                          FillEmptyHistory::ALWAYS, nullptr);
+  auto compute = [&]() {
+    auto computation = network->NewComputation();
+    for (int i = 0; i < batch_size; i++) {
+      computation->AddInput(InputPlanes(input));
+    }
+    computation->ComputeBlocking();
+  };
+  // Do any backend initialization outside the timing.
+  compute();
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < batches; i++) compute();
+  const std::chrono::duration<double> time =
+      std::chrono::steady_clock::now() - start;
+  return batch_size * batches / time.count();
+}
+
+struct Candidate {
+  // Subdict name, or the backend name for the default candidates.
+  std::string name;
+  std::string backend;
+  const OptionsDict* options;
+};
+
+// Returns the candidate chosen for @key by an earlier run, or an empty string.
+std::string ReadDecision(const std::string& filename, const std::string& key) {
+  std::ifstream file(filename);
+  std::string line;
+  std::string decision;
+  while (std::getline(file, line)) {
+    // "<host>\t<net>\t<candidate>", later lines override earlier ones.
+    const auto pos = line.rfind('\t');
+    if (pos != std::string::npos && line.compare(0, pos, key) == 0) {
+      decision = line.substr(pos + 1);
+    }
+  }
+  return decision;
+}
+
+std::unique_ptr<Network> MakeAutoNetwork(
+    const std::optional<WeightsFile>& weights, const OptionsDict& options) {
+  std::vector<Candidate> candidates;
+  for (const auto& name : options.ListSubdicts()) {
+    const auto& opts = options.GetSubdict(name);
+    candidates.push_back(
+        {name, opts.GetOrDefault<std::string>("backend", name), &opts});
+  }
+  if (candidates.empty()) {
+    for (const auto& backend :
+         NetworkFactory::Get()->GetBackendsList(kMinCandidatePriority)) {
+      candidates.push_back({backend, backend, &options});
+    }
+  }
+
+  std::string decisions_file;
+  if (options.IsDefault<std::string>("decisions_file")) {
+    decisions_file = GetUserCacheDirectory();
+    if (!decisions_file.empty()) {
+      decisions_file += "lc0/";
+      CreateDirectory(decisions_file);
+    }
+    decisions_file += "lc0_backend_autotune";
+  } else {
+    decisions_file = options.Get<std::string>("decisions_file");
+  }
+  const bool retune = options.GetOrDefault<bool>("retune", false);
+  const int batch_size = options.GetOrDefault<int>("bench_batch_size", 0);
+  const int batches = options.GetOrDefault<int>("bench_batches", 20);
+
+  // Options of the candidates that were not used are not errors.
+  auto mark_options_read = [&]() {
+    for (const auto& candidate : candidates) {
+      if (candidate.options != &options) {
+        candidate.options->MarkAllOptionsRead();
+      }
+    }
+  };
+
+  const std::string key = GetHostName() + '\t' + GetNetKey(weights);
+  const std::string decision =
+      retune ? "" : ReadDecision(decisions_file, key);
+  for (const auto& candidate : candidates) {
+    if (candidate.name != decision) continue;
+    auto network = NetworkFactory::Get()->Create(candidate.backend, weights,
+                                                 *candidate.options);
+    mark_options_read();
+    CERR << "Using backend " << candidate.name
+         << " chosen by autotune for this host and net.";
+    return network;
+  }
+
+  std::unique_ptr<Network> best;
+  std::string best_name;
+  double best_nps = 0.0;
+  for (const auto& candidate : candidates) {
+    std::unique_ptr<Network> network;
+    double nps;
+    try {
+      network = NetworkFactory::Get()->Create(candidate.backend, weights,
+                                              *candidate.options);
+      nps = MeasureThroughput(
+          network.get(),
+          batch_size > 0 ? batch_size : network->GetMiniBatchSize(), batches);
+    } catch (const std::exception& e) {
+      CERR << "Autotune skips backend " << candidate.name << ": " << e.what();
+      continue;
+    }
+    CERR << "Autotune: backend " << candidate.name << " runs at "
+         << static_cast<int>(nps) << " nps.";
+    if (nps > best_nps) {
+      best = std::move(network);
+      best_name = candidate.name;
+      best_nps = nps;
+    }
+  }
+  mark_options_read();
+  if (!best) throw Exception("Autotune: none of the backends could be used.");
+
+  CERR << "Autotune chose backend " << best_name << ".";
+  std::ofstream(decisions_file, std::ios::app)
+      << key << '\t' << best_name << '\n';
+  return best;
+}
+
+REGISTER_NETWORK("auto", MakeAutoNetwork, -1002)
+
+}  // namespace
+}  // namespace lczero
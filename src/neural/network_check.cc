@@ -26,8 +26,13 @@
  */
 
 #include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <deque>
 #include <iomanip>
+#include <mutex>
+#include <thread>
 
 #include "neural/decoder.h"
 #include "neural/factory.h"
@@ -46,6 +51,7 @@ enum CheckMode {
   kCheckOnly,
   kErrorDisplay,
   kHistogram,
+  kSample,
 };
 
 struct CheckParams {
@@ -77,6 +83,12 @@ class CheckComputation : public NetworkComputation {
     moves_.emplace_back(board.GenerateLegalMoves());
   }
 
+  void SetPriority(ComputationPriority priority) override {
+    NetworkComputation::SetPriority(priority);
+    work_comp_->SetPriority(priority);
+    check_comp_->SetPriority(priority);
+  }
+
   void ComputeBlocking() override {
     work_comp_->ComputeBlocking();
     check_comp_->ComputeBlocking();
@@ -90,6 +102,8 @@ class CheckComputation : public NetworkComputation {
       case kHistogram:
         DisplayHistogram();
         break;
+      case kSample:
+        break;
     }
   }
 
@@ -115,10 +129,10 @@ class CheckComputation : public NetworkComputation {
 
  private:
   const CheckParams& params_;
-  std::vector<MoveList> moves_;
+  std::vector<FixedMoveList> moves_;
 
   std::vector<float> PolicySoftMax(const NetworkComputation* comp, int sample,
-                                   const std::vector<Move>& moves) const {
+                                   const FixedMoveList& moves) const {
     float max_p = -std::numeric_limits<float>::infinity();
     std::vector<float> policy;
     policy.reserve(moves.size());
@@ -244,24 +258,258 @@ class CheckComputation : public NetworkComputation {
     }
 
     MaximumError policy_error;
+    // Reduced precision backends are expected to differ by more than the
+    // tolerances, what matters is whether they still pick the same moves.
+    int same_best_move = 0;
     for (int i = 0; i < size; i++) {
       const auto work = PolicySoftMax(work_comp_.get(), i, moves_[i]);
       const auto check = PolicySoftMax(check_comp_.get(), i, moves_[i]);
       for (size_t j = 0; j < work.size(); j++) {
         policy_error.Add(work[j], check[j]);
       }
+      same_best_move +=
+          std::max_element(work.begin(), work.end()) - work.begin() ==
+          std::max_element(check.begin(), check.end()) - check.begin();
     }
 
     CERR << "maximum error for a batch of " << size << ":";
 
     value_error.Dump("  value");
     policy_error.Dump("  policy");
+    CERR << "  same best move: " << same_best_move << " of " << size << ".";
   }
 
   std::unique_ptr<NetworkComputation> work_comp_;
   std::unique_ptr<NetworkComputation> check_comp_;
 };
 
+// A sampled batch with the outputs of the working backend, restricted to the
+// legal moves, waiting to be checked.
+struct SampledBatch {
+  std::vector<InputPlanes> inputs;
+  std::vector<FixedMoveList> moves;
+  std::vector<float> q;
+  std::vector<float> d;
+  // Raw policy of the legal moves of each sample, in the order of moves.
+  std::vector<std::vector<float>> policy;
+};
+
+// Checks sampled batches on the reference backend in a thread of its own,
+// so that the working backend is never held up, and reports the drift
+// between the two periodically. Batches arriving while the queue is full
+// are dropped rather than waited for.
+class DriftMonitor {
+ public:
+  DriftMonitor(Network* check_net, const CheckParams& params,
+               size_t max_pending, std::chrono::seconds report_interval)
+      : check_net_(check_net),
+        params_(params),
+        max_pending_(max_pending),
+        report_interval_(report_interval),
+        last_report_(std::chrono::steady_clock::now()),
+        thread_([this]() { Worker(); }) {}
+
+  ~DriftMonitor() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+    if (stats_.samples > 0) Report();
+  }
+
+  void Submit(SampledBatch&& batch) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (queue_.size() >= max_pending_) {
+        dropped_++;
+        return;
+      }
+      queue_.push_back(std::move(batch));
+    }
+    cv_.notify_one();
+  }
+
+ private:
+  struct Stats {
+    int64_t batches = 0;
+    int64_t samples = 0;
+    double q_error_sum = 0;
+    double q_error_max = 0;
+    double d_error_sum = 0;
+    double d_error_max = 0;
+    double policy_error_max = 0;
+    int64_t same_best_move = 0;
+    int64_t beyond_tolerance = 0;
+  };
+
+  void Worker() {
+    while (true) {
+      SampledBatch batch;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&]() { return stop_ || !queue_.empty(); });
+        if (stop_) return;
+        batch = std::move(queue_.front());
+        queue_.pop_front();
+      }
+      Check(&batch);
+      if (stats_.samples > 0 &&
+          std::chrono::steady_clock::now() - last_report_ >=
+          report_interval_) {
+        Report();
+        last_report_ = std::chrono::steady_clock::now();
+      }
+    }
+  }
+
+  void Check(SampledBatch* batch) {
+    auto comp = check_net_->NewComputation();
+    for (auto& input : batch->inputs) comp->AddInput(std::move(input));
+    comp->ComputeBlocking();
+
+    stats_.batches++;
+    for (size_t i = 0; i < batch->moves.size(); i++) {
+      stats_.samples++;
+      const double q_error = std::abs(comp->GetQVal(i) - batch->q[i]);
+      const double d_error = std::abs(comp->GetDVal(i) - batch->d[i]);
+      stats_.q_error_sum += q_error;
+      stats_.q_error_max = std::max(stats_.q_error_max, q_error);
+      stats_.d_error_sum += d_error;
+      stats_.d_error_max = std::max(stats_.d_error_max, d_error);
+      bool beyond_tolerance = !IsAlmostEqual(comp->GetQVal(i), batch->q[i]);
+
+      std::vector<float> check;
+      for (const auto move : batch->moves[i]) {
+        check.push_back(comp->GetPVal(i, move.as_nn_index(0)));
+      }
+      const auto work = SoftMax(batch->policy[i]);
+      check = SoftMax(check);
+      for (size_t j = 0; j < work.size(); j++) {
+        stats_.policy_error_max = std::max(
+            stats_.policy_error_max, std::abs(double{work[j]} - check[j]));
+        beyond_tolerance |= !IsAlmostEqual(work[j], check[j]);
+      }
+      stats_.same_best_move +=
+          std::max_element(work.begin(), work.end()) - work.begin() ==
+          std::max_element(check.begin(), check.end()) - check.begin();
+      stats_.beyond_tolerance += beyond_tolerance;
+    }
+  }
+
+  static std::vector<float> SoftMax(std::vector<float> policy) {
+    float max_p = -std::numeric_limits<float>::infinity();
+    for (const auto p : policy) max_p = std::max(max_p, p);
+    float total = 0;
+    for (auto& p : policy) {
+      p = std::exp(p - max_p);
+      total += p;
+    }
+    if (total > 0) {
+      for (auto& p : policy) p /= total;
+    }
+    return policy;
+  }
+
+  bool IsAlmostEqual(double a, double b) const {
+    return std::abs(a - b) <= std::max(params_.relative_tolerance *
+                                           std::max(std::abs(a), std::abs(b)),
+                                       params_.absolute_tolerance);
+  }
+
+  void Report() {
+    int64_t dropped;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      dropped = dropped_;
+    }
+    CERR << std::scientific << std::setprecision(1) << "Drift over "
+         << stats_.batches << " sampled batches (" << stats_.samples
+         << " positions, " << dropped << " batches dropped): value mean "
+         << stats_.q_error_sum / stats_.samples << " max "
+         << stats_.q_error_max << ", draw mean "
+         << stats_.d_error_sum / stats_.samples << " max "
+         << stats_.d_error_max << ", policy max " << stats_.policy_error_max
+         << std::fixed << ", same best move "
+         << 100.0 * stats_.same_best_move / stats_.samples << "%, "
+         << stats_.beyond_tolerance << " positions beyond tolerance.";
+  }
+
+  Network* const check_net_;
+  const CheckParams& params_;
+  const size_t max_pending_;
+  const std::chrono::seconds report_interval_;
+  std::chrono::steady_clock::time_point last_report_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<SampledBatch> queue_;
+  bool stop_ = false;
+  int64_t dropped_ = 0;
+  // Only touched by the worker thread.
+  Stats stats_;
+  std::thread thread_;
+};
+
+// Runs on the working backend only, handing a copy of the batch with its
+// outputs to the drift monitor once computed.
+class SampleComputation : public NetworkComputation {
+ public:
+  SampleComputation(const CheckParams& params,
+                    std::unique_ptr<NetworkComputation> work_comp,
+                    DriftMonitor* monitor)
+      : params_(params), work_comp_(std::move(work_comp)), monitor_(monitor) {}
+
+  void AddInput(InputPlanes&& input) override {
+    batch_.inputs.push_back(input);
+    work_comp_->AddInput(std::move(input));
+  }
+
+  void SetPriority(ComputationPriority priority) override {
+    NetworkComputation::SetPriority(priority);
+    work_comp_->SetPriority(priority);
+  }
+
+  void ComputeBlocking() override {
+    work_comp_->ComputeBlocking();
+    for (size_t i = 0; i < batch_.inputs.size(); i++) {
+      ChessBoard board;
+      int rule50;
+      int gameply;
+      PopulateBoard(params_.input_format, batch_.inputs[i], &board, &rule50,
+                    &gameply);
+      batch_.moves.push_back(board.GenerateLegalMoves());
+      batch_.q.push_back(work_comp_->GetQVal(i));
+      batch_.d.push_back(work_comp_->GetDVal(i));
+      auto& policy = batch_.policy.emplace_back();
+      for (const auto move : batch_.moves.back()) {
+        policy.push_back(work_comp_->GetPVal(i, move.as_nn_index(0)));
+      }
+    }
+    monitor_->Submit(std::move(batch_));
+  }
+
+  int GetBatchSize() const override { return work_comp_->GetBatchSize(); }
+  float GetQVal(int sample) const override {
+    return work_comp_->GetQVal(sample);
+  }
+  float GetDVal(int sample) const override {
+    return work_comp_->GetDVal(sample);
+  }
+  float GetMVal(int sample) const override {
+    return work_comp_->GetMVal(sample);
+  }
+  float GetPVal(int sample, int move_id) const override {
+    return work_comp_->GetPVal(sample, move_id);
+  }
+
+ private:
+  const CheckParams& params_;
+  std::unique_ptr<NetworkComputation> work_comp_;
+  DriftMonitor* const monitor_;
+  SampledBatch batch_;
+};
+
 class CheckNetwork : public Network {
  public:
   static constexpr CheckMode kDefaultMode = kCheckOnly;
@@ -291,6 +539,8 @@ class CheckNetwork : public Network {
       params_.mode = kHistogram;
     } else if (mode == "display") {
       params_.mode = kErrorDisplay;
+    } else if (mode == "sample") {
+      params_.mode = kSample;
     }
 
     params_.absolute_tolerance =
@@ -343,6 +593,17 @@ class CheckNetwork : public Network {
       case kHistogram:
         CERR << "Check mode: histogram.";
         break;
+      case kSample:
+        CERR << std::scientific << std::setprecision(1)
+             << "Check mode: sampled drift report with relative tolerance "
+             << params_.relative_tolerance << ", absolute tolerance "
+             << params_.absolute_tolerance << ".";
+        monitor_ = std::make_unique<DriftMonitor>(
+            check_net_.get(), params_,
+            options.GetOrDefault<int>("max_pending", 2),
+            std::chrono::seconds(
+                options.GetOrDefault<int>("report_interval", 60)));
+        break;
     }
     CERR << "Check rate: " << std::fixed << std::setprecision(0)
          << 100 * check_frequency_ << "%.";
@@ -351,6 +612,10 @@ class CheckNetwork : public Network {
   std::unique_ptr<NetworkComputation> NewComputation() override {
     const double draw = Random::Get().GetDouble(1.0);
     const bool check = draw < check_frequency_;
+    if (check && monitor_) {
+      return std::make_unique<SampleComputation>(
+          params_, work_net_->NewComputation(), monitor_.get());
+    }
     if (check) {
       std::unique_ptr<NetworkComputation> work_comp =
           work_net_->NewComputation();
@@ -374,6 +639,8 @@ class CheckNetwork : public Network {
   std::unique_ptr<Network> work_net_;
   std::unique_ptr<Network> check_net_;
   NetworkCapabilities capabilities_;
+  // Only in sample mode. Declared last to stop before the networks go.
+  std::unique_ptr<DriftMonitor> monitor_;
 };
 
 std::unique_ptr<Network> MakeCheckNetwork(
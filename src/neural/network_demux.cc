@@ -25,16 +25,27 @@
   Program grant you additional permission to convey the resulting work.
 */
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <numeric>
 #include <queue>
 #include <thread>
 
 #include "neural/factory.h"
 #include "utils/exception.h"
+#include "utils/tracing.h"
 
 namespace lczero {
 namespace {
 
+// Throughput is tracked separately for each power of two of the split size.
+constexpr int kThroughputBuckets = 16;
+// Weight of the newest measurement in the moving average of throughput.
+constexpr float kThroughputDecay = 0.2f;
+
 class DemuxingNetwork;
 class DemuxingComputation : public NetworkComputation {
  public:
@@ -47,27 +58,23 @@ class DemuxingComputation : public NetworkComputation {
   int GetBatchSize() const override { return planes_.size(); }
 
   float GetQVal(int sample) const override {
-    const int idx = sample / partial_size_;
-    const int offset = sample % partial_size_;
-    return parents_[idx]->GetQVal(offset);
+    const int idx = GetSplit(sample);
+    return parents_[idx]->GetQVal(sample - split_starts_[idx]);
   }
 
   float GetDVal(int sample) const override {
-    int idx = sample / partial_size_;
-    int offset = sample % partial_size_;
-    return parents_[idx]->GetDVal(offset);
+    const int idx = GetSplit(sample);
+    return parents_[idx]->GetDVal(sample - split_starts_[idx]);
   }
 
   float GetMVal(int sample) const override {
-    int idx = sample / partial_size_;
-    int offset = sample % partial_size_;
-    return parents_[idx]->GetMVal(offset);
+    const int idx = GetSplit(sample);
+    return parents_[idx]->GetMVal(sample - split_starts_[idx]);
   }
 
   float GetPVal(int sample, int move_id) const override {
-    const int idx = sample / partial_size_;
-    const int offset = sample % partial_size_;
-    return parents_[idx]->GetPVal(offset, move_id);
+    const int idx = GetSplit(sample);
+    return parents_[idx]->GetPVal(sample - split_starts_[idx], move_id);
   }
 
   void NotifyComplete() {
@@ -78,18 +85,28 @@ class DemuxingComputation : public NetworkComputation {
     }
   }
 
-  NetworkComputation* AddParentFromNetwork(Network* network) {
-    std::unique_lock<std::mutex> lock(mutex_);
-    parents_.emplace_back(network->NewComputation());
-    const int cur_idx = (parents_.size() - 1) * partial_size_;
-    for (int i = cur_idx; i < std::min(GetBatchSize(), cur_idx + partial_size_);
-         i++) {
-      parents_.back()->AddInput(std::move(planes_[i]));
+  NetworkComputation* AddParentFromNetwork(Network* network, int split) {
+    auto parent = network->NewComputation();
+    parent->SetPriority(GetPriority());
+    for (int i = split_starts_[split]; i < split_starts_[split + 1]; i++) {
+      parent->AddInput(std::move(planes_[i]));
     }
-    return parents_.back().get();
+    std::unique_lock<std::mutex> lock(mutex_);
+    parents_[split] = std::move(parent);
+    return parents_[split].get();
+  }
+
+  int GetSplitSize(int split) const {
+    return split_starts_[split + 1] - split_starts_[split];
   }
 
  private:
+  int GetSplit(int sample) const {
+    return std::upper_bound(split_starts_.begin(), split_starts_.end(),
+                            sample) -
+           split_starts_.begin() - 1;
+  }
+
   std::vector<InputPlanes> planes_;
   DemuxingNetwork* network_;
   std::vector<std::unique_ptr<NetworkComputation>> parents_;
@@ -97,14 +114,24 @@ class DemuxingComputation : public NetworkComputation {
   std::mutex mutex_;
   std::condition_variable dataready_cv_;
   int dataready_ = 0;
-  int partial_size_ = 0;
+  // First sample of each split, followed by the batch size.
+  std::vector<int> split_starts_;
 };
 
 class DemuxingNetwork : public Network {
  public:
+  // Split of a batch to be computed, on a given child network or on any of
+  // them in turn.
+  struct Task {
+    DemuxingComputation* computation;
+    int split;
+    int network;
+  };
+
   DemuxingNetwork(const std::optional<WeightsFile>& weights,
                   const OptionsDict& options) {
     minimum_split_size_ = options.GetOrDefault<int>("minimum-split-size", 0);
+    throughput_split_ = options.GetOrDefault<bool>("throughput-split", false);
     const auto parents = options.ListSubdicts();
     if (parents.empty()) {
       // If options are empty, or multiplexer configured in root object,
@@ -130,6 +157,8 @@ class DemuxingNetwork : public Network {
     if (nn_threads == 0) {
       nn_threads = networks_.back()->GetThreads();
     }
+    stats_.emplace_back(std::make_unique<Stats>());
+    stats_.back()->threads = nn_threads;
 
     min_batch_size_ =
         std::min(min_batch_size_, networks_.back()->GetMiniBatchSize());
@@ -160,9 +189,14 @@ class DemuxingNetwork : public Network {
 
   bool IsCpu() const override { return is_cpu_; }
 
-  void Enqueue(DemuxingComputation* computation) {
+  std::string GetPciBusId() const override {
+    return networks_.size() == 1 ? networks_[0]->GetPciBusId() : "";
+  }
+
+  void Enqueue(const Task& task) {
+    if (task.network >= 0) stats_[task.network]->pending++;
     std::lock_guard<std::mutex> lock(mutex_);
-    queue_.push(computation);
+    queues_[static_cast<int>(task.computation->GetPriority())].push(task);
     cv_.notify_one();
   }
 
@@ -170,37 +204,119 @@ class DemuxingNetwork : public Network {
     Abort();
     Wait();
     // Unstuck waiting computations.
-    while (!queue_.empty()) {
-      queue_.front()->NotifyComplete();
-      queue_.pop();
+    for (auto& queue : queues_) {
+      while (!queue.empty()) {
+        queue.front().computation->NotifyComplete();
+        queue.pop();
+      }
+    }
+  }
+
+  // Takes the next task of the highest priority. Must be called with mutex_
+  // held.
+  bool PopTask(Task* task) {
+    for (auto& queue : queues_) {
+      if (queue.empty()) continue;
+      *task = queue.front();
+      queue.pop();
+      return true;
+    }
+    return false;
+  }
+
+  bool QueuesEmpty() const {
+    for (const auto& queue : queues_) {
+      if (!queue.empty()) return false;
+    }
+    return true;
+  }
+
+  // Splits a batch in proportion to the measured throughput of the child
+  // networks that have a free thread (or of all of them, if none has).
+  // Returns the size of the split for each child.
+  std::vector<int> PlanThroughputSplits(int batch_size) const {
+    std::vector<int> candidates;
+    for (size_t i = 0; i < networks_.size(); i++) {
+      if (stats_[i]->pending < stats_[i]->threads) candidates.push_back(i);
+    }
+    if (candidates.empty()) {
+      candidates.resize(networks_.size());
+      std::iota(candidates.begin(), candidates.end(), 0);
+    }
+
+    std::vector<float> rates(networks_.size(), 0.0f);
+    float max_rate = 0.0f;
+    for (int i : candidates) {
+      rates[i] = stats_[i]->Rate(batch_size / candidates.size());
+      max_rate = std::max(max_rate, rates[i]);
+    }
+    // Unmeasured children get the best rate, so that they are measured soon.
+    for (int i : candidates) {
+      if (rates[i] == 0.0f) rates[i] = max_rate > 0.0f ? max_rate : 1.0f;
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [&](int a, int b) { return rates[a] > rates[b]; });
+
+    std::vector<int> sizes(networks_.size(), 0);
+    while (true) {
+      float total_rate = 0.0f;
+      for (int i : candidates) total_rate += rates[i];
+      int assigned = 0;
+      for (int i : candidates) {
+        sizes[i] = static_cast<int>(batch_size * rates[i] / total_rate);
+        assigned += sizes[i];
+      }
+      // Rounding leftovers go to the fastest child.
+      sizes[candidates[0]] += batch_size - assigned;
+      // Drop the slowest child if its split is too small to be worth it.
+      const int slowest = candidates.back();
+      if (candidates.size() == 1 ||
+          (sizes[slowest] > 0 && sizes[slowest] >= minimum_split_size_)) {
+        break;
+      }
+      sizes[slowest] = 0;
+      candidates.pop_back();
     }
+    return sizes;
   }
 
   void Worker() {
+    LC0_TRACE_THREAD_NAME("demultiplexing backend");
     // While Abort() is not called (and it can only be called from destructor).
     while (!abort_) {
       {
         {
           std::unique_lock<std::mutex> lock(mutex_);
           // Wait until there's come work to compute.
-          cv_.wait(lock, [&] { return abort_ || !queue_.empty(); });
+          cv_.wait(lock, [&] { return abort_ || !QueuesEmpty(); });
           if (abort_) break;
         }
 
         // While there is a work in queue, process it.
         while (true) {
-          DemuxingComputation* to_notify;
+          Task task;
           {
             std::unique_lock<std::mutex> lock(mutex_);
-            if (queue_.empty()) break;
-            to_notify = queue_.front();
-            queue_.pop();
+            if (!PopTask(&task)) break;
+          }
+          if (task.network < 0) {
+            task.network = ++(counter_) % networks_.size();
+            stats_[task.network]->pending++;
           }
-          long long net_idx = ++(counter_) % networks_.size();
           NetworkComputation* to_compute =
-              to_notify->AddParentFromNetwork(networks_[net_idx].get());
-          to_compute->ComputeBlocking();
-          to_notify->NotifyComplete();
+              task.computation->AddParentFromNetwork(
+                  networks_[task.network].get(), task.split);
+          const auto start = std::chrono::steady_clock::now();
+          {
+            LC0_TRACE_SCOPE("demux compute");
+            to_compute->ComputeBlocking();
+          }
+          const std::chrono::duration<float> elapsed =
+              std::chrono::steady_clock::now() - start;
+          stats_[task.network]->Update(
+              task.computation->GetSplitSize(task.split), elapsed.count());
+          stats_[task.network]->pending--;
+          task.computation->NotifyComplete();
         }
       }
     }
@@ -221,12 +337,60 @@ class DemuxingNetwork : public Network {
     }
   }
 
+  // Online throughput measurements of a child network.
+  struct Stats {
+    static int Bucket(int size) {
+      int bucket = 0;
+      while (size > 1 && bucket < kThroughputBuckets - 1) {
+        size >>= 1;
+        bucket++;
+      }
+      return bucket;
+    }
+
+    void Update(int size, float seconds) {
+      if (seconds <= 0.0f) return;
+      const float rate = size / seconds;
+      std::lock_guard<std::mutex> lock(mutex);
+      float& average = rates[Bucket(size)];
+      average = average == 0.0f ? rate
+                                : kThroughputDecay * rate +
+                                      (1 - kThroughputDecay) * average;
+    }
+
+    // Samples per second at the given split size, taken from the nearest
+    // measured size if needed. Zero if nothing was measured yet.
+    float Rate(int size) const {
+      const int bucket = Bucket(size);
+      std::lock_guard<std::mutex> lock(mutex);
+      for (int distance = 0; distance < kThroughputBuckets; distance++) {
+        if (bucket - distance >= 0 && rates[bucket - distance] > 0.0f) {
+          return rates[bucket - distance];
+        }
+        if (bucket + distance < kThroughputBuckets &&
+            rates[bucket + distance] > 0.0f) {
+          return rates[bucket + distance];
+        }
+      }
+      return 0.0f;
+    }
+
+    int threads = 0;
+    // Splits queued or being computed on the network.
+    std::atomic<int> pending{0};
+    mutable std::mutex mutex;
+    std::array<float, kThroughputBuckets> rates{};
+  };
+
   std::vector<std::unique_ptr<Network>> networks_;
+  std::vector<std::unique_ptr<Stats>> stats_;
   NetworkCapabilities capabilities_;
   int min_batch_size_ = std::numeric_limits<int>::max();
   bool is_cpu_ = true;
-  std::queue<DemuxingComputation*> queue_;
+  // One queue per ComputationPriority, the most urgent first.
+  std::array<std::queue<Task>, kNumComputationPriorities> queues_;
   int minimum_split_size_ = 0;
+  bool throughput_split_ = false;
   std::atomic<long long> counter_;
   bool abort_ = false;
 
@@ -238,17 +402,35 @@ class DemuxingNetwork : public Network {
 
 void DemuxingComputation::ComputeBlocking() {
   if (GetBatchSize() == 0) return;
-  partial_size_ = (GetBatchSize() + network_->threads_.size() - 1) /
-                  network_->threads_.size();
-  if (partial_size_ < network_->minimum_split_size_) {
-    partial_size_ = std::min(GetBatchSize(), network_->minimum_split_size_);
+  std::vector<int> networks;
+  split_starts_.assign(1, 0);
+  if (network_->throughput_split_) {
+    const auto sizes = network_->PlanThroughputSplits(GetBatchSize());
+    for (size_t i = 0; i < sizes.size(); i++) {
+      if (sizes[i] == 0) continue;
+      networks.push_back(i);
+      split_starts_.push_back(split_starts_.back() + sizes[i]);
+    }
+  } else {
+    int partial_size = (GetBatchSize() + network_->threads_.size() - 1) /
+                       network_->threads_.size();
+    if (partial_size < network_->minimum_split_size_) {
+      partial_size = std::min(GetBatchSize(), network_->minimum_split_size_);
+    }
+    while (split_starts_.back() < GetBatchSize()) {
+      networks.push_back(-1);
+      split_starts_.push_back(
+          std::min(GetBatchSize(), split_starts_.back() + partial_size));
+    }
   }
-  const int splits = (GetBatchSize() + partial_size_ - 1) / partial_size_;
+  const int splits = networks.size();
+  parents_.clear();
+  parents_.resize(splits);
 
   std::unique_lock<std::mutex> lock(mutex_);
   dataready_ = splits;
   for (int j = 0; j < splits; j++) {
-    network_->Enqueue(this);
+    network_->Enqueue({this, j, networks[j]});
   }
   dataready_cv_.wait(lock, [this]() { return dataready_ == 0; });
 }
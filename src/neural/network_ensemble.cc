@@ -0,0 +1,329 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+#include <queue>
+#include <thread>
+
+#include "neural/factory.h"
+#include "neural/loader.h"
+#include "utils/exception.h"
+#include "utils/tracing.h"
+
+namespace lczero {
+namespace {
+
+class EnsembleNetwork;
+
+// Evaluates every input on all the member networks and combines their
+// outputs. The planes are encoded once and copied to each member.
+class EnsembleComputation : public NetworkComputation {
+ public:
+  EnsembleComputation(EnsembleNetwork* network) : network_(network) {}
+
+  void AddInput(InputPlanes&& input) override {
+    inputs_.emplace_back(std::move(input));
+    moves_.emplace_back();
+  }
+
+  void AddInputWithMoves(InputPlanes&& input,
+                         const std::vector<uint16_t>& moves) override {
+    inputs_.emplace_back(std::move(input));
+    moves_.emplace_back(moves);
+  }
+
+  void ComputeBlocking() override;
+
+  int GetBatchSize() const override { return inputs_.size(); }
+
+  float GetQVal(int sample) const override;
+  float GetDVal(int sample) const override;
+  float GetMVal(int sample) const override;
+  // Weighted mean of the raw policies of the members. Only used for inputs
+  // added without their legal moves, whose probabilities can't be mixed.
+  float GetPVal(int sample, int move_id) const override;
+  // Log of the weighted mixture of the members' policies over the legal
+  // moves.
+  float GetLegalPVal(int sample, int move_ordinal,
+                     int move_id) const override;
+
+  // Computes the inputs on member @idx.
+  void ComputeMember(int idx);
+  void NotifyComplete();
+
+ private:
+  EnsembleNetwork* network_;
+  std::vector<InputPlanes> inputs_;
+  // Empty for inputs added without moves.
+  std::vector<std::vector<uint16_t>> moves_;
+  std::vector<std::unique_ptr<NetworkComputation>> members_;
+  // Log of the sum of the exponentiated legal policies of [member][sample],
+  // to normalize them before mixing.
+  std::vector<std::vector<float>> log_sums_;
+
+  std::mutex mutex_;
+  std::condition_variable done_cv_;
+  int pending_ = 0;
+};
+
+class EnsembleNetwork : public Network {
+ public:
+  EnsembleNetwork(const std::optional<WeightsFile>& weights,
+                  const OptionsDict& options) {
+    const auto members = options.ListSubdicts();
+    if (members.empty()) {
+      throw Exception(
+          "Ensemble backend needs the member networks in backend-opts, e.g. "
+          "a(backend=cuda,gpu=0),b(backend=cuda,gpu=1,weights_file=\"x.pb\")");
+    }
+    for (const auto& name : members) {
+      AddMember(name, weights, options.GetSubdict(name));
+    }
+    float total = 0.0f;
+    for (const float weight : weights_) total += weight;
+    if (!(total > 0.0f)) {
+      throw Exception("Ensemble member weights must have a positive sum.");
+    }
+    for (float& weight : weights_) weight /= total;
+    // The first member is computed by the thread running the computation.
+    for (size_t i = 1; i < networks_.size(); i++) {
+      threads_.emplace_back([this, i]() { Worker(i); });
+    }
+  }
+
+  ~EnsembleNetwork() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      abort_ = true;
+    }
+    cv_.notify_all();
+    for (auto& thread : threads_) thread.join();
+  }
+
+  void AddMember(const std::string& name,
+                 const std::optional<WeightsFile>& weights,
+                 const OptionsDict& opts) {
+    const std::string backend = opts.GetOrDefault<std::string>("backend", name);
+    const std::string weights_file =
+        opts.GetOrDefault<std::string>("weights_file", "");
+    networks_.emplace_back(NetworkFactory::Get()->Create(
+        backend,
+        weights_file.empty() ? weights
+                             : std::optional<WeightsFile>(
+                                   LoadWeightsFromFile(weights_file)),
+        opts));
+    weights_.push_back(opts.GetOrDefault<float>("weight", 1.0f));
+    queues_.emplace_back();
+
+    const auto& capabilities = networks_.back()->GetCapabilities();
+    min_batch_size_ =
+        std::min(min_batch_size_, networks_.back()->GetMiniBatchSize());
+    is_cpu_ &= networks_.back()->IsCpu();
+    if (networks_.size() == 1) {
+      capabilities_ = capabilities;
+    } else {
+      capabilities_.Merge(capabilities);
+      if (!capabilities_.has_mlh()) {
+        capabilities_.moves_left = capabilities.moves_left;
+      }
+    }
+  }
+
+  std::unique_ptr<NetworkComputation> NewComputation() override {
+    return std::make_unique<EnsembleComputation>(this);
+  }
+
+  const NetworkCapabilities& GetCapabilities() const override {
+    return capabilities_;
+  }
+
+  int GetMiniBatchSize() const override { return min_batch_size_; }
+
+  int GetThreads() const override { return 1; }
+
+  bool IsCpu() const override { return is_cpu_; }
+
+  int GetNumMembers() const { return networks_.size(); }
+  Network* GetMember(int idx) { return networks_[idx].get(); }
+  float GetWeight(int idx) const { return weights_[idx]; }
+  bool HasMovesLeft(int idx) const {
+    return networks_[idx]->GetCapabilities().has_mlh();
+  }
+
+  void Enqueue(int idx, EnsembleComputation* computation) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queues_[idx].push(computation);
+    }
+    cv_.notify_all();
+  }
+
+ private:
+  void Worker(int idx) {
+    LC0_TRACE_THREAD_NAME("ensemble backend");
+    while (true) {
+      EnsembleComputation* computation;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&]() { return abort_ || !queues_[idx].empty(); });
+        if (abort_) return;
+        computation = queues_[idx].front();
+        queues_[idx].pop();
+      }
+      computation->ComputeMember(idx);
+      computation->NotifyComplete();
+    }
+  }
+
+  std::vector<std::unique_ptr<Network>> networks_;
+  // Normalized to sum to one.
+  std::vector<float> weights_;
+  NetworkCapabilities capabilities_;
+  int min_batch_size_ = std::numeric_limits<int>::max();
+  bool is_cpu_ = true;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // Computations waiting for each member, the first one's is unused.
+  std::vector<std::queue<EnsembleComputation*>> queues_;
+  bool abort_ = false;
+  std::vector<std::thread> threads_;
+};
+
+void EnsembleComputation::ComputeBlocking() {
+  if (inputs_.empty()) return;
+  const int num_members = network_->GetNumMembers();
+  members_.resize(num_members);
+  log_sums_.assign(num_members, std::vector<float>(inputs_.size()));
+  for (int i = 0; i < num_members; i++) {
+    auto& member = members_[i];
+    member = network_->GetMember(i)->NewComputation();
+    member->SetPriority(GetPriority());
+    for (size_t j = 0; j < inputs_.size(); j++) {
+      InputPlanes planes = inputs_[j];
+      if (moves_[j].empty()) {
+        member->AddInput(std::move(planes));
+      } else {
+        member->AddInputWithMoves(std::move(planes), moves_[j]);
+      }
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_ = num_members - 1;
+  }
+  for (int i = 1; i < num_members; i++) network_->Enqueue(i, this);
+  ComputeMember(0);
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cv_.wait(lock, [this]() { return pending_ == 0; });
+}
+
+void EnsembleComputation::ComputeMember(int idx) {
+  LC0_TRACE_SCOPE("ensemble member compute");
+  auto& member = *members_[idx];
+  member.ComputeBlocking();
+  for (size_t j = 0; j < moves_.size(); j++) {
+    const auto& moves = moves_[j];
+    if (moves.empty()) continue;
+    float max_p = std::numeric_limits<float>::lowest();
+    for (size_t k = 0; k < moves.size(); k++) {
+      max_p = std::max(max_p, member.GetLegalPVal(j, k, moves[k]));
+    }
+    float sum = 0.0f;
+    for (size_t k = 0; k < moves.size(); k++) {
+      sum += std::exp(member.GetLegalPVal(j, k, moves[k]) - max_p);
+    }
+    log_sums_[idx][j] = max_p + std::log(sum);
+  }
+}
+
+void EnsembleComputation::NotifyComplete() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (--pending_ == 0) done_cv_.notify_one();
+}
+
+float EnsembleComputation::GetQVal(int sample) const {
+  float q = 0.0f;
+  for (size_t i = 0; i < members_.size(); i++) {
+    q += network_->GetWeight(i) * members_[i]->GetQVal(sample);
+  }
+  return q;
+}
+
+float EnsembleComputation::GetDVal(int sample) const {
+  float d = 0.0f;
+  for (size_t i = 0; i < members_.size(); i++) {
+    d += network_->GetWeight(i) * members_[i]->GetDVal(sample);
+  }
+  return d;
+}
+
+float EnsembleComputation::GetMVal(int sample) const {
+  // Members without a moves left head don't count.
+  float m = 0.0f;
+  float total = 0.0f;
+  for (size_t i = 0; i < members_.size(); i++) {
+    if (!network_->HasMovesLeft(i)) continue;
+    m += network_->GetWeight(i) * members_[i]->GetMVal(sample);
+    total += network_->GetWeight(i);
+  }
+  return total > 0.0f ? m / total : 0.0f;
+}
+
+float EnsembleComputation::GetPVal(int sample, int move_id) const {
+  float p = 0.0f;
+  for (size_t i = 0; i < members_.size(); i++) {
+    p += network_->GetWeight(i) * members_[i]->GetPVal(sample, move_id);
+  }
+  return p;
+}
+
+float EnsembleComputation::GetLegalPVal(int sample, int move_ordinal,
+                                        int move_id) const {
+  if (moves_[sample].empty()) return GetPVal(sample, move_id);
+  float p = 0.0f;
+  for (size_t i = 0; i < members_.size(); i++) {
+    p += network_->GetWeight(i) *
+         std::exp(members_[i]->GetLegalPVal(sample, move_ordinal, move_id) -
+                  log_sums_[i][sample]);
+  }
+  return std::log(std::max(p, std::numeric_limits<float>::min()));
+}
+
+std::unique_ptr<Network> MakeEnsembleNetwork(
+    const std::optional<WeightsFile>& weights, const OptionsDict& options) {
+  return std::make_unique<EnsembleNetwork>(weights, options);
+}
+
+REGISTER_NETWORK("ensemble", MakeEnsembleNetwork, -999)
+
+}  // namespace
+}  // namespace lczero
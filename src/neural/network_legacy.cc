@@ -19,13 +19,41 @@
 #include "neural/network_legacy.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <optional>
+#include <thread>
 
 #include "utils/weights_adapter.h"
 
 namespace lczero {
 namespace {
 static constexpr float kEpsilon = 1e-5f;
+
+// Decodes the blocks of a tower on all cores. The blocks are independent, and
+// together they hold nearly all the weights of a net.
+template <typename Block, typename Proto>
+std::vector<Block> DecodeTower(const std::vector<Proto>& protos) {
+  std::vector<std::optional<Block>> decoded(protos.size());
+  std::atomic<size_t> next{0};
+  auto worker = [&]() {
+    for (size_t i = next++; i < protos.size(); i = next++) {
+      decoded[i].emplace(protos[i]);
+    }
+  };
+  const size_t thread_count = std::min<size_t>(
+      protos.size(), std::max(1u, std::thread::hardware_concurrency()));
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < thread_count; i++) threads.emplace_back(worker);
+  worker();
+  for (auto& thread : threads) thread.join();
+
+  std::vector<Block> blocks;
+  blocks.reserve(decoded.size());
+  for (auto& block : decoded) blocks.push_back(std::move(*block));
+  return blocks;
+}
+
 }  // namespace
 
 LegacyWeights::LegacyWeights(const pblczero::Weights& weights)
@@ -59,17 +87,11 @@ LegacyWeights::LegacyWeights(const pblczero::Weights& weights)
       ip2_mov_b(LayerAdapter(weights.ip2_mov_b()).as_vector()),
       smolgen_w(LayerAdapter(weights.smolgen_w()).as_vector()),
       has_smolgen(weights.has_smolgen_w()) {
-  for (const auto& res : weights.residual()) {
-    residual.emplace_back(res);
-  }
+  residual = DecodeTower<Residual>(weights.residual());
   encoder_head_count = weights.headcount();
-  for (const auto& enc : weights.encoder()) {
-    encoder.emplace_back(enc);
-  }
+  encoder = DecodeTower<EncoderLayer>(weights.encoder());
   pol_encoder_head_count = weights.pol_headcount();
-  for (const auto& enc : weights.pol_encoder()) {
-    pol_encoder.emplace_back(enc);
-  }
+  pol_encoder = DecodeTower<EncoderLayer>(weights.pol_encoder());
 }
 
 LegacyWeights::SEunit::SEunit(const pblczero::Weights::SEunit& se)
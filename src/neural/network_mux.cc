@@ -25,18 +25,25 @@
   Program grant you additional permission to convey the resulting work.
 */
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <condition_variable>
-#include <queue>
 #include <thread>
+#include <utility>
 
 #include "neural/factory.h"
 #include "utils/exception.h"
+#include "utils/mpscqueue.h"
+#include "utils/numa.h"
+#include "utils/tracing.h"
 
 namespace lczero {
 namespace {
 
 class MuxingNetwork;
-class MuxingComputation : public NetworkComputation {
+class MuxingComputation : public NetworkComputation, public MpscQueueNode {
  public:
   MuxingComputation(MuxingNetwork* network) : network_(network) {}
 
@@ -75,6 +82,8 @@ class MuxingComputation : public NetworkComputation {
     dataready_cv_.notify_one();
   }
 
+  std::chrono::steady_clock::time_point enqueued_at_;
+
  private:
   std::vector<InputPlanes> planes_;
   MuxingNetwork* network_;
@@ -110,6 +119,13 @@ class MuxingNetwork : public Network {
                   const std::optional<WeightsFile>& weights,
                   const OptionsDict& opts) {
     const int max_batch = opts.GetOrDefault<int>("max_batch", 256);
+    // A batch is sent once it holds target_fill * max_batch positions, or
+    // max_wait microseconds after its oldest computation was queued.
+    const int target_batch = std::max(
+        1, static_cast<int>(std::lround(
+               opts.GetOrDefault<float>("target_fill", 1.0f) * max_batch)));
+    const std::chrono::microseconds max_wait(
+        opts.GetOrDefault<int>("max_wait", 0));
     const std::string backend = opts.GetOrDefault<std::string>("backend", name);
 
     networks_.emplace_back(
@@ -131,8 +147,9 @@ class MuxingNetwork : public Network {
     }
 
     for (int i = 0; i < nn_threads; ++i) {
-      threads_.emplace_back(
-          [this, net, max_batch]() { Worker(net, max_batch); });
+      threads_.emplace_back([this, net, max_batch, target_batch, max_wait]() {
+        Worker(net, max_batch, target_batch, max_wait);
+      });
     }
   }
 
@@ -150,23 +167,71 @@ class MuxingNetwork : public Network {
 
   bool IsCpu() const override { return is_cpu_; }
 
+  std::string GetPciBusId() const override {
+    return networks_.size() == 1 ? networks_[0]->GetPciBusId() : "";
+  }
+
   void Enqueue(MuxingComputation* computation) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    queue_.push(computation);
-    cv_.notify_one();
+    computation->enqueued_at_ = std::chrono::steady_clock::now();
+    queues_[static_cast<int>(computation->GetPriority())].Push(computation);
+    queued_.fetch_add(1);
+    // Only take the lock when a worker may be sleeping.
+    if (sleepers_.load() > 0) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      cv_.notify_one();
+    }
   }
 
   ~MuxingNetwork() {
     Abort();
     Wait();
     // Unstuck waiting computations.
-    while (!queue_.empty()) {
-      queue_.front()->NotifyReady();
-      queue_.pop();
+    if (carried_) carried_->NotifyReady();
+    while (auto computation = PopQueued()) computation->NotifyReady();
+  }
+
+  // Takes the next queued computation of the highest priority, if any. Must be
+  // called with consumer_mutex_ held.
+  MuxingComputation* PopQueued() {
+    for (auto& queue : queues_) {
+      if (auto computation = queue.Pop()) return computation;
     }
+    return nullptr;
   }
 
-  void Worker(Network* network, const int max_batch) {
+  // Takes the next computation, waiting for one until the deadline (or
+  // forever if there is none). Returns nullptr on timeout or abort. Must be
+  // called with consumer_mutex_ held.
+  MuxingComputation* Pop(
+      const std::chrono::steady_clock::time_point* deadline) {
+    if (carried_) return std::exchange(carried_, nullptr);
+    while (!abort_) {
+      if (auto computation = PopQueued()) {
+        queued_.fetch_sub(1);
+        return computation;
+      }
+      std::unique_lock<std::mutex> lock(mutex_);
+      sleepers_.fetch_add(1);
+      const auto ready = [&] { return abort_ || queued_.load() > 0; };
+      bool woken = true;
+      if (deadline) {
+        woken = cv_.wait_until(lock, *deadline, ready);
+      } else {
+        cv_.wait(lock, ready);
+      }
+      sleepers_.fetch_sub(1);
+      if (!woken) return nullptr;
+      // A producer that started earlier may still be linking its item.
+      if (!abort_) std::this_thread::yield();
+    }
+    return nullptr;
+  }
+
+  void Worker(Network* network, const int max_batch, const int target_batch,
+              const std::chrono::microseconds max_wait) {
+    LC0_TRACE_THREAD_NAME("multiplexing backend");
+    // Gathering and copying the batch is cheaper close to the GPU.
+    Numa::BindThreadNearDevice(network->GetPciBusId());
     // While Abort() is not called (and it can only be called from destructor).
     while (!abort_) {
       std::vector<MuxingComputation*> children;
@@ -174,31 +239,51 @@ class MuxingNetwork : public Network {
       // there.
       std::shared_ptr<NetworkComputation> parent(network->NewComputation());
       {
-        std::unique_lock<std::mutex> lock(mutex_);
+        LC0_TRACE_SCOPE("mux gather batch");
+        // Workers take turns as the single consumer of the queue.
+        std::lock_guard<std::mutex> lock(consumer_mutex_);
         // Wait until there's come work to compute.
-        cv_.wait(lock, [&] { return abort_ || !queue_.empty(); });
-        if (abort_) break;
-
-        // While there is a work in queue, add it.
-        while (!queue_.empty()) {
-          // If we are reaching batch size limit, stop adding.
-          // However, if a single input batch is larger than output batch limit,
-          // we still have to add it.
+        auto computation = Pop(nullptr);
+        if (!computation) break;
+        const auto deadline = computation->enqueued_at_ + max_wait;
+
+        while (computation) {
+          // If we are reaching batch size limit, stop adding and leave it for
+          // the next batch. However, if a single input batch is larger than
+          // output batch limit, we still have to add it.
           if (parent->GetBatchSize() != 0 &&
-              parent->GetBatchSize() + queue_.front()->GetBatchSize() >
+              parent->GetBatchSize() + computation->GetBatchSize() >
                   max_batch) {
+            carried_ = computation;
             break;
           }
           // Remember which of "input" computations we serve.
-          children.push_back(queue_.front());
-          queue_.pop();
+          children.push_back(computation);
           // Make "input" computation populate data into output batch.
-          children.back()->PopulateToParent(parent);
+          computation->PopulateToParent(parent);
+          if (parent->GetBatchSize() >= max_batch) break;
+          // Below the target fill, wait for more work until the deadline.
+          // Past either, only take what is already queued.
+          const auto now = std::chrono::steady_clock::now();
+          computation = Pop(parent->GetBatchSize() < target_batch &&
+                                    now < deadline
+                                ? &deadline
+                                : &now);
         }
       }
 
+      // The batch is as urgent as its most urgent part.
+      auto priority = ComputationPriority::kBackground;
+      for (auto child : children) {
+        priority = std::min(priority, child->GetPriority());
+      }
+      parent->SetPriority(priority);
+
       // Compute.
-      parent->ComputeBlocking();
+      {
+        LC0_TRACE_SCOPE("mux compute");
+        parent->ComputeBlocking();
+      }
       // Notify children that data is ready!
       for (auto child : children) child->NotifyReady();
     }
@@ -221,12 +306,22 @@ class MuxingNetwork : public Network {
 
  private:
   std::vector<std::unique_ptr<Network>> networks_;
-  std::queue<MuxingComputation*> queue_;
-  bool abort_ = false;
+  // One queue per ComputationPriority, the most urgent first.
+  std::array<MpscQueue<MuxingComputation>, kNumComputationPriorities>
+      queues_;
+  // Number of computations pushed and not yet popped.
+  std::atomic<int> queued_{0};
+  // Number of workers waiting on cv_.
+  std::atomic<int> sleepers_{0};
+  // Popped computation that didn't fit into the previous batch.
+  MuxingComputation* carried_ = nullptr;
+  std::atomic<bool> abort_{false};
   NetworkCapabilities capabilities_;
   int min_batch_size_ = std::numeric_limits<int>::max();
   bool is_cpu_ = true;
 
+  // Held by the worker that is gathering a batch.
+  std::mutex consumer_mutex_;
   std::mutex mutex_;
   std::condition_variable cv_;
 
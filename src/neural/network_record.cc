@@ -28,6 +28,7 @@
 #include <iostream>
 
 #include "neural/factory.h"
+#include "neural/trace.h"
 #include "utils/hashcat.h"
 
 namespace lczero {
@@ -36,8 +37,8 @@ namespace {
 class RecordComputation : public NetworkComputation {
  public:
   RecordComputation(std::unique_ptr<NetworkComputation>&& inner,
-                    const std::string& record_file)
-      : inner_(std::move(inner)), record_file_(record_file) {}
+                    const std::string& record_file, TraceWriter* trace)
+      : inner_(std::move(inner)), record_file_(record_file), trace_(trace) {}
   static uint64_t make_hash(const InputPlanes& input) {
     std::uint64_t hash = 0x2134435D4534LL;
     for (const auto& plane : input) {
@@ -54,10 +55,32 @@ class RecordComputation : public NetworkComputation {
     hashes_.push_back(make_hash(input));
     requests_.emplace_back();
     q_count_.push_back(0);
+    if (trace_) trace_batch_.inputs.push_back(input);
     inner_->AddInput(std::move(input));
   }
+  void SetPriority(ComputationPriority priority) override {
+    NetworkComputation::SetPriority(priority);
+    inner_->SetPriority(priority);
+  }
   // Do the computation.
-  void ComputeBlocking() override { inner_->ComputeBlocking(); }
+  void ComputeBlocking() override {
+    inner_->ComputeBlocking();
+    if (trace_) WriteTrace();
+  }
+  // Appends the batch with all its outputs to the trace.
+  void WriteTrace() {
+    const int batch_size = trace_batch_.inputs.size();
+    for (int i = 0; i < batch_size; i++) {
+      trace_batch_.q.push_back(inner_->GetQVal(i));
+      trace_batch_.d.push_back(inner_->GetDVal(i));
+      trace_batch_.m.push_back(inner_->GetMVal(i));
+      for (int j = 0; j < TraceBatch::kPolicySize; j++) {
+        trace_batch_.policy.push_back(inner_->GetPVal(i, j));
+      }
+    }
+    trace_->Write(trace_batch_);
+    trace_batch_ = {};
+  }
   // Returns how many times AddInput() was called.
   int GetBatchSize() const override { return inner_->GetBatchSize(); }
   float Capture(float value, int index) const {
@@ -83,6 +106,7 @@ class RecordComputation : public NetworkComputation {
     return Capture(inner_->GetMVal(sample), sample);
   }
   virtual ~RecordComputation() {
+    if (record_file_.empty()) return;
     Mutex::Lock lock(mutex_);
     std::fstream output(record_file_, std::ios::app | std::ios_base::binary);
     for (size_t i = 0; i < hashes_.size(); i++) {
@@ -99,6 +123,8 @@ class RecordComputation : public NetworkComputation {
   }
   std::unique_ptr<NetworkComputation> inner_;
   std::string record_file_;
+  TraceWriter* trace_;
+  TraceBatch trace_batch_;
   std::vector<uint64_t> hashes_;
   mutable std::vector<int> q_count_;
   mutable std::vector<std::vector<float>> requests_;
@@ -172,6 +198,10 @@ class RecordReplayNetwork : public Network {
     }
     replay_file_ = options.GetOrDefault<std::string>("replay_file", "");
     record_file_ = options.GetOrDefault<std::string>("record_file", "");
+    // Batches with all their outputs, to replay with "backendbench".
+    const auto trace_file =
+        options.GetOrDefault<std::string>("trace_file", "");
+    if (!trace_file.empty()) trace_ = std::make_unique<TraceWriter>(trace_file);
     if (replay_file_.size() > 0) {
       lookup_ =
           std::make_unique<std::unordered_map<uint64_t, std::vector<float>>>();
@@ -217,7 +247,8 @@ class RecordReplayNetwork : public Network {
     if (!lookup_) {
       const long long val = ++counter_;
       return std::make_unique<RecordComputation>(
-          networks_[val % networks_.size()]->NewComputation(), record_file_);
+          networks_[val % networks_.size()]->NewComputation(), record_file_,
+          trace_.get());
     }
     return std::make_unique<ReplayComputation>(lookup_.get());
   }
@@ -234,6 +265,7 @@ class RecordReplayNetwork : public Network {
   NetworkCapabilities capabilities_;
   std::string replay_file_;
   std::string record_file_;
+  std::unique_ptr<TraceWriter> trace_;
   std::unique_ptr<std::unordered_map<uint64_t, std::vector<float>>> lookup_;
 };
 
@@ -35,6 +35,62 @@
 namespace lczero {
 namespace {
 
+class RoundRobinNetwork;
+
+// Defers the choice of the child network until the computation is run, when
+// its priority is known.
+class RoundRobinComputation : public NetworkComputation {
+ public:
+  RoundRobinComputation(RoundRobinNetwork* network) : network_(network) {}
+  ~RoundRobinComputation();
+
+  void AddInput(InputPlanes&& input) override {
+    inputs_.emplace_back(std::move(input));
+    moves_.emplace_back();
+  }
+
+  void AddInputWithMoves(InputPlanes&& input,
+                         const std::vector<uint16_t>& moves) override {
+    inputs_.emplace_back(std::move(input));
+    moves_.emplace_back(moves);
+  }
+
+  void ComputeBlocking() override {
+    Submit();
+    Wait();
+  }
+
+  void Submit() override;
+
+  void Wait() override;
+
+  int GetBatchSize() const override { return batch_size_ + inputs_.size(); }
+
+  float GetQVal(int sample) const override { return child_->GetQVal(sample); }
+
+  float GetDVal(int sample) const override { return child_->GetDVal(sample); }
+
+  float GetPVal(int sample, int move_id) const override {
+    return child_->GetPVal(sample, move_id);
+  }
+
+  float GetMVal(int sample) const override { return child_->GetMVal(sample); }
+
+  float GetLegalPVal(int sample, int move_ordinal,
+                     int move_id) const override {
+    return child_->GetLegalPVal(sample, move_ordinal, move_id);
+  }
+
+ private:
+  RoundRobinNetwork* network_;
+  std::vector<InputPlanes> inputs_;
+  // Empty for inputs added without moves.
+  std::vector<std::vector<uint16_t>> moves_;
+  int batch_size_ = 0;
+  std::unique_ptr<NetworkComputation> child_;
+  int child_idx_ = -1;
+};
+
 class RoundRobinNetwork : public Network {
  public:
   RoundRobinNetwork(const std::optional<WeightsFile>& weights,
@@ -59,6 +115,7 @@ class RoundRobinNetwork : public Network {
 
     networks_.emplace_back(
         NetworkFactory::Get()->Create(backend, weights, opts));
+    in_flight_.emplace_back(std::make_unique<std::atomic<int>>(0));
 
     min_batch_size_ =
         std::min(min_batch_size_, networks_.back()->GetMiniBatchSize());
@@ -72,10 +129,28 @@ class RoundRobinNetwork : public Network {
   }
 
   std::unique_ptr<NetworkComputation> NewComputation() override {
+    return std::make_unique<RoundRobinComputation>(this);
+  }
+
+  // Critical computations go to the least busy child, the others take turns.
+  int PickNetwork(ComputationPriority priority) {
     const long long val = ++counter_;
-    return networks_[val % networks_.size()]->NewComputation();
+    int idx = val % networks_.size();
+    if (priority == ComputationPriority::kCritical) {
+      for (size_t i = 0; i < networks_.size(); i++) {
+        if (*in_flight_[i] < *in_flight_[idx]) idx = i;
+      }
+    }
+    ++*in_flight_[idx];
+    return idx;
   }
 
+  std::unique_ptr<NetworkComputation> NewChildComputation(int idx) {
+    return networks_[idx]->NewComputation();
+  }
+
+  void ReleaseNetwork(int idx) { --*in_flight_[idx]; }
+
   const NetworkCapabilities& GetCapabilities() const override {
     return capabilities_;
   }
@@ -86,16 +161,52 @@ class RoundRobinNetwork : public Network {
 
   bool IsCpu() const override { return is_cpu_; }
 
+  std::string GetPciBusId() const override {
+    return networks_.size() == 1 ? networks_[0]->GetPciBusId() : "";
+  }
+
   ~RoundRobinNetwork() {}
 
  private:
   std::vector<std::unique_ptr<Network>> networks_;
+  // Computations submitted to each child and not waited for yet.
+  std::vector<std::unique_ptr<std::atomic<int>>> in_flight_;
   std::atomic<long long> counter_;
   NetworkCapabilities capabilities_;
   int min_batch_size_ = std::numeric_limits<int>::max();
   bool is_cpu_ = true;
 };
 
+RoundRobinComputation::~RoundRobinComputation() {
+  // Submitted but never waited for.
+  if (child_idx_ >= 0) {
+    network_->ReleaseNetwork(child_idx_);
+  }
+}
+
+void RoundRobinComputation::Submit() {
+  child_idx_ = network_->PickNetwork(GetPriority());
+  child_ = network_->NewChildComputation(child_idx_);
+  child_->SetPriority(GetPriority());
+  for (size_t i = 0; i < inputs_.size(); i++) {
+    if (moves_[i].empty()) {
+      child_->AddInput(std::move(inputs_[i]));
+    } else {
+      child_->AddInputWithMoves(std::move(inputs_[i]), moves_[i]);
+    }
+  }
+  batch_size_ += inputs_.size();
+  inputs_.clear();
+  moves_.clear();
+  child_->Submit();
+}
+
+void RoundRobinComputation::Wait() {
+  child_->Wait();
+  network_->ReleaseNetwork(child_idx_);
+  child_idx_ = -1;
+}
+
 std::unique_ptr<Network> MakeRoundRobinNetwork(
     const std::optional<WeightsFile>& weights, const OptionsDict& options) {
   return std::make_unique<RoundRobinNetwork>(weights, options);
@@ -0,0 +1,168 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "neural/factory.h"
+#include "utils/logging.h"
+#include "utils/random.h"
+
+namespace lczero {
+namespace {
+
+// A backend that takes as long as a real one would, to benchmark the search
+// without a GPU. A batch of n samples takes fixed_us microseconds plus n times
+// sample_ns nanoseconds, scaled by a uniform random factor in [1 - jitter,
+// 1 + jitter], and at most concurrency batches are computed at once, the
+// others waiting for their turn as on a busy device. The outputs come from
+// the backend named by outputs, "random" by default, expected to be fast.
+class SyntheticNetwork;
+
+class SyntheticComputation : public NetworkComputation {
+ public:
+  SyntheticComputation(SyntheticNetwork* network,
+                       std::unique_ptr<NetworkComputation> inner)
+      : network_(network), inner_(std::move(inner)) {}
+
+  void AddInput(InputPlanes&& input) override {
+    inner_->AddInput(std::move(input));
+  }
+  void SetPriority(ComputationPriority priority) override {
+    NetworkComputation::SetPriority(priority);
+    inner_->SetPriority(priority);
+  }
+  void ComputeBlocking() override;
+  int GetBatchSize() const override { return inner_->GetBatchSize(); }
+  float GetQVal(int sample) const override { return inner_->GetQVal(sample); }
+  float GetDVal(int sample) const override { return inner_->GetDVal(sample); }
+  float GetPVal(int sample, int move_id) const override {
+    return inner_->GetPVal(sample, move_id);
+  }
+  float GetMVal(int sample) const override { return inner_->GetMVal(sample); }
+
+ private:
+  SyntheticNetwork* const network_;
+  std::unique_ptr<NetworkComputation> inner_;
+};
+
+class SyntheticNetwork : public Network {
+ public:
+  SyntheticNetwork(const std::optional<WeightsFile>& weights,
+                   const OptionsDict& options)
+      : fixed_us_(options.GetOrDefault<int>("fixed_us", 2000)),
+        sample_ns_(options.GetOrDefault<int>("sample_ns", 10000)),
+        jitter_(options.GetOrDefault<float>("jitter", 0.05f)),
+        free_slots_(options.GetOrDefault<int>("concurrency", 1)),
+        threads_(free_slots_),
+        minibatch_size_(options.GetOrDefault<int>("minibatch_size", 256)) {
+    if (fixed_us_ < 0 || sample_ns_ < 0) {
+      throw Exception("Synthetic backend latencies must not be negative.");
+    }
+    if (jitter_ < 0.0f || jitter_ > 1.0f) {
+      throw Exception("Synthetic backend jitter must be in [0, 1].");
+    }
+    if (free_slots_ < 1) {
+      throw Exception("Synthetic backend concurrency must be at least 1.");
+    }
+    // Not "backend", which may be what selected this one in a parent.
+    const std::string backend =
+        options.GetOrDefault<std::string>("outputs", "random");
+    inner_ = NetworkFactory::Get()->Create(backend, weights, options);
+    CERR << "Synthetic backend: " << fixed_us_ << "us + " << sample_ns_
+         << "ns per sample, " << jitter_ * 100.0f << "% jitter, "
+         << free_slots_ << " concurrent batch(es), outputs from " << backend
+         << ".";
+  }
+
+  std::unique_ptr<NetworkComputation> NewComputation() override {
+    return std::make_unique<SyntheticComputation>(this,
+                                                  inner_->NewComputation());
+  }
+  const NetworkCapabilities& GetCapabilities() const override {
+    return inner_->GetCapabilities();
+  }
+  int GetThreads() const override { return threads_; }
+  int GetMiniBatchSize() const override { return minibatch_size_; }
+
+  // Time a batch of @batch_size samples takes.
+  std::chrono::nanoseconds GetLatency(int batch_size) const {
+    double factor = 1.0;
+    if (jitter_ > 0.0f) {
+      factor += Random::Get().GetDouble(2.0 * jitter_) - jitter_;
+    }
+    return std::chrono::nanoseconds(static_cast<long long>(
+        (1000.0 * fixed_us_ + 1.0 * sample_ns_ * batch_size) * factor));
+  }
+
+  void AcquireSlot() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [&]() { return free_slots_ > 0; });
+    --free_slots_;
+  }
+
+  void ReleaseSlot() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++free_slots_;
+    }
+    cv_.notify_one();
+  }
+
+ private:
+  const int fixed_us_;
+  const int sample_ns_;
+  const float jitter_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  int free_slots_;
+  const int threads_;
+  const int minibatch_size_;
+  std::unique_ptr<Network> inner_;
+};
+
+void SyntheticComputation::ComputeBlocking() {
+  network_->AcquireSlot();
+  const auto done = std::chrono::steady_clock::now() +
+                    network_->GetLatency(inner_->GetBatchSize());
+  inner_->ComputeBlocking();
+  std::this_thread::sleep_until(done);
+  network_->ReleaseSlot();
+}
+
+std::unique_ptr<Network> MakeSyntheticNetwork(
+    const std::optional<WeightsFile>& weights, const OptionsDict& options) {
+  return std::make_unique<SyntheticNetwork>(weights, options);
+}
+
+REGISTER_NETWORK("synthetic", MakeSyntheticNetwork, -999)
+
+}  // namespace
+}  // namespace lczero
@@ -26,11 +26,15 @@
 */
 
 #include "layers.h"
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <cstring>
+#include <fstream>
 #include <vector>
 
+#include "utils/logging.h"
+
 namespace lczero {
 
 namespace onednn_backend {
@@ -46,6 +50,89 @@ BaseLayer::BaseLayer(int c, int h, int w, BaseLayer* ip)
   }
 }
 
+PrimitiveCache& PrimitiveCache::Get() {
+  static PrimitiveCache cache;
+  return cache;
+}
+
+void PrimitiveCache::Load(const std::string& filename) {
+  std::lock_guard<std::mutex> lock(lock_);
+  filename_ = filename;
+  std::ifstream file(filename, std::ios::binary);
+  if (!file) return;
+  // Records of the id and the kernel, each one as its size and bytes.
+  auto read = [&](std::vector<uint8_t>& data) {
+    uint64_t size = 0;
+    if (!file.read(reinterpret_cast<char*>(&size), sizeof(size))) return false;
+    data.resize(size);
+    return static_cast<bool>(
+        file.read(reinterpret_cast<char*>(data.data()), size));
+  };
+  std::vector<uint8_t> id;
+  std::vector<uint8_t> blob;
+  while (read(id) && read(blob)) blobs_.emplace(id, blob);
+}
+
+void PrimitiveCache::Save() {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (filename_.empty() || !dirty_) return;
+  std::ofstream file(filename_, std::ios::binary);
+  auto write = [&](const std::vector<uint8_t>& data) {
+    const uint64_t size = data.size();
+    file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    file.write(reinterpret_cast<const char*>(data.data()), size);
+  };
+  for (const auto& entry : blobs_) {
+    write(entry.first);
+    write(entry.second);
+  }
+  // Not worth an error, the kernels are just compiled again next time.
+  if (!file) CERR << "Unable to write the primitive cache to " << filename_;
+  dirty_ = false;
+}
+
+void Int8Context::AddSlot(int slot) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (static_cast<int>(ranges_.size()) <= slot) ranges_.resize(slot + 1, 0.0f);
+}
+
+void Int8Context::Record(int slot, float range) {
+  std::lock_guard<std::mutex> lock(lock_);
+  ranges_[slot] = std::max(ranges_[slot], range);
+}
+
+float Int8Context::GetRange(int slot) const {
+  std::lock_guard<std::mutex> lock(lock_);
+  return ranges_[slot];
+}
+
+bool Int8Context::Load(const std::string& filename) {
+  std::ifstream file(filename);
+  if (!file) return false;
+  std::lock_guard<std::mutex> lock(lock_);
+  size_t count = 0;
+  file >> count;
+  if (!file || count != ranges_.size()) {
+    throw Exception("Int8 scales in " + filename +
+                    " are not for this network.");
+  }
+  for (auto& range : ranges_) {
+    if (!(file >> range)) throw Exception("Bad int8 scales in " + filename);
+  }
+  calibrated_.store(true, std::memory_order_release);
+  return true;
+}
+
+void Int8Context::Save(const std::string& filename) const {
+  std::lock_guard<std::mutex> lock(lock_);
+  std::ofstream file(filename);
+  file << ranges_.size() << "\n";
+  for (auto range : ranges_) file << range << "\n";
+  if (!file) {
+    throw Exception("Unable to write int8 scales to " + filename);
+  }
+}
+
 ConvLayer::ConvLayer(BaseLayer* ip, int C, int H, int W, int filter, int Cin,
                      ActivationFunction activation, bool skip)
     : BaseLayer(C, H, W, ip),
@@ -68,27 +155,56 @@ void ConvLayer::LoadWeights(dnnl::memory& w1, dnnl::memory& b1,
   dnnl::reorder(b1, bias_mem).execute(stream, b1, bias_mem);
 }
 
+void ConvLayer::EnableInt8(Int8Context* context, int slot) {
+  int8_context_ = context;
+  int8_slot_ = slot;
+  context->AddSlot(slot);
+  // Symmetric per output channel quantization of the oihw weights.
+  const float* weights =
+      static_cast<const float*>(filter_mem.get_data_handle());
+  const int filter_len = c_input_ * filter_size_ * filter_size_;
+  weight_scales_.resize(C);
+  for (int k = 0; k < C; k++) {
+    float range = 0.0f;
+    for (int i = 0; i < filter_len; i++) {
+      range = std::max(range, std::abs(weights[k * filter_len + i]));
+    }
+    weight_scales_[k] = range > 0.0f ? 127.0f / range : 1.0f;
+  }
+}
+
 void ConvLayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
                      dnnl::engine& eng, dnnl::stream& stream) {
   std::lock_guard<std::mutex> lock(lock_);
-  if (last_batch_ != N) {
-    auto t_in_md = dnnl::memory::desc({N, c_input_, H, W}, data_type_,
+  const bool int8 = int8_context_ && int8_context_->IsCalibrated();
+  float input_scale = 1.0f;
+  if (int8) {
+    const float range = int8_context_->GetRange(int8_slot_);
+    if (range > 0.0f) input_scale = 127.0f / range;
+  }
+  if (last_batch_ != N || int8 != int8_primitive_) {
+    // Int8 convolutions take quantized inputs and weights, but keep the bias
+    // and output in float so that the rest of the network is unchanged.
+    const auto in_type = int8 ? dnnl::memory::data_type::s8 : data_type_;
+    auto t_in_md = dnnl::memory::desc({N, c_input_, H, W}, in_type,
                                       dnnl::memory::format_tag::any);
 
     auto t_filter_md =
-        dnnl::memory::desc({C, c_input_, filter_size_, filter_size_},
-                           data_type_, dnnl::memory::format_tag::any);
+        dnnl::memory::desc({C, c_input_, filter_size_, filter_size_}, in_type,
+                           dnnl::memory::format_tag::any);
 
     auto t_out_md = dnnl::memory::desc({N, C, H, W}, data_type_,
                                        dnnl::memory::format_tag::any);
 
     const int padding = filter_size_ / 2;
+    auto algorithm = filter_size_ == 3 ? convolution_type_
+                                       : dnnl::algorithm::convolution_auto;
+    // There is no int8 Winograd convolution.
+    if (int8) algorithm = dnnl::algorithm::convolution_direct;
     auto conv_d = dnnl::convolution_forward::desc(
-        dnnl::prop_kind::forward_inference,
-        filter_size_ == 3 ? convolution_type_
-                          : dnnl::algorithm::convolution_auto,
-        t_in_md, t_filter_md, bias_mem.get_desc(), t_out_md, {1, 1},
-        {padding, padding}, {padding, padding});
+        dnnl::prop_kind::forward_inference, algorithm, t_in_md, t_filter_md,
+        bias_mem.get_desc(), t_out_md, {1, 1}, {padding, padding},
+        {padding, padding});
     dnnl::post_ops conv_ops;
     if (use_skip_) {
       conv_ops.append_sum();
@@ -101,10 +217,18 @@ void ConvLayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     dnnl::primitive_attr conv_attr;
     conv_attr.set_scratchpad_mode(dnnl::scratchpad_mode::user);
     conv_attr.set_post_ops(conv_ops);
+    if (int8) {
+      // Dequantize the accumulators per output channel.
+      std::vector<float> output_scales(C);
+      for (int k = 0; k < C; k++) {
+        output_scales[k] = 1.0f / (input_scale * weight_scales_[k]);
+      }
+      conv_attr.set_output_scales(1 << 1, output_scales);
+    }
     auto conv_pd =
         dnnl::convolution_forward::primitive_desc(conv_d, conv_attr, eng);
     auto scratchpad_md = conv_pd.scratchpad_desc();
-    conv_ = dnnl::convolution_forward(conv_pd);
+    conv_ = PrimitiveCache::Get().Create<dnnl::convolution_forward>(conv_pd);
 
     in_md = conv_pd.src_desc();
     out_md = conv_pd.dst_desc();
@@ -129,14 +253,20 @@ void ConvLayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
       // This may be a transformation for Winograd convolution, so keep the
       // original weights.
       conv_filter_mem = dnnl::memory(conv_pd.weights_desc(), eng);
-      dnnl::reorder(filter_mem, conv_filter_mem)
+      dnnl::primitive_attr filter_attr;
+      if (int8) filter_attr.set_output_scales(1 << 0, weight_scales_);
+      dnnl::reorder(
+          dnnl::reorder::primitive_desc(filter_mem, conv_filter_mem,
+                                        filter_attr))
           .execute(stream, filter_mem, conv_filter_mem);
     }
 
     dnnl::primitive_attr reorder_attr;
     reorder_attr.set_scratchpad_mode(dnnl::scratchpad_mode::user);
+    dnnl::primitive_attr in_reorder_attr = reorder_attr;
+    if (int8) in_reorder_attr.set_output_scales(0, {input_scale});
     auto in_reorder_pd = dnnl::reorder::primitive_desc(
-        eng, input.get_desc(), eng, in_md, reorder_attr);
+        eng, input.get_desc(), eng, in_md, in_reorder_attr);
     in_reorder_ = dnnl::reorder(in_reorder_pd);
     if (scratchpad_md.get_size() < in_reorder_pd.scratchpad_desc().get_size()) {
       scratchpad_md = in_reorder_pd.scratchpad_desc();
@@ -155,14 +285,29 @@ void ConvLayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     scratchpad_mem = dnnl::memory(scratchpad_md, eng);
 
     last_batch_ = N;
+    int8_primitive_ = int8;
   }
 
+  // The quantized input is only for this convolution, the caller may still
+  // need the float one.
+  dnnl::memory conv_input = input;
   if (in_md != input.get_desc()) {
     auto tmp = dnnl::memory(in_md, eng);
     in_reorder_.execute(stream, {{DNNL_ARG_SRC, input},
                                  {DNNL_ARG_DST, tmp},
                                  {DNNL_ARG_SCRATCHPAD, scratchpad_mem}});
-    input = tmp;
+    conv_input = tmp;
+    if (!int8) input = tmp;
+  }
+
+  if (int8_context_ && !int8) {
+    // Calibrating, the input has to be computed before it's read.
+    stream.wait();
+    const float* data = static_cast<const float*>(input.get_data_handle());
+    const size_t len = input.get_desc().get_size() / sizeof(float);
+    float range = 0.0f;
+    for (size_t i = 0; i < len; i++) range = std::max(range, std::abs(data[i]));
+    int8_context_->Record(int8_slot_, range);
   }
 
   if (!output || out_md != output.get_desc()) {
@@ -177,7 +322,7 @@ void ConvLayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     }
   }
 
-  conv_.execute(stream, {{DNNL_ARG_SRC, input},
+  conv_.execute(stream, {{DNNL_ARG_SRC, conv_input},
                          {DNNL_ARG_WEIGHTS, conv_filter_mem},
                          {DNNL_ARG_BIAS, bias_mem},
                          {DNNL_ARG_DST, output},
@@ -275,7 +420,7 @@ void SELayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     fc_attr.set_post_ops(fc_ops);
     auto fc_pd =
         dnnl::inner_product_forward::primitive_desc(fc_d, fc_attr, eng);
-    fc_ = dnnl::inner_product_forward(fc_pd);
+    fc_ = PrimitiveCache::Get().Create<dnnl::inner_product_forward>(fc_pd);
     if (scratchpad_md.get_size() < fc_pd.scratchpad_desc().get_size()) {
       scratchpad_md = fc_pd.scratchpad_desc();
     }
@@ -295,7 +440,7 @@ void SELayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     fc2_attr.set_scratchpad_mode(dnnl::scratchpad_mode::user);
     auto fc2_pd =
         dnnl::inner_product_forward::primitive_desc(fc2_d, fc2_attr, eng);
-    fc2_ = dnnl::inner_product_forward(fc2_pd);
+    fc2_ = PrimitiveCache::Get().Create<dnnl::inner_product_forward>(fc2_pd);
     if (scratchpad_md.get_size() < fc2_pd.scratchpad_desc().get_size()) {
       scratchpad_md = fc2_pd.scratchpad_desc();
     }
@@ -519,7 +664,7 @@ void FCLayer::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     fc_attr.set_post_ops(fc_ops);
     auto fc_pd =
         dnnl::inner_product_forward::primitive_desc(fc_d, fc_attr, eng);
-    fc_ = dnnl::inner_product_forward(fc_pd);
+    fc_ = PrimitiveCache::Get().Create<dnnl::inner_product_forward>(fc_pd);
     auto scratchpad_md = fc_pd.scratchpad_desc();
 
     in_md = fc_pd.src_desc();
@@ -627,7 +772,7 @@ void AttentionPolicyHead::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     fc_attr.set_post_ops(fc_ops);
     auto fc_pd =
         dnnl::inner_product_forward::primitive_desc(fc_d, fc_attr, eng);
-    fc_ = dnnl::inner_product_forward(fc_pd);
+    fc_ = PrimitiveCache::Get().Create<dnnl::inner_product_forward>(fc_pd);
     auto scratchpad_md = fc_pd.scratchpad_desc();
 
     // Q
@@ -642,7 +787,7 @@ void AttentionPolicyHead::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     common_attr.set_scratchpad_mode(dnnl::scratchpad_mode::user);
     auto fcQK_pd =
         dnnl::inner_product_forward::primitive_desc(fcQK_d, common_attr, eng);
-    fcQK_ = dnnl::inner_product_forward(fcQK_pd);
+    fcQK_ = PrimitiveCache::Get().Create<dnnl::inner_product_forward>(fcQK_pd);
     if (scratchpad_md.get_size() < fcQK_pd.scratchpad_desc().get_size()) {
       scratchpad_md = fcQK_pd.scratchpad_desc();
     }
@@ -661,7 +806,7 @@ void AttentionPolicyHead::Eval(int N, dnnl::memory& output, dnnl::memory& input,
     mul_attr.set_scratchpad_mode(dnnl::scratchpad_mode::user);
     mul_attr.set_output_scales(0, {1.0f / scaling});
     auto mul_pd = dnnl::matmul::primitive_desc(mul_d, mul_attr, eng);
-    mul_ = dnnl::matmul(mul_pd);
+    mul_ = PrimitiveCache::Get().Create<dnnl::matmul>(mul_pd);
     if (scratchpad_md.get_size() < mul_pd.scratchpad_desc().get_size()) {
       scratchpad_md = mul_pd.scratchpad_desc();
     }
@@ -686,7 +831,7 @@ void AttentionPolicyHead::Eval(int N, dnnl::memory& output, dnnl::memory& input,
           mul_B_md.submemory_desc({N, policy_d_model_, 8}, {0, 0, 0}),
           mul_A_md.submemory_desc({N, 4, 8}, {0, 0, 0}));
       auto pmul_pd = dnnl::matmul::primitive_desc(pmul_d, common_attr, eng);
-      pmul_ = dnnl::matmul(pmul_pd);
+      pmul_ = PrimitiveCache::Get().Create<dnnl::matmul>(pmul_pd);
       if (scratchpad_md.get_size() < pmul_pd.scratchpad_desc().get_size()) {
         scratchpad_md = pmul_pd.scratchpad_desc();
       }
@@ -705,7 +850,7 @@ void AttentionPolicyHead::Eval(int N, dnnl::memory& output, dnnl::memory& input,
           mul_B_md.submemory_desc({N, policy_d_model_, 8}, {0, 0, 56}),
           promo_md);
       auto pmul_pd = dnnl::matmul::primitive_desc(pmul_d, common_attr, eng);
-      pmul_ = dnnl::matmul(pmul_pd);
+      pmul_ = PrimitiveCache::Get().Create<dnnl::matmul>(pmul_pd);
       if (scratchpad_md.get_size() < pmul_pd.scratchpad_desc().get_size()) {
         scratchpad_md = pmul_pd.scratchpad_desc();
       }
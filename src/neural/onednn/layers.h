@@ -26,6 +26,13 @@
 */
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
 #include "neural/shared/activation.h"
 #include "utils/exception.h"
 
@@ -62,6 +69,75 @@ class BaseLayer {
   std::mutex lock_;
 };
 
+// Compiled kernels of the primitives, kept across runs in a file so that they
+// are not compiled again. oneDNN only has them for gpu engines, on the cpu
+// primitives are always built from scratch.
+class PrimitiveCache {
+ public:
+  static PrimitiveCache& Get();
+
+  // Reads the kernels saved in @filename, if any, and saves to it from then
+  // on.
+  void Load(const std::string& filename);
+  // Writes the kernels to the file, if some were compiled since it was read.
+  void Save();
+
+  template <typename Primitive>
+  Primitive Create(const typename Primitive::primitive_desc& pd) {
+#if DNNL_VERSION_MAJOR * 100 + DNNL_VERSION_MINOR >= 207
+    const auto id = pd.get_cache_blob_id();
+    if (!id.empty()) {
+      {
+        std::lock_guard<std::mutex> lock(lock_);
+        if (filename_.empty()) return Primitive(pd);
+        auto it = blobs_.find(id);
+        if (it != blobs_.end()) return Primitive(pd, it->second);
+      }
+      Primitive primitive(pd);
+      std::lock_guard<std::mutex> lock(lock_);
+      blobs_[id] = primitive.get_cache_blob();
+      dirty_ = true;
+      return primitive;
+    }
+#endif
+    return Primitive(pd);
+  }
+
+ private:
+  std::mutex lock_;
+  std::string filename_;
+  bool dirty_ = false;
+  std::map<std::vector<uint8_t>, std::vector<uint8_t>> blobs_;
+};
+
+// The int8 mode of a network. Its convolutions record the range of their
+// inputs while the network still computes in float, until the calibration is
+// finished and they switch to int8 primitives. Ranges are kept per position of
+// the convolution in a layer stack, so the stacks of all batch sizes share
+// them. They can be saved and loaded to skip the calibration.
+class Int8Context {
+ public:
+  // Makes room for the range of convolution @slot.
+  void AddSlot(int slot);
+  void Record(int slot, float range);
+  float GetRange(int slot) const;
+  bool IsCalibrated() const {
+    return calibrated_.load(std::memory_order_acquire);
+  }
+  void FinishCalibration() {
+    calibrated_.store(true, std::memory_order_release);
+  }
+  // Loads the input ranges in @filename and finishes the calibration. Returns
+  // false if there's no such file, throws if it's not for this network.
+  bool Load(const std::string& filename);
+  void Save(const std::string& filename) const;
+
+ private:
+  mutable std::mutex lock_;
+  std::vector<float> ranges_;
+  std::atomic<bool> calibrated_{false};
+};
+
 class ConvLayer : public BaseLayer {
  public:
   ConvLayer(BaseLayer* ip, int C, int H, int W, int size, int Cin,
@@ -70,6 +146,10 @@ class ConvLayer : public BaseLayer {
   void LoadWeights(dnnl::memory& w1, dnnl::memory& b1, dnnl::engine& eng,
                    dnnl::stream& stream);
 
+  // Computes in int8 once @context is calibrated, the input range being the
+  // one of @slot. Only for float layers on the cpu.
+  void EnableInt8(Int8Context* context, int slot);
+
   // If there is a skip connection the output doubles as an input.
   void Eval(int N, dnnl::memory& output, dnnl::memory& input, dnnl::engine& eng,
             dnnl::stream& stream) override;
@@ -80,6 +160,13 @@ class ConvLayer : public BaseLayer {
   const ActivationFunction activation_;
   const bool use_skip_;
 
+  Int8Context* int8_context_ = nullptr;
+  int int8_slot_ = 0;
+  // Per output channel, the factor quantizing the weights to int8.
+  std::vector<float> weight_scales_;
+  // Whether the cached primitives are the int8 ones.
+  bool int8_primitive_ = false;
+
   dnnl::memory filter_mem;       // The original weights.
   dnnl::memory conv_filter_mem;  // Transformed weights (maybe for Winograd).
   dnnl::memory bias_mem;
@@ -25,20 +25,24 @@
   Program grant you additional permission to convey the resulting work.
 */
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cmath>
 #include <functional>
 #include <list>
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <thread>
 
 #include "layers.h"
+#include "neural/batch_buckets.h"
 #include "neural/factory.h"
 #include "neural/network_legacy.h"
-#include "neural/shared/attention_policy_map.h"
-#include "neural/shared/policy_map.h"
+#include "neural/shared/policy.h"
 #include "utils/bititer.h"
 #include "utils/exception.h"
+#include "utils/logging.h"
 
 #include <omp.h>
 
@@ -105,6 +109,17 @@ class OnednnNetworkComputation : public NetworkComputation {
     batch_size_++;
   }
 
+  bool CanAddInputInPlace() const override { return true; }
+
+  InputBuffers AddInputInPlace(
+      const std::vector<uint16_t>& /*moves*/) override {
+    const InputBuffers buffers{
+        &inputs_outputs_->input_masks_mem_[batch_size_ * kInputPlanes],
+        &inputs_outputs_->input_val_mem_[batch_size_ * kInputPlanes]};
+    batch_size_++;
+    return buffers;
+  }
+
   void ComputeBlocking() override;
 
   int GetBatchSize() const override { return batch_size_; }
@@ -172,6 +187,10 @@ class OnednnNetwork : public Network {
     dnnl::set_primitive_cache_capacity(
         options.GetOrDefault<int>("jit_cache", 1024));
 #endif
+    // Compiled gpu kernels persist in this file between runs.
+    const auto primitive_cache =
+        options.GetOrDefault<std::string>("primitive_cache", "");
+    if (!primitive_cache.empty()) PrimitiveCache::Get().Load(primitive_cache);
 
     if (!options.IsDefault<int>("threads")) {
       omp_set_num_threads(options.Get<int>("threads"));
@@ -186,9 +205,22 @@ class OnednnNetwork : public Network {
     }
     eng_stream_ = dnnl::stream(eng_);
 
+    // Convolutions can also run in int8, the network staying in float
+    // otherwise. Only on the cpu, since the calibration reads the tensors.
+    const bool int8 = options.GetOrDefault<bool>("int8", false);
+    if (int8 && eng_.get_kind() != dnnl::engine::kind::cpu) {
+      throw Exception("Int8 is only supported on the cpu.");
+    }
+    if (int8 && (options.GetOrDefault<bool>("fp16", false) ||
+                 options.GetOrDefault<bool>("bf16", false))) {
+      throw Exception("Int8 can't be combined with fp16 or bf16.");
+    }
+
     auto data_type = dnnl::memory::data_type::f32;
-    if (options.GetOrDefault<bool>(
-            "fp16", eng_.get_kind() == dnnl::engine::kind::gpu)) {
+    if (options.GetOrDefault<bool>("bf16", false)) {
+      data_type = dnnl::memory::data_type::bf16;
+    } else if (options.GetOrDefault<bool>(
+                   "fp16", eng_.get_kind() == dnnl::engine::kind::gpu)) {
       if (eng_.get_kind() == dnnl::engine::kind::cpu) {
         data_type = dnnl::memory::data_type::bf16;
       } else {
@@ -224,8 +256,19 @@ class OnednnNetwork : public Network {
     steps_ = options.GetOrDefault<int>("steps", 2);
     if (batch_size_ <= 0) {
       steps_ = 1;
-    } else if (steps_ > max_batch_size_ / batch_size_) {
-      steps_ = max_batch_size_ / batch_size_;
+    } else {
+      if (steps_ > max_batch_size_ / batch_size_) {
+        steps_ = max_batch_size_ / batch_size_;
+      }
+      // Explicit or measured buckets replace the multiples of the batch size.
+      if (options.Exists<std::string>("buckets") ||
+          options.Exists<std::string>("batch_curve")) {
+        buckets_ = BatchBuckets::FromOptions(options, batch_size_ * steps_,
+                                             steps_);
+      } else {
+        buckets_ = BatchBuckets::Uniform(batch_size_ * steps_, steps_);
+      }
+      steps_ = buckets_->sizes().size();
     }
 
     // Default layout is nchw.
@@ -527,16 +570,64 @@ class OnednnNetwork : public Network {
         layers_[idx].emplace_back(std::move(FCMov2));
       }
 
-      // Initialize layers if batch size fixed.
-      if (options.GetOrDefault<bool>("init", true) && batch_size_ > 0) {
-        int batchSize = (idx + 1) * batch_size_;
-        InputsOutputs io(batchSize, wdl_, moves_left_);
-        memset(io.input_masks_mem_, 0,
-               batchSize * kInputPlanes * sizeof(uint64_t));
-        memset(io.input_val_mem_, 0, batchSize * kInputPlanes * sizeof(float));
-        forwardEval(&io, batchSize);
+    }
+
+    // The int8 convolutions need the range of their inputs, which is either
+    // loaded from @int8_scales or measured over the first batches evaluated in
+    // float. Layer stacks are built alike, so the n-th convolution of each
+    // uses the same range.
+    if (int8) {
+      int8_context_ = std::make_unique<Int8Context>();
+      for (auto& stack : layers_) {
+        int slot = 0;
+        for (auto& layer : stack) {
+          if (auto* conv = dynamic_cast<ConvLayer*>(layer.get())) {
+            conv->EnableInt8(int8_context_.get(), slot++);
+          }
+        }
+      }
+      scales_file_ = options.GetOrDefault<std::string>("int8_scales", "");
+      calibration_batches_ =
+          options.GetOrDefault<int>("int8_calibration_batches", 64);
+      if (!scales_file_.empty() && int8_context_->Load(scales_file_)) {
+        CERR << "Loaded int8 scales from " << scales_file_;
+      } else {
+        CERR << "Calibrating int8 scales on the first " << calibration_batches_
+             << " batches.";
       }
     }
+
+    // Initialize layers if batch size fixed. Only the largest batch size is
+    // needed right away, the smaller ones can be built in the background.
+    if (options.GetOrDefault<bool>("init", true) && buckets_) {
+      InitLayers(steps_ - 1);
+      if (options.GetOrDefault<bool>("background_init", true)) {
+        init_thread_ = std::thread([this]() {
+          for (int idx = steps_ - 2; idx >= 0 && !stop_init_; idx--) {
+            InitLayers(idx);
+          }
+          PrimitiveCache::Get().Save();
+        });
+      } else {
+        for (int idx = steps_ - 2; idx >= 0; idx--) InitLayers(idx);
+      }
+    }
+    if (!init_thread_.joinable()) PrimitiveCache::Get().Save();
+  }
+
+  ~OnednnNetwork() {
+    stop_init_ = true;
+    if (init_thread_.joinable()) init_thread_.join();
+    PrimitiveCache::Get().Save();
+  }
+
+  // Builds the primitives of layer stack @idx by evaluating an empty batch.
+  void InitLayers(int idx) {
+    int batchSize = buckets_->sizes()[idx];
+    InputsOutputs io(batchSize, wdl_, moves_left_);
+    memset(io.input_masks_mem_, 0, batchSize * kInputPlanes * sizeof(uint64_t));
+    memset(io.input_val_mem_, 0, batchSize * kInputPlanes * sizeof(float));
+    forwardEval(&io, batchSize);
   }
 
   void forwardEval(InputsOutputs* io, int inputBatchSize) {
@@ -544,11 +635,8 @@ class OnednnNetwork : public Network {
     uint64_t* ipDataMasks = io->input_masks_mem_;
     float* ipDataValues = io->input_val_mem_;
 
-    int batchSize = steps_ * batch_size_;
-    if (batchSize <= 0) {
-      // Use just one batch of variable size.
-      batchSize = inputBatchSize;
-    }
+    // Without buckets use just one batch of variable size.
+    int batchSize = buckets_ ? buckets_->max() : inputBatchSize;
 
     // Break input batch in smaller batches.
     for (int start = 0; start < inputBatchSize; start += batchSize) {
@@ -557,9 +645,9 @@ class OnednnNetwork : public Network {
       int currentBatchSize = inputBatchSize - start;
       if (currentBatchSize > batchSize) {
         currentBatchSize = batchSize;
-      } else {
-        idx = (currentBatchSize - 1) / batch_size_;
-        batchSize = (idx + 1) * batch_size_;
+      } else if (buckets_) {
+        idx = buckets_->Index(currentBatchSize);
+        batchSize = buckets_->sizes()[idx];
       }
 
       auto input_desc = dnnl::memory::desc({batchSize, kInputPlanes, 8, 8},
@@ -742,48 +830,33 @@ class OnednnNetwork : public Network {
       }
       if (attn_policy_) {
         float* opPol = (float*)opPol_mem.get_data_handle();
-        // The promotion offsets are extracted from the output tensor.
+        // The promotion logits are written over the promotion offsets they are
+        // computed from, where the attention policy map expects them.
         float promotion_offsets[3][8];
         for (int batch = 0; batch < currentBatchSize; batch++) {
+          float* pol = opPol + batch * (64 * 64 + 8 * 24);
           for (int i = 0; i < 3; i++) {
             for (int j = 0; j < 8; j++) {
               promotion_offsets[i][j] =
-                  opPol[batch * (64 * 64 + 8 * 24) + 64 * 64 + i * 8 + j] +
-                  opPol[batch * (64 * 64 + 8 * 24) + 64 * 64 + 24 + j];
-            }
-          }
-          for (int x = 0; x < 64 * 64; x++) {
-            auto y = kAttnPolicyMap[x];
-            if (y >= 0) {
-              io->op_policy_mem_[(batch + start) * kNumOutputPolicy + y] =
-                  opPol[batch * (64 * 64 + 8 * 24) + x];
+                  pol[64 * 64 + i * 8 + j] + pol[64 * 64 + 24 + j];
             }
           }
           for (int k = 0; k < 8; k++) {
             for (int j = 0; j < 8; j++) {
               for (int i = 0; i < 3; i++) {
-                auto y = kAttnPolicyMap[64 * 64 + 24 * k + 3 * j + i];
-                if (y >= 0) {
-                  io->op_policy_mem_[(batch + start) * kNumOutputPolicy + y] =
-                      opPol[batch * (64 * 64 + 8 * 24) + (48 + k) * 64 + 56 +
-                            j] +
-                      promotion_offsets[i][j];
-                }
+                pol[64 * 64 + 24 * k + 3 * j + i] =
+                    pol[(48 + k) * 64 + 56 + j] + promotion_offsets[i][j];
               }
             }
           }
         }
+        MapPolicy(PolicyMapping::kAttention, currentBatchSize, opPol,
+                  64 * 64 + 8 * 24,
+                  io->op_policy_mem_ + start * kNumOutputPolicy);
       } else if (conv_policy_) {
-        float* opPol = (float*)opPol_mem.get_data_handle();
-        for (int batch = 0; batch < currentBatchSize; batch++) {
-          for (int i = 0; i < 73 * 8 * 8; i++) {
-            auto j = kConvPolicyMap[i];
-            if (j >= 0) {
-              io->op_policy_mem_[(batch + start) * kNumOutputPolicy + j] =
-                  opPol[batch * pol_channels_ * 64 + i];
-            }
-          }
-        }
+        MapPolicy(PolicyMapping::kConvolution, currentBatchSize,
+                  (float*)opPol_mem.get_data_handle(), pol_channels_ * 64,
+                  io->op_policy_mem_ + start * kNumOutputPolicy);
       } else {
         memcpy(io->op_policy_mem_ + start * kNumOutputPolicy,
                opPol_mem.get_data_handle(),
@@ -797,11 +870,23 @@ class OnednnNetwork : public Network {
     }
   }
 
+  // Called after each evaluation of a search batch.
+  void BatchDone() {
+    if (int8_context_ && !int8_context_->IsCalibrated() &&
+        ++calibration_batches_seen_ == calibration_batches_) {
+      int8_context_->FinishCalibration();
+      if (!scales_file_.empty()) int8_context_->Save(scales_file_);
+      CERR << "Int8 calibration done.";
+    }
+  }
+
   const NetworkCapabilities& GetCapabilities() const override {
     return capabilities_;
   }
 
-  int GetMiniBatchSize() const override { return batch_size_ * steps_; }
+  int GetMiniBatchSize() const override {
+    return buckets_ ? buckets_->max() : batch_size_ * steps_;
+  }
 
   bool IsCpu() const override {
     return eng_.get_kind() == dnnl::engine::kind::cpu;
@@ -837,6 +922,7 @@ class OnednnNetwork : public Network {
   int max_batch_size_;
   int batch_size_;
   int steps_;
+  std::optional<BatchBuckets> buckets_;
   bool wdl_;
   bool moves_left_;
 
@@ -858,6 +944,16 @@ class OnednnNetwork : public Network {
   std::vector<std::vector<std::unique_ptr<BaseLayer>>> layers_;
   BaseLayer* getLastLayer(int idx) { return layers_[idx].back().get(); }
 
+  // Set when the convolutions run in int8.
+  std::unique_ptr<Int8Context> int8_context_;
+  std::string scales_file_;
+  int calibration_batches_ = 0;
+  std::atomic<int> calibration_batches_seen_{0};
+
+  // Builds the primitives of the smaller batch sizes after the constructor.
+  std::thread init_thread_;
+  std::atomic<bool> stop_init_{false};
+
   std::mutex inputs_outputs_lock_;
   std::list<std::unique_ptr<InputsOutputs>> free_inputs_outputs_;
 };
@@ -875,6 +971,7 @@ OnednnNetworkComputation::~OnednnNetworkComputation() {
 
 void OnednnNetworkComputation::ComputeBlocking() {
   network_->forwardEval(inputs_outputs_.get(), GetBatchSize());
+  network_->BatchDone();
 }
 
 std::unique_ptr<Network> MakeOnednnNetwork(const std::optional<WeightsFile>& w,
@@ -108,6 +108,17 @@ class Int64OnnxConst : public GenericOnnxConst<int64_t> {
   }
 };
 
+// GenericOnnxConst for int8 values.
+class Int8OnnxConst : public GenericOnnxConst<int8_t> {
+ public:
+  using GenericOnnxConst<int8_t>::GenericOnnxConst;
+
+ private:
+  pblczero::TensorProto::DataType GetDataType() const override {
+    return pblczero::TensorProto::INT8;
+  }
+};
+
 // GenericOnnxConst for float values.
 class FloatOnnxConst : public GenericOnnxConst<float> {
  public:
@@ -146,6 +146,20 @@ std::string OnnxBuilder::Conv(const std::string& name,
   return out;
 }
 
+std::string OnnxBuilder::Conv(const std::string& name,
+                              const std::string& input_name,
+                              const std::string& kernel,
+                              const OnnxConst& bias_weights, int kernel_size,
+                              int pads) {
+  auto* node = model_.mutable_graph()->add_node();
+  auto out = PopulateStdNodeFields(node, name, input_name, "Conv");
+  node->add_input(kernel);
+  node->add_input(AddInitializer(name + "/w/bias", bias_weights));
+  AddIntsAttribute(node, "pads", {pads, pads, pads, pads});
+  AddIntsAttribute(node, "kernel_shape", {kernel_size, kernel_size});
+  return out;
+}
+
 std::string OnnxBuilder::Add(const std::string& name, const std::string& input1,
                              const std::string& input2) {
   auto* node = model_.mutable_graph()->add_node();
@@ -218,6 +232,17 @@ std::string OnnxBuilder::MatMul(const std::string& name,
   return out;
 }
 
+std::string OnnxBuilder::Gemm(const std::string& name,
+                              const std::string& input1,
+                              const std::string& input2,
+                              const OnnxConst& bias) {
+  auto* node = model_.mutable_graph()->add_node();
+  auto out = PopulateStdNodeFields(node, name, input1, "Gemm");
+  node->add_input(input2);
+  node->add_input(AddInitializer(name + "/w", bias));
+  return out;
+}
+
 std::string OnnxBuilder::Relu(const std::string& name,
                               const std::string& input) {
   auto* node = model_.mutable_graph()->add_node();
@@ -260,7 +285,14 @@ std::string OnnxBuilder::Pad(const std::string& name, const std::string& input,
                              std::initializer_list<int> pads) {
   auto* node = model_.mutable_graph()->add_node();
   auto out = PopulateStdNodeFields(node, name, input, "Pad");
-  AddIntsAttribute(node, "pads", pads);
+  if (opset_ < 11) {
+    AddIntsAttribute(node, "pads", pads);
+  } else {
+    node->add_input(AddInitializer(
+        name + "/pads",
+        Int64OnnxConst(std::vector<int64_t>(begin(pads), end(pads)),
+                       {static_cast<int>(pads.size())})));
+  }
   return out;
 }
 
@@ -476,4 +508,19 @@ std::string OnnxBuilder::ReduceMean(const std::string& name,
   return out;
 }
 
+std::string OnnxBuilder::DequantizeLinear(const std::string& name,
+                                          const OnnxConst& input,
+                                          const OnnxConst& scale, int axis) {
+  if (opset_ < 13) {
+    throw Exception("Per-axis DequantizeLinear requires opset 13 or higher.");
+  }
+  auto* node = model_.mutable_graph()->add_node();
+  auto out = PopulateStdNodeFields(
+      node, name, AddInitializer(name + "/quantized", input),
+      "DequantizeLinear");
+  node->add_input(AddInitializer(name + "/scale", scale));
+  AddIntAttribute(node, "axis", axis);
+  return out;
+}
+
 }  // namespace lczero
@@ -62,6 +62,9 @@ class OnnxBuilder {
   std::string Conv(const std::string& name, const std::string& input_name,
                    const OnnxConst& kernel_weights,
                    const OnnxConst& bias_weights, int pads = 1);
+  std::string Conv(const std::string& name, const std::string& input_name,
+                   const std::string& kernel, const OnnxConst& bias_weights,
+                   int kernel_size, int pads);
   std::string Add(const std::string& name, const std::string& input1,
                   const std::string& input2);
   std::string Add(const std::string& name, const std::string& input1,
@@ -78,6 +81,9 @@ class OnnxBuilder {
                   const std::string& input2);
   std::string Mul(const std::string& name, const std::string& input1,
                   const OnnxConst&);
+  // Y = input1 * input2 + bias, input1 has to be 2D.
+  std::string Gemm(const std::string& name, const std::string& input1,
+                   const std::string& input2, const OnnxConst& bias);
   std::string Relu(const std::string& name, const std::string& input);
   std::string Tanh(const std::string& name, const std::string& input);
   std::string Softmax(const std::string& name, const std::string& input,
@@ -126,6 +132,10 @@ class OnnxBuilder {
                    pblczero::TensorProto::DataType type);
   std::string ReduceMean(const std::string& name, const std::string& input,
                          std::initializer_list<int> axes);
+  // Adds @input (int8) and @scale as initializers, and dequantizes them along
+  // @axis into a float tensor named @name.
+  std::string DequantizeLinear(const std::string& name, const OnnxConst& input,
+                               const OnnxConst& scale, int axis);
   // Returns ONNX model as protobuf.
   const pblczero::ModelProto& as_proto() const { return model_; }
   // Returns serialized model.
@@ -27,11 +27,14 @@
 
 #include "neural/onnx/converter.h"
 
+#include <algorithm>
 #include <climits>
 #include <cmath>
 #include <cstddef>
+#include <cstring>
 #include <initializer_list>
 #include <memory>
+#include <utility>
 
 #include "neural/loader.h"
 #include "neural/network.h"
@@ -74,6 +77,18 @@ class Converter {
   void FillValueInfo(pblczero::ValueInfoProto* vip, const std::string& name,
                      std::initializer_list<int> dims);
 
+  std::string MakeWeights(OnnxBuilder* builder, const std::string& name,
+                          const std::vector<float>& weights,
+                          std::initializer_list<int> dims,
+                          std::initializer_list<int> order, int axis);
+
+  std::string MakeDense(OnnxBuilder* builder, const std::string& input,
+                        const std::string& matmul_name,
+                        const std::string& add_name,
+                        const std::vector<float>& weights,
+                        const std::vector<float>& biases, int input_size,
+                        int output_size);
+
   std::string MakeConvBlock(OnnxBuilder* builder,
                             const LegacyWeights::ConvBlock&, int input_channels,
                             int output_channels, const std::string& input,
@@ -176,6 +191,60 @@ std::unique_ptr<OnnxConst> Converter::GetWeghtsConverter(
                   " is not supported in weights converter");
 }
 
+std::string Converter::MakeWeights(OnnxBuilder* builder,
+                                   const std::string& name,
+                                   const std::vector<float>& weights,
+                                   std::initializer_list<int> dims,
+                                   std::initializer_list<int> order, int axis) {
+  if (!options_.quantize_int8) {
+    return builder->AddInitializer(name,
+                                   *GetWeghtsConverter(weights, dims, order));
+  }
+  // Symmetric int8 quantization with one scale per channel along @axis.
+  const FloatOnnxWeightsAdapter adapter(weights, dims, order);
+  const auto raw = static_cast<const OnnxConst&>(adapter).GetRawData();
+  std::vector<float> values(raw.size() / sizeof(float));
+  std::memcpy(values.data(), raw.data(), raw.size());
+  const std::vector<int> shape(dims);
+  const int channels = shape[axis];
+  int inner = 1;
+  for (size_t i = axis + 1; i < shape.size(); i++) inner *= shape[i];
+  std::vector<float> scales(channels, 0.0f);
+  for (size_t i = 0; i < values.size(); i++) {
+    auto& scale = scales[(i / inner) % channels];
+    scale = std::max(scale, std::abs(values[i]));
+  }
+  for (auto& scale : scales) scale = scale > 0.0f ? scale / 127.0f : 1.0f;
+  std::vector<int8_t> quantized(values.size());
+  for (size_t i = 0; i < values.size(); i++) {
+    quantized[i] = static_cast<int8_t>(std::clamp(
+        std::round(values[i] / scales[(i / inner) % channels]), -127.0f,
+        127.0f));
+  }
+  if (GetDataType() == pblczero::TensorProto::FLOAT) {
+    return builder->DequantizeLinear(name, Int8OnnxConst(quantized, dims),
+                                     FloatOnnxConst(scales, {channels}), axis);
+  }
+  auto flow = builder->DequantizeLinear(
+      name + "/dequantized", Int8OnnxConst(quantized, dims),
+      FloatOnnxConst(scales, {channels}), axis);
+  return builder->Cast(name, flow, GetDataType());
+}
+
+std::string Converter::MakeDense(OnnxBuilder* builder, const std::string& input,
+                                 const std::string& matmul_name,
+                                 const std::string& add_name,
+                                 const std::vector<float>& weights,
+                                 const std::vector<float>& biases,
+                                 int input_size, int output_size) {
+  auto w = MakeWeights(builder, matmul_name + "/w", weights,
+                       {input_size, output_size}, {1, 0}, 1);
+  auto b = GetWeghtsConverter(biases, {output_size});
+  if (options_.fuse_bias) return builder->Gemm(add_name, input, w, *b);
+  auto flow = builder->MatMul(matmul_name, input, w);
+  return builder->Add(add_name, flow, *b);
+}
+
 std::string Converter::MakeMish(OnnxBuilder* builder, const std::string& input,
                                 const std::string& name) {
   if (!options_.alt_mish || options_.opset < 9 ||
@@ -243,17 +312,11 @@ std::string Converter::MakeSqueezeAndExcite(
   }
   auto flow = builder->GlobalAveragePool(name + "/pooled", input);
   flow = builder->Squeeze(name + "/squeeze", flow, {2, 3});
-  flow = builder->MatMul(
-      name + "/matmul1", flow,
-      *GetWeghtsConverter(se_unit.w1, {NumFilters(), se_filters}, {1, 0}));
-  flow = builder->Add(name + "/add1", flow,
-                      *GetWeghtsConverter(se_unit.b1, {se_filters}));
+  flow = MakeDense(builder, flow, name + "/matmul1", name + "/add1", se_unit.w1,
+                   se_unit.b1, NumFilters(), se_filters);
   flow = MakeActivation(builder, flow, name, default_activation_);
-  flow = builder->MatMul(
-      name + "/matmul2", flow,
-      *GetWeghtsConverter(se_unit.w2, {se_filters, 2 * NumFilters()}, {1, 0}));
-  flow = builder->Add(name + "/add2", flow,
-                      *GetWeghtsConverter(se_unit.b2, {2 * NumFilters()}));
+  flow = MakeDense(builder, flow, name + "/matmul2", name + "/add2", se_unit.w2,
+                   se_unit.b2, se_filters, 2 * NumFilters());
   flow = builder->Reshape(name + "/reshape", flow, "/const/se_reshape");
 
   auto splits = builder->Split(name + "/split", flow, 1);
@@ -268,12 +331,13 @@ std::string Converter::MakeConvBlock(
     int input_channels, int output_channels, const std::string& input,
     const std::string& name, const LegacyWeights::SEunit* seunit,
     const std::string& mixin, bool activation, int filters) {
-  auto flow = builder->Conv(
-      name, input,
-      *GetWeghtsConverter(weights.weights,
-                          {output_channels, input_channels, filters, filters}),
-      *GetWeghtsConverter(weights.biases, {output_channels}),
-      (filters - 1) / 2);
+  auto kernel = MakeWeights(builder, name + "/w/kernel", weights.weights,
+                            {output_channels, input_channels, filters, filters},
+                            {}, 0);
+  auto flow =
+      builder->Conv(name, input, kernel,
+                    *GetWeghtsConverter(weights.biases, {output_channels}),
+                    filters, (filters - 1) / 2);
 
   if (seunit) flow = MakeSqueezeAndExcite(builder, *seunit, flow, name + "/se");
   if (!mixin.empty()) flow = builder->Add(name + "/mixin", flow, mixin);
@@ -309,34 +373,28 @@ std::string Converter::MakeSmolgen(OnnxBuilder* builder,
   const int smolgen_gen_sz = layer.mha.smolgen.dense2_b.size() / heads;
   auto flow = builder->MatMul(
       name + "/smolgen/compress", encoder_in,
-      *GetWeghtsConverter(layer.mha.smolgen.compress,
-                          {embedding_size, smolgen_hidden_channels}, {1, 0}));
+      MakeWeights(builder, name + "/smolgen/compress/w",
+                  layer.mha.smolgen.compress,
+                  {embedding_size, smolgen_hidden_channels}, {1, 0}, 1));
   flow = builder->Reshape(
       name + "/smolgen/compress/reshape", flow,
       builder->AddInitializer(
           "/const" + name + "/smolgen/compress/shape",
           Int64OnnxConst({-1, 64 * smolgen_hidden_channels}, {2})));
-  flow = builder->MatMul(
-      name + "/smolgen/dense1/w", flow,
-      *GetWeghtsConverter(layer.mha.smolgen.dense1_w,
-                          {64 * smolgen_hidden_channels, smolgen_hidden_sz},
-                          {1, 0}));
-  flow = builder->Add(
-      name + "/smolgen/dense1/b", flow,
-      *GetWeghtsConverter(layer.mha.smolgen.dense1_b, {smolgen_hidden_sz}));
+  flow = MakeDense(builder, flow, name + "/smolgen/dense1/w",
+                   name + "/smolgen/dense1/b", layer.mha.smolgen.dense1_w,
+                   layer.mha.smolgen.dense1_b, 64 * smolgen_hidden_channels,
+                   smolgen_hidden_sz);
   flow = MakeActivation(builder, flow, name + "/smolgen/dense1", activation);
   flow = MakeLayerNorm(
       builder, flow, name + "/smolgen/ln1",
       *GetWeghtsConverter(layer.mha.smolgen.ln1_gammas, {smolgen_hidden_sz}),
       *GetWeghtsConverter(layer.mha.smolgen.ln1_betas, {smolgen_hidden_sz}),
       1e-3);
-  flow = builder->MatMul(
-      name + "/smolgen/dense2/w", flow,
-      *GetWeghtsConverter(layer.mha.smolgen.dense2_w,
-                          {smolgen_hidden_sz, smolgen_gen_sz * heads}, {1, 0}));
-  flow = builder->Add(name + "/smolgen/dense2/b", flow,
-                      *GetWeghtsConverter(layer.mha.smolgen.dense2_b,
-                                          {smolgen_gen_sz * heads}));
+  flow = MakeDense(builder, flow, name + "/smolgen/dense2/w",
+                   name + "/smolgen/dense2/b", layer.mha.smolgen.dense2_w,
+                   layer.mha.smolgen.dense2_b, smolgen_hidden_sz,
+                   smolgen_gen_sz * heads);
   flow = MakeActivation(builder, flow, name + "/smolgen/dense2", activation);
   flow = MakeLayerNorm(builder, flow, name + "/smolgen/ln2",
                        *GetWeghtsConverter(layer.mha.smolgen.ln2_gammas,
@@ -395,25 +453,17 @@ std::string Converter::MakeEncoderLayer(
   auto mha_shape =
       builder->AddInitializer("/const" + name + "/mha/shape",
                               Int64OnnxConst({-1, 64, heads, depth}, {4}));
-  auto flow = builder->MatMul(
-      name + "/mha/Q/w", encoder_in,
-      *GetWeghtsConverter(layer.mha.q_w, {embedding_size, d_model}, {1, 0}));
-  flow = builder->Add(name + "/mha/Q/b", flow,
-                      *GetWeghtsConverter(layer.mha.q_b, {d_model}));
+  auto flow =
+      MakeDense(builder, encoder_in, name + "/mha/Q/w", name + "/mha/Q/b",
+                layer.mha.q_w, layer.mha.q_b, embedding_size, d_model);
   flow = builder->Reshape(name + "/mha/Q/reshape", flow, mha_shape);
   auto Q = builder->Transpose(name + "/mha/Q/transpose", flow, {0, 2, 1, 3});
-  flow = builder->MatMul(
-      name + "/mha/K/w", encoder_in,
-      *GetWeghtsConverter(layer.mha.k_w, {embedding_size, d_model}, {1, 0}));
-  flow = builder->Add(name + "/mha/K/b", flow,
-                      *GetWeghtsConverter(layer.mha.k_b, {d_model}));
+  flow = MakeDense(builder, encoder_in, name + "/mha/K/w", name + "/mha/K/b",
+                   layer.mha.k_w, layer.mha.k_b, embedding_size, d_model);
   flow = builder->Reshape(name + "/mha/K/reshape", flow, mha_shape);
   auto K = builder->Transpose(name + "/mha/K/transpose", flow, {0, 2, 3, 1});
-  flow = builder->MatMul(
-      name + "/mha/V/w", encoder_in,
-      *GetWeghtsConverter(layer.mha.v_w, {embedding_size, d_model}, {1, 0}));
-  flow = builder->Add(name + "/mha/V/b", flow,
-                      *GetWeghtsConverter(layer.mha.v_b, {d_model}));
+  flow = MakeDense(builder, encoder_in, name + "/mha/V/w", name + "/mha/V/b",
+                   layer.mha.v_w, layer.mha.v_b, embedding_size, d_model);
   flow = builder->Reshape(name + "/mha/V/reshape", flow, mha_shape);
   auto V = builder->Transpose(name + "/mha/V/transpose", flow, {0, 2, 1, 3});
   flow = builder->MatMul(name + "/mha/QK/matmul", Q, K);
@@ -440,12 +490,9 @@ std::string Converter::MakeEncoderLayer(
       name + "/mha/out/reshape", flow,
       builder->AddInitializer("/const" + name + "/mha/out/shape",
                               Int64OnnxConst({-1, d_model}, {2})));
-  flow =
-      builder->MatMul(name + "/mha/out/dense/w", flow,
-                      *GetWeghtsConverter(layer.mha.dense_w,
-                                          {d_model, embedding_size}, {1, 0}));
-  flow = builder->Add(name + "/mha/out/dense/b", flow,
-                      *GetWeghtsConverter(layer.mha.dense_b, {embedding_size}));
+  flow = MakeDense(builder, flow, name + "/mha/out/dense/w",
+                   name + "/mha/out/dense/b", layer.mha.dense_w,
+                   layer.mha.dense_b, d_model, embedding_size);
   std::unique_ptr<OnnxConst> alpha_onnx;
   std::string alpha_in;
   if (alpha != 1.0) {
@@ -466,25 +513,18 @@ std::string Converter::MakeEncoderLayer(
                     *GetWeghtsConverter(layer.ln1_gammas, {embedding_size}),
                     *GetWeghtsConverter(layer.ln1_betas, {embedding_size}));
   const int dff_size = layer.ffn.dense1_b.size();
-  flow =
-      builder->MatMul(name + "/ffn/dense1/w", ffn_in,
-                      *GetWeghtsConverter(layer.ffn.dense1_w,
-                                          {embedding_size, dff_size}, {1, 0}));
-  flow = builder->Add(name + "/ffn/dense1/b", flow,
-                      *GetWeghtsConverter(layer.ffn.dense1_b, {dff_size}));
+  flow = MakeDense(builder, ffn_in, name + "/ffn/dense1/w",
+                   name + "/ffn/dense1/b", layer.ffn.dense1_w,
+                   layer.ffn.dense1_b, embedding_size, dff_size);
 
   const auto ffn_activation = static_cast<ActivationFunction>(
       src_.format().network_format().ffn_activation());
   flow = MakeActivation(
       builder, flow, name + "/ffn/dense1",
       ffn_activation == ACTIVATION_DEFAULT ? activation : ffn_activation);
-  flow =
-      builder->MatMul(name + "/ffn/dense2/w", flow,
-                      *GetWeghtsConverter(layer.ffn.dense2_w,
-                                          {dff_size, embedding_size}, {1, 0}));
-  flow =
-      builder->Add(name + "/ffn/dense2/b", flow,
-                   *GetWeghtsConverter(layer.ffn.dense2_b, {embedding_size}));
+  flow = MakeDense(builder, flow, name + "/ffn/dense2/w",
+                   name + "/ffn/dense2/b", layer.ffn.dense2_w,
+                   layer.ffn.dense2_b, dff_size, embedding_size);
   std::string alpha_ffn_in;
   if (alpha != 1.0) {
     alpha_ffn_in = builder->Mul(name + "/alpha*out1", ffn_in, *alpha_onnx);
@@ -502,11 +542,9 @@ std::string Converter::MakeAttentionBody(OnnxBuilder* builder,
                                          const std::string& input,
                                          const LegacyWeights& weights) {
   if (weights.has_smolgen) {
-    builder->AddInitializer(
-        "/const/smolgen_w",
-        *GetWeghtsConverter(
-            weights.smolgen_w,
-            {static_cast<int>(weights.smolgen_w.size() / 4096), 4096}, {1, 0}));
+    MakeWeights(builder, "/const/smolgen_w", weights.smolgen_w,
+                {static_cast<int>(weights.smolgen_w.size() / 4096), 4096},
+                {1, 0}, 1);
   }
 
   auto flow = builder->Transpose("/attn_body/transpose", input, {0, 2, 3, 1});
@@ -587,13 +625,9 @@ std::string Converter::MakeAttentionBody(OnnxBuilder* builder,
   }
 
   int embedding_size = weights.ip_emb_b.size();
-  flow = builder->MatMul(
-      "/attn_body/matmul", flow,
-      *GetWeghtsConverter(
-          weights.ip_emb_w,
-          {NumResBlocks() > 0 ? NumFilters() : 176, embedding_size}, {1, 0}));
-  flow = builder->Add("/attn_body/add", flow,
-                      *GetWeghtsConverter(weights.ip_emb_b, {embedding_size}));
+  flow = MakeDense(builder, flow, "/attn_body/matmul", "/attn_body/add",
+                   weights.ip_emb_w, weights.ip_emb_b,
+                   NumResBlocks() > 0 ? NumFilters() : 176, embedding_size);
   flow = MakeActivation(builder, flow, "/attn_body", default_activation_);
 
   if (weights.ip_mult_gate.size() > 0 || weights.ip_add_gate.size() > 0) {
@@ -636,6 +670,27 @@ std::vector<int> MakePolicyMap(const short* map, int size) {
   }
   return policy_map;
 }
+
+// Splits the attention policy map into indices into the 64x64 move logits and
+// into the 24 promotion offsets, with index 24 pointing past the offsets.
+std::pair<std::vector<int>, std::vector<int>> MakeFoldedAttnPolicyMap() {
+  const auto policy_map =
+      MakePolicyMap(kAttnPolicyMap, std::size(kAttnPolicyMap));
+  std::vector<int> logits(1858);
+  std::vector<int> promotions(1858, 24);
+  for (int i = 0; i < 1858; i++) {
+    const int idx = policy_map[i] - 64 * 64;
+    if (idx < 0) {
+      logits[i] = policy_map[i];
+      continue;
+    }
+    // Promotions are laid out as [from file][to file][piece], and their logit
+    // is the 7th to 8th rank move logit plus the (to file, piece) offset.
+    logits[i] = (48 + idx / 24) * 64 + 56 + idx % 24 / 3;
+    promotions[i] = idx % 24;
+  }
+  return {logits, promotions};
+}
 }  // namespace
 
 std::string Converter::MakeAttentionPolicy(OnnxBuilder* builder,
@@ -658,15 +713,10 @@ std::string Converter::MakeAttentionPolicy(OnnxBuilder* builder,
         builder->AddInitializer("/const/policy_shape",
                                 Int64OnnxConst({-1, NumFilters()}, {2})));
   }
-  flow = builder->MatMul(
-      "/policy/dense1/matmul", flow,
-      *GetWeghtsConverter(weights.ip_pol_w,
-                          {NumEncBlocks() > 0 ? embedding_size : NumFilters(),
-                           policy_embedding_size},
-                          {1, 0}));
-  flow = builder->Add(
-      "/policy/dense1/add", flow,
-      *GetWeghtsConverter(weights.ip_pol_b, {policy_embedding_size}));
+  flow = MakeDense(builder, flow, "/policy/dense1/matmul", "/policy/dense1/add",
+                   weights.ip_pol_w, weights.ip_pol_b,
+                   NumEncBlocks() > 0 ? embedding_size : NumFilters(),
+                   policy_embedding_size);
   flow = MakeActivation(builder, flow, "/policy/dense1", activation);
 
   for (size_t i = 0; i < weights.pol_encoder.size(); i++) {
@@ -677,22 +727,16 @@ std::string Converter::MakeAttentionPolicy(OnnxBuilder* builder,
         weights.pol_encoder_head_count, flow, name, activation);
   }
   auto encoder_out = flow;
-  flow = builder->MatMul(
-      "/policy/Q/matmul", encoder_out,
-      *GetWeghtsConverter(weights.ip2_pol_w,
-                          {policy_embedding_size, policy_d_model}, {1, 0}));
-  flow = builder->Add("/policy/Q/add", flow,
-                      *GetWeghtsConverter(weights.ip2_pol_b, {policy_d_model}));
+  flow = MakeDense(builder, encoder_out, "/policy/Q/matmul", "/policy/Q/add",
+                   weights.ip2_pol_w, weights.ip2_pol_b, policy_embedding_size,
+                   policy_d_model);
   auto Q = builder->Reshape(
       "/policy/Q/reshape", flow,
       builder->AddInitializer("/const/QK_shape",
                               Int64OnnxConst({-1, 64, policy_d_model}, {3})));
-  flow = builder->MatMul(
-      "/policy/K/matmul", encoder_out,
-      *GetWeghtsConverter(weights.ip3_pol_w,
-                          {policy_embedding_size, policy_d_model}, {1, 0}));
-  flow = builder->Add("/policy/K/add", flow,
-                      *GetWeghtsConverter(weights.ip3_pol_b, {policy_d_model}));
+  flow = MakeDense(builder, encoder_out, "/policy/K/matmul", "/policy/K/add",
+                   weights.ip3_pol_w, weights.ip3_pol_b, policy_embedding_size,
+                   policy_d_model);
   auto K = builder->Reshape("/policy/K/reshape", flow, "/const/QK_shape");
   flow = builder->Transpose("/policy/K/transpose", K, {0, 2, 1});
   flow = builder->MatMul("/policy/matmul", Q, flow);
@@ -714,6 +758,30 @@ std::string Converter::MakeAttentionPolicy(OnnxBuilder* builder,
   auto prom2 = builder->Split("/policy/promotion/split", prom, 1, {3, 1});
   prom = builder->Add("/policy/promotion/add", prom2[0], prom2[1]);
   prom = builder->Transpose("/policy/promotion/transpose2", prom, {0, 2, 1});
+  if (options_.fold_policy_map) {
+    prom = builder->Reshape(
+        "/policy/promotion/reshape", prom,
+        builder->AddInitializer("/const/policy_promotion_shape",
+                                Int64OnnxConst({-1, 24}, {2})));
+    // The extra zero column is used by all non-promotion moves.
+    prom = builder->Pad("/policy/promotion/pad", prom, {0, 0, 0, 1});
+    flow = builder->Reshape(
+        "/policy/reshape", flow,
+        builder->AddInitializer("/const/policy_out_shape",
+                                Int64OnnxConst({-1, 64 * 64}, {2})));
+    const auto [logits_map, promotion_map] = MakeFoldedAttnPolicyMap();
+    flow = builder->Gather(
+        "/policy/gather", flow,
+        builder->AddInitializer("/const/mapping_table",
+                                Int32OnnxConst(logits_map, {1858})),
+        1);
+    prom = builder->Gather(
+        "/policy/promotion/gather", prom,
+        builder->AddInitializer("/const/promotion_mapping_table",
+                                Int32OnnxConst(promotion_map, {1858})),
+        1);
+    return builder->Add(options_.output_policy_head, flow, prom);
+  }
   prom = builder->Reshape(
       "/policy/promotion/reshape", prom,
       builder->AddInitializer("/const/policy_promotion_shape",
@@ -795,12 +863,9 @@ void Converter::MakePolicyHead(pblczero::OnnxModel* onnx, OnnxBuilder* builder,
                          builder->AddInitializer(
                              "/const/policy_shape",
                              Int64OnnxConst({-1, pol_channels * 8 * 8}, {2})));
-    flow = builder->MatMul(
-        "/policy/dense/matmul", flow,
-        *GetWeghtsConverter(weights.ip_pol_w, {pol_channels * 8 * 8, 1858},
-                            {1, 0}));
-    auto output = builder->Add(options_.output_policy_head, flow,
-                               *GetWeghtsConverter(weights.ip_pol_b, {1858}));
+    auto output = MakeDense(builder, flow, "/policy/dense/matmul",
+                            options_.output_policy_head, weights.ip_pol_w,
+                            weights.ip_pol_b, pol_channels * 8 * 8, 1858);
     builder->AddOutput(output, {options_.batch_size, 1858}, GetDataType());
     onnx->set_output_policy(output);
   }
@@ -813,12 +878,9 @@ void Converter::MakeValueHead(pblczero::OnnxModel* onnx, OnnxBuilder* builder,
   const int val_channels = NumEncBlocks() > 0 ? weights.ip_val_b.size() : 32;
   if (NumEncBlocks() > 0) {
     int embedding_size = weights.ip_emb_b.size();
-    flow = builder->MatMul(
-        "/value/embed/matmul", input,
-        *GetWeghtsConverter(weights.ip_val_w, {embedding_size, val_channels},
-                            {1, 0}));
-    flow = builder->Add("/value/embed/add", flow,
-                        *GetWeghtsConverter(weights.ip_val_b, {val_channels}));
+    flow = MakeDense(builder, input, "/value/embed/matmul", "/value/embed/add",
+                     weights.ip_val_w, weights.ip_val_b, embedding_size,
+                     val_channels);
     flow = MakeActivation(builder, flow, "/value/embed", default_activation_);
   } else {
     flow = MakeConvBlock(builder, weights.value, NumFilters(), val_channels,
@@ -828,31 +890,22 @@ void Converter::MakeValueHead(pblczero::OnnxModel* onnx, OnnxBuilder* builder,
       "/value/reshape", flow,
       builder->AddInitializer("/const/value_shape",
                               Int64OnnxConst({-1, val_channels * 8 * 8}, {2})));
-  flow =
-      builder->MatMul("/value/dense1/matmul", flow,
-                      *GetWeghtsConverter(weights.ip1_val_w,
-                                          {val_channels * 8 * 8, 128}, {1, 0}));
-  flow = builder->Add("/value/dense1/add", flow,
-                      *GetWeghtsConverter(weights.ip1_val_b, {128}));
+  flow = MakeDense(builder, flow, "/value/dense1/matmul", "/value/dense1/add",
+                   weights.ip1_val_w, weights.ip1_val_b, val_channels * 8 * 8,
+                   128);
   flow = MakeActivation(builder, flow, "/value/dense1", default_activation_);
 
   const bool wdl = src_.format().network_format().value() ==
                    pblczero::NetworkFormat::VALUE_WDL;
   if (wdl) {
-    flow = builder->MatMul(
-        "/value/dense2/matmul", flow,
-        *GetWeghtsConverter(weights.ip2_val_w, {128, 3}, {1, 0}));
-    flow = builder->Add("/value/dense2/add", flow,
-                        *GetWeghtsConverter(weights.ip2_val_b, {3}));
+    flow = MakeDense(builder, flow, "/value/dense2/matmul", "/value/dense2/add",
+                     weights.ip2_val_w, weights.ip2_val_b, 128, 3);
     auto output = builder->Softmax(options_.output_wdl, flow);
     builder->AddOutput(output, {options_.batch_size, 3}, GetDataType());
     onnx->set_output_wdl(output);
   } else {
-    flow = builder->MatMul(
-        "/value/dense2/matmul", flow,
-        *GetWeghtsConverter(weights.ip2_val_w, {128, 1}, {1, 0}));
-    flow = builder->Add("/value/dense2/add", flow,
-                        *GetWeghtsConverter(weights.ip2_val_b, {1}));
+    flow = MakeDense(builder, flow, "/value/dense2/matmul", "/value/dense2/add",
+                     weights.ip2_val_w, weights.ip2_val_b, 128, 1);
     auto output = builder->Tanh(options_.output_value, flow);
     builder->AddOutput(output, {options_.batch_size, 1}, GetDataType());
     onnx->set_output_value(output);
@@ -863,8 +916,8 @@ void Converter::MakeMovesLeftHead(pblczero::OnnxModel* onnx,
                                   OnnxBuilder* builder,
                                   const std::string& input,
                                   const LegacyWeights& weights) {
-  if (src_.format().network_format().moves_left() !=
-      pblczero::NetworkFormat::MOVES_LEFT_V1) {
+  if (!options_.mlh || src_.format().network_format().moves_left() !=
+                           pblczero::NetworkFormat::MOVES_LEFT_V1) {
     return;
   }
   const int mlh_channels = NumEncBlocks() > 0
@@ -874,12 +927,9 @@ void Converter::MakeMovesLeftHead(pblczero::OnnxModel* onnx,
   std::string flow;
   if (NumEncBlocks() > 0) {
     int embedding_size = weights.ip_emb_b.size();
-    flow = builder->MatMul(
-        "/mlh/embed/matmul", input,
-        *GetWeghtsConverter(weights.ip_mov_w, {embedding_size, mlh_channels},
-                            {1, 0}));
-    flow = builder->Add("/mlh/embed/add", flow,
-                        *GetWeghtsConverter(weights.ip_mov_b, {mlh_channels}));
+    flow = MakeDense(builder, input, "/mlh/embed/matmul", "/mlh/embed/add",
+                     weights.ip_mov_w, weights.ip_mov_b, embedding_size,
+                     mlh_channels);
     flow = MakeActivation(builder, flow, "/mlh/embed", default_activation_);
   } else {
     flow =
@@ -890,19 +940,12 @@ void Converter::MakeMovesLeftHead(pblczero::OnnxModel* onnx,
       "/mlh/reshape", flow,
       builder->AddInitializer("/const/mlh_shape",
                               Int64OnnxConst({-1, mlh_channels * 8 * 8}, {2})));
-  flow = builder->MatMul(
-      "/mlh/dense1/matmul", flow,
-      *GetWeghtsConverter(weights.ip1_mov_w,
-                          {mlh_channels * 8 * 8, mlh_fc1_outputs}, {1, 0}));
-  flow =
-      builder->Add("/mlh/dense1/add", flow,
-                   *GetWeghtsConverter(weights.ip1_mov_b, {mlh_fc1_outputs}));
+  flow = MakeDense(builder, flow, "/mlh/dense1/matmul", "/mlh/dense1/add",
+                   weights.ip1_mov_w, weights.ip1_mov_b, mlh_channels * 8 * 8,
+                   mlh_fc1_outputs);
   flow = MakeActivation(builder, flow, "/mlh/dense1", default_activation_);
-  flow = builder->MatMul(
-      "/mlh/dense2/matmul", flow,
-      *GetWeghtsConverter(weights.ip2_mov_w, {mlh_fc1_outputs, 1}, {1, 0}));
-  flow = builder->Add("/mlh/dense2/add", flow,
-                      *GetWeghtsConverter(weights.ip2_mov_b, {1}));
+  flow = MakeDense(builder, flow, "/mlh/dense2/matmul", "/mlh/dense2/add",
+                   weights.ip2_mov_w, weights.ip2_mov_b, mlh_fc1_outputs, 1);
   flow = MakeActivation(builder, flow, "/mlh/dense2", default_activation_);
   auto output = builder->Identity(options_.output_mlh, flow);
   builder->AddOutput(output, {options_.batch_size, 1}, GetDataType());
@@ -961,7 +1004,9 @@ void Converter::CopyGenericFields(pblczero::Net* dst) {
   // outside they are all POLICY_CLASSICAL.
   network_format->set_policy(pblczero::NetworkFormat::POLICY_CLASSICAL);
   network_format->set_value(src_.format().network_format().value());
-  network_format->set_moves_left(src_.format().network_format().moves_left());
+  network_format->set_moves_left(
+      options_.mlh ? src_.format().network_format().moves_left()
+                   : pblczero::NetworkFormat::MOVES_LEFT_NONE);
 
   *dst->mutable_training_params() = src_.training_params();
 }
@@ -45,6 +45,16 @@ struct WeightsToOnnxConverterOptions {
   int opset = 17;
   bool alt_mish = false;
   bool alternative_layer_normalization = false;
+  // Emit dense layers as Gemm with the bias folded in, instead of MatMul+Add.
+  bool fuse_bias = false;
+  // Compute the attention policy promotion logits with two Gathers instead of
+  // building the full 67x64 logits tensor first.
+  bool fold_policy_map = false;
+  // Store conv and dense weights as per-channel int8 with DequantizeLinear
+  // (QDQ) in front of them. Requires opset 13.
+  bool quantize_int8 = false;
+  // When false, the moves left head is not emitted at all.
+  bool mlh = true;
 };
 
 // Converts "classical" weights file to weights file with embedded ONNX model.
@@ -27,9 +27,11 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstdlib>
 #include <fstream>
 #include <iterator>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -39,6 +41,7 @@
 #endif
 
 #include "cpu_provider_factory.h"
+#include "neural/batch_buckets.h"
 #include "neural/factory.h"
 #include "neural/loader.h"
 #include "neural/network.h"
@@ -46,20 +49,47 @@
 #include "onnxruntime_cxx_api.h"
 #include "utils/bititer.h"
 #include "utils/exception.h"
+#include "utils/filesystem.h"
 #include "utils/fp16_utils.h"
 #include "utils/logging.h"
 
 namespace lczero {
 namespace {
 
-enum class OnnxProvider { CPU, CUDA, DML, ROCM };
+enum class OnnxProvider { CPU, CUDA, DML, ROCM, TRT };
+
+// Settings of the TensorRT execution provider.
+struct TrtSettings {
+  std::string input_name;
+  bool fp16 = false;
+  bool int8 = false;
+  // Built engines and kernel timings are kept here, so that they are only
+  // built once for a network.
+  std::string cache_dir;
+  // Optimization profiles of sessions with a variable batch size, one per
+  // bucket. Sessions of a fixed size get a profile of just that size.
+  std::vector<int> buckets;
+};
 
 class OnnxNetwork;
 
+// Memory of the inputs and outputs of a computation, with an IoBinding per
+// session over it. The network hands it from one computation to the next, so
+// that nothing is allocated per batch. It is pinned for the CUDA providers,
+// which then copy to and from the device without staging.
+struct OnnxBuffers {
+  // The set of sessions the bindings are for.
+  int session_set = 0;
+  void* input = nullptr;
+  std::vector<void*> outputs;
+  std::vector<Ort::IoBinding> bindings;
+};
+
 template <typename DataType>
 class OnnxComputation : public NetworkComputation {
  public:
   OnnxComputation(OnnxNetwork* network);
+  ~OnnxComputation();
   void AddInput(InputPlanes&& input) override;
   int GetBatchSize() const override { return raw_input_.size(); }
   void ComputeBlocking() override;
@@ -69,14 +99,14 @@ class OnnxComputation : public NetworkComputation {
   float GetMVal(int sample) const override;
 
  private:
-  Ort::Value PrepareInputs(int start, int batch_size);
+  // Binds the @batch_size inputs from @start and their outputs.
+  void PrepareInputs(Ort::IoBinding& binding, int start, int batch_size);
 
   OnnxNetwork* network_;
   std::vector<InputPlanes> raw_input_;
-  std::vector<DataType> input_tensor_data_;
-  std::vector<Ort::Value> output_tensors_;
-  std::vector<std::vector<DataType>> output_tensors_data_;
-  std::vector<size_t> output_tensors_step_;
+  std::unique_ptr<OnnxBuffers> buffers_;
+  DataType* input_data_;
+  std::vector<DataType*> output_data_;
 };
 
 class OnnxNetwork : public Network {
@@ -99,10 +129,18 @@ class OnnxNetwork : public Network {
                              : batch_size_ * steps_;
   }
   bool IsCpu() const override { return provider_ == OnnxProvider::CPU; }
+  ~OnnxNetwork();
+
+  std::unique_ptr<OnnxBuffers> GetBuffers();
+  void ReleaseBuffers(std::unique_ptr<OnnxBuffers> buffers);
 
   Ort::Env onnx_env_;
   // Prepare sessions for this many multiples of the batch size;
   int steps_;
+  // Independent copies of the sessions, so that as many batches can be in
+  // flight at once, each on its own device stream.
+  int session_sets_;
+  // Indexed by session set * steps_ + step - 1.
   std::vector<Ort::Session> session_;
   std::vector<std::string> inputs_;
   // Points to strings in inputs_.
@@ -115,41 +153,40 @@ class OnnxNetwork : public Network {
   int wdl_head_ = -1;
   int value_head_ = -1;
   int mlh_head_ = -1;
+  // Output values per sample, by index in output_cstr_.
+  std::vector<size_t> outputs_step_;
   NetworkCapabilities capabilities_;
   bool fp16_;
   // The batch size to use, or -1 for variable.
   int batch_size_;
   static constexpr int max_batch_size_ = 1024;
-  // For conditional locking if running the DML provider.
+  // For conditional locking if running the DML provider, one per session set.
   OnnxProvider provider_;
-  std::mutex lock_;
+  std::unique_ptr<std::mutex[]> locks_;
+  // Memory of the buffers, pinned for the CUDA providers.
+  Ort::MemoryInfo memory_info_;
+  std::unique_ptr<Ort::Allocator> pinned_allocator_;
+  std::mutex buffers_lock_;
+  // Computations are spread round robin over the session sets.
+  int next_session_set_ = 0;
+  // Indexed by session set.
+  std::vector<std::vector<std::unique_ptr<OnnxBuffers>>> free_buffers_;
 };
 
 template <typename DataType>
 OnnxComputation<DataType>::OnnxComputation(OnnxNetwork* network)
-    : network_(network) {
-  output_tensors_data_.resize(network_->outputs_.size());
-  output_tensors_step_.resize(network_->outputs_.size());
-  output_tensors_step_[network_->policy_head_] = 1858;
-  output_tensors_data_[network_->policy_head_] =
-      std::vector<DataType>(1858 * network_->max_batch_size_);
-  if (network_->wdl_head_ != -1) {
-    output_tensors_step_[network_->wdl_head_] = 3;
-    output_tensors_data_[network_->wdl_head_] =
-        std::vector<DataType>(3 * network_->max_batch_size_);
-  }
-  if (network_->value_head_ != -1) {
-    output_tensors_step_[network_->value_head_] = 1;
-    output_tensors_data_[network_->value_head_] =
-        std::vector<DataType>(network_->max_batch_size_);
-  }
-  if (network_->mlh_head_ != -1) {
-    output_tensors_step_[network_->mlh_head_] = 1;
-    output_tensors_data_[network_->mlh_head_] =
-        std::vector<DataType>(network_->max_batch_size_);
+    : network_(network), buffers_(network->GetBuffers()) {
+  input_data_ = static_cast<DataType*>(buffers_->input);
+  for (void* output : buffers_->outputs) {
+    output_data_.push_back(static_cast<DataType*>(output));
   }
 }
 
+template <typename DataType>
+OnnxComputation<DataType>::~OnnxComputation() {
+  network_->ReleaseBuffers(std::move(buffers_));
+}
+
 template <typename DataType>
 void OnnxComputation<DataType>::AddInput(InputPlanes&& input) {
   raw_input_.emplace_back(input);
@@ -169,10 +206,10 @@ float AsFloat(Ort::Float16_t x) {
 template <typename DataType>
 float OnnxComputation<DataType>::GetQVal(int sample) const {
   if (network_->wdl_head_ != -1) {
-    const auto& data = output_tensors_data_[network_->wdl_head_];
+    const DataType* data = output_data_[network_->wdl_head_];
     return AsFloat(data[sample * 3 + 0]) - AsFloat(data[sample * 3 + 2]);
   } else {
-    const auto& data = output_tensors_data_[network_->value_head_];
+    const DataType* data = output_data_[network_->value_head_];
     return AsFloat(data[sample]);
   }
 }
@@ -180,20 +217,20 @@ float OnnxComputation<DataType>::GetQVal(int sample) const {
 template <typename DataType>
 float OnnxComputation<DataType>::GetDVal(int sample) const {
   if (network_->wdl_head_ == -1) return 0.0f;
-  const auto& data = output_tensors_data_[network_->wdl_head_];
+  const DataType* data = output_data_[network_->wdl_head_];
   return AsFloat(data[sample * 3 + 1]);
 }
 
 template <typename DataType>
 float OnnxComputation<DataType>::GetPVal(int sample, int move_id) const {
-  const auto& data = output_tensors_data_[network_->policy_head_];
+  const DataType* data = output_data_[network_->policy_head_];
   return AsFloat(data[sample * 1858 + move_id]);
 }
 
 template <typename DataType>
 float OnnxComputation<DataType>::GetMVal(int sample) const {
   if (network_->mlh_head_ == -1) return 0.0f;
-  const auto& data = output_tensors_data_[network_->mlh_head_];
+  const DataType* data = output_data_[network_->mlh_head_];
   return AsFloat(data[sample]);
 }
 
@@ -204,10 +241,11 @@ void AsDataType(float x, Ort::Float16_t* y) {
 }
 
 template <typename DataType>
-Ort::Value OnnxComputation<DataType>::PrepareInputs(int start, int batch_size) {
-  input_tensor_data_.clear();
-  input_tensor_data_.resize(batch_size * kInputPlanes * 8 * 8);
-  auto iter = input_tensor_data_.data();
+void OnnxComputation<DataType>::PrepareInputs(Ort::IoBinding& binding,
+                                              int start, int batch_size) {
+  const size_t input_size = batch_size * kInputPlanes * 8 * 8;
+  std::fill_n(input_data_, input_size, DataType());
+  auto iter = input_data_;
   int end = std::min(start + batch_size, static_cast<int>(raw_input_.size()));
   for (int i = start; i < end; i++) {
     for (const auto& plane : raw_input_[i]) {
@@ -219,28 +257,20 @@ Ort::Value OnnxComputation<DataType>::PrepareInputs(int start, int batch_size) {
       iter += 64;
     }
   }
-  for (int i = end; i < start + batch_size; i++) {
-    for (int j = 0; j < kInputPlanes * 64; j++) {
-      *iter++ = DataType();
-    }
-  }
-
-  auto memory_info =
-      Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
-
-  output_tensors_.clear();
-  for (size_t i = 0; i < output_tensors_step_.size(); i++) {
-    int size = output_tensors_step_[i];
-    int64_t dims[] = {batch_size, size};
-    output_tensors_.emplace_back(Ort::Value::CreateTensor<DataType>(
-        memory_info, output_tensors_data_[i].data() + start * size,
-        size * batch_size, dims, 2));
-  }
 
+  const auto& memory_info = network_->memory_info_;
   int64_t dims[] = {batch_size, kInputPlanes, 8, 8};
-  return Ort::Value::CreateTensor<DataType>(memory_info,
-                                            input_tensor_data_.data(),
-                                            input_tensor_data_.size(), dims, 4);
+  binding.BindInput(network_->inputs_cstr_[0],
+                    Ort::Value::CreateTensor<DataType>(
+                        memory_info, input_data_, input_size, dims, 4));
+  for (size_t i = 0; i < output_data_.size(); i++) {
+    int size = network_->outputs_step_[i];
+    int64_t output_dims[] = {batch_size, size};
+    binding.BindOutput(network_->outputs_cstr_[i],
+                       Ort::Value::CreateTensor<DataType>(
+                           memory_info, output_data_[i] + start * size,
+                           size * batch_size, output_dims, 2));
+  }
 }
 
 template <typename DataType>
@@ -253,29 +283,90 @@ void OnnxComputation<DataType>::ComputeBlocking() {
     if (step > network_->steps_) step = network_->steps_;
     int batch = batch_size * step;
 
-    auto input_tensor = PrepareInputs(i, batch);
+    const int set = buffers_->session_set;
+    auto& binding = buffers_->bindings[step - 1];
+    PrepareInputs(binding, i, batch);
     // The DML onnxruntime execution provider is documented as not supporting
     // multi-threaded calls to Run on the same inference session. We found the
     // same to be true for the ROCm execution provider (at least for CNNs).
     // TODO: This may be a onnxruntime/ROCm bug, check onnxruntime 1.16 release.
     if (network_->provider_ == OnnxProvider::DML ||
         network_->provider_ == OnnxProvider::ROCM) {
-      network_->lock_.lock();
+      network_->locks_[set].lock();
     }
-    network_->session_[step - 1].Run(
-        {}, network_->inputs_cstr_.data(), &input_tensor, 1,
-        network_->outputs_cstr_.data(), output_tensors_.data(),
-        output_tensors_.size());
+    network_->session_[set * network_->steps_ + step - 1].Run(
+        Ort::RunOptions{nullptr}, binding);
     if (network_->provider_ == OnnxProvider::DML ||
         network_->provider_ == OnnxProvider::ROCM) {
-      network_->lock_.unlock();
+      network_->locks_[set].unlock();
     }
     i += batch;
   }
 }
 
+// The "input:NxCxHxW" shapes of the input planes for @batch_sizes, in the
+// comma separated form of the TensorRT profile options.
+std::string TrtShapes(const std::string& input,
+                      const std::vector<int>& batch_sizes) {
+  std::string shapes;
+  for (int batch_size : batch_sizes) {
+    if (!shapes.empty()) shapes += ",";
+    shapes += input + ":" + std::to_string(batch_size) + "x" +
+              std::to_string(kInputPlanes) + "x8x8";
+  }
+  return shapes;
+}
+
+void AppendTensorRT(Ort::SessionOptions& options, int gpu, int batch_size,
+                    const TrtSettings& trt) {
+  std::vector<int> min_batch, max_batch;
+  if (batch_size > 0) {
+    min_batch = max_batch = {batch_size};
+  } else {
+    // A profile per bucket, from the size after the previous bucket.
+    int previous = 0;
+    for (int bucket : trt.buckets) {
+      min_batch.push_back(previous + 1);
+      max_batch.push_back(bucket);
+      previous = bucket;
+    }
+  }
+  const std::vector<std::pair<std::string, std::string>> settings = {
+      {"device_id", std::to_string(gpu)},
+      {"trt_fp16_enable", trt.fp16 ? "1" : "0"},
+      {"trt_int8_enable", trt.int8 ? "1" : "0"},
+      {"trt_engine_cache_enable", "1"},
+      {"trt_engine_cache_path", trt.cache_dir},
+      {"trt_timing_cache_enable", "1"},
+      {"trt_timing_cache_path", trt.cache_dir},
+      {"trt_profile_min_shapes", TrtShapes(trt.input_name, min_batch)},
+      {"trt_profile_opt_shapes", TrtShapes(trt.input_name, max_batch)},
+      {"trt_profile_max_shapes", TrtShapes(trt.input_name, max_batch)},
+  };
+  std::vector<const char*> keys, values;
+  for (const auto& setting : settings) {
+    keys.push_back(setting.first.c_str());
+    values.push_back(setting.second.c_str());
+  }
+
+  const OrtApi& api = Ort::GetApi();
+  OrtTensorRTProviderOptionsV2* trt_options;
+  Ort::ThrowOnError(api.CreateTensorRTProviderOptions(&trt_options));
+  std::unique_ptr<OrtTensorRTProviderOptionsV2,
+                  decltype(api.ReleaseTensorRTProviderOptions)>
+      release(trt_options, api.ReleaseTensorRTProviderOptions);
+  Ort::ThrowOnError(api.UpdateTensorRTProviderOptions(
+      trt_options, keys.data(), values.data(), keys.size()));
+  options.AppendExecutionProvider_TensorRT_V2(*trt_options);
+
+  // The nodes TensorRT doesn't take run on CUDA.
+  OrtCUDAProviderOptions cuda_options;
+  cuda_options.device_id = gpu;
+  options.AppendExecutionProvider_CUDA(cuda_options);
+}
+
 Ort::SessionOptions GetOptions(OnnxProvider provider, int gpu, int threads,
-                               int batch_size) {
+                               int batch_size, const TrtSettings& trt) {
   Ort::SessionOptions options;
   options.SetIntraOpNumThreads(threads);
   options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
@@ -311,6 +402,9 @@ Ort::SessionOptions GetOptions(OnnxProvider provider, int gpu, int threads,
       options.AppendExecutionProvider_CUDA(cuda_options);
       break;
     }
+    case OnnxProvider::TRT:
+      AppendTensorRT(options, gpu, batch_size, trt);
+      break;
     case OnnxProvider::CPU:
       auto status = OrtSessionOptionsAppendExecutionProvider_CPU(options, 0);
       if (status) {
@@ -325,7 +419,7 @@ Ort::SessionOptions GetOptions(OnnxProvider provider, int gpu, int threads,
   return options;
 }
 
-OnnxNetwork::OnnxNetwork(const WeightsFile& file, const OptionsDict&,
+OnnxNetwork::OnnxNetwork(const WeightsFile& file, const OptionsDict& opts,
                          OnnxProvider provider, int gpu, int threads,
                          int batch_size, int steps)
     : onnx_env_(ORT_LOGGING_LEVEL_WARNING, "lc0"),
@@ -334,23 +428,55 @@ OnnxNetwork::OnnxNetwork(const WeightsFile& file, const OptionsDict&,
                     file.format().network_format().moves_left()},
       fp16_(file.onnx_model().data_type() == pblczero::OnnxModel::FLOAT16),
       batch_size_(batch_size),
-      provider_(provider) {
+      provider_(provider),
+      memory_info_(nullptr) {
+  session_sets_ = opts.GetOrDefault<int>(
+      "sessions", provider == OnnxProvider::CPU ? 1 : 2);
   // Sanity checks.
+  if (session_sets_ < 1) session_sets_ = 1;
   if (batch_size_ < 0) steps_ = 1;
   if (batch_size_ * steps > max_batch_size_) {
     batch_size_ = max_batch_size_ / steps_;
   }
 
-  for (int step = 1; step <= steps_; step++)
-    session_.emplace_back(
-        onnx_env_, file.onnx_model().model().data(),
-        file.onnx_model().model().size(),
-        GetOptions(provider, gpu, threads, batch_size_ * step));
-
   const auto& md = file.onnx_model();
   if (!md.has_input_planes()) {
     throw Exception("NN doesn't have input planes defined.");
   }
+
+  TrtSettings trt;
+  if (provider == OnnxProvider::TRT) {
+    trt.input_name = md.input_planes();
+    trt.fp16 = opts.GetOrDefault<bool>("fp16", true);
+    trt.int8 = opts.GetOrDefault<bool>("int8", false);
+    if (opts.Exists<std::string>("trt_cache")) {
+      trt.cache_dir = opts.Get<std::string>("trt_cache");
+    } else {
+      trt.cache_dir = GetUserCacheDirectory();
+      if (!trt.cache_dir.empty()) {
+        trt.cache_dir += "lc0/";
+        CreateDirectory(trt.cache_dir);
+      }
+      trt.cache_dir += "onnx_trt";
+    }
+    CreateDirectory(trt.cache_dir);
+    if (batch_size_ < 0) {
+      trt.buckets =
+          BatchBuckets::FromOptions(opts, max_batch_size_, 4).sizes();
+    }
+  }
+
+  for (int set = 0; set < session_sets_; set++) {
+    for (int step = 1; step <= steps_; step++) {
+      session_.emplace_back(
+          onnx_env_, file.onnx_model().model().data(),
+          file.onnx_model().model().size(),
+          GetOptions(provider, gpu, threads, batch_size_ * step, trt));
+    }
+  }
+  locks_ = std::make_unique<std::mutex[]>(session_sets_);
+  free_buffers_.resize(session_sets_);
+
   inputs_.emplace_back(md.input_planes());
   if (!md.has_output_policy()) {
     throw Exception("NN doesn't have policy head defined.");
@@ -376,6 +502,72 @@ OnnxNetwork::OnnxNetwork(const WeightsFile& file, const OptionsDict&,
   std::transform(outputs_.begin(), outputs_.end(),
                  std::back_inserter(outputs_cstr_),
                  [](const auto& x) { return x.c_str(); });
+
+  outputs_step_.resize(outputs_.size(), 1);
+  outputs_step_[policy_head_] = 1858;
+  if (wdl_head_ != -1) outputs_step_[wdl_head_] = 3;
+
+  if (provider_ == OnnxProvider::CUDA || provider_ == OnnxProvider::TRT) {
+    memory_info_ = Ort::MemoryInfo("CudaPinned", OrtDeviceAllocator, gpu,
+                                   OrtMemTypeCPUOutput);
+    pinned_allocator_ =
+        std::make_unique<Ort::Allocator>(session_[0], memory_info_);
+  } else {
+    memory_info_ =
+        Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
+  }
+}
+
+OnnxNetwork::~OnnxNetwork() {
+  for (auto& set_buffers : free_buffers_) {
+    for (auto& buffers : set_buffers) {
+      for (void* output : buffers->outputs) {
+        pinned_allocator_ ? pinned_allocator_->Free(output)
+                          : std::free(output);
+      }
+      pinned_allocator_ ? pinned_allocator_->Free(buffers->input)
+                        : std::free(buffers->input);
+    }
+  }
+}
+
+std::unique_ptr<OnnxBuffers> OnnxNetwork::GetBuffers() {
+  int set;
+  {
+    std::lock_guard<std::mutex> lock(buffers_lock_);
+    set = next_session_set_;
+    next_session_set_ = (next_session_set_ + 1) % session_sets_;
+    auto& set_buffers = free_buffers_[set];
+    if (!set_buffers.empty()) {
+      auto buffers = std::move(set_buffers.back());
+      set_buffers.pop_back();
+      return buffers;
+    }
+  }
+  // The last batch is padded up to a multiple of the batch size.
+  const size_t max_batch = max_batch_size_ + std::max(batch_size_, 0);
+  const size_t value_size = fp16_ ? sizeof(Ort::Float16_t) : sizeof(float);
+  auto alloc = [&](size_t size) {
+    void* memory = pinned_allocator_ ? pinned_allocator_->Alloc(size)
+                                     : std::malloc(size);
+    if (!memory) throw Exception("ONNX buffer allocation failed.");
+    return memory;
+  };
+  auto buffers = std::make_unique<OnnxBuffers>();
+  buffers->session_set = set;
+  buffers->input = alloc(max_batch * kInputPlanes * 64 * value_size);
+  for (size_t step : outputs_step_) {
+    buffers->outputs.push_back(alloc(max_batch * step * value_size));
+  }
+  for (int step = 1; step <= steps_; step++) {
+    buffers->bindings.emplace_back(session_[set * steps_ + step - 1]);
+  }
+  return buffers;
+}
+
+void OnnxNetwork::ReleaseBuffers(std::unique_ptr<OnnxBuffers> buffers) {
+  std::lock_guard<std::mutex> lock(buffers_lock_);
+  free_buffers_[buffers->session_set].push_back(std::move(buffers));
 }
 
 template <OnnxProvider kProvider>
@@ -409,6 +601,11 @@ std::unique_ptr<Network> MakeOnnxNetwork(const std::optional<WeightsFile>& w,
         "alt_mish", kProvider == OnnxProvider::CPU ? true : false);
     converter_options.alternative_layer_normalization =
         opts.GetOrDefault<bool>("alternative_layer_normalization", true);
+    converter_options.fuse_bias = opts.GetOrDefault<bool>("fuse_bias", false);
+    converter_options.fold_policy_map =
+        opts.GetOrDefault<bool>("fold_policy_map", true);
+    converter_options.quantize_int8 = opts.GetOrDefault<bool>("int8", false);
+    converter_options.mlh = opts.GetOrDefault<bool>("mlh", true);
     converter_options.data_type_ =
         fp16 ? WeightsToOnnxConverterOptions::DataType::kFloat16
              : WeightsToOnnxConverterOptions::DataType::kFloat32;
@@ -425,6 +622,7 @@ REGISTER_NETWORK("onnx-rocm", MakeOnnxNetwork<OnnxProvider::ROCM>, 64)
 #ifdef USE_DML
 REGISTER_NETWORK("onnx-dml", MakeOnnxNetwork<OnnxProvider::DML>, 63)
 #endif
+REGISTER_NETWORK("onnx-trt", MakeOnnxNetwork<OnnxProvider::TRT>, 60)
 REGISTER_NETWORK("onnx-cuda", MakeOnnxNetwork<OnnxProvider::CUDA>, 61)
 REGISTER_NETWORK("onnx-cpu", MakeOnnxNetwork<OnnxProvider::CPU>, 62)
 
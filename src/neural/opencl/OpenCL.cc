@@ -366,6 +366,23 @@ void OpenCL::initialize(const int channels, const OpenCLParams& params) {
 
   process_tuners(sgemm_tuners);
 
+  if (params.tune_background) {
+    m_tuner_thread = std::thread(
+        [this, t, channels, sgemm_tuners, batch = params.tune_batch_size]() {
+          auto tuner = t;
+          try {
+            tuner.tune_sgemm_background(channels, batch * WINOGRAD_P,
+                                        channels, WINOGRAD_TILE, sgemm_tuners,
+                                        m_tuner_stop);
+          } catch (const cl::Error& e) {
+            CERR << "Background SGEMM tuner stopped: " << e.what() << ": "
+                 << e.err();
+          } catch (const std::exception& e) {
+            CERR << "Background SGEMM tuner stopped: " << e.what();
+          }
+        });
+  }
+
   auto sgemm_kernel = cl::Kernel(m_program, "XgemmBatched");
 
   m_wavefront_size =
@@ -398,6 +415,11 @@ void OpenCL_Network::release_buffers(
   m_buffers_pool.push_back(std::move(buffers));
 }
 
+OpenCL::~OpenCL() {
+  m_tuner_stop = true;
+  if (m_tuner_thread.joinable()) m_tuner_thread.join();
+}
+
 std::string OpenCL::get_device_name() {
   std::stringstream ss;
 
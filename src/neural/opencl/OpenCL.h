@@ -30,10 +30,12 @@ using net_t = float;
 #define CL_HPP_TARGET_OPENCL_VERSION 120
 #endif
 #define CL_HPP_ENABLE_EXCEPTIONS
+#include <atomic>
 #include <cstddef>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "cl2.hpp"
@@ -234,6 +236,8 @@ class OpenCL {
   friend class Tuner;
 
  public:
+  ~OpenCL();
+
   void initialize(const int channels, const OpenCLParams& params);
   std::string get_device_name();
 
@@ -259,6 +263,9 @@ class OpenCL {
   size_t m_max_workgroup_size{0};
   std::vector<size_t> m_max_workgroup_dims;
   bool m_init_ok{false};
+
+  std::thread m_tuner_thread;
+  std::atomic<bool> m_tuner_stop{false};
 };
 
 extern const std::string sourceCode_sgemm;
@@ -29,4 +29,11 @@ struct OpenCLParams {
   bool tune_exhaustive = false;
   int tune_batch_size = 1;
   std::string tuner_file;
+  // Tunings are read from here when missing from tuner_file.
+  std::string tuner_import_file;
+  // Tunings in use are also written here, to be shipped to other machines.
+  std::string tuner_export_file;
+  bool tune_background = false;
+  // Pause between background tuning trials, in milliseconds.
+  int tune_background_interval = 1000;
 };
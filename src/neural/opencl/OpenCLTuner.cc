@@ -21,15 +21,19 @@
 
 #include "neural/opencl/OpenCLTuner.h"
 
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <chrono>
 #include <cmath>
+#include <cstdlib>
 #include <fstream>
 #include <iomanip>
 #include <map>
 #include <random>
 #include <sstream>
 #include <string>
+#include <thread>
 
 #include "neural/opencl/OpenCL.h"
 #include "neural/opencl/OpenCLParams.h"
@@ -179,61 +183,151 @@ static float compare_ref(std::vector<float>& x, std::vector<float>& ref,
   return sum / (m * n * batch_size);
 }
 
-std::string Tuner::tune_sgemm(const int m, const int n, const int k,
-                              const int batch_size, const int runs) {
-  auto opts = std::vector<Configurations>();
-  if (m_params.tune_exhaustive) {
-    opts = {
-        {"MWG", {16, 32, 64}},  {"NWG", {16, 32, 64}},  {"KWG", {16, 32}},
-        {"MDIMC", {8, 16, 32}}, {"NDIMC", {8, 16, 32}}, {"MDIMA", {8, 16, 32}},
-        {"NDIMB", {8, 16, 32}}, {"KWI", {2, 8}},        {"VWM", {1, 2, 4, 8}},
-        {"VWN", {1, 2, 4, 8}},  {"STRM", {0, 1}},       {"STRN", {0, 1}},
-        {"SA", {0, 1}},         {"SB", {0, 1}},
-    };
-  } else {
-    opts = {
-        {"MWG", {16, 32, 64}},  {"NWG", {16, 32, 64}},  {"KWG", {32}},
-        {"MDIMC", {8, 16, 32}}, {"NDIMC", {8, 16, 32}}, {"MDIMA", {8, 16, 32}},
-        {"NDIMB", {8, 16, 32}}, {"KWI", {2}},           {"VWM", {1, 2, 4}},
-        {"VWN", {1, 2, 4}},     {"STRM", {0}},          {"STRN", {0}},
-        {"SA", {0, 1}},         {"SB", {0, 1}},
-    };
+namespace {
+// Host data and device buffers for timing one batched SGEMM problem size.
+struct SgemmProblem {
+  SgemmProblem(cl::Context& context, cl::Device& device, const int m,
+               const int n, const int k, const int batch_size)
+      : m(m), n(n), k(k), batch_size(batch_size) {
+    // This needs to be at minimum the maximum (MNK/WG) values of
+    // Tuner::sgemm_configurations().
+    auto m_max = std::max(64, m);
+    auto n_max = std::max(64, n);
+    auto k_max = std::max(32, k);
+
+    at_size = batch_size * next_power_of_two(k_max) * next_power_of_two(m_max);
+    b_size = batch_size * next_power_of_two(k_max) * next_power_of_two(n_max);
+    c_size = batch_size * next_power_of_two(m_max) * next_power_of_two(n_max);
+
+    at.resize(at_size);
+    b.resize(b_size);
+    c.resize(c_size);
+    c_ref.resize(c_size);
+
+    sgemm_generate_data(at, k, m, batch_size, k, m);
+    sgemm_generate_data(b, n, k, batch_size, n, k);
+
+    sgemmBatched_ref(at, b, c_ref, m, n, k, batch_size);
+
+    aBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(float) * at_size,
+                         nullptr, nullptr);
+    bBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(float) * b_size,
+                         nullptr, nullptr);
+    cBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(float) * c_size,
+                         nullptr, nullptr);
+
+    queue = cl::CommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE);
+    program = cl::Program(context, sourceCode_sgemm);
+  }
+
+  int m, n, k, batch_size;
+  size_t at_size, b_size, c_size;
+  std::vector<float> at, b, c, c_ref;
+  cl::Buffer aBuffer, bBuffer, cBuffer;
+  cl::CommandQueue queue;
+  cl::Program program;
+  int m_ceil_prev = 0;
+  int n_ceil_prev = 0;
+  int k_ceil_prev = 0;
+};
+}  // namespace
+
+// Returns the average kernel time in nanoseconds, or 0 if the configuration
+// failed to build, to run or to produce correct results.
+static float time_sgemm(SgemmProblem& pr, TuneParameters& p,
+                        const std::string& args, const int runs) {
+  try {
+    pr.program.build(args.c_str());
+  } catch (const cl::Error&) {
+    // Failed to compile.
+    return 0.0f;
+  }
+
+  auto sgemm_kernel = cl::Kernel(pr.program, "XgemmBatched");
+  auto event = cl::Event();
+
+  auto m_ceil = (int)ceilMultiple(ceilMultiple(pr.m, p["MWG"]), p["VWM"]);
+  auto n_ceil = (int)ceilMultiple(ceilMultiple(pr.n, p["NWG"]), p["VWN"]);
+  auto k_ceil = (int)ceilMultiple(ceilMultiple(pr.k, p["KWG"]), p["VWM"]);
+
+  if (m_ceil != pr.m_ceil_prev || n_ceil != pr.n_ceil_prev ||
+      k_ceil != pr.k_ceil_prev) {
+    pr.m_ceil_prev = m_ceil;
+    pr.n_ceil_prev = n_ceil;
+    pr.k_ceil_prev = k_ceil;
+
+    sgemm_generate_data(pr.at, pr.k, pr.m, pr.batch_size, k_ceil, m_ceil);
+    sgemm_generate_data(pr.b, pr.n, pr.k, pr.batch_size, n_ceil, k_ceil);
+
+    pr.queue.enqueueWriteBuffer(pr.aBuffer, CL_FALSE, 0,
+                                pr.at_size * sizeof(float), pr.at.data());
+    pr.queue.enqueueWriteBuffer(pr.bBuffer, CL_FALSE, 0,
+                                pr.b_size * sizeof(float), pr.b.data());
+    pr.queue.finish();
   }
 
-  // This needs to be at minimum the maximum (MNK/WG) values above.
-  auto m_max = std::max(64, m);
-  auto n_max = std::max(64, n);
-  auto k_max = std::max(32, k);
+  sgemm_kernel.setArg(0, m_ceil);
+  sgemm_kernel.setArg(1, n_ceil);
+  sgemm_kernel.setArg(2, k_ceil);
+  sgemm_kernel.setArg(3, pr.aBuffer);
+  sgemm_kernel.setArg(4, pr.bBuffer);
+  sgemm_kernel.setArg(5, pr.cBuffer);
 
-  auto at_size =
-      batch_size * next_power_of_two(k_max) * next_power_of_two(m_max);
-  auto b_size =
-      batch_size * next_power_of_two(k_max) * next_power_of_two(n_max);
-  auto c_size =
-      batch_size * next_power_of_two(m_max) * next_power_of_two(n_max);
+  cl::NDRange local_sgemm = {p["MDIMC"], p["NDIMC"], 1};
 
-  auto total_flops = batch_size * 2.0 * m * n * k;
+  cl::NDRange size_sgemm = {(m_ceil * p["MDIMC"]) / p["MWG"],
+                            (n_ceil * p["NDIMC"]) / p["NWG"],
+                            (size_t)pr.batch_size};
 
-  auto at = std::vector<float>(at_size);
-  auto b = std::vector<float>(b_size);
-  auto c = std::vector<float>(c_size);
-  auto c_ref = std::vector<float>(c_size);
+  auto sum = 0.0f;
+  for (auto r = 0; r < runs; r++) {
+    try {
+      pr.queue.enqueueNDRangeKernel(sgemm_kernel, cl::NullRange, size_sgemm,
+                                    local_sgemm, nullptr, &event);
+      pr.queue.finish();
+      event.wait();
 
-  sgemm_generate_data(at, k, m, batch_size, k, m);
-  sgemm_generate_data(b, n, k, batch_size, n, k);
+      pr.queue.enqueueReadBuffer(pr.cBuffer, CL_FALSE, 0,
+                                 pr.c_size * sizeof(float), pr.c.data());
+      pr.queue.finish();
 
-  sgemmBatched_ref(at, b, c_ref, m, n, k, batch_size);
+      auto this_error = compare_ref(pr.c, pr.c_ref, pr.n, pr.m, pr.batch_size,
+                                    n_ceil, m_ceil);
+      if (this_error >= MAX_ERROR) return 0.0f;
 
-  auto aBuffer = cl::Buffer(m_context, CL_MEM_READ_WRITE,
-                            sizeof(float) * at_size, nullptr, nullptr);
-  auto bBuffer = cl::Buffer(m_context, CL_MEM_READ_WRITE,
-                            sizeof(float) * b_size, nullptr, nullptr);
-  auto cBuffer = cl::Buffer(m_context, CL_MEM_READ_WRITE,
-                            sizeof(float) * c_size, nullptr, nullptr);
+      auto elapsed = event.getProfilingInfo<CL_PROFILING_COMMAND_END>() -
+                     event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
 
-  CERR << "Started OpenCL SGEMM tuner with batch size " << n / WINOGRAD_P
-       << ".";
+      sum += elapsed;
+    } catch (const cl::Error&) {
+      // Failed to enqueue kernel.
+      return 0.0f;
+    }
+  }
+  return sum / runs;
+}
+
+std::vector<Configurations> Tuner::sgemm_configurations(bool exhaustive) {
+  if (exhaustive) {
+    return {
+        {"MWG", {16, 32, 64}},  {"NWG", {16, 32, 64}},  {"KWG", {16, 32}},
+        {"MDIMC", {8, 16, 32}}, {"NDIMC", {8, 16, 32}}, {"MDIMA", {8, 16, 32}},
+        {"NDIMB", {8, 16, 32}}, {"KWI", {2, 8}},        {"VWM", {1, 2, 4, 8}},
+        {"VWN", {1, 2, 4, 8}},  {"STRM", {0, 1}},       {"STRN", {0, 1}},
+        {"SA", {0, 1}},         {"SB", {0, 1}},
+    };
+  }
+  return {
+      {"MWG", {16, 32, 64}},  {"NWG", {16, 32, 64}},  {"KWG", {32}},
+      {"MDIMC", {8, 16, 32}}, {"NDIMC", {8, 16, 32}}, {"MDIMA", {8, 16, 32}},
+      {"NDIMB", {8, 16, 32}}, {"KWI", {2}},           {"VWM", {1, 2, 4}},
+      {"VWN", {1, 2, 4}},     {"STRM", {0}},          {"STRN", {0}},
+      {"SA", {0, 1}},         {"SB", {0, 1}},
+  };
+}
 
+std::vector<int> Tuner::valid_sgemm_configurations(
+    const std::vector<Configurations>& opts, bool exhaustive) {
   auto valid_params = std::vector<int>{};
   auto cfgs = 1;
   for (auto c = size_t{0}; c < opts.size(); c++) {
@@ -242,28 +336,44 @@ std::string Tuner::tune_sgemm(const int m, const int n, const int k,
 
   for (auto i = 0; i < cfgs; i++) {
     TuneParameters param = get_parameters_by_int(opts, i);
-    if (valid_config_sgemm(param, m_params.tune_exhaustive)) {
-      if (m_params.tune_exhaustive) {
-        //                if (rng.RandInt<std::uint16_t>(16) != 0) {
-        //                    continue;
-        //               }
-      }
+    if (valid_config_sgemm(param, exhaustive)) {
       valid_params.emplace_back(i);
     }
   }
+  return valid_params;
+}
 
-  CERR << "Will try " << valid_params.size() << " valid configurations.";
+TuneParameters Tuner::defines_to_parameters(const std::string& defines) {
+  TuneParameters p;
+  auto ss = std::stringstream{defines};
+  auto item = std::string{};
+  while (ss >> item) {
+    auto eq = item.find('=');
+    if (item.compare(0, 2, "-D") != 0 || eq == std::string::npos) continue;
+    p[item.substr(2, eq - 2)] = std::stoul(item.substr(eq + 1));
+  }
+  return p;
+}
 
-  std::string best_params;
-  auto best_time = unsigned{0};
+std::string Tuner::tune_sgemm(const int m, const int n, const int k,
+                              const int batch_size, const int runs,
+                              float* kernel_ns) {
+  auto opts = sgemm_configurations(m_params.tune_exhaustive);
 
-  auto queue = cl::CommandQueue(m_context, m_device, CL_QUEUE_PROFILING_ENABLE);
-  auto event = cl::Event();
-  auto program = cl::Program(m_context, sourceCode_sgemm);
+  auto total_flops = batch_size * 2.0 * m * n * k;
 
-  auto m_ceil_prev = 0;
-  auto n_ceil_prev = 0;
-  auto k_ceil_prev = 0;
+  auto problem = SgemmProblem(m_context, m_device, m, n, k, batch_size);
+
+  CERR << "Started OpenCL SGEMM tuner with batch size " << n / WINOGRAD_P
+       << ".";
+
+  auto valid_params =
+      valid_sgemm_configurations(opts, m_params.tune_exhaustive);
+
+  CERR << "Will try " << valid_params.size() << " valid configurations.";
+
+  std::string best_params;
+  auto best_time = 0.0f;
   auto param_counter = size_t{0};
 
   for (const auto& i : valid_params) {
@@ -271,104 +381,104 @@ std::string Tuner::tune_sgemm(const int m, const int n, const int k,
 
     auto p = get_parameters_by_int(opts, i);
     auto defines = parameters_to_defines(p);
+    auto time =
+        time_sgemm(problem, p, m_opencl.m_cl_args + " " + defines, runs);
 
-    try {
-      auto args = m_opencl.m_cl_args + " " + defines;
-      program.build(args.c_str());
-    } catch (const cl::Error&) {
-      // Failed to compile, get next parameter.
-      continue;
-    }
-
-    auto sgemm_kernel = cl::Kernel(program, "XgemmBatched");
-
-    auto m_ceil = (int)ceilMultiple(ceilMultiple(m, p["MWG"]), p["VWM"]);
-    auto n_ceil = (int)ceilMultiple(ceilMultiple(n, p["NWG"]), p["VWN"]);
-    auto k_ceil = (int)ceilMultiple(ceilMultiple(k, p["KWG"]), p["VWM"]);
-
-    if (m_ceil != m_ceil_prev || n_ceil != n_ceil_prev ||
-        k_ceil != k_ceil_prev) {
-      m_ceil_prev = m_ceil;
-      n_ceil_prev = n_ceil;
-      k_ceil_prev = k_ceil;
-
-      sgemm_generate_data(at, k, m, batch_size, k_ceil, m_ceil);
-      sgemm_generate_data(b, n, k, batch_size, n_ceil, k_ceil);
-
-      queue.enqueueWriteBuffer(aBuffer, CL_FALSE, 0, at_size * sizeof(float),
-                               at.data());
-      queue.enqueueWriteBuffer(bBuffer, CL_FALSE, 0, b_size * sizeof(float),
-                               b.data());
-      queue.finish();
-    }
-
-    sgemm_kernel.setArg(0, m_ceil);
-    sgemm_kernel.setArg(1, n_ceil);
-    sgemm_kernel.setArg(2, k_ceil);
-    sgemm_kernel.setArg(3, aBuffer);
-    sgemm_kernel.setArg(4, bBuffer);
-    sgemm_kernel.setArg(5, cBuffer);
-
-    cl::NDRange local_sgemm = {p["MDIMC"], p["NDIMC"], 1};
-
-    cl::NDRange size_sgemm = {(m_ceil * p["MDIMC"]) / p["MWG"],
-                              (n_ceil * p["NDIMC"]) / p["NWG"],
-                              (size_t)batch_size};
-
-    auto sum = 0.0f;
-    auto max_error = 0.0f;
-    for (auto r = 0; r < runs; r++) {
-      try {
-        queue.enqueueNDRangeKernel(sgemm_kernel, cl::NullRange, size_sgemm,
-                                   local_sgemm, nullptr, &event);
-        queue.finish();
-        event.wait();
-
-        queue.enqueueReadBuffer(cBuffer, CL_FALSE, 0, c_size * sizeof(float),
-                                c.data());
-        queue.finish();
-
-        auto this_error =
-            compare_ref(c, c_ref, n, m, batch_size, n_ceil, m_ceil);
-        max_error = std::max(max_error, this_error);
-
-        auto elapsed = event.getProfilingInfo<CL_PROFILING_COMMAND_END>() -
-                       event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
-
-        sum += elapsed;
-      } catch (const cl::Error&) {
-        // Failed to enqueue kernel. Set error to max.
-        max_error = MAX_ERROR;
-        break;
-      }
-    }
-    if (max_error < MAX_ERROR && (best_time == 0 || sum < best_time)) {
+    if (time > 0.0f && (best_time == 0.0f || time < best_time)) {
       auto param_str = parameters_to_string(p);
-      auto kernel_us = 1e-3f * (sum / runs);
+      auto kernel_us = 1e-3f * time;
       // Timing is in nanoseconds (10^-9), Giga = 10^9, so this works out.
-      auto kernel_gflops = total_flops / (sum / runs);
+      auto kernel_gflops = total_flops / time;
       CERR << std::fixed << std::setprecision(1) << "(" << param_counter << "/"
            << valid_params.size() << ") " << param_str << " " << kernel_us
            << " us (" << kernel_gflops << " GFLOPS)";
 
-      best_time = sum;
+      best_time = time;
       best_params = defines;
     }
   }
-  if (best_time == 0) {
+  if (best_time == 0.0f) {
     CERR << "Failed to find a working configuration." << std::endl
          << "Check your OpenCL drivers.";
     throw std::runtime_error("Tuner failed to find working configuration.");
   }
+  if (kernel_ns) *kernel_ns = best_time;
   return best_params;
 }
 
-void Tuner::store_sgemm_tuners(const int m, const int n, const int k,
-                               const int batch_size, std::string tuners) {
+void Tuner::tune_sgemm_background(const int m, const int n, const int k,
+                                  const int batch_size, std::string tuners,
+                                  const std::atomic<bool>& stop) {
+  auto opts = sgemm_configurations(true);
+  auto candidates = valid_sgemm_configurations(opts, true);
+  std::shuffle(candidates.begin(), candidates.end(),
+               std::mt19937(std::random_device()()));
+
+  auto problem = SgemmProblem(m_context, m_device, m, n, k, batch_size);
+
+  // Time the configuration in use under the same load as the candidates.
+  auto current = defines_to_parameters(tuners);
+  auto best_time =
+      time_sgemm(problem, current, m_opencl.m_cl_args + " " + tuners, 4);
+  if (best_time == 0.0f) return;
+
+  CERR << "Background SGEMM tuner will try " << candidates.size()
+       << " configurations.";
+
+  for (const auto& i : candidates) {
+    // Leave the device to the search most of the time.
+    for (auto slept = 0; slept < m_params.tune_background_interval;
+         slept += 10) {
+      if (stop) return;
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    if (stop) return;
+
+    auto p = get_parameters_by_int(opts, i);
+    auto defines = parameters_to_defines(p);
+    auto time = time_sgemm(problem, p, m_opencl.m_cl_args + " " + defines, 4);
+
+    // Require a clear improvement so that timing noise doesn't churn the
+    // tuning file.
+    if (time > 0.0f && time < 0.95f * best_time) {
+      CERR << std::fixed << std::setprecision(1)
+           << "Background SGEMM tuner: " << parameters_to_string(p) << " "
+           << 1e-3f * time << " us (was " << 1e-3f * best_time
+           << " us), will be used on next start.";
+      best_time = time;
+      store_sgemm_tuners(m_params.tuner_file, m, n, k, batch_size, defines,
+                         time);
+      if (!m_params.tuner_export_file.empty()) {
+        store_sgemm_tuners(m_params.tuner_export_file, m, n, k, batch_size,
+                           defines, time);
+      }
+    }
+  }
+  CERR << "Background SGEMM tuner finished.";
+}
+
+std::string Tuner::get_driver_version() {
+  return m_device.getInfo<CL_DRIVER_VERSION>();
+}
+
+static std::vector<std::string> split_tuner_line(const std::string& line) {
+  auto s = std::vector<std::string>{};
+  auto ss = std::stringstream{line};
+  auto item = std::string{};
+
+  while (std::getline(ss, item, ';')) {
+    s.emplace_back(item);
+  }
+  return s;
+}
+
+void Tuner::store_sgemm_tuners(const std::string& filename, const int m,
+                               const int n, const int k, const int batch_size,
+                               std::string tuners, const float kernel_ns) {
   auto file_contents = std::vector<std::string>();
   {
     // Read the previous contents to string.
-    auto file = std::ifstream{m_params.tuner_file};
+    auto file = std::ifstream{filename};
     if (file.good()) {
       auto line = std::string{};
       while (std::getline(file, line)) {
@@ -376,21 +486,32 @@ void Tuner::store_sgemm_tuners(const int m, const int n, const int k,
       }
     }
   }
-  auto file = std::ofstream{m_params.tuner_file};
+  auto file = std::ofstream{filename};
 
   auto device_name = m_opencl.get_device_name();
+  auto driver_version = get_driver_version();
   auto tuning_params = std::stringstream{};
   tuning_params << m << ";" << n << ";" << k << ";" << batch_size;
 
-  auto tuning_line_prefix = std::to_string(TUNER_VERSION) + ";XgemmBatched;" +
-                            tuning_params.str() + ";";
-  auto tuning_line = tuning_line_prefix + tuners + ";" + device_name;
+  auto tuning_line = std::to_string(TUNER_VERSION) + ";XgemmBatched;" +
+                     tuning_params.str() + ";" + tuners + ";" + device_name +
+                     ";" + driver_version + ";" +
+                     std::to_string(static_cast<long long>(kernel_ns));
 
   // Write back previous data as long as it's not the device and
-  // tuning we just tuned.
+  // tuning we just tuned. Entries from before the driver version was
+  // recorded are superseded as well.
   for (const auto& line : file_contents) {
-    if (line.find(tuning_line_prefix) == std::string::npos ||
-        line.find(device_name) == std::string::npos) {
+    auto s = split_tuner_line(line);
+    auto same_tuning = s.size() >= 8 && s[1] == "XgemmBatched" &&
+                       s[2] == std::to_string(m) &&
+                       s[3] == std::to_string(n) &&
+                       s[4] == std::to_string(k) &&
+                       s[5] == std::to_string(batch_size) &&
+                       s[7] == device_name;
+    auto same_driver =
+        s.size() == 8 || (s.size() >= 9 && s[8] == driver_version);
+    if (!same_tuning || !same_driver) {
       file << line << std::endl;
     }
   }
@@ -400,26 +521,27 @@ void Tuner::store_sgemm_tuners(const int m, const int n, const int k,
 
   if (file.fail()) {
     CERR << "Could not save the tuning result.";
-    CERR << "Do I have write permissions on " << m_params.tuner_file << "?";
+    CERR << "Do I have write permissions on " << filename << "?";
   }
 }
 
 std::string Tuner::sgemm_tuners_from_line(std::string line, const int m,
                                           const int n, const int k,
-                                          const int batch_size) {
-  auto s = std::vector<std::string>{};
-  auto ss = std::stringstream{line};
-  auto item = std::string{};
+                                          const int batch_size,
+                                          float* kernel_ns) {
+  auto s = split_tuner_line(line);
 
-  while (std::getline(ss, item, ';')) {
-    s.emplace_back(item);
+  // Version 0 entries carry no driver version or timing.
+  if (s.size() == 8 && s[0] == "0") {
+    s.emplace_back(get_driver_version());
+    s.emplace_back("0");
   }
 
-  if (s.size() != 8) {
+  if (s.size() != 10) {
     return "";
   }
 
-  if (s[0] != std::to_string(TUNER_VERSION)) {
+  if (s[0] != "0" && s[0] != std::to_string(TUNER_VERSION)) {
     return "";
   }
 
@@ -447,37 +569,71 @@ std::string Tuner::sgemm_tuners_from_line(std::string line, const int m,
     return "";
   }
 
+  if (s[8] != get_driver_version()) {
+    return "";
+  }
+
+  if (kernel_ns) *kernel_ns = std::strtof(s[9].c_str(), nullptr);
   return s[6];
 }
 
+std::string Tuner::read_sgemm_tuners(const std::string& filename, const int m,
+                                     const int n, const int k,
+                                     const int batch_size, float* kernel_ns) {
+  auto file = std::ifstream{filename};
+  if (file.good()) {
+    auto line = std::string{};
+    while (std::getline(file, line)) {
+      auto tuners =
+          sgemm_tuners_from_line(line, m, n, k, batch_size, kernel_ns);
+      if (tuners.size() != 0) return tuners;
+    }
+  }
+  return "";
+}
+
 std::string Tuner::load_sgemm_tuners(const int m, const int n, const int k,
                                      const int batch_size) {
+  auto tuners = std::string{};
+  auto kernel_ns = 0.0f;
   if (!m_params.force_tune) {
-    auto file = std::ifstream{m_params.tuner_file};
-    if (file.good()) {
-      auto line = std::string{};
-      while (std::getline(file, line)) {
-        auto tuners = sgemm_tuners_from_line(line, m, n, k, batch_size);
-        if (tuners.size() != 0) {
-          // batch_size argument is the number of batched sgemm calls, which
-          // equals the number of elements in one tile.
-          // Convolution batch size affects the "n" dimension of
-          // the matrix multiplication (n = WINOGRAD_P * batch_size).
-          CERR << "Loaded existing SGEMM tuning for batch size "
-               << n / WINOGRAD_P << ".";
-          return tuners;
-        }
+    tuners = read_sgemm_tuners(m_params.tuner_file, m, n, k, batch_size,
+                               &kernel_ns);
+    if (tuners.size() != 0) {
+      // batch_size argument is the number of batched sgemm calls, which
+      // equals the number of elements in one tile.
+      // Convolution batch size affects the "n" dimension of
+      // the matrix multiplication (n = WINOGRAD_P * batch_size).
+      CERR << "Loaded existing SGEMM tuning for batch size "
+           << n / WINOGRAD_P << ".";
+    } else if (!m_params.tuner_import_file.empty()) {
+      tuners = read_sgemm_tuners(m_params.tuner_import_file, m, n, k,
+                                 batch_size, &kernel_ns);
+      if (tuners.size() != 0) {
+        CERR << "Imported SGEMM tuning for batch size " << n / WINOGRAD_P
+             << " from " << m_params.tuner_import_file << ".";
+        store_sgemm_tuners(m_params.tuner_file, m, n, k, batch_size, tuners,
+                           kernel_ns);
       }
     }
   }
 
-  auto tuners = tune_sgemm(m, n, k, batch_size);
-  store_sgemm_tuners(m, n, k, batch_size, tuners);
+  auto tuned = tuners.size() == 0;
+  if (tuned) {
+    tuners = tune_sgemm(m, n, k, batch_size, 4, &kernel_ns);
+    store_sgemm_tuners(m_params.tuner_file, m, n, k, batch_size, tuners,
+                       kernel_ns);
+  }
+
+  if (!m_params.tuner_export_file.empty()) {
+    store_sgemm_tuners(m_params.tuner_export_file, m, n, k, batch_size, tuners,
+                       kernel_ns);
+  }
 
   // Exit immediately after tuning. Some NVIDIA drivers are buggy,
   // and will fail to compile the rest of the kernels after a tuning,
   // run. See #729.
-  if (m_params.tune_only) {
+  if (tuned && m_params.tune_only) {
     exit(EXIT_SUCCESS);
   }
   return tuners;
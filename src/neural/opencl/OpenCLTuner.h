@@ -21,6 +21,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <map>
 #include <string>
 #include <vector>
@@ -42,11 +43,18 @@ class Tuner {
 
  public:
   std::string tune_sgemm(const int m, const int n, const int k,
-                         const int batch_size, const int runs = 4);
+                         const int batch_size, const int runs = 4,
+                         float* kernel_ns = nullptr);
   std::string load_sgemm_tuners(const int m, const int n, const int k,
                                 const int batch_size);
+  // Times random untried configurations against the tuners in use until all
+  // were tried or stop is set. Improvements are stored for the next start.
+  void tune_sgemm_background(const int m, const int n, const int k,
+                             const int batch_size, std::string tuners,
+                             const std::atomic<bool>& stop);
 
-  static constexpr auto TUNER_VERSION = 0;
+  // Version 1 added the driver version and the kernel time to each entry.
+  static constexpr auto TUNER_VERSION = 1;
   Tuner(OpenCL& opencl, const OpenCLParams& params, cl::Context context,
         cl::Device device)
       : m_opencl(opencl),
@@ -55,13 +63,23 @@ class Tuner {
         m_device(device) {}
 
  private:
-  void store_sgemm_tuners(const int m, const int n, const int k,
-                          const int batch_size, std::string tuners);
+  void store_sgemm_tuners(const std::string& filename, const int m,
+                          const int n, const int k, const int batch_size,
+                          std::string tuners, const float kernel_ns);
+  std::string read_sgemm_tuners(const std::string& filename, const int m,
+                                const int n, const int k, const int batch_size,
+                                float* kernel_ns);
+  std::string get_driver_version();
   bool valid_config_sgemm(TuneParameters p, bool exhaustive);
+  std::vector<Configurations> sgemm_configurations(bool exhaustive);
+  std::vector<int> valid_sgemm_configurations(
+      const std::vector<Configurations>& opts, bool exhaustive);
+  TuneParameters defines_to_parameters(const std::string& defines);
   std::string parameters_to_defines(const TuneParameters& p);
   std::string parameters_to_string(const TuneParameters& p);
   TuneParameters get_parameters_by_int(const std::vector<Configurations>& opts,
                                        const int n);
   std::string sgemm_tuners_from_line(std::string line, const int m, const int n,
-                                     const int k, const int batch_size);
+                                     const int k, const int batch_size,
+                                     float* kernel_ns);
 };
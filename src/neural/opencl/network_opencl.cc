@@ -256,6 +256,14 @@ class OpenCLNetwork : public Network {
     } else {
       params_.tuner_file = options.Get<std::string>("tuner_file");
     }
+    params_.tuner_import_file =
+        options.GetOrDefault<std::string>("tuner_import", "");
+    params_.tuner_export_file =
+        options.GetOrDefault<std::string>("tuner_export", "");
+    params_.tune_background =
+        options.GetOrDefault<bool>("tune_background", false);
+    params_.tune_background_interval =
+        options.GetOrDefault<int>("tune_background_interval", 1000);
 
     wdl_ = file.format().network_format().output() ==
            pblczero::NetworkFormat::OUTPUT_WDL;
@@ -0,0 +1,247 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "neural/persistent_cache.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include "utils/exception.h"
+#include "utils/hashcat.h"
+#include "utils/logging.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace lczero {
+namespace {
+// "LNC2" in a little endian file. Lets readers resynchronize after a record
+// torn by a crashed writer.
+constexpr uint32_t kRecordMagic = 0x32434e4c;
+// Magic, key and checksum.
+constexpr size_t kRecordHeaderBytes =
+    sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t);
+// The file is mapped at least this far, and twice as far as it got.
+constexpr size_t kMinMappedBytes = 16 * 1024 * 1024;
+
+// Checksum of a record with @key and the serialized request at @data.
+uint32_t RecordChecksum(uint64_t key, const char* data, size_t size) {
+  uint64_t hash = HashCat(key, size);
+  for (size_t i = 0; i < size; i += sizeof(uint64_t)) {
+    uint64_t word = 0;
+    std::memcpy(&word, data + i, std::min(sizeof(word), size - i));
+    hash = HashCat(hash, word);
+  }
+  return static_cast<uint32_t>(hash);
+}
+}  // namespace
+
+#ifdef _WIN32
+
+PersistentNNCache::PersistentNNCache(const std::string& filename,
+                                     uint64_t network_key, size_t max_bytes)
+    : filename_(filename), network_key_(network_key), max_bytes_(max_bytes) {
+  throw Exception("Persistent NN cache is not supported on Windows.");
+}
+
+PersistentNNCache::~PersistentNNCache() {}
+
+void PersistentNNCache::Append(const std::string&) {}
+
+void PersistentNNCache::Refresh() {}
+
+#else
+
+PersistentNNCache::PersistentNNCache(const std::string& filename,
+                                     uint64_t network_key, size_t max_bytes)
+    : filename_(filename), network_key_(network_key), max_bytes_(max_bytes) {
+  fd_ = open(filename.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (fd_ < 0) throw Exception("Cannot open NN cache file: " + filename);
+  Mutex::Lock file_lock(file_mutex_);
+  SharedMutex::Lock lock(mutex_);
+  flock(fd_, LOCK_SH);
+  Refresh();
+  flock(fd_, LOCK_UN);
+  CERR << "Loaded " << index_.size() << " NN evaluations from " << filename;
+}
+
+PersistentNNCache::~PersistentNNCache() {
+  if (data_) munmap(const_cast<char*>(data_), mapped_size_);
+  close(fd_);
+}
+
+void PersistentNNCache::Append(const std::string& batch) {
+  if (batch.empty()) return;
+  Mutex::Lock file_lock(file_mutex_);
+  // Other processes append whole batches under the same lock, so records
+  // never interleave and readers never see one half written.
+  flock(fd_, LOCK_EX);
+  const off_t start = lseek(fd_, 0, SEEK_END);
+  if (start >= 0 && static_cast<size_t>(start) + batch.size() <= max_bytes_) {
+    for (size_t written = 0; written < batch.size();) {
+      const ssize_t res =
+          write(fd_, batch.data() + written, batch.size() - written);
+      if (res < 0) {
+        if (errno == EINTR) continue;
+        CERR << "Cannot write NN cache file: " << filename_;
+        // Don't leave a torn record behind, e.g. when the disk is full.
+        if (ftruncate(fd_, start) < 0) {
+          CERR << "Cannot truncate NN cache file: " << filename_;
+        }
+        break;
+      }
+      written += res;
+    }
+  } else if (start >= 0 && !full_) {
+    full_ = true;
+    CERR << "NN cache file " << filename_
+         << " reached its size limit, no longer appending to it.";
+  }
+  {
+    SharedMutex::Lock lock(mutex_);
+    Refresh();
+  }
+  flock(fd_, LOCK_UN);
+}
+
+void PersistentNNCache::Refresh() {
+  struct stat s;
+  if (fstat(fd_, &s) < 0) return;
+  const size_t size = s.st_size;
+  if (size <= indexed_end_) return;
+  if (size > mapped_size_) {
+    if (data_) munmap(const_cast<char*>(data_), mapped_size_);
+    // Pages past the end of the file become readable as it grows.
+    size_t map_size = std::max(
+        size, std::min(max_bytes_, std::max(2 * size, kMinMappedBytes)));
+    void* data = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd_, 0);
+    if (data == MAP_FAILED && map_size > size) {
+      map_size = size;
+      data = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd_, 0);
+    }
+    if (data == MAP_FAILED) {
+      data_ = nullptr;
+      mapped_size_ = 0;
+      indexed_end_ = 0;
+      index_.clear();
+      CERR << "Cannot map NN cache file: " << filename_;
+      return;
+    }
+    data_ = static_cast<const char*>(data);
+    mapped_size_ = map_size;
+  }
+
+  size_t pos = indexed_end_;
+  while (pos + kRecordHeaderBytes <= size) {
+    uint32_t magic;
+    std::memcpy(&magic, data_ + pos, sizeof(magic));
+    if (magic != kRecordMagic) {
+      pos++;
+      continue;
+    }
+    uint64_t key;
+    std::memcpy(&key, data_ + pos + sizeof(magic), sizeof(key));
+    uint32_t checksum;
+    std::memcpy(&checksum, data_ + pos + sizeof(magic) + sizeof(key),
+                sizeof(checksum));
+    const char* request = data_ + pos + kRecordHeaderBytes;
+    const size_t request_size = CachedNNRequest::ReadSerializedSize(
+        request, size - pos - kRecordHeaderBytes);
+    // No record is being written while the file is locked, so this one was
+    // torn. Look for the next one.
+    if (request_size == 0 ||
+        RecordChecksum(key, request, request_size) != checksum) {
+      pos++;
+      continue;
+    }
+    index_.emplace(key, pos + kRecordHeaderBytes);
+    pos += kRecordHeaderBytes + request_size;
+  }
+  indexed_end_ = pos;
+}
+
+#endif
+
+std::unique_ptr<CachedNNRequest> PersistentNNCache::Lookup(uint64_t hash) {
+  SharedMutex::SharedLock lock(mutex_);
+  const auto iter = index_.find(HashCat(hash, network_key_));
+  if (iter == index_.end()) return nullptr;
+  return CachedNNRequest::Deserialize(data_ + iter->second,
+                                      indexed_end_ - iter->second);
+}
+
+void PersistentNNCache::AddToBatch(std::string* batch, uint64_t hash,
+                                   const CachedNNRequest& request) const {
+  const uint64_t key = HashCat(hash, network_key_);
+  const size_t pos = batch->size();
+  batch->resize(pos + kRecordHeaderBytes + request.GetSerializedSize());
+  char* out = &(*batch)[pos];
+  request.Serialize(out + kRecordHeaderBytes);
+  const uint32_t checksum = RecordChecksum(key, out + kRecordHeaderBytes,
+                                           request.GetSerializedSize());
+  std::memcpy(out, &kRecordMagic, sizeof(kRecordMagic));
+  std::memcpy(out + sizeof(kRecordMagic), &key, sizeof(key));
+  std::memcpy(out + sizeof(kRecordMagic) + sizeof(key), &checksum,
+              sizeof(checksum));
+}
+
+size_t PersistentNNCache::GetSize() {
+  SharedMutex::SharedLock lock(mutex_);
+  return index_.size();
+}
+
+uint64_t PersistentNNCache::GetNetworkKey(const std::string& weights_path) {
+  if (weights_path.empty()) return 0;
+  std::ifstream file(weights_path, std::ios::binary);
+  if (!file) throw Exception("Cannot read weights file: " + weights_path);
+  uint64_t hash = 0;
+  std::vector<char> buffer(1 << 20);
+  while (file) {
+    file.read(buffer.data(), buffer.size());
+    const size_t size = file.gcount();
+    // Zero padding of the last word doesn't matter, the size goes in too.
+    for (size_t i = 0; i < size; i += sizeof(uint64_t)) {
+      uint64_t word = 0;
+      std::memcpy(&word, buffer.data() + i,
+                  std::min(sizeof(word), size - i));
+      hash = HashCat(hash, word);
+    }
+    hash = HashCat(hash, size);
+  }
+  return hash;
+}
+
+}  // namespace lczero
@@ -0,0 +1,102 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "neural/cache.h"
+#include "utils/mutex.h"
+
+namespace lczero {
+
+// NN evaluations in a file which several lc0 processes use at once, as a
+// second tier behind NNCache. The file is a sequence of records which are
+// only ever appended: a magic number, the position hash combined with the
+// network key, a checksum, and a serialized CachedNNRequest. Every process
+// maps the file and indexes the records it sees, so appends of others become
+// visible when it's refreshed, which happens after each own append.
+// Appends are made under an exclusive lock of the file and cut back when the
+// write fails, and the file is indexed under a shared one. So a record which
+// doesn't parse or match its checksum was torn by a writer which died, and is
+// skipped. Not supported on Windows.
+class PersistentNNCache {
+ public:
+  // Opens @filename, creating it if needed. Evaluations of the network with
+  // @network_key are used. Appends stop when the file would grow over
+  // @max_bytes, which also bounds the index. Throws Exception if the file
+  // cannot be opened.
+  PersistentNNCache(const std::string& filename, uint64_t network_key,
+                    size_t max_bytes);
+  ~PersistentNNCache();
+  PersistentNNCache(const PersistentNNCache&) = delete;
+  PersistentNNCache& operator=(const PersistentNNCache&) = delete;
+
+  // Returns a copy of the evaluation of @hash, or nullptr if there's none.
+  std::unique_ptr<CachedNNRequest> Lookup(uint64_t hash);
+  // Serializes @request to the end of @batch, to be written by Append().
+  void AddToBatch(std::string* batch, uint64_t hash,
+                  const CachedNNRequest& request) const;
+  // Appends @batch to the file in one locked write, unless the file would get
+  // too large, then picks up what other processes appended.
+  void Append(const std::string& batch);
+  // Number of distinct evaluations indexed so far.
+  size_t GetSize();
+
+  // Returns the key of the network in @weights_path, a hash of its contents.
+  // Backends without a weights file get 0.
+  static uint64_t GetNetworkKey(const std::string& weights_path);
+
+ private:
+  // Maps the file as far as it got and indexes the new complete records.
+  // The file must be locked.
+  void Refresh() REQUIRES(file_mutex_, mutex_);
+
+  const std::string filename_;
+  const uint64_t network_key_;
+  const size_t max_bytes_;
+  int fd_ = -1;
+  // Held while the file is locked. The lock belongs to the file descriptor,
+  // which the threads of the process share.
+  Mutex file_mutex_{"PersistentNNCache::file_mutex_"};
+  bool full_ GUARDED_BY(file_mutex_) = false;
+  SharedMutex mutex_ ACQUIRED_AFTER(file_mutex_){"PersistentNNCache::mutex_"};
+  const char* data_ GUARDED_BY(mutex_) = nullptr;
+  // Length of the mapping, which reaches past the end of the file so that it
+  // doesn't have to be redone after every append.
+  size_t mapped_size_ GUARDED_BY(mutex_) = 0;
+  // End of the last complete record indexed.
+  size_t indexed_end_ GUARDED_BY(mutex_) = 0;
+  // Offsets of the serialized requests by their record key.
+  std::unordered_map<uint64_t, size_t> index_ GUARDED_BY(mutex_);
+};
+
+}  // namespace lczero
@@ -0,0 +1,105 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "neural/persistent_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+
+namespace lczero {
+namespace {
+
+std::unique_ptr<CachedNNRequest> MakeRequest(float q) {
+  auto request = CachedNNRequest::Create(3);
+  request->SetValues(q, 0.25f, 10.0f);
+  const float policy[] = {0.0f, -1.0f, -2.0f};
+  request->SetPolicy(policy);
+  return request;
+}
+
+std::string MakeBatch(const PersistentNNCache& cache, uint64_t hash,
+                      float q) {
+  std::string batch;
+  cache.AddToBatch(&batch, hash, *MakeRequest(q));
+  return batch;
+}
+
+}  // namespace
+
+TEST(PersistentNNCache, SkipsTornRecords) {
+  const std::string filename = ::testing::TempDir() + "persistent_torn.bin";
+  std::remove(filename.c_str());
+  PersistentNNCache cache(filename, 7, 1 << 20);
+  cache.Append(MakeBatch(cache, 1, 0.5f));
+  {
+    // A writer which died halfway through its record.
+    const std::string torn = MakeBatch(cache, 2, 0.5f);
+    std::ofstream file(filename, std::ios::binary | std::ios::app);
+    file.write(torn.data(), torn.size() / 2);
+  }
+  cache.Append(MakeBatch(cache, 3, -0.5f));
+  EXPECT_EQ(cache.GetSize(), 2u);
+  EXPECT_EQ(cache.Lookup(2), nullptr);
+  ASSERT_NE(cache.Lookup(3), nullptr);
+  EXPECT_EQ(cache.Lookup(3)->GetQ(), -0.5f);
+
+  PersistentNNCache reopened(filename, 7, 1 << 20);
+  EXPECT_EQ(reopened.GetSize(), 2u);
+  ASSERT_NE(reopened.Lookup(1), nullptr);
+  EXPECT_EQ(reopened.Lookup(1)->GetQ(), 0.5f);
+  EXPECT_EQ(reopened.Lookup(1)->GetNumMoves(), 3);
+  EXPECT_NE(reopened.Lookup(3), nullptr);
+  // Other networks have their own entries.
+  PersistentNNCache other_network(filename, 8, 1 << 20);
+  EXPECT_EQ(other_network.Lookup(1), nullptr);
+}
+
+TEST(PersistentNNCache, StopsAppendingAtSizeLimit) {
+  const std::string filename = ::testing::TempDir() + "persistent_full.bin";
+  std::remove(filename.c_str());
+  size_t record_bytes;
+  {
+    PersistentNNCache probe(filename, 7, 0);
+    record_bytes = MakeBatch(probe, 1, 0.5f).size();
+  }
+  // Room for two and a half records.
+  PersistentNNCache cache(filename, 7, 2 * record_bytes + record_bytes / 2);
+  cache.Append(MakeBatch(cache, 1, 0.5f));
+  cache.Append(MakeBatch(cache, 2, 0.5f));
+  cache.Append(MakeBatch(cache, 3, 0.5f));
+  EXPECT_EQ(cache.GetSize(), 2u);
+  EXPECT_EQ(cache.Lookup(3), nullptr);
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,289 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "neural/factory.h"
+#include "neural/remote/protocol.h"
+#include "utils/exception.h"
+#include "utils/logging.h"
+#include "utils/string.h"
+
+namespace lczero {
+namespace remote {
+namespace {
+
+class RemoteNetwork;
+
+class RemoteComputation : public NetworkComputation {
+ public:
+  RemoteComputation(RemoteNetwork* network) : network_(network) {}
+
+  void AddInput(InputPlanes&& input) override {
+    AppendSample(&request_, input, {});
+    num_moves_.push_back(0);
+  }
+
+  void AddInputWithMoves(InputPlanes&& input,
+                         const std::vector<uint16_t>& moves) override {
+    AppendSample(&request_, input, moves);
+    num_moves_.push_back(moves.size());
+  }
+
+  void ComputeBlocking() override;
+
+  int GetBatchSize() const override { return num_moves_.size(); }
+
+  float GetQVal(int sample) const override {
+    return results_[offsets_[sample]];
+  }
+
+  float GetDVal(int sample) const override {
+    return results_[offsets_[sample] + 1];
+  }
+
+  float GetMVal(int sample) const override {
+    return results_[offsets_[sample] + 2];
+  }
+
+  // Only valid for samples added without moves.
+  float GetPVal(int sample, int move_id) const override {
+    return results_[offsets_[sample] + 3 + move_id];
+  }
+
+  float GetLegalPVal(int sample, int move_ordinal,
+                     int move_id) const override {
+    if (num_moves_[sample] == 0) return GetPVal(sample, move_id);
+    return results_[offsets_[sample] + 3 + move_ordinal];
+  }
+
+ private:
+  RemoteNetwork* network_;
+  // Serialized samples.
+  std::string request_;
+  std::vector<int> num_moves_;
+  // Results of all samples, and where each sample's start.
+  std::vector<float> results_;
+  std::vector<size_t> offsets_;
+};
+
+// Spreads the computations over one or more inference servers, listed
+// comma separated in the "address" option. Each computation goes to the
+// server with the fewest samples in flight, so that faster hosts get more of
+// the work, and is retried on another server if its server fails.
+// The batches are scheduled by the servers as those of the job named by the
+// "job" option, with its "job_priority" and "job_quota".
+class RemoteNetwork : public Network {
+ public:
+  RemoteNetwork(const OptionsDict& options)
+      : threads_(options.GetOrDefault<int>("threads", 2)),
+        max_batch_(options.GetOrDefault<int>("max_batch", 256)),
+        job_(MakeJobInfo(options)) {
+    const std::string addresses =
+        options.GetOrDefault<std::string>("address", "unix:/tmp/lc0.sock");
+    for (const auto& address : StrSplit(addresses, ",")) {
+      if (Trim(address).empty()) continue;
+      servers_.push_back(std::make_unique<Server>(Trim(address)));
+      // The server tells what its network is like on connection.
+      Hello hello;
+      auto socket = Connect(servers_.back().get(), &hello);
+      const NetworkCapabilities capabilities{
+          static_cast<pblczero::NetworkFormat::InputFormat>(
+              hello.input_format),
+          static_cast<pblczero::NetworkFormat::MovesLeftFormat>(
+              hello.moves_left)};
+      if (servers_.size() == 1) {
+        capabilities_ = capabilities;
+      } else {
+        capabilities_.Merge(capabilities);
+      }
+      ReleaseSocket(servers_.back().get(), std::move(socket));
+      CERR << "Connected to inference server at " << servers_.back()->address
+           << ".";
+    }
+    if (servers_.empty()) throw Exception("No inference server address.");
+  }
+
+  std::unique_ptr<NetworkComputation> NewComputation() override {
+    return std::make_unique<RemoteComputation>(this);
+  }
+
+  const NetworkCapabilities& GetCapabilities() const override {
+    return capabilities_;
+  }
+
+  // Enough threads to keep all servers busy.
+  int GetThreads() const override { return threads_ * servers_.size(); }
+
+  int GetMiniBatchSize() const override { return max_batch_; }
+
+  // Sends @request of @batch_size samples and reads the answer into @results,
+  // trying every server once before giving up.
+  void Evaluate(const RequestHeader& header, const std::string& request,
+                std::vector<float>* results) {
+    std::vector<bool> tried(servers_.size());
+    for (size_t attempt = 0;; attempt++) {
+      Server* server = PickServer(&tried);
+      server->in_flight.fetch_add(header.batch_size);
+      try {
+        auto socket = AcquireSocket(server);
+        socket->Write(&header, sizeof(header));
+        socket->Write(request.data(), request.size());
+        socket->Read(results->data(), results->size() * sizeof(float));
+        // Sockets which failed are dropped by the exceptions above.
+        ReleaseSocket(server, std::move(socket));
+        server->in_flight.fetch_sub(header.batch_size);
+        return;
+      } catch (const Exception& e) {
+        server->in_flight.fetch_sub(header.batch_size);
+        server->retry_at.store(Now() + kRetryDelayMs);
+        if (attempt + 1 >= servers_.size()) throw;
+        CERR << "Inference server at " << server->address
+             << " failed, retrying elsewhere: " << e.what();
+      }
+    }
+  }
+
+ private:
+  struct Server {
+    explicit Server(const std::string& address) : address(address) {}
+    const std::string address;
+    // Samples sent to the server and not answered yet.
+    std::atomic<int> in_flight{0};
+    // Servers which failed are only used again after this time, in ms.
+    std::atomic<int64_t> retry_at{0};
+    std::mutex sockets_mutex;
+    std::list<std::unique_ptr<Socket>> sockets;
+  };
+
+  static constexpr int64_t kRetryDelayMs = 5000;
+
+  static JobInfo MakeJobInfo(const OptionsDict& options) {
+    JobInfo job{};
+    const auto name = options.GetOrDefault<std::string>("job", "default");
+    if (name.size() >= sizeof(job.name)) {
+      throw Exception("Job name too long: " + name);
+    }
+    name.copy(job.name, name.size());
+    job.priority = options.GetOrDefault<int>("job_priority", 0);
+    job.quota = options.GetOrDefault<float>("job_quota", 0.0f);
+    return job;
+  }
+
+  static int64_t Now() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  // Picks the least loaded server not tried yet, preferring the ones which
+  // didn't fail recently, and marks it as tried.
+  Server* PickServer(std::vector<bool>* tried) {
+    const int64_t now = Now();
+    int best = -1;
+    auto key = [&](int i) {
+      return std::make_pair(servers_[i]->retry_at.load() > now,
+                            servers_[i]->in_flight.load());
+    };
+    for (int i = 0; i < static_cast<int>(servers_.size()); i++) {
+      if ((*tried)[i]) continue;
+      if (best < 0 || key(i) < key(best)) best = i;
+    }
+    (*tried)[best] = true;
+    return servers_[best].get();
+  }
+
+  // Takes an idle connection, or opens a new one.
+  std::unique_ptr<Socket> AcquireSocket(Server* server) {
+    {
+      std::lock_guard<std::mutex> lock(server->sockets_mutex);
+      if (!server->sockets.empty()) {
+        auto socket = std::move(server->sockets.front());
+        server->sockets.pop_front();
+        return socket;
+      }
+    }
+    Hello hello;
+    return Connect(server, &hello);
+  }
+
+  void ReleaseSocket(Server* server, std::unique_ptr<Socket> socket) {
+    std::lock_guard<std::mutex> lock(server->sockets_mutex);
+    server->sockets.push_back(std::move(socket));
+  }
+
+  std::unique_ptr<Socket> Connect(Server* server, Hello* hello) {
+    auto socket = std::make_unique<Socket>(Socket::Connect(server->address));
+    socket->Read(hello, sizeof(*hello));
+    if (hello->magic != kMagic || hello->version != kVersion) {
+      throw Exception("Incompatible inference server at " + server->address +
+                      ".");
+    }
+    socket->Write(&job_, sizeof(job_));
+    return socket;
+  }
+
+  const int threads_;
+  const int max_batch_;
+  const JobInfo job_;
+  NetworkCapabilities capabilities_;
+  std::vector<std::unique_ptr<Server>> servers_;
+};
+
+void RemoteComputation::ComputeBlocking() {
+  if (num_moves_.empty()) return;
+  if (num_moves_.size() > kMaxBatchSize) {
+    throw Exception("Batch too large for the inference server.");
+  }
+  offsets_.clear();
+  size_t size = 0;
+  for (const int num_moves : num_moves_) {
+    offsets_.push_back(size);
+    size += 3 + (num_moves == 0 ? kPolicyOutputs : num_moves);
+  }
+  results_.resize(size);
+
+  const RequestHeader header{static_cast<uint32_t>(num_moves_.size()),
+                             static_cast<int32_t>(GetPriority())};
+  network_->Evaluate(header, request_, &results_);
+}
+
+std::unique_ptr<Network> MakeRemoteNetwork(
+    const std::optional<WeightsFile>& /*weights*/, const OptionsDict& options) {
+  return std::make_unique<RemoteNetwork>(options);
+}
+
+REGISTER_NETWORK("remote", MakeRemoteNetwork, -998)
+
+}  // namespace
+}  // namespace remote
+}  // namespace lczero
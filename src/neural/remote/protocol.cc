@@ -0,0 +1,263 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "neural/remote/protocol.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "utils/exception.h"
+
+namespace lczero {
+namespace remote {
+namespace {
+
+#ifdef MSG_NOSIGNAL
+constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+constexpr int kSendFlags = 0;
+#endif
+
+bool IsUnixAddress(const std::string& address) {
+  return address.compare(0, 5, "unix:") == 0;
+}
+
+sockaddr_un UnixAddress(const std::string& address) {
+  const std::string path = address.substr(5);
+  sockaddr_un addr{};
+  if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+    throw Exception("Invalid unix socket path: " + path);
+  }
+  addr.sun_family = AF_UNIX;
+  std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  return addr;
+}
+
+addrinfo* ResolveTcpAddress(const std::string& address, bool passive) {
+  const auto colon = address.rfind(':');
+  if (colon == std::string::npos) {
+    throw Exception("Address must be unix:<path> or <host>:<port>: " +
+                    address);
+  }
+  const std::string host = address.substr(0, colon);
+  const std::string port = address.substr(colon + 1);
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (passive) hints.ai_flags = AI_PASSIVE;
+  addrinfo* result = nullptr;
+  const int error = getaddrinfo(host.empty() ? nullptr : host.c_str(),
+                                port.c_str(), &hints, &result);
+  if (error != 0) {
+    throw Exception("Cannot resolve " + address + ": " + gai_strerror(error));
+  }
+  return result;
+}
+
+void SetSocketOptions(int fd, bool tcp) {
+  int one = 1;
+#ifdef SO_NOSIGPIPE
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+  // Requests are small and latency bound.
+  if (tcp) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+}  // namespace
+
+Socket& Socket::operator=(Socket&& other) {
+  if (this != &other) {
+    Close();
+    fd_ = other.fd_;
+    other.fd_ = -1;
+  }
+  return *this;
+}
+
+Socket Socket::Connect(const std::string& address) {
+  if (IsUnixAddress(address)) {
+    const sockaddr_un addr = UnixAddress(address);
+    Socket socket(::socket(AF_UNIX, SOCK_STREAM, 0));
+    if (!socket.IsOpen() ||
+        connect(socket.fd_, reinterpret_cast<const sockaddr*>(&addr),
+                sizeof(addr)) != 0) {
+      throw Exception("Cannot connect to " + address + ": " +
+                      std::strerror(errno));
+    }
+    SetSocketOptions(socket.fd_, false);
+    return socket;
+  }
+  addrinfo* addresses = ResolveTcpAddress(address, false);
+  Socket socket;
+  for (addrinfo* ai = addresses; ai; ai = ai->ai_next) {
+    socket = Socket(::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol));
+    if (socket.IsOpen() &&
+        connect(socket.fd_, ai->ai_addr, ai->ai_addrlen) == 0) {
+      break;
+    }
+    socket.Close();
+  }
+  freeaddrinfo(addresses);
+  if (!socket.IsOpen()) {
+    throw Exception("Cannot connect to " + address + ": " +
+                    std::strerror(errno));
+  }
+  SetSocketOptions(socket.fd_, true);
+  return socket;
+}
+
+Socket Socket::Listen(const std::string& address) {
+  constexpr int kBacklog = 64;
+  if (IsUnixAddress(address)) {
+    const sockaddr_un addr = UnixAddress(address);
+    // Left behind by a previous server.
+    unlink(addr.sun_path);
+    Socket socket(::socket(AF_UNIX, SOCK_STREAM, 0));
+    if (!socket.IsOpen() ||
+        bind(socket.fd_, reinterpret_cast<const sockaddr*>(&addr),
+             sizeof(addr)) != 0 ||
+        listen(socket.fd_, kBacklog) != 0) {
+      throw Exception("Cannot listen on " + address + ": " +
+                      std::strerror(errno));
+    }
+    return socket;
+  }
+  addrinfo* addresses = ResolveTcpAddress(address, true);
+  Socket socket;
+  for (addrinfo* ai = addresses; ai; ai = ai->ai_next) {
+    socket = Socket(::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol));
+    if (!socket.IsOpen()) continue;
+    int one = 1;
+    setsockopt(socket.fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(socket.fd_, ai->ai_addr, ai->ai_addrlen) == 0 &&
+        listen(socket.fd_, kBacklog) == 0) {
+      break;
+    }
+    socket.Close();
+  }
+  freeaddrinfo(addresses);
+  if (!socket.IsOpen()) {
+    throw Exception("Cannot listen on " + address + ": " +
+                    std::strerror(errno));
+  }
+  return socket;
+}
+
+Socket Socket::Accept() {
+  while (true) {
+    sockaddr_storage addr;
+    socklen_t length = sizeof(addr);
+    const int fd = accept(fd_, reinterpret_cast<sockaddr*>(&addr), &length);
+    if (fd >= 0) {
+      SetSocketOptions(fd, addr.ss_family != AF_UNIX);
+      return Socket(fd);
+    }
+    if (errno != EINTR && errno != ECONNABORTED) {
+      throw Exception(std::string("Accept failed: ") + std::strerror(errno));
+    }
+  }
+}
+
+void Socket::Read(void* data, size_t size) {
+  auto* ptr = static_cast<char*>(data);
+  while (size > 0) {
+    const ssize_t got = recv(fd_, ptr, size, 0);
+    if (got == 0) throw Exception("Connection closed by peer.");
+    if (got < 0) {
+      if (errno == EINTR) continue;
+      throw Exception(std::string("Receive failed: ") + std::strerror(errno));
+    }
+    ptr += got;
+    size -= got;
+  }
+}
+
+void Socket::Write(const void* data, size_t size) {
+  const auto* ptr = static_cast<const char*>(data);
+  while (size > 0) {
+    const ssize_t sent = send(fd_, ptr, size, kSendFlags);
+    if (sent < 0) {
+      if (errno == EINTR) continue;
+      throw Exception(std::string("Send failed: ") + std::strerror(errno));
+    }
+    ptr += sent;
+    size -= sent;
+  }
+}
+
+void AppendSample(std::string* buffer, const InputPlanes& input,
+                  const std::vector<uint16_t>& moves) {
+  if (input.size() != static_cast<size_t>(kInputPlanes)) {
+    throw Exception("Unexpected number of input planes.");
+  }
+  const auto append = [&](const auto& value) {
+    buffer->append(reinterpret_cast<const char*>(&value), sizeof(value));
+  };
+  append(static_cast<uint16_t>(moves.size()));
+  for (const auto& plane : input) {
+    append(plane.mask);
+    append(plane.value);
+  }
+  for (const auto move : moves) append(move);
+}
+
+void ReadSample(Socket* socket, InputPlanes* input,
+                std::vector<uint16_t>* moves) {
+  uint16_t num_moves;
+  socket->Read(&num_moves, sizeof(num_moves));
+  if (num_moves > kPolicyOutputs) throw Exception("Too many moves.");
+  constexpr size_t kPlaneSize = sizeof(uint64_t) + sizeof(float);
+  char planes[kInputPlanes * kPlaneSize];
+  socket->Read(planes, sizeof(planes));
+  input->resize(kInputPlanes);
+  for (int i = 0; i < kInputPlanes; i++) {
+    std::memcpy(&(*input)[i].mask, planes + i * kPlaneSize, sizeof(uint64_t));
+    std::memcpy(&(*input)[i].value, planes + i * kPlaneSize + sizeof(uint64_t),
+                sizeof(float));
+  }
+  moves->resize(num_moves);
+  socket->Read(moves->data(), num_moves * sizeof(uint16_t));
+}
+
+void Socket::Shutdown() {
+  if (fd_ >= 0) shutdown(fd_, SHUT_RDWR);
+}
+
+void Socket::Close() {
+  if (fd_ >= 0) close(fd_);
+  fd_ = -1;
+}
+
+}  // namespace remote
+}  // namespace lczero
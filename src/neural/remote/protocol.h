@@ -0,0 +1,118 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "neural/network.h"
+
+namespace lczero {
+namespace remote {
+
+// Wire format between the "remote" backend and "lc0 serve". Integers and
+// floats are sent in host byte order, so clients and server must share the
+// architecture.
+//
+// On connection the server sends a Hello and the client answers with the
+// JobInfo of its job. Then the client sends requests, each a RequestHeader
+// followed by batch_size samples, and the server answers each request with
+// batch_size results:
+//   sample: uint16 num_moves, kInputPlanes x (uint64 mask, float value),
+//           num_moves x uint16 policy index of the legal moves.
+//   result: float q, float d, float m, then the policy of the legal moves in
+//           the order they were sent, or of all kPolicyOutputs moves if
+//           num_moves is zero.
+
+constexpr uint32_t kMagic = 0x5230434c;  // "LC0R"
+constexpr uint32_t kVersion = 2;
+constexpr uint32_t kMaxBatchSize = 4096;
+constexpr int kPolicyOutputs = 1858;
+
+struct Hello {
+  uint32_t magic;
+  uint32_t version;
+  int32_t input_format;
+  int32_t moves_left;
+};
+
+// Connections with the same job name share a job of the server's
+// JobScheduler.
+struct JobInfo {
+  char name[32];
+  int32_t priority;
+  float quota;
+};
+
+struct RequestHeader {
+  uint32_t batch_size;
+  // ComputationPriority of the computation.
+  int32_t priority;
+};
+
+// Connected stream socket, closed on destruction. Methods throw Exception on
+// errors; reads also throw when the peer disconnected.
+class Socket {
+ public:
+  Socket() = default;
+  explicit Socket(int fd) : fd_(fd) {}
+  ~Socket() { Close(); }
+  Socket(Socket&& other) : fd_(other.fd_) { other.fd_ = -1; }
+  Socket& operator=(Socket&& other);
+  Socket(const Socket&) = delete;
+  Socket& operator=(const Socket&) = delete;
+
+  // Connects to "unix:<path>" or "<host>:<port>".
+  static Socket Connect(const std::string& address);
+  // Listens on "unix:<path>" or "<host>:<port>".
+  static Socket Listen(const std::string& address);
+  // Waits for the next client of a listening socket.
+  Socket Accept();
+
+  void Read(void* data, size_t size);
+  void Write(const void* data, size_t size);
+  // Makes a blocked Accept() or Read() return with an error.
+  void Shutdown();
+  void Close();
+
+  bool IsOpen() const { return fd_ >= 0; }
+
+ private:
+  int fd_ = -1;
+};
+
+// Serializes a sample of a request.
+void AppendSample(std::string* buffer, const InputPlanes& input,
+                  const std::vector<uint16_t>& moves);
+// Reads a sample of a request.
+void ReadSample(Socket* socket, InputPlanes* input,
+                std::vector<uint16_t>* moves);
+
+}  // namespace remote
+}  // namespace lczero
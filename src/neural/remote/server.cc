@@ -0,0 +1,173 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "neural/remote/server.h"
+
+#include <algorithm>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <thread>
+
+#include "neural/factory.h"
+#include "neural/job_scheduler.h"
+#include "neural/remote/protocol.h"
+#include "utils/exception.h"
+#include "utils/logging.h"
+#include "utils/optionsparser.h"
+
+namespace lczero {
+namespace {
+
+const OptionId kListenId{
+    "listen", "", "Address to serve on, unix:<path> or <host>:<port>."};
+const OptionId kJobSlotsId{
+    "job-slots", "",
+    "Number of batches of the clients computed at the same time. When they "
+    "have to wait, the batches of the jobs below their quota go first, then "
+    "those of the jobs with higher priority, as set by the job, job_priority "
+    "and job_quota options of the remote backends. 0 doesn't limit them."};
+
+void ServeClient(remote::Socket* socket, Network* network,
+                 JobScheduler* scheduler) {
+  const auto& capabilities = network->GetCapabilities();
+  const remote::Hello hello{remote::kMagic, remote::kVersion,
+                            capabilities.input_format,
+                            capabilities.moves_left};
+  socket->Write(&hello, sizeof(hello));
+  remote::JobInfo job_info;
+  socket->Read(&job_info, sizeof(job_info));
+  const std::string job_name(job_info.name,
+                             strnlen(job_info.name, sizeof(job_info.name)));
+  const int job =
+      scheduler->AddJob(job_name, job_info.priority, job_info.quota);
+  LOGFILE << "Client of job " << job_name << " connected, priority "
+          << job_info.priority << ", quota " << job_info.quota << ".";
+
+  std::vector<std::vector<uint16_t>> moves;
+  std::vector<float> results;
+  while (true) {
+    remote::RequestHeader header;
+    socket->Read(&header, sizeof(header));
+    if (header.batch_size == 0 || header.batch_size > remote::kMaxBatchSize) {
+      throw Exception("Invalid batch size.");
+    }
+    auto computation = network->NewComputation();
+    computation->SetPriority(static_cast<ComputationPriority>(
+        std::clamp(header.priority,
+                   static_cast<int32_t>(ComputationPriority::kCritical),
+                   static_cast<int32_t>(ComputationPriority::kBackground))));
+    moves.resize(header.batch_size);
+    for (auto& sample_moves : moves) {
+      InputPlanes input;
+      remote::ReadSample(socket, &input, &sample_moves);
+      if (sample_moves.empty()) {
+        computation->AddInput(std::move(input));
+      } else {
+        computation->AddInputWithMoves(std::move(input), sample_moves);
+      }
+    }
+
+    {
+      auto slot = scheduler->Acquire(job, header.batch_size);
+      computation->ComputeBlocking();
+    }
+
+    results.clear();
+    for (int i = 0; i < static_cast<int>(moves.size()); i++) {
+      results.push_back(computation->GetQVal(i));
+      results.push_back(computation->GetDVal(i));
+      results.push_back(computation->GetMVal(i));
+      if (moves[i].empty()) {
+        for (int j = 0; j < remote::kPolicyOutputs; j++) {
+          results.push_back(computation->GetPVal(i, j));
+        }
+      } else {
+        for (size_t j = 0; j < moves[i].size(); j++) {
+          results.push_back(computation->GetLegalPVal(i, j, moves[i][j]));
+        }
+      }
+    }
+    socket->Write(results.data(), results.size() * sizeof(float));
+  }
+}
+
+}  // namespace
+
+void InferenceServer::Run() {
+  OptionsParser options;
+  NetworkFactory::PopulateOptions(&options);
+  options.Add<StringOption>(kListenId) = "unix:/tmp/lc0.sock";
+  options.Add<IntOption>(kJobSlotsId, 0, 1024) = 0;
+  // Gather the requests of all clients into common batches.
+  options.GetMutableDefaultsOptions()->Set<std::string>(
+      NetworkFactory::kBackendId, "multiplexing");
+
+  if (!options.ProcessAllFlags()) return;
+
+  const auto option_dict = options.GetOptionsDict();
+  auto network = NetworkFactory::LoadNetwork(option_dict);
+  JobScheduler scheduler(option_dict.Get<int>(kJobSlotsId));
+  const auto address = option_dict.Get<std::string>(kListenId);
+  auto listener = remote::Socket::Listen(address);
+  CERR << "Serving network on " << address << ".";
+
+  std::mutex clients_mutex;
+  std::list<remote::Socket> clients;
+  std::list<std::thread> threads;
+  try {
+    while (true) {
+      auto socket = listener.Accept();
+      std::lock_guard<std::mutex> lock(clients_mutex);
+      clients.push_back(std::move(socket));
+      auto client = std::prev(clients.end());
+      threads.emplace_back([&, client]() {
+        try {
+          ServeClient(&*client, network.get(), &scheduler);
+        } catch (const std::exception& e) {
+          LOGFILE << "Client disconnected: " << e.what();
+          for (const auto& stats : scheduler.GetStats()) {
+            LOGFILE << "Job " << stats.name << ": " << stats.batches
+                    << " batches, " << stats.samples << " samples, "
+                    << stats.share * 100.0f << "% of the recent samples.";
+          }
+        }
+        std::lock_guard<std::mutex> lock(clients_mutex);
+        client->Close();
+      });
+    }
+  } catch (const std::exception& e) {
+    CERR << "Inference server stopped: " << e.what();
+  }
+  {
+    std::lock_guard<std::mutex> lock(clients_mutex);
+    for (auto& client : clients) client.Shutdown();
+  }
+  for (auto& thread : threads) thread.join();
+}
+
+}  // namespace lczero
@@ -21,6 +21,7 @@
 #include <algorithm>
 #include <cmath>
 
+#include "utils/cppattributes.h"
 #include "utils/exception.h"
 
 #ifdef USE_ISPC
@@ -34,6 +35,7 @@ constexpr int kHeight = 8;
 constexpr int kSquares = kWidth * kHeight;
 }  // namespace
 
+SIMD_CLONES
 void SoftmaxActivation(const size_t size, const float* input, float* output) {
   auto alpha = *std::max_element(input, input + size);
 
@@ -93,6 +95,7 @@ float Activate(const float val, const ActivationFunction activation) {
   return val;
 }
 
+SIMD_CLONES
 void Activate(const size_t len, const float* data, const float* bias,
               float* output, const ActivationFunction activation) {
   if (activation == ACTIVATION_NONE) {
@@ -153,6 +156,7 @@ void Activate(const size_t len, const float* data, const float* bias,
   }
 }
 
+SIMD_CLONES
 void Activate(const size_t len, float gamma, const float* data,
               const float* bias, float beta, float* output,
               const ActivationFunction activation) {
@@ -187,6 +191,7 @@ void Activate(const size_t len, float gamma, const float* data,
   }
 }
 
+SIMD_CLONES
 void BiasResidual(const size_t batch_size, const size_t channels, float* data,
                   const float* biases, const float* eltwise,
                   const ActivationFunction activation) {
@@ -230,6 +235,7 @@ void BiasResidual(const size_t batch_size, const size_t channels, float* data,
   }
 }
 
+SIMD_CLONES
 void BiasActivate(const size_t batch_size, const size_t channels, float* data,
                   const float* biases, const ActivationFunction activation) {
   for (size_t i = 0; i < batch_size; i++) {
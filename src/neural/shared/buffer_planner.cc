@@ -0,0 +1,76 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "neural/shared/buffer_planner.h"
+
+#include <algorithm>
+#include <numeric>
+
+#include "utils/exception.h"
+
+namespace lczero {
+
+int BufferPlanner::Add(size_t size, int first, int last) {
+  if (first > last) throw Exception("Buffer live range ends before it starts.");
+  buffers_.push_back({size, first, last});
+  return static_cast<int>(buffers_.size()) - 1;
+}
+
+void BufferPlanner::Plan() {
+  std::vector<int> order(buffers_.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+    return buffers_[a].size > buffers_[b].size;
+  });
+
+  arena_size_ = 0;
+  std::vector<const Buffer*> live;
+  for (size_t i = 0; i < order.size(); i++) {
+    Buffer& buffer = buffers_[order[i]];
+    // The placed buffers whose live range overlaps this one, by offset.
+    live.clear();
+    for (size_t j = 0; j < i; j++) {
+      const Buffer& other = buffers_[order[j]];
+      if (other.first <= buffer.last && buffer.first <= other.last) {
+        live.push_back(&other);
+      }
+    }
+    std::sort(live.begin(), live.end(), [](const Buffer* a, const Buffer* b) {
+      return a->offset < b->offset;
+    });
+    size_t offset = 0;
+    for (const Buffer* other : live) {
+      if (offset + buffer.size <= other->offset) break;
+      offset = std::max(offset, other->offset + other->size);
+      offset = (offset + alignment_ - 1) / alignment_ * alignment_;
+    }
+    buffer.offset = offset;
+    arena_size_ = std::max(arena_size_, offset + buffer.size);
+  }
+}
+
+}  // namespace lczero
@@ -0,0 +1,70 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace lczero {
+
+// Places the intermediate buffers of a network computation in one arena.
+// Each buffer is live over a range of steps of the computation, and buffers
+// whose ranges don't overlap may share memory. Buffers are placed largest
+// first, each at the lowest offset that doesn't overlap a placed buffer live
+// at the same time, which comes close to the peak of the live sizes.
+// Sizes and offsets are in elements of the caller's type.
+class BufferPlanner {
+ public:
+  // Offsets are multiples of @alignment.
+  explicit BufferPlanner(size_t alignment = 1) : alignment_(alignment) {}
+
+  // Adds a buffer of @size elements, live from step @first to step @last
+  // inclusive, and returns its id.
+  int Add(size_t size, int first, int last);
+
+  // Places the buffers added so far.
+  void Plan();
+
+  // Valid after Plan().
+  size_t GetOffset(int id) const { return buffers_[id].offset; }
+  size_t GetArenaSize() const { return arena_size_; }
+
+ private:
+  struct Buffer {
+    size_t size;
+    int first;
+    int last;
+    size_t offset = 0;
+  };
+
+  const size_t alignment_;
+  std::vector<Buffer> buffers_;
+  size_t arena_size_ = 0;
+};
+
+}  // namespace lczero
@@ -0,0 +1,92 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "neural/shared/buffer_planner.h"
+
+#include <gtest/gtest.h>
+
+#include "utils/exception.h"
+
+namespace lczero {
+
+TEST(BufferPlanner, DisjointRangesShareMemory) {
+  BufferPlanner planner;
+  const int a = planner.Add(100, 0, 1);
+  const int b = planner.Add(60, 2, 3);
+  planner.Plan();
+  EXPECT_EQ(planner.GetOffset(a), 0u);
+  EXPECT_EQ(planner.GetOffset(b), 0u);
+  EXPECT_EQ(planner.GetArenaSize(), 100u);
+}
+
+TEST(BufferPlanner, OverlappingRangesDontShare) {
+  BufferPlanner planner;
+  const int a = planner.Add(100, 0, 2);
+  const int b = planner.Add(60, 2, 3);
+  planner.Plan();
+  EXPECT_EQ(planner.GetOffset(a), 0u);
+  EXPECT_EQ(planner.GetOffset(b), 100u);
+  EXPECT_EQ(planner.GetArenaSize(), 160u);
+}
+
+TEST(BufferPlanner, FillsGaps) {
+  // A lives throughout, B and C in turn, and D fits in the hole C leaves
+  // next to B.
+  BufferPlanner planner;
+  const int a = planner.Add(50, 0, 3);
+  const int b = planner.Add(100, 0, 1);
+  const int c = planner.Add(40, 2, 3);
+  const int d = planner.Add(30, 3, 3);
+  planner.Plan();
+  EXPECT_EQ(planner.GetOffset(b), 0u);
+  EXPECT_EQ(planner.GetOffset(a), 100u);
+  EXPECT_EQ(planner.GetOffset(c), 0u);
+  EXPECT_EQ(planner.GetOffset(d), 40u);
+  EXPECT_EQ(planner.GetArenaSize(), 150u);
+}
+
+TEST(BufferPlanner, AlignsOffsets) {
+  BufferPlanner planner(16);
+  const int a = planner.Add(10, 0, 0);
+  const int b = planner.Add(5, 0, 0);
+  planner.Plan();
+  EXPECT_EQ(planner.GetOffset(a), 0u);
+  EXPECT_EQ(planner.GetOffset(b), 16u);
+  EXPECT_EQ(planner.GetArenaSize(), 21u);
+}
+
+TEST(BufferPlanner, RejectsReversedRange) {
+  BufferPlanner planner;
+  EXPECT_THROW(planner.Add(10, 2, 1), Exception);
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
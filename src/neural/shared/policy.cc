@@ -0,0 +1,130 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#include "neural/shared/policy.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <limits>
+
+#include "neural/shared/attention_policy_map.h"
+#include "neural/shared/policy_map.h"
+#include "utils/cppattributes.h"
+
+namespace lczero {
+namespace {
+// Accumulator lanes of the reductions, so that they vectorize without
+// reassociating float math.
+constexpr size_t kLanes = 8;
+
+using InverseMap = std::array<short, kPolicyOutputs>;
+
+// Both maps are one-to-one on their used entries, so the gather can be driven
+// by the output: contiguous stores and one indexed load per move.
+InverseMap InvertMap(const short* map, size_t size) {
+  InverseMap inverse{};
+  for (size_t i = 0; i < size; i++) {
+    if (map[i] >= 0) inverse[map[i]] = static_cast<short>(i);
+  }
+  return inverse;
+}
+
+const InverseMap& GetInverseMap(PolicyMapping mapping) {
+  static const InverseMap kConv =
+      InvertMap(kConvPolicyMap, std::size(kConvPolicyMap));
+  static const InverseMap kAttn =
+      InvertMap(kAttnPolicyMap, std::size(kAttnPolicyMap));
+  return mapping == PolicyMapping::kConvolution ? kConv : kAttn;
+}
+
+// FastExp() of utils/fastmath.h without the early return, so that the loops
+// using it vectorize.
+inline float SoftmaxExp(float a) {
+  a = std::max(a * 1.442695040f, -126.0f);
+  const int32_t exp = static_cast<int32_t>(a) - (a < 0 ? 1 : 0);
+  float out = a - exp;
+  out = 1.0f + out * (0.6602339f + 0.33976606f * out);
+  int32_t tmp;
+  std::memcpy(&tmp, &out, sizeof(float));
+  tmp += static_cast<int32_t>(static_cast<uint32_t>(exp) << 23);
+  std::memcpy(&out, &tmp, sizeof(float));
+  return out;
+}
+}  // namespace
+
+SIMD_CLONES
+void MapPolicy(PolicyMapping mapping, size_t batch_size, const float* input,
+               size_t input_stride, float* output) {
+  const short* inverse = GetInverseMap(mapping).data();
+  for (size_t batch = 0; batch < batch_size; batch++) {
+    const float* in = input + batch * input_stride;
+    float* out = output + batch * kPolicyOutputs;
+    for (size_t i = 0; i < kPolicyOutputs; i++) out[i] = in[inverse[i]];
+  }
+}
+
+SIMD_CLONES
+void PolicySoftmax(size_t count, const float* logits, float temperature,
+                   float* output) {
+  std::array<float, kLanes> lanes;
+  lanes.fill(std::numeric_limits<float>::lowest());
+  size_t i = 0;
+  for (; i + kLanes <= count; i += kLanes) {
+    for (size_t j = 0; j < kLanes; j++) {
+      lanes[j] = std::max(lanes[j], logits[i + j]);
+    }
+  }
+  float max_p = *std::max_element(lanes.begin(), lanes.end());
+  for (; i < count; i++) max_p = std::max(max_p, logits[i]);
+
+  // exp((p-max_p)/T) is (exp(p-max_p))^(1/T), the softmax with temperature.
+  const float inv_temperature = 1.0f / temperature;
+  lanes.fill(0.0f);
+  for (i = 0; i + kLanes <= count; i += kLanes) {
+    for (size_t j = 0; j < kLanes; j++) {
+      const float p = SoftmaxExp((logits[i + j] - max_p) * inv_temperature);
+      output[i + j] = p;
+      lanes[j] += p;
+    }
+  }
+  float total = 0.0f;
+  for (float lane : lanes) total += lane;
+  for (; i < count; i++) {
+    const float p = SoftmaxExp((logits[i] - max_p) * inv_temperature);
+    output[i] = p;
+    total += p;
+  }
+
+  const float scale = total > 0.0f ? 1.0f / total : 1.0f;
+  for (i = 0; i < count; i++) output[i] *= scale;
+}
+
+}  // namespace lczero
@@ -0,0 +1,57 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+
+#pragma once
+
+#include <cstddef>
+
+namespace lczero {
+
+// Number of lc0 policy outputs (legal move encodings) of a network.
+constexpr size_t kPolicyOutputs = 1858;
+
+// Layout of the raw policy head output.
+enum class PolicyMapping {
+  // 73 planes of 64 squares (kConvPolicyMap).
+  kConvolution,
+  // 64x64 from-to logits followed by 8x24 promotion logits (kAttnPolicyMap).
+  kAttention,
+};
+
+// Gathers the lc0 policy of @batch_size samples from the raw policy head
+// output. Raw samples are @input_stride floats apart, the mapped ones
+// kPolicyOutputs.
+void MapPolicy(PolicyMapping mapping, size_t batch_size, const float* input,
+               size_t input_stride, float* output);
+
+// Softmax of the @count policy logits of the legal moves of a position, with
+// policy @temperature. The result sums up to 1. @output may be @logits.
+void PolicySoftmax(size_t count, const float* logits, float temperature,
+                   float* output);
+
+}  // namespace lczero
@@ -0,0 +1,138 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "neural/trace.h"
+
+#include <cstdint>
+#include <cstring>
+
+#include "utils/exception.h"
+#include "utils/fp16_utils.h"
+
+namespace lczero {
+namespace {
+
+const char kMagic[8] = {'L', 'c', '0', 'T', 'r', 'a', 'c', 'e'};
+const uint32_t kVersion = 1;
+const int kBitmapBytes = (kInputPlanes + 7) / 8;
+
+template <typename T>
+void Append(std::string* out, const T& value) {
+  out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+T Extract(std::ifstream* input) {
+  T value;
+  if (!input->read(reinterpret_cast<char*>(&value), sizeof(value))) {
+    throw Exception("Truncated trace file.");
+  }
+  return value;
+}
+
+}  // namespace
+
+TraceWriter::TraceWriter(const std::string& filename)
+    : output_(filename, std::ios::binary | std::ios::trunc) {
+  if (!output_) throw Exception("Cannot write trace file " + filename);
+  output_.write(kMagic, sizeof(kMagic));
+  output_.write(reinterpret_cast<const char*>(&kVersion), sizeof(kVersion));
+}
+
+void TraceWriter::Write(const TraceBatch& batch) {
+  // Serialized outside of the lock, which only covers the file write.
+  std::string out;
+  Append(&out, static_cast<uint32_t>(batch.inputs.size()));
+  for (size_t i = 0; i < batch.inputs.size(); i++) {
+    const auto& input = batch.inputs[i];
+    uint8_t bitmap[kBitmapBytes] = {};
+    for (int j = 0; j < kInputPlanes; j++) {
+      if (input[j].mask) bitmap[j / 8] |= 1 << (j % 8);
+    }
+    out.append(reinterpret_cast<const char*>(bitmap), sizeof(bitmap));
+    for (int j = 0; j < kInputPlanes; j++) {
+      if (!input[j].mask) continue;
+      Append(&out, input[j].mask);
+      Append(&out, input[j].value);
+    }
+    Append(&out, batch.q[i]);
+    Append(&out, batch.d[i]);
+    Append(&out, batch.m[i]);
+    for (int j = 0; j < TraceBatch::kPolicySize; j++) {
+      Append(&out, FP32toFP16(batch.policy[i * TraceBatch::kPolicySize + j]));
+    }
+  }
+  Mutex::Lock lock(mutex_);
+  output_.write(out.data(), out.size());
+  output_.flush();
+}
+
+TraceReader::TraceReader(const std::string& filename)
+    : input_(filename, std::ios::binary) {
+  char magic[sizeof(kMagic)];
+  uint32_t version = 0;
+  if (!input_.read(magic, sizeof(magic)) ||
+      std::memcmp(magic, kMagic, sizeof(kMagic)) != 0 ||
+      !input_.read(reinterpret_cast<char*>(&version), sizeof(version)) ||
+      version != kVersion) {
+    throw Exception("Not a trace file: " + filename);
+  }
+}
+
+bool TraceReader::Read(TraceBatch* batch) {
+  uint32_t batch_size;
+  if (!input_.read(reinterpret_cast<char*>(&batch_size), sizeof(batch_size))) {
+    return false;
+  }
+  batch->inputs.assign(batch_size, InputPlanes(kInputPlanes));
+  batch->q.resize(batch_size);
+  batch->d.resize(batch_size);
+  batch->m.resize(batch_size);
+  batch->policy.resize(batch_size * TraceBatch::kPolicySize);
+  for (uint32_t i = 0; i < batch_size; i++) {
+    uint8_t bitmap[kBitmapBytes];
+    if (!input_.read(reinterpret_cast<char*>(bitmap), sizeof(bitmap))) {
+      throw Exception("Truncated trace file.");
+    }
+    for (int j = 0; j < kInputPlanes; j++) {
+      if (!(bitmap[j / 8] & (1 << (j % 8)))) continue;
+      auto& plane = batch->inputs[i][j];
+      plane.mask = Extract<uint64_t>(&input_);
+      plane.value = Extract<float>(&input_);
+    }
+    batch->q[i] = Extract<float>(&input_);
+    batch->d[i] = Extract<float>(&input_);
+    batch->m[i] = Extract<float>(&input_);
+    for (int j = 0; j < TraceBatch::kPolicySize; j++) {
+      batch->policy[i * TraceBatch::kPolicySize + j] =
+          FP16toFP32(Extract<uint16_t>(&input_));
+    }
+  }
+  return true;
+}
+
+}  // namespace lczero
@@ -0,0 +1,84 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "neural/network.h"
+#include "utils/mutex.h"
+
+namespace lczero {
+
+// Batch of a search and the outputs computed for it, as kept in a trace file.
+struct TraceBatch {
+  static constexpr int kPolicySize = 1858;
+
+  std::vector<InputPlanes> inputs;
+  // Per sample.
+  std::vector<float> q;
+  std::vector<float> d;
+  std::vector<float> m;
+  // kPolicySize values per sample.
+  std::vector<float> policy;
+};
+
+// Trace files hold the batches in the order they were computed:
+//   header: "Lc0Trace", uint32 version.
+//   batch:  uint32 batch size, then per sample:
+//           bitmap of the kInputPlanes planes with a non-zero mask,
+//           (uint64 mask, float value) of each of these planes,
+//           float q, d, m, and kPolicySize policy values as fp16.
+// The policy is quantized to fp16, everything else is kept exactly.
+class TraceWriter {
+ public:
+  // Creates or truncates @filename. Throws Exception if it cannot.
+  explicit TraceWriter(const std::string& filename);
+
+  // Thread safe.
+  void Write(const TraceBatch& batch);
+
+ private:
+  Mutex mutex_;
+  std::ofstream output_ GUARDED_BY(mutex_);
+};
+
+class TraceReader {
+ public:
+  // Throws Exception if @filename is not a trace file.
+  explicit TraceReader(const std::string& filename);
+
+  // Reads the next batch into @batch. Returns false at the end of the trace.
+  bool Read(TraceBatch* batch);
+
+ private:
+  std::ifstream input_;
+};
+
+}  // namespace lczero
@@ -0,0 +1,99 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "neural/trace.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+
+#include "utils/exception.h"
+
+namespace lczero {
+
+TEST(Trace, RoundTrip) {
+  const std::string filename = ::testing::TempDir() + "lc0_trace_test.bin";
+  TraceBatch batch;
+  for (int i = 0; i < 2; i++) {
+    InputPlanes input(kInputPlanes);
+    input[0].mask = 0xff00ff00ff00ff00ull + i;
+    input[104].Fill(0.25f * i + 0.1f);
+    batch.inputs.push_back(input);
+    batch.q.push_back(0.5f - i);
+    batch.d.push_back(0.125f);
+    batch.m.push_back(42.0f + i);
+    for (int j = 0; j < TraceBatch::kPolicySize; j++) {
+      batch.policy.push_back(j == 100 + i ? 0.75f : 0.25f / 1857);
+    }
+  }
+  {
+    TraceWriter writer(filename);
+    writer.Write(batch);
+    writer.Write(batch);
+  }
+
+  TraceReader reader(filename);
+  TraceBatch read;
+  for (int pass = 0; pass < 2; pass++) {
+    ASSERT_TRUE(reader.Read(&read));
+    ASSERT_EQ(read.inputs.size(), 2u);
+    for (int i = 0; i < 2; i++) {
+      for (int j = 0; j < kInputPlanes; j++) {
+        EXPECT_EQ(read.inputs[i][j].mask, batch.inputs[i][j].mask);
+        if (batch.inputs[i][j].mask) {
+          EXPECT_EQ(read.inputs[i][j].value, batch.inputs[i][j].value);
+        }
+      }
+    }
+    EXPECT_EQ(read.q, batch.q);
+    EXPECT_EQ(read.d, batch.d);
+    EXPECT_EQ(read.m, batch.m);
+    ASSERT_EQ(read.policy.size(), batch.policy.size());
+    for (size_t j = 0; j < batch.policy.size(); j++) {
+      // Quantized to fp16.
+      EXPECT_NEAR(read.policy[j], batch.policy[j], batch.policy[j] / 1000);
+    }
+  }
+  EXPECT_FALSE(reader.Read(&read));
+  std::remove(filename.c_str());
+}
+
+TEST(Trace, RejectsOtherFiles) {
+  const std::string filename = ::testing::TempDir() + "lc0_not_a_trace.bin";
+  FILE* f = std::fopen(filename.c_str(), "wb");
+  std::fputs("not a trace", f);
+  std::fclose(f);
+  EXPECT_THROW(TraceReader reader(filename), Exception);
+  std::remove(filename.c_str());
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
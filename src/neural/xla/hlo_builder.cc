@@ -137,10 +137,34 @@ HloFlow HloBuilder::Add(HloFlow lhs, HloFlow rhs) {
   return MakeElementwiseInstruction("add", lhs, rhs);
 }
 
+HloFlow HloBuilder::Subtract(HloFlow lhs, HloFlow rhs) {
+  return MakeElementwiseInstruction("subtract", lhs, rhs);
+}
+
+HloFlow HloBuilder::Multiply(HloFlow lhs, HloFlow rhs) {
+  return MakeElementwiseInstruction("multiply", lhs, rhs);
+}
+
+HloFlow HloBuilder::Divide(HloFlow lhs, HloFlow rhs) {
+  return MakeElementwiseInstruction("divide", lhs, rhs);
+}
+
 HloFlow HloBuilder::Maximum(HloFlow lhs, HloFlow rhs) {
   return MakeElementwiseInstruction("maximum", lhs, rhs);
 }
 
+HloFlow HloBuilder::Minimum(HloFlow lhs, HloFlow rhs) {
+  return MakeElementwiseInstruction("minimum", lhs, rhs);
+}
+
+HloFlow HloBuilder::And(HloFlow lhs, HloFlow rhs) {
+  return MakeElementwiseInstruction("and", lhs, rhs);
+}
+
+HloFlow HloBuilder::ShiftRightLogical(HloFlow lhs, HloFlow rhs) {
+  return MakeElementwiseInstruction("shift-right-logical", lhs, rhs);
+}
+
 HloFlow HloBuilder::Reshape(HloFlow input,
                             const pblczero::XlaShapeProto& new_shape) {
   if (input->shape().element_type() != new_shape.element_type()) {
@@ -220,6 +244,71 @@ HloFlow HloBuilder::Tanh(HloFlow input) {
   return MakeInstruction("tanh", input->shape(), {input});
 }
 
+HloFlow HloBuilder::Exponential(HloFlow input) {
+  return MakeInstruction("exponential", input->shape(), {input});
+}
+
+HloFlow HloBuilder::Log1p(HloFlow input) {
+  return MakeInstruction("log-plus-one", input->shape(), {input});
+}
+
+HloFlow HloBuilder::Logistic(HloFlow input) {
+  return MakeInstruction("logistic", input->shape(), {input});
+}
+
+HloFlow HloBuilder::Sqrt(HloFlow input) {
+  return MakeInstruction("sqrt", input->shape(), {input});
+}
+
+HloFlow HloBuilder::Rsqrt(HloFlow input) {
+  return MakeInstruction("rsqrt", input->shape(), {input});
+}
+
+HloFlow HloBuilder::Abs(HloFlow input) {
+  return MakeInstruction("abs", input->shape(), {input});
+}
+
+HloFlow HloBuilder::Negate(HloFlow input) {
+  return MakeInstruction("negate", input->shape(), {input});
+}
+
+HloFlow HloBuilder::Transpose(HloFlow input,
+                              const std::vector<int64_t>& permutation) {
+  const auto& input_shape = input->shape();
+  if (permutation.size() != input_shape.dimensions_size()) {
+    throw Exception("Transpose permutation must match the input rank");
+  }
+  pblczero::XlaShapeProto shape;
+  shape.set_element_type(input_shape.element_type());
+  for (auto dim : permutation) {
+    shape.add_dimensions(input_shape.dimensions(dim));
+  }
+  ResetXlaShapeProtoLayout(&shape);
+  auto flow = MakeInstruction("transpose", shape, {input});
+  for (auto dim : permutation) flow->add_dimensions(dim);
+  return flow;
+}
+
+HloFlow HloBuilder::Reduce(HloFlow input, HloFlow init,
+                           std::string_view opcode,
+                           const std::vector<int64_t>& dimensions) {
+  const auto& input_shape = input->shape();
+  pblczero::XlaShapeProto shape;
+  shape.set_element_type(input_shape.element_type());
+  for (size_t i = 0; i < input_shape.dimensions_size(); ++i) {
+    if (std::find(dimensions.begin(), dimensions.end(),
+                  static_cast<int64_t>(i)) == dimensions.end()) {
+      shape.add_dimensions(input_shape.dimensions(i));
+    }
+  }
+  ResetXlaShapeProtoLayout(&shape);
+  auto flow = MakeInstruction("reduce", shape, {input, init});
+  for (auto dim : dimensions) flow->add_dimensions(dim);
+  flow->add_called_computation_ids(
+      GetScalarComputation(opcode, input_shape.element_type()));
+  return flow;
+}
+
 HloFlow HloBuilder::Tuple(const std::vector<HloFlow>& elements) {
   pblczero::XlaShapeProto shape;
   shape.set_element_type(pblczero::XlaShapeProto::TUPLE);
@@ -267,6 +356,32 @@ pblczero::HloComputationProto MakeComputation(const HloComputation& comp,
 }
 }  // namespace
 
+int64_t HloBuilder::GetScalarComputation(std::string_view opcode,
+                                         pblczero::XlaShapeProto::Type type) {
+  const std::string name = std::string(opcode) + "_" +
+                           pblczero::XlaShapeProto::Type_Name(type);
+  auto iter = dependent_computations_.find(name);
+  if (iter != dependent_computations_.end()) return iter->second.id();
+
+  pblczero::XlaShapeProto shape;
+  shape.set_element_type(type);
+  shape.mutable_layout();
+  HloComputation comp;
+  for (size_t i = 0; i < 3; ++i) {
+    auto instr = std::make_unique<pblczero::HloInstructionProto>();
+    instr->set_opcode(i < 2 ? "parameter" : opcode);
+    *instr->mutable_shape() = shape;
+    instr->set_id(i);
+    comp.push_back(std::move(instr));
+  }
+  comp[2]->add_operand_ids(0);
+  comp[2]->add_operand_ids(1);
+  // The entry computation has id 0.
+  const int64_t id = dependent_computations_.size() + 1;
+  dependent_computations_[name] = MakeComputation(comp, name, id);
+  return id;
+}
+
 // Assigns unique names to all instructions in the module.
 // In StableHLO instructions are allowed to have numeric names, but in XLA HLO
 // they are not, so we use "i"+number.
@@ -284,17 +399,35 @@ void HloBuilder::AssignInstructionNames() {
   }
 }
 
+namespace {
+// Shifts the instruction ids of a computation, so that they don't collide
+// with the ones of other computations.
+void OffsetInstructionIds(pblczero::HloComputationProto* comp,
+                          int64_t offset) {
+  for (auto& instr : *comp->mutable_instructions()) {
+    instr.set_id(instr.id() + offset);
+    for (auto& operand : *instr.mutable_operand_ids()) operand += offset;
+  }
+  comp->set_root_id(comp->root_id() + offset);
+}
+}  // namespace
+
 pblczero::HloModuleProto HloBuilder::Build(std::string_view name) {
   AssignInstructionNames();
   pblczero::HloModuleProto module;
   module.set_name(name);
   module.set_entry_computation_name("main");
   module.set_entry_computation_id(0);
-  *module.add_computations() = MakeComputation(entry_computation_, "main", 0);
+  // Called computations must come before their callers.
+  int64_t next_id = entry_computation_.size();
   for (auto& [name, comp] : dependent_computations_) {
+    OffsetInstructionIds(&comp, next_id);
+    next_id += comp.instructions_size();
     *module.add_computations() = comp;
   }
-  *module.mutable_host_program_shape() = module.computations(0).program_shape();
+  *module.add_computations() = MakeComputation(entry_computation_, "main", 0);
+  *module.mutable_host_program_shape() =
+      module.computations().back().program_shape();
   return module;
 }
 
@@ -54,11 +54,29 @@ class HloBuilder {
   HloFlow Broadcast(HloFlow input, const pblczero::XlaShapeProto& target_shape,
                     const std::vector<int64_t>& broadcast_dimensions);
   HloFlow Add(HloFlow lhs, HloFlow rhs);
+  HloFlow Subtract(HloFlow lhs, HloFlow rhs);
+  HloFlow Multiply(HloFlow lhs, HloFlow rhs);
+  HloFlow Divide(HloFlow lhs, HloFlow rhs);
   HloFlow Maximum(HloFlow lhs, HloFlow rhs);
+  HloFlow Minimum(HloFlow lhs, HloFlow rhs);
+  HloFlow And(HloFlow lhs, HloFlow rhs);
+  HloFlow ShiftRightLogical(HloFlow lhs, HloFlow rhs);
   HloFlow Reshape(HloFlow input, const pblczero::XlaShapeProto& new_shape);
   HloFlow Dot(HloFlow lhs, HloFlow rhs,
               const pblczero::XlaDotDimensionNumbers& dimension_numbers);
   HloFlow Tanh(HloFlow input);
+  HloFlow Exponential(HloFlow input);
+  HloFlow Log1p(HloFlow input);
+  HloFlow Logistic(HloFlow input);
+  HloFlow Sqrt(HloFlow input);
+  HloFlow Rsqrt(HloFlow input);
+  HloFlow Abs(HloFlow input);
+  HloFlow Negate(HloFlow input);
+  HloFlow Transpose(HloFlow input, const std::vector<int64_t>& permutation);
+  // Reduces the dimensions of the input with a binary scalar op (e.g. "add" or
+  // "maximum"), starting from init (a scalar).
+  HloFlow Reduce(HloFlow input, HloFlow init, std::string_view opcode,
+                 const std::vector<int64_t>& dimensions);
   HloFlow Tuple(const std::vector<HloFlow>& elements);
 
   // Build the HloModuleProto with a given name.
@@ -71,6 +89,9 @@ class HloBuilder {
   pblczero::HloInstructionProto* MakeElementwiseInstruction(
       std::string_view opcode, HloFlow lhs, HloFlow rhs);
   void AssignInstructionNames();
+  // Returns the id of the scalar computation applying the binary opcode.
+  int64_t GetScalarComputation(std::string_view opcode,
+                               pblczero::XlaShapeProto::Type type);
 
   HloComputation entry_computation_;
   std::unordered_map<std::string, pblczero::HloComputationProto>
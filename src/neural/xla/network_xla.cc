@@ -26,25 +26,38 @@
 */
 
 #include <cassert>
+#include <functional>
+#include <numeric>
 
+#include "neural/batch_buckets.h"
 #include "neural/factory.h"
 #include "neural/network.h"
 #include "neural/onnx/converter.h"
 #include "neural/xla/onnx2hlo.h"
 #include "neural/xla/xla_runner.h"
 #include "utils/bititer.h"
+#include "utils/filesystem.h"
 
 namespace lczero {
 namespace {
 
+// An input tensor of elements of type T, with shape [batch, sample_dims...].
+template <typename T>
 class Lc0InputTensor : public XlaTensor {
  public:
-  Lc0InputTensor(size_t max_batch_size)
+  Lc0InputTensor(size_t max_batch_size,
+                 const std::vector<int64_t>& sample_dims,
+                 pblczero::XlaShapeProto::Type type)
       : max_batch_size_(max_batch_size),
+        sample_size_(std::accumulate(sample_dims.begin(), sample_dims.end(),
+                                     1, std::multiplies<size_t>())),
         // TODO replace with make_unique_for_overwrite() once C++20 is
         // available.
-        data_(new float[GetTensorByteSizeForBatch(max_batch_size)]),
-        shape_{0, kInputPlanes, 8, 8} {}
+        data_(new T[sample_size_ * max_batch_size]),
+        shape_{0},
+        type_(type) {
+    shape_.insert(shape_.end(), sample_dims.begin(), sample_dims.end());
+  }
 
   const std::vector<int64_t>& shape() const override { return shape_; }
   const void* data() const override { return data_.get(); }
@@ -52,28 +65,28 @@ class Lc0InputTensor : public XlaTensor {
   size_t capacity() const override {
     return GetTensorByteSizeForBatch(max_batch_size_);
   }
-  pblczero::XlaShapeProto::Type type() const override {
-    return pblczero::XlaShapeProto::F32;
-  }
+  pblczero::XlaShapeProto::Type type() const override { return type_; }
 
   // Adds a batch to the tensor and returns a pointer to the start of the its
   // part in the buffer. Does NOT initialize the data with zeros.
-  float* AddBatch() {
+  T* AddBatch() {
     assert(size_t(shape_[0]) < max_batch_size_);
-    auto ret = data_.get() + shape_[0] * GetTensorByteSizeForBatch(1);
+    auto ret = data_.get() + shape_[0] * sample_size_;
     ++shape_[0];
     return ret;
   }
   size_t GetBatchSize() const { return shape_[0]; }
 
  private:
-  static size_t GetTensorByteSizeForBatch(size_t batch_size) {
-    return kInputPlanes * 8 * 8 * batch_size * sizeof(float);
+  size_t GetTensorByteSizeForBatch(size_t batch_size) const {
+    return sample_size_ * batch_size * sizeof(T);
   }
 
   const size_t max_batch_size_;
-  std::unique_ptr<float[]> data_;
+  const size_t sample_size_;
+  std::unique_ptr<T[]> data_;
   std::vector<int64_t> shape_;
+  const pblczero::XlaShapeProto::Type type_;
 };
 
 class XlaNetwork;
@@ -90,12 +103,18 @@ class XlaComputation : public NetworkComputation {
 
  private:
   const XlaNetwork* network_;
-  Lc0InputTensor input_tensor_;
+  // Expanded input planes, or masks and values for a compact input (the
+  // others are left empty).
+  Lc0InputTensor<float> input_tensor_;
+  Lc0InputTensor<uint64_t> masks_tensor_;
+  Lc0InputTensor<float> values_tensor_;
   std::vector<std::unique_ptr<XlaTensor>> outputs_;
 };
 
 // Indices of various heads in the HLO output.
 struct XlaNetworkOptions {
+  // Whether the input planes are expanded on the device.
+  bool compact_input = false;
   std::optional<size_t> output_value_idx;
   std::optional<size_t> output_wdl_idx;
   std::optional<size_t> output_policy_idx;
@@ -130,9 +149,30 @@ class XlaNetwork : public Network {
 };
 
 XlaComputation::XlaComputation(const XlaNetwork* network)
-    : network_(network), input_tensor_(network->runner_->GetMaxBatchSize()) {}
+    : network_(network),
+      input_tensor_(network->options_.compact_input
+                        ? 0
+                        : network->runner_->GetMaxBatchSize(),
+                    {kInputPlanes, 8, 8}, pblczero::XlaShapeProto::F32),
+      masks_tensor_(network->options_.compact_input
+                        ? network->runner_->GetMaxBatchSize()
+                        : 0,
+                    {kInputPlanes}, pblczero::XlaShapeProto::U64),
+      values_tensor_(network->options_.compact_input
+                         ? network->runner_->GetMaxBatchSize()
+                         : 0,
+                     {kInputPlanes}, pblczero::XlaShapeProto::F32) {}
 
 void XlaComputation::AddInput(InputPlanes&& input) {
+  if (network_->options_.compact_input) {
+    uint64_t* masks = masks_tensor_.AddBatch();
+    float* values = values_tensor_.AddBatch();
+    for (const auto& plane : input) {
+      *masks++ = plane.mask;
+      *values++ = plane.value;
+    }
+    return;
+  }
   float* ptr = input_tensor_.AddBatch();
   memset(ptr, 0, 8 * 8 * kInputPlanes * sizeof(float));
   for (const auto& plane : input) {
@@ -178,11 +218,17 @@ float XlaComputation::GetMVal(int sample) const {
 }
 
 int XlaComputation::GetBatchSize() const {
-  return input_tensor_.GetBatchSize();
+  return network_->options_.compact_input ? masks_tensor_.GetBatchSize()
+                                          : input_tensor_.GetBatchSize();
 }
 
 void XlaComputation::ComputeBlocking() {
-  outputs_ = network_->runner_->ExecuteBlocking({&input_tensor_});
+  if (network_->options_.compact_input) {
+    outputs_ =
+        network_->runner_->ExecuteBlocking({&masks_tensor_, &values_tensor_});
+  } else {
+    outputs_ = network_->runner_->ExecuteBlocking({&input_tensor_});
+  }
 }
 
 XlaNetwork::XlaNetwork(std::unique_ptr<XlaRunner> runner,
@@ -196,7 +242,11 @@ XlaNetwork::XlaNetwork(std::unique_ptr<XlaRunner> runner,
 // XlaRunner.
 XlaNetworkOptions FillXlaRunnerFromOnnx(const pblczero::OnnxModel& onnx_model,
                                         XlaRunner* runner,
-                                        size_t max_batch_size, size_t steps) {
+                                        const BatchBuckets& buckets,
+                                        bool compact_input) {
+  const std::string input_name(onnx_model.input_planes());
+  Onnx2HloOptions hlo_options;
+  if (compact_input) hlo_options.compact_input = input_name;
   pblczero::ModelProto onnx;
   onnx.ParseFromString(onnx_model.model());
 
@@ -216,36 +266,51 @@ XlaNetworkOptions FillXlaRunnerFromOnnx(const pblczero::OnnxModel& onnx_model,
     }
   };
 
-  for (size_t i = 0; i < steps; ++i) {
-    size_t batch_size = max_batch_size * (i + 1) / steps;
+  // The same for all batch sizes.
+  std::vector<pblczero::TensorProto> folded_initializers;
+  for (const int batch_size : buckets.sizes()) {
     CERR << "Building HLO for batch size " << batch_size << "...";
-    auto conversion = ConvertOnnxToHlo(onnx, batch_size, {});
+    auto conversion = ConvertOnnxToHlo(onnx, batch_size, hlo_options);
     add_tensors(conversion.constants, constant_to_parameter_idx);
     add_tensors(conversion.inputs, input_to_parameter_idx);
     add_tensors(conversion.outputs, output_to_parameter_idx);
     runner->AddModule(batch_size, conversion.hlo_module);
+    folded_initializers = std::move(conversion.folded_initializers);
   }
 
   std::vector<std::unique_ptr<XlaTensor>> constants;
   constants.resize(constant_to_parameter_idx.size() +
                    input_to_parameter_idx.size());
-  for (const auto& initializer : onnx.graph().initializer()) {
+  auto add_constant = [&](const pblczero::TensorProto& initializer) {
     auto iter = constant_to_parameter_idx.find(std::string(initializer.name()));
-    if (iter == constant_to_parameter_idx.end()) continue;
+    if (iter == constant_to_parameter_idx.end()) return;
     auto idx = iter->second;
     assert(idx < constants.size());
     constants[idx] = OnnxTensorToXlaTensor(initializer);
+  };
+  for (const auto& initializer : onnx.graph().initializer()) {
+    add_constant(initializer);
   }
+  for (const auto& initializer : folded_initializers) add_constant(initializer);
 
   CERR << "Transferring constants...";
   runner->SetFrozenInputs(std::move(constants));
   CERR << "Done.";
 
   XlaNetworkOptions options;
-  if (input_to_parameter_idx.size() != 1 ||
-      input_to_parameter_idx.begin()->first != onnx_model.input_planes()) {
-    throw Exception("Expected a single input named " +
-                    std::string(onnx_model.input_planes()));
+  options.compact_input = compact_input;
+  if (compact_input) {
+    // The masks parameter comes first, as ExecuteBlocking() expects.
+    if (input_to_parameter_idx.size() != 2 ||
+        !input_to_parameter_idx.count(input_name + "/masks") ||
+        !input_to_parameter_idx.count(input_name + "/values")) {
+      throw Exception("Expected a single input named " + input_name);
+    }
+    assert(input_to_parameter_idx.at(input_name + "/masks") <
+           input_to_parameter_idx.at(input_name + "/values"));
+  } else if (input_to_parameter_idx.size() != 1 ||
+             input_to_parameter_idx.begin()->first != input_name) {
+    throw Exception("Expected a single input named " + input_name);
   }
   if (onnx_model.has_output_value()) {
     options.output_value_idx =
@@ -275,24 +340,39 @@ std::unique_ptr<Network> MakeXlaNetwork(const std::optional<WeightsFile>& w,
   // Note: if the plugin_path does NOT contain a slash, it's looked up in the
   // LD_LIBRARY_PATH (and a few other system defined places). If it does contain
   // a slash, it's looked up at the exact relative or absolute path.
+  // Compiled executables are cached here, set to an empty string to disable.
+  std::string cache_dir;
+  if (opts.Exists<std::string>("cache_dir")) {
+    cache_dir = opts.Get<std::string>("cache_dir");
+  } else {
+    cache_dir = GetUserCacheDirectory();
+    if (!cache_dir.empty()) {
+      cache_dir += "lc0/";
+      CreateDirectory(cache_dir);
+      cache_dir += "xla";
+    }
+  }
+  if (!cache_dir.empty()) CreateDirectory(cache_dir);
   auto runner = std::make_unique<XlaRunner>(
       opts.GetOrDefault<std::string>("plugin_path",
                                      "./pjrt_c_api_gpu_plugin.so")
           .c_str(),
-      device);
-  int max_batch_size = opts.GetOrDefault<int>("max_batch", 739);
-  int steps = opts.GetOrDefault<int>("steps", 13);
+      device, cache_dir);
+  const auto buckets = BatchBuckets::FromOptions(
+      opts, opts.GetOrDefault<int>("max_batch", 739), 13);
+  // Only transfer the bitboards and plane values, and expand them on device.
+  const bool compact_input = opts.GetOrDefault<bool>("compact_input", true);
 
   XlaNetworkOptions options;
   if (w->has_onnx_model()) {
-    options = FillXlaRunnerFromOnnx(w->onnx_model(), runner.get(),
-                                    max_batch_size, steps);
+    options = FillXlaRunnerFromOnnx(w->onnx_model(), runner.get(), buckets,
+                                    compact_input);
   } else {
     CERR << "Converting weights to ONNX first.";
     WeightsToOnnxConverterOptions onnx_converter_options;
     auto converted = ConvertWeightsToOnnx(*w, onnx_converter_options);
     options = FillXlaRunnerFromOnnx(converted.onnx_model(), runner.get(),
-                                    max_batch_size, steps);
+                                    buckets, compact_input);
   }
 
   return std::make_unique<XlaNetwork>(std::move(runner), options,
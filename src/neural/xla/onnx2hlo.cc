@@ -27,7 +27,11 @@
 
 #include "neural/xla/onnx2hlo.h"
 
+#include <cstring>
+#include <limits>
+#include <numeric>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "neural/onnx/onnx.pb.h"
 #include "neural/xla/hlo.pb.h"
@@ -142,15 +146,71 @@ pblczero::XlaLiteralProto OnnxTensorToXlaLiteral(
   return literal;
 }
 
+// Returns the tensor data with its dimensions permuted.
+std::string TransposeTensorData(const pblczero::TensorProto& tensor,
+                                const std::vector<int64_t>& permutation) {
+  const auto& dims = tensor.dims();
+  const size_t rank = dims.size();
+  const size_t count = std::accumulate(dims.begin(), dims.end(), size_t{1},
+                                       std::multiplies<size_t>());
+  const auto data = tensor.raw_data();
+  if (count == 0 || data.size() % count != 0) {
+    throw Exception("Unexpected data size for tensor " +
+                    std::string(tensor.name()));
+  }
+  const size_t element_size = data.size() / count;
+  std::vector<size_t> input_strides(rank);
+  size_t stride = 1;
+  for (size_t i = rank; i-- > 0;) {
+    input_strides[i] = stride;
+    stride *= dims[i];
+  }
+  // Output dimensions, with the stride of each in the input.
+  std::vector<size_t> output_dims(rank);
+  std::vector<size_t> strides(rank);
+  for (size_t i = 0; i < rank; ++i) {
+    output_dims[i] = dims[permutation[i]];
+    strides[i] = input_strides[permutation[i]];
+  }
+  std::string result(data.size(), '\0');
+  std::vector<size_t> idx(rank, 0);
+  for (size_t out = 0; out < count; ++out) {
+    size_t in = 0;
+    for (size_t i = 0; i < rank; ++i) in += idx[i] * strides[i];
+    std::memcpy(&result[out * element_size], data.data() + in * element_size,
+                element_size);
+    for (size_t i = rank; i-- > 0;) {
+      if (++idx[i] < output_dims[i]) break;
+      idx[i] = 0;
+    }
+  }
+  return result;
+}
+
 class Onnx2HloConverter {
  public:
   Onnx2HloConverter(const Onnx2HloOptions& options) : options_(options) {
     onnx_op_to_builder_["Add"] = &Onnx2HloConverter::OpAdd;
+    onnx_op_to_builder_["Cast"] = &Onnx2HloConverter::OpCast;
     onnx_op_to_builder_["Conv"] = &Onnx2HloConverter::OpConv;
+    onnx_op_to_builder_["Div"] = &Onnx2HloConverter::OpDiv;
+    onnx_op_to_builder_["Exp"] = &Onnx2HloConverter::OpExp;
+    onnx_op_to_builder_["LayerNormalization"] =
+        &Onnx2HloConverter::OpLayerNormalization;
     onnx_op_to_builder_["MatMul"] = &Onnx2HloConverter::OpMatMul;
+    onnx_op_to_builder_["Mish"] = &Onnx2HloConverter::OpMish;
+    onnx_op_to_builder_["Mul"] = &Onnx2HloConverter::OpMul;
+    onnx_op_to_builder_["Reciprocal"] = &Onnx2HloConverter::OpReciprocal;
+    onnx_op_to_builder_["ReduceMean"] = &Onnx2HloConverter::OpReduceMean;
     onnx_op_to_builder_["Relu"] = &Onnx2HloConverter::OpRelu;
     onnx_op_to_builder_["Reshape"] = &Onnx2HloConverter::OpReshape;
+    onnx_op_to_builder_["Sigmoid"] = &Onnx2HloConverter::OpSigmoid;
+    onnx_op_to_builder_["Softmax"] = &Onnx2HloConverter::OpSoftmax;
+    onnx_op_to_builder_["Softplus"] = &Onnx2HloConverter::OpSoftplus;
+    onnx_op_to_builder_["Sqrt"] = &Onnx2HloConverter::OpSqrt;
+    onnx_op_to_builder_["Sub"] = &Onnx2HloConverter::OpSub;
     onnx_op_to_builder_["Tanh"] = &Onnx2HloConverter::OpTanh;
+    onnx_op_to_builder_["Transpose"] = &Onnx2HloConverter::OpTranspose;
   }
 
   Onnx2HloResult Convert(const pblczero::ModelProto& onnx_model,
@@ -166,6 +226,9 @@ class Onnx2HloConverter {
     // Convert ONNX outputs to HLO result.
     result.outputs = BuildOutputs(onnx_model.graph().output());
     result.hlo_module = builder_.Build("onnx_model");
+    for (const auto& tensor : folded_initializers_) {
+      result.folded_initializers.push_back(*tensor);
+    }
     for (size_t i = 0; i < params_.size(); ++i) {
       const auto& param = params_[i];
       auto& dst = param.is_constant ? result.constants : result.inputs;
@@ -223,6 +286,14 @@ class Onnx2HloConverter {
     auto iter = onnx_name_to_hlo_flow_.find(name);
     if (iter != onnx_name_to_hlo_flow_.end()) return iter->second;
 
+    auto lazy = lazy_transposes_.find(name);
+    if (lazy != lazy_transposes_.end()) {
+      auto* flow =
+          builder_.Transpose(lazy->second.input, lazy->second.permutation);
+      onnx_name_to_hlo_flow_[name] = flow;
+      return flow;
+    }
+
     auto iter2 = initializers_.find(name);
     if (iter2 == initializers_.end()) {
       throw Exception("Unknown input " + name);
@@ -346,18 +417,26 @@ class Onnx2HloConverter {
       throw Exception("Reshape only supports constant shape");
     }
     auto new_dims = OnnxTensorToXlaLiteral(*dims_tensor->second).s64s();
-    pblczero::XlaShapeProto new_shape;
-    new_shape.set_element_type(input->shape().element_type());
+    const auto& input_dims = input->shape().dimensions();
+    const int64_t count =
+        std::accumulate(input_dims.begin(), input_dims.end(), int64_t{1},
+                        std::multiplies<int64_t>());
+    int64_t known = 1;
     for (size_t i = 0; i < new_dims.size(); ++i) {
-      auto dim = new_dims[i];
-      if (dim == -1) dim = batch_size_;
-      if (dim == 0) {
+      if (new_dims[i] == 0) {
         if (new_dims.size() != input->shape().dimensions_size()) {
           throw Exception("Reshape cannot infer shape when rank changes");
         }
-        dim = input->shape().dimensions(i);
+        new_dims[i] = input->shape().dimensions(i);
       }
-      new_shape.add_dimensions(dim);
+      if (new_dims[i] != -1) known *= new_dims[i];
+    }
+    pblczero::XlaShapeProto new_shape;
+    new_shape.set_element_type(input->shape().element_type());
+    for (auto dim : new_dims) {
+      // The batch dimension is usually the one to infer, but e.g. attention
+      // reshapes fold the squares into it.
+      new_shape.add_dimensions(dim == -1 ? count / known : dim);
     }
     ResetXlaShapeProtoLayout(&new_shape);
     return {builder_.Reshape(input, new_shape)};
@@ -365,20 +444,264 @@ class Onnx2HloConverter {
 
   std::vector<HloFlow> OpMatMul(const pblczero::NodeProto& node) {
     CheckKnownAttributes(node, {});
-    auto* lhs = GetInput(node, 0);
-    auto* rhs = GetInput(node, 1);
-    if (lhs->shape().dimensions_size() != 2 ||
-        rhs->shape().dimensions_size() != 2) {
-      throw Exception("MatMul only implemented for 2D inputs so far");
+    // Transposed operands (e.g. attention Q, K and V) are used as they were
+    // before the transpose, with the permutation applied to the dimension
+    // numbers instead.
+    auto [lhs, lhs_perm] = GetMatMulOperand(node, 0);
+    auto [rhs, rhs_perm] = GetMatMulOperand(node, 1);
+    const size_t rank = lhs_perm.size();
+    if (rank < 2 || rhs_perm.size() != rank) {
+      throw Exception("MatMul only implemented for inputs of the same rank");
     }
     pblczero::XlaDotDimensionNumbers dn;
-    dn.add_lhs_contracting_dimensions(1);
-    dn.add_rhs_contracting_dimensions(0);
+    for (size_t i = 0; i + 2 < rank; ++i) {
+      dn.add_lhs_batch_dimensions(lhs_perm[i]);
+      dn.add_rhs_batch_dimensions(rhs_perm[i]);
+    }
+    dn.add_lhs_contracting_dimensions(lhs_perm[rank - 1]);
+    dn.add_rhs_contracting_dimensions(rhs_perm[rank - 2]);
+    // With a single non-contracting dimension on each side, the dot output is
+    // [batch..., lhs rows, rhs columns] as in ONNX.
     return {builder_.Dot(lhs, rhs, dn)};
   }
 
+  std::vector<HloFlow> OpTranspose(const pblczero::NodeProto& node) {
+    CheckKnownAttributes(node, {"perm"});
+    auto* input = GetInput(node, 0);
+    return {builder_.Transpose(input, GetPermutation(node, input))};
+  }
+
+  std::vector<HloFlow> OpMul(const pblczero::NodeProto& node) {
+    CheckKnownAttributes(node, {});
+    auto [lhs, rhs] = EqualizeShape(GetInput(node, 0), GetInput(node, 1));
+    return {builder_.Multiply(lhs, rhs)};
+  }
+
+  std::vector<HloFlow> OpSub(const pblczero::NodeProto& node) {
+    CheckKnownAttributes(node, {});
+    auto [lhs, rhs] = EqualizeShape(GetInput(node, 0), GetInput(node, 1));
+    return {builder_.Subtract(lhs, rhs)};
+  }
+
+  std::vector<HloFlow> OpDiv(const pblczero::NodeProto& node) {
+    CheckKnownAttributes(node, {});
+    auto [lhs, rhs] = EqualizeShape(GetInput(node, 0), GetInput(node, 1));
+    return {builder_.Divide(lhs, rhs)};
+  }
+
+  std::vector<HloFlow> OpExp(const pblczero::NodeProto& node) {
+    CheckKnownAttributes(node, {});
+    return {builder_.Exponential(GetInput(node, 0))};
+  }
+
+  std::vector<HloFlow> OpSigmoid(const pblczero::NodeProto& node) {
+    CheckKnownAttributes(node, {});
+    return {builder_.Logistic(GetInput(node, 0))};
+  }
+
+  std::vector<HloFlow> OpSqrt(const pblczero::NodeProto& node) {
+    CheckKnownAttributes(node, {});
+    return {builder_.Sqrt(GetInput(node, 0))};
+  }
+
+  std::vector<HloFlow> OpReciprocal(const pblczero::NodeProto& node) {
+    CheckKnownAttributes(node, {});
+    auto* input = GetInput(node, 0);
+    return {builder_.Divide(MakeSplat(1, input->shape()), input)};
+  }
+
+  std::vector<HloFlow> OpSoftplus(const pblczero::NodeProto& node) {
+    CheckKnownAttributes(node, {});
+    return {MakeSoftplus(GetInput(node, 0))};
+  }
+
+  std::vector<HloFlow> OpMish(const pblczero::NodeProto& node) {
+    CheckKnownAttributes(node, {});
+    return {MakeMish(GetInput(node, 0))};
+  }
+
+  std::vector<HloFlow> OpCast(const pblczero::NodeProto& node) {
+    CheckKnownAttributes(node, {"to"});
+    auto* input = GetInput(node, 0);
+    const auto type = OnnxTypeToXlaType(
+        static_cast<pblczero::TensorProto::DataType>(
+            GetAttribute(node, "to")->i()));
+    return {builder_.Convert(input, type)};
+  }
+
+  std::vector<HloFlow> OpSoftmax(const pblczero::NodeProto& node) {
+    CheckKnownAttributes(node, {"axis"});
+    auto* input = GetInput(node, 0);
+    const auto* axis = GetAttribute(node, "axis", true);
+    const int64_t dim = NormalizeAxis(axis ? axis->i() : -1, input);
+    // Subtracting the maximum keeps the exponentials in range.
+    const auto& shape = input->shape();
+    auto* max = ReduceAndBroadcast(
+        input, "maximum",
+        MakeScalar(-std::numeric_limits<float>::infinity(),
+                   shape.element_type()),
+        {dim});
+    auto* flow = builder_.Exponential(builder_.Subtract(input, max));
+    auto* sum = ReduceAndBroadcast(
+        flow, "add", MakeScalar(0, shape.element_type()), {dim});
+    return {builder_.Divide(flow, sum)};
+  }
+
+  std::vector<HloFlow> OpReduceMean(const pblczero::NodeProto& node) {
+    CheckKnownAttributes(node, {"axes", "keepdims"});
+    auto* input = GetInput(node, 0);
+    const auto& shape = input->shape();
+    std::vector<int64_t> axes;
+    if (const auto* attr = GetAttribute(node, "axes", true)) {
+      for (auto axis : attr->ints()) axes.push_back(NormalizeAxis(axis, input));
+      std::sort(axes.begin(), axes.end());
+    } else {
+      axes.resize(shape.dimensions_size());
+      std::iota(axes.begin(), axes.end(), 0);
+    }
+    int64_t count = 1;
+    for (auto axis : axes) count *= shape.dimensions(axis);
+    auto* flow = builder_.Reduce(
+        input, MakeScalar(0, shape.element_type()), "add", axes);
+    flow = builder_.Divide(flow, MakeSplat(count, flow->shape()));
+    const auto* keepdims = GetAttribute(node, "keepdims", true);
+    if (keepdims && keepdims->i() == 0) return {flow};
+    pblczero::XlaShapeProto new_shape = shape;
+    for (auto axis : axes) (*new_shape.mutable_dimensions())[axis] = 1;
+    ResetXlaShapeProtoLayout(&new_shape);
+    return {builder_.Reshape(flow, new_shape)};
+  }
+
+  std::vector<HloFlow> OpLayerNormalization(const pblczero::NodeProto& node) {
+    CheckKnownAttributes(node, {"axis", "epsilon", "stash_type"});
+    if (node.output_size() != 1) {
+      throw Exception("LayerNormalization mean and variance outputs are not "
+                      "supported");
+    }
+    auto* input = GetInput(node, 0);
+    auto* scale = GetInput(node, 1);
+    auto* bias = GetInput(node, 2, true);
+    const auto* axis_attr = GetAttribute(node, "axis", true);
+    const auto* epsilon_attr = GetAttribute(node, "epsilon", true);
+    const int64_t axis = NormalizeAxis(axis_attr ? axis_attr->i() : -1, input);
+    const float epsilon = epsilon_attr ? epsilon_attr->f() : 1e-5f;
+    const auto type = input->shape().element_type();
+
+    // The statistics are always computed in F32, and the variance of the
+    // centered values rather than from the mean of squares.
+    auto* flow = builder_.Convert(input, pblczero::XlaShapeProto::F32);
+    std::vector<int64_t> dims(flow->shape().dimensions_size() - axis);
+    std::iota(dims.begin(), dims.end(), axis);
+    flow = builder_.Subtract(flow, MeanAndBroadcast(flow, dims));
+    auto* var = MeanAndBroadcast(builder_.Multiply(flow, flow), dims);
+    var = builder_.Add(var, MakeSplat(epsilon, var->shape()));
+    flow = builder_.Multiply(flow, builder_.Rsqrt(var));
+    flow = builder_.Convert(flow, type);
+    std::tie(flow, scale) = EqualizeShape(flow, scale);
+    flow = builder_.Multiply(flow, scale);
+    if (!bias) return {flow};
+    std::tie(flow, bias) = EqualizeShape(flow, bias);
+    return {builder_.Add(flow, bias)};
+  }
+
   /////////////////////////////////////////////////////////////////////////////
 
+  // Returns the operand and the permutation of its dimensions, which is not
+  // identity if it's a deferred transpose.
+  std::pair<HloFlow, std::vector<int64_t>> GetMatMulOperand(
+      const pblczero::NodeProto& node, size_t idx) {
+    if (idx >= node.input_size()) {
+      throw Exception("Input " + std::to_string(idx) + " not set");
+    }
+    auto iter = lazy_transposes_.find(std::string(node.input(idx)));
+    if (iter != lazy_transposes_.end()) {
+      return {iter->second.input, iter->second.permutation};
+    }
+    auto* flow = GetInput(node, idx);
+    std::vector<int64_t> permutation(flow->shape().dimensions_size());
+    std::iota(permutation.begin(), permutation.end(), 0);
+    return {flow, permutation};
+  }
+
+  // The "perm" attribute of a Transpose node, reversing the dimensions by
+  // default.
+  std::vector<int64_t> GetPermutation(const pblczero::NodeProto& node,
+                                      HloFlow input) {
+    const size_t rank = input->shape().dimensions_size();
+    std::vector<int64_t> permutation(rank);
+    if (const auto* perm = GetAttribute(node, "perm", true)) {
+      if (perm->ints_size() != rank) {
+        throw Exception("'perm' attribute has wrong size");
+      }
+      permutation = perm->ints();
+    } else {
+      for (size_t i = 0; i < rank; ++i) permutation[i] = rank - i - 1;
+    }
+    return permutation;
+  }
+
+  // Converts a negative ONNX axis to the dimension index.
+  int64_t NormalizeAxis(int64_t axis, HloFlow input) {
+    const int64_t rank = input->shape().dimensions_size();
+    if (axis < 0) axis += rank;
+    if (axis < 0 || axis >= rank) {
+      throw Exception("Axis " + std::to_string(axis) + " out of range");
+    }
+    return axis;
+  }
+
+  // Reduces the dimensions with the binary op and broadcasts the result back
+  // to the input shape.
+  HloFlow ReduceAndBroadcast(HloFlow input, std::string_view opcode,
+                             HloFlow init, const std::vector<int64_t>& dims) {
+    auto* flow = builder_.Reduce(input, init, opcode, dims);
+    std::vector<int64_t> kept_dims;
+    for (size_t i = 0; i < input->shape().dimensions_size(); ++i) {
+      if (std::find(dims.begin(), dims.end(), static_cast<int64_t>(i)) ==
+          dims.end()) {
+        kept_dims.push_back(i);
+      }
+    }
+    return builder_.Broadcast(flow, input->shape(), kept_dims);
+  }
+
+  HloFlow MeanAndBroadcast(HloFlow input, const std::vector<int64_t>& dims) {
+    const auto& shape = input->shape();
+    int64_t count = 1;
+    for (auto dim : dims) count *= shape.dimensions(dim);
+    auto* sum = ReduceAndBroadcast(
+        input, "add", MakeScalar(0, shape.element_type()), dims);
+    return builder_.Divide(sum, MakeSplat(count, shape));
+  }
+
+  // log(1 + e^x), written so that it doesn't overflow for large x.
+  HloFlow MakeSoftplus(HloFlow input) {
+    const auto& shape = input->shape();
+    auto* flow = builder_.Negate(builder_.Abs(input));
+    flow = builder_.Log1p(builder_.Exponential(flow));
+    return builder_.Add(builder_.Maximum(input, MakeSplat(0, shape)), flow);
+  }
+
+  // x * tanh(softplus(x)) = x * n / (n + 2) with n = e^x * (e^x + 2), a single
+  // exponential instead of the exp, log and tanh chain. x is clamped for the
+  // exponential where the ratio is 1 anyway.
+  HloFlow MakeMish(HloFlow input) {
+    const auto& shape = input->shape();
+    auto* two = MakeSplat(2, shape);
+    auto* e = builder_.Exponential(
+        builder_.Minimum(input, MakeSplat(20, shape)));
+    auto* n = builder_.Multiply(e, builder_.Add(e, two));
+    return builder_.Multiply(
+        input, builder_.Divide(n, builder_.Add(n, two)));
+  }
+
+  // Makes a scalar constant broadcast to the shape.
+  template <typename T>
+  HloFlow MakeSplat(T value, const pblczero::XlaShapeProto& shape) {
+    return builder_.Broadcast(MakeScalar(value, shape.element_type()), shape,
+                              {});
+  }
+
   // Makes a scalar constant (usually 0 or 1) of a given type.
   template <typename T>
   HloFlow MakeScalar(T value, pblczero::XlaShapeProto::Type type) {
@@ -389,6 +712,9 @@ class Onnx2HloConverter {
       case pblczero::XlaShapeProto::F32:
         literal.add_f32s(value);
         break;
+      case pblczero::XlaShapeProto::U64:
+        literal.add_u64s(value);
+        break;
       default:
         throw Exception("Unsupported type for zero constant");
     }
@@ -440,6 +766,11 @@ class Onnx2HloConverter {
       ctx.SetOpType("input");
       ctx.SetOpName(input.name());
       auto out_shape = OnnxShapeToXlaShape(input.type(), batch_size_);
+      if (input.name() == options_.compact_input) {
+        onnx_name_to_hlo_flow_[std::string(input.name())] =
+            BuildCompactInput(std::string(input.name()), out_shape);
+        continue;
+      }
       auto in_shape = out_shape;
       in_shape.set_element_type(options_.io_type);
       const auto* flow =
@@ -449,6 +780,47 @@ class Onnx2HloConverter {
     }
   }
 
+  // Builds the parameters of a compact input and expands them to the full
+  // planes, see Onnx2HloOptions::compact_input.
+  HloFlow BuildCompactInput(const std::string& name,
+                            const pblczero::XlaShapeProto& shape) {
+    if (shape.dimensions_size() != 4 || shape.dimensions(2) != 8 ||
+        shape.dimensions(3) != 8) {
+      throw Exception("Compact input must have shape [batch, planes, 8, 8]");
+    }
+    const auto type = shape.element_type();
+    pblczero::XlaShapeProto planes_shape;
+    planes_shape.set_element_type(pblczero::XlaShapeProto::U64);
+    planes_shape.add_dimensions(shape.dimensions(0));
+    planes_shape.add_dimensions(shape.dimensions(1));
+    ResetXlaShapeProtoLayout(&planes_shape);
+    auto* masks = MakeParameter(name + "/masks", planes_shape, false);
+    planes_shape.set_element_type(options_.io_type);
+    auto* values = MakeParameter(name + "/values", planes_shape, false);
+    values = builder_.Convert(values, type);
+
+    // bits[b, p, i] = (masks[b, p] >> i) & 1
+    pblczero::XlaShapeProto bits_shape = planes_shape;
+    bits_shape.set_element_type(pblczero::XlaShapeProto::U64);
+    bits_shape.add_dimensions(64);
+    ResetXlaShapeProtoLayout(&bits_shape);
+    pblczero::XlaLiteralProto shifts;
+    shifts.mutable_shape()->set_element_type(pblczero::XlaShapeProto::U64);
+    shifts.mutable_shape()->add_dimensions(64);
+    ResetXlaShapeProtoLayout(shifts.mutable_shape());
+    for (uint64_t i = 0; i < 64; ++i) shifts.add_u64s(i);
+    auto* flow = builder_.ShiftRightLogical(
+        builder_.Broadcast(masks, bits_shape, {0, 1}),
+        builder_.Broadcast(builder_.Constant(shifts), bits_shape, {2}));
+    auto* one = MakeScalar(1, pblczero::XlaShapeProto::U64);
+    flow = builder_.And(flow, builder_.Broadcast(one, bits_shape, {}));
+    flow = builder_.Convert(flow, type);
+    bits_shape.set_element_type(type);
+    flow = builder_.Multiply(flow,
+                             builder_.Broadcast(values, bits_shape, {0, 1}));
+    return builder_.Reshape(flow, shape);
+  }
+
   // Makes a parameter instruction (for inputs or large constants).
   HloFlow MakeParameter(const std::string& name,
                         const pblczero::XlaShapeProto& shape,
@@ -460,6 +832,15 @@ class Onnx2HloConverter {
 
   void BuildGraph(const pblczero::GraphProto& graph) {
     for (const auto& node : graph.node()) {
+      for (size_t i = 0; i < node.input_size(); ++i) {
+        consumers_[std::string(node.input(i))].push_back(&node);
+      }
+    }
+    for (const auto& output : graph.output()) {
+      consumers_[std::string(output.name())].push_back(nullptr);
+    }
+    for (const auto& node : graph.node()) {
+      if (fused_nodes_.count(&node)) continue;
       // Set up the context so that nodes have metadata from the original ONNX.
       auto ctx = HloContext(&builder_);
       ctx.SetOpType(node.op_type());
@@ -468,15 +849,129 @@ class Onnx2HloConverter {
     }
   }
 
+  // Returns the only consumer of the value if it's a node of the given type.
+  const pblczero::NodeProto* GetSoleConsumer(std::string_view name,
+                                             std::string_view op_type) {
+    auto iter = consumers_.find(std::string(name));
+    if (iter == consumers_.end() || iter->second.size() != 1) return nullptr;
+    const auto* consumer = iter->second[0];
+    if (!consumer || consumer->op_type() != op_type) return nullptr;
+    return consumer;
+  }
+
+  // Folds Reshape and Transpose of initializers at conversion time, rather
+  // than doing it on the device for every evaluation.
+  bool TryFoldConstant(const pblczero::NodeProto& node) {
+    if (node.op_type() != "Reshape" && node.op_type() != "Transpose") {
+      return false;
+    }
+    if (node.input_size() == 0) return false;
+    auto iter = initializers_.find(std::string(node.input(0)));
+    if (iter == initializers_.end()) return false;
+    const auto& input = *iter->second;
+    auto folded = std::make_unique<pblczero::TensorProto>();
+    folded->set_name(node.output(0));
+    folded->set_data_type(input.data_type());
+    if (node.op_type() == "Reshape") {
+      if (node.input_size() < 2) return false;
+      auto dims_tensor = initializers_.find(std::string(node.input(1)));
+      if (dims_tensor == initializers_.end()) return false;
+      auto new_dims = OnnxTensorToXlaLiteral(*dims_tensor->second).s64s();
+      const int64_t count =
+          std::accumulate(input.dims().begin(), input.dims().end(),
+                          int64_t{1}, std::multiplies<int64_t>());
+      int64_t known = 1;
+      for (size_t i = 0; i < new_dims.size(); ++i) {
+        if (new_dims[i] == 0) new_dims[i] = input.dims(i);
+        if (new_dims[i] != -1) known *= new_dims[i];
+      }
+      for (auto& dim : new_dims) {
+        if (dim == -1) dim = count / known;
+        folded->add_dims(dim);
+      }
+      folded->set_raw_data(input.raw_data());
+    } else {
+      CheckKnownAttributes(node, {"perm"});
+      std::vector<int64_t> permutation(input.dims_size());
+      if (const auto* perm = GetAttribute(node, "perm", true)) {
+        permutation = perm->ints();
+      } else {
+        for (size_t i = 0; i < permutation.size(); ++i) {
+          permutation[i] = permutation.size() - i - 1;
+        }
+      }
+      for (auto dim : permutation) folded->add_dims(input.dims(dim));
+      folded->set_raw_data(TransposeTensorData(input, permutation));
+    }
+    initializers_[std::string(node.output(0))] = folded.get();
+    folded_initializers_.push_back(std::move(folded));
+    return true;
+  }
+
+  // Lowers the pattern starting at the node in one go if it's a known one.
+  // Returns whether it did.
+  bool TryFuse(const pblczero::NodeProto& node) {
+    if (node.op_type() == "Transpose") return DeferTranspose(node);
+    if (node.op_type() == "Softplus") return FuseMish(node);
+    if (node.op_type() == "Sqrt") return FuseRsqrt(node);
+    return false;
+  }
+
+  // Transposes only consumed by MatMul nodes are folded into their dot
+  // dimension numbers (and emitted lazily if needed after all).
+  bool DeferTranspose(const pblczero::NodeProto& node) {
+    auto iter = consumers_.find(std::string(node.output(0)));
+    if (iter == consumers_.end()) return false;
+    for (const auto* consumer : iter->second) {
+      if (!consumer || consumer->op_type() != "MatMul") return false;
+    }
+    CheckKnownAttributes(node, {"perm"});
+    auto* input = GetInput(node, 0);
+    lazy_transposes_[std::string(node.output(0))] = {
+        input, GetPermutation(node, input)};
+    return true;
+  }
+
+  // Softplus -> Tanh -> Mul with the Softplus input.
+  bool FuseMish(const pblczero::NodeProto& node) {
+    const auto* tanh = GetSoleConsumer(node.output(0), "Tanh");
+    if (!tanh) return false;
+    const auto* mul = GetSoleConsumer(tanh->output(0), "Mul");
+    if (!mul || mul->input_size() != 2) return false;
+    const auto x = node.input(0);
+    const auto y = tanh->output(0);
+    if (!(mul->input(0) == x && mul->input(1) == y) &&
+        !(mul->input(0) == y && mul->input(1) == x)) {
+      return false;
+    }
+    CheckKnownAttributes(node, {});
+    onnx_name_to_hlo_flow_[std::string(mul->output(0))] =
+        MakeMish(GetInput(node, 0));
+    fused_nodes_.insert(tanh);
+    fused_nodes_.insert(mul);
+    return true;
+  }
+
+  // Sqrt -> Reciprocal, as in the decomposed layer normalization.
+  bool FuseRsqrt(const pblczero::NodeProto& node) {
+    const auto* reciprocal = GetSoleConsumer(node.output(0), "Reciprocal");
+    if (!reciprocal) return false;
+    CheckKnownAttributes(node, {});
+    onnx_name_to_hlo_flow_[std::string(reciprocal->output(0))] =
+        builder_.Rsqrt(GetInput(node, 0));
+    fused_nodes_.insert(reciprocal);
+    return true;
+  }
+
   // Calls the correct function to handle the ONNX node, and stores output in
   // the map.
   void DispatchNode(const pblczero::NodeProto& node) {
-    auto iter = onnx_op_to_builder_.find(std::string(node.op_type()));
-    if (iter == onnx_op_to_builder_.end()) {
-      throw Exception("Unsupported ONNX op[" + std::string(node.op_type()) +
-                      "] name=[" + std::string(node.name()) + "]");
-    }
     try {
+      if (TryFoldConstant(node) || TryFuse(node)) return;
+      auto iter = onnx_op_to_builder_.find(std::string(node.op_type()));
+      if (iter == onnx_op_to_builder_.end()) {
+        throw Exception("Unsupported ONNX op");
+      }
       auto outputs = (this->*iter->second)(node);
       if (outputs.size() != node.output_size()) {
         throw Exception("Node produced wrong number of outputs");
@@ -495,6 +990,18 @@ class Onnx2HloConverter {
                                       const pblczero::NodeProto&)>
       onnx_op_to_builder_;
   std::unordered_map<std::string, const pblczero::TensorProto*> initializers_;
+  // Initializers created by TryFoldConstant().
+  std::vector<std::unique_ptr<pblczero::TensorProto>> folded_initializers_;
+  // ONNX nodes using each value, graph outputs count as a nullptr consumer.
+  std::unordered_map<std::string, std::vector<const pblczero::NodeProto*>>
+      consumers_;
+  // Nodes already lowered as part of a pattern.
+  std::unordered_set<const pblczero::NodeProto*> fused_nodes_;
+  struct LazyTranspose {
+    HloFlow input;
+    std::vector<int64_t> permutation;
+  };
+  std::unordered_map<std::string, LazyTranspose> lazy_transposes_;
   HloBuilder builder_;
   size_t batch_size_ = 0;
   Onnx2HloOptions options_;
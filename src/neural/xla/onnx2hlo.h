@@ -43,6 +43,11 @@ struct Onnx2HloOptions {
   // The types of input/output tensors (does not affect constants passed as
   // parameters).
   pblczero::XlaShapeProto::Type io_type = pblczero::XlaShapeProto::F32;
+  // If set, the input with this name (of shape [batch, planes, 8, 8]) is
+  // passed as two smaller parameters and expanded on the device: "<name>/masks"
+  // of type U64 and shape [batch, planes] with a bit per square, followed by
+  // "<name>/values" of shape [batch, planes] with the value of the set bits.
+  std::string compact_input;
 };
 
 struct Onnx2HloResult {
@@ -57,6 +62,9 @@ struct Onnx2HloResult {
   std::vector<NamedTensor> constants;
   std::vector<NamedTensor> inputs;
   std::vector<NamedTensor> outputs;
+  // Initializers computed at conversion time from the ones of the model (e.g.
+  // reshaped or transposed weights). Constants above may refer to them.
+  std::vector<pblczero::TensorProto> folded_initializers;
   pblczero::HloModuleProto hlo_module;
 };
 
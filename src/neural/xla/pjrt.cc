@@ -147,8 +147,36 @@ PjrtExecutable::~PjrtExecutable() {
 
 size_t PjrtExecutable::GetNumOutputs() const { return num_outputs_; }
 
+std::string PjrtExecutable::Serialize() const {
+  auto args = MakeStruct<PJRT_LoadedExecutable_GetExecutable_Args>();
+  args.loaded_executable = executable_;
+  CheckError(api_->PJRT_LoadedExecutable_GetExecutable(&args));
+
+  auto args2 = MakeStruct<PJRT_Executable_Serialize_Args>();
+  args2.executable = args.executable;
+  PJRT_Error* error = api_->PJRT_Executable_Serialize(&args2);
+  std::string result;
+  if (!error) {
+    result.assign(args2.serialized_bytes, args2.serialized_bytes_size);
+    args2.serialized_executable_deleter(args2.serialized_executable);
+  }
+
+  auto args3 = MakeStruct<PJRT_Executable_Destroy_Args>();
+  args3.executable = args.executable;
+  CheckError(api_->PJRT_Executable_Destroy(&args3));
+  CheckError(error);
+  return result;
+}
+
 std::vector<std::unique_ptr<PjrtDeviceBuffer>> PjrtExecutable::ExecuteBlocking(
     const std::vector<PjrtDeviceBuffer*>& inputs) {
+  auto execution = ExecuteAsync(inputs);
+  execution.done->Await();
+  return std::move(execution.outputs);
+}
+
+PjrtExecution PjrtExecutable::ExecuteAsync(
+    const std::vector<PjrtDeviceBuffer*>& inputs) {
   auto options = MakeStruct<PJRT_ExecuteOptions>();
   options.num_non_donatable_input_indices = inputs.size();
   std::vector<int64_t> non_donatable_indices(inputs.size());
@@ -173,16 +201,14 @@ std::vector<std::unique_ptr<PjrtDeviceBuffer>> PjrtExecutable::ExecuteBlocking(
   args.device_complete_events = &event_ptr;
   CheckError(api_->PJRT_LoadedExecutable_Execute(&args));
 
-  PjrtEvent event(api_, event_ptr);
-  event.Await();
-
-  std::vector<std::unique_ptr<PjrtDeviceBuffer>> output_buffers;
-  output_buffers.reserve(num_outputs_);
+  PjrtExecution execution;
+  execution.done = std::make_unique<PjrtEvent>(api_, event_ptr);
+  execution.outputs.reserve(num_outputs_);
   for (size_t i = 0; i < num_outputs_; ++i) {
-    output_buffers.push_back(
+    execution.outputs.push_back(
         std::make_unique<PjrtDeviceBuffer>(api_, outputs[i]));
   }
-  return output_buffers;
+  return execution;
 }
 
 PjrtDevice::PjrtDevice(const PJRT_Api* api, PJRT_Device* device)
@@ -227,6 +253,16 @@ std::unique_ptr<PjrtExecutable> PjrtClient::CompileHlo(
   return std::make_unique<PjrtExecutable>(api_, args.executable);
 }
 
+std::unique_ptr<PjrtExecutable> PjrtClient::DeserializeAndLoad(
+    std::string_view serialized) {
+  auto args = MakeStruct<PJRT_Executable_DeserializeAndLoad_Args>();
+  args.client = client_;
+  args.serialized_executable = serialized.data();
+  args.serialized_executable_size = serialized.size();
+  CheckError(api_->PJRT_Executable_DeserializeAndLoad(&args));
+  return std::make_unique<PjrtExecutable>(api_, args.loaded_executable);
+}
+
 std::vector<std::unique_ptr<PjrtDevice>> PjrtClient::GetDevices() {
   auto args = MakeStruct<PJRT_Client_Devices_Args>();
   args.client = client_;
@@ -307,6 +343,14 @@ PjrtHostToDeviceTransfer::AwaitAndReleaseBuffer() {
                         "Buffer already released");
   }
   Await();
+  return ReleaseBuffer();
+}
+
+std::unique_ptr<PjrtDeviceBuffer> PjrtHostToDeviceTransfer::ReleaseBuffer() {
+  if (!buffer_) {
+    throw PjrtException(PjrtErrorCode::INVALID_ARGUMENT,
+                        "Buffer already released");
+  }
   auto res = std::make_unique<PjrtDeviceBuffer>(api_, buffer_);
   buffer_ = nullptr;
   return res;
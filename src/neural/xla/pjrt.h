@@ -31,6 +31,8 @@
 
 #include <memory>
 #include <stdexcept>
+#include <string>
+#include <string_view>
 #include <variant>
 #include <vector>
 
@@ -189,6 +191,15 @@ class PjrtDeviceBuffer : protected PjrtCommon {
   friend class PjrtExecutable;
 };
 
+// Result of an asynchronous execution. The output buffers can be used (e.g.
+// copied to the host) right away, the operations are queued behind the
+// execution.
+struct PjrtExecution {
+  std::vector<std::unique_ptr<PjrtDeviceBuffer>> outputs;
+  // Fires when the execution is done and the inputs are not used anymore.
+  std::unique_ptr<PjrtEvent> done;
+};
+
 class PjrtExecutable : protected PjrtCommon {
  public:
   PjrtExecutable(const PJRT_Api* api, PJRT_LoadedExecutable* executable);
@@ -197,7 +208,13 @@ class PjrtExecutable : protected PjrtCommon {
   // modified. The function allocates the output buffers and returns them.
   std::vector<std::unique_ptr<PjrtDeviceBuffer>> ExecuteBlocking(
       const std::vector<PjrtDeviceBuffer*>& inputs);
+  // Same as above, but returns without waiting for the execution to finish.
+  // The inputs must be kept alive until the done event fires.
+  PjrtExecution ExecuteAsync(const std::vector<PjrtDeviceBuffer*>& inputs);
   size_t GetNumOutputs() const;
+  // Returns a platform specific serialization of the executable, that can be
+  // loaded back with PjrtClient::DeserializeAndLoad() by the same plugin.
+  std::string Serialize() const;
 
  private:
   PJRT_LoadedExecutable* executable_;
@@ -217,6 +234,10 @@ class PjrtHostToDeviceTransfer : protected PjrtCommon {
   // Waits for the transfer to complete and releases the ownership of the
   // buffer.
   std::unique_ptr<PjrtDeviceBuffer> AwaitAndReleaseBuffer();
+  // Releases the ownership of the buffer without waiting, operations on it are
+  // queued behind the transfer. The host memory must stay valid until this
+  // object is destroyed.
+  std::unique_ptr<PjrtDeviceBuffer> ReleaseBuffer();
 
  private:
   PJRT_Buffer* buffer_;
@@ -229,6 +250,9 @@ class PjrtClient : protected PjrtCommon {
   ~PjrtClient();
   std::unique_ptr<PjrtExecutable> CompileHlo(std::string_view hlo,
                                              std::string_view config);
+  // Loads an executable produced by PjrtExecutable::Serialize().
+  std::unique_ptr<PjrtExecutable> DeserializeAndLoad(
+      std::string_view serialized);
   std::vector<std::unique_ptr<PjrtDevice>> GetDevices();
   std::unique_ptr<PjrtHostToDeviceTransfer> HostToDevice(
       std::string_view buffer, PjrtType type, const std::vector<int64_t>& dims,
@@ -27,6 +27,8 @@
 
 #include "neural/xla/print_hlo.h"
 
+#include <unordered_map>
+
 namespace lczero {
 namespace {
 
@@ -72,7 +74,9 @@ class HloPrettyPrinter {
       : options_(options), s_(stream) {}
 
   void PrintModule(const pblczero::HloModuleProto& module) {
-    current_module_ = &module;
+    for (const auto& computation : module.computations()) {
+      computation_names_[computation.id()] = computation.name();
+    }
     s_ << "HloModule " << module.name();
     if (module.has_host_program_shape()) {
       s_ << ", entry_computation_layout=";
@@ -85,7 +89,7 @@ class HloPrettyPrinter {
       if (module.entry_computation_id() == computation.id()) s_ << "ENTRY ";
       PrintComputation(computation);
     }
-    current_module_ = nullptr;
+    computation_names_.clear();
   }
 
  private:
@@ -243,7 +247,7 @@ class HloPrettyPrinter {
       PrintDelimeted(
           instruction.operand_ids(),
           [&](int64_t id) {
-            s_ << "%" << current_computation_->instructions(id).name();
+            s_ << "%" << instruction_names_[id];
           },
           ", ");
     }
@@ -305,7 +309,7 @@ class HloPrettyPrinter {
     if (instruction.called_computation_ids_size() > 0) {
       PrintDelimeted(
           instruction.called_computation_ids(),
-          [&](int64_t id) { s_ << current_module_->computations(id).name(); },
+          [&](int64_t id) { s_ << computation_names_[id]; },
           ",", ", calls={", "}");
     }
     if (instruction.has_window()) {
@@ -362,7 +366,9 @@ class HloPrettyPrinter {
 
   // Prints the given computation.
   void PrintComputation(const pblczero::HloComputationProto& computation) {
-    current_computation_ = &computation;
+    for (const auto& instruction : computation.instructions()) {
+      instruction_names_[instruction.id()] = instruction.name();
+    }
     s_ << computation.name() << " {\n";
     for (const auto& instruction : computation.instructions()) {
       s_ << "    ";
@@ -371,12 +377,13 @@ class HloPrettyPrinter {
       s_ << "\n";
     }
     s_ << "}\n";
-    current_computation_ = nullptr;
+    instruction_names_.clear();
   }
 
   PrettyPrintHloOptions options_;
-  const pblczero::HloModuleProto* current_module_ = nullptr;
-  const pblczero::HloComputationProto* current_computation_ = nullptr;
+  // Names by id, ids are not necessarily indices.
+  std::unordered_map<int64_t, std::string_view> computation_names_;
+  std::unordered_map<int64_t, std::string_view> instruction_names_;
   std::ostream& s_;
 };
 
@@ -27,9 +27,14 @@
 
 #include "neural/xla/xla_runner.h"
 
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iterator>
 #include <numeric>
 
 #include "utils/exception.h"
+#include "utils/hashcat.h"
 #include "utils/logging.h"
 
 namespace lczero {
@@ -45,6 +50,8 @@ size_t GetTypeSize(pblczero::XlaShapeProto::Type type) {
       return sizeof(int32_t);
     case pblczero::XlaShapeProto::S64:
       return sizeof(int64_t);
+    case pblczero::XlaShapeProto::U64:
+      return sizeof(uint64_t);
     default:
       throw Exception("Add size for type " +
                       pblczero::XlaShapeProto::Type_Name(type));
@@ -89,8 +96,11 @@ std::string XlaTensor::DebugString() {
   return result;
 }
 
-XlaRunner::XlaRunner(const char* library_path, int device)
-    : pjrt_client_(Pjrt(library_path).CreateClient()), device_(device) {
+XlaRunner::XlaRunner(const char* library_path, int device,
+                     const std::string& cache_dir)
+    : device_(device), cache_dir_(cache_dir) {
+  Pjrt pjrt(library_path);
+  pjrt_client_ = pjrt.CreateClient();
   CERR << "Devices:";
   devices_ = pjrt_client_->GetDevices();
   for (const auto& device : devices_) {
@@ -99,6 +109,52 @@ XlaRunner::XlaRunner(const char* library_path, int device)
   if (devices_.empty()) {
     throw Exception("No devices available");
   }
+  // Serialized executables are only valid for the same plugin build and
+  // device, so they are both part of the key.
+  std::hash<std::string> hash;
+  cache_key_ = HashCat(hash(library_path),
+                       hash(devices_.at(device)->ToString()));
+  for (const auto& attribute : pjrt.GetAttributes()) {
+    cache_key_ = HashCat(cache_key_, hash(attribute.key() + "=" +
+                                          attribute.value_as_string()));
+  }
+}
+
+std::unique_ptr<PjrtExecutable> XlaRunner::LoadCachedExecutable(
+    const std::string& filename) {
+  std::ifstream file(filename, std::ios::binary);
+  if (!file) return nullptr;
+  std::string serialized{std::istreambuf_iterator<char>(file),
+                         std::istreambuf_iterator<char>()};
+  try {
+    return pjrt_client_->DeserializeAndLoad(serialized);
+  } catch (const PjrtException& e) {
+    CERR << "Ignoring cached executable " << filename << ": " << e.what();
+    return nullptr;
+  }
+}
+
+void XlaRunner::StoreCachedExecutable(const std::string& filename,
+                                      const PjrtExecutable& executable) {
+  std::string serialized;
+  try {
+    serialized = executable.Serialize();
+  } catch (const PjrtException& e) {
+    CERR << "Unable to serialize executable: " << e.what();
+    return;
+  }
+  // Written aside and renamed, so that concurrent instances never see a
+  // partial file.
+  const std::string tmp_filename = filename + ".tmp";
+  {
+    std::ofstream file(tmp_filename, std::ios::binary);
+    file.write(serialized.data(), serialized.size());
+    if (!file) {
+      CERR << "Unable to write " << tmp_filename;
+      return;
+    }
+  }
+  std::rename(tmp_filename.c_str(), filename.c_str());
 }
 
 void XlaRunner::AddModule(size_t minibatch_size,
@@ -107,8 +163,28 @@ void XlaRunner::AddModule(size_t minibatch_size,
   options.mutable_executable_build_options()->set_num_replicas(1);
   options.mutable_executable_build_options()->set_num_partitions(1);
   options.mutable_executable_build_options()->set_device_ordinal(device_);
-  auto executable = pjrt_client_->CompileHlo(module.OutputAsString(),
-                                             options.OutputAsString());
+  const std::string hlo = module.OutputAsString();
+  const std::string config = options.OutputAsString();
+
+  std::string cache_file;
+  std::unique_ptr<PjrtExecutable> executable;
+  if (!cache_dir_.empty()) {
+    std::hash<std::string> hash;
+    char key[17];
+    std::snprintf(key, sizeof(key), "%016llx",
+                  static_cast<unsigned long long>(
+                      HashCat({cache_key_, hash(hlo), hash(config)})));
+    cache_file = cache_dir_ + "/" + key + ".pjrt";
+    executable = LoadCachedExecutable(cache_file);
+    if (executable) {
+      CERR << "Loaded executable for batch size " << minibatch_size
+           << " from " << cache_file;
+    }
+  }
+  if (!executable) {
+    executable = pjrt_client_->CompileHlo(hlo, config);
+    if (!cache_file.empty()) StoreCachedExecutable(cache_file, *executable);
+  }
   executables_.push_back({minibatch_size, std::move(executable)});
   std::sort(executables_.begin(), executables_.end());
 }
@@ -146,8 +222,9 @@ size_t XlaRunner::GetMaxBatchSize() const { return executables_.back().first; }
 
 std::vector<std::unique_ptr<XlaTensor>> XlaRunner::ExecuteBlocking(
     const std::vector<XlaTensor*>& inputs) {
-  if (inputs.size() != 1) {
-    throw Exception("Only one input is kinda supported.");
+  if (inputs.empty() || inputs.size() != param_idxs_.size()) {
+    throw Exception("Expected " + std::to_string(param_idxs_.size()) +
+                    " inputs, got " + std::to_string(inputs.size()));
   }
   // Find the smallest batch size that fits the input.
   auto iter = std::find_if(
@@ -159,30 +236,36 @@ std::vector<std::unique_ptr<XlaTensor>> XlaRunner::ExecuteBlocking(
                     std::to_string(inputs[0]->shape()[0]));
   }
   const size_t batch_size = iter->first;
-  // Update the shape to match the rounded up batch size. After growing, the
-  // batch size must fit within tensor buffer capacity (it's fine to have
-  // garbage in the tail of that buffer).
-  std::vector<int64_t> new_shape = inputs[0]->shape();
-  new_shape[0] = batch_size;
-  const size_t input_size = std::accumulate(new_shape.begin(), new_shape.end(),
-                                            1, std::multiplies<size_t>()) *
-                            GetTypeSize(inputs[0]->type());
-  if (input_size > inputs[0]->capacity()) {
-    throw Exception("Input buffer too small");
-  }
-  // Transfer the input to the device.
-  auto input_buffer =
-      pjrt_client_
-          ->HostToDevice(
-              {static_cast<const char*>(inputs[0]->data()), input_size},
-              static_cast<PjrtType>(inputs[0]->type()), new_shape,
-              devices_[0].get())
-          ->AwaitAndReleaseBuffer();
-  // Make a copy to support multiple concurrent calls, not sure if it's needed.
+  // Nothing below waits until the outputs are copied back: the execution is
+  // queued behind the input transfers, and the output transfers behind the
+  // execution.
+  std::vector<std::unique_ptr<PjrtHostToDeviceTransfer>> transfers;
+  std::vector<std::unique_ptr<PjrtDeviceBuffer>> owned_inputs;
+  // Make a copy to support multiple concurrent calls.
   auto input_buffers = buffers_;
-  input_buffers[param_idxs_[0]] = input_buffer.get();
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    // Update the shape to match the rounded up batch size. After growing, the
+    // batch size must fit within tensor buffer capacity (it's fine to have
+    // garbage in the tail of that buffer).
+    std::vector<int64_t> new_shape = inputs[i]->shape();
+    new_shape[0] = batch_size;
+    const size_t input_size =
+        std::accumulate(new_shape.begin(), new_shape.end(), 1,
+                        std::multiplies<size_t>()) *
+        GetTypeSize(inputs[i]->type());
+    if (input_size > inputs[i]->capacity()) {
+      throw Exception("Input buffer too small");
+    }
+    transfers.push_back(pjrt_client_->HostToDevice(
+        {static_cast<const char*>(inputs[i]->data()), input_size},
+        static_cast<PjrtType>(inputs[i]->type()), new_shape,
+        devices_.at(device_).get()));
+    owned_inputs.push_back(transfers.back()->ReleaseBuffer());
+    input_buffers[param_idxs_[i]] = owned_inputs.back().get();
+  }
   // Execute!
-  auto outputs = iter->second->ExecuteBlocking(input_buffers);
+  auto execution = iter->second->ExecuteAsync(input_buffers);
+  const auto& outputs = execution.outputs;
 
   // Now we need to transfer the outputs back to the host.
   std::vector<std::unique_ptr<XlaTensor>> result;
@@ -208,6 +291,9 @@ std::vector<std::unique_ptr<XlaTensor>> XlaRunner::ExecuteBlocking(
         static_cast<pblczero::XlaShapeProto::Type>(output->GetType()),
         std::move(output_buffers[i])));
   }
+  // The outputs are ready, so is the execution, but the inputs must not be
+  // released before the event says so.
+  execution.done->Await();
   return result;
 }
 
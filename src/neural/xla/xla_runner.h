@@ -99,13 +99,18 @@ class XlaTensorOwned : public XlaTensor {
 // batch size.
 class XlaRunner {
  public:
-  // The library_path is the path to the PJRT library, and device indx.
-  XlaRunner(const char* library_path, int device);
-  // Compiles and adds a module for the given batch size.
+  // The library_path is the path to the PJRT library, and device indx. If
+  // cache_dir is not empty, compiled executables are stored there and loaded
+  // back instead of compiling the same module again.
+  XlaRunner(const char* library_path, int device,
+            const std::string& cache_dir = "");
+  // Compiles (or loads from the cache) and adds a module for the given batch
+  // size.
   void AddModule(size_t minibatch_size, const pblczero::HloModuleProto& module);
   // Transfers inputs to the device and execute the executable corresponding to
-  // the batch size. Only non-frozen inputs are passed as arguments.
-  // Currnetly only single input is supported (just because we don't need more).
+  // the batch size. Only non-frozen inputs are passed as arguments, in the
+  // order of their parameter indices. The transfers and the execution are
+  // queued without waiting, the call only blocks on the outputs.
   std::vector<std::unique_ptr<XlaTensor>> ExecuteBlocking(
       const std::vector<XlaTensor*>& inputs);
   // Inputs that are shared between all calls (i.e. network weights passed as
@@ -117,6 +122,12 @@ class XlaRunner {
   size_t GetMaxBatchSize() const;
 
  private:
+  // Returns nullptr if there is no usable executable in the file.
+  std::unique_ptr<PjrtExecutable> LoadCachedExecutable(
+      const std::string& filename);
+  void StoreCachedExecutable(const std::string& filename,
+                             const PjrtExecutable& executable);
+
   std::unique_ptr<PjrtClient> pjrt_client_;
   std::vector<std::unique_ptr<PjrtDevice>> devices_;
   // Compiled executables per batch size.
@@ -129,6 +140,9 @@ class XlaRunner {
   std::vector<PjrtDeviceBuffer*> buffers_;
   std::vector<size_t> param_idxs_;
   int device_;
+  std::string cache_dir_;
+  // Hash of the plugin and the device, part of all cache keys.
+  uint64_t cache_key_ = 0;
 };
 
 }  // namespace lczero
\ No newline at end of file
@@ -0,0 +1,180 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "chess/callbacks.h"
+#include "mcts/node.h"
+#include "mcts/params.h"
+#include "mcts/search.h"
+#include "mcts/stoppers/stoppers.h"
+#include "neural/cache.h"
+#include "python/weights.h"
+#include "utils/optionsparser.h"
+#include "utils/threadpool.h"
+
+namespace lczero {
+namespace python {
+
+namespace search_options {
+const OptionId kThreadsId{"threads", "Threads",
+                          "Number of search threads of each position."};
+const OptionId kConcurrencyId{"concurrency", "Concurrency",
+                              "Number of positions searched at the same time."};
+const OptionId kNNCacheSizeId{"nncache", "NNCacheSize",
+                              "Number of positions to store in the cache "
+                              "shared by the searches."};
+}  // namespace search_options
+
+class SearchResult {
+ public:
+  // Exported.
+  int nodes() const { return nodes_; }
+  const std::string& best_move() const { return best_move_; }
+  // Root moves, and their visits, Q values from the point of view of the side
+  // to move and priors, in the same order.
+  std::vector<std::string> moves() const { return moves_; }
+  std::vector<int> n() const { return n_; }
+  std::vector<float> q() const { return q_; }
+  std::vector<float> p() const { return p_; }
+
+  // Not exposed.
+  SearchResult(const NodeTree& tree, int nodes, Move best_move)
+      : nodes_(nodes) {
+    const bool is_black = tree.IsBlackToMove();
+    best_move_ = best_move.as_string();
+    for (const auto& edge : tree.GetCurrentHead()->Edges()) {
+      moves_.push_back(edge.GetMove(is_black).as_string());
+      n_.push_back(edge.GetN());
+      q_.push_back(edge.GetQ(0.0f, 0.0f));
+      p_.push_back(edge.GetP());
+    }
+  }
+
+ private:
+  int nodes_;
+  std::string best_move_;
+  std::vector<std::string> moves_;
+  std::vector<int> n_;
+  std::vector<float> q_;
+  std::vector<float> p_;
+};
+
+// Runs MCTS searches on a backend, several positions at a time, in threads of
+// its own: Python threads keep running meanwhile.
+class Searcher {
+ public:
+  // Exported.
+  // @options are command line flags of lc0 for the search parameters, plus
+  // --threads, --concurrency and --nncache.
+  Searcher(const Backend& backend, int visits,
+           const std::optional<std::string>& options)
+      : network_(backend.network()), visits_(visits) {
+    if (visits_ <= 0) throw Exception("Visits must be positive.");
+    parser_.Add<IntOption>(search_options::kThreadsId, 1, 128) = 1;
+    parser_.Add<IntOption>(search_options::kConcurrencyId, 1, 1024) = 4;
+    parser_.Add<IntOption>(search_options::kNNCacheSizeId, 0, 999999999) =
+        200000;
+    SearchParams::Populate(&parser_);
+    std::vector<std::string> flags;
+    std::istringstream stream(options.value_or(""));
+    for (std::string flag; stream >> flag;) flags.push_back(flag);
+    if (!parser_.ProcessFlags(flags)) {
+      throw Exception("Invalid search options: " + options.value_or(""));
+    }
+    const auto& dict = parser_.GetOptionsDict();
+    threads_ = dict.Get<int>(search_options::kThreadsId);
+    concurrency_ = dict.Get<int>(search_options::kConcurrencyId);
+    cache_.SetCapacity(dict.Get<int>(search_options::kNNCacheSizeId));
+  }
+
+  // Searches each of @games for the visits given to the constructor.
+  std::vector<std::unique_ptr<SearchResult>> search(
+      const std::vector<GameState*>& games) {
+    std::vector<std::unique_ptr<SearchResult>> results(games.size());
+    std::vector<std::string> errors(games.size());
+    std::atomic<size_t> next{0};
+    auto searcher = [&]() {
+      // Search threads are kept between positions.
+      ThreadPool thread_pool;
+      for (size_t i; (i = next.fetch_add(1)) < games.size();) {
+        try {
+          results[i] = Search(*games[i], &thread_pool);
+        } catch (const Exception& ex) {
+          errors[i] = ex.what();
+        }
+      }
+    };
+    std::vector<std::thread> threads;
+    const size_t concurrency =
+        std::min(games.size(), static_cast<size_t>(concurrency_));
+    for (size_t i = 1; i < concurrency; ++i) threads.emplace_back(searcher);
+    searcher();
+    for (auto& thread : threads) thread.join();
+    for (const auto& error : errors) {
+      if (!error.empty()) throw Exception(error);
+    }
+    return results;
+  }
+
+ private:
+  std::unique_ptr<SearchResult> Search(const GameState& game,
+                                       ThreadPool* thread_pool) {
+    NodeTree tree;
+    tree.ResetToPosition(game.starting_fen(), game.history_moves());
+    Move best_move;
+    auto responder = std::make_unique<CallbackUciResponder>(
+        [&](const BestMoveInfo& move) { best_move = move.bestmove; },
+        [](const std::vector<ThinkingInfo>&) {});
+    ::lczero::Search search(tree, network_, std::move(responder), MoveList(),
+                            std::chrono::steady_clock::now(),
+                            std::make_unique<VisitsStopper>(visits_, false),
+                            false, false, parser_.GetOptionsDict(), &cache_,
+                            nullptr, thread_pool);
+    search.StartThreads(threads_);
+    search.Wait();
+    return std::make_unique<SearchResult>(tree, search.GetTotalPlayouts(),
+                                          best_move);
+  }
+
+  Network* const network_;
+  const int visits_;
+  OptionsParser parser_;
+  NNCache cache_;
+  int threads_ = 1;
+  int concurrency_ = 1;
+};
+
+}  // namespace python
+}  // namespace lczero
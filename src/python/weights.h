@@ -27,6 +27,7 @@
 
 #pragma once
 
+#include <future>
 #include <string>
 
 #include "neural/encoder.h"
@@ -34,6 +35,7 @@
 #include "neural/loader.h"
 #include "utils/fastmath.h"
 #include "utils/optionsparser.h"
+#include "utils/threadpool.h"
 
 namespace lczero {
 namespace python {
@@ -84,6 +86,13 @@ class Weights {
   const WeightsFile weights_;
 };
 
+// Contiguous array of the caller, e.g. a NumPy array, used in place.
+template <typename T>
+struct ArrayView {
+  T* data;
+  size_t size;
+};
+
 inline std::vector<std::string> GetAvailableBackends() {
   return NetworkFactory::Get()->GetBackendsList();
 }
@@ -176,6 +185,49 @@ class Output {
   float m_;
 };
 
+// Outputs of a batch evaluated in the background by Backend::evaluate_async().
+class EvaluationFuture {
+ public:
+  // Not exported.
+  EvaluationFuture(std::shared_ptr<Network> network,
+                   std::shared_ptr<NetworkComputation> computation,
+                   std::future<void> done)
+      : network_(std::move(network)),
+        computation_(std::move(computation)),
+        done_(std::move(done)) {}
+
+  // Exported methods.
+  bool done() const {
+    return !done_.valid() || done_.wait_for(std::chrono::seconds(0)) ==
+                                 std::future_status::ready;
+  }
+
+  // Waits for the evaluation to finish. Can only be called once.
+  std::vector<std::unique_ptr<Output>> result() {
+    if (!done_.valid()) throw Exception("Result has already been retrieved.");
+    try {
+      done_.get();
+    } catch (const std::exception& e) {
+      throw Exception(std::string("Evaluation failed: ") + e.what());
+    }
+    std::vector<std::unique_ptr<Output>> result;
+    for (int i = 0; i < computation_->GetBatchSize(); ++i) {
+      result.push_back(std::make_unique<Output>(*computation_, i));
+    }
+    computation_.reset();
+    return result;
+  }
+
+ private:
+  // Keeps the network alive for the computation, even if the Backend object
+  // goes away first.
+  std::shared_ptr<Network> network_;
+  // Shared with the running task, so that dropping an unfinished future is
+  // safe.
+  std::shared_ptr<NetworkComputation> computation_;
+  std::future<void> done_;
+};
+
 class BackendCapabilities {
  public:
   // Exported.
@@ -212,14 +264,13 @@ class Backend {
     return BackendCapabilities(network_->GetCapabilities());
   }
 
+  // Not exported.
+  Network* network() const { return network_.get(); }
+
   std::vector<std::unique_ptr<Output>> evaluate(
       const std::vector<Input*>& inputs) const {
     if (inputs.empty()) return {};
-    auto computation = network_->NewComputation();
-    for (const auto* input : inputs) {
-      InputPlanes input_copy = input->GetPlanes();
-      computation->AddInput(std::move(input_copy));
-    }
+    auto computation = NewComputation(inputs);
     computation->ComputeBlocking();
     std::vector<std::unique_ptr<Output>> result;
     for (int i = 0; i < computation->GetBatchSize(); ++i) {
@@ -228,19 +279,92 @@ class Backend {
     return result;
   }
 
+  // Same as evaluate(), but returns right away while the batch is computed on
+  // a thread of the backend's pool, so that the caller can prepare the next
+  // batch meanwhile. Any number of batches may be in flight.
+  std::unique_ptr<EvaluationFuture> evaluate_async(
+      const std::vector<Input*>& inputs) {
+    std::shared_ptr<NetworkComputation> computation = NewComputation(inputs);
+    std::future<void> done;
+    if (inputs.empty()) {
+      std::promise<void> promise;
+      promise.set_value();
+      done = promise.get_future();
+    } else {
+      done = thread_pool_.Run(
+          [computation]() { computation->ComputeBlocking(); });
+    }
+    return std::make_unique<EvaluationFuture>(network_, std::move(computation),
+                                              std::move(done));
+  }
+
+  // Evaluates a batch of N samples given as arrays: input plane masks and
+  // values of shape (N, 112), without the Input objects of evaluate(). Writes
+  // the results into arrays of shape (N) for q, d and m, and (N, 1858) for
+  // the raw policy.
+  void evaluate_into(ArrayView<const uint64_t> masks,
+                     ArrayView<const float> values, ArrayView<float> q,
+                     ArrayView<float> d, ArrayView<float> m,
+                     ArrayView<float> policy) const {
+    const size_t batch_size = masks.size / kInputPlanes;
+    if (masks.size != batch_size * kInputPlanes ||
+        values.size != masks.size) {
+      throw Exception("Masks and values must both have shape (N, " +
+                      std::to_string(kInputPlanes) + ").");
+    }
+    if (q.size != batch_size || d.size != batch_size || m.size != batch_size) {
+      throw Exception("Q, D and M must have shape (N).");
+    }
+    if (policy.size != batch_size * 1858) {
+      throw Exception("Policy must have shape (N, 1858).");
+    }
+    if (batch_size == 0) return;
+    auto computation = network_->NewComputation();
+    for (size_t i = 0; i < batch_size; ++i) {
+      InputPlanes planes(kInputPlanes);
+      for (int j = 0; j < kInputPlanes; ++j) {
+        planes[j].mask = masks.data[i * kInputPlanes + j];
+        planes[j].value = values.data[i * kInputPlanes + j];
+      }
+      computation->AddInput(std::move(planes));
+    }
+    computation->ComputeBlocking();
+    for (size_t i = 0; i < batch_size; ++i) {
+      q.data[i] = computation->GetQVal(i);
+      d.data[i] = computation->GetDVal(i);
+      m.data[i] = computation->GetMVal(i);
+      float* sample_policy = policy.data + i * 1858;
+      for (int j = 0; j < 1858; ++j) {
+        sample_policy[j] = computation->GetPVal(i, j);
+      }
+    }
+  }
+
  private:
-  std::unique_ptr<::lczero::Network> network_;
+  std::unique_ptr<NetworkComputation> NewComputation(
+      const std::vector<Input*>& inputs) const {
+    auto computation = network_->NewComputation();
+    for (const auto* input : inputs) {
+      InputPlanes input_copy = input->GetPlanes();
+      computation->AddInput(std::move(input_copy));
+    }
+    return computation;
+  }
+
+  std::shared_ptr<::lczero::Network> network_;
+  // Destroyed first, waiting for the computations still in flight.
+  ThreadPool thread_pool_;
 };
 
 class GameState {
  public:
   GameState(const std::optional<std::string> startpos,
-            const std::vector<std::string>& moves) {
+            const std::vector<std::string>& moves)
+      : starting_fen_(startpos.value_or(ChessBoard::kStartposFen)) {
     ChessBoard starting_board;
     int no_capture_ply;
     int full_moves;
-    starting_board.SetFromFen(startpos.value_or(ChessBoard::kStartposFen),
-                              &no_capture_ply, &full_moves);
+    starting_board.SetFromFen(starting_fen_, &no_capture_ply, &full_moves);
 
     history_.Reset(starting_board, no_capture_ply,
                    full_moves * 2 - (starting_board.flipped() ? 1 : 2));
@@ -249,6 +373,7 @@ class GameState {
       Move move(m, history_.IsBlackToMove());
       move = history_.Last().GetBoard().GetModernMove(move);
       history_.Append(move);
+      moves_.emplace_back(m);
     }
   }
 
@@ -287,7 +412,14 @@ class GameState {
         .DebugString();
   }
 
+  // Not exported.
+  const std::string& starting_fen() const { return starting_fen_; }
+  // The moves from the starting position, as NodeTree takes them.
+  const std::vector<Move>& history_moves() const { return moves_; }
+
  private:
+  const std::string starting_fen_;
+  std::vector<Move> moves_;
   PositionHistory history_;
 };
 
@@ -0,0 +1,245 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "rescorer/policy_index.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include "utils/exception.h"
+
+namespace lczero {
+namespace {
+constexpr char kMagic[8] = {'L', 'C', '0', 'P', 'S', 'U', 'B', '1'};
+constexpr size_t kHeaderSize = sizeof(kMagic) + 2 * sizeof(uint64_t);
+constexpr size_t kEntrySize = 2 * sizeof(uint64_t);
+constexpr size_t kPolicyEntrySize = sizeof(uint16_t) + sizeof(float);
+
+template <typename T>
+T ReadAt(const char* data) {
+  T value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+template <typename T>
+void Append(std::string* out, T value) {
+  out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+}  // namespace
+
+PolicySubIndex::~PolicySubIndex() { Close(); }
+
+void PolicySubIndex::Load(const std::string& path) {
+  Close();
+#ifndef _WIN32
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    throw Exception("Cannot read policy substitution index " + path);
+  }
+  void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    throw Exception("Cannot map policy substitution index " + path);
+  }
+  mapped_ = true;
+  Open(static_cast<const char*>(data), st.st_size);
+#else
+  std::ifstream in(path, std::ios::binary);
+  if (!in) return;
+  buffer_.assign(std::istreambuf_iterator<char>(in),
+                 std::istreambuf_iterator<char>());
+  Open(buffer_.data(), buffer_.size());
+#endif
+}
+
+void PolicySubIndex::Open(const char* data, size_t size) {
+  data_ = data;
+  size_ = size;
+  if (size < kHeaderSize || std::memcmp(data, kMagic, sizeof(kMagic)) != 0) {
+    Close();
+    throw Exception("Not a policy substitution index.");
+  }
+  const uint64_t count = ReadAt<uint64_t>(data + sizeof(kMagic));
+  const uint64_t names_size =
+      ReadAt<uint64_t>(data + sizeof(kMagic) + sizeof(uint64_t));
+  if (names_size > size - kHeaderSize ||
+      count > (size - kHeaderSize - names_size) / kEntrySize) {
+    Close();
+    throw Exception("Corrupt policy substitution index.");
+  }
+  const char* names = data + kHeaderSize;
+  for (size_t start = 0; start < names_size;) {
+    const char* end = static_cast<const char*>(
+        std::memchr(names + start, '\n', names_size - start));
+    if (!end) break;
+    files_.emplace(names + start, end);
+    start = end - names + 1;
+  }
+  entries_ = names + names_size;
+  entry_count_ = count;
+}
+
+void PolicySubIndex::Close() {
+#ifndef _WIN32
+  if (mapped_) munmap(const_cast<char*>(data_), size_);
+#endif
+  mapped_ = false;
+  data_ = nullptr;
+  size_ = 0;
+  buffer_.clear();
+  entries_ = nullptr;
+  entry_count_ = 0;
+  files_.clear();
+}
+
+uint64_t PolicySubIndex::EntryKey(size_t i) const {
+  return ReadAt<uint64_t>(entries_ + i * kEntrySize);
+}
+
+PolicySubIndex::Policy PolicySubIndex::ReadPolicy(uint64_t offset) const {
+  if (offset + sizeof(uint16_t) > size_) {
+    throw Exception("Corrupt policy substitution index.");
+  }
+  const uint16_t count = ReadAt<uint16_t>(data_ + offset);
+  const char* p = data_ + offset + sizeof(uint16_t);
+  if (offset + sizeof(uint16_t) + count * kPolicyEntrySize > size_) {
+    throw Exception("Corrupt policy substitution index.");
+  }
+  Policy policy(count);
+  for (auto& entry : policy) {
+    entry.first = ReadAt<uint16_t>(p);
+    entry.second = ReadAt<float>(p + sizeof(uint16_t));
+    p += kPolicyEntrySize;
+  }
+  return policy;
+}
+
+void PolicySubIndex::Add(uint64_t key, const float* policy) {
+  auto& entry = added_[key];
+  entry.clear();
+  for (uint16_t i = 0; i < 1858; i++) {
+    if (policy[i] >= 0.0f) entry.emplace_back(i, policy[i]);
+  }
+}
+
+bool PolicySubIndex::Lookup(uint64_t key, float* policy) const {
+  size_t lo = 0;
+  size_t hi = entry_count_;
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (EntryKey(mid) < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == entry_count_ || EntryKey(lo) != key) return false;
+  std::fill(policy, policy + 1858, -1.0f);
+  const uint64_t offset =
+      ReadAt<uint64_t>(entries_ + lo * kEntrySize + sizeof(uint64_t));
+  for (const auto& entry : ReadPolicy(offset)) {
+    if (entry.first < 1858) policy[entry.first] = entry.second;
+  }
+  return true;
+}
+
+void PolicySubIndex::Commit(const std::string& path) {
+  std::string names;
+  for (const auto& name : files_) names += name + '\n';
+
+  // Merges the sorted existing entries with the added ones, which win.
+  std::vector<std::pair<uint64_t, uint64_t>> entries;
+  std::string policies;
+  auto append_policy = [&](uint64_t key, const Policy& policy) {
+    entries.emplace_back(key, policies.size());
+    Append<uint16_t>(&policies, policy.size());
+    for (const auto& entry : policy) {
+      Append<uint16_t>(&policies, entry.first);
+      Append<float>(&policies, entry.second);
+    }
+  };
+  auto added = added_.begin();
+  for (size_t i = 0; i < entry_count_; i++) {
+    const uint64_t key = EntryKey(i);
+    for (; added != added_.end() && added->first < key; ++added) {
+      append_policy(added->first, added->second);
+    }
+    if (added != added_.end() && added->first == key) continue;
+    append_policy(key, ReadPolicy(ReadAt<uint64_t>(
+                           entries_ + i * kEntrySize + sizeof(uint64_t))));
+  }
+  for (; added != added_.end(); ++added) {
+    append_policy(added->first, added->second);
+  }
+
+  const uint64_t base =
+      kHeaderSize + names.size() + entries.size() * kEntrySize;
+  std::string out(kMagic, sizeof(kMagic));
+  Append<uint64_t>(&out, entries.size());
+  Append<uint64_t>(&out, names.size());
+  out += names;
+  for (const auto& entry : entries) {
+    Append<uint64_t>(&out, entry.first);
+    Append<uint64_t>(&out, base + entry.second);
+  }
+  out += policies;
+  added_.clear();
+
+  Close();
+  if (path.empty()) {
+    buffer_ = std::move(out);
+    Open(buffer_.data(), buffer_.size());
+    return;
+  }
+  const std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+    file.write(out.data(), out.size());
+    if (!file) throw Exception("Cannot write " + tmp_path);
+  }
+  std::remove(path.c_str());
+  if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    throw Exception("Cannot rename " + tmp_path + " to " + path);
+  }
+  Load(path);
+}
+
+}  // namespace lczero
@@ -0,0 +1,100 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace lczero {
+
+// Policy substitutions keyed by position key, in a form that is written to
+// disk once and memory mapped on later runs. The key of a position is the
+// HashCat() of the game root and the NN move indices leading to it.
+//
+// File layout (little-endian):
+//   char[8]  "LC0PSUB1"
+//   uint64   number of entries
+//   uint64   size of the file list
+//   char[]   names of the indexed files, each followed by '\n'
+//   entries  {uint64 key, uint64 offset}, sorted by key
+//   policies at the entry offsets: uint16 count, then count times
+//            {uint16 nn index, float probability}
+class PolicySubIndex {
+ public:
+  PolicySubIndex() = default;
+  PolicySubIndex(const PolicySubIndex&) = delete;
+  PolicySubIndex& operator=(const PolicySubIndex&) = delete;
+  ~PolicySubIndex();
+
+  // Opens the index at @path. A missing file is an empty index.
+  void Load(const std::string& path);
+
+  // Whether @name is already in the index.
+  bool HasFile(const std::string& name) const { return files_.count(name); }
+  // Records that @name was indexed.
+  void AddFile(const std::string& name) { files_.insert(name); }
+
+  // Sets the policy of @key, replacing the one already there. Negative
+  // probabilities mark illegal moves and aren't stored.
+  void Add(uint64_t key, const float* policy);
+
+  // Merges the added policies into the index and writes it to @path, or
+  // only keeps it in memory if @path is empty.
+  void Commit(const std::string& path);
+
+  // Writes the 1858 probabilities of @key into @policy, -1 for the moves
+  // without one. Returns false if there is no substitution for @key.
+  bool Lookup(uint64_t key, float* policy) const;
+
+  size_t size() const { return entry_count_; }
+  bool empty() const { return entry_count_ == 0; }
+
+ private:
+  using Policy = std::vector<std::pair<uint16_t, float>>;
+
+  void Open(const char* data, size_t size);
+  void Close();
+  Policy ReadPolicy(uint64_t offset) const;
+  uint64_t EntryKey(size_t i) const;
+
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+  bool mapped_ = false;
+  // Holds the index when it isn't mapped.
+  std::string buffer_;
+  const char* entries_ = nullptr;
+  size_t entry_count_ = 0;
+  std::set<std::string> files_;
+  std::map<uint64_t, Policy> added_;
+};
+
+}  // namespace lczero
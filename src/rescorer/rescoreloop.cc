@@ -27,13 +27,30 @@
 
 #include "rescorer/rescoreloop.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
 #include <optional>
 #include <sstream>
+#include <unordered_set>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
 
 #include "gtb-probe.h"
 #include "neural/decoder.h"
+#include "neural/encoder.h"
+#include "neural/factory.h"
+#include "rescorer/policy_index.h"
+#include "syzygy/probe_cache.h"
 #include "syzygy/syzygy.h"
 #include "trainingdata/reader.h"
+#include "utils/checkpoint.h"
 #include "utils/filesystem.h"
 #include "utils/optionsparser.h"
 
@@ -49,6 +66,11 @@ const OptionId kInputDirId{
 const OptionId kPolicySubsDirId{"policy-substitutions", "",
                                 "Directory with gzipped files are to use to "
                                 "replace policy for some of the data."};
+const OptionId kPolicySubsIndexId{
+    "policy-substitutions-index", "",
+    "Index file of the policy substitutions. Files of the policy substitutions "
+    "directory that aren't in it yet are added, so that every game is only "
+    "decoded once."};
 const OptionId kOutputDirId{"output", "", "Directory to write rescored files."};
 const OptionId kThreadsId{"threads", "",
                           "Number of concurrent threads to rescore with.", 't'};
@@ -78,6 +100,10 @@ const OptionId kDeblunderQBlunderWidth{
 const OptionId kNnuePlainFileId{"nnue-plain-file", "",
                                 "Append SF plain format training data to this "
                                 "file. Will be generated if not there."};
+const OptionId kNnueBinFileId{
+    "nnue-bin-file", "",
+    "Append SF .bin format (40 byte PackedSfenValue) training data to this "
+    "file. Much faster to write and read than the plain format."};
 const OptionId kNnueBestScoreId{"nnue-best-score", "",
                                 "For the SF training data use the score of the "
                                 "best move instead of the played one."};
@@ -85,18 +111,33 @@ const OptionId kNnueBestMoveId{
     "nnue-best-move", "",
     "For the SF training data record the best move instead of the played one. "
     "If set to true the generated files do not compress well."};
+const OptionId kSparseOutputId{
+    "sparse-output", "",
+    "Write the rescored files in the V7 format, with the policy of legal moves "
+    "only."};
+const OptionId kRelabelDirId{
+    "relabel-output", "",
+    "Directory to write copies of the rescored files to, with the policy and "
+    "value targets replaced by the evaluation of the network given by "
+    "--weights. Positions of many files are evaluated in large batches."};
+const OptionId kRelabelBatchId{
+    "relabel-batch-size", "",
+    "Number of positions evaluated in one network batch when relabeling."};
+const OptionId kStreamId{
+    "stream", "",
+    "Read games from stdin and write the rescored games to stdout, instead of "
+    "the input and output directories. Each game is a 32-bit little-endian "
+    "byte count followed by the uncompressed training data of the game."};
 const OptionId kDeleteFilesId{"delete-files", "",
                               "Delete the input files after processing."};
+const OptionId kCheckpointId{
+    "checkpoint", "",
+    "File listing the input files processed so far, one per line. The files "
+    "listed are skipped, and each file is added once its output is written, "
+    "so that a rescorer restarted after being killed carries on where it "
+    "stopped."};
 
-class PolicySubNode {
- public:
-  PolicySubNode() {
-    for (int i = 0; i < 1858; i++) children[i] = nullptr;
-  }
-  bool active = false;
-  float policy[1858];
-  PolicySubNode* children[1858];
-};
+std::unique_ptr<CheckpointJournal> checkpoint;
 
 std::atomic<int> games(0);
 std::atomic<int> positions(0);
@@ -112,12 +153,155 @@ std::atomic<int> policy_nobump_total_hist[11];
 std::atomic<int> policy_bump_total_hist[11];
 std::atomic<int> policy_dtm_bump(0);
 std::atomic<int> gaviota_dtm_rescores(0);
-std::map<uint64_t, PolicySubNode> policy_subs;
+PolicySubIndex policy_subs;
 bool gaviotaEnabled = false;
+// Results of Gaviota probes, as positions recur across games.
+std::unique_ptr<ProbeCache> gaviota_cache;
+// Stockfish .bin output file, if any.
+std::string nnue_bin_file;
 bool deblunderEnabled = false;
 float deblunderQBlunderThreshold = 2.0f;
 float deblunderQBlunderWidth = 0.0f;
 
+// Evaluates the positions of many games with a network, in large batches, and
+// writes copies of the games with the network output as policy and value
+// targets.
+class Relabeler {
+ public:
+  Relabeler(std::unique_ptr<Network> network, std::string output_dir,
+            int batch_size, bool sparse)
+      : network_(std::move(network)),
+        input_format_(network_->GetCapabilities().input_format),
+        output_dir_(output_dir),
+        batch_size_(batch_size),
+        sparse_(sparse) {}
+
+  // Queues the game in @chunks, @moves being the moves played between them.
+  // The queued games are evaluated on the calling thread once they make up a
+  // full batch.
+  void Add(const std::string& file, std::vector<V6TrainingData> chunks,
+           const MoveList& moves) {
+    Game game;
+    game.file = file;
+    game.name = file.substr(file.find_last_of("/\\") + 1);
+    PositionHistory history;
+    ChessBoard board;
+    int rule50ply;
+    int gameply;
+    PopulateBoard(static_cast<pblczero::NetworkFormat::InputFormat>(
+                      chunks[0].input_format),
+                  PlanesFromTrainingData(chunks[0]), &board, &rule50ply,
+                  &gameply);
+    history.Reset(board, rule50ply, gameply);
+    for (size_t i = 0; i < chunks.size(); i++) {
+      if (i > 0) history.Append(moves[i - 1]);
+      Sample sample;
+      sample.input = EncodePositionForNN(input_format_, history, 8,
+                                         FillEmptyHistory::FEN_ONLY,
+                                         &sample.transform);
+      sample.legal_moves = history.Last().GetBoard().GenerateLegalMoves();
+      game.samples.push_back(std::move(sample));
+    }
+    game.chunks = std::move(chunks);
+
+    std::vector<Game> batch;
+    {
+      Mutex::Lock lock(mutex_);
+      pending_positions_ += game.chunks.size();
+      pending_.push_back(std::move(game));
+      if (pending_positions_ < batch_size_) return;
+      batch.swap(pending_);
+      pending_positions_ = 0;
+    }
+    Evaluate(&batch);
+  }
+
+  // Evaluates and writes the games still queued.
+  void Flush() {
+    std::vector<Game> batch;
+    {
+      Mutex::Lock lock(mutex_);
+      batch.swap(pending_);
+      pending_positions_ = 0;
+    }
+    Evaluate(&batch);
+  }
+
+ private:
+  struct Sample {
+    InputPlanes input;
+    int transform;
+    FixedMoveList legal_moves;
+  };
+  struct Game {
+    std::string file;
+    std::string name;
+    std::vector<V6TrainingData> chunks;
+    std::vector<Sample> samples;
+  };
+
+  void Evaluate(std::vector<Game>* games) {
+    std::vector<std::pair<V6TrainingData*, Sample*>> positions;
+    for (auto& game : *games) {
+      for (size_t i = 0; i < game.chunks.size(); i++) {
+        positions.emplace_back(&game.chunks[i], &game.samples[i]);
+      }
+    }
+    for (size_t start = 0; start < positions.size(); start += batch_size_) {
+      const size_t end = std::min(positions.size(), start + batch_size_);
+      auto computation = network_->NewComputation();
+      for (size_t i = start; i < end; i++) {
+        computation->AddInput(std::move(positions[i].second->input));
+      }
+      computation->ComputeBlocking();
+      for (size_t i = start; i < end; i++) {
+        auto* chunk = positions[i].first;
+        const auto& sample = *positions[i].second;
+        const int idx = i - start;
+        // Softmax of the policy over the legal moves.
+        std::vector<float> policy;
+        float max_p = -std::numeric_limits<float>::infinity();
+        for (auto move : sample.legal_moves) {
+          policy.push_back(
+              computation->GetPVal(idx, move.as_nn_index(sample.transform)));
+          max_p = std::max(max_p, policy.back());
+        }
+        float total = 0.0f;
+        for (auto& p : policy) total += (p = std::exp(p - max_p));
+        std::fill(std::begin(chunk->probabilities),
+                  std::end(chunk->probabilities), -1.0f);
+        for (size_t j = 0; j < policy.size(); j++) {
+          const int chunk_idx =
+              sample.legal_moves[j].as_nn_index(chunk->invariance_info & 7);
+          chunk->probabilities[chunk_idx] = policy[j] / total;
+        }
+        chunk->root_q = chunk->best_q = computation->GetQVal(idx);
+        chunk->root_d = chunk->best_d = computation->GetDVal(idx);
+        chunk->root_m = chunk->best_m = computation->GetMVal(idx);
+      }
+    }
+    for (const auto& game : *games) {
+      TrainingDataWriter writer(output_dir_ + "/" + game.name, sparse_);
+      for (const auto& chunk : game.chunks) {
+        // Don't save chunks that just provide move history.
+        if ((chunk.invariance_info & 64) == 0) writer.WriteChunk(chunk);
+      }
+      writer.Finalize();
+      if (checkpoint) checkpoint->Append(game.file);
+    }
+  }
+
+  const std::unique_ptr<Network> network_;
+  const pblczero::NetworkFormat::InputFormat input_format_;
+  const std::string output_dir_;
+  const size_t batch_size_;
+  const bool sparse_;
+  Mutex mutex_;
+  std::vector<Game> pending_ GUARDED_BY(mutex_);
+  size_t pending_positions_ GUARDED_BY(mutex_) = 0;
+};
+std::unique_ptr<Relabeler> relabeler;
+
 void DataAssert(bool check_result) {
   if (!check_result) throw Exception("Range Violation");
 }
@@ -249,6 +433,15 @@ void Validate(const std::vector<V6TrainingData>& fileContents,
 
 void gaviota_tb_probe_hard(const Position& pos, unsigned int& info,
                            unsigned int& dtm) {
+  // Gaviota results are for absolute colors, the board hash isn't.
+  const uint64_t key = HashCat(pos.GetBoard().Hash(), pos.IsBlackToMove());
+  int cached_dtm;
+  int cached_info;
+  if (gaviota_cache->Lookup(key, &cached_dtm, &cached_info)) {
+    info = cached_info;
+    dtm = cached_dtm;
+    return;
+  }
   unsigned int wsq[17];
   unsigned int bsq[17];
   unsigned char wpc[17];
@@ -335,6 +528,7 @@ void gaviota_tb_probe_hard(const Position& pos, unsigned int& info,
   bpc[idx] = tb_NOPIECE;
 
   tb_probe_hard(stm, epsq, tb_NOCASTLE, wsq, bsq, wpc, bpc, &info, &dtm);
+  gaviota_cache->Store(key, dtm, info);
 }
 
 void ChangeInputFormat(int newInputFormat, V6TrainingData* data,
@@ -453,25 +647,130 @@ std::string AsNnueString(const Position& p, Move m, float q, int result) {
   return out.str();
 }
 
+// Appends @p in the Stockfish .bin training data format: a 40 byte
+// PackedSfenValue with the Huffman coded position, score, move, ply and result.
+void AppendNnueBin(const Position& p, Move m, float q, int result,
+                   std::string* out) {
+  uint8_t data[40] = {};
+  int cursor = 0;
+  auto write_bits = [&](int value, int bits) {
+    for (int i = 0; i < bits; i++, cursor++) {
+      if (value & (1 << i)) data[cursor / 8] |= 1 << (cursor % 8);
+    }
+  };
+  const ChessBoard& board = p.GetWhiteBoard();
+  write_bits(p.IsBlackToMove(), 1);
+  write_bits((*(board.kings() & board.ours()).begin()).as_int(), 6);
+  write_bits((*(board.kings() & board.theirs()).begin()).as_int(), 6);
+  for (int row = 7; row >= 0; row--) {
+    for (int col = 0; col < 8; col++) {
+      const BoardSquare sq(row, col);
+      if (board.kings().get(sq)) continue;
+      if (!board.ours().get(sq) && !board.theirs().get(sq)) {
+        write_bits(0, 1);
+        continue;
+      }
+      if (board.pawns().get(sq)) {
+        write_bits(0b0001, 4);
+      } else if (board.knights().get(sq)) {
+        write_bits(0b0011, 4);
+      } else if (board.bishops().get(sq)) {
+        write_bits(0b0101, 4);
+      } else if (board.rooks().get(sq)) {
+        write_bits(0b0111, 4);
+      } else {
+        write_bits(0b1001, 4);
+      }
+      write_bits(board.theirs().get(sq), 1);
+    }
+  }
+  const auto& castlings = board.castlings();
+  write_bits(castlings.we_can_00(), 1);
+  write_bits(castlings.we_can_000(), 1);
+  write_bits(castlings.they_can_00(), 1);
+  write_bits(castlings.they_can_000(), 1);
+  if (board.en_passant().empty()) {
+    write_bits(0, 1);
+  } else {
+    write_bits(1, 1);
+    const int col = (*board.en_passant().begin()).col();
+    write_bits(BoardSquare(p.IsBlackToMove() ? 2 : 5, col).as_int(), 6);
+  }
+  const int rule50 = p.GetRule50Ply();
+  const int fullmove = 1 + (p.GetGamePly() - p.IsBlackToMove()) / 2;
+  write_bits(rule50, 6);
+  write_bits(fullmove, 8);
+  write_bits(fullmove >> 8, 8);
+  write_bits(rule50 >> 6, 1);
+
+  // The move as Stockfish encodes it, castling as king takes rook.
+  const ChessBoard& us = p.GetBoard();
+  m = us.GetModernMove(m);
+  int type = 0;
+  int promotion = 0;
+  if (us.ours().get(m.to())) {
+    type = 3;
+  } else if (us.pawns().get(m.from())) {
+    if (m.from().col() != m.to().col() && !us.theirs().get(m.to())) {
+      type = 2;
+    } else if (m.to().row() == ChessBoard::Rank::RANK_8) {
+      type = 1;
+      switch (m.promotion()) {
+        case Move::Promotion::Queen:
+          promotion = 3;
+          break;
+        case Move::Promotion::Rook:
+          promotion = 2;
+          break;
+        case Move::Promotion::Bishop:
+          promotion = 1;
+          break;
+        default:
+          // Knight, also when missing as in the plain format.
+          promotion = 0;
+      }
+    }
+  }
+  if (p.IsBlackToMove()) m.Mirror();
+  const uint16_t move = m.to().as_int() | m.from().as_int() << 6 |
+                        promotion << 12 | type << 14;
+  // Formula from PR1477 adjuster for SF PawnValueEg.
+  const double score = std::clamp(
+      std::round(660.6 * q / (1 - 0.9751875 * std::pow(q, 10))), -32000.0,
+      32000.0);
+  const int16_t score16 = score;
+  const uint16_t ply = p.GetGamePly();
+  const int8_t result8 = result;
+  std::memcpy(data + 32, &score16, 2);
+  std::memcpy(data + 34, &move, 2);
+  std::memcpy(data + 36, &ply, 2);
+  std::memcpy(data + 38, &result8, 1);
+  out->append(reinterpret_cast<const char*>(data), sizeof(data));
+}
+
 struct ProcessFileFlags {
   bool delete_files : 1;
   bool nnue_best_score : 1;
   bool nnue_best_move : 1;
+  bool sparse_output : 1;
 };
 
+// Rescores the game in @file. With @input set the game is read from there
+// instead, and with @output set the rescored game is appended to it rather
+// than written to @outputDir, both uncompressed.
 void ProcessFile(const std::string& file, SyzygyTablebase* tablebase,
                  std::string outputDir, float distTemp, float distOffset,
                  float dtzBoost, int newInputFormat,
-                 std::string nnue_plain_file, ProcessFileFlags flags) {
+                 std::string nnue_plain_file, ProcessFileFlags flags,
+                 const std::string* input = nullptr,
+                 std::string* output = nullptr) {
   // Scope to ensure reader and writer are closed before deleting source file.
   {
     try {
-      TrainingDataReader reader(file);
-      std::vector<V6TrainingData> fileContents;
-      V6TrainingData data;
-      while (reader.ReadChunk(&data)) {
-        fileContents.push_back(data);
-      }
+      TrainingDataReader reader =
+          input ? TrainingDataReader(file, input->data(), input->size())
+                : TrainingDataReader(file);
+      std::vector<V6TrainingData> fileContents = reader.ReadAll();
       Validate(fileContents);
       MoveList moves;
       for (int i = 1; i < fileContents.size(); i++) {
@@ -495,11 +794,11 @@ void ProcessFile(const std::string& file, SyzygyTablebase* tablebase,
       PopulateBoard(input_format, PlanesFromTrainingData(fileContents[0]),
                     &board, &rule50ply, &gameply);
       history.Reset(board, rule50ply, gameply);
-      uint64_t rootHash = HashCat(board.Hash(), rule50ply);
-      if (policy_subs.find(rootHash) != policy_subs.end()) {
-        PolicySubNode* rootNode = &policy_subs[rootHash];
+      if (!policy_subs.empty()) {
+        uint64_t key = HashCat(board.Hash(), rule50ply);
+        float policy[1858];
         for (int i = 0; i < fileContents.size(); i++) {
-          if (rootNode->active) {
+          if (policy_subs.Lookup(key, policy)) {
             /* Some logic for choosing a softmax to apply to better align the
             new policy with the old policy...
             double bestkld =
@@ -509,8 +808,8 @@ void ProcessFile(const std::string& file, SyzygyTablebase* tablebase,
               float soft[1858];
               float sum = 0.0f;
               for (int j = 0; j < 1858; j++) {
-                if (rootNode->policy[j] >= 0.0) {
-                  soft[j] = std::pow(rootNode->policy[j], 1.0f / temp);
+                if (policy[j] >= 0.0) {
+                  soft[j] = std::pow(policy[j], 1.0f / temp);
                   sum += soft[j];
                 } else {
                   soft[j] = -1.0f;
@@ -519,7 +818,7 @@ void ProcessFile(const std::string& file, SyzygyTablebase* tablebase,
               double kld = 0.0;
               for (int j = 0; j < 1858; j++) {
                 if (soft[j] >= 0.0) soft[j] /= sum;
-                if (rootNode->policy[j] > 0.0 &&
+                if (policy[j] > 0.0 &&
                     fileContents[i].probabilities[j] > 0) {
                   kld += -1.0f * soft[j] *
                     std::log(fileContents[i].probabilities[j] / soft[j]);
@@ -534,26 +833,41 @@ void ProcessFile(const std::string& file, SyzygyTablebase* tablebase,
             */
             for (int j = 0; j < 1858; j++) {
               /*
-              if (rootNode->policy[j] >= 0.0) {
-                std::cerr << i << " " << j << " " << rootNode->policy[j] << " "
+              if (policy[j] >= 0.0) {
+                std::cerr << i << " " << j << " " << policy[j] << " "
                           << fileContents[i].probabilities[j] << std::endl;
               }
               */
-              fileContents[i].probabilities[j] = rootNode->policy[j];
+              fileContents[i].probabilities[j] = policy[j];
             }
           }
           if (i < fileContents.size() - 1) {
             int transform = TransformForPosition(input_format, history);
-            int idx = moves[i].as_nn_index(transform);
-            if (rootNode->children[idx] == nullptr) {
-              break;
-            }
-            rootNode = rootNode->children[idx];
+            key = HashCat(key, moves[i].as_nn_index(transform));
             history.Append(moves[i]);
           }
         }
       }
 
+      // Probes every position of the game the two passes below look at in one
+      // batch, so that positions of the same table are probed together.
+      PopulateBoard(input_format, PlanesFromTrainingData(fileContents[0]),
+                    &board, &rule50ply, &gameply);
+      history.Reset(board, rule50ply, gameply);
+      std::vector<Position> tb_positions;
+      std::vector<int> tb_index(moves.size(), -1);
+      for (int i = 0; i < moves.size(); i++) {
+        history.Append(moves[i]);
+        const auto& board = history.Last().GetBoard();
+        if (board.castlings().no_legal_castle() &&
+            (board.ours() | board.theirs()).count() <=
+                tablebase->max_cardinality()) {
+          tb_index[i] = tb_positions.size();
+          tb_positions.push_back(history.Last());
+        }
+      }
+      const auto tb_results = tablebase->probe_wdl_batch(tb_positions);
+
       PopulateBoard(input_format, PlanesFromTrainingData(fileContents[0]),
                     &board, &rule50ply, &gameply);
       history.Reset(board, rule50ply, gameply);
@@ -567,8 +881,8 @@ void ProcessFile(const std::string& file, SyzygyTablebase* tablebase,
             history.Last().GetRule50Ply() == 0 &&
             (board.ours() | board.theirs()).count() <=
                 tablebase->max_cardinality()) {
-          ProbeState state;
-          WDLScore wdl = tablebase->probe_wdl(history.Last(), &state);
+          ProbeState state = tb_results[tb_index[i]].state;
+          const WDLScore wdl = tb_results[tb_index[i]].wdl;
           // Only fail state means the WDL is wrong, probe_wdl may produce
           // correct result with a stat other than OK.
           if (state != FAIL) {
@@ -623,8 +937,8 @@ void ProcessFile(const std::string& file, SyzygyTablebase* tablebase,
             history.Last().GetRule50Ply() != 0 &&
             (board.ours() | board.theirs()).count() <=
                 tablebase->max_cardinality()) {
-          ProbeState state;
-          WDLScore wdl = tablebase->probe_wdl(history.Last(), &state);
+          ProbeState state = tb_results[tb_index[i]].state;
+          const WDLScore wdl = tb_results[tb_index[i]].wdl;
           // Only fail state means the WDL is wrong, probe_wdl may produce
           // correct result with a stat other than OK.
           if (state != FAIL) {
@@ -1044,9 +1358,14 @@ void ProcessFile(const std::string& file, SyzygyTablebase* tablebase,
         }
       }
 
-      if (!outputDir.empty()) {
+      if (relabeler) relabeler->Add(file, fileContents, moves);
+
+      if (output || !outputDir.empty()) {
         std::string fileName = file.substr(file.find_last_of("/\\") + 1);
-        TrainingDataWriter writer(outputDir + "/" + fileName);
+        TrainingDataWriter writer =
+            output ? TrainingDataWriter(output, flags.sparse_output)
+                   : TrainingDataWriter(outputDir + "/" + fileName,
+                                        flags.sparse_output);
         for (auto chunk : fileContents) {
           // Don't save chunks that just provide move history.
           if ((chunk.invariance_info & 64) == 0) {
@@ -1055,10 +1374,15 @@ void ProcessFile(const std::string& file, SyzygyTablebase* tablebase,
         }
       }
 
-      // Output data in Stockfish plain format.
-      if (!nnue_plain_file.empty()) {
+      // Output data in Stockfish plain and/or .bin format.
+      if (!nnue_plain_file.empty() || !nnue_bin_file.empty()) {
         static Mutex mutex;
         std::ostringstream out;
+        std::string bin_out;
+        auto emit = [&](const Position& p, Move m, float q, int result) {
+          if (!nnue_plain_file.empty()) out << AsNnueString(p, m, q, result);
+          if (!nnue_bin_file.empty()) AppendNnueBin(p, m, q, result, &bin_out);
+        };
         pblczero::NetworkFormat::InputFormat format;
         if (newInputFormat != -1) {
           format =
@@ -1078,21 +1402,27 @@ void ProcessFile(const std::string& file, SyzygyTablebase* tablebase,
                 flags.nnue_best_move ? chunk.best_idx : chunk.played_idx,
                 TransformForPosition(format, history));
             float q = flags.nnue_best_score ? chunk.best_q : chunk.played_q;
-            out << AsNnueString(p, m, q, round(chunk.result_q));
+            emit(p, m, q, round(chunk.result_q));
           } else if (i < moves.size()) {
-            out << AsNnueString(p, moves[i], chunk.best_q,
-                                round(chunk.result_q));
+            emit(p, moves[i], chunk.best_q, round(chunk.result_q));
           }
           if (i < moves.size()) {
             history.Append(moves[i]);
           }
         }
-        std::ofstream file;
         Mutex::Lock lock(mutex);
-        file.open(nnue_plain_file, std::ios_base::app);
-        if (file.is_open()) {
-          file << out.str();
-          file.close();
+        if (!nnue_plain_file.empty()) {
+          std::ofstream file;
+          file.open(nnue_plain_file, std::ios_base::app);
+          if (file.is_open()) {
+            file << out.str();
+            file.close();
+          }
+        }
+        if (!nnue_bin_file.empty()) {
+          std::ofstream file(nnue_bin_file,
+                             std::ios_base::app | std::ios_base::binary);
+          if (file.is_open()) file.write(bin_out.data(), bin_out.size());
         }
       }
     } catch (Exception& ex) {
@@ -1108,30 +1438,96 @@ void ProcessFile(const std::string& file, SyzygyTablebase* tablebase,
   }
 }
 
+// Takes files from @files until none are left, @next is the shared index of
+// the next file to process.
 void ProcessFiles(const std::vector<std::string>& files,
                   SyzygyTablebase* tablebase, std::string outputDir,
                   float distTemp, float distOffset, float dtzBoost,
-                  int newInputFormat, int offset, int mod,
-                  std::string nnue_plain_file, ProcessFileFlags flags) {
-  std::cerr << "Thread: " << offset << " starting" << std::endl;
-  for (int i = offset; i < files.size(); i += mod) {
+                  int newInputFormat, int thread_id,
+                  std::atomic<size_t>* next, std::string nnue_plain_file,
+                  ProcessFileFlags flags) {
+  std::cerr << "Thread: " << thread_id << " starting" << std::endl;
+  for (size_t i = (*next)++; i < files.size(); i = (*next)++) {
     if (files[i].rfind(".gz") != files[i].size() - 3) {
       std::cerr << "Skipping: " << files[i] << std::endl;
       continue;
     }
     ProcessFile(files[i], tablebase, outputDir, distTemp, distOffset, dtzBoost,
                 newInputFormat, nnue_plain_file, flags);
+    // The relabeler records the files once it writes them.
+    if (checkpoint && !relabeler) checkpoint->Append(files[i]);
   }
 }
 
-void BuildSubs(const std::vector<std::string>& files) {
+// Stream framing: a 32-bit little-endian byte count, then that many bytes of
+// uncompressed training data of one game.
+bool ReadFrame(std::FILE* in, std::string* data) {
+  unsigned char size[4];
+  if (std::fread(size, 1, 4, in) != 4) return false;
+  data->resize(size[0] | size[1] << 8 | size[2] << 16 |
+               static_cast<uint32_t>(size[3]) << 24);
+  return std::fread(&(*data)[0], 1, data->size(), in) == data->size();
+}
+
+void WriteFrame(std::FILE* out, const std::string& data) {
+  const uint32_t size = data.size();
+  const unsigned char header[4] = {
+      static_cast<unsigned char>(size), static_cast<unsigned char>(size >> 8),
+      static_cast<unsigned char>(size >> 16),
+      static_cast<unsigned char>(size >> 24)};
+  std::fwrite(header, 1, 4, out);
+  std::fwrite(data.data(), 1, data.size(), out);
+  std::fflush(out);
+}
+
+// Rescores the games framed on stdin as they arrive, and writes them framed
+// to stdout. Games that fail to rescore are dropped.
+void ProcessStream(SyzygyTablebase* tablebase, float distTemp,
+                   float distOffset, float dtzBoost, int newInputFormat,
+                   int threads, std::string nnue_plain_file,
+                   ProcessFileFlags flags) {
+#ifdef _WIN32
+  _setmode(_fileno(stdin), _O_BINARY);
+  _setmode(_fileno(stdout), _O_BINARY);
+#endif
+  Mutex in_mutex;
+  Mutex out_mutex;
+  int next_game = 0;
+  auto worker = [&]() {
+    std::string input;
+    std::string output;
+    while (true) {
+      std::string name;
+      {
+        Mutex::Lock lock(in_mutex);
+        if (!ReadFrame(stdin, &input)) return;
+        name = "stream_" + std::to_string(next_game++);
+      }
+      output.clear();
+      ProcessFile(name, tablebase, "", distTemp, distOffset, dtzBoost,
+                  newInputFormat, nnue_plain_file, flags, &input, &output);
+      if (output.empty()) continue;
+      Mutex::Lock lock(out_mutex);
+      WriteFrame(stdout, output);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (int i = 1; i < threads; i++) workers.emplace_back(worker);
+  worker();
+  for (auto& thread : workers) thread.join();
+}
+
+// Adds the games in @files that aren't indexed yet to policy_subs, and writes
+// the index to @index_path unless it's empty.
+void BuildSubs(const std::vector<std::string>& files,
+               const std::string& index_path) {
+  if (!index_path.empty()) policy_subs.Load(index_path);
+  int added = 0;
   for (auto& file : files) {
+    const std::string name = file.substr(file.find_last_of("/\\") + 1);
+    if (policy_subs.HasFile(name)) continue;
     TrainingDataReader reader(file);
-    std::vector<V6TrainingData> fileContents;
-    V6TrainingData data;
-    while (reader.ReadChunk(&data)) {
-      fileContents.push_back(data);
-    }
+    std::vector<V6TrainingData> fileContents = reader.ReadAll();
     Validate(fileContents);
     MoveList moves;
     for (int i = 1; i < fileContents.size(); i++) {
@@ -1155,26 +1551,24 @@ void BuildSubs(const std::vector<std::string>& files) {
     PopulateBoard(input_format, PlanesFromTrainingData(fileContents[0]), &board,
                   &rule50ply, &gameply);
     history.Reset(board, rule50ply, gameply);
-    uint64_t rootHash = HashCat(board.Hash(), rule50ply);
-    PolicySubNode* rootNode = &policy_subs[rootHash];
+    // Positions are keyed by the game root and the moves leading to them.
+    uint64_t key = HashCat(board.Hash(), rule50ply);
     for (int i = 0; i < fileContents.size(); i++) {
       if ((fileContents[i].invariance_info & 64) == 0) {
-        rootNode->active = true;
-        for (int j = 0; j < 1858; j++) {
-          rootNode->policy[j] = fileContents[i].probabilities[j];
-        }
+        policy_subs.Add(key, fileContents[i].probabilities);
       }
       if (i < fileContents.size() - 1) {
         int transform = TransformForPosition(input_format, history);
-        int idx = moves[i].as_nn_index(transform);
-        if (rootNode->children[idx] == nullptr) {
-          rootNode->children[idx] = new PolicySubNode();
-        }
-        rootNode = rootNode->children[idx];
+        key = HashCat(key, moves[i].as_nn_index(transform));
         history.Append(moves[i]);
       }
     }
+    policy_subs.AddFile(name);
+    added++;
   }
+  if (added > 0 || index_path.empty()) policy_subs.Commit(index_path);
+  std::cerr << "Policy substitutions: " << policy_subs.size()
+            << " positions, " << added << " new files" << std::endl;
 }
 
 }  // namespace
@@ -1203,7 +1597,8 @@ void RescoreLoop::RunLoop() {
   options_.Add<StringOption>(kInputDirId);
   options_.Add<StringOption>(kOutputDirId);
   options_.Add<StringOption>(kPolicySubsDirId);
-  options_.Add<IntOption>(kThreadsId, 1, 20) = 1;
+  options_.Add<StringOption>(kPolicySubsIndexId);
+  options_.Add<IntOption>(kThreadsId, 1, 1024) = 1;
   options_.Add<FloatOption>(kTempId, 0.001, 100) = 1;
   // Positive dist offset requires knowing the legal move set, so not supported
   // for now.
@@ -1214,18 +1609,30 @@ void RescoreLoop::RunLoop() {
   options_.Add<FloatOption>(kDeblunderQBlunderThreshold, 0.0f, 2.0f) = 2.0f;
   options_.Add<FloatOption>(kDeblunderQBlunderWidth, 0.0f, 2.0f) = 0.0f;
   options_.Add<StringOption>(kNnuePlainFileId);
+  options_.Add<StringOption>(kNnueBinFileId);
   options_.Add<BoolOption>(kNnueBestScoreId) = true;
   options_.Add<BoolOption>(kNnueBestMoveId) = false;
+  options_.Add<BoolOption>(kSparseOutputId) = false;
+  options_.Add<StringOption>(kRelabelDirId);
+  options_.Add<IntOption>(kRelabelBatchId, 1, 65536) = 4096;
+  NetworkFactory::PopulateOptions(&options_);
+  options_.Add<BoolOption>(kStreamId) = false;
   options_.Add<BoolOption>(kDeleteFilesId) = true;
+  options_.Add<StringOption>(kCheckpointId);
 
   if (!options_.ProcessAllFlags()) return;
 
   if (options_.GetOptionsDict().IsDefault<std::string>(kOutputDirId) &&
-      options_.GetOptionsDict().IsDefault<std::string>(kNnuePlainFileId)) {
-    std::cerr << "Must provide an output dir or NNUE plain file." << std::endl;
+      options_.GetOptionsDict().IsDefault<std::string>(kNnuePlainFileId) &&
+      options_.GetOptionsDict().IsDefault<std::string>(kNnueBinFileId) &&
+      options_.GetOptionsDict().IsDefault<std::string>(kRelabelDirId) &&
+      !options_.GetOptionsDict().Get<bool>(kStreamId)) {
+    std::cerr << "Must provide an output dir, relabel output dir or NNUE file."
+              << std::endl;
     return;
   }
 
+  nnue_bin_file = options_.GetOptionsDict().Get<std::string>(kNnueBinFileId);
   deblunderEnabled = options_.GetOptionsDict().Get<bool>(kDeblunder);
   deblunderQBlunderThreshold =
       options_.GetOptionsDict().Get<float>(kDeblunderQBlunderThreshold);
@@ -1250,6 +1657,7 @@ void RescoreLoop::RunLoop() {
     }
     tb_init(0, tb_CP4, paths);
     tbcache_init(64 * 1024 * 1024, 64);
+    gaviota_cache = std::make_unique<ProbeCache>(1 << 20);
     if (tb_availability() != 63) {
       std::cerr << "UNEXPECTED gaviota availability" << std::endl;
       return;
@@ -1260,101 +1668,164 @@ void RescoreLoop::RunLoop() {
   }
   auto policySubsDir =
       options_.GetOptionsDict().Get<std::string>(kPolicySubsDirId);
-  if (policySubsDir.size() != 0) {
-    auto policySubFiles = GetFileList(policySubsDir);
+  auto policySubsIndex =
+      options_.GetOptionsDict().Get<std::string>(kPolicySubsIndexId);
+  if (policySubsDir.size() != 0 || policySubsIndex.size() != 0) {
+    std::vector<std::string> policySubFiles;
+    if (policySubsDir.size() != 0) policySubFiles = GetFileList(policySubsDir);
     for (int i = 0; i < policySubFiles.size(); i++) {
       policySubFiles[i] = policySubsDir + "/" + policySubFiles[i];
     }
-    BuildSubs(policySubFiles);
+    BuildSubs(policySubFiles, policySubsIndex);
   }
 
-  auto inputDir = options_.GetOptionsDict().Get<std::string>(kInputDirId);
-  if (inputDir.size() == 0) {
-    std::cerr << "Must provide an input dir." << std::endl;
-    return;
-  }
-  auto files = GetFileList(inputDir);
-  if (files.size() == 0) {
-    std::cerr << "No files to process" << std::endl;
-    return;
-  }
-  for (int i = 0; i < files.size(); i++) {
-    files[i] = inputDir + "/" + files[i];
-  }
   float dtz_boost = options_.GetOptionsDict().Get<float>(kMinDTZBoostId);
   int threads = options_.GetOptionsDict().Get<int>(kThreadsId);
   ProcessFileFlags flags;
   flags.delete_files = options_.GetOptionsDict().Get<bool>(kDeleteFilesId);
   flags.nnue_best_score = options_.GetOptionsDict().Get<bool>(kNnueBestScoreId);
   flags.nnue_best_move = options_.GetOptionsDict().Get<bool>(kNnueBestMoveId);
-  if (threads > 1) {
-    std::vector<std::thread> threads_;
-    int offset = 0;
-    while (threads_.size() < threads) {
-      int offset_val = offset;
-      offset++;
-      threads_.emplace_back([this, offset_val, files, &tablebase, threads,
-                             dtz_boost, flags]() {
-        ProcessFiles(
-            files, &tablebase,
-            options_.GetOptionsDict().Get<std::string>(kOutputDirId),
-            options_.GetOptionsDict().Get<float>(kTempId),
-            options_.GetOptionsDict().Get<float>(kDistributionOffsetId),
-            dtz_boost, options_.GetOptionsDict().Get<int>(kNewInputFormatId),
-            offset_val, threads,
-            options_.GetOptionsDict().Get<std::string>(kNnuePlainFileId),
-            flags);
-      });
+  flags.sparse_output = options_.GetOptionsDict().Get<bool>(kSparseOutputId);
+  const auto relabel_dir =
+      options_.GetOptionsDict().Get<std::string>(kRelabelDirId);
+  if (!relabel_dir.empty()) {
+    relabeler = std::make_unique<Relabeler>(
+        NetworkFactory::LoadNetwork(options_.GetOptionsDict()), relabel_dir,
+        options_.GetOptionsDict().Get<int>(kRelabelBatchId),
+        static_cast<bool>(flags.sparse_output));
+  }
+  if (options_.GetOptionsDict().Get<bool>(kStreamId)) {
+    flags.delete_files = false;
+    ProcessStream(&tablebase, options_.GetOptionsDict().Get<float>(kTempId),
+                  options_.GetOptionsDict().Get<float>(kDistributionOffsetId),
+                  dtz_boost,
+                  options_.GetOptionsDict().Get<int>(kNewInputFormatId),
+                  threads,
+                  options_.GetOptionsDict().Get<std::string>(kNnuePlainFileId),
+                  flags);
+  } else {
+    auto inputDir = options_.GetOptionsDict().Get<std::string>(kInputDirId);
+    if (inputDir.size() == 0) {
+      std::cerr << "Must provide an input dir." << std::endl;
+      return;
+    }
+    auto files = GetFileList(inputDir);
+    if (files.size() == 0) {
+      std::cerr << "No files to process" << std::endl;
+      return;
     }
-    for (int i = 0; i < threads_.size(); i++) {
-      threads_[i].join();
+    for (int i = 0; i < files.size(); i++) {
+      files[i] = inputDir + "/" + files[i];
     }
+    const auto checkpoint_file =
+        options_.GetOptionsDict().Get<std::string>(kCheckpointId);
+    if (!checkpoint_file.empty()) {
+      checkpoint = std::make_unique<CheckpointJournal>(checkpoint_file);
+      const std::unordered_set<std::string> done(
+          checkpoint->GetRecords().begin(), checkpoint->GetRecords().end());
+      const size_t total = files.size();
+      files.erase(std::remove_if(files.begin(), files.end(),
+                                 [&](const std::string& file) {
+                                   return done.count(file) > 0;
+                                 }),
+                  files.end());
+      std::cerr << "Skipping " << total - files.size()
+                << " files already processed." << std::endl;
+    }
+    // Largest files first, so that the threads take files from a shared queue
+    // and a big file late in the list doesn't leave one thread running alone.
+    {
+      std::vector<std::pair<uint64_t, std::string>> sized;
+      for (auto& file : files) sized.emplace_back(GetFileSize(file), file);
+      std::stable_sort(
+          sized.begin(), sized.end(),
+          [](const auto& a, const auto& b) { return a.first > b.first; });
+      for (size_t i = 0; i < files.size(); i++) files[i] = sized[i].second;
+    }
+    std::atomic<size_t> next_file{0};
+    if (threads > 1) {
+      std::vector<std::thread> threads_;
+      while (threads_.size() < threads) {
+        const int thread_id = threads_.size();
+        threads_.emplace_back([this, thread_id, &files, &tablebase, &next_file,
+                               dtz_boost, flags]() {
+          ProcessFiles(
+              files, &tablebase,
+              options_.GetOptionsDict().Get<std::string>(kOutputDirId),
+              options_.GetOptionsDict().Get<float>(kTempId),
+              options_.GetOptionsDict().Get<float>(kDistributionOffsetId),
+              dtz_boost, options_.GetOptionsDict().Get<int>(kNewInputFormatId),
+              thread_id, &next_file,
+              options_.GetOptionsDict().Get<std::string>(kNnuePlainFileId),
+              flags);
+        });
+      }
+      for (int i = 0; i < threads_.size(); i++) {
+        threads_[i].join();
+      }
 
-  } else {
-    ProcessFiles(files, &tablebase,
-                 options_.GetOptionsDict().Get<std::string>(kOutputDirId),
-                 options_.GetOptionsDict().Get<float>(kTempId),
-                 options_.GetOptionsDict().Get<float>(kDistributionOffsetId),
-                 dtz_boost,
-                 options_.GetOptionsDict().Get<int>(kNewInputFormatId), 0, 1,
-                 options_.GetOptionsDict().Get<std::string>(kNnuePlainFileId),
-                 flags);
+    } else {
+      ProcessFiles(files, &tablebase,
+                   options_.GetOptionsDict().Get<std::string>(kOutputDirId),
+                   options_.GetOptionsDict().Get<float>(kTempId),
+                   options_.GetOptionsDict().Get<float>(kDistributionOffsetId),
+                   dtz_boost,
+                   options_.GetOptionsDict().Get<int>(kNewInputFormatId), 0,
+                   &next_file,
+                   options_.GetOptionsDict().Get<std::string>(kNnuePlainFileId),
+                   flags);
+    }
+  }
+  if (relabeler) {
+    relabeler->Flush();
+    relabeler.reset();
   }
-  std::cout << "Games processed: " << games << std::endl;
-  std::cout << "Positions processed: " << positions << std::endl;
-  std::cout << "Rescores performed: " << rescored << std::endl;
-  std::cout << "Cumulative outcome change: " << delta << std::endl;
-  std::cout << "Secondary rescores performed: " << rescored2 << std::endl;
-  std::cout << "Secondary rescores performed used dtz: " << rescored3
-            << std::endl;
-  std::cout << "Blunders picked up by deblunder threshold: " << blunders
-            << std::endl;
-  std::cout << "Number of policy values boosted by dtz or dtm " << policy_bump
-            << std::endl;
-  std::cout << "Number of policy values boosted by dtm " << policy_dtm_bump
-            << std::endl;
-  std::cout << "Orig policy_sum dist of boost candidate:";
-  std::cout << std::endl;
+  checkpoint.reset();
+  // stdout carries the games when streaming.
+  std::ostream& stats =
+      options_.GetOptionsDict().Get<bool>(kStreamId) ? std::cerr : std::cout;
+  stats << "Games processed: " << games << std::endl;
+  stats << "Positions processed: " << positions << std::endl;
+  stats << "Rescores performed: " << rescored << std::endl;
+  stats << "Cumulative outcome change: " << delta << std::endl;
+  stats << "Secondary rescores performed: " << rescored2 << std::endl;
+  stats << "Secondary rescores performed used dtz: " << rescored3 << std::endl;
+  stats << "Blunders picked up by deblunder threshold: " << blunders
+        << std::endl;
+  stats << "Number of policy values boosted by dtz or dtm " << policy_bump
+        << std::endl;
+  stats << "Number of policy values boosted by dtm " << policy_dtm_bump
+        << std::endl;
+  stats << "Orig policy_sum dist of boost candidate:";
+  stats << std::endl;
   int event_sum = 0;
   for (int i = 0; i < 11; i++) event_sum += policy_bump_total_hist[i];
   for (int i = 0; i < 11; i++) {
-    std::cout << " " << std::setprecision(4)
-              << ((float)policy_nobump_total_hist[i] / (float)event_sum);
+    stats << " " << std::setprecision(4)
+          << ((float)policy_nobump_total_hist[i] / (float)event_sum);
   }
-  std::cout << std::endl;
-  std::cout << "Boosted policy_sum dist of boost candidate:";
-  std::cout << std::endl;
+  stats << std::endl;
+  stats << "Boosted policy_sum dist of boost candidate:";
+  stats << std::endl;
   for (int i = 0; i < 11; i++) {
-    std::cout << " " << std::setprecision(4)
-              << ((float)policy_bump_total_hist[i] / (float)event_sum);
+    stats << " " << std::setprecision(4)
+          << ((float)policy_bump_total_hist[i] / (float)event_sum);
+  }
+  stats << std::endl;
+  stats << "Original L: " << orig_counts[0] << " D: " << orig_counts[1]
+        << " W: " << orig_counts[2] << std::endl;
+  stats << "After L: " << fixed_counts[0] << " D: " << fixed_counts[1]
+        << " W: " << fixed_counts[2] << std::endl;
+  stats << "Gaviota DTM move_count rescores: " << gaviota_dtm_rescores
+        << std::endl;
+  stats << "Syzygy probes answered from cache: "
+        << tablebase.probe_cache_hits() << " of "
+        << tablebase.probe_cache_lookups() << std::endl;
+  if (gaviota_cache) {
+    stats << "Gaviota probes answered from cache: "
+          << gaviota_cache->hits() << " of " << gaviota_cache->lookups()
+          << std::endl;
   }
-  std::cout << std::endl;
-  std::cout << "Original L: " << orig_counts[0] << " D: " << orig_counts[1]
-            << " W: " << orig_counts[2] << std::endl;
-  std::cout << "After L: " << fixed_counts[0] << " D: " << fixed_counts[1]
-            << " W: " << fixed_counts[2] << std::endl;
-  std::cout << "Gaviota DTM move_count rescores: " << gaviota_dtm_rescores
-            << std::endl;
 }
 
 }  // namespace lczero
@@ -28,6 +28,7 @@
 #include "selfplay/game.h"
 
 #include <algorithm>
+#include <cstdlib>
 
 #include "mcts/stoppers/common.h"
 #include "mcts/stoppers/factory.h"
@@ -65,6 +66,48 @@ const OptionId kOpeningStopProbId{
     "opening-stop-prob", "OpeningStopProb",
     "From each opening move, start a self-play game with probability max(p, "
     "1/n), where p is the value given and n the opening moves remaining."};
+const OptionId kCacheKeepPliesId{
+    "cache-keep-plies", "CacheKeepPlies",
+    "NN evaluations of the positions played in the first this many plies of "
+    "each game are kept in the NN cache, which is shared by the concurrent "
+    "games, rather than evicted, as they recur across games. At most half of "
+    "the cache is kept that way."};
+const OptionId kTablebaseAdjudicationId{
+    "tb-adjudication", "TablebaseAdjudication",
+    "End the game with the tablebase result as soon as a position is in the "
+    "Syzygy tablebases, instead of playing it out."};
+
+// Returns the result of the game as the tablebases tell it from @pos, or
+// UNDECIDED if they don't know or it's too close to the 50-move limit.
+GameResult ProbeGameResult(SyzygyTablebase* syzygy_tb, const Position& pos) {
+  const auto& board = pos.GetBoard();
+  if (!board.castlings().no_legal_castle() ||
+      (board.ours() | board.theirs()).count() >
+          syzygy_tb->max_cardinality()) {
+    return GameResult::UNDECIDED;
+  }
+  ProbeState state;
+  WDLScore wdl = syzygy_tb->probe_wdl(pos, &state);
+  if (state == FAIL) return GameResult::UNDECIDED;
+  const int rule50 = pos.GetRule50Ply();
+  // WDL assumes the 50-move counter was just reset, same margins as in the
+  // search.
+  if (rule50 != 0 && (wdl == WDL_WIN || wdl == WDL_LOSS)) {
+    const int dtz = std::abs(syzygy_tb->probe_dtz(pos, &state));
+    if (state == FAIL) return GameResult::UNDECIDED;
+    if (rule50 + dtz > 101) {
+      wdl = WDL_DRAW;
+    } else if (rule50 + dtz >= 99) {
+      return GameResult::UNDECIDED;
+    }
+  }
+  if (wdl == WDL_WIN || wdl == WDL_LOSS) {
+    return (wdl == WDL_WIN) != pos.IsBlackToMove() ? GameResult::WHITE_WON
+                                                   : GameResult::BLACK_WON;
+  }
+  // Cursed wins and blessed losses are draws.
+  return GameResult::DRAW;
+}
 }  // namespace
 
 void SelfPlayGame::PopulateUciParams(OptionsParser* options) {
@@ -77,6 +120,8 @@ void SelfPlayGame::PopulateUciParams(OptionsParser* options) {
   PopulateTimeManagementOptions(RunType::kSelfplay, options);
   options->Add<StringOption>(kSyzygyTablebaseId);
   options->Add<FloatOption>(kOpeningStopProbId, 0.0f, 1.0f) = 0.0f;
+  options->Add<IntOption>(kCacheKeepPliesId, 0, 1000) = 0;
+  options->Add<BoolOption>(kTablebaseAdjudicationId) = false;
 }
 
 SelfPlayGame::SelfPlayGame(PlayerOptions white, PlayerOptions black,
@@ -88,6 +133,13 @@ SelfPlayGame::SelfPlayGame(PlayerOptions white, PlayerOptions black,
                      SearchParams(*black.uci_options).GetHistoryFill(),
                      white.network->GetCapabilities().input_format) {
   orig_fen_ = opening.start_fen;
+  for (int idx : {0, 1}) {
+    if (options_[idx].search_limits.full_search_fraction >= 1.0f) continue;
+    // Noise is only for the searches the network learns from.
+    fast_options_[idx] =
+        std::make_unique<OptionsDict>(options_[idx].uci_options);
+    fast_options_[idx]->Set<float>(SearchParams::kNoiseEpsilonId, 0.0f);
+  }
   tree_[0] = std::make_shared<NodeTree>();
   tree_[0]->ResetToPosition(orig_fen_, {});
 
@@ -148,6 +200,10 @@ void SelfPlayGame::Play(int white_threads, int black_threads, bool training,
       syzygy_tb_ = nullptr;
     }
   }
+  SyzygyTablebase* const adjudication_tb =
+      options_[0].uci_options->Get<bool>(kTablebaseAdjudicationId)
+          ? (syzygy_tb ? syzygy_tb : syzygy_tb_.get())
+          : nullptr;
   // Do moves while not end of the game. (And while not abort_)
   while (!abort_) {
     game_result_ = tree_[0]->GetPositionHistory().ComputeGameResult();
@@ -158,16 +214,36 @@ void SelfPlayGame::Play(int white_threads, int black_threads, bool training,
       adjudicated_ = true;
       break;
     }
+    // Known positions need no more searches.
+    if (adjudication_tb) {
+      game_result_ = ProbeGameResult(adjudication_tb,
+                                     tree_[0]->GetPositionHistory().Last());
+      if (game_result_ != GameResult::UNDECIDED) {
+        adjudicated_ = true;
+        break;
+      }
+    }
     // Initialize search.
     const int idx = blacks_move ? 1 : 0;
     if (!options_[idx].uci_options->Get<bool>(kReuseTreeId)) {
       tree_[idx]->TrimTreeAtHead();
     }
+    SelfPlayTreeCache* const tree_cache = options_[idx].tree_cache;
+    if (tree_cache && tree_cache->IsCachedPly(move_count_)) {
+      tree_cache->Restore(tree_[idx].get());
+    }
+    const bool full_search =
+        !fast_options_[idx] ||
+        Random::Get().GetFloat(1.0f) <
+            options_[idx].search_limits.full_search_fraction;
+    const OptionsDict& search_options =
+        full_search ? *options_[idx].uci_options : *fast_options_[idx];
     {
       std::lock_guard<std::mutex> lock(mutex_);
       if (abort_) break;
-      auto stoppers = options_[idx].search_limits.MakeSearchStopper();
-      PopulateIntrinsicStoppers(stoppers.get(), *options_[idx].uci_options);
+      auto stoppers =
+          options_[idx].search_limits.MakeSearchStopper(full_search);
+      PopulateIntrinsicStoppers(stoppers.get(), search_options);
 
       std::unique_ptr<UciResponder> responder =
           std::make_unique<CallbackUciResponder>(
@@ -183,11 +259,18 @@ void SelfPlayGame::Play(int white_threads, int black_threads, bool training,
           *tree_[idx], options_[idx].network, std::move(responder),
           /* searchmoves */ MoveList(), std::chrono::steady_clock::now(),
           std::move(stoppers), /* infinite */ false, /* ponder */ false,
-          *options_[idx].uci_options, options_[idx].cache, syzygy_tb);
+          search_options, options_[idx].cache, syzygy_tb, &thread_pool_);
     }
 
     // Do search.
-    search_->RunBlocking(blacks_move ? black_threads : white_threads);
+    if (options_[idx].lockstep) options_[idx].lockstep->Join();
+    const int threads = blacks_move ? black_threads : white_threads;
+    if (options_[idx].lean_search) {
+      search_->RunBlockingLean(threads);
+    } else {
+      search_->RunBlocking(threads);
+    }
+    if (options_[idx].lockstep) options_[idx].lockstep->Leave();
     move_count_++;
     nodes_total_ += search_->GetTotalPlayouts();
     if (abort_) break;
@@ -280,7 +363,8 @@ void SelfPlayGame::Play(int white_threads, int black_threads, bool training,
       search_->ResetBestMove();
     }
 
-    if (training) {
+    // Only the full searches are worth learning from.
+    if (training && full_search) {
       bool best_is_proof = best_is_terminal;  // But check for better moves.
       if (best_is_proof && best_eval.wl < 1) {
         auto best =
@@ -303,9 +387,23 @@ void SelfPlayGame::Play(int white_threads, int black_threads, bool training,
     // Must reset the search before mutating the tree.
     search_.reset();
 
+    // The root was evaluated by this or an earlier search, so it is usually
+    // still in the cache.
+    const auto& history = tree_[idx]->GetPositionHistory();
+    if (history.Last().GetGamePly() <
+        options_[idx].uci_options->Get<int>(kCacheKeepPliesId)) {
+      options_[idx].cache->Keep(history.HashLast(
+          SearchParams(*options_[idx].uci_options).GetCacheHistoryLength() +
+          1));
+    }
+
     // Add best move to the tree.
     tree_[0]->MakeMove(move);
     if (tree_[0] != tree_[1]) tree_[1]->MakeMove(move);
+    // The subtree of the move is what the next search starts from.
+    if (tree_cache && tree_cache->IsCachedPly(move_count_)) {
+      tree_cache->Store(*tree_[idx]);
+    }
     blacks_move = !blacks_move;
   }
 }
@@ -357,9 +455,13 @@ void SelfPlayGame::WriteTrainingData(TrainingDataWriter* writer) const {
   training_data_.Write(writer, game_result_, adjudicated_);
 }
 
-std::unique_ptr<ChainedSearchStopper> SelfPlayLimits::MakeSearchStopper()
-    const {
+std::unique_ptr<ChainedSearchStopper> SelfPlayLimits::MakeSearchStopper(
+    bool full) const {
   auto result = std::make_unique<ChainedSearchStopper>();
+  if (!full) {
+    result->AddStopper(std::make_unique<VisitsStopper>(fast_visits, false));
+    return result;
+  }
 
   // always set VisitsStopper to avoid exceeding the limit 4000000000, the
   // default value when visits = 0
@@ -27,6 +27,8 @@
 
 #pragma once
 
+#include <atomic>
+
 #include "chess/pgn.h"
 #include "chess/position.h"
 #include "chess/uciloop.h"
@@ -34,6 +36,8 @@
 #include "mcts/stoppers/stoppers.h"
 #include "neural/cache.h"
 #include "neural/network.h"
+#include "selfplay/lockstep.h"
+#include "selfplay/treecache.h"
 #include "trainingdata/trainingdata.h"
 #include "utils/optionsparser.h"
 
@@ -43,14 +47,24 @@ struct SelfPlayLimits {
   std::int64_t visits = -1;
   std::int64_t playouts = -1;
   std::int64_t movetime = -1;
-
-  std::unique_ptr<ChainedSearchStopper> MakeSearchStopper() const;
+  // Playout cap randomization: only this fraction of the moves is searched
+  // with the limits above and recorded as training data, the others are
+  // searched with fast_visits visits and no noise.
+  float full_search_fraction = 1.0f;
+  std::int64_t fast_visits = -1;
+
+  // Stoppers of a full search, or of a fast one if @full is false.
+  std::unique_ptr<ChainedSearchStopper> MakeSearchStopper(
+      bool full = true) const;
 };
 
 struct PlayerOptions {
   using OpeningCallback = std::function<void(const Opening&)>;
   // Network to use by the player.
   Network* network;
+  // Set when the network is shared in lockstep with other games, to join it
+  // for the time of every search.
+  LockstepNetwork* lockstep = nullptr;
   // Callback when player moves.
   CallbackUciResponder::BestMoveCallback best_move_callback;
   // Callback when player outputs info.
@@ -63,6 +77,11 @@ struct PlayerOptions {
   const OptionsDict* uci_options;
   // Limits to use for every move.
   SelfPlayLimits search_limits;
+  // Trees of the first plies shared with other games, nullptr if not.
+  SelfPlayTreeCache* tree_cache = nullptr;
+  // Whether nobody looks at the thinking info of the searches, so that they
+  // can run with Search::RunBlockingLean().
+  bool lean_search = false;
 };
 
 // Plays a single game vs itself.
@@ -97,7 +116,8 @@ class SelfPlayGame {
   // Eval is the expected outcome in the range 0<->1.
   float GetWorstEvalForWinnerOrDraw() const;
   int move_count_ = 0;
-  uint64_t nodes_total_ = 0;
+  // Also read by the tournament while the game is played.
+  std::atomic<uint64_t> nodes_total_{0};
 
  private:
   // options_[0] is for white player, [1] for black.
@@ -108,6 +128,10 @@ class SelfPlayGame {
   std::string orig_fen_;
   int start_ply_;
 
+  // Options of the fast searches of playout cap randomization, per player.
+  std::unique_ptr<OptionsDict> fast_options_[2];
+  // Search threads are kept for all the moves of the game.
+  ThreadPool thread_pool_;
   // Search that is currently in progress. Stored in members so that Abort()
   // can stop it.
   std::unique_ptr<Search> search_;
@@ -0,0 +1,193 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "selfplay/lockstep.h"
+
+#include <algorithm>
+
+namespace lczero {
+
+class LockstepComputation : public NetworkComputation {
+ public:
+  LockstepComputation(LockstepNetwork* network) : network_(network) {}
+
+  void AddInput(InputPlanes&& input) override {
+    inputs_.emplace_back(std::move(input));
+    moves_.emplace_back();
+  }
+
+  void AddInputWithMoves(InputPlanes&& input,
+                         const std::vector<uint16_t>& moves) override {
+    inputs_.emplace_back(std::move(input));
+    moves_.emplace_back(moves);
+    with_moves_ = true;
+  }
+
+  void ComputeBlocking() override { network_->batcher()->Compute(this); }
+
+  int GetBatchSize() const override { return inputs_.size(); }
+
+  float GetQVal(int sample) const override {
+    return parent_->GetQVal(sample + idx_in_parent_);
+  }
+  float GetDVal(int sample) const override {
+    return parent_->GetDVal(sample + idx_in_parent_);
+  }
+  float GetMVal(int sample) const override {
+    return parent_->GetMVal(sample + idx_in_parent_);
+  }
+  float GetPVal(int sample, int move_id) const override {
+    return parent_->GetPVal(sample + idx_in_parent_, move_id);
+  }
+  float GetLegalPVal(int sample, int move_ordinal,
+                     int move_id) const override {
+    return parent_->GetLegalPVal(sample + idx_in_parent_, move_ordinal,
+                                 move_id);
+  }
+
+  // Adds the inputs to the batch of the step.
+  void PopulateToParent(std::shared_ptr<NetworkComputation> parent) {
+    parent_ = parent;
+    idx_in_parent_ = parent->GetBatchSize();
+    for (size_t i = 0; i < inputs_.size(); ++i) {
+      if (with_moves_) {
+        parent_->AddInputWithMoves(std::move(inputs_[i]), moves_[i]);
+      } else {
+        parent_->AddInput(std::move(inputs_[i]));
+      }
+    }
+    inputs_.clear();
+    moves_.clear();
+  }
+
+  LockstepNetwork* network() const { return network_; }
+
+  // Guarded by the mutex of the batcher.
+  bool ready_ = false;
+
+ private:
+  LockstepNetwork* const network_;
+  std::vector<InputPlanes> inputs_;
+  std::vector<std::vector<uint16_t>> moves_;
+  // Whether the inputs come with their legal moves. The search adds all the
+  // inputs of a computation the same way.
+  bool with_moves_ = false;
+  std::shared_ptr<NetworkComputation> parent_;
+  int idx_in_parent_ = 0;
+};
+
+LockstepNetwork::LockstepNetwork(std::unique_ptr<Network> network,
+                                 LockstepBatcher* batcher)
+    : network_(std::move(network)), batcher_(batcher) {}
+
+std::unique_ptr<NetworkComputation> LockstepNetwork::NewComputation() {
+  return std::make_unique<LockstepComputation>(this);
+}
+
+float LockstepNetwork::TakeStepFill() {
+  std::lock_guard<std::mutex> lock(batcher_->mutex_);
+  if (steps_taken_ == 0) return -1.0f;
+  const float fill = static_cast<float>(step_positions_) / steps_taken_ /
+                     network_->GetMiniBatchSize();
+  step_positions_ = 0;
+  steps_taken_ = 0;
+  return fill;
+}
+
+void LockstepBatcher::Join() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++searching_;
+}
+
+void LockstepBatcher::Leave() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  --searching_;
+  // The step may have been waiting only for the game that left.
+  if (!pending_.empty()) cv_.notify_all();
+}
+
+void LockstepBatcher::Compute(LockstepComputation* computation) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (pending_.empty()) {
+    deadline_ = std::chrono::steady_clock::now() + timeout_;
+  }
+  pending_.push_back(computation);
+  const auto step = step_;
+  while (step_ == step) {
+    if (static_cast<int>(pending_.size()) >= searching_ ||
+        std::chrono::steady_clock::now() >= deadline_) {
+      RunStep(&lock);
+      break;
+    }
+    cv_.wait_until(lock, deadline_);
+  }
+  cv_.wait(lock, [computation]() { return computation->ready_; });
+}
+
+void LockstepBatcher::RunStep(std::unique_lock<std::mutex>* lock) {
+  std::vector<LockstepComputation*> children;
+  children.swap(pending_);
+  ++step_;
+  // Let the next step start gathering while this one is computed.
+  cv_.notify_all();
+  lock->unlock();
+
+  // One batch per network.
+  std::stable_sort(children.begin(), children.end(),
+                   [](const LockstepComputation* a,
+                      const LockstepComputation* b) {
+                     return a->network() < b->network();
+                   });
+  std::vector<std::pair<LockstepNetwork*, int>> batches;
+  for (auto begin = children.begin(); begin != children.end();) {
+    LockstepNetwork* network = (*begin)->network();
+    const auto end = std::find_if(begin, children.end(), [&](auto child) {
+      return child->network() != network;
+    });
+    std::shared_ptr<NetworkComputation> parent(
+        network->network_->NewComputation());
+    auto priority = ComputationPriority::kSpeculative;
+    for (auto it = begin; it != end; ++it) {
+      priority = std::min(priority, (*it)->GetPriority());
+      (*it)->PopulateToParent(parent);
+    }
+    parent->SetPriority(priority);
+    parent->ComputeBlocking();
+    batches.emplace_back(network, parent->GetBatchSize());
+    begin = end;
+  }
+
+  lock->lock();
+  for (const auto& batch : batches) {
+    batch.first->step_positions_ += batch.second;
+    ++batch.first->steps_taken_;
+  }
+  for (auto child : children) child->ready_ = true;
+  cv_.notify_all();
+}
+
+}  // namespace lczero
@@ -0,0 +1,119 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "neural/network.h"
+
+namespace lczero {
+
+class LockstepComputation;
+class LockstepNetwork;
+
+// Makes the searches of the games of a tournament advance in steps: the
+// computations of the networks it batches are held until every game which is
+// searching has sent one, and the computations of each network are then
+// concatenated into a single batch, the batches of different networks being
+// run back to back. A game that doesn't send anything in time (e.g. busy with
+// a terminal-only minibatch) doesn't stall the others for longer than the
+// timeout.
+class LockstepBatcher {
+ public:
+  explicit LockstepBatcher(std::chrono::microseconds timeout)
+      : timeout_(timeout) {}
+
+  // A game joins before each search and leaves after it.
+  void Join();
+  void Leave();
+
+  // Queues the computation into the current step, and blocks until the step
+  // it went into is computed.
+  void Compute(LockstepComputation* computation);
+
+ private:
+  // Takes the pending computations out and computes them, one batch per
+  // network. Called with the lock held, releases it while computing.
+  void RunStep(std::unique_lock<std::mutex>* lock);
+
+  const std::chrono::microseconds timeout_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // Number of games currently searching.
+  int searching_ = 0;
+  // Computations of the step being gathered.
+  std::vector<LockstepComputation*> pending_;
+  // When the step being gathered is sent regardless of who is missing.
+  std::chrono::steady_clock::time_point deadline_;
+  // Incremented every time a step is taken out.
+  uint64_t step_ = 0;
+
+  friend class LockstepNetwork;
+};
+
+// Wraps a network to batch its computations with @batcher.
+class LockstepNetwork : public Network {
+ public:
+  LockstepNetwork(std::unique_ptr<Network> network, LockstepBatcher* batcher);
+
+  LockstepBatcher* batcher() const { return batcher_; }
+  void Join() { batcher_->Join(); }
+  void Leave() { batcher_->Leave(); }
+
+  // Returns the average size of the batches since the previous call, relative
+  // to the minibatch size of the wrapped network, or -1 if there were none.
+  float TakeStepFill();
+
+  std::unique_ptr<NetworkComputation> NewComputation() override;
+  const NetworkCapabilities& GetCapabilities() const override {
+    return network_->GetCapabilities();
+  }
+  int GetThreads() const override { return network_->GetThreads(); }
+  bool IsCpu() const override { return network_->IsCpu(); }
+  std::string GetPciBusId() const override { return network_->GetPciBusId(); }
+  int GetMiniBatchSize() const override {
+    return network_->GetMiniBatchSize();
+  }
+
+ private:
+  const std::unique_ptr<Network> network_;
+  LockstepBatcher* const batcher_;
+  // Positions and batches computed since the last TakeStepFill(). Guarded by
+  // the mutex of the batcher.
+  uint64_t step_positions_ = 0;
+  uint64_t steps_taken_ = 0;
+
+  friend class LockstepBatcher;
+};
+
+}  // namespace lczero
@@ -0,0 +1,201 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "selfplay/openings.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <unordered_set>
+
+#include "neural/encoder.h"
+#include "utils/exception.h"
+#include "utils/filesystem.h"
+#include "utils/logging.h"
+
+namespace lczero {
+namespace {
+
+// File layout: magic, u32 opening count, then for every opening a u16 length
+// and the starting FEN, a u16 move count and the moves as u16 (the to square,
+// the from square shifted by 6 and the promotion shifted by 12).
+constexpr char kBookMagic[8] = {'L', 'C', '0', 'B', 'O', 'O', 'K', '1'};
+
+template <typename T>
+void Append(std::string* out, T value) {
+  out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+T Take(const char** data, const char* end) {
+  if (end - *data < static_cast<ptrdiff_t>(sizeof(T))) {
+    throw Exception("Truncated opening book cache.");
+  }
+  T value;
+  std::memcpy(&value, *data, sizeof(T));
+  *data += sizeof(T);
+  return value;
+}
+
+uint16_t PackMove(Move move) {
+  return move.to().as_int() | (move.from().as_int() << 6) |
+         (static_cast<int>(move.promotion()) << 12);
+}
+
+Move UnpackMove(uint16_t packed) {
+  return Move(BoardSquare((packed >> 6) & 63), BoardSquare(packed & 63),
+              static_cast<Move::Promotion>(packed >> 12));
+}
+
+std::vector<Opening> ReadBook(const std::string& filename) {
+  MappedFile file(filename);
+  const char* data = file.data();
+  const char* end = data + file.size();
+  if (file.size() < sizeof(kBookMagic) ||
+      std::memcmp(data, kBookMagic, sizeof(kBookMagic)) != 0) {
+    throw Exception("Not an opening book cache: " + filename);
+  }
+  data += sizeof(kBookMagic);
+  std::vector<Opening> openings(Take<uint32_t>(&data, end));
+  for (auto& opening : openings) {
+    const auto fen_size = Take<uint16_t>(&data, end);
+    if (end - data < fen_size) throw Exception("Truncated opening book cache.");
+    opening.start_fen.assign(data, fen_size);
+    data += fen_size;
+    const auto moves = Take<uint16_t>(&data, end);
+    opening.moves.reserve(moves);
+    for (int i = 0; i < moves; ++i) {
+      opening.moves.push_back(UnpackMove(Take<uint16_t>(&data, end)));
+    }
+  }
+  return openings;
+}
+
+void WriteBook(const std::string& filename,
+               const std::vector<Opening>& openings) {
+  std::string out(kBookMagic, sizeof(kBookMagic));
+  Append<uint32_t>(&out, openings.size());
+  for (const auto& opening : openings) {
+    Append<uint16_t>(&out, opening.start_fen.size());
+    out += opening.start_fen;
+    Append<uint16_t>(&out, opening.moves.size());
+    for (Move move : opening.moves) Append<uint16_t>(&out, PackMove(move));
+  }
+  // Written aside and renamed, so that concurrent runs never read half of it.
+  const std::string tmp = filename + ".tmp";
+  {
+    std::ofstream file(tmp, std::ios::binary);
+    file.write(out.data(), out.size());
+    if (!file) throw Exception("Unable to write " + tmp);
+  }
+  if (std::rename(tmp.c_str(), filename.c_str()) != 0) {
+    throw Exception("Unable to rename " + tmp);
+  }
+}
+
+PositionHistory OpeningHistory(const Opening& opening) {
+  ChessBoard board;
+  int rule50_ply;
+  int full_moves;
+  board.SetFromFen(opening.start_fen, &rule50_ply, &full_moves);
+  PositionHistory history;
+  history.Reset(board, rule50_ply, full_moves * 2 - (board.flipped() ? 1 : 2));
+  // The same as NodeTree::MakeMove() does.
+  for (Move move : opening.moves) {
+    if (history.IsBlackToMove()) move.Mirror();
+    history.Append(history.Last().GetBoard().GetModernMove(move));
+  }
+  return history;
+}
+
+}  // namespace
+
+std::vector<Opening> LoadOpenings(const std::string& pgn_file) {
+  const std::string book_file = pgn_file + ".lc0book";
+  const time_t book_time = GetFileTime(book_file);
+  if (book_time != 0 && book_time >= GetFileTime(pgn_file)) {
+    try {
+      return ReadBook(book_file);
+    } catch (const Exception& e) {
+      CERR << e.what() << ", parsing " << pgn_file << " again.";
+    }
+  }
+  PgnReader reader;
+  reader.AddPgnFile(pgn_file);
+  auto openings = reader.ReleaseGames();
+  try {
+    WriteBook(book_file, openings);
+  } catch (const Exception& e) {
+    // Only the next start gets slower.
+    CERR << e.what();
+  }
+  return openings;
+}
+
+int SeedCacheWithOpenings(const std::vector<Opening>& openings,
+                          Network* network, NNCache* cache,
+                          const SearchParams& params) {
+  const auto input_format = network->GetCapabilities().input_format;
+  const int batch_size = network->GetMiniBatchSize();
+  std::unordered_set<uint64_t> seen;
+  std::vector<uint64_t> hashes;
+  int kept = 0;
+  auto flush = [&](CachingComputation* computation) {
+    computation->ComputeBlocking();
+    for (uint64_t hash : hashes) kept += cache->Keep(hash);
+    hashes.clear();
+  };
+  auto computation =
+      std::make_unique<CachingComputation>(network->NewComputation(), cache);
+  for (const auto& opening : openings) {
+    const auto history = OpeningHistory(opening);
+    const auto hash = history.HashLast(params.GetCacheHistoryLength() + 1);
+    if (!seen.insert(hash).second) continue;
+    const auto legal_moves = history.Last().GetBoard().GenerateLegalMoves();
+    // Nothing to search in finished games.
+    if (legal_moves.empty()) continue;
+    int transform;
+    auto planes = EncodePositionForNN(input_format, history, 8,
+                                      params.GetHistoryFill(), &transform);
+    std::vector<uint16_t> moves;
+    moves.reserve(legal_moves.size());
+    for (const auto& move : legal_moves) {
+      moves.emplace_back(move.as_nn_index(transform));
+    }
+    computation->AddInput(hash, std::move(planes), std::move(moves));
+    hashes.push_back(hash);
+    if (computation->GetBatchSize() >= batch_size) {
+      flush(computation.get());
+      computation = std::make_unique<CachingComputation>(
+          network->NewComputation(), cache);
+    }
+  }
+  flush(computation.get());
+  return kept;
+}
+
+}  // namespace lczero
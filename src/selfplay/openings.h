@@ -0,0 +1,51 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "chess/pgn.h"
+#include "mcts/params.h"
+#include "neural/cache.h"
+#include "neural/network.h"
+
+namespace lczero {
+
+// Reads the openings of a PGN file. The parsed openings are saved next to the
+// file (as <file>.lc0book), and read from there rather than parsed again as
+// long as the PGN file doesn't change.
+std::vector<Opening> LoadOpenings(const std::string& pgn_file);
+
+// Evaluates the positions where the openings end, and keeps them in @cache for
+// all the games to use. Returns the number of positions kept.
+int SeedCacheWithOpenings(const std::vector<Opening>& openings,
+                          Network* network, NNCache* cache,
+                          const SearchParams& params);
+
+}  // namespace lczero
@@ -27,11 +27,20 @@
 
 #include "selfplay/tournament.h"
 
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
 #include "chess/pgn.h"
 #include "mcts/search.h"
 #include "mcts/stoppers/factory.h"
 #include "neural/factory.h"
 #include "selfplay/game.h"
+#include "selfplay/lockstep.h"
+#include "selfplay/openings.h"
+#ifndef _WIN32
+#include "selfplay/uploader.h"
+#endif
 #include "utils/optionsparser.h"
 #include "utils/random.h"
 
@@ -40,12 +49,35 @@ namespace {
 const OptionId kShareTreesId{"share-trees", "ShareTrees",
                              "When on, game tree is shared for two players; "
                              "when off, each side has a separate tree."};
+const OptionId kShareCacheId{
+    "share-cache", "ShareCache",
+    "When on, the two players use one NN cache also with separate trees, "
+    "provided they use the same networks. Positions of the opening recur "
+    "across the concurrent games of both players."};
 const OptionId kTotalGamesId{
     "games", "Games",
     "Number of games to play. -1 to play forever, -2 to play equal to book "
     "length, or double book length if mirrored."};
 const OptionId kParallelGamesId{"parallelism", "Parallelism",
                                 "Number of games to play in parallel."};
+const OptionId kMaxParallelGamesId{
+    "max-parallelism", "MaxParallelism",
+    "When above --parallelism, the number of parallel games starts at "
+    "--parallelism and is adjusted to the measured throughput, up to this "
+    "limit. Bound it by the memory the trees of the games may take."};
+const OptionId kAutoscaleIntervalId{
+    "autoscale-interval", "AutoscaleInterval",
+    "Seconds over which the throughput is measured between two adjustments "
+    "of the number of parallel games."};
+const OptionId kLockstepId{
+    "lockstep", "Lockstep",
+    "Advance the searches of the parallel games in steps, evaluating the "
+    "leaves of all the games searching with a network as one batch. With "
+    "different networks, their batches of a step are run back to back."};
+const OptionId kLockstepTimeoutId{
+    "lockstep-timeout", "LockstepTimeout",
+    "Longest time in microseconds a lockstep batch waits for the games that "
+    "didn't send their leaves yet."};
 const OptionId kThreadsId{
     "threads", "Threads",
     "Number of (CPU) worker threads to use for every game,", 't'};
@@ -55,10 +87,39 @@ const OptionId kVisitsId{"visits", "Visits",
                          "Number of visits per move to search."};
 const OptionId kTimeMsId{"movetime", "MoveTime",
                          "Time per move, in milliseconds."};
+const OptionId kFullSearchFractionId{
+    "full-search-fraction", "FullSearchFraction",
+    "Playout cap randomization: the fraction of the moves searched with the "
+    "full visits/playouts/movetime limits. The other moves are searched with "
+    "FastVisits visits and without noise, and are left out of the training "
+    "data."};
+const OptionId kFastVisitsId{
+    "fast-visits", "FastVisits",
+    "Visits per move of the fast searches of playout cap randomization."};
 const OptionId kTrainingId{
     "training", "Training",
     "Enables writing training data. The training data is stored into a "
     "temporary subdirectory that the engine creates."};
+const OptionId kSparseTrainingId{
+    "sparse-training", "SparseTraining",
+    "Write training data in the V7 format, which stores the policy of legal "
+    "moves only. The reader expands it back to V6."};
+const OptionId kTrainingQueueId{
+    "training-queue", "TrainingQueue",
+    "Number of finished games that may wait for the background thread that "
+    "compresses and writes training data. 0 writes the data on the game "
+    "thread."};
+const OptionId kTrainingCompressionId{
+    "training-compression", "TrainingCompression",
+    "zlib compression level of training data files, 1 is the fastest."};
+const OptionId kUploadUrlId{
+    "upload-url", "UploadUrl",
+    "Send the training data to this URL (\"http://<host>[:<port>]/<path>\") "
+    "by HTTP POST, in gzip chunks of several games, rather than writing a "
+    "file per game. Chunks that can't be sent are written to files."};
+const OptionId kUploadChunkGamesId{
+    "upload-chunk-games", "UploadChunkGames",
+    "Number of games per chunk of uploaded training data."};
 const OptionId kVerboseThinkingId{"verbose-thinking", "VerboseThinking",
                                   "Show verbose thinking messages."};
 const OptionId kMoveThinkingId{"move-thinking", "MoveThinking",
@@ -77,8 +138,25 @@ const OptionId kOpeningsMirroredId{
     "mirror-openings", "MirrorOpenings",
     "If true, each opening will be played in pairs. "
     "Not really compatible with openings mode random."};
+const OptionId kSeedBookCacheId{
+    "seed-book-cache", "SeedBookCache",
+    "Evaluate the positions where the openings end once at start, and keep "
+    "them in the NN cache for all the games."};
+const OptionId kTreeCachePliesId{
+    "tree-cache-plies", "TreeCachePlies",
+    "Number of first plies of every game whose search trees are kept, for "
+    "the games that reach the same positions to start from. Only with shared "
+    "trees, 0 to disable."};
+const OptionId kTreeCacheSizeId{
+    "tree-cache-size", "TreeCacheSize",
+    "Maximum number of positions with search trees kept by TreeCachePlies."};
 const OptionId kOpeningsModeId{"openings-mode", "OpeningsMode",
                                "A choice of sequential, shuffled, or random."};
+const OptionId kCheckpointId{
+    "checkpoint", "Checkpoint",
+    "File recording the finished games. A tournament restarted with the same "
+    "file doesn't play them again and keeps their results, games which were "
+    "in progress are played from their start."};
 const OptionId kSyzygyTablebaseId{
     "syzygy-paths", "SyzygyPath",
     "List of Syzygy tablebase directories, list entries separated by system "
@@ -99,27 +177,47 @@ void SelfPlayTournament::PopulateOptions(OptionsParser* options) {
   }
 
   NetworkFactory::PopulateOptions(options);
-  options->Add<IntOption>(kThreadsId, 1, 8) = 1;
+  options->Add<IntOption>(kThreadsId, 1, 64) = 1;
   options->Add<IntOption>(kNNCacheSizeId, 0, 999999999) = 2000000;
+  options->Add<ChoiceOption>(kNNCacheEvictionId,
+                             GetCacheEvictionPolicyNames()) = "fifo";
   SearchParams::Populate(options);
 
   options->Add<BoolOption>(kShareTreesId) = true;
+  options->Add<BoolOption>(kShareCacheId) = false;
   options->Add<IntOption>(kTotalGamesId, -2, 999999) = -1;
-  options->Add<IntOption>(kParallelGamesId, 1, 256) = 8;
+  options->Add<IntOption>(kParallelGamesId, 1, 4096) = 8;
+  options->Add<IntOption>(kMaxParallelGamesId, 0, 4096) = 0;
+  options->Add<IntOption>(kAutoscaleIntervalId, 1, 3600) = 30;
+  options->Add<BoolOption>(kLockstepId) = false;
+  options->Add<IntOption>(kLockstepTimeoutId, 0, 1000000) = 1000;
   options->Add<IntOption>(kPlayoutsId, -1, 999999999) = -1;
   options->Add<IntOption>(kVisitsId, -1, 999999999) = -1;
   options->Add<IntOption>(kTimeMsId, -1, 999999999) = -1;
+  options->Add<FloatOption>(kFullSearchFractionId, 0.0f, 1.0f) = 1.0f;
+  options->Add<IntOption>(kFastVisitsId, 1, 999999999) = 100;
   options->Add<BoolOption>(kTrainingId) = false;
+  options->Add<BoolOption>(kSparseTrainingId) = false;
+  options->Add<IntOption>(kTrainingQueueId, 0, 1024) = 16;
+  options->Add<IntOption>(kTrainingCompressionId, 1, 9) = 6;
+#ifndef _WIN32
+  options->Add<StringOption>(kUploadUrlId);
+  options->Add<IntOption>(kUploadChunkGamesId, 1, 100000) = 64;
+#endif
   options->Add<BoolOption>(kVerboseThinkingId) = false;
   options->Add<BoolOption>(kMoveThinkingId) = false;
   options->Add<FloatOption>(kResignPlaythroughId, 0.0f, 100.0f) = 0.0f;
   options->Add<FloatOption>(kDiscardedStartChanceId, 0.0f, 100.0f) = 0.0f;
   options->Add<StringOption>(kOpeningsFileId) = "";
   options->Add<BoolOption>(kOpeningsMirroredId) = false;
+  options->Add<BoolOption>(kSeedBookCacheId) = false;
+  options->Add<IntOption>(kTreeCachePliesId, 0, 100) = 0;
+  options->Add<IntOption>(kTreeCacheSizeId, 1, 1000000) = 10000;
   std::vector<std::string> openings_modes = {"sequential", "shuffled",
                                              "random"};
   options->Add<ChoiceOption>(kOpeningsModeId, openings_modes) = "sequential";
 
+  options->Add<StringOption>(kCheckpointId);
   options->Add<StringOption>(kSyzygyTablebaseId);
   SelfPlayGame::PopulateUciParams(options);
 
@@ -158,14 +256,32 @@ SelfPlayTournament::SelfPlayTournament(
       kTotalGames(options.Get<int>(kTotalGamesId)),
       kShareTree(options.Get<bool>(kShareTreesId)),
       kParallelism(options.Get<int>(kParallelGamesId)),
+      kMaxParallelism(options.Get<int>(kMaxParallelGamesId)),
+      kAutoscaleInterval(options.Get<int>(kAutoscaleIntervalId)),
+      kLockstep(options.Get<bool>(kLockstepId)),
       kTraining(options.Get<bool>(kTrainingId)),
+      kSparseTraining(options.Get<bool>(kSparseTrainingId)),
       kResignPlaythrough(options.Get<float>(kResignPlaythroughId)),
       kDiscardedStartChance(options.Get<float>(kDiscardedStartChanceId)) {
+  target_parallelism_ = kParallelism;
+#ifndef _WIN32
+  if (kTraining && !options.Get<std::string>(kUploadUrlId).empty()) {
+    // The training queue size bounds the chunks waiting for the server.
+    write_queue_ = std::make_unique<TrainingDataUploader>(
+        options.Get<std::string>(kUploadUrlId),
+        options.Get<int>(kUploadChunkGamesId),
+        options.Get<int>(kTrainingQueueId),
+        options.Get<int>(kTrainingCompressionId));
+  }
+#endif
+  if (kTraining && !write_queue_ && options.Get<int>(kTrainingQueueId) > 0) {
+    write_queue_ = std::make_unique<TrainingDataWriteQueue>(
+        options.Get<int>(kTrainingQueueId),
+        options.Get<int>(kTrainingCompressionId));
+  }
   std::string book = options.Get<std::string>(kOpeningsFileId);
   if (!book.empty()) {
-    PgnReader book_reader;
-    book_reader.AddPgnFile(book);
-    openings_ = book_reader.ReleaseGames();
+    openings_ = LoadOpenings(book);
     if (options.Get<std::string>(kOpeningsModeId) == "shuffled") {
       Random::Get().Shuffle(openings_.begin(), openings_.end());
     }
@@ -174,14 +290,47 @@ SelfPlayTournament::SelfPlayTournament(
   if (kTotalGames != 1) {
     first_game_black_ = Random::Get().GetBool();
   }
+  const std::string checkpoint = options.Get<std::string>(kCheckpointId);
+  if (!checkpoint.empty()) {
+    checkpoint_ = std::make_unique<CheckpointJournal>(checkpoint);
+    // Each record is game id, whether player1 was black, player1's result,
+    // moves and nodes.
+    for (const auto& record : checkpoint_->GetRecords()) {
+      std::istringstream in(record);
+      int game_id, player1_black, result, moves;
+      uint64_t nodes;
+      if (!(in >> game_id >> player1_black >> result >> moves >> nodes) ||
+          result < 0 || result > 2 || !finished_games_.insert(game_id).second) {
+        continue;
+      }
+      // Keep the colors of the games still to play.
+      first_game_black_ = (player1_black != 0) != (game_id % 2 == 1);
+      ++tournament_info_.results[result][player1_black ? 1 : 0];
+      tournament_info_.move_count_ += moves;
+      tournament_info_.nodes_total_ += nodes;
+    }
+    if (!finished_games_.empty()) {
+      CERR << "Resuming after " << finished_games_.size()
+           << " finished games.";
+    }
+  }
 
   // Initializing networks.
+  if (kLockstep) {
+    lockstep_batcher_ = std::make_unique<LockstepBatcher>(
+        std::chrono::microseconds(options.Get<int>(kLockstepTimeoutId)));
+  }
   for (const auto& name : {"player1", "player2"}) {
     for (const auto& color : {"white", "black"}) {
       const auto& opts = options.GetSubdict(name).GetSubdict(color);
       const auto config = NetworkFactory::BackendConfiguration(opts);
       if (networks_.find(config) == networks_.end()) {
-        networks_.emplace(config, NetworkFactory::LoadNetwork(opts));
+        auto network = NetworkFactory::LoadNetwork(opts);
+        if (kLockstep) {
+          network = std::make_unique<LockstepNetwork>(
+              std::move(network), lockstep_batcher_.get());
+        }
+        networks_.emplace(config, std::move(network));
       }
     }
   }
@@ -189,11 +338,44 @@ SelfPlayTournament::SelfPlayTournament(
   // Initializing cache.
   cache_[0] = std::make_shared<NNCache>(
       options.GetSubdict("player1").Get<int>(kNNCacheSizeId));
-  if (kShareTree) {
+  cache_[0]->SetEvictionPolicy(ParseCacheEvictionPolicy(
+      options.GetSubdict("player1").Get<std::string>(kNNCacheEvictionId)));
+  bool share_cache = kShareTree;
+  if (options.Get<bool>(kShareCacheId)) {
+    // Evaluations are only interchangeable between the same networks.
+    share_cache = true;
+    for (const auto& color : {"white", "black"}) {
+      share_cache &= NetworkFactory::BackendConfiguration(
+                         options.GetSubdict("player1").GetSubdict(color)) ==
+                     NetworkFactory::BackendConfiguration(
+                         options.GetSubdict("player2").GetSubdict(color));
+    }
+  }
+  if (share_cache) {
     cache_[1] = cache_[0];
   } else {
     cache_[1] = std::make_shared<NNCache>(
         options.GetSubdict("player2").Get<int>(kNNCacheSizeId));
+    cache_[1]->SetEvictionPolicy(ParseCacheEvictionPolicy(
+        options.GetSubdict("player2").Get<std::string>(kNNCacheEvictionId)));
+  }
+
+  if (kShareTree && options.Get<int>(kTreeCachePliesId) > 0) {
+    tree_cache_ = std::make_unique<SelfPlayTreeCache>(
+        options.Get<int>(kTreeCachePliesId),
+        options.Get<int>(kTreeCacheSizeId));
+  }
+
+  if (options.Get<bool>(kSeedBookCacheId) && !openings_.empty()) {
+    for (int pl_idx : {0, 1}) {
+      if (pl_idx == 1 && cache_[1] == cache_[0]) break;
+      const auto& opts = player_options_[pl_idx][0];
+      const int kept = SeedCacheWithOpenings(
+          openings_,
+          networks_[NetworkFactory::BackendConfiguration(opts)].get(),
+          cache_[pl_idx].get(), SearchParams(opts));
+      CERR << "Kept " << kept << " opening end positions in the NN cache.";
+    }
   }
 
   // SearchLimits.
@@ -207,6 +389,8 @@ SelfPlayTournament::SelfPlayTournament(
       limits.playouts = dict.Get<int>(kPlayoutsId);
       limits.visits = dict.Get<int>(kVisitsId);
       limits.movetime = dict.Get<int>(kTimeMsId);
+      limits.full_search_fraction = dict.Get<float>(kFullSearchFractionId);
+      limits.fast_visits = dict.Get<int>(kFastVisitsId);
 
       if (limits.playouts == -1 && limits.visits == -1 &&
           limits.movetime == -1) {
@@ -271,9 +455,12 @@ void SelfPlayTournament::PlayOneGame(int game_number) {
     opt.network = networks_[NetworkFactory::BackendConfiguration(
                                 player_options_[pl_idx][color])]
                       .get();
+    if (kLockstep) opt.lockstep = static_cast<LockstepNetwork*>(opt.network);
     opt.cache = cache_[pl_idx].get();
     opt.uci_options = &player_options_[pl_idx][color];
     opt.search_limits = search_limits_[pl_idx][color];
+    opt.tree_cache = tree_cache_.get();
+    opt.lean_search = !verbose_thinking && !move_thinking;
 
     // "bestmove" callback.
     opt.best_move_callback = [this, game_number, pl_idx, player1_black,
@@ -353,6 +540,19 @@ void SelfPlayTournament::PlayOneGame(int game_number) {
 
   // If game was aborted, it's still undecided.
   if (game.GetGameResult() != GameResult::UNDECIDED) {
+    int result = game.GetGameResult() == GameResult::DRAW
+                     ? 1
+                     : game.GetGameResult() == GameResult::WHITE_WON ? 0 : 2;
+    if (player1_black) result = 2 - result;
+    // The game is checkpointed once its training data is complete.
+    std::ostringstream record;
+    record << game_number << ' ' << player1_black << ' ' << result << ' '
+           << game.move_count_ << ' ' << game.nodes_total_;
+    const auto finish = [this, record = record.str()](const GameInfo& info) {
+      if (checkpoint_) checkpoint_->Append(record);
+      game_callback_(info);
+    };
+
     // Game callback.
     GameInfo game_info;
     game_info.game_result = game.GetGameResult();
@@ -367,20 +567,27 @@ void SelfPlayTournament::PlayOneGame(int game_number) {
     }
     if (kTraining &&
         game_info.play_start_ply < static_cast<int>(game_info.moves.size())) {
-      TrainingDataWriter writer(game_number);
-      game.WriteTrainingData(&writer);
-      writer.Finalize();
-      game_info.training_filename = writer.GetFileName();
+      if (write_queue_) {
+        // The game is reported once its file is complete.
+        TrainingDataWriter writer(game_number, kSparseTraining,
+                                  write_queue_.get());
+        game.WriteTrainingData(&writer);
+        game_info.training_filename = writer.GetFileName();
+        writer.Finalize([finish, game_info]() { finish(game_info); });
+      } else {
+        TrainingDataWriter writer(game_number, kSparseTraining);
+        game.WriteTrainingData(&writer);
+        writer.Finalize();
+        game_info.training_filename = writer.GetFileName();
+        finish(game_info);
+      }
+    } else {
+      finish(game_info);
     }
-    game_callback_(game_info);
 
     // Update tournament stats.
     {
       Mutex::Lock lock(mutex_);
-      int result = game.GetGameResult() == GameResult::DRAW
-                       ? 1
-                       : game.GetGameResult() == GameResult::WHITE_WON ? 0 : 2;
-      if (player1_black) result = 2 - result;
       ++tournament_info_.results[result][player1_black ? 1 : 0];
       tournament_info_.move_count_ += game.move_count_;
       tournament_info_.nodes_total_ += game.nodes_total_;
@@ -400,30 +607,127 @@ void SelfPlayTournament::Worker() {
     int game_id;
     {
       Mutex::Lock lock(mutex_);
-      if (abort_) break;
+      while (finished_games_.count(games_count_)) ++games_count_;
       bool mirrored = player_options_[0][0].Get<bool>(kOpeningsMirroredId);
-      if ((kTotalGames >= 0 && games_count_ >= kTotalGames) ||
+      if (abort_ || (kTotalGames >= 0 && games_count_ >= kTotalGames) ||
           (kTotalGames == -2 && !openings_.empty() &&
            games_count_ >=
-               static_cast<int>(openings_.size()) * (mirrored ? 2 : 1)))
+               static_cast<int>(openings_.size()) * (mirrored ? 2 : 1)) ||
+          running_workers_ > target_parallelism_) {
+        --running_workers_;
+        autoscale_cv_.notify_all();
         break;
+      }
       game_id = games_count_++;
     }
     PlayOneGame(game_id);
   }
 }
 
-void SelfPlayTournament::StartAsync() {
+void SelfPlayTournament::StartWorkers() {
   Mutex::Lock lock(threads_mutex_);
-  while (threads_.size() < kParallelism) {
-    threads_.emplace_back([&]() { Worker(); });
+  size_t count;
+  {
+    Mutex::Lock games_lock(mutex_);
+    if (abort_ || running_workers_ >= target_parallelism_) return;
+    count = target_parallelism_ - running_workers_;
+    running_workers_ += count;
+  }
+  while (count-- > 0) threads_.emplace_back([&]() { Worker(); });
+}
+
+uint64_t SelfPlayTournament::CountNodes() {
+  Mutex::Lock lock(mutex_);
+  uint64_t nodes = tournament_info_.nodes_total_;
+  for (auto& game : games_) nodes += game->nodes_total_;
+  return nodes;
+}
+
+void SelfPlayTournament::Autoscaler() {
+  const auto interval = std::chrono::seconds(kAutoscaleInterval);
+  auto last_time = std::chrono::steady_clock::now();
+  uint64_t last_nodes = CountNodes();
+  int last_games = 0;
+  double last_rate = 0.0;
+  // Number of games before the last increase, if it is still being measured.
+  size_t previous_target = 0;
+  // Intervals to wait before trying to increase the number of games again.
+  int cooldown = 0;
+  while (true) {
+    size_t target;
+    int games;
+    {
+      Mutex::Lock lock(mutex_);
+      autoscale_cv_.wait_for(lock.get_raw(), interval, [&]() {
+        return abort_ || running_workers_ == 0;
+      });
+      if (abort_ || running_workers_ == 0) return;
+      target = target_parallelism_;
+      games = 0;
+      for (const auto& x : tournament_info_.results) games += x[0] + x[1];
+    }
+    const auto now = std::chrono::steady_clock::now();
+    const uint64_t nodes = CountNodes();
+    const double seconds =
+        std::chrono::duration<double>(now - last_time).count();
+    const double rate = (nodes - last_nodes) / seconds;
+    const double games_per_hour = (games - last_games) * 3600.0 / seconds;
+    // How full the batches are, when lockstep measures it.
+    float fill = -1.0f;
+    if (kLockstep) {
+      for (auto& network : networks_) {
+        fill = std::max(
+            fill, static_cast<LockstepNetwork*>(network.second.get())
+                      ->TakeStepFill());
+      }
+    }
+    last_time = now;
+    last_nodes = nodes;
+    last_games = games;
+
+    size_t increased_from = 0;
+    if (previous_target != 0 && rate < last_rate * 1.02) {
+      // The added games didn't pay off, go back and stay there for a while.
+      target = previous_target;
+      cooldown = 10;
+    } else if (cooldown > 0) {
+      --cooldown;
+    } else if (target < kMaxParallelism && fill < 0.95f) {
+      // More games while the batches are not full (or fill is unknown).
+      increased_from = target;
+      target = std::min(kMaxParallelism,
+                        target + std::max<size_t>(1, target / 4));
+    }
+    previous_target = increased_from;
+    CERR << "Autoscale: " << std::fixed << std::setprecision(0) << rate
+         << " nodes/s, " << games_per_hour << " games/h"
+         << (fill < 0.0f ? "" : ", batch fill " + std::to_string(fill))
+         << ", " << target << " parallel games.";
+    last_rate = rate;
+    {
+      Mutex::Lock lock(mutex_);
+      target_parallelism_ = target;
+    }
+    StartWorkers();
+  }
+}
+
+void SelfPlayTournament::StartAsync() {
+  StartWorkers();
+  if (kMaxParallelism > kParallelism && !autoscaler_.joinable()) {
+    autoscaler_ = std::thread([&]() { Autoscaler(); });
   }
 }
 
 void SelfPlayTournament::RunBlocking() {
-  if (kParallelism == 1) {
+  if (kParallelism == 1 && kMaxParallelism <= 1) {
     // No need for multiple threads if there is one worker.
+    {
+      Mutex::Lock lock(mutex_);
+      ++running_workers_;
+    }
     Worker();
+    if (write_queue_) write_queue_->Flush();
     Mutex::Lock lock(mutex_);
     if (!abort_) {
       tournament_info_.finished = true;
@@ -436,6 +740,8 @@ void SelfPlayTournament::RunBlocking() {
 }
 
 void SelfPlayTournament::Wait() {
+  // Stops once the workers run out of games.
+  if (autoscaler_.joinable()) autoscaler_.join();
   {
     Mutex::Lock lock(threads_mutex_);
     while (!threads_.empty()) {
@@ -443,6 +749,7 @@ void SelfPlayTournament::Wait() {
       threads_.pop_back();
     }
   }
+  if (write_queue_) write_queue_->Flush();
   {
     Mutex::Lock lock(mutex_);
     if (!abort_) {
@@ -455,6 +762,7 @@ void SelfPlayTournament::Wait() {
 void SelfPlayTournament::Abort() {
   Mutex::Lock lock(mutex_);
   abort_ = true;
+  autoscale_cv_.notify_all();
   for (auto& game : games_)
     if (game) game->Abort();
 }
@@ -462,6 +770,7 @@ void SelfPlayTournament::Abort() {
 void SelfPlayTournament::Stop() {
   Mutex::Lock lock(mutex_);
   abort_ = true;
+  autoscale_cv_.notify_all();
 }
 
 SelfPlayTournament::~SelfPlayTournament() {
@@ -27,11 +27,18 @@
 
 #pragma once
 
+#include <condition_variable>
 #include <list>
+#include <thread>
+#include <unordered_set>
 
 #include "chess/pgn.h"
 #include "neural/factory.h"
 #include "selfplay/game.h"
+#include "selfplay/lockstep.h"
+#include "selfplay/treecache.h"
+#include "trainingdata/writer.h"
+#include "utils/checkpoint.h"
 #include "utils/mutex.h"
 #include "utils/optionsdict.h"
 #include "utils/optionsparser.h"
@@ -71,6 +78,12 @@ class SelfPlayTournament {
  private:
   void Worker();
   void PlayOneGame(int game_id);
+  // Starts workers until target_parallelism_ of them run.
+  void StartWorkers();
+  // Adjusts target_parallelism_ to the measured throughput.
+  void Autoscaler();
+  // Nodes searched by the finished and the ongoing games.
+  uint64_t CountNodes();
 
   Mutex mutex_;
   // Whether first game will be black for player1.
@@ -78,7 +91,14 @@ class SelfPlayTournament {
   std::vector<Opening> discard_pile_ GUARDED_BY(mutex_);
   // Number of games which already started.
   int games_count_ GUARDED_BY(mutex_) = 0;
+  // Games finished before a restart, which are not played again.
+  std::unordered_set<int> finished_games_ GUARDED_BY(mutex_);
   bool abort_ GUARDED_BY(mutex_) = false;
+  // Number of games to play in parallel, and of workers playing them.
+  size_t target_parallelism_ GUARDED_BY(mutex_) = 0;
+  size_t running_workers_ GUARDED_BY(mutex_) = 0;
+  // Notified when workers stop or the tournament is aborted.
+  std::condition_variable autoscale_cv_;
   std::vector<Opening> openings_ GUARDED_BY(mutex_);
   // Games in progress. Exposed here to be able to abort them in case if
   // Abort(). Stored as list and not vector so that threads can keep iterators
@@ -89,11 +109,16 @@ class SelfPlayTournament {
 
   Mutex threads_mutex_;
   std::vector<std::thread> threads_ GUARDED_BY(threads_mutex_);
+  std::thread autoscaler_;
 
+  // Shared by all the networks when in lockstep, so it outlives them.
+  std::unique_ptr<LockstepBatcher> lockstep_batcher_;
   // Map from the backend configuration to a network.
   std::map<NetworkFactory::BackendConfiguration, std::unique_ptr<Network>>
       networks_;
   std::shared_ptr<NNCache> cache_[2];
+  // Search trees of the first plies, if shared between games.
+  std::unique_ptr<SelfPlayTreeCache> tree_cache_;
   // [player1 or player2][white or black].
   const OptionsDict player_options_[2][2];
   SelfPlayLimits search_limits_[2][2];
@@ -105,11 +130,20 @@ class SelfPlayTournament {
   const int kTotalGames;
   const bool kShareTree;
   const size_t kParallelism;
+  const size_t kMaxParallelism;
+  const int kAutoscaleInterval;
+  const bool kLockstep;
   const bool kTraining;
+  const bool kSparseTraining;
   const float kResignPlaythrough;
   const float kDiscardedStartChance;
 
   std::unique_ptr<SyzygyTablebase> syzygy_tb_;
+  // Records the finished games, if enabled. Outlives the write queue, which
+  // reports the games.
+  std::unique_ptr<CheckpointJournal> checkpoint_;
+  // Writes training data off the game threads, if enabled.
+  std::unique_ptr<TrainingDataSink> write_queue_;
 
 };
 
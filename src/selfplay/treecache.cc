@@ -0,0 +1,76 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "selfplay/treecache.h"
+
+namespace lczero {
+
+SelfPlayTreeCache::SelfPlayTreeCache(int max_plies, size_t capacity)
+    : max_plies_(max_plies), capacity_(capacity) {}
+
+void SelfPlayTreeCache::Store(const NodeTree& tree) {
+  const auto& history = tree.GetPositionHistory();
+  const uint64_t key = history.HashLast(history.GetLength());
+  const uint32_t visits = tree.GetCurrentHead()->GetN();
+  if (visits == 0) return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto iter = entries_.find(key);
+    if (iter != entries_.end() && iter->second.visits >= visits) return;
+  }
+  // Snapshots are taken without the lock, as they take a while.
+  auto snapshot = std::make_shared<const std::string>(tree.SnapshotHead());
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto [iter, inserted] = entries_.try_emplace(key, Entry{0, nullptr});
+  if (!inserted && iter->second.visits >= visits) return;
+  iter->second = Entry{visits, std::move(snapshot)};
+  if (!inserted) return;
+  order_.push_back(key);
+  if (order_.size() > capacity_) {
+    entries_.erase(order_.front());
+    order_.pop_front();
+  }
+}
+
+bool SelfPlayTreeCache::Restore(NodeTree* tree) {
+  const auto& history = tree->GetPositionHistory();
+  const uint64_t key = history.HashLast(history.GetLength());
+  std::shared_ptr<const std::string> snapshot;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto iter = entries_.find(key);
+    if (iter == entries_.end() ||
+        iter->second.visits <= tree->GetCurrentHead()->GetN()) {
+      return false;
+    }
+    snapshot = iter->second.snapshot;
+  }
+  tree->TrimTreeAtHead();
+  return tree->RestoreHead(*snapshot);
+}
+
+}  // namespace lczero
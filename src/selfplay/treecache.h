@@ -0,0 +1,75 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "mcts/node.h"
+
+namespace lczero {
+
+// Search trees of the first plies of selfplay games, shared between the games
+// which reach the same positions, e.g. from the same opening. A subtree is
+// taken from below the root of a search, so it holds no root noise, and a game
+// which continues it still spends the rest of its visits with noise of its own.
+class SelfPlayTreeCache {
+ public:
+  // Keeps trees of positions up to @max_plies searched plies into a game, of
+  // at most @capacity positions. The oldest are dropped first.
+  SelfPlayTreeCache(int max_plies, size_t capacity);
+
+  // Whether the position of the search number @ply of a game is cached.
+  bool IsCachedPly(int ply) const { return ply < max_plies_; }
+
+  // Keeps the subtree under the head of @tree, unless one with at least as
+  // many visits is kept for the same game history.
+  void Store(const NodeTree& tree);
+  // Replaces the subtree under the head of @tree by the kept one, if it has
+  // more visits. Returns whether it did.
+  bool Restore(NodeTree* tree);
+
+ private:
+  struct Entry {
+    uint32_t visits;
+    std::shared_ptr<const std::string> snapshot;
+  };
+
+  const int max_plies_;
+  const size_t capacity_;
+  std::mutex mutex_;
+  std::unordered_map<uint64_t, Entry> entries_;
+  // Keys in the order they were first stored.
+  std::deque<uint64_t> order_;
+};
+
+}  // namespace lczero
@@ -0,0 +1,226 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "selfplay/uploader.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "neural/remote/protocol.h"
+#include "utils/exception.h"
+#include "utils/logging.h"
+
+namespace lczero {
+namespace {
+
+// Attempts to deliver a chunk before writing it to a file, with a doubling
+// pause between them.
+constexpr int kSendAttempts = 3;
+
+std::string GzipCompress(const std::string& data, int level) {
+  z_stream stream{};
+  // 16 added to the window bits asks for a gzip header.
+  if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    throw Exception("Cannot initialize gzip compression.");
+  }
+  std::string out(deflateBound(&stream, data.size()), '\0');
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = data.size();
+  stream.next_out = reinterpret_cast<Bytef*>(&out[0]);
+  stream.avail_out = out.size();
+  const int result = deflate(&stream, Z_FINISH);
+  out.resize(stream.total_out);
+  deflateEnd(&stream);
+  if (result != Z_STREAM_END) throw Exception("Gzip compression failed.");
+  return out;
+}
+
+}  // namespace
+
+TrainingDataUploader::TrainingDataUploader(const std::string& url,
+                                           int chunk_games, size_t max_pending,
+                                           int level)
+    : url_(url),
+      chunk_games_(std::max(chunk_games, 1)),
+      max_pending_(std::max<size_t>(max_pending, 1)),
+      level_(level) {
+  const std::string scheme = "http://";
+  if (url.compare(0, scheme.size(), scheme) != 0) {
+    throw Exception("Upload URL must start with " + scheme + ": " + url);
+  }
+  const size_t path_start = url.find('/', scheme.size());
+  host_ = url.substr(scheme.size(), path_start - scheme.size());
+  path_ = path_start == std::string::npos ? "/" : url.substr(path_start);
+  if (host_.empty()) throw Exception("No host in upload URL: " + url);
+  // Bracketed IPv6 addresses have colons of their own.
+  const size_t port_colon = host_.rfind(':');
+  const bool has_port =
+      port_colon != std::string::npos && host_.find(']', port_colon) ==
+                                             std::string::npos;
+  address_ = has_port ? host_ : host_ + ":80";
+  thread_ = std::thread([this]() { Worker(); });
+}
+
+TrainingDataUploader::~TrainingDataUploader() {
+  {
+    Mutex::Lock lock(mutex_);
+    if (!current_.filenames.empty()) {
+      chunks_.push_back(std::move(current_));
+      current_ = Chunk();
+    }
+    exiting_ = true;
+  }
+  chunk_added_.notify_all();
+  thread_.join();
+}
+
+void TrainingDataUploader::Submit(std::string filename, std::string data,
+                                  std::function<void()> done) {
+  {
+    Mutex::Lock lock(mutex_);
+    current_.filenames.push_back(std::move(filename));
+    current_.sizes.push_back(data.size());
+    current_.data += data;
+    if (done) current_.done.push_back(std::move(done));
+    if (current_.filenames.size() < chunk_games_) return;
+    // Backpressure: the games wait while the server is behind.
+    chunk_done_.wait(lock.get_raw(), [&]() NO_THREAD_SAFETY_ANALYSIS {
+      return chunks_.size() < max_pending_;
+    });
+    chunks_.push_back(std::move(current_));
+    current_ = Chunk();
+  }
+  chunk_added_.notify_one();
+}
+
+void TrainingDataUploader::Flush() {
+  Mutex::Lock lock(mutex_);
+  if (!current_.filenames.empty()) {
+    chunks_.push_back(std::move(current_));
+    current_ = Chunk();
+    chunk_added_.notify_one();
+  }
+  chunk_done_.wait(lock.get_raw(), [&]() NO_THREAD_SAFETY_ANALYSIS {
+    return chunks_.empty() && !busy_;
+  });
+}
+
+bool TrainingDataUploader::Send(const Chunk& chunk) {
+  const std::string compressed = GzipCompress(chunk.data, level_);
+  std::string sizes;
+  for (uint64_t size : chunk.sizes) {
+    if (!sizes.empty()) sizes += ',';
+    sizes += std::to_string(size);
+  }
+  const std::string payload =
+      "POST " + path_ + " HTTP/1.1\r\nHost: " + host_ +
+      "\r\nContent-Type: application/gzip\r\nContent-Length: " +
+      std::to_string(compressed.size()) + "\r\nX-Lc0-Game-Sizes: " + sizes +
+      "\r\nConnection: close\r\n\r\n" + compressed;
+
+  auto pause = std::chrono::seconds(1);
+  for (int attempt = 0; attempt < kSendAttempts; ++attempt) {
+    if (attempt > 0) {
+      std::this_thread::sleep_for(pause);
+      pause *= 2;
+    }
+    try {
+      remote::Socket socket = remote::Socket::Connect(address_);
+      socket.Write(payload.data(), payload.size());
+      // Only the status line matters, e.g. "HTTP/1.1 200 OK".
+      std::string status;
+      for (char c = 0; c != '\n' && status.size() < 256;) {
+        socket.Read(&c, 1);
+        status += c;
+      }
+      const size_t code = status.find(' ');
+      if (status.compare(0, 5, "HTTP/") != 0 || code == std::string::npos ||
+          status[code + 1] != '2') {
+        throw Exception("Server responded " +
+                        status.substr(0, status.find('\r')));
+      }
+      return true;
+    } catch (const Exception& e) {
+      CERR << "Uploading training data to " << url_ << " failed: " << e.what();
+    }
+  }
+  return false;
+}
+
+void TrainingDataUploader::Spill(const Chunk& chunk) {
+  const std::string& filename = chunk.filenames.front();
+  gzFile fout = gzopen(filename.c_str(),
+                       ("wb" + std::to_string(level_)).c_str());
+  if (!fout) {
+    CERR << "Cannot create gzip file " << filename;
+    return;
+  }
+  const int size = chunk.data.size();
+  if (gzwrite(fout, chunk.data.data(), size) != size) {
+    CERR << "Unable to write into " << filename;
+  }
+  gzclose(fout);
+  CERR << "Wrote " << chunk.filenames.size() << " games into " << filename
+       << " instead.";
+}
+
+void TrainingDataUploader::Worker() {
+  while (true) {
+    Chunk chunk;
+    {
+      Mutex::Lock lock(mutex_);
+      chunk_added_.wait(lock.get_raw(), [&]() NO_THREAD_SAFETY_ANALYSIS {
+        return exiting_ || !chunks_.empty();
+      });
+      // Exits only once the queue is drained.
+      if (chunks_.empty()) return;
+      chunk = std::move(chunks_.front());
+      chunks_.pop_front();
+      busy_ = true;
+    }
+    chunk_done_.notify_all();
+    // An exception would end the thread, so failures are only logged.
+    bool sent = false;
+    try {
+      sent = Send(chunk);
+    } catch (const Exception& e) {
+      CERR << e.what();
+    }
+    if (!sent) Spill(chunk);
+    for (auto& done : chunk.done) done();
+    {
+      Mutex::Lock lock(mutex_);
+      busy_ = false;
+    }
+    chunk_done_.notify_all();
+  }
+}
+
+}  // namespace lczero
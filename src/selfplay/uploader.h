@@ -0,0 +1,102 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "trainingdata/writer.h"
+#include "utils/mutex.h"
+
+namespace lczero {
+
+// Sends the finished games of selfplay to a collecting server, several games
+// per chunk, rather than writing a file per game.
+//
+// Every chunk is an HTTP POST of one gzip stream of the records of all its
+// games, with Content-Type application/gzip. The uncompressed sizes of the
+// records of each game, which tell the games apart, are listed in order and
+// comma separated in the X-Lc0-Game-Sizes header. Any 2xx response means the
+// chunk was stored. Chunks that can't be delivered are written as gzip files
+// instead, at the place of the first game of the chunk, so that no game is
+// lost.
+class TrainingDataUploader : public TrainingDataSink {
+ public:
+  // @url is "http://<host>[:<port>][/<path>]". Chunks are sent once they hold
+  // @chunk_games games, Submit() blocks while @max_pending chunks wait to be
+  // sent. @level is the zlib compression level. Throws Exception if @url
+  // isn't such a URL.
+  TrainingDataUploader(const std::string& url, int chunk_games,
+                       size_t max_pending, int level);
+  // Sends all the games, including those of an incomplete chunk.
+  ~TrainingDataUploader();
+
+  void Submit(std::string filename, std::string data,
+              std::function<void()> done) override;
+  // Sends the incomplete chunk too, and waits until everything is delivered.
+  void Flush() override;
+
+ private:
+  struct Chunk {
+    std::vector<std::string> filenames;
+    std::vector<uint64_t> sizes;
+    std::string data;
+    std::vector<std::function<void()>> done;
+  };
+
+  void Worker();
+  // Returns whether the server acknowledged the chunk.
+  bool Send(const Chunk& chunk);
+  void Spill(const Chunk& chunk);
+
+  const std::string url_;
+  // "<host>:<port>" as remote::Socket::Connect() takes it.
+  std::string address_;
+  // Value of the Host header.
+  std::string host_;
+  std::string path_;
+  const size_t chunk_games_;
+  const size_t max_pending_;
+  const int level_;
+
+  Mutex mutex_;
+  std::condition_variable chunk_added_;
+  std::condition_variable chunk_done_;
+  // Chunk being filled by Submit().
+  Chunk current_ GUARDED_BY(mutex_);
+  std::deque<Chunk> chunks_ GUARDED_BY(mutex_);
+  bool busy_ GUARDED_BY(mutex_) = false;
+  bool exiting_ GUARDED_BY(mutex_) = false;
+  std::thread thread_;
+};
+
+}  // namespace lczero
@@ -0,0 +1,92 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "syzygy/async_prober.h"
+
+#include <algorithm>
+
+namespace lczero {
+
+AsyncWdlProber::AsyncWdlProber(SyzygyTablebase* tablebase, int threads)
+    : tablebase_(tablebase), thread_count_(std::max(threads, 1)) {
+  for (size_t i = 0; i < thread_count_; ++i) {
+    threads_.emplace_back([this]() { Worker(); });
+  }
+}
+
+AsyncWdlProber::~AsyncWdlProber() {
+  {
+    Mutex::Lock lock(mutex_);
+    exiting_ = true;
+  }
+  request_added_.notify_all();
+  for (auto& thread : threads_) thread.join();
+}
+
+std::future<AsyncWdlProber::Result> AsyncWdlProber::Probe(
+    const Position& pos) {
+  std::promise<Result> promise;
+  auto future = promise.get_future();
+  {
+    Mutex::Lock lock(mutex_);
+    requests_.emplace_back(pos, std::move(promise));
+  }
+  request_added_.notify_one();
+  return future;
+}
+
+void AsyncWdlProber::Worker() {
+  std::deque<Request> batch;
+  std::vector<Position> positions;
+  while (true) {
+    {
+      Mutex::Lock lock(mutex_);
+      request_added_.wait(lock.get_raw(), [&]() NO_THREAD_SAFETY_ANALYSIS {
+        return exiting_ || !requests_.empty();
+      });
+      // Exits only once the queue is drained.
+      if (requests_.empty()) return;
+      // Takes a fair share of the queue, so that probes a search thread queued
+      // together are spread over the threads.
+      const size_t count =
+          (requests_.size() + thread_count_ - 1) / thread_count_;
+      for (size_t i = 0; i < count; ++i) {
+        batch.push_back(std::move(requests_.front()));
+        requests_.pop_front();
+      }
+    }
+    positions.clear();
+    for (const auto& request : batch) positions.push_back(request.first);
+    const auto results = tablebase_->probe_wdl_batch(positions);
+    for (size_t i = 0; i < batch.size(); ++i) {
+      batch[i].second.set_value(results[i]);
+    }
+    batch.clear();
+  }
+}
+
+}  // namespace lczero
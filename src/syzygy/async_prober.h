@@ -0,0 +1,73 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "syzygy/syzygy.h"
+#include "utils/mutex.h"
+
+namespace lczero {
+
+// Probes WDL tables on a few background threads, so that the threads asking
+// for probes don't stall while the tables are read from disk.
+class AsyncWdlProber {
+ public:
+  using Result = WDLProbeResult;
+
+  // Probes @tablebase on @threads threads (at least one).
+  AsyncWdlProber(SyzygyTablebase* tablebase, int threads);
+  AsyncWdlProber(const AsyncWdlProber&) = delete;
+  AsyncWdlProber& operator=(const AsyncWdlProber&) = delete;
+  // Finishes the queued probes and joins threads.
+  ~AsyncWdlProber();
+
+  // Queues a WDL probe of @pos. Same as SyzygyTablebase::probe_wdl(), but the
+  // result arrives through the future.
+  std::future<Result> Probe(const Position& pos);
+
+ private:
+  using Request = std::pair<Position, std::promise<Result>>;
+
+  void Worker();
+
+  SyzygyTablebase* const tablebase_;
+  const size_t thread_count_;
+  Mutex mutex_;
+  std::condition_variable request_added_;
+  std::deque<Request> requests_ GUARDED_BY(mutex_);
+  bool exiting_ GUARDED_BY(mutex_) = false;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace lczero
@@ -0,0 +1,62 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "syzygy/probe_cache.h"
+
+namespace lczero {
+namespace {
+constexpr uint64_t kValid = 1ULL << 63;
+}  // namespace
+
+ProbeCache::ProbeCache(size_t size)
+    : size_(size), entries_(std::make_unique<Entry[]>(size)) {}
+
+bool ProbeCache::Lookup(uint64_t key, int* value, int* state) {
+  lookups_.fetch_add(1, std::memory_order_relaxed);
+  const auto& entry = entries_[key % size_];
+  const uint64_t data = entry.data.load(std::memory_order_relaxed);
+  if (!(data & kValid) ||
+      (entry.check.load(std::memory_order_relaxed) ^ data) != key) {
+    return false;
+  }
+  *value = static_cast<int32_t>(static_cast<uint32_t>(data));
+  *state = static_cast<int8_t>(data >> 32);
+  hits_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+void ProbeCache::Store(uint64_t key, int value, int state) {
+  const uint64_t data = kValid |
+                        static_cast<uint64_t>(static_cast<uint8_t>(state))
+                            << 32 |
+                        static_cast<uint32_t>(value);
+  auto& entry = entries_[key % size_];
+  entry.check.store(key ^ data, std::memory_order_relaxed);
+  entry.data.store(data, std::memory_order_relaxed);
+}
+
+}  // namespace lczero
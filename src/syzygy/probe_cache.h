@@ -0,0 +1,67 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace lczero {
+
+// Fixed size cache of tablebase probe results by position hash, shared by the
+// Syzygy and Gaviota probing code. Each result is a 32 bit value with an 8 bit
+// state, whose meaning is up to the tables cached.
+// Thread safe: entries are written and read without locks, and an entry torn
+// by concurrent writes is detected and counts as a miss.
+class ProbeCache {
+ public:
+  explicit ProbeCache(size_t size);
+
+  // Looks up the result of the position with @key. Returns whether found.
+  bool Lookup(uint64_t key, int* value, int* state);
+  void Store(uint64_t key, int value, int state);
+
+  uint64_t hits() const { return hits_.load(std::memory_order_relaxed); }
+  uint64_t lookups() const { return lookups_.load(std::memory_order_relaxed); }
+
+ private:
+  struct Entry {
+    // Position hash xor data.
+    std::atomic<uint64_t> check{0};
+    // Valid bit, state and value.
+    std::atomic<uint64_t> data{0};
+  };
+
+  const size_t size_;
+  std::unique_ptr<Entry[]> entries_;
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> lookups_{0};
+};
+
+}  // namespace lczero
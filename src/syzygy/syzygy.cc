@@ -32,6 +32,7 @@
 */
 
 #include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
@@ -41,16 +42,22 @@
 #include <random>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "syzygy/syzygy.h"
 
 #include "utils/exception.h"
+#include "utils/histogram.h"
 #include "utils/logging.h"
 #include "utils/mutex.h"
 
 #ifndef _WIN32
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #else
@@ -79,6 +86,13 @@ typedef size_t map_t;
 typedef uint64_t Key;
 
 constexpr const char* kSuffix[] = {".rtbw", ".rtbm", ".rtbz"};
+// A pack file holds several table files: the header is the kPackMagic, the
+// number of tables and 4 reserved bytes, then for each table its file name
+// (NUL padded to 16 bytes), offset and size, then the tables at offsets that
+// are multiples of 64. Numbers are 32 bit and 64 bit little endian.
+constexpr const char* kPackSuffix = ".tbpack";
+constexpr char kPackMagic[8] = {'T', 'B', 'P', 'A', 'C', 'K', '0', '1'};
+constexpr size_t kPackNameLength = 16;
 constexpr uint32_t kMagic[] = {0x5d23e871, 0x88ac504b, 0xa50c66d7};
 enum { WDL, DTM, DTZ };
 
@@ -118,6 +132,8 @@ struct PairsData {
   uint8_t idxBits;
   uint8_t minLen;
   uint8_t constValue[2];
+  // Shortest possible code length for each value of a code's leading byte.
+  uint8_t lenTable[256];
   uint64_t base[1];  // must be base[1] in C++
 };
 
@@ -130,9 +146,13 @@ struct EncInfo {
 
 struct BaseEntry {
   Key key;
+  // Table name, e.g. KRvK.
+  char name[16];
   uint8_t* data[3];
   map_t mapping[3];
   std::atomic<bool> ready[3];
+  // Probes of each table, counted while statistics are collected.
+  std::atomic<uint64_t> probes[3];
   uint8_t num;
   bool symmetric;
   bool hasPawns;
@@ -700,6 +720,10 @@ uint16_t from_le_u16(uint16_t v) {
   return is_little_endian() ? v : swap_endian(v);
 }
 
+uint64_t from_le_u64(uint64_t v) {
+  return is_little_endian() ? v : swap_endian(v);
+}
+
 uint64_t from_be_u64(uint64_t v) {
   return is_little_endian() ? swap_endian(v) : v;
 }
@@ -712,6 +736,10 @@ uint32_t read_le_u32(void* p) {
   return from_le_u32(*static_cast<uint32_t*>(p));
 }
 
+uint64_t read_le_u64(void* p) {
+  return from_le_u64(*static_cast<uint64_t*>(p));
+}
+
 uint16_t read_le_u16(void* p) {
   return from_le_u16(*static_cast<uint16_t*>(p));
 }
@@ -771,6 +799,16 @@ PairsData* setup_pairs(uint8_t** ptr, size_t tb_size, size_t* size,
   }
   for (int i = 0; i < h; i++) d->base[i] <<= 64 - (min_len + i);
 
+  // Codes are canonical, so base decreases with length and the length of the
+  // largest code with a given leading byte bounds that of all the others.
+  for (int v = 0; v < 256; v++) {
+    const uint64_t largest =
+        (static_cast<uint64_t>(v) << 56) | 0x00ffffffffffffff;
+    int l = 0;
+    while (largest < d->base[l]) l++;
+    d->lenTable[v] = min_len + l;
+  }
+
   d->offset -= d->minLen;
 
   return d;
@@ -810,7 +848,7 @@ uint8_t* decompress_pairs(PairsData* d, size_t idx) {
 
   ptr += 2;
   for (;;) {
-    int l = m;
+    int l = d->lenTable[code >> 56];
     while (code < base[l]) l++;
     sym = from_le_u16(offset[l]);
     sym += (code - base[l]) >> (64 - l);
@@ -867,6 +905,16 @@ class SyzygyTablebaseImpl {
     if (paths.size() == 0 || paths == "<empty>") return;
     paths_ = paths;
 
+    std::stringstream path_string_stream(paths_);
+    std::string path;
+    while (std::getline(path_string_stream, path, SEP_CHAR)) {
+      if (path.size() >= strlen(kPackSuffix) &&
+          path.compare(path.size() - strlen(kPackSuffix), std::string::npos,
+                       kPackSuffix) == 0) {
+        load_pack(path);
+      }
+    }
+
     tb_hash_.resize(1 << TB_HASHBITS);
 
     char str[33];
@@ -993,6 +1041,55 @@ class SyzygyTablebaseImpl {
          << num_dtz_ << " DTZ tablebase files.";
   }
 
+  // Maps the WDL and DTZ tables of up to @cardinality pieces now rather than on
+  // their first probe, on @threads threads. Tables of up to @lock_cardinality
+  // pieces are locked in memory, the others are read ahead into the page
+  // cache. Returns the number of tables mapped, and sets @lock_failed if
+  // locking failed for some. Not thread safe, like construction.
+  int preload(int cardinality, int lock_cardinality, int threads,
+              bool* lock_failed) {
+    std::vector<BaseEntry*> entries;
+    for (int i = 0; i < num_piece_entries_; i++) {
+      if (piece_entries_[i].num <= cardinality) {
+        entries.push_back(&piece_entries_[i]);
+      }
+    }
+    for (int i = 0; i < num_pawn_entries_; i++) {
+      if (pawn_entries_[i].num <= cardinality) {
+        entries.push_back(&pawn_entries_[i]);
+      }
+    }
+    std::atomic<size_t> next_entry{0};
+    std::atomic<int> mapped{0};
+    std::atomic<bool> any_lock_failed{false};
+    auto worker = [&]() {
+      for (size_t i; (i = next_entry.fetch_add(1)) < entries.size();) {
+        BaseEntry* be = entries[i];
+        for (const int type : {WDL, DTZ}) {
+          if (type == DTZ && !be->hasDtz) continue;
+          if (!atomic_load_explicit(&be->ready[type],
+                                    std::memory_order_acquire)) {
+            // Failures are left for the first probe to deal with.
+            if (!init_table(be, be->name, type)) continue;
+            atomic_store_explicit(&be->ready[type], true,
+                                  std::memory_order_release);
+          }
+          mapped++;
+          if (!warm_table(be->data[type], be->mapping[type],
+                          be->num <= lock_cardinality)) {
+            any_lock_failed = true;
+          }
+        }
+      }
+    };
+    std::vector<std::thread> workers;
+    for (int i = 1; i < threads; i++) workers.emplace_back(worker);
+    worker();
+    for (auto& thread : workers) thread.join();
+    *lock_failed = any_lock_failed;
+    return mapped;
+  }
+
   ~SyzygyTablebaseImpl() {
     // if pathString was set there may be entries in need of cleaning.
     if (!paths_.empty()) {
@@ -1001,10 +1098,36 @@ class SyzygyTablebaseImpl {
       for (int i = 0; i < num_pawn_entries_; i++)
         free_tb_entry(&pawn_entries_[i]);
     }
+    for (const auto& [base_address, size] : packs_) {
+      free_pack_memory(base_address, size);
+    }
   }
 
   int max_cardinality() const { return max_cardinality_; }
 
+  void set_count_probes(bool count) {
+    count_probes_.store(count, std::memory_order_relaxed);
+  }
+
+  // Returns the probe counts of the tables probed, by file name, most probed
+  // first.
+  std::vector<std::pair<std::string, uint64_t>> table_probes() const {
+    std::vector<std::pair<std::string, uint64_t>> result;
+    const auto add = [&](const BaseEntry& be) {
+      for (int type = 0; type < 3; type++) {
+        const uint64_t probes =
+            be.probes[type].load(std::memory_order_relaxed);
+        if (probes) result.emplace_back(be.name + std::string(kSuffix[type]),
+                                        probes);
+      }
+    };
+    for (int i = 0; i < num_piece_entries_; i++) add(piece_entries_[i]);
+    for (int i = 0; i < num_pawn_entries_; i++) add(pawn_entries_[i]);
+    std::sort(result.begin(), result.end(),
+              [](const auto& a, const auto& b) { return a.second > b.second; });
+    return result;
+  }
+
   int probe_wdl_table(const ChessBoard& pos, int* success) {
     return probe_table(pos, 0, success, WDL);
   }
@@ -1031,10 +1154,89 @@ class SyzygyTablebaseImpl {
   }
 
   bool test_tb(const char* str, const char* suffix) {
-    return !name_for_tb(str, suffix).empty();
+    return packed_tables_.count(std::string(str) + suffix) != 0 ||
+           !name_for_tb(str, suffix).empty();
+  }
+
+  // Allocates memory for a pack, backed by huge pages where the OS allows.
+  uint8_t* alloc_pack_memory(size_t* size) {
+#ifndef _WIN32
+    constexpr size_t kHugePageSize = 2 << 20;
+    *size = (*size + kHugePageSize - 1) & ~(kHugePageSize - 1);
+    // Over-allocates to align the memory to huge pages and trims the rest.
+    void* raw = mmap(nullptr, *size + kHugePageSize, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) return nullptr;
+    const uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+    const uintptr_t aligned =
+        (start + kHugePageSize - 1) & ~(kHugePageSize - 1);
+    if (aligned != start) munmap(raw, aligned - start);
+    munmap(reinterpret_cast<void*>(aligned + *size),
+           start + kHugePageSize - aligned);
+#if defined(MADV_HUGEPAGE)
+    madvise(reinterpret_cast<void*>(aligned), *size, MADV_HUGEPAGE);
+#endif
+    return reinterpret_cast<uint8_t*>(aligned);
+#else
+    return static_cast<uint8_t*>(VirtualAlloc(
+        nullptr, *size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+#endif
+  }
+
+  void free_pack_memory(uint8_t* base_address, size_t size) {
+#ifndef _WIN32
+    munmap(base_address, size);
+#else
+    (void)size;
+    VirtualFree(base_address, 0, MEM_RELEASE);
+#endif
+  }
+
+  // Reads all of the pack file @fname into memory and indexes its tables.
+  void load_pack(const std::string& fname) {
+    std::ifstream stream(fname, std::ios::binary | std::ios::ate);
+    if (!stream.is_open()) {
+      throw Exception("Could not open tablebase pack " + fname);
+    }
+    const size_t file_size = static_cast<size_t>(stream.tellg());
+    size_t size = file_size;
+    uint8_t* data = alloc_pack_memory(&size);
+    if (!data) throw Exception("Could not allocate memory for " + fname);
+    packs_.emplace_back(data, size);
+    stream.seekg(0);
+    stream.read(reinterpret_cast<char*>(data), file_size);
+    const auto corrupt = [&]() {
+      return Exception("Corrupt tablebase pack " + fname);
+    };
+    if (!stream || file_size < 16 ||
+        memcmp(data, kPackMagic, sizeof(kPackMagic)) != 0) {
+      throw corrupt();
+    }
+    const size_t count = read_le_u32(data + 8);
+    constexpr size_t kEntrySize = kPackNameLength + 16;
+    if (count > (file_size - 16) / kEntrySize) throw corrupt();
+    for (size_t i = 0; i < count; i++) {
+      uint8_t* entry = data + 16 + i * kEntrySize;
+      const std::string name(
+          reinterpret_cast<const char*>(entry),
+          strnlen(reinterpret_cast<const char*>(entry), kPackNameLength));
+      const uint64_t offset = read_le_u64(entry + kPackNameLength);
+      const uint64_t length = read_le_u64(entry + kPackNameLength + 8);
+      if (offset % 64 != 0 || length % 64 != 16 || offset > file_size ||
+          length > file_size - offset) {
+        throw corrupt();
+      }
+      packed_tables_.emplace(name, data + offset);
+    }
   }
 
   void* map_tb(const char* name, const char* suffix, map_t* mapping) {
+    const auto packed = packed_tables_.find(std::string(name) + suffix);
+    if (packed != packed_tables_.end()) {
+      // Not a mapping, unmap_file() leaves the pack alone.
+      *mapping = map_t();
+      return packed->second;
+    }
     std::string fname = name_for_tb(name, suffix);
     void* base_address;
 #ifndef _WIN32
@@ -1081,7 +1283,24 @@ class SyzygyTablebaseImpl {
     return base_address;
   }
 
+  // Locks a mapped table in memory, or has the OS read it ahead. Returns false
+  // if locking failed.
+  bool warm_table(void* base_address, map_t mapping, bool lock) {
+#ifndef _WIN32
+    if (lock) return mlock(base_address, mapping) == 0;
+#if defined(MADV_WILLNEED)
+    madvise(base_address, mapping, MADV_WILLNEED);
+#endif
+#else
+    (void)base_address;
+    (void)mapping;
+    (void)lock;
+#endif
+    return true;
+  }
+
   void unmap_file(void* base_address, map_t mapping) {
+    if (!mapping) return;
 #ifndef _WIN32
     munmap(base_address, mapping);
 #else
@@ -1131,6 +1350,8 @@ class SyzygyTablebaseImpl {
             : static_cast<BaseEntry*>(&piece_entries_[num_piece_entries_++]);
     be->hasPawns = has_pawns;
     be->key = key;
+    std::strncpy(be->name, str, sizeof(be->name) - 1);
+    be->name[sizeof(be->name) - 1] = '\0';
     be->symmetric = key == key2;
     be->num = 0;
     for (int i = 0; i < 16; i++) be->num += pcs[i];
@@ -1340,6 +1561,9 @@ class SyzygyTablebaseImpl {
       *success = 0;
       return 0;
     }
+    if (count_probes_.load(std::memory_order_relaxed)) {
+      be->probes[type].fetch_add(1, std::memory_order_relaxed);
+    }
 
     // Use double-checked locking to reduce locking overhead
     if (!atomic_load_explicit(&be->ready[type], std::memory_order_acquire)) {
@@ -1459,9 +1683,73 @@ class SyzygyTablebaseImpl {
   std::vector<PieceEntry> piece_entries_;
   std::vector<PawnEntry> pawn_entries_;
   std::vector<TbHashEntry> tb_hash_;
+  std::atomic<bool> count_probes_{false};
+  // Memory of the pack files read, and the tables in them by file name.
+  std::vector<std::pair<uint8_t*, size_t>> packs_;
+  std::unordered_map<std::string, uint8_t*> packed_tables_;
+};
+
+namespace {
+constexpr size_t kProbeCacheSize = 1 << 16;
+
+// Adds the page faults of the calling thread so far to the arguments.
+void AddPageFaults(uint64_t* minor, uint64_t* major) {
+#if defined(__linux__)
+  rusage usage;
+  if (getrusage(RUSAGE_THREAD, &usage) != 0) return;
+  *minor += usage.ru_minflt;
+  *major += usage.ru_majflt;
+#else
+  (void)minor;
+  (void)major;
+#endif
+}
+}  // namespace
+
+struct SyzygyTablebase::ProbeStats {
+  // Measures the probe made during its lifetime, if stats are collected.
+  class Timer {
+   public:
+    Timer(ProbeStats* stats, int type)
+        : stats_(stats->enabled.load(std::memory_order_relaxed) ? stats
+                                                                : nullptr),
+          type_(type) {
+      if (!stats_) return;
+      AddPageFaults(&start_minor_faults_, &start_major_faults_);
+      start_ = std::chrono::steady_clock::now();
+    }
+    ~Timer() {
+      if (!stats_) return;
+      const std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start_;
+      uint64_t minor_faults = 0;
+      uint64_t major_faults = 0;
+      AddPageFaults(&minor_faults, &major_faults);
+      stats_->minor_faults.fetch_add(minor_faults - start_minor_faults_,
+                                     std::memory_order_relaxed);
+      stats_->major_faults.fetch_add(major_faults - start_major_faults_,
+                                     std::memory_order_relaxed);
+      stats_->latency[type_].Add(elapsed.count());
+    }
+
+   private:
+    ProbeStats* const stats_;
+    const int type_;
+    uint64_t start_minor_faults_ = 0;
+    uint64_t start_major_faults_ = 0;
+    std::chrono::steady_clock::time_point start_;
+  };
+
+  std::atomic<bool> enabled{false};
+  std::atomic<uint64_t> minor_faults{0};
+  std::atomic<uint64_t> major_faults{0};
+  // Latency in seconds of WDL, DTM and DTZ probes that missed the cache.
+  Histogram latency[3] = {
+      Histogram(-7, 1, 5), Histogram(-7, 1, 5), Histogram(-7, 1, 5)};
 };
 
-SyzygyTablebase::SyzygyTablebase() : max_cardinality_(0) {}
+SyzygyTablebase::SyzygyTablebase()
+    : max_cardinality_(0), stats_(std::make_unique<ProbeStats>()) {}
 
 SyzygyTablebase::~SyzygyTablebase() = default;
 
@@ -1471,11 +1759,81 @@ bool SyzygyTablebase::init(const std::string& paths) {
   max_cardinality_ = impl_->max_cardinality();
   if (max_cardinality_ <= 2) {
     impl_ = nullptr;
+    wdl_cache_ = nullptr;
+    dtz_cache_ = nullptr;
     return false;
   }
+  wdl_cache_ = std::make_unique<ProbeCache>(kProbeCacheSize);
+  dtz_cache_ = std::make_unique<ProbeCache>(kProbeCacheSize);
+  impl_->set_count_probes(collect_stats());
+  for (auto& latency : stats_->latency) latency.Clear();
+  stats_->minor_faults.store(0, std::memory_order_relaxed);
+  stats_->major_faults.store(0, std::memory_order_relaxed);
   return true;
 }
 
+void SyzygyTablebase::set_collect_stats(bool collect) {
+  stats_->enabled.store(collect, std::memory_order_relaxed);
+  if (impl_) impl_->set_count_probes(collect);
+}
+
+bool SyzygyTablebase::collect_stats() const {
+  return stats_->enabled.load(std::memory_order_relaxed);
+}
+
+std::string SyzygyTablebase::stats_summary() const {
+  std::ostringstream oss;
+  oss << "tbstats";
+  for (const int type : {WDL, DTZ}) {
+    const Histogram& latency = stats_->latency[type];
+    oss << " " << (type == WDL ? "wdl" : "dtz") << " "
+        << static_cast<uint64_t>(latency.GetTotal()) << " probes";
+    if (latency.GetTotal() == 0) continue;
+    oss << " p50 " << latency.GetQuantile(0.5) * 1e6 << "us p99 "
+        << latency.GetQuantile(0.99) * 1e6 << "us";
+  }
+  oss << " faults " << stats_->minor_faults.load(std::memory_order_relaxed)
+      << " minor " << stats_->major_faults.load(std::memory_order_relaxed)
+      << " major";
+  if (impl_) {
+    const auto tables = impl_->table_probes();
+    oss << " top";
+    for (size_t i = 0; i < std::min<size_t>(tables.size(), 5); i++) {
+      oss << " " << tables[i].first << " " << tables[i].second;
+    }
+  }
+  return oss.str();
+}
+
+void SyzygyTablebase::LogStats() const {
+  LOGFILE << stats_summary();
+  if (!impl_) return;
+  for (const auto& [table, probes] : impl_->table_probes()) {
+    LOGFILE << "tbstats " << table << " " << probes << " probes";
+  }
+}
+
+int SyzygyTablebase::preload(int cardinality, int lock_cardinality,
+                             int threads) {
+  if (!impl_) return 0;
+  bool lock_failed = false;
+  const int mapped = impl_->preload(cardinality, lock_cardinality,
+                                    std::max(threads, 1), &lock_failed);
+  if (lock_failed) {
+    CERR << "Could not lock some tablebases in memory, the locked memory "
+            "limit (ulimit -l) may be too low.";
+  }
+  return mapped;
+}
+
+uint64_t SyzygyTablebase::probe_cache_hits() const {
+  return wdl_cache_ ? wdl_cache_->hits() + dtz_cache_->hits() : 0;
+}
+
+uint64_t SyzygyTablebase::probe_cache_lookups() const {
+  return wdl_cache_ ? wdl_cache_->lookups() + dtz_cache_->lookups() : 0;
+}
+
 // For a position where the side to move has a winning capture it is not
 // necessary to store a winning value so the generator treats such positions as
 // "don't cares" and tries to assign to it a value that improves the compression
@@ -1547,8 +1905,51 @@ WDLScore SyzygyTablebase::search(const Position& pos, ProbeState* result) {
 //  1 : win, but draw under 50-move rule
 //  2 : win
 WDLScore SyzygyTablebase::probe_wdl(const Position& pos, ProbeState* result) {
+  const uint64_t key = pos.GetBoard().Hash();
+  int value;
+  int state;
+  if (wdl_cache_->Lookup(key, &value, &state)) {
+    *result = static_cast<ProbeState>(state);
+    return static_cast<WDLScore>(value);
+  }
   *result = OK;
-  return search(pos, result);
+  WDLScore wdl;
+  {
+    ProbeStats::Timer timer(stats_.get(), WDL);
+    wdl = search(pos, result);
+  }
+  wdl_cache_->Store(key, wdl, *result);
+  return wdl;
+}
+
+std::vector<WDLProbeResult> SyzygyTablebase::probe_wdl_batch(
+    const std::vector<Position>& positions) {
+  struct Entry {
+    Key material;
+    uint64_t hash;
+    size_t index;
+  };
+  std::vector<Entry> entries;
+  entries.reserve(positions.size());
+  for (size_t i = 0; i < positions.size(); i++) {
+    const ChessBoard& board = positions[i].GetBoard();
+    entries.push_back({calc_key_from_position(board), board.Hash(), i});
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry& a, const Entry& b) {
+              return std::tie(a.material, a.hash) <
+                     std::tie(b.material, b.hash);
+            });
+  std::vector<WDLProbeResult> results(positions.size());
+  for (size_t i = 0; i < entries.size(); i++) {
+    WDLProbeResult& result = results[entries[i].index];
+    if (i > 0 && entries[i].hash == entries[i - 1].hash) {
+      result = results[entries[i - 1].index];
+      continue;
+    }
+    result.wdl = probe_wdl(positions[entries[i].index], &result.state);
+  }
+  return results;
 }
 
 // Probe the DTZ table for a particular position.
@@ -1577,6 +1978,23 @@ WDLScore SyzygyTablebase::probe_wdl(const Position& pos, ProbeState* result) {
 // In short, if a move is available resulting in dtz + 50-move-counter <= 99,
 // then do not accept moves leading to dtz + 50-move-counter == 100.
 int SyzygyTablebase::probe_dtz(const Position& pos, ProbeState* result) {
+  const uint64_t key = pos.GetBoard().Hash();
+  int dtz;
+  int state;
+  if (dtz_cache_->Lookup(key, &dtz, &state)) {
+    *result = static_cast<ProbeState>(state);
+    return dtz;
+  }
+  {
+    ProbeStats::Timer timer(stats_.get(), DTZ);
+    dtz = probe_dtz_uncached(pos, result);
+  }
+  dtz_cache_->Store(key, dtz, *result);
+  return dtz;
+}
+
+int SyzygyTablebase::probe_dtz_uncached(const Position& pos,
+                                        ProbeState* result) {
   *result = OK;
   const WDLScore wdl = search<true>(pos, result);
   if (*result == FAIL || wdl == WDL_DRAW) {  // DTZ tables don't store draws
@@ -1685,15 +2103,17 @@ bool SyzygyTablebase::root_probe_wdl(const Position& pos,
                                      std::vector<Move>* safe_moves) {
   static const int WDL_to_rank[] = {-1000, -899, 0, 899, 1000};
   auto root_moves = pos.GetBoard().GenerateLegalMoves();
-  ProbeState result;
+  std::vector<Position> children;
+  children.reserve(root_moves.size());
+  for (auto& m : root_moves) children.emplace_back(pos, m);
+  const auto results = probe_wdl_batch(children);
   std::vector<int> ranks;
   ranks.reserve(root_moves.size());
   int best_rank = -1000;
-  // Probe and rank each move
-  for (auto& m : root_moves) {
-    Position nextPos = Position(pos, m);
-    const WDLScore wdl = static_cast<WDLScore>(-probe_wdl(nextPos, &result));
-    if (result == FAIL) return false;
+  // Rank each move
+  for (const auto& result : results) {
+    if (result.state == FAIL) return false;
+    const WDLScore wdl = static_cast<WDLScore>(-result.wdl);
     ranks.push_back(WDL_to_rank[wdl + 2]);
     if (ranks.back() > best_rank) best_rank = ranks.back();
   }
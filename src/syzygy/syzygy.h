@@ -34,6 +34,7 @@
 #include <tuple>
 #include <vector>
 #include "chess/position.h"
+#include "syzygy/probe_cache.h"
 
 namespace lczero {
 
@@ -53,6 +54,12 @@ enum ProbeState {
   ZEROING_BEST_MOVE = 2  // Best move zeroes DTZ (capture or pawn move)
 };
 
+// Result of a WDL probe, as returned by SyzygyTablebase::probe_wdl_batch().
+struct WDLProbeResult {
+  WDLScore wdl;
+  ProbeState state;
+};
+
 class SyzygyTablebaseImpl;
 
 // Provides methods to load and probe syzygy tablebases.
@@ -70,12 +77,25 @@ class SyzygyTablebase {
   // thread safe, there must be no concurrent usage while this method is
   // running. All other thread safe method calls must be strictly ordered with
   // respect to this method.
+  // Entries of @paths ending in ".tbpack" are pack files holding several
+  // tables, which are read into memory in full here.
   bool init(const std::string& paths);
+  // Maps the WDL and DTZ tables of up to @cardinality pieces now, on @threads
+  // threads, instead of on their first probe. Those of up to @lock_cardinality
+  // pieces are also locked in memory, the others are read ahead into the page
+  // cache. Returns the number of tables mapped. Not thread safe, like init().
+  int preload(int cardinality, int lock_cardinality, int threads);
   // Probes WDL tables for the given position to determine a WDLScore.
   // Thread safe.
   // Result is only strictly valid for positions with 0 ply 50 move counter.
   // Probe state will return FAIL if the position is not in the tablebase.
   WDLScore probe_wdl(const Position& pos, ProbeState* result);
+  // Same as probe_wdl() for every position of @positions, results in the same
+  // order. Positions are probed grouped by table, so that each table's index
+  // and blocks are read once per batch, and equal boards are probed once.
+  // Thread safe.
+  std::vector<WDLProbeResult> probe_wdl_batch(
+      const std::vector<Position>& positions);
   // Probes DTZ tables for the given position to determine the number of ply
   // before a zeroing move under optimal play.
   // Thread safe.
@@ -97,16 +117,41 @@ class SyzygyTablebase {
   // Returns false if the position is not in the tablebase.
   // Safe moves are added to the safe_moves output paramater.
   bool root_probe_wdl(const Position& pos, std::vector<Move>* safe_moves);
+  // Number of probe_wdl() and probe_dtz() calls answered from the cache of
+  // recent probe results, and of all calls, since init().
+  // Thread safe.
+  uint64_t probe_cache_hits() const;
+  uint64_t probe_cache_lookups() const;
+  // Starts or stops collecting probe statistics: the latency of probes that
+  // miss the cache, the page faults taken during them and the probes of each
+  // table file.
+  // Thread safe.
+  void set_collect_stats(bool collect);
+  bool collect_stats() const;
+  // Returns a one line summary of the statistics collected since init(), for
+  // info strings. Thread safe.
+  std::string stats_summary() const;
+  // Writes the summary and the probes of every table file to the log.
+  // Thread safe.
+  void LogStats() const;
 
  private:
+  struct ProbeStats;
+
   template <bool CheckZeroingMoves = false>
   WDLScore search(const Position& pos, ProbeState* result);
+  int probe_dtz_uncached(const Position& pos, ProbeState* result);
 
   std::string paths_;
   // Caches the max_cardinality from the impl, as max_cardinality may be a hot
   // path.
   int max_cardinality_;
   std::unique_ptr<SyzygyTablebaseImpl> impl_;
+  // Results of recent WDL and DTZ probes, which only depend on the board, so
+  // that transpositions probed again during a search skip the tables.
+  std::unique_ptr<ProbeCache> wdl_cache_;
+  std::unique_ptr<ProbeCache> dtz_cache_;
+  std::unique_ptr<ProbeStats> stats_;
 };
 
 }  // namespace lczero
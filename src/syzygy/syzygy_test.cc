@@ -27,8 +27,13 @@
 
 #include <gtest/gtest.h>
 
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include "src/syzygy/async_prober.h"
 #include "src/syzygy/syzygy.h"
+#include "src/utils/exception.h"
 
 namespace lczero {
 
@@ -146,6 +151,264 @@ TEST(Syzygy, Root3PieceProbes) {
                            {Move("d2d3", true)}, {}, {Move("d2e3", true)});
 }
 
+TEST(Syzygy, AsyncProbesMatchSynchronousOnes) {
+  SyzygyTablebase tablebase;
+  tablebase.init(kPaths);
+  if (tablebase.max_cardinality() < 3) {
+    // These probes require 3 piece tablebase.
+    return;
+  }
+  const std::vector<std::string> fens = {
+      "8/8/8/8/8/8/2Rk4/1K6 b - - 0 1", "8/8/8/8/8/8/2rK4/1k6 w - - 0 1",
+      "5Qk1/8/8/8/8/8/8/4K3 b - - 0 1", "6k1/8/8/8/8/5p2/8/2K5 b - - 0 1"};
+  std::vector<Position> positions;
+  for (const auto& fen : fens) {
+    ChessBoard board;
+    board.SetFromFen(fen);
+    positions.emplace_back(board, 0, 1);
+  }
+  AsyncWdlProber prober(&tablebase, 2);
+  std::vector<std::future<AsyncWdlProber::Result>> results;
+  for (int i = 0; i < 10; ++i) {
+    for (const auto& pos : positions) results.push_back(prober.Probe(pos));
+  }
+  for (size_t i = 0; i < results.size(); ++i) {
+    ProbeState state;
+    const WDLScore wdl =
+        tablebase.probe_wdl(positions[i % positions.size()], &state);
+    const auto result = results[i].get();
+    EXPECT_EQ(result.wdl, wdl);
+    EXPECT_EQ(result.state, state);
+  }
+}
+
+TEST(Syzygy, ProbeCacheReturnsSameResults) {
+  SyzygyTablebase tablebase;
+  tablebase.init(kPaths);
+  if (tablebase.max_cardinality() < 3) {
+    // These probes require 3 piece tablebase.
+    return;
+  }
+  ChessBoard board;
+  board.SetFromFen("8/8/8/8/8/8/2Rk4/1K6 b - - 0 1");
+  const Position pos(board, 0, 1);
+  ProbeState state;
+  EXPECT_EQ(tablebase.probe_wdl(pos, &state), WDL_LOSS);
+  const uint64_t hits = tablebase.probe_cache_hits();
+  EXPECT_EQ(tablebase.probe_wdl(pos, &state), WDL_LOSS);
+  EXPECT_NE(state, FAIL);
+  EXPECT_EQ(tablebase.probe_cache_hits(), hits + 1);
+  const int dtz = tablebase.probe_dtz(pos, &state);
+  EXPECT_EQ(tablebase.probe_dtz(pos, &state), dtz);
+  EXPECT_NE(state, FAIL);
+  EXPECT_EQ(dtz, -32);
+}
+
+TEST(Syzygy, PreloadedTablesProbe) {
+  SyzygyTablebase tablebase;
+  tablebase.init(kPaths);
+  if (tablebase.max_cardinality() < 3) {
+    // These probes require 3 piece tablebase.
+    return;
+  }
+  EXPECT_GT(tablebase.preload(3, 0, 2), 0);
+  TestValidExpectation(&tablebase, "8/8/8/8/8/8/2Rk4/1K6 b - - 0 1", WDL_LOSS,
+                       -32);
+  TestValidExpectation(&tablebase, "6k1/8/8/8/8/5p2/8/2K5 b - - 0 1", WDL_WIN,
+                       1);
+}
+
+TEST(Syzygy, BatchProbesMatchSingleOnes) {
+  SyzygyTablebase tablebase;
+  tablebase.init(kPaths);
+  if (tablebase.max_cardinality() < 3) {
+    // These probes require 3 piece tablebase.
+    return;
+  }
+  std::vector<Position> positions;
+  for (const char* fen :
+       {"8/8/8/8/8/8/2Rk4/1K6 b - - 0 1", "6k1/8/8/8/8/5p2/8/2K5 b - - 0 1",
+        "8/8/8/8/8/8/2Rk4/1K6 b - - 0 1", "8/8/8/8/8/8/2Rk4/1K6 w - - 0 1"}) {
+    ChessBoard board;
+    board.SetFromFen(fen);
+    positions.emplace_back(board, 0, 1);
+  }
+  const auto results = tablebase.probe_wdl_batch(positions);
+  ASSERT_EQ(results.size(), positions.size());
+  for (size_t i = 0; i < positions.size(); i++) {
+    ProbeState state;
+    EXPECT_EQ(results[i].wdl, tablebase.probe_wdl(positions[i], &state));
+    EXPECT_EQ(results[i].state, state);
+  }
+  EXPECT_EQ(results[0].wdl, WDL_LOSS);
+  EXPECT_EQ(results[1].wdl, WDL_WIN);
+}
+
+TEST(ProbeCache, StoresValuesAndStates) {
+  ProbeCache cache(64);
+  int value;
+  int state;
+  EXPECT_FALSE(cache.Lookup(12345, &value, &state));
+  cache.Store(12345, -32, CHANGE_STM);
+  ASSERT_TRUE(cache.Lookup(12345, &value, &state));
+  EXPECT_EQ(value, -32);
+  EXPECT_EQ(state, CHANGE_STM);
+  // Same slot, different key.
+  EXPECT_FALSE(cache.Lookup(12345 + 64, &value, &state));
+  EXPECT_EQ(cache.hits(), 1u);
+  EXPECT_EQ(cache.lookups(), 3u);
+}
+
+// Writes a pack file holding @tables, given as file name and contents.
+void WritePack(const std::string& filename,
+               const std::vector<std::pair<std::string, std::string>>& tables) {
+  std::string pack = "TBPACK01";
+  const auto append = [&](uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) pack.push_back(char(value >> (8 * i)));
+  };
+  const auto pad = [&]() { pack.resize((pack.size() + 63) / 64 * 64); };
+  append(tables.size(), 4);
+  append(0, 4);
+  uint64_t offset = (16 + 32 * tables.size() + 63) / 64 * 64;
+  for (const auto& [name, contents] : tables) {
+    pack += name;
+    pack.resize(pack.size() + 16 - name.size());
+    append(offset, 8);
+    append(contents.size(), 8);
+    offset += (contents.size() + 63) / 64 * 64;
+  }
+  for (const auto& table : tables) {
+    pad();
+    pack += table.second;
+  }
+  std::ofstream(filename, std::ios::binary) << pack;
+}
+
+TEST(Syzygy, PackTablesAreFound) {
+  const std::string filename = ::testing::TempDir() + "found.tbpack";
+  WritePack(filename, {{"KQvK.rtbw", std::string(16, '\0')}});
+  SyzygyTablebase tablebase;
+  EXPECT_TRUE(tablebase.init(filename));
+  EXPECT_EQ(tablebase.max_cardinality(), 3);
+  std::remove(filename.c_str());
+}
+
+TEST(Syzygy, StatsCountProbes) {
+  const std::string filename = ::testing::TempDir() + "stats.tbpack";
+  // A table that is found but fails to load still counts as probed.
+  WritePack(filename, {{"KQvK.rtbw", std::string(16, '\0')}});
+  SyzygyTablebase tablebase;
+  ASSERT_TRUE(tablebase.init(filename));
+  tablebase.set_collect_stats(true);
+  ChessBoard board;
+  board.SetFromFen("8/8/8/8/8/8/2Qk4/1K6 b - - 0 1");
+  ProbeState state;
+  tablebase.probe_wdl(Position(board, 0, 1), &state);
+  EXPECT_EQ(state, FAIL);
+  const std::string summary = tablebase.stats_summary();
+  EXPECT_NE(summary.find("wdl 1 probes"), std::string::npos) << summary;
+  EXPECT_NE(summary.find("KQvK.rtbw 1"), std::string::npos) << summary;
+  std::remove(filename.c_str());
+}
+
+TEST(Syzygy, CorruptPackThrows) {
+  const std::string filename = ::testing::TempDir() + "corrupt.tbpack";
+  // Table sizes are always 16 more than a multiple of 64.
+  WritePack(filename, {{"KQvK.rtbw", std::string(20, '\0')}});
+  SyzygyTablebase tablebase;
+  EXPECT_THROW(tablebase.init(filename), Exception);
+  std::remove(filename.c_str());
+}
+
+TEST(Syzygy, PackProbesMatchFiles) {
+  SyzygyTablebase tablebase;
+  tablebase.init(kPaths);
+  if (tablebase.max_cardinality() < 3) {
+    // These probes require 3 piece tablebase.
+    return;
+  }
+  std::vector<std::pair<std::string, std::string>> tables;
+  for (const char* table : {"KQvK", "KRvK", "KBvK", "KNvK", "KPvK"}) {
+    for (const char* suffix : {".rtbw", ".rtbz"}) {
+      const std::string name = std::string(table) + suffix;
+      std::ifstream stream(std::string(kPaths) + "/" + name, std::ios::binary);
+      if (!stream.is_open()) continue;
+      std::stringstream contents;
+      contents << stream.rdbuf();
+      tables.emplace_back(name, contents.str());
+    }
+  }
+  const std::string filename = ::testing::TempDir() + "tables.tbpack";
+  WritePack(filename, tables);
+  SyzygyTablebase packed;
+  EXPECT_TRUE(packed.init(filename));
+  TestValidExpectation(&packed, "8/8/8/8/8/8/2Rk4/1K6 b - - 0 1", WDL_LOSS,
+                       -32);
+  TestValidExpectation(&packed, "6k1/8/8/8/8/5p2/8/2K5 b - - 0 1", WDL_WIN,
+                       1);
+  std::remove(filename.c_str());
+}
+
+// Probes many different positions, so that they don't hit the probe cache but
+// go through indexing and decompression each time, and checks that the WDL
+// and DTZ tables agree on each.
+TEST(Syzygy, ManyProbesAgree) {
+  SyzygyTablebase tablebase;
+  tablebase.init(kPaths);
+  if (tablebase.max_cardinality() < 3) {
+    // These probes require 3 piece tablebase.
+    return;
+  }
+  std::vector<Position> positions;
+  for (int white_king = 0; white_king < 64; white_king++) {
+    for (int black_king = 0; black_king < 64; black_king += 3) {
+      for (int rook = 0; rook < 64; rook += 5) {
+        if (white_king == black_king || rook == white_king ||
+            rook == black_king ||
+            (std::abs(white_king / 8 - black_king / 8) <= 1 &&
+             std::abs(white_king % 8 - black_king % 8) <= 1)) {
+          continue;
+        }
+        std::string fen;
+        for (int row = 7; row >= 0; row--) {
+          int empty = 0;
+          for (int col = 0; col < 8; col++) {
+            const int sq = row * 8 + col;
+            const char piece = sq == white_king   ? 'K'
+                               : sq == black_king ? 'k'
+                               : sq == rook       ? 'R'
+                                                  : '\0';
+            if (!piece) {
+              empty++;
+              continue;
+            }
+            if (empty) fen += std::to_string(empty);
+            empty = 0;
+            fen += piece;
+          }
+          if (empty) fen += std::to_string(empty);
+          if (row) fen += '/';
+        }
+        // Black to move, so that the rook may give check.
+        ChessBoard board;
+        board.SetFromFen(fen + " b - - 0 1");
+        positions.emplace_back(board, 0, 1);
+      }
+    }
+  }
+  for (const auto& pos : positions) {
+    ProbeState state;
+    const WDLScore wdl = tablebase.probe_wdl(pos, &state);
+    ASSERT_NE(state, FAIL);
+    // The lone king can only draw, by taking the rook or by stalemate.
+    EXPECT_TRUE(wdl == WDL_LOSS || wdl == WDL_DRAW);
+    const int dtz = tablebase.probe_dtz(pos, &state);
+    ASSERT_NE(state, FAIL);
+    EXPECT_EQ(dtz < 0, wdl == WDL_LOSS);
+    EXPECT_EQ(dtz == 0, wdl == WDL_DRAW);
+  }
+}
+
 TEST(Syzygy, Simple4PieceProbes) {
   SyzygyTablebase tablebase;
   tablebase.init(kPaths);
@@ -27,6 +27,16 @@
 
 #include "trainingdata/reader.h"
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+
 namespace lczero {
 
 InputPlanes PlanesFromTrainingData(const V6TrainingData& data) {
@@ -119,27 +129,111 @@ InputPlanes PlanesFromTrainingData(const V6TrainingData& data) {
 
 TrainingDataReader::TrainingDataReader(std::string filename)
     : filename_(filename) {
+#ifndef _WIN32
+  // Uncompressed files are mapped rather than read through zlib.
+  int fd = open(filename_.c_str(), O_RDONLY);
+  if (fd < 0) throw Exception("Cannot open file " + filename_);
+  unsigned char magic[2] = {};
+  struct stat st;
+  if (read(fd, magic, 2) == 2 && !(magic[0] == 0x1f && magic[1] == 0x8b) &&
+      fstat(fd, &st) == 0) {
+    void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped != MAP_FAILED) {
+      madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+      mapped_ = static_cast<const char*>(mapped);
+      mapped_size_ = st.st_size;
+      close(fd);
+      return;
+    }
+  }
+  close(fd);
+#endif
   fin_ = gzopen(filename_.c_str(), "rb");
   if (!fin_) {
     throw Exception("Cannot open gzip file " + filename_);
   }
 }
 
-TrainingDataReader::~TrainingDataReader() { gzclose(fin_); }
+TrainingDataReader::TrainingDataReader(std::string name, const char* data,
+                                       size_t size)
+    : filename_(name),
+      mapped_(data),
+      owns_mapping_(false),
+      mapped_size_(size) {}
+
+TrainingDataReader::~TrainingDataReader() {
+#ifndef _WIN32
+  if (mapped_ && owns_mapping_) {
+    munmap(const_cast<char*>(mapped_), mapped_size_);
+  }
+#endif
+  if (fin_) gzclose(fin_);
+}
+
+int TrainingDataReader::Read(void* buffer, int size) {
+  if (!mapped_) return gzread(fin_, buffer, size);
+  const size_t count =
+      std::min(static_cast<size_t>(size), mapped_size_ - mapped_pos_);
+  std::memcpy(buffer, mapped_ + mapped_pos_, count);
+  mapped_pos_ += count;
+  return count;
+}
+
+size_t TrainingDataReader::ReadChunks(V6TrainingData* data, size_t count) {
+  size_t done = 0;
+  // The first chunk establishes the format, after that V6 data is read in one
+  // go without looking at the individual records.
+  while (done < count && !format_v6) {
+    if (!ReadChunk(data + done)) return done;
+    ++done;
+  }
+  if (done == count) return done;
+  const int size = (count - done) * sizeof(V6TrainingData);
+  const int read_size = Read(data + done, size);
+  if (read_size < 0) throw Exception("Corrupt read.");
+  return done + read_size / sizeof(V6TrainingData);
+}
+
+std::vector<V6TrainingData> TrainingDataReader::ReadAll() {
+  constexpr size_t kBatch = 256;
+  std::vector<V6TrainingData> result;
+  while (true) {
+    const size_t size = result.size();
+    result.resize(size + kBatch);
+    const size_t count = ReadChunks(result.data() + size, kBatch);
+    if (count < kBatch) {
+      result.resize(size + count);
+      return result;
+    }
+  }
+}
 
 bool TrainingDataReader::ReadChunk(V6TrainingData* data) {
   if (format_v6) {
-    int read_size = gzread(fin_, reinterpret_cast<void*>(data), sizeof(*data));
+    int read_size = Read(data, sizeof(*data));
     if (read_size < 0) throw Exception("Corrupt read.");
     return read_size == sizeof(*data);
+  } else if (format_v7) {
+    return ReadV7Chunk(data, false);
   } else {
     int v6_extra = 48;
     int v5_extra = 16;
     int v4_extra = 16;
     int v3_size = sizeof(*data) - v4_extra - v5_extra - v6_extra;
-    int read_size = gzread(fin_, reinterpret_cast<void*>(data), v3_size);
+    // Read the version first, V7 records are shorter than v3 ones.
+    int read_size = Read(data, sizeof(data->version));
     if (read_size < 0) throw Exception("Corrupt read.");
-    if (read_size != v3_size) return false;
+    if (read_size != sizeof(data->version)) return false;
+    if (data->version == 7) {
+      format_v7 = true;
+      return ReadV7Chunk(data, true);
+    }
+    read_size =
+        Read(reinterpret_cast<char*>(data) + read_size, v3_size - read_size);
+    if (read_size < 0) throw Exception("Corrupt read.");
+    if (read_size != v3_size - static_cast<int>(sizeof(data->version))) {
+      return false;
+    }
     auto orig_version = data->version;
     switch (data->version) {
       case 3: {
@@ -155,10 +249,7 @@ bool TrainingDataReader::ReadChunk(V6TrainingData* data) {
       case 4: {
         // If actually 4, we need to read the additional data first.
         if (orig_version == 4) {
-          read_size = gzread(
-              fin_,
-              reinterpret_cast<void*>(reinterpret_cast<char*>(data) + v3_size),
-              v4_extra);
+          read_size = Read(reinterpret_cast<char*>(data) + v3_size, v4_extra);
           if (read_size < 0) throw Exception("Corrupt read.");
           if (read_size != v4_extra) return false;
         }
@@ -176,10 +267,8 @@ bool TrainingDataReader::ReadChunk(V6TrainingData* data) {
       case 5: {
         // If actually 5, we need to read the additional data first.
         if (orig_version == 5) {
-          read_size = gzread(
-              fin_,
-              reinterpret_cast<void*>(reinterpret_cast<char*>(data) + v3_size),
-              v4_extra + v5_extra);
+          read_size = Read(reinterpret_cast<char*>(data) + v3_size,
+                           v4_extra + v5_extra);
           if (read_size < 0) throw Exception("Corrupt read.");
           if (read_size != v4_extra + v5_extra) return false;
         }
@@ -210,10 +299,8 @@ bool TrainingDataReader::ReadChunk(V6TrainingData* data) {
       }
       case 6: {
         format_v6 = true;
-        read_size = gzread(
-            fin_,
-            reinterpret_cast<void*>(reinterpret_cast<char*>(data) + v3_size),
-            v4_extra + v5_extra + v6_extra);
+        read_size = Read(reinterpret_cast<char*>(data) + v3_size,
+                         v4_extra + v5_extra + v6_extra);
         if (read_size < 0) throw Exception("Corrupt read.");
         return read_size == v4_extra + v5_extra + v6_extra;
       }
@@ -223,4 +310,23 @@ bool TrainingDataReader::ReadChunk(V6TrainingData* data) {
   }
 }
 
+bool TrainingDataReader::ReadV7Chunk(V6TrainingData* data, bool version_read) {
+  V7TrainingDataHeader header;
+  header.version = 7;
+  const int skip = version_read ? sizeof(header.version) : 0;
+  const int header_size = sizeof(header) - skip;
+  int read_size = Read(reinterpret_cast<char*>(&header) + skip, header_size);
+  if (read_size < 0) throw Exception("Corrupt read.");
+  if (read_size != header_size) return false;
+  if (header.version != 7) throw Exception("Mixed format training data.");
+  if (header.policy_count > 1858) throw Exception("Corrupt V7 policy.");
+  V7PolicyEntry policy[1858];
+  const int policy_size = header.policy_count * sizeof(V7PolicyEntry);
+  read_size = Read(policy, policy_size);
+  if (read_size < 0) throw Exception("Corrupt read.");
+  if (read_size != policy_size) return false;
+  FromV7TrainingData(header, policy, data);
+  return true;
+}
+
 }  // namespace lczero
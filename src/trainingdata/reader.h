@@ -43,19 +43,39 @@ class TrainingDataReader {
  public:
   // Opens the given file to read chunk data from.
   TrainingDataReader(std::string filename);
+  // Reads uncompressed chunks from @data, which must outlive the reader.
+  // @name is only used in messages.
+  TrainingDataReader(std::string name, const char* data, size_t size);
 
   ~TrainingDataReader();
 
   // Reads a chunk. Returns true if a chunk was read.
   bool ReadChunk(V6TrainingData* data);
 
+  // Reads up to @count chunks into @data. Returns the number of chunks read,
+  // fewer than @count only at the end of the file.
+  size_t ReadChunks(V6TrainingData* data, size_t count);
+
+  // Reads all the remaining chunks.
+  std::vector<V6TrainingData> ReadAll();
+
   // Gets full filename of the file being read.
   std::string GetFileName() const { return filename_; }
 
  private:
+  bool ReadV7Chunk(V6TrainingData* data, bool version_read);
+  // Reads from the mapped file or through zlib, same semantics as gzread().
+  int Read(void* buffer, int size);
+
   std::string filename_;
-  gzFile fin_;
+  gzFile fin_ = nullptr;
+  // Uncompressed input files are memory mapped.
+  const char* mapped_ = nullptr;
+  bool owns_mapping_ = true;
+  size_t mapped_size_ = 0;
+  size_t mapped_pos_ = 0;
   bool format_v6 = false;
+  bool format_v7 = false;
 };
 
 }  // namespace lczero
@@ -27,6 +27,12 @@
 
 #include "trainingdata/trainingdata.h"
 
+#include <algorithm>
+#include <cstring>
+
+#include "utils/exception.h"
+#include "utils/fp16_utils.h"
+
 namespace lczero {
 
 namespace {
@@ -77,13 +83,43 @@ std::tuple<float, float> DriftCorrect(float q, float d) {
 }
 }  // namespace
 
+void ToV7TrainingData(const V6TrainingData& data, V7TrainingDataHeader* header,
+                      std::vector<V7PolicyEntry>* policy) {
+  header->version = 7;
+  header->input_format = data.input_format;
+  std::memcpy(header->tail, &data.planes, sizeof(header->tail));
+  policy->clear();
+  for (uint16_t i = 0; i < 1858; i++) {
+    if (data.probabilities[i] < 0.0f) continue;
+    policy->push_back({i, FP32toFP16(data.probabilities[i])});
+  }
+  header->policy_count = policy->size();
+}
+
+void FromV7TrainingData(const V7TrainingDataHeader& header,
+                        const V7PolicyEntry* policy, V6TrainingData* data) {
+  if (header.version != 7) throw Exception("Not a V7 training record.");
+  data->version = 6;
+  data->input_format = header.input_format;
+  std::fill(std::begin(data->probabilities), std::end(data->probabilities),
+            -1.0f);
+  for (int i = 0; i < header.policy_count; i++) {
+    if (policy[i].index >= 1858) {
+      throw Exception("Invalid policy index in V7 training record.");
+    }
+    data->probabilities[policy[i].index] = FP16toFP32(policy[i].probability);
+  }
+  std::memcpy(&data->planes, header.tail, sizeof(header.tail));
+}
+
 void V6TrainingDataArray::Write(TrainingDataWriter* writer, GameResult result,
                                 bool adjudicated) const {
   if (training_data_.empty()) return;
   // Base estimate off of best_m.  If needed external processing can use a
   // different approach.
-  float m_estimate = training_data_.back().best_m + training_data_.size() - 1;
-  for (auto chunk : training_data_) {
+  const float last_m = training_data_.back().best_m;
+  for (size_t i = 0; i < training_data_.size(); ++i) {
+    auto chunk = training_data_[i];
     bool black_to_move = chunk.side_to_move_or_enpassant;
     if (IsCanonicalFormat(static_cast<pblczero::NetworkFormat::InputFormat>(
             chunk.input_format))) {
@@ -105,8 +141,7 @@ void V6TrainingDataArray::Write(TrainingDataWriter* writer, GameResult result,
     if (adjudicated && result == GameResult::UNDECIDED) {
       chunk.invariance_info |= 1u << 4;  // Max game length exceeded.
     }
-    chunk.plies_left = m_estimate;
-    m_estimate -= 1.0f;
+    chunk.plies_left = last_m + plies_.back() - plies_[i];
     writer->WriteChunk(chunk);
   }
 }
@@ -149,19 +184,14 @@ void V6TrainingDataArray::Add(const Node* node, const PositionHistory& history,
   float max_p = -std::numeric_limits<float>::infinity();
   std::vector<float> intermediate;
   if (nneval) {
-    int last_idx = 0;
+    // Cached policy is kept by legal move ordinal, while edges are sorted.
+    const auto legal_moves = position.GetBoard().GenerateLegalMoves();
     for (const auto& child : node->Edges()) {
-      auto nn_idx = child.edge()->GetMove().as_nn_index(transform);
-      float p = 0;
-      for (int i = 0; i < nneval->p.size(); i++) {
-        // Optimization: usually moves are stored in the same order as queried.
-        const auto& move = nneval->p[last_idx++];
-        if (last_idx == nneval->p.size()) last_idx = 0;
-        if (move.first == nn_idx) {
-          p = move.second;
-          break;
-        }
-      }
+      const auto iter = std::find(legal_moves.begin(), legal_moves.end(),
+                                  child.edge()->GetMove());
+      const float p = nneval->GetP(iter == legal_moves.end()
+                                       ? nneval->GetNumMoves()
+                                       : iter - legal_moves.begin());
       intermediate.emplace_back(p);
       max_p = std::max(max_p, p);
     }
@@ -236,9 +266,9 @@ void V6TrainingDataArray::Add(const Node* node, const PositionHistory& history,
 
   Eval orig_eval;
   if (nneval) {
-    orig_eval.wl = nneval->q;
-    orig_eval.d = nneval->d;
-    orig_eval.ml = nneval->m;
+    orig_eval.wl = nneval->GetQ();
+    orig_eval.d = nneval->GetD();
+    orig_eval.ml = nneval->GetM();
   } else {
     orig_eval.wl = std::numeric_limits<float>::quiet_NaN();
     orig_eval.d = std::numeric_limits<float>::quiet_NaN();
@@ -281,6 +311,7 @@ void V6TrainingDataArray::Add(const Node* node, const PositionHistory& history,
   // Unknown here - will be filled in once the full data has been collected.
   result.plies_left = 0;
   training_data_.push_back(result);
+  plies_.push_back(position.GetGamePly());
 }
 
 }  // namespace lczero
@@ -27,6 +27,8 @@
 
 #pragma once
 
+#include <cstddef>
+
 #include "mcts/node.h"
 #include "trainingdata/writer.h"
 
@@ -85,8 +87,34 @@ struct V6TrainingData {
 } PACKED_STRUCT;
 static_assert(sizeof(V6TrainingData) == 8356, "Wrong struct size");
 
+// Sparse form of V6TrainingData. Only moves with a non-negative probability
+// (i.e. the legal ones) are stored, as fp16. On disk the header is followed by
+// policy_count V7PolicyEntry records.
+struct V7TrainingDataHeader {
+  uint32_t version;
+  uint32_t input_format;
+  uint16_t policy_count;
+  // Same layout as the V6TrainingData fields from planes to reserved.
+  uint8_t tail[sizeof(V6TrainingData) - offsetof(V6TrainingData, planes)];
+} PACKED_STRUCT;
+static_assert(sizeof(V7TrainingDataHeader) == 926, "Wrong struct size");
+
+struct V7PolicyEntry {
+  uint16_t index;
+  uint16_t probability;  // fp16.
+} PACKED_STRUCT;
+
 #pragma pack(pop)
 
+// Converts a V6 record into V7 header and policy entries.
+void ToV7TrainingData(const V6TrainingData& data, V7TrainingDataHeader* header,
+                      std::vector<V7PolicyEntry>* policy);
+
+// Expands a V7 record back into V6. Moves missing from @policy get probability
+// -1, the same as illegal moves in V6 data.
+void FromV7TrainingData(const V7TrainingDataHeader& header,
+                        const V7PolicyEntry* policy, V6TrainingData* data);
+
 class V6TrainingDataArray {
  public:
   V6TrainingDataArray(FillEmptyHistory white_fill_empty_history,
@@ -95,7 +123,8 @@ class V6TrainingDataArray {
       : fill_empty_history_{white_fill_empty_history, black_fill_empty_history},
         input_format_(input_format) {}
 
-  // Add a chunk.
+  // Add a chunk. Moves may be skipped (e.g. the fast searches of playout cap
+  // randomization), the ply is taken from @history.
   void Add(const Node* node, const PositionHistory& history, Eval best_eval,
            Eval played_eval, bool best_is_proven, Move best_move,
            Move played_move, const NNCacheLock& nneval);
@@ -106,6 +135,8 @@ class V6TrainingDataArray {
 
  private:
   std::vector<V6TrainingData> training_data_;
+  // Game ply of every chunk.
+  std::vector<int> plies_;
   FillEmptyHistory fill_empty_history_[2];
   pblczero::NetworkFormat::InputFormat input_format_;
 };
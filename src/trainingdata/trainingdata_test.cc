@@ -0,0 +1,169 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "trainingdata/trainingdata.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include "trainingdata/reader.h"
+#include "trainingdata/writer.h"
+
+namespace lczero {
+namespace {
+
+V6TrainingData MakeRecord(int seed) {
+  V6TrainingData data;
+  std::memset(&data, 0, sizeof(data));
+  data.version = 6;
+  data.input_format = 1;
+  for (int i = 0; i < 1858; i++) data.probabilities[i] = -1.0f;
+  for (int i = 0; i < 30; i++) {
+    data.probabilities[(i * 61 + seed) % 1858] = (i + 1) / 465.0f;
+  }
+  for (int i = 0; i < 104; i++) data.planes[i] = 0x0123456789abcdefULL * i;
+  data.rule50_count = seed;
+  data.result_q = -1.0f;
+  data.best_idx = seed;
+  data.reserved = 0xdeadbeef;
+  return data;
+}
+
+}  // namespace
+
+TEST(TrainingData, V7RoundTrip) {
+  const auto data = MakeRecord(5);
+  V7TrainingDataHeader header;
+  std::vector<V7PolicyEntry> policy;
+  ToV7TrainingData(data, &header, &policy);
+  EXPECT_EQ(header.policy_count, 30);
+  V6TrainingData back;
+  FromV7TrainingData(header, policy.data(), &back);
+  EXPECT_EQ(back.version, 6u);
+  for (int i = 0; i < 1858; i++) {
+    EXPECT_NEAR(back.probabilities[i], data.probabilities[i], 1e-3f);
+  }
+  // Everything after the policy is copied bit for bit.
+  EXPECT_EQ(std::memcmp(&back.planes, &data.planes,
+                        sizeof(data) - offsetof(V6TrainingData, planes)),
+            0);
+}
+
+TEST(TrainingData, ReaderExpandsV7Files) {
+  const std::string filename = testing::TempDir() + "trainingdata_v7.gz";
+  {
+    TrainingDataWriter writer(filename, true);
+    for (int i = 0; i < 3; i++) writer.WriteChunk(MakeRecord(i));
+    writer.Finalize();
+  }
+  TrainingDataReader reader(filename);
+  V6TrainingData data;
+  for (int i = 0; i < 3; i++) {
+    ASSERT_TRUE(reader.ReadChunk(&data));
+    EXPECT_EQ(data.version, 6u);
+    EXPECT_EQ(data.rule50_count, i);
+    EXPECT_EQ(data.reserved, 0xdeadbeef);
+  }
+  EXPECT_FALSE(reader.ReadChunk(&data));
+  std::remove(filename.c_str());
+}
+
+TEST(TrainingData, ReaderStillReadsV6Files) {
+  const std::string filename = testing::TempDir() + "trainingdata_v6.gz";
+  const auto record = MakeRecord(7);
+  {
+    TrainingDataWriter writer(filename);
+    writer.WriteChunk(record);
+    writer.WriteChunk(record);
+    writer.Finalize();
+  }
+  TrainingDataReader reader(filename);
+  V6TrainingData data;
+  for (int i = 0; i < 2; i++) {
+    ASSERT_TRUE(reader.ReadChunk(&data));
+    EXPECT_EQ(std::memcmp(&data, &record, sizeof(data)), 0);
+  }
+  EXPECT_FALSE(reader.ReadChunk(&data));
+  std::remove(filename.c_str());
+}
+
+TEST(TrainingData, WriteQueueWritesFiles) {
+  std::vector<std::string> filenames;
+  std::atomic<int> done{0};
+  {
+    TrainingDataWriteQueue queue(2, 1);
+    for (int i = 0; i < 5; i++) {
+      TrainingDataWriter writer(100 + i, i % 2 == 1, &queue);
+      writer.WriteChunk(MakeRecord(i));
+      filenames.push_back(writer.GetFileName());
+      writer.Finalize([&done]() { ++done; });
+    }
+    queue.Flush();
+    EXPECT_EQ(done.load(), 5);
+  }
+  for (int i = 0; i < 5; i++) {
+    TrainingDataReader reader(filenames[i]);
+    V6TrainingData data;
+    ASSERT_TRUE(reader.ReadChunk(&data));
+    EXPECT_EQ(data.rule50_count, i);
+    EXPECT_FALSE(reader.ReadChunk(&data));
+    std::remove(filenames[i].c_str());
+  }
+}
+
+TEST(TrainingData, ReadsUncompressedFilesInBulk) {
+  const std::string filename = testing::TempDir() + "trainingdata_raw";
+  std::vector<V6TrainingData> records;
+  for (int i = 0; i < 300; i++) records.push_back(MakeRecord(i % 200));
+  {
+    std::ofstream out(filename, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(records.data()),
+              records.size() * sizeof(V6TrainingData));
+  }
+  TrainingDataReader reader(filename);
+  V6TrainingData first[2];
+  ASSERT_EQ(reader.ReadChunks(first, 2), 2u);
+  const auto rest = reader.ReadAll();
+  ASSERT_EQ(rest.size(), 298u);
+  EXPECT_EQ(std::memcmp(&first[1], &records[1], sizeof(V6TrainingData)), 0);
+  EXPECT_EQ(std::memcmp(rest.data(), &records[2],
+                        rest.size() * sizeof(V6TrainingData)),
+            0);
+  std::remove(filename.c_str());
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -27,9 +27,12 @@
 
 #include "trainingdata/writer.h"
 
+#include <algorithm>
+
 #include "trainingdata/trainingdata.h"
 #include "utils/exception.h"
 #include "utils/filesystem.h"
+#include "utils/logging.h"
 #include "utils/random.h"
 
 namespace lczero {
@@ -43,9 +46,7 @@ std::string GetLc0CacheDirectory() {
   return user_cache_path;
 }
 
-}  // namespace
-
-TrainingDataWriter::TrainingDataWriter(int game_id) {
+std::string GetTrainingFileName(int game_id) {
   static std::string directory =
       GetLc0CacheDirectory() + "data-" + Random::Get().GetString(12);
   // It's fine if it already exists.
@@ -54,29 +55,133 @@ TrainingDataWriter::TrainingDataWriter(int game_id) {
   std::ostringstream oss;
   oss << directory << '/' << "game_" << std::setfill('0') << std::setw(6)
       << game_id << ".gz";
+  return oss.str();
+}
+
+}  // namespace
+
+TrainingDataWriteQueue::TrainingDataWriteQueue(size_t max_pending, int level)
+    : max_pending_(std::max<size_t>(max_pending, 1)),
+      mode_("wb" + std::to_string(level)) {
+  thread_ = std::thread([this]() { Worker(); });
+}
+
+TrainingDataWriteQueue::~TrainingDataWriteQueue() {
+  {
+    Mutex::Lock lock(mutex_);
+    exiting_ = true;
+  }
+  job_added_.notify_all();
+  thread_.join();
+}
+
+void TrainingDataWriteQueue::Submit(std::string filename, std::string data,
+                                    std::function<void()> done) {
+  {
+    Mutex::Lock lock(mutex_);
+    job_done_.wait(lock.get_raw(), [&]() NO_THREAD_SAFETY_ANALYSIS {
+      return jobs_.size() < max_pending_;
+    });
+    jobs_.push_back({std::move(filename), std::move(data), std::move(done)});
+  }
+  job_added_.notify_one();
+}
 
-  filename_ = oss.str();
+void TrainingDataWriteQueue::Flush() {
+  Mutex::Lock lock(mutex_);
+  job_done_.wait(lock.get_raw(), [&]() NO_THREAD_SAFETY_ANALYSIS {
+    return jobs_.empty() && !busy_;
+  });
+}
+
+void TrainingDataWriteQueue::Worker() {
+  while (true) {
+    Job job;
+    {
+      Mutex::Lock lock(mutex_);
+      job_added_.wait(lock.get_raw(), [&]() NO_THREAD_SAFETY_ANALYSIS {
+        return exiting_ || !jobs_.empty();
+      });
+      // Exits only once the queue is drained.
+      if (jobs_.empty()) return;
+      job = std::move(jobs_.front());
+      jobs_.pop_front();
+      busy_ = true;
+    }
+    job_done_.notify_all();
+    // An exception would end the thread, so failures are only logged.
+    gzFile fout = gzopen(job.filename.c_str(), mode_.c_str());
+    if (!fout) {
+      CERR << "Cannot create gzip file " << job.filename;
+    } else {
+      const int size = job.data.size();
+      if (gzwrite(fout, job.data.data(), size) != size) {
+        CERR << "Unable to write into " << job.filename;
+      }
+      gzclose(fout);
+    }
+    if (job.done) job.done();
+    {
+      Mutex::Lock lock(mutex_);
+      busy_ = false;
+    }
+    job_done_.notify_all();
+  }
+}
+
+TrainingDataWriter::TrainingDataWriter(int game_id, bool sparse)
+    : filename_(GetTrainingFileName(game_id)), sparse_(sparse) {
   fout_ = gzopen(filename_.c_str(), "wb");
   if (!fout_) throw Exception("Cannot create gzip file " + filename_);
 }
 
-TrainingDataWriter::TrainingDataWriter(std::string filename)
-    : filename_(filename) {
+TrainingDataWriter::TrainingDataWriter(std::string filename, bool sparse)
+    : filename_(filename), sparse_(sparse) {
   fout_ = gzopen(filename_.c_str(), "wb");
   if (!fout_) throw Exception("Cannot create gzip file " + filename_);
 }
 
-void TrainingDataWriter::WriteChunk(const V6TrainingData& data) {
-  auto bytes_written =
-      gzwrite(fout_, reinterpret_cast<const char*>(&data), sizeof(data));
-  if (bytes_written != sizeof(data)) {
+TrainingDataWriter::TrainingDataWriter(int game_id, bool sparse,
+                                       TrainingDataSink* queue)
+    : filename_(GetTrainingFileName(game_id)),
+      sparse_(sparse),
+      queue_(queue),
+      out_(&buffer_) {}
+
+TrainingDataWriter::TrainingDataWriter(std::string* out, bool sparse)
+    : sparse_(sparse), out_(out) {}
+
+void TrainingDataWriter::Write(const void* data, size_t size) {
+  if (out_) {
+    out_->append(static_cast<const char*>(data), size);
+    return;
+  }
+  if (gzwrite(fout_, data, size) != static_cast<int>(size)) {
     throw Exception("Unable to write into " + filename_);
   }
 }
 
-void TrainingDataWriter::Finalize() {
-  gzclose(fout_);
+void TrainingDataWriter::WriteChunk(const V6TrainingData& data) {
+  if (sparse_) {
+    V7TrainingDataHeader header;
+    std::vector<V7PolicyEntry> policy;
+    ToV7TrainingData(data, &header, &policy);
+    Write(&header, sizeof(header));
+    Write(policy.data(), policy.size() * sizeof(V7PolicyEntry));
+    return;
+  }
+  Write(&data, sizeof(data));
+}
+
+void TrainingDataWriter::Finalize(std::function<void()> done) {
+  if (queue_) {
+    queue_->Submit(filename_, std::move(buffer_), std::move(done));
+    queue_ = nullptr;
+    return;
+  }
+  if (fout_) gzclose(fout_);
   fout_ = nullptr;
+  if (done) done();
 }
 
 }  // namespace lczero
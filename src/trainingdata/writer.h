@@ -27,36 +27,113 @@
 
 #pragma once
 
-#include <fstream>
 #include <zlib.h>
 
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include "utils/mutex.h"
+
 namespace lczero {
 
 struct V6TrainingData;
 
+// Takes over the finished games of TrainingDataWriter, which then doesn't
+// write them itself.
+class TrainingDataSink {
+ public:
+  virtual ~TrainingDataSink() = default;
+
+  // Takes the uncompressed records of the game that would be written into
+  // @filename. @done, if set, is called once the game is stored.
+  virtual void Submit(std::string filename, std::string data,
+                      std::function<void()> done) = 0;
+
+  // Waits until all the submitted games are stored.
+  virtual void Flush() = 0;
+};
+
+// Compresses and writes training data files on a background thread, so that
+// the selfplay threads only hand over the finished games.
+class TrainingDataWriteQueue : public TrainingDataSink {
+ public:
+  // At most @max_pending files wait to be written, Submit() blocks beyond
+  // that. @level is the zlib compression level.
+  TrainingDataWriteQueue(size_t max_pending, int level);
+  TrainingDataWriteQueue(const TrainingDataWriteQueue&) = delete;
+  TrainingDataWriteQueue& operator=(const TrainingDataWriteQueue&) = delete;
+  // Writes all the pending files and joins the thread.
+  ~TrainingDataWriteQueue();
+
+  // Queues @data to be compressed into @filename. @done, if set, is called on
+  // the writer thread once the file is complete.
+  void Submit(std::string filename, std::string data,
+              std::function<void()> done) override;
+
+  // Waits until all the submitted files are written.
+  void Flush() override;
+
+ private:
+  struct Job {
+    std::string filename;
+    std::string data;
+    std::function<void()> done;
+  };
+
+  void Worker();
+
+  const size_t max_pending_;
+  const std::string mode_;
+  Mutex mutex_;
+  std::condition_variable job_added_;
+  std::condition_variable job_done_;
+  std::deque<Job> jobs_ GUARDED_BY(mutex_);
+  bool busy_ GUARDED_BY(mutex_) = false;
+  bool exiting_ GUARDED_BY(mutex_) = false;
+  std::thread thread_;
+};
+
 class TrainingDataWriter {
  public:
   // Creates a new file to write in data directory. It will has @game_id
-  // somewhere in the filename.
-  TrainingDataWriter(int game_id);
-  TrainingDataWriter(std::string filename);
+  // somewhere in the filename. With @sparse set chunks are stored in the V7
+  // format.
+  TrainingDataWriter(int game_id, bool sparse = false);
+  TrainingDataWriter(std::string filename, bool sparse = false);
+  // Same, but the chunks are kept in memory and Finalize() passes them to
+  // @queue.
+  TrainingDataWriter(int game_id, bool sparse, TrainingDataSink* queue);
+  // Appends the uncompressed chunks to @out rather than writing a file.
+  TrainingDataWriter(std::string* out, bool sparse = false);
 
   ~TrainingDataWriter() {
-    if (fout_) Finalize();
+    if (fout_ || queue_) Finalize();
   }
 
   // Writes a chunk.
   void WriteChunk(const V6TrainingData& data);
 
-  // Flushes file and closes it.
-  void Finalize();
+  // Flushes file and closes it. When writing through a queue, @done is called
+  // from the queue thread once the file is complete, otherwise right away.
+  void Finalize(std::function<void()> done = nullptr);
 
   // Gets full filename of the file written.
   std::string GetFileName() const { return filename_; }
 
  private:
+  void Write(const void* data, size_t size);
+
   std::string filename_;
-  gzFile fout_;
+  gzFile fout_ = nullptr;
+  const bool sparse_;
+  TrainingDataSink* queue_ = nullptr;
+  std::string buffer_;
+  // Where chunks are kept when not writing to the file directly.
+  std::string* out_ = nullptr;
 };
 
 }  // namespace lczero
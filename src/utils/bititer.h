@@ -30,6 +30,7 @@
 #include <iterator>
 #ifdef _MSC_VER
 #include <intrin.h>
+#include <cstdlib>
 #endif
 
 namespace lczero {
@@ -71,10 +72,11 @@ inline uint64_t ReverseBitsInBytes(uint64_t v) {
 }
 
 inline uint64_t ReverseBytesInBytes(uint64_t v) {
-  v = (v & 0x00000000FFFFFFFF) << 32 | (v & 0xFFFFFFFF00000000) >> 32;
-  v = (v & 0x0000FFFF0000FFFF) << 16 | (v & 0xFFFF0000FFFF0000) >> 16;
-  v = (v & 0x00FF00FF00FF00FF) << 8 | (v & 0xFF00FF00FF00FF00) >> 8;
-  return v;
+#if defined(_MSC_VER)
+  return _byteswap_uint64(v);
+#else
+  return __builtin_bswap64(v);
+#endif
 }
 
 // Transpose across the diagonal connecting bit 7 to bit 56.
@@ -88,6 +90,15 @@ inline uint64_t TransposeBitsInBytes(uint64_t v) {
   return v;
 }
 
+// Applies a combination of BoardTransform to the bits of @v. Flip and mirror
+// go first, the same order as used when choosing the transform.
+inline uint64_t TransformBits(uint64_t v, int transform) {
+  if ((transform & FlipTransform) != 0) v = ReverseBitsInBytes(v);
+  if ((transform & MirrorTransform) != 0) v = ReverseBytesInBytes(v);
+  if ((transform & TransposeTransform) != 0) v = TransposeBitsInBytes(v);
+  return v;
+}
+
 // Iterates over all set bits of the value, lower to upper. The value of
 // dereferenced iterator is bit number (lower to upper, 0 bazed)
 template <typename T>
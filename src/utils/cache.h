@@ -27,15 +27,60 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
 #include <cstring>
+#include <deque>
 #include <memory>
 #include <string>
+#include <vector>
 
+#include "utils/largepages.h"
 #include "utils/mutex.h"
+#include "utils/prefetch.h"
 
 namespace lczero {
 
+// Bytes taken by a value stored in HashKeyedCache. Overload it for values
+// which own further memory.
+template <class V>
+size_t GetCacheValueBytes(const V&) {
+  return sizeof(V);
+}
+
+// How HashKeyedCache picks entries to evict.
+enum class CacheEvictionPolicy {
+  // Oldest insertion first.
+  kFifo,
+  // Second chance: an entry looked up since it was last considered is kept
+  // once more and goes to the back of the queue.
+  kClock,
+  // Like kClock, but an entry is kept as many times as it was looked up, up
+  // to a small limit, so that frequently used entries survive longer.
+  kFrequency,
+};
+
+// Names of the eviction policies, in the order of the enum.
+inline constexpr const char* kCacheEvictionPolicyNames[] = {"fifo", "clock",
+                                                            "frequency"};
+inline std::vector<std::string> GetCacheEvictionPolicyNames() {
+  return {std::begin(kCacheEvictionPolicyNames),
+          std::end(kCacheEvictionPolicyNames)};
+}
+inline const char* GetCacheEvictionPolicyName(CacheEvictionPolicy policy) {
+  return kCacheEvictionPolicyNames[static_cast<int>(policy)];
+}
+// Returns the policy named @name, FIFO if there's none such.
+inline CacheEvictionPolicy ParseCacheEvictionPolicy(const std::string& name) {
+  const auto names = GetCacheEvictionPolicyNames();
+  for (size_t i = 0; i < names.size(); i++) {
+    if (names[i] == name) return static_cast<CacheEvictionPolicy>(i);
+  }
+  return CacheEvictionPolicy::kFifo;
+}
+
 // A hash-keyed cache. Thread-safe. Takes ownership of all values, which are
 // deleted upon eviction; thus, using values stored requires pinning them, which
 // in turn requires Unpin()ing them after use. The use of HashKeyedCacheLock is
@@ -43,68 +88,31 @@ namespace lczero {
 // Unlike LRUCache, doesn't even consider trying to support LRU order.
 // Does not support delete.
 // Does not support replace! Inserts to existing elements are silently ignored.
-// FIFO eviction.
+// FIFO eviction by default, or one of the CacheEvictionPolicy alternatives.
 // Assumes that eviction while pinned is rare enough to not need to optimize
 // unpin for that case.
+// Keys are spread over shards with a lock of their own, so that threads
+// rarely wait for each other. The eviction order is kept per shard.
 template <class V>
 class HashKeyedCache {
-  static const double constexpr kLoadFactor = 1.9;
-
  public:
-  HashKeyedCache(int capacity = 128)
-      : capacity_(capacity),
-        hash_(static_cast<size_t>(capacity * kLoadFactor + 1)) {}
-
-  ~HashKeyedCache() {
-    EvictToCapacity(0);
-    assert(size_ == 0);
-    assert(allocated_ == 0);
+  HashKeyedCache(int capacity = 128) : table_(kNumShards) {
+    for (int i = 0; i < kNumShards; i++) shards_[i].SetTable(&table_[i], 1);
+    SetCapacity(capacity);
   }
 
   // Inserts the element under key @key with value @val. Unless the key is
   // already in the cache.
   void Insert(uint64_t key, std::unique_ptr<V> val) {
     if (capacity_.load(std::memory_order_relaxed) == 0) return;
-
-    SpinMutex::Lock lock(mutex_);
-
-    size_t idx = key % hash_.size();
-    while (true) {
-      if (!hash_[idx].in_use) break;
-      if (hash_[idx].key == key) {
-        // Already exists.
-        return;
-      }
-      ++idx;
-      if (idx >= hash_.size()) idx -= hash_.size();
-    }
-    hash_[idx].key = key;
-    hash_[idx].value = std::move(val);
-    hash_[idx].pins = 0;
-    hash_[idx].in_use = true;
-    insertion_order_.push_back(key);
-    ++size_;
-    ++allocated_;
-
-    EvictToCapacity(capacity_);
+    GetShard(key).Insert(key, std::move(val));
   }
 
   // Checks whether a key exists. Doesn't pin. Of course the next moment the
   // key may be evicted.
   bool ContainsKey(uint64_t key) {
     if (capacity_.load(std::memory_order_relaxed) == 0) return false;
-
-    SpinMutex::Lock lock(mutex_);
-    size_t idx = key % hash_.size();
-    while (true) {
-      if (!hash_[idx].in_use) break;
-      if (hash_[idx].key == key) {
-        return true;
-      }
-      ++idx;
-      if (idx >= hash_.size()) idx -= hash_.size();
-    }
-    return false;
+    return GetShard(key).ContainsKey(key);
   }
 
   // Looks up and pins the element by key. Returns nullptr if not found.
@@ -112,105 +120,115 @@ class HashKeyedCache {
   // Use of HashedKeyCacheLock is recommended to automate this pin management.
   V* LookupAndPin(uint64_t key) {
     if (capacity_.load(std::memory_order_relaxed) == 0) return nullptr;
+    return GetShard(key).LookupAndPin(key);
+  }
 
-    SpinMutex::Lock lock(mutex_);
+  // Starts loading the slot of @key into the CPU cache, so that a lookup of it
+  // soon after doesn't wait for memory. Doesn't lock.
+  void Prefetch(uint64_t key) const { GetShard(key).Prefetch(key); }
 
-    size_t idx = key % hash_.size();
-    while (true) {
-      if (!hash_[idx].in_use) break;
-      if (hash_[idx].key == key) {
-        ++hash_[idx].pins;
-        return hash_[idx].value.get();
-      }
-      ++idx;
-      if (idx >= hash_.size()) idx -= hash_.size();
-    }
-    return nullptr;
+  // Looks up and pins @count elements by @keys, storing them (nullptr if not
+  // found) to @values. The slots of all keys are prefetched first, so their
+  // memory accesses overlap.
+  void LookupAndPinBatch(const uint64_t* keys, size_t count, V** values) {
+    for (size_t i = 0; i < count; i++) Prefetch(keys[i]);
+    for (size_t i = 0; i < count; i++) values[i] = LookupAndPin(keys[i]);
   }
 
   // Unpins the element given key and value. Use of HashedKeyCacheLock is
   // recommended to automate this pin management.
-  void Unpin(uint64_t key, V* value) {
-    SpinMutex::Lock lock(mutex_);
-
-    // Checking evicted list first.
-    for (auto it = evicted_.begin(); it != evicted_.end(); ++it) {
-      auto& entry = *it;
-      if (key == entry.key && value == entry.value.get()) {
-        if (--entry.pins == 0) {
-          --allocated_;
-          evicted_.erase(it);
-          return;
-        } else {
-          return;
-        }
-      }
-    }
-    // Now the main list.
-    size_t idx = key % hash_.size();
-    while (true) {
-      if (!hash_[idx].in_use) break;
-      if (hash_[idx].key == key &&
-          hash_[idx].value.get() == value) {
-        --hash_[idx].pins;
-        return;
-      }
-      ++idx;
-      if (idx >= hash_.size()) idx -= hash_.size();
-    }
-    assert(false);
+  void Unpin(uint64_t key, V* value) { GetShard(key).Unpin(key, value); }
+
+  // Exempts the element under @key from eviction until the cache is cleared
+  // or shrunk, for entries known to be needed again and again. At most half
+  // of the capacity is kept. Returns false if the key is not in the cache or
+  // no more entries can be kept.
+  bool Keep(uint64_t key) {
+    if (capacity_.load(std::memory_order_relaxed) == 0) return false;
+    return GetShard(key).Keep(key);
   }
 
   // Sets the capacity of the cache. If new capacity is less than current size
   // of the cache, oldest entries are evicted. In any case the hashtable is
   // rehashed.
   void SetCapacity(int capacity) {
-    // This is the one operation that can be expected to take a long time, which
-    // usually means a SpinMutex is not a great idea. However we should only
-    // very rarely have any contention on the lock while this function is
-    // running, since its called very rarely and almost always before things
-    // start happening.
-    SpinMutex::Lock lock(mutex_);
-
+    if (capacity < 0) capacity = 0;
+    Mutex::Lock lock(capacity_mutex_);
     if (capacity_.load(std::memory_order_relaxed) == capacity) return;
-    EvictToCapacity(capacity);
+    // All shards share one table, so that it's large enough for large pages.
+    // Each shard moves its entries to its slice of the new table, and the old
+    // one is freed when none of them uses it anymore.
+    std::array<int, kNumShards> shard_capacities;
+    size_t table_size = 0;
+    for (int i = 0; i < kNumShards; i++) {
+      shard_capacities[i] =
+          capacity / kNumShards + (i < capacity % kNumShards ? 1 : 0);
+      table_size += GetSliceSize(shard_capacities[i]);
+    }
+    EntryTable new_table(table_size);
+    Entry* slice = new_table.data();
+    for (int i = 0; i < kNumShards; i++) {
+      const size_t slice_size = GetSliceSize(shard_capacities[i]);
+      shards_[i].SetCapacity(shard_capacities[i], slice, slice_size);
+      slice += slice_size;
+    }
+    table_.swap(new_table);
     capacity_.store(capacity);
+  }
 
-    std::vector<Entry> new_hash(
-        static_cast<size_t>(capacity * kLoadFactor + 1));
-
-    if (size_ != 0) {
-      for (Entry& item : hash_) {
-        if (!item.in_use) continue;
-        size_t idx = item.key % new_hash.size();
-        while (true) {
-          if (!new_hash[idx].in_use) break;
-          ++idx;
-          if (idx >= new_hash.size()) idx -= new_hash.size();
-        }
-        new_hash[idx].key = item.key;
-        new_hash[idx].value = std::move(item.value);
-        new_hash[idx].pins = item.pins;
-        new_hash[idx].in_use = true;
-      }
-    }
-    hash_.swap(new_hash);
+  // Sets how entries are picked for eviction from now on.
+  void SetEvictionPolicy(CacheEvictionPolicy policy) {
+    for (auto& shard : shards_) shard.SetEvictionPolicy(policy);
+    policy_.store(policy, std::memory_order_relaxed);
+  }
+  CacheEvictionPolicy GetEvictionPolicy() const {
+    return policy_.load(std::memory_order_relaxed);
   }
 
-  // Clears the cache;
+  // Clears the cache, kept entries included.
   void Clear() {
-    SpinMutex::Lock lock(mutex_);
-    EvictToCapacity(0);
+    for (auto& shard : shards_) shard.Clear();
   }
 
   int GetSize() const {
-    SpinMutex::Lock lock(mutex_);
-    return size_;
+    int size = 0;
+    for (const auto& shard : shards_) size += shard.GetSize();
+    return size;
   }
   int GetCapacity() const { return capacity_.load(std::memory_order_relaxed); }
+  // Number of LookupAndPin() calls which found their key, and of all of them,
+  // since the cache was created.
+  uint64_t GetHits() const {
+    uint64_t hits = 0;
+    for (const auto& shard : shards_) hits += shard.GetHits();
+    return hits;
+  }
+  uint64_t GetLookups() const {
+    uint64_t lookups = 0;
+    for (const auto& shard : shards_) lookups += shard.GetLookups();
+    return lookups;
+  }
+  // Number of entries evicted to make room for new ones since the cache was
+  // created.
+  uint64_t GetEvictions() const {
+    uint64_t evictions = 0;
+    for (const auto& shard : shards_) evictions += shard.GetEvictions();
+    return evictions;
+  }
   static constexpr size_t GetItemStructSize() { return sizeof(Entry); }
+  // Bytes taken by the hash tables, the insertion orders and all values still
+  // allocated, including evicted ones which are still pinned.
+  size_t GetMemoryUsage() const {
+    size_t bytes = 0;
+    for (const auto& shard : shards_) bytes += shard.GetMemoryUsage();
+    return bytes;
+  }
 
  private:
+  static const double constexpr kLoadFactor = 1.9;
+  static constexpr int kShardBits = 6;
+  static constexpr int kNumShards = 1 << kShardBits;
+
   struct Entry {
     Entry() {}
     Entry(uint64_t key, std::unique_ptr<V> value)
@@ -218,71 +236,358 @@ class HashKeyedCache {
     uint64_t key;
     std::unique_ptr<V> value;
     int pins = 0;
+    // Lookups which still earn the entry a pass over eviction.
+    uint8_t uses = 0;
+    // Exempt from eviction while there are other entries to evict.
+    bool kept = false;
     bool in_use = false;
   };
 
-  void EvictItem() REQUIRES(mutex_) {
-    --size_;
-    uint64_t key = insertion_order_.front();
-    insertion_order_.pop_front();
-    size_t idx = key % hash_.size();
-    while (true) {
-      if (hash_[idx].in_use && hash_[idx].key == key) {
-        break;
-      }
-      ++idx;
-      if (idx >= hash_.size()) idx -= hash_.size();
+  // Most passes over eviction an entry earns with kFrequency.
+  static constexpr uint8_t kMaxUses = 3;
+
+  using EntryTable = std::vector<Entry, LargePageAllocator<Entry>>;
+
+  // Open addressing table over a slice of the shared table, for the keys of
+  // one shard. Aligned so that the locks of different shards are not in the
+  // same cache line.
+  class alignas(64) Shard {
+   public:
+    // Sets the initial slice, which must be empty.
+    void SetTable(Entry* table, size_t size) {
+      SpinMutex::Lock lock(mutex_);
+      hash_ = table;
+      hash_size_ = size;
+      PublishTable();
+    }
+
+    ~Shard() {
+      EvictToCapacity(0);
+      assert(size_ == 0);
+      assert(allocated_ == 0);
     }
-    if (hash_[idx].pins == 0) {
-      --allocated_;
-      hash_[idx].value.reset();
-      hash_[idx].in_use = false;
-    } else {
-      evicted_.emplace_back(hash_[idx].key, std::move(hash_[idx].value));
-      evicted_.back().pins = hash_[idx].pins;
+
+    void Insert(uint64_t key, std::unique_ptr<V> val) {
+      SpinMutex::Lock lock(mutex_);
+      if (capacity_ == 0) return;
+
+      size_t idx = key % hash_size_;
+      while (true) {
+        if (!hash_[idx].in_use) break;
+        if (hash_[idx].key == key) {
+          // Already exists.
+          return;
+        }
+        ++idx;
+        if (idx >= hash_size_) idx -= hash_size_;
+      }
+      value_bytes_ += GetCacheValueBytes(*val);
+      hash_[idx].key = key;
+      hash_[idx].value = std::move(val);
       hash_[idx].pins = 0;
-      hash_[idx].in_use = false;
+      hash_[idx].uses = 0;
+      hash_[idx].kept = false;
+      hash_[idx].in_use = true;
+      insertion_order_.push_back(key);
+      ++size_;
+      ++allocated_;
+
+      if (size_ > capacity_) {
+        evictions_ += size_ - capacity_;
+        EvictToCapacity(capacity_);
+      }
     }
-    size_t next = idx + 1;
-    if (next >= hash_.size()) next -= hash_.size();
-    while (true) {
-      if (!hash_[next].in_use) {
-        break;
+
+    bool ContainsKey(uint64_t key) {
+      SpinMutex::Lock lock(mutex_);
+      size_t idx = key % hash_size_;
+      while (true) {
+        if (!hash_[idx].in_use) break;
+        if (hash_[idx].key == key) {
+          return true;
+        }
+        ++idx;
+        if (idx >= hash_size_) idx -= hash_size_;
       }
-      size_t target = hash_[next].key % hash_.size();
-      if (!InRange(target, idx + 1, next)) {
-        std::swap(hash_[next], hash_[idx]);
-        idx = next;
+      return false;
+    }
+
+    V* LookupAndPin(uint64_t key) {
+      SpinMutex::Lock lock(mutex_);
+
+      ++lookups_;
+      size_t idx = key % hash_size_;
+      while (true) {
+        if (!hash_[idx].in_use) break;
+        if (hash_[idx].key == key) {
+          ++hits_;
+          ++hash_[idx].pins;
+          if (hash_[idx].uses < max_uses_) ++hash_[idx].uses;
+          return hash_[idx].value.get();
+        }
+        ++idx;
+        if (idx >= hash_size_) idx -= hash_size_;
       }
-      ++next;
-      if (next >= hash_.size()) next -= hash_.size();
+      return nullptr;
+    }
+
+    void Unpin(uint64_t key, V* value) {
+      SpinMutex::Lock lock(mutex_);
+
+      // Checking evicted list first.
+      for (auto it = evicted_.begin(); it != evicted_.end(); ++it) {
+        auto& entry = *it;
+        if (key == entry.key && value == entry.value.get()) {
+          if (--entry.pins == 0) {
+            --allocated_;
+            value_bytes_ -= GetCacheValueBytes(*entry.value);
+            evicted_.erase(it);
+            return;
+          } else {
+            return;
+          }
+        }
+      }
+      // Now the main list.
+      size_t idx = key % hash_size_;
+      while (true) {
+        if (!hash_[idx].in_use) break;
+        if (hash_[idx].key == key && hash_[idx].value.get() == value) {
+          --hash_[idx].pins;
+          return;
+        }
+        ++idx;
+        if (idx >= hash_size_) idx -= hash_size_;
+      }
+      assert(false);
     }
-  }
 
-  bool InRange(size_t target, size_t start, size_t end) {
-    if (start <= end) {
-      return target >= start && target <= end;
-    } else {
-      return target >= start || target <= end;
+    bool Keep(uint64_t key) {
+      SpinMutex::Lock lock(mutex_);
+      size_t idx = key % hash_size_;
+      while (true) {
+        if (!hash_[idx].in_use) return false;
+        if (hash_[idx].key == key) break;
+        ++idx;
+        if (idx >= hash_size_) idx -= hash_size_;
+      }
+      if (hash_[idx].kept) return true;
+      if (kept_ >= capacity_ / 2) return false;
+      hash_[idx].kept = true;
+      ++kept_;
+      return true;
     }
-  }
 
-  void EvictToCapacity(int capacity) REQUIRES(mutex_) {
-    if (capacity < 0) capacity = 0;
-    while (size_ > capacity) {
-      EvictItem();
+    // Evicts down to @capacity and rehashes into the empty @table.
+    void SetCapacity(int capacity, Entry* table, size_t size) {
+      // This is the one operation that can be expected to take a long time,
+      // which usually means a SpinMutex is not a great idea. However we should
+      // only very rarely have any contention on the lock while this function
+      // is running, since its called very rarely and almost always before
+      // things start happening.
+      SpinMutex::Lock lock(mutex_);
+
+      EvictToCapacity(capacity);
+      capacity_ = capacity;
+
+      if (size_ != 0) {
+        for (size_t i = 0; i < hash_size_; i++) {
+          Entry& item = hash_[i];
+          if (!item.in_use) continue;
+          size_t idx = item.key % size;
+          while (true) {
+            if (!table[idx].in_use) break;
+            ++idx;
+            if (idx >= size) idx -= size;
+          }
+          table[idx].key = item.key;
+          table[idx].value = std::move(item.value);
+          table[idx].pins = item.pins;
+          table[idx].uses = item.uses;
+          table[idx].kept = item.kept;
+          table[idx].in_use = true;
+        }
+      }
+      hash_ = table;
+      hash_size_ = size;
+      PublishTable();
+    }
+
+    void Prefetch(uint64_t key) const {
+      // The two may be from different tables while the capacity changes,
+      // which only prefetches a useless line.
+      const Entry* table = prefetch_hash_.load(std::memory_order_relaxed);
+      const size_t size = prefetch_hash_size_.load(std::memory_order_relaxed);
+      PrefetchForRead(&table[key % size]);
+    }
+
+    void Clear() {
+      SpinMutex::Lock lock(mutex_);
+      EvictToCapacity(0);
+    }
+
+    void SetEvictionPolicy(CacheEvictionPolicy policy) {
+      SpinMutex::Lock lock(mutex_);
+      switch (policy) {
+        case CacheEvictionPolicy::kFifo:
+          max_uses_ = 0;
+          break;
+        case CacheEvictionPolicy::kClock:
+          max_uses_ = 1;
+          break;
+        case CacheEvictionPolicy::kFrequency:
+          max_uses_ = kMaxUses;
+          break;
+      }
+      // Uses counted under a more generous policy don't carry over.
+      for (size_t i = 0; i < hash_size_; i++) {
+        hash_[i].uses = std::min(hash_[i].uses, max_uses_);
+      }
+    }
+
+    int GetSize() const {
+      SpinMutex::Lock lock(mutex_);
+      return size_;
+    }
+    uint64_t GetHits() const {
+      SpinMutex::Lock lock(mutex_);
+      return hits_;
+    }
+    uint64_t GetLookups() const {
+      SpinMutex::Lock lock(mutex_);
+      return lookups_;
+    }
+    uint64_t GetEvictions() const {
+      SpinMutex::Lock lock(mutex_);
+      return evictions_;
     }
+    size_t GetMemoryUsage() const {
+      SpinMutex::Lock lock(mutex_);
+      return (hash_size_ + evicted_.size()) * sizeof(Entry) +
+             insertion_order_.size() * sizeof(uint64_t) + value_bytes_;
+    }
+
+   private:
+    void PublishTable() REQUIRES(mutex_) {
+      prefetch_hash_.store(hash_, std::memory_order_relaxed);
+      prefetch_hash_size_.store(hash_size_, std::memory_order_relaxed);
+    }
+
+    size_t FindInUse(uint64_t key) REQUIRES(mutex_) {
+      size_t idx = key % hash_size_;
+      while (true) {
+        if (hash_[idx].in_use && hash_[idx].key == key) return idx;
+        ++idx;
+        if (idx >= hash_size_) idx -= hash_size_;
+      }
+    }
+
+    void EvictItem() REQUIRES(mutex_) {
+      // Kept entries go to the back of the queue, unless only they are left.
+      const bool evict_kept = kept_ == size_;
+      --size_;
+      // Entries with uses left go to the back of the queue with one use less.
+      // Every pass takes a use away, so this ends within kMaxUses rounds.
+      size_t idx;
+      while (true) {
+        const uint64_t key = insertion_order_.front();
+        insertion_order_.pop_front();
+        idx = FindInUse(key);
+        if (hash_[idx].kept && !evict_kept) {
+          insertion_order_.push_back(key);
+          continue;
+        }
+        if (hash_[idx].uses == 0) break;
+        --hash_[idx].uses;
+        insertion_order_.push_back(key);
+      }
+      if (hash_[idx].kept) {
+        --kept_;
+        hash_[idx].kept = false;
+      }
+      if (hash_[idx].pins == 0) {
+        --allocated_;
+        value_bytes_ -= GetCacheValueBytes(*hash_[idx].value);
+        hash_[idx].value.reset();
+        hash_[idx].in_use = false;
+      } else {
+        evicted_.emplace_back(hash_[idx].key, std::move(hash_[idx].value));
+        evicted_.back().pins = hash_[idx].pins;
+        hash_[idx].pins = 0;
+        hash_[idx].in_use = false;
+      }
+      size_t next = idx + 1;
+      if (next >= hash_size_) next -= hash_size_;
+      while (true) {
+        if (!hash_[next].in_use) {
+          break;
+        }
+        size_t target = hash_[next].key % hash_size_;
+        if (!InRange(target, idx + 1, next)) {
+          std::swap(hash_[next], hash_[idx]);
+          idx = next;
+        }
+        ++next;
+        if (next >= hash_size_) next -= hash_size_;
+      }
+    }
+
+    bool InRange(size_t target, size_t start, size_t end) {
+      if (start <= end) {
+        return target >= start && target <= end;
+      } else {
+        return target >= start || target <= end;
+      }
+    }
+
+    void EvictToCapacity(int capacity) REQUIRES(mutex_) {
+      if (capacity < 0) capacity = 0;
+      while (size_ > capacity) {
+        EvictItem();
+      }
+    }
+
+    int capacity_ GUARDED_BY(mutex_) = 0;
+    int size_ GUARDED_BY(mutex_) = 0;
+    int allocated_ GUARDED_BY(mutex_) = 0;
+    int kept_ GUARDED_BY(mutex_) = 0;
+    size_t value_bytes_ GUARDED_BY(mutex_) = 0;
+    uint8_t max_uses_ GUARDED_BY(mutex_) = 0;
+    uint64_t hits_ GUARDED_BY(mutex_) = 0;
+    uint64_t lookups_ GUARDED_BY(mutex_) = 0;
+    uint64_t evictions_ GUARDED_BY(mutex_) = 0;
+    // Fresh in back (or given another chance), stale at front.
+    std::deque<uint64_t> GUARDED_BY(mutex_) insertion_order_;
+    std::vector<Entry> GUARDED_BY(mutex_) evicted_;
+    Entry* hash_ GUARDED_BY(mutex_) = nullptr;
+    size_t hash_size_ GUARDED_BY(mutex_) = 0;
+    // Copies of hash_ and hash_size_ for Prefetch(), which doesn't lock.
+    std::atomic<Entry*> prefetch_hash_{nullptr};
+    std::atomic<size_t> prefetch_hash_size_{1};
+
+    mutable SpinMutex mutex_{"HashKeyedCache shard"};
+  };
+
+  static size_t GetSliceSize(int capacity) {
+    return static_cast<size_t>(capacity * kLoadFactor + 1);
   }
 
-  std::atomic<int> capacity_;
-  int size_ GUARDED_BY(mutex_) = 0;
-  int allocated_ GUARDED_BY(mutex_) = 0;
-  // Fresh in back, stale at front.
-  std::deque<uint64_t> GUARDED_BY(mutex_) insertion_order_;
-  std::vector<Entry> GUARDED_BY(mutex_) evicted_;
-  std::vector<Entry> GUARDED_BY(mutex_) hash_;
+  // Slots within a shard are picked by the key modulo the slice size, so the
+  // shard is picked by the top bits of the key scrambled.
+  Shard& GetShard(uint64_t key) {
+    return shards_[(key * 0x9E3779B97F4A7C15ULL) >> (64 - kShardBits)];
+  }
+  const Shard& GetShard(uint64_t key) const {
+    return shards_[(key * 0x9E3779B97F4A7C15ULL) >> (64 - kShardBits)];
+  }
 
-  mutable SpinMutex mutex_;
+  std::atomic<int> capacity_{-1};
+  std::atomic<CacheEvictionPolicy> policy_{CacheEvictionPolicy::kFifo};
+  Mutex capacity_mutex_{"HashKeyedCache::capacity_mutex_"};
+  // Probed at random, so it goes to large pages when they are enabled.
+  // Declared before the shards, which use it until they are destroyed.
+  EntryTable table_;
+  std::array<Shard, kNumShards> shards_;
 };
 
 // Convenience class for pinning cache items.
@@ -292,6 +597,9 @@ class HashKeyedCacheLock {
   // Looks up the value in @cache by @key and pins it if found.
   HashKeyedCacheLock(HashKeyedCache<V>* cache, uint64_t key)
       : cache_(cache), key_(key), value_(cache->LookupAndPin(key_)) {}
+  // Takes over the pin of @value, found under @key by LookupAndPinBatch().
+  HashKeyedCacheLock(HashKeyedCache<V>* cache, uint64_t key, V* value)
+      : cache_(cache), key_(key), value_(value) {}
 
   // Unpins the cache entry (if holds).
   ~HashKeyedCacheLock() {
@@ -0,0 +1,251 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/cache.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace lczero {
+
+namespace {
+uint64_t Key(int i) { return i * 0x2545F4914F6CDD1DULL + 1; }
+}  // namespace
+
+TEST(HashKeyedCache, InsertsAndEvictsToCapacity) {
+  HashKeyedCache<int> cache(1000);
+  for (int i = 0; i < 3000; i++) {
+    cache.Insert(Key(i), std::make_unique<int>(i));
+  }
+  EXPECT_EQ(cache.GetSize(), 1000);
+  EXPECT_EQ(cache.GetEvictions(), 2000u);
+  // Each shard evicts its oldest entries, so the newest survive.
+  int found = 0;
+  for (int i = 0; i < 3000; i++) {
+    HashKeyedCacheLock<int> lock(&cache, Key(i));
+    if (!lock) continue;
+    EXPECT_EQ(**lock, i);
+    found++;
+  }
+  EXPECT_EQ(found, 1000);
+  EXPECT_TRUE(cache.ContainsKey(Key(2999)));
+  EXPECT_FALSE(cache.ContainsKey(Key(0)));
+}
+
+TEST(HashKeyedCache, PinnedValuesOutliveEviction) {
+  HashKeyedCache<int> cache(100);
+  cache.Insert(Key(0), std::make_unique<int>(42));
+  HashKeyedCacheLock<int> lock(&cache, Key(0));
+  ASSERT_TRUE(lock);
+  cache.Clear();
+  EXPECT_EQ(cache.GetSize(), 0);
+  EXPECT_FALSE(cache.ContainsKey(Key(0)));
+  EXPECT_EQ(**lock, 42);
+}
+
+TEST(HashKeyedCache, SetCapacityKeepsNewestEntries) {
+  HashKeyedCache<int> cache(10000);
+  for (int i = 0; i < 1000; i++) {
+    cache.Insert(Key(i), std::make_unique<int>(i));
+  }
+  HashKeyedCacheLock<int> pinned(&cache, Key(0));
+  cache.SetCapacity(20000);
+  EXPECT_EQ(cache.GetSize(), 1000);
+  for (int i = 0; i < 1000; i++) EXPECT_TRUE(cache.ContainsKey(Key(i)));
+  cache.SetCapacity(100);
+  EXPECT_EQ(cache.GetSize(), 100);
+  EXPECT_TRUE(cache.ContainsKey(Key(999)));
+  EXPECT_EQ(**pinned, 0);
+  cache.SetCapacity(0);
+  cache.Insert(Key(0), std::make_unique<int>(0));
+  EXPECT_EQ(cache.GetSize(), 0);
+}
+
+namespace {
+// Half fills a cache of @policy, looks up the 320 oldest entries and inserts
+// twice as many more as the capacity. Returns how many of the looked up ones
+// are still there.
+int LookedUpSurvivors(CacheEvictionPolicy policy) {
+  HashKeyedCache<int> cache(6400);
+  cache.SetEvictionPolicy(policy);
+  for (int i = 0; i < 3200; i++) {
+    cache.Insert(Key(i), std::make_unique<int>(i));
+  }
+  for (int i = 0; i < 320; i++) HashKeyedCacheLock<int> lock(&cache, Key(i));
+  for (int i = 3200; i < 9600; i++) {
+    cache.Insert(Key(i), std::make_unique<int>(i));
+  }
+  EXPECT_EQ(cache.GetSize(), 6400);
+  int survivors = 0;
+  for (int i = 0; i < 320; i++) survivors += cache.ContainsKey(Key(i));
+  return survivors;
+}
+}  // namespace
+
+TEST(HashKeyedCache, EvictionPolicies) {
+  // Each shard evicts about the oldest third, so entries which were looked up
+  // only survive when they get another chance.
+  EXPECT_LT(LookedUpSurvivors(CacheEvictionPolicy::kFifo), 32);
+  EXPECT_EQ(LookedUpSurvivors(CacheEvictionPolicy::kClock), 320);
+  EXPECT_EQ(LookedUpSurvivors(CacheEvictionPolicy::kFrequency), 320);
+}
+
+TEST(HashKeyedCache, KeptEntriesSurviveEviction) {
+  HashKeyedCache<int> cache(6400);
+  EXPECT_FALSE(cache.Keep(Key(0)));
+  for (int i = 0; i < 320; i++) {
+    cache.Insert(Key(i), std::make_unique<int>(i));
+    EXPECT_TRUE(cache.Keep(Key(i)));
+  }
+  for (int i = 320; i < 16000; i++) {
+    cache.Insert(Key(i), std::make_unique<int>(i));
+  }
+  EXPECT_EQ(cache.GetSize(), 6400);
+  for (int i = 0; i < 320; i++) EXPECT_TRUE(cache.ContainsKey(Key(i)));
+  cache.Clear();
+  EXPECT_EQ(cache.GetSize(), 0);
+}
+
+TEST(HashKeyedCache, CountsHits) {
+  HashKeyedCache<int> cache(100);
+  cache.Insert(Key(0), std::make_unique<int>(0));
+  for (int i = 0; i < 4; i++) HashKeyedCacheLock<int> lock(&cache, Key(i));
+  EXPECT_EQ(cache.GetHits(), 1u);
+  EXPECT_EQ(cache.GetLookups(), 4u);
+}
+
+TEST(HashKeyedCache, LookupAndPinBatch) {
+  HashKeyedCache<int> cache(100);
+  cache.Insert(Key(1), std::make_unique<int>(1));
+  cache.Insert(Key(3), std::make_unique<int>(3));
+  const uint64_t keys[] = {Key(0), Key(1), Key(2), Key(3)};
+  int* values[4];
+  cache.LookupAndPinBatch(keys, 4, values);
+  EXPECT_EQ(values[0], nullptr);
+  EXPECT_EQ(*values[1], 1);
+  EXPECT_EQ(values[2], nullptr);
+  EXPECT_EQ(*values[3], 3);
+  {
+    HashKeyedCacheLock<int> lock(&cache, Key(1), values[1]);
+    cache.Clear();
+    EXPECT_EQ(**lock, 1);
+  }
+  cache.Unpin(Key(3), values[3]);
+}
+
+// Threads insert keys of their own into a cache small enough for every shard
+// to evict, while looking up keys of all threads.
+TEST(HashKeyedCache, ConcurrentLookupsAndEvictions) {
+  constexpr int kCapacity = 6400;
+  constexpr int kThreads = 4;
+  constexpr int kKeysPerThread = 20000;
+  HashKeyedCache<int> cache(kCapacity);
+  std::atomic<int> wrong_values{0};
+  std::vector<std::thread> workers;
+  for (int t = 0; t < kThreads; t++) {
+    workers.emplace_back([&, t]() {
+      uint32_t x = t * 7919 + 1;
+      for (int i = 0; i < kKeysPerThread; i++) {
+        const int own = t * kKeysPerThread + i;
+        cache.Insert(Key(own), std::make_unique<int>(own));
+        x = x * 1664525 + 1013904223;
+        const int other = x % (kThreads * kKeysPerThread);
+        HashKeyedCacheLock<int> lock(&cache, Key(other));
+        if (lock && **lock != other) wrong_values++;
+      }
+    });
+  }
+  for (auto& worker : workers) worker.join();
+  EXPECT_EQ(wrong_values.load(), 0);
+  // Every shard got more keys than its share of the capacity.
+  EXPECT_EQ(cache.GetSize(), kCapacity);
+  EXPECT_EQ(cache.GetEvictions(), kThreads * kKeysPerThread - kCapacity);
+  EXPECT_EQ(cache.GetLookups(), static_cast<uint64_t>(kThreads) *
+                                    kKeysPerThread);
+  // All the entries left are found, with their own values.
+  int found = 0;
+  for (int i = 0; i < kThreads * kKeysPerThread; i++) {
+    HashKeyedCacheLock<int> lock(&cache, Key(i));
+    if (!lock) continue;
+    EXPECT_EQ(**lock, i);
+    found++;
+  }
+  EXPECT_EQ(found, kCapacity);
+}
+
+// Prints lookups per second for a growing number of threads, each of which
+// looks up random keys of a full cache, pinning and unpinning their values.
+// A benchmark rather than a test, run with --gtest_also_run_disabled_tests.
+TEST(HashKeyedCache, DISABLED_LookupThroughput) {
+  constexpr int kEntries = 200000;
+  constexpr int kLookupsPerThread = 1000000;
+  HashKeyedCache<int> cache(kEntries);
+  for (int i = 0; i < kEntries; i++) {
+    cache.Insert(Key(i), std::make_unique<int>(i));
+  }
+  const int max_threads =
+      std::max(2, static_cast<int>(std::thread::hardware_concurrency()));
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    std::atomic<int64_t> hits{0};
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+      workers.emplace_back([&, t]() {
+        int64_t thread_hits = 0;
+        uint32_t x = t * 7919 + 1;
+        for (int i = 0; i < kLookupsPerThread; i++) {
+          x = x * 1664525 + 1013904223;
+          HashKeyedCacheLock<int> lock(&cache, Key(x % (2 * kEntries)));
+          if (lock) thread_hits++;
+        }
+        hits += thread_hits;
+      });
+    }
+    for (auto& worker : workers) worker.join();
+    const double seconds = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+    std::cout << threads << " threads: "
+              << static_cast<int64_t>(threads * kLookupsPerThread / seconds)
+              << " lookups/s" << std::endl;
+    // About half of the keys are in the cache.
+    EXPECT_GT(hits.load(), threads * kLookupsPerThread / 4);
+  }
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,79 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/checkpoint.h"
+
+#include <fstream>
+#include <sstream>
+
+#include "utils/exception.h"
+
+namespace lczero {
+
+CheckpointJournal::CheckpointJournal(const std::string& filename)
+    : filename_(filename) {
+  bool truncated = false;
+  {
+    std::ifstream in(filename, std::ios::binary);
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    const std::string contents = buffer.str();
+    size_t start = 0;
+    for (size_t end; (end = contents.find('\n', start)) != std::string::npos;
+         start = end + 1) {
+      records_.emplace_back(contents, start, end - start);
+    }
+    truncated = start < contents.size();
+  }
+  if (truncated) {
+    // Rewrite the complete records, so the next one starts on its own line.
+    std::FILE* file = std::fopen(filename.c_str(), "wb");
+    if (!file) throw Exception("Unable to write checkpoint " + filename);
+    for (const auto& record : records_) {
+      std::fputs(record.c_str(), file);
+      std::fputc('\n', file);
+    }
+    std::fclose(file);
+  }
+  file_ = std::fopen(filename.c_str(), "ab");
+  if (!file_) throw Exception("Unable to open checkpoint " + filename);
+}
+
+CheckpointJournal::~CheckpointJournal() {
+  Mutex::Lock lock(mutex_);
+  std::fclose(file_);
+}
+
+void CheckpointJournal::Append(const std::string& record) {
+  Mutex::Lock lock(mutex_);
+  if (std::fputs(record.c_str(), file_) < 0 || std::fputc('\n', file_) < 0 ||
+      std::fflush(file_) != 0) {
+    throw Exception("Unable to write checkpoint " + filename_);
+  }
+}
+
+}  // namespace lczero
@@ -0,0 +1,62 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "utils/mutex.h"
+
+namespace lczero {
+
+// Append-only record of finished work, so that jobs killed halfway resume
+// where they left off. Each record is a line, flushed as soon as the work is
+// done, so only the work in progress is lost. A line cut short by a crash is
+// dropped when the journal is opened again.
+class CheckpointJournal {
+ public:
+  // Opens @filename, creating it if there is none. Throws on error.
+  explicit CheckpointJournal(const std::string& filename);
+  ~CheckpointJournal();
+  CheckpointJournal(const CheckpointJournal&) = delete;
+  CheckpointJournal& operator=(const CheckpointJournal&) = delete;
+
+  // Records found in the file when it was opened, oldest first.
+  const std::vector<std::string>& GetRecords() const { return records_; }
+  // Writes @record, which has no newlines, and flushes it.
+  void Append(const std::string& record);
+
+ private:
+  const std::string filename_;
+  std::vector<std::string> records_;
+  Mutex mutex_;
+  std::FILE* file_ GUARDED_BY(mutex_) = nullptr;
+};
+
+}  // namespace lczero
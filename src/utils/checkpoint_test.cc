@@ -0,0 +1,68 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/checkpoint.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+
+#include "utils/files.h"
+
+namespace lczero {
+
+TEST(CheckpointJournal, RecordsSurviveReopening) {
+  const std::string filename = ::testing::TempDir() + "checkpoint_test.txt";
+  std::remove(filename.c_str());
+  {
+    CheckpointJournal journal(filename);
+    EXPECT_TRUE(journal.GetRecords().empty());
+    journal.Append("first");
+    journal.Append("second");
+  }
+  CheckpointJournal journal(filename);
+  EXPECT_EQ(journal.GetRecords(),
+            (std::vector<std::string>{"first", "second"}));
+}
+
+TEST(CheckpointJournal, DropsLineCutShort) {
+  const std::string filename = ::testing::TempDir() + "checkpoint_cut.txt";
+  WriteStringToFile(filename, "done\nhalf");
+  {
+    CheckpointJournal journal(filename);
+    EXPECT_EQ(journal.GetRecords(), std::vector<std::string>{"done"});
+    journal.Append("next");
+  }
+  EXPECT_EQ(ReadFileToString(filename), "done\nnext\n");
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -58,3 +58,14 @@
 #define PACKED_STRUCT ATTRIBUTE__(packed)
 
 #define NO_THREAD_SAFETY_ANALYSIS ATTRIBUTE__(no_thread_safety_analysis)
+
+// Compiles a function for several x86-64 instruction sets, the best one for
+// the cpu being picked when the program loads. Only in portable builds, since
+// others are compiled for the build machine. Needs ifunc, so Linux only.
+#if defined(PORTABLE_BUILD) && defined(__x86_64__) && defined(__linux__) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define SIMD_CLONES \
+  __attribute__((target_clones("default", "avx2", "avx512f")))
+#else
+#define SIMD_CLONES
+#endif
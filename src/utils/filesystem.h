@@ -27,6 +27,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <ctime>
 #include <string>
@@ -48,6 +49,26 @@ uint64_t GetFileSize(const std::string& filename);
 // Returns modification time of a file, 0 if file doesn't exist or can't be read.
 time_t GetFileTime(const std::string& filename);
 
+// Read-only memory mapping of a whole file.
+class MappedFile {
+ public:
+  // Maps @filename. Throws exception if cannot.
+  explicit MappedFile(const std::string& filename);
+  ~MappedFile();
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+  // Platform handles of the file and the mapping, if it needs them.
+  void* file_handle_ = nullptr;
+  void* mapping_handle_ = nullptr;
+};
+
 // Returns the base directory relative to which user specific non-essential data
 // files are stored or an empty string if unspecified.
 std::string GetUserCacheDirectory();
@@ -71,6 +71,43 @@ time_t GetFileTime(const std::string& filename) {
          s.ftLastWriteTime.dwLowDateTime;
 }
 
+MappedFile::MappedFile(const std::string& filename) {
+  HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    throw Exception("Cannot open file: " + filename);
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size)) {
+    CloseHandle(file);
+    throw Exception("Cannot read file: " + filename);
+  }
+  size_ = static_cast<size_t>(size.QuadPart);
+  file_handle_ = file;
+  if (size_ == 0) return;
+  HANDLE mapping =
+      CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!mapping) {
+    CloseHandle(file);
+    throw Exception("Cannot map file: " + filename);
+  }
+  mapping_handle_ = mapping;
+  data_ = static_cast<const char*>(
+      MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+  if (!data_) {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    throw Exception("Cannot map file: " + filename);
+  }
+}
+
+MappedFile::~MappedFile() {
+  if (data_) UnmapViewOfFile(data_);
+  if (mapping_handle_) CloseHandle(mapping_handle_);
+  if (file_handle_) CloseHandle(file_handle_);
+}
+
 std::string GetUserCacheDirectory() {
   return std::string();
 }
@@ -0,0 +1,123 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace lczero {
+
+// Vector with inline storage for up to kCapacity elements, so that creating,
+// filling and copying it never allocates. Only copies the elements in use.
+template <typename T, size_t kCapacity>
+class FixedVector {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "FixedVector elements must be trivially copyable.");
+
+ public:
+  using value_type = T;
+  using size_type = size_t;
+  using reference = T&;
+  using const_reference = const T&;
+  using iterator = T*;
+  using const_iterator = const T*;
+
+  FixedVector() = default;
+  explicit FixedVector(size_t size) { resize(size); }
+  FixedVector(size_t size, const T& value) { resize(size, value); }
+  FixedVector(std::initializer_list<T> init) {
+    for (const auto& x : init) push_back(x);
+  }
+  FixedVector(const FixedVector& other) noexcept { *this = other; }
+  FixedVector& operator=(const FixedVector& other) noexcept {
+    size_ = other.size_;
+    std::memcpy(static_cast<void*>(storage_), other.storage_,
+                size_ * sizeof(T));
+    return *this;
+  }
+
+  static constexpr size_t capacity() { return kCapacity; }
+  static constexpr size_t max_size() { return kCapacity; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  T* data() { return reinterpret_cast<T*>(storage_); }
+  const T* data() const { return reinterpret_cast<const T*>(storage_); }
+  T& operator[](size_t idx) { return data()[idx]; }
+  const T& operator[](size_t idx) const { return data()[idx]; }
+  T& front() { return data()[0]; }
+  const T& front() const { return data()[0]; }
+  T& back() { return data()[size_ - 1]; }
+  const T& back() const { return data()[size_ - 1]; }
+
+  iterator begin() { return data(); }
+  iterator end() { return data() + size_; }
+  const_iterator begin() const { return data(); }
+  const_iterator end() const { return data() + size_; }
+  const_iterator cbegin() const { return begin(); }
+  const_iterator cend() const { return end(); }
+
+  // Storage is inline, so it only checks that @size fits.
+  void reserve([[maybe_unused]] size_t size) const {
+    assert(size <= kCapacity);
+  }
+  void resize(size_t size) { resize(size, T()); }
+  void resize(size_t size, const T& value) {
+    assert(size <= kCapacity);
+    for (size_t i = size_; i < size; i++) new (data() + i) T(value);
+    size_ = size;
+  }
+  void clear() { size_ = 0; }
+
+  void push_back(const T& value) { emplace_back(value); }
+  template <typename... Args>
+  T& emplace_back(Args&&... args) {
+    assert(size_ < kCapacity);
+    return *new (data() + size_++) T(std::forward<Args>(args)...);
+  }
+  void pop_back() { --size_; }
+
+  iterator erase(const_iterator pos) { return erase(pos, pos + 1); }
+  iterator erase(const_iterator first, const_iterator last) {
+    T* dst = begin() + (first - begin());
+    std::memmove(static_cast<void*>(dst), last, (end() - last) * sizeof(T));
+    size_ -= last - first;
+    return dst;
+  }
+
+ private:
+  size_t size_ = 0;
+  alignas(T) unsigned char storage_[kCapacity * sizeof(T)];
+};
+
+}  // namespace lczero
@@ -0,0 +1,80 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/fixedvector.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+
+namespace lczero {
+
+TEST(FixedVector, BehavesLikeVector) {
+  FixedVector<int, 8> v(3, 7);
+  EXPECT_EQ(v.size(), 3u);
+  v.push_back(1);
+  v.emplace_back(2);
+  EXPECT_EQ(v.back(), 2);
+  EXPECT_EQ(v[0], 7);
+  v.resize(6);
+  EXPECT_EQ(v[5], 0);
+  v.pop_back();
+  EXPECT_EQ(v.size(), 5u);
+  EXPECT_EQ(std::count(v.begin(), v.end(), 7), 3);
+}
+
+TEST(FixedVector, EraseKeepsOrder) {
+  FixedVector<int, 8> v{1, 2, 3, 4, 5, 6};
+  v.erase(std::remove_if(v.begin(), v.end(), [](int x) { return x % 2; }),
+          v.end());
+  ASSERT_EQ(v.size(), 3u);
+  EXPECT_EQ(v[0], 2);
+  EXPECT_EQ(v[1], 4);
+  EXPECT_EQ(v[2], 6);
+  v.erase(v.begin());
+  ASSERT_EQ(v.size(), 2u);
+  EXPECT_EQ(v.front(), 4);
+}
+
+TEST(FixedVector, CopiesAreIndependent) {
+  FixedVector<int, 8> v{1, 2};
+  FixedVector<int, 8> copy = v;
+  copy[0] = 3;
+  copy.push_back(4);
+  EXPECT_EQ(v.size(), 2u);
+  EXPECT_EQ(v[0], 1);
+  v = copy;
+  EXPECT_EQ(v.size(), 3u);
+  EXPECT_EQ(v[2], 4);
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -109,4 +109,21 @@ inline float FP16toFP32(uint16_t f16) {
 
 #endif
 
+// Bfloat16 is the upper half of a float, rounded to nearest even.
+inline uint16_t FP32toBF16(float f32) {
+  uint32_t x;
+  memcpy(&x, &f32, sizeof(float));
+  // Keeps NaN a NaN, when its payload is all in the lower half.
+  if ((x & 0x7fffffff) > 0x7f800000) return (x >> 16) | 0x40;
+  x += 0x7fff + ((x >> 16) & 1);
+  return x >> 16;
+}
+
+inline float BF16toFP32(uint16_t bf16) {
+  const uint32_t x = static_cast<uint32_t>(bf16) << 16;
+  float f;
+  memcpy(&f, &x, sizeof(float));
+  return f;
+}
+
 }  // namespace lczero
@@ -0,0 +1,117 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/futex.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#pragma comment(lib, "Synchronization.lib")
+#elif defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <climits>
+#else
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#endif
+
+static_assert(sizeof(std::atomic<int>) == sizeof(int),
+              "Futex words must be plain 32-bit integers.");
+
+namespace lczero {
+
+#ifdef _WIN32
+
+void FutexWait(std::atomic<int>* word, int expected) {
+  WaitOnAddress(word, &expected, sizeof(expected), INFINITE);
+}
+
+void FutexWakeOne(std::atomic<int>* word) { WakeByAddressSingle(word); }
+
+void FutexWakeAll(std::atomic<int>* word) { WakeByAddressAll(word); }
+
+#elif defined(__linux__)
+
+namespace {
+long Futex(std::atomic<int>* word, int op, int val) {
+  return syscall(SYS_futex, reinterpret_cast<int*>(word), op, val, nullptr,
+                 nullptr, 0);
+}
+}  // namespace
+
+void FutexWait(std::atomic<int>* word, int expected) {
+  Futex(word, FUTEX_WAIT_PRIVATE, expected);
+}
+
+void FutexWakeOne(std::atomic<int>* word) {
+  Futex(word, FUTEX_WAKE_PRIVATE, 1);
+}
+
+void FutexWakeAll(std::atomic<int>* word) {
+  Futex(word, FUTEX_WAKE_PRIVATE, INT_MAX);
+}
+
+#else
+
+namespace {
+// Words hash into a fixed number of buckets, so unrelated words may share
+// one. That only causes spurious wakeups, which callers handle anyway.
+struct Bucket {
+  std::mutex mutex;
+  std::condition_variable cv;
+};
+constexpr size_t kBuckets = 64;
+
+Bucket* GetBucket(std::atomic<int>* word) {
+  static Bucket buckets[kBuckets];
+  return &buckets[(reinterpret_cast<uintptr_t>(word) >> 2) % kBuckets];
+}
+}  // namespace
+
+void FutexWait(std::atomic<int>* word, int expected) {
+  Bucket* bucket = GetBucket(word);
+  std::unique_lock<std::mutex> lock(bucket->mutex);
+  if (word->load(std::memory_order_acquire) != expected) return;
+  // Wakers change the word before taking the bucket lock, so they can't slip
+  // in between the check above and the wait.
+  bucket->cv.wait(lock);
+}
+
+void FutexWakeOne(std::atomic<int>* word) { FutexWakeAll(word); }
+
+void FutexWakeAll(std::atomic<int>* word) {
+  Bucket* bucket = GetBucket(word);
+  std::lock_guard<std::mutex> lock(bucket->mutex);
+  bucket->cv.notify_all();
+}
+
+#endif
+
+}  // namespace lczero
@@ -0,0 +1,51 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <atomic>
+
+namespace lczero {
+
+// Thin wrappers over the operating system's address based wait/wake
+// primitives: futex() on Linux, WaitOnAddress() on Windows, and a small table
+// of condition variables elsewhere. They let a thread sleep until a 32-bit
+// atomic changes without polling it.
+
+// Blocks while @word holds @expected, until FutexWakeOne() or FutexWakeAll()
+// is called on @word. The check and the going to sleep are atomic with
+// respect to the wake calls, but the wait may also end spuriously, so callers
+// must check their condition again.
+void FutexWait(std::atomic<int>* word, int expected);
+
+// Wakes at least one of the threads blocked in FutexWait() on @word.
+void FutexWakeOne(std::atomic<int>* word);
+
+// Wakes all of the threads blocked in FutexWait() on @word.
+void FutexWakeAll(std::atomic<int>* word);
+
+}  // namespace lczero
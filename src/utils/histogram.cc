@@ -32,6 +32,10 @@
 #include <cmath>
 #include <iomanip>
 #include <iostream>
+#include <limits>
+#include <sstream>
+
+#include "utils/exception.h"
 
 namespace lczero {
 
@@ -63,21 +67,58 @@ Histogram::Histogram(int min_exp, int max_exp, int minor_scales)
   Clear();
 }
 
+Histogram::Histogram(const Histogram& other)
+    : Histogram(other.min_exp_, other.max_exp_, other.minor_scales_) {
+  Merge(other);
+}
+
 void Histogram::Clear() {
-  std::fill(buckets_.begin(), buckets_.end(), 0);
-  total_ = 0;
-  max_ = 0;
+  for (auto& bucket : buckets_) bucket.store(0, std::memory_order_relaxed);
+  total_.store(0, std::memory_order_relaxed);
+  sum_.store(0.0, std::memory_order_relaxed);
+}
+
+namespace {
+void AtomicAdd(std::atomic<double>* target, double value) {
+  double old = target->load(std::memory_order_relaxed);
+  while (!target->compare_exchange_weak(old, old + value,
+                                        std::memory_order_relaxed)) {
+  }
 }
+}  // namespace
 
 void Histogram::Add(double value) {
-  const int index = GetIndex(std::abs(value));
-  const int count = ++buckets_[index];
-  total_++;
-  if (count > max_) max_ = count;
+  buckets_[GetIndex(std::abs(value))].fetch_add(1, std::memory_order_relaxed);
+  total_.fetch_add(1, std::memory_order_relaxed);
+  AtomicAdd(&sum_, value);
+}
+
+void Histogram::Merge(const Histogram& other) {
+  if (min_exp_ != other.min_exp_ || max_exp_ != other.max_exp_ ||
+      minor_scales_ != other.minor_scales_) {
+    throw Exception("Merging histograms of different scales.");
+  }
+  for (size_t i = 0; i < buckets_.size(); i++) {
+    buckets_[i].fetch_add(other.buckets_[i].load(std::memory_order_relaxed),
+                          std::memory_order_relaxed);
+  }
+  total_.fetch_add(other.total_.load(std::memory_order_relaxed),
+                   std::memory_order_relaxed);
+  AtomicAdd(&sum_, other.GetSum());
+}
+
+double Histogram::GetMean() const {
+  const double total = GetTotal();
+  return total > 0 ? GetSum() / total : 0.0;
 }
 
 void Histogram::Dump() const {
-  const double ymax = 0.02 + max_ / (double)total_;
+  const double total = GetTotal();
+  uint64_t max = 0;
+  for (const auto& bucket : buckets_) {
+    max = std::max(max, bucket.load(std::memory_order_relaxed));
+  }
+  const double ymax = 0.02 + max / total;
   for (int i = 0; i < 100; i++) {
     const double yscale = 1 - i * 0.01;
     if (yscale > ymax) continue;
@@ -90,7 +131,7 @@ void Histogram::Dump() const {
     }
     const double ymin = (99 - i) * 0.01;
     for (size_t j = 0; j < buckets_.size(); j++) {
-      const double val = buckets_[j] / (double)total_;
+      const double val = buckets_[j].load(std::memory_order_relaxed) / total;
       if (val > ymin) {
         Print("#");
       } else {
@@ -122,6 +163,67 @@ void Histogram::Dump() const {
   Print(" \n");
 }
 
+double Histogram::GetQuantile(double q) const {
+  double remaining = q * GetTotal();
+  for (size_t i = 0; i < buckets_.size(); i++) {
+    const uint64_t count = buckets_[i].load(std::memory_order_relaxed);
+    remaining -= count;
+    if (remaining > 0 || count == 0) continue;
+    return GetUpperBound(i);
+  }
+  return std::numeric_limits<double>::infinity();
+}
+
+// See GetIndex() for the bounds of each bucket.
+double Histogram::GetLowerBound(int index) const {
+  if (index < 2) return 0.0;
+  return std::pow(10.0, min_exp_ + (std::min(index, total_scales_ + 2) - 4.5) /
+                                       minor_scales_);
+}
+
+double Histogram::GetUpperBound(int index) const {
+  if (index >= total_scales_ + 2) {
+    return std::numeric_limits<double>::infinity();
+  }
+  return std::pow(10.0,
+                  min_exp_ + (std::max<int>(index, 1) - 3.5) / minor_scales_);
+}
+
+std::vector<Histogram::Bucket> Histogram::GetBuckets() const {
+  std::vector<Bucket> result;
+  for (size_t i = 0; i < buckets_.size(); i++) {
+    const uint64_t count = buckets_[i].load(std::memory_order_relaxed);
+    if (count == 0) continue;
+    result.push_back({GetLowerBound(i), GetUpperBound(i), count});
+  }
+  return result;
+}
+
+std::string Histogram::ToJson() const {
+  auto number = [](double value) {
+    // JSON has no infinity.
+    return std::isfinite(value) ? Format("%.6g", value) : "null";
+  };
+  std::ostringstream out;
+  out << "{\"total\": " << static_cast<uint64_t>(GetTotal())
+      << ", \"sum\": " << number(GetSum());
+  for (const auto& [name, q] :
+       {std::pair{"p50", 0.5}, {"p90", 0.9}, {"p99", 0.99}}) {
+    out << ", \"" << name << "\": "
+        << (GetTotal() > 0 ? number(GetQuantile(q)) : "null");
+  }
+  out << ", \"buckets\": [";
+  bool first = true;
+  for (const auto& bucket : GetBuckets()) {
+    if (!first) out << ", ";
+    first = false;
+    out << "[" << number(bucket.lower) << ", " << number(bucket.upper) << ", "
+        << bucket.count << "]";
+  }
+  out << "]}";
+  return out.str();
+}
+
 int Histogram::GetIndex(double val) const {
   if (val <= 0) return 0;
   const double log10 = std::log10(val);
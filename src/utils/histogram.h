@@ -27,7 +27,9 @@
 
 #pragma once
 
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -52,7 +54,12 @@ namespace lczero {
 //    0.00   +----+----+----+----+---- ... +----+
 //
 //         -inf  -15  -14  -13  -12        5   inf
-
+//
+// Samples are bucketed by their absolute value. All methods may be called
+// concurrently without locking, as the counts are relaxed atomics: a histogram
+// can be shared by the threads of a hot path, or kept per thread and merged
+// for reporting. Readers see each bucket's latest count, not a snapshot taken
+// at one instant.
 class Histogram {
  public:
   // Creates a histogram with default scales.
@@ -62,16 +69,52 @@ class Histogram {
   // with minor_scales spacing.
   Histogram(int min_exp, int max_exp, int minor_scales);
 
+  // Copies the counts of @other.
+  Histogram(const Histogram& other);
+  Histogram& operator=(const Histogram&) = delete;
+
   void Clear();
 
   // Adds a sample.
   void Add(double value);
 
+  // Adds the samples of @other, which must have the same scales. Throws
+  // Exception otherwise.
+  void Merge(const Histogram& other);
+
   // Dumps the histogram to stderr.
   void Dump() const;
 
+  // Number of samples added.
+  double GetTotal() const { return total_.load(std::memory_order_relaxed); }
+
+  // Sum and mean of the samples added.
+  double GetSum() const { return sum_.load(std::memory_order_relaxed); }
+  double GetMean() const;
+
+  // Returns the upper bound of the bucket holding the @q quantile of the
+  // samples (0 <= q <= 1), infinity if it's above the histogram's range.
+  double GetQuantile(double q) const;
+
+  struct Bucket {
+    double lower;
+    double upper;
+    uint64_t count;
+  };
+  // Returns the buckets holding samples, in increasing order. Samples below
+  // the range are in a bucket with lower bound 0, above the range in one with
+  // upper bound infinity.
+  std::vector<Bucket> GetBuckets() const;
+
+  // Returns a JSON object with the total, sum, p50, p90 and p99 quantiles and
+  // the [lower, upper, count] of the buckets holding samples.
+  std::string ToJson() const;
+
  private:
   int GetIndex(double val) const;
+  // Bounds of the bucket at @index of buckets_.
+  double GetLowerBound(int index) const;
+  double GetUpperBound(int index) const;
 
   static constexpr int kDefaultMinExp = -15;
   static constexpr int kDefaultMaxExp = 5;
@@ -82,9 +125,9 @@ class Histogram {
   const int minor_scales_;
   const int major_scales_;
   const int total_scales_;
-  std::vector<double> buckets_;
-  double total_;
-  double max_;
+  std::vector<std::atomic<uint64_t>> buckets_;
+  std::atomic<uint64_t> total_;
+  std::atomic<double> sum_;
 };
 
 }  // namespace lczero
@@ -0,0 +1,117 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/histogram.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#include "utils/exception.h"
+
+namespace lczero {
+
+TEST(Histogram, QuantilesAreBucketUpperBounds) {
+  Histogram histogram(-3, 3, 5);
+  for (int i = 1; i <= 100; i++) histogram.Add(i);
+  EXPECT_EQ(histogram.GetTotal(), 100);
+  EXPECT_DOUBLE_EQ(histogram.GetSum(), 5050);
+  EXPECT_DOUBLE_EQ(histogram.GetMean(), 50.5);
+  // Buckets are a fifth of a decade wide, so the bounds are within 60%.
+  const double p50 = histogram.GetQuantile(0.5);
+  EXPECT_GE(p50, 50);
+  EXPECT_LT(p50, 50 * 1.6);
+  const double p99 = histogram.GetQuantile(0.99);
+  EXPECT_GE(p99, 99);
+  EXPECT_LT(p99, 99 * 1.6);
+}
+
+TEST(Histogram, BucketsCoverTheSamples) {
+  Histogram histogram(0, 2, 5);
+  histogram.Add(0);
+  histogram.Add(4);
+  histogram.Add(4.5);
+  histogram.Add(1e6);
+  const auto buckets = histogram.GetBuckets();
+  ASSERT_EQ(buckets.size(), 3u);
+  EXPECT_EQ(buckets[0].lower, 0);
+  EXPECT_EQ(buckets[0].count, 1u);
+  EXPECT_LE(buckets[1].lower, 4);
+  EXPECT_GT(buckets[1].upper, 4.5);
+  EXPECT_EQ(buckets[1].count, 2u);
+  EXPECT_TRUE(std::isinf(buckets[2].upper));
+  EXPECT_LE(buckets[2].lower, 1e6);
+  for (size_t i = 1; i < buckets.size(); i++) {
+    EXPECT_LE(buckets[i - 1].upper, buckets[i].lower);
+  }
+  EXPECT_TRUE(std::isinf(histogram.GetQuantile(1.0)));
+}
+
+TEST(Histogram, MergesPerThreadHistograms) {
+  Histogram shared(-3, 3, 5);
+  Histogram merged(-3, 3, 5);
+  std::vector<std::thread> threads;
+  std::vector<Histogram> local(4, Histogram(-3, 3, 5));
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&, t]() {
+      for (int i = 0; i < 10000; i++) {
+        shared.Add(0.01 * (i % 100 + 1));
+        local[t].Add(0.01 * (i % 100 + 1));
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  for (const auto& histogram : local) merged.Merge(histogram);
+  EXPECT_EQ(shared.GetTotal(), 40000);
+  EXPECT_EQ(merged.GetTotal(), 40000);
+  EXPECT_NEAR(shared.GetSum(), merged.GetSum(), 1e-6);
+  EXPECT_EQ(shared.GetQuantile(0.9), merged.GetQuantile(0.9));
+  EXPECT_EQ(Histogram(merged).GetTotal(), 40000);
+}
+
+TEST(Histogram, RefusesToMergeDifferentScales) {
+  Histogram histogram(-3, 3, 5);
+  EXPECT_THROW(histogram.Merge(Histogram(-3, 3, 10)), Exception);
+}
+
+TEST(Histogram, WritesJson) {
+  Histogram histogram(0, 2, 5);
+  EXPECT_EQ(histogram.ToJson(),
+            "{\"total\": 0, \"sum\": 0, \"p50\": null, \"p90\": null, "
+            "\"p99\": null, \"buckets\": []}");
+  histogram.Add(1e6);
+  EXPECT_NE(histogram.ToJson().find(", null, 1]]"), std::string::npos);
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,183 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/largepages.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "utils/logging.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace lczero {
+
+std::atomic<bool> LargePages::enabled_{false};
+
+namespace {
+constexpr size_t kLargePageSize = 2 * 1024 * 1024;
+// Smaller allocations would waste most of a large page.
+constexpr size_t kMinLargeAllocation = kLargePageSize / 2;
+
+enum class Backing : uint32_t { kHeap, kHugeTlb, kTransparent, kWindows };
+
+// Kept in front of every allocation, so that Free() knows how to release it.
+struct alignas(alignof(std::max_align_t)) Header {
+  void* mapping;
+  size_t mapping_size;
+  Backing backing;
+};
+
+size_t RoundUp(size_t size, size_t alignment) {
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+// Logs the kind of pages the first large allocation got.
+void LogBacking(Backing backing) {
+  static std::atomic<bool> logged{false};
+  if (logged.exchange(true)) return;
+  switch (backing) {
+    case Backing::kHugeTlb:
+    case Backing::kWindows:
+      LOGFILE << "Large allocations use large pages.";
+      break;
+    case Backing::kTransparent:
+      LOGFILE << "Large pages unavailable, using transparent huge pages.";
+      break;
+    case Backing::kHeap:
+      LOGFILE << "Large pages unavailable.";
+      break;
+  }
+}
+
+// Maps @size bytes of large pages. Returns nullptr if the system can't.
+void* MapLargePages(size_t size, Backing* backing, size_t* mapping_size) {
+#ifdef _WIN32
+  const size_t page = GetLargePageMinimum();
+  if (page == 0) return nullptr;
+  *mapping_size = RoundUp(size, page);
+  void* ptr =
+      VirtualAlloc(nullptr, *mapping_size,
+                   MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+  *backing = Backing::kWindows;
+  return ptr;
+#elif defined(__linux__)
+  *mapping_size = RoundUp(size, kLargePageSize);
+  void* ptr = mmap(nullptr, *mapping_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (ptr != MAP_FAILED) {
+    *backing = Backing::kHugeTlb;
+    return ptr;
+  }
+  // No reserved huge pages, ask for transparent ones. They need the mapping to
+  // be aligned to the huge page size, so map more and trim.
+  const size_t padded = *mapping_size + kLargePageSize;
+  char* padded_ptr = static_cast<char*>(mmap(nullptr, padded,
+                                             PROT_READ | PROT_WRITE,
+                                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  if (padded_ptr == MAP_FAILED) return nullptr;
+  char* aligned = reinterpret_cast<char*>(
+      RoundUp(reinterpret_cast<uintptr_t>(padded_ptr), kLargePageSize));
+  if (aligned > padded_ptr) munmap(padded_ptr, aligned - padded_ptr);
+  const size_t tail = padded_ptr + padded - (aligned + *mapping_size);
+  if (tail > 0) munmap(aligned + *mapping_size, tail);
+  madvise(aligned, *mapping_size, MADV_HUGEPAGE);
+  *backing = Backing::kTransparent;
+  return aligned;
+#else
+  (void)size;
+  (void)backing;
+  (void)mapping_size;
+  return nullptr;
+#endif
+}
+}  // namespace
+
+void LargePages::SetEnabled(bool enabled) {
+#ifdef _WIN32
+  // Large pages need the "Lock pages in memory" privilege to be enabled.
+  static bool privilege_requested = false;
+  if (enabled && !privilege_requested) {
+    privilege_requested = true;
+    HANDLE token;
+    if (OpenProcessToken(GetCurrentProcess(),
+                         TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+      TOKEN_PRIVILEGES privileges;
+      privileges.PrivilegeCount = 1;
+      privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+      if (LookupPrivilegeValueA(nullptr, "SeLockMemoryPrivilege",
+                                &privileges.Privileges[0].Luid)) {
+        AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr);
+      }
+      CloseHandle(token);
+    }
+  }
+#endif
+  enabled_.store(enabled, std::memory_order_relaxed);
+}
+
+void* LargePages::Allocate(size_t size) {
+  Header header{nullptr, 0, Backing::kHeap};
+  char* memory = nullptr;
+  if (IsEnabled() && size >= kMinLargeAllocation) {
+    memory = static_cast<char*>(MapLargePages(
+        size + sizeof(Header), &header.backing, &header.mapping_size));
+    if (!memory) header.backing = Backing::kHeap;
+    LogBacking(header.backing);
+  }
+  if (!memory) memory = static_cast<char*>(::operator new(size + sizeof(Header)));
+  header.mapping = memory;
+  *reinterpret_cast<Header*>(memory) = header;
+  return memory + sizeof(Header);
+}
+
+void LargePages::Free(void* ptr) {
+  if (!ptr) return;
+  const Header header = *(reinterpret_cast<Header*>(ptr) - 1);
+  switch (header.backing) {
+    case Backing::kHeap:
+      ::operator delete(header.mapping);
+      break;
+    case Backing::kHugeTlb:
+    case Backing::kTransparent:
+#ifdef __linux__
+      munmap(header.mapping, header.mapping_size);
+#endif
+      break;
+    case Backing::kWindows:
+#ifdef _WIN32
+      VirtualFree(header.mapping, 0, MEM_RELEASE);
+#endif
+      break;
+  }
+}
+
+}  // namespace lczero
@@ -0,0 +1,83 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+
+namespace lczero {
+
+// Memory for large, randomly accessed structures, backed by 2MB pages (or
+// 1GB where the system is set up with those by default) when enabled and the
+// system allows it. Falls back to transparent huge pages, then to normal
+// pages.
+class LargePages {
+ public:
+  LargePages() = delete;
+
+  // Enables large pages for allocations made from now on.
+  static void SetEnabled(bool enabled);
+  static bool IsEnabled() {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  // Allocates @size bytes, aligned for any type. Throws std::bad_alloc.
+  static void* Allocate(size_t size);
+  // Frees memory from Allocate(), whether it went to large pages or not.
+  static void Free(void* ptr);
+
+ private:
+  static std::atomic<bool> enabled_;
+};
+
+// Standard allocator interface to LargePages, for containers.
+template <class T>
+struct LargePageAllocator {
+  using value_type = T;
+
+  LargePageAllocator() = default;
+  template <class U>
+  LargePageAllocator(const LargePageAllocator<U>&) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(LargePages::Allocate(n * sizeof(T)));
+  }
+  void deallocate(T* ptr, size_t) { LargePages::Free(ptr); }
+
+  template <class U>
+  bool operator==(const LargePageAllocator<U>&) const {
+    return true;
+  }
+  template <class U>
+  bool operator!=(const LargePageAllocator<U>&) const {
+    return false;
+  }
+};
+
+}  // namespace lczero
@@ -27,36 +27,120 @@
 
 #include "utils/logging.h"
 
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <memory>
 #include <iomanip>
 #include <iostream>
 #include <thread>
 
+#include "utils/metrics.h"
+
 namespace lczero {
 
 namespace {
 const size_t kBufferSizeLines = 200;
 const char* const kStderrFilename = "<stderr>";
+// Memory the queued lines may take before new ones are dropped.
+const size_t kMaxQueuedBytes = 64 << 20;
+// How often the writer thread looks for queued lines.
+const auto kWriterInterval = std::chrono::milliseconds(10);
+
+MetricCounter gDroppedLinesMetric("lc0_log_lines_dropped_total",
+                                  "Log lines dropped as the queue was full.");
 }  // namespace
 
 Logging& Logging::Get() {
-  static Logging logging;
-  return logging;
+  // Never destroyed, so that static destructors can still log. Queued lines
+  // are written by an exit handler.
+  static Logging* logging = []() {
+    auto* logging = new Logging();
+    std::atexit([]() { Get().Stop(); });
+    return logging;
+  }();
+  return *logging;
 }
 
-void Logging::WriteLineRaw(const std::string& line) {
-  Mutex::Lock lock_(mutex_);
+Logging::Logging() : writer_([this]() { WriterThread(); }) {}
+
+void Logging::WriteLineRaw(std::string&& line) {
+  if (stopped_.load(std::memory_order_acquire)) {
+    Mutex::Lock lock(mutex_);
+    WriteQueuedLines();
+    WriteLineLocked(line);
+    return;
+  }
+  const size_t bytes = sizeof(QueuedLine) + line.capacity();
+  if (queued_bytes_.fetch_add(bytes, std::memory_order_relaxed) + bytes >
+      kMaxQueuedBytes) {
+    queued_bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    dropped_total_.fetch_add(1, std::memory_order_relaxed);
+    gDroppedLinesMetric.Add();
+    return;
+  }
+  auto* queued = new QueuedLine();
+  queued->text = std::move(line);
+  queue_.Push(queued);
+}
+
+void Logging::WriterThread() {
+  Mutex::Lock lock(mutex_);
+  while (!stop_) {
+    WriteQueuedLines();
+    cv_.wait_for(lock.get_raw(), kWriterInterval);
+  }
+}
+
+void Logging::WriteQueuedLines() {
+  bool written = false;
+  while (QueuedLine* queued = queue_.Pop()) {
+    std::unique_ptr<QueuedLine> line(queued);
+    queued_bytes_.fetch_sub(sizeof(QueuedLine) + line->text.capacity(),
+                            std::memory_order_relaxed);
+    WriteLineLocked(line->text);
+    written = true;
+  }
+  const uint64_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+  if (dropped > 0) {
+    WriteLineLocked(FormatTime(std::chrono::system_clock::now()) + " " +
+                    std::to_string(dropped) +
+                    " log lines dropped, the log queue was full.");
+    written = true;
+  }
+  if (written && !filename_.empty()) {
+    (filename_ == kStderrFilename ? std::cerr : file_).flush();
+  }
+}
+
+void Logging::WriteLineLocked(const std::string& line) {
   if (filename_.empty()) {
     buffer_.push_back(line);
     if (buffer_.size() > kBufferSizeLines) buffer_.pop_front();
   } else {
     auto& file = (filename_ == kStderrFilename) ? std::cerr : file_;
-    file << line << std::endl;
+    file << line << '\n';
   }
 }
 
+void Logging::Stop() {
+  {
+    Mutex::Lock lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  writer_.join();
+  stopped_.store(true, std::memory_order_release);
+  Mutex::Lock lock(mutex_);
+  WriteQueuedLines();
+}
+
 void Logging::SetFilename(const std::string& filename) {
   Mutex::Lock lock_(mutex_);
   if (filename_ == filename) return;
+  // Lines logged before go to the previous destination.
+  WriteQueuedLines();
   filename_ = filename;
   if (filename.empty() || filename == kStderrFilename) {
     file_.close();
@@ -102,25 +186,29 @@ std::chrono::time_point<std::chrono::system_clock> SteadyClockToSystemClock(
 
 std::string FormatTime(
     std::chrono::time_point<std::chrono::system_clock> time) {
-  static Mutex mutex;
-
-  std::ostringstream ss;
   using std::chrono::duration_cast;
   using std::chrono::microseconds;
   const auto us =
       duration_cast<microseconds>(time.time_since_epoch()).count() % 1000000;
-  auto timer = std::chrono::system_clock::to_time_t(time);
-  // std::localtime is not thread safe. Since this is the only place
-  // std::localtime is used in the program, guard by mutex.
-  // TODO: replace with std::localtime_r or s once they are properly
-  // standardised. Or some other more c++ like time component thing, whichever
-  // comes first...
-  {
-    Mutex::Lock lock(mutex);
-    ss << std::put_time(std::localtime(&timer), "%m%d %T") << '.'
-       << std::setfill('0') << std::setw(6) << us;
+  const auto timer = std::chrono::system_clock::to_time_t(time);
+  // Converting to local time is slow, so each thread keeps the date and time
+  // of the last second it formatted.
+  thread_local std::time_t cached_timer = -1;
+  thread_local char cached[32];
+  if (timer != cached_timer) {
+    std::tm tm;
+#ifdef _WIN32
+    localtime_s(&tm, &timer);
+#else
+    localtime_r(&timer, &tm);
+#endif
+    std::strftime(cached, sizeof(cached), "%m%d %H:%M:%S", &tm);
+    cached_timer = timer;
   }
-  return ss.str();
+  char result[48];
+  std::snprintf(result, sizeof(result), "%s.%06d", cached,
+                static_cast<int>(us));
+  return result;
 }
 
 }  // namespace lczero
\ No newline at end of file
@@ -27,16 +27,24 @@
 
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
 #include <deque>
 #include <fstream>
 #include <iomanip>
 #include <sstream>
 #include <string>
+#include <thread>
 
+#include "utils/mpscqueue.h"
 #include "utils/mutex.h"
 
 namespace lczero {
 
+// Log lines are queued without locking and written by a background thread, so
+// that logging threads don't wait for the file. Lines beyond a bound of queued
+// memory are dropped and counted. Queued lines are written at exit.
 class Logging {
  public:
   static Logging& Get();
@@ -44,16 +52,42 @@ class Logging {
   // Sets the name of the log. Empty name disables logging.
   void SetFilename(const std::string& filename);
 
- private:
-  // Writes line to the log, and appends new line character.
-  void WriteLineRaw(const std::string& line);
+  // Number of lines dropped because the queue was full.
+  uint64_t GetDroppedLines() const {
+    return dropped_total_.load(std::memory_order_relaxed);
+  }
 
-  Mutex mutex_;
+ private:
+  struct QueuedLine : MpscQueueNode {
+    std::string text;
+  };
+
+  // Queues line to be written to the log with a new line character appended.
+  void WriteLineRaw(std::string&& line);
+  void WriterThread();
+  // Writes all queued lines. The queue is only consumed holding mutex_.
+  void WriteQueuedLines() REQUIRES(mutex_);
+  void WriteLineLocked(const std::string& line) REQUIRES(mutex_);
+  // Writes the queued lines and stops the writer thread, after which lines are
+  // written as they come. Called at exit.
+  void Stop();
+
+  MpscQueue<QueuedLine> queue_;
+  std::atomic<size_t> queued_bytes_{0};
+  // Lines dropped since the last report in the log, and in total.
+  std::atomic<uint64_t> dropped_{0};
+  std::atomic<uint64_t> dropped_total_{0};
+  std::atomic<bool> stopped_{false};
+
+  Mutex mutex_{"Logging::mutex_"};
+  std::condition_variable cv_;
+  bool stop_ GUARDED_BY(mutex_) = false;
   std::string filename_ GUARDED_BY(mutex_);
   std::ofstream file_ GUARDED_BY(mutex_);
   std::deque<std::string> buffer_ GUARDED_BY(mutex_);
+  std::thread writer_;
 
-  Logging() = default;
+  Logging();
   friend class LogMessage;
 };
 
@@ -0,0 +1,202 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+#include "utils/logging.h"
+
+namespace lczero {
+namespace {
+
+class MetricRegistry {
+ public:
+  // Never destroyed, as metrics of other translation units unregister in
+  // static destructors which may run after this one's.
+  static MetricRegistry* Get() {
+    static MetricRegistry* registry = new MetricRegistry();
+    return registry;
+  }
+
+  void Register(const Metric* metric) {
+    Mutex::Lock lock(mutex_);
+    metrics_.push_back(metric);
+  }
+
+  void Unregister(const Metric* metric) {
+    Mutex::Lock lock(mutex_);
+    metrics_.erase(std::remove(metrics_.begin(), metrics_.end(), metric),
+                   metrics_.end());
+  }
+
+  void Write(std::ostream* out) {
+    Mutex::Lock lock(mutex_);
+    for (const Metric* metric : metrics_) metric->Write(out);
+  }
+
+ private:
+  Mutex mutex_;
+  std::vector<const Metric*> metrics_ GUARDED_BY(mutex_);
+};
+
+void WriteValue(std::ostream* out, double value) {
+  if (std::isnan(value)) {
+    *out << "NaN";
+  } else if (std::isinf(value)) {
+    *out << (value > 0 ? "+Inf" : "-Inf");
+  } else {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.10g", value);
+    *out << buf;
+  }
+}
+
+MetricGauge gResidentMemory("process_resident_memory_bytes",
+                            "Resident memory size of the process in bytes.");
+
+void UpdateProcessMetrics() {
+#ifdef __linux__
+  std::ifstream statm("/proc/self/statm");
+  size_t total_pages = 0;
+  size_t resident_pages = 0;
+  if (statm >> total_pages >> resident_pages) {
+    gResidentMemory.Set(static_cast<double>(resident_pages) *
+                        sysconf(_SC_PAGESIZE));
+  }
+#endif
+}
+
+}  // namespace
+
+Metric::Metric(const char* name, const char* help, const char* type)
+    : name_(name), help_(help), type_(type) {
+  MetricRegistry::Get()->Register(this);
+}
+
+Metric::~Metric() { MetricRegistry::Get()->Unregister(this); }
+
+void Metric::Write(std::ostream* out) const {
+  *out << "# HELP " << name_ << " " << help_ << "\n";
+  *out << "# TYPE " << name_ << " " << type_ << "\n";
+  WriteSamples(out);
+}
+
+void MetricCounter::WriteSamples(std::ostream* out) const {
+  *out << name_ << " " << Get() << "\n";
+}
+
+void MetricGauge::WriteSamples(std::ostream* out) const {
+  *out << name_ << " ";
+  WriteValue(out, Get());
+  *out << "\n";
+}
+
+MetricHistogram::MetricHistogram(const char* name, const char* help,
+                                 int min_exp, int max_exp)
+    : Metric(name, help, "summary"), histogram_(min_exp, max_exp, 5) {}
+
+void MetricHistogram::WriteSamples(std::ostream* out) const {
+  for (const double quantile : {0.5, 0.9, 0.99}) {
+    *out << name_ << "{quantile=\"" << quantile << "\"} ";
+    WriteValue(out, histogram_.GetTotal() > 0
+                        ? histogram_.GetQuantile(quantile)
+                        : std::nan(""));
+    *out << "\n";
+  }
+  *out << name_ << "_sum ";
+  WriteValue(out, histogram_.GetSum());
+  *out << "\n" << name_ << "_count ";
+  WriteValue(out, histogram_.GetTotal());
+  *out << "\n";
+}
+
+void WriteMetrics(std::ostream* out) {
+  UpdateProcessMetrics();
+  MetricRegistry::Get()->Write(out);
+}
+
+MetricsFileWriter::MetricsFileWriter(const std::string& filename,
+                                     std::chrono::milliseconds interval,
+                                     std::function<void()> collect)
+    : filename_(filename),
+      interval_(interval),
+      collect_(std::move(collect)),
+      thread_([this]() { Worker(); }) {}
+
+MetricsFileWriter::~MetricsFileWriter() {
+  {
+    Mutex::Lock lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+  WriteFile();
+}
+
+void MetricsFileWriter::Worker() {
+  while (true) {
+    {
+      Mutex::Lock lock(mutex_);
+      if (cv_.wait_for(lock.get_raw(), interval_,
+                       [this]() { return stop_; })) {
+        return;
+      }
+    }
+    WriteFile();
+  }
+}
+
+void MetricsFileWriter::WriteFile() {
+  if (collect_) collect_();
+  std::ostringstream text;
+  WriteMetrics(&text);
+  // Scrapers never see a partially written file.
+  const std::string tmp_filename = filename_ + ".tmp";
+  {
+    std::ofstream out(tmp_filename);
+    out << text.str();
+    if (!out) {
+      LOGFILE << "Unable to write metrics to " << tmp_filename;
+      return;
+    }
+  }
+  if (std::rename(tmp_filename.c_str(), filename_.c_str()) != 0) {
+    LOGFILE << "Unable to replace metrics file " << filename_;
+  }
+}
+
+}  // namespace lczero
@@ -0,0 +1,149 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <thread>
+
+#include "utils/histogram.h"
+#include "utils/mutex.h"
+
+namespace lczero {
+
+// Metrics of long running engine processes, exported in the Prometheus text
+// format. Metrics are objects with static storage duration defined next to the
+// code they measure, which register themselves on construction:
+//
+//   MetricCounter gTbHits("lc0_tb_hits_total", "Tablebase probes found.");
+//   ...
+//   gTbHits.Add();
+//
+// Updates are relaxed atomic operations on memory shared by all threads, so
+// they are meant for once per batch rather than per node.
+class Metric {
+ public:
+  // @name and @help must be string literals.
+  Metric(const char* name, const char* help, const char* type);
+  virtual ~Metric();
+  Metric(const Metric&) = delete;
+  Metric& operator=(const Metric&) = delete;
+
+  // Writes the HELP, TYPE and sample lines of the metric.
+  void Write(std::ostream* out) const;
+
+ protected:
+  virtual void WriteSamples(std::ostream* out) const = 0;
+  const char* const name_;
+
+ private:
+  const char* const help_;
+  const char* const type_;
+};
+
+// Monotonically increasing total.
+class MetricCounter : public Metric {
+ public:
+  MetricCounter(const char* name, const char* help)
+      : Metric(name, help, "counter") {}
+
+  void Add(uint64_t value = 1) {
+    value_.fetch_add(value, std::memory_order_relaxed);
+  }
+  // For totals which are counted elsewhere, e.g. by the NN cache.
+  void Set(uint64_t value) { value_.store(value, std::memory_order_relaxed); }
+  uint64_t Get() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  void WriteSamples(std::ostream* out) const override;
+  std::atomic<uint64_t> value_{0};
+};
+
+// Current value, which may go up and down.
+class MetricGauge : public Metric {
+ public:
+  MetricGauge(const char* name, const char* help)
+      : Metric(name, help, "gauge") {}
+
+  void Set(double value) { value_.store(value, std::memory_order_relaxed); }
+  double Get() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  void WriteSamples(std::ostream* out) const override;
+  std::atomic<double> value_{0.0};
+};
+
+// Distribution of samples from 10^min_exp to 10^max_exp, exported as a summary
+// with the 0.5, 0.9 and 0.99 quantiles since the start of the process. The
+// quantiles are the upper bounds of the logarithmic Histogram buckets.
+class MetricHistogram : public Metric {
+ public:
+  MetricHistogram(const char* name, const char* help, int min_exp,
+                  int max_exp);
+
+  void Add(double value) { histogram_.Add(value); }
+
+ private:
+  void WriteSamples(std::ostream* out) const override;
+  Histogram histogram_;
+};
+
+// Writes all registered metrics in the Prometheus text exposition format.
+void WriteMetrics(std::ostream* out);
+
+// Writes the metrics to a file every @interval, replacing it atomically, for
+// the textfile collector of the Prometheus node exporter or other scrapers.
+// @collect is called before every write to update the metrics which are
+// sampled rather than counted as they change.
+class MetricsFileWriter {
+ public:
+  MetricsFileWriter(const std::string& filename,
+                    std::chrono::milliseconds interval,
+                    std::function<void()> collect);
+  // Writes the file a last time.
+  ~MetricsFileWriter();
+
+ private:
+  void Worker();
+  void WriteFile();
+
+  const std::string filename_;
+  const std::chrono::milliseconds interval_;
+  const std::function<void()> collect_;
+  Mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_ GUARDED_BY(mutex_) = false;
+  std::thread thread_;
+};
+
+}  // namespace lczero
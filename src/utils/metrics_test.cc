@@ -0,0 +1,100 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/metrics.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+
+namespace lczero {
+
+namespace {
+std::string GetMetrics() {
+  std::ostringstream out;
+  WriteMetrics(&out);
+  return out.str();
+}
+}  // namespace
+
+TEST(Metrics, WritesCountersAndGauges) {
+  MetricCounter counter("test_events_total", "Events.");
+  MetricGauge gauge("test_level", "Level.");
+  counter.Add();
+  counter.Add(41);
+  gauge.Set(0.25);
+  const std::string text = GetMetrics();
+  EXPECT_NE(text.find("# HELP test_events_total Events.\n"
+                      "# TYPE test_events_total counter\n"
+                      "test_events_total 42\n"),
+            std::string::npos);
+  EXPECT_NE(text.find("# TYPE test_level gauge\ntest_level 0.25\n"),
+            std::string::npos);
+}
+
+TEST(Metrics, WritesHistogramsAsSummaries) {
+  MetricHistogram histogram("test_latency_seconds", "Latency.", -3, 1);
+  for (int i = 1; i <= 100; i++) histogram.Add(i * 0.01);
+  const std::string text = GetMetrics();
+  EXPECT_NE(text.find("# TYPE test_latency_seconds summary\n"),
+            std::string::npos);
+  EXPECT_NE(text.find("test_latency_seconds{quantile=\"0.99\"} "),
+            std::string::npos);
+  EXPECT_NE(text.find("test_latency_seconds_sum 50.5\n"
+                      "test_latency_seconds_count 100\n"),
+            std::string::npos);
+}
+
+TEST(Metrics, UnregistersOnDestruction) {
+  { MetricCounter counter("test_gone_total", "Gone."); }
+  EXPECT_EQ(GetMetrics().find("test_gone_total"), std::string::npos);
+}
+
+TEST(Metrics, FileWriterWritesOnDestruction) {
+  const std::string filename = ::testing::TempDir() + "metrics_test.prom";
+  MetricGauge gauge("test_collected", "Collected.");
+  {
+    MetricsFileWriter writer(filename, std::chrono::hours(1),
+                             [&]() { gauge.Set(7); });
+  }
+  std::ifstream in(filename);
+  const std::string text((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+  EXPECT_NE(text.find("test_collected 7\n"), std::string::npos);
+  std::remove(filename.c_str());
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,92 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <type_traits>
+
+namespace lczero {
+
+// Link embedded in items of MpscQueue.
+struct MpscQueueNode {
+  std::atomic<MpscQueueNode*> mpsc_next{nullptr};
+};
+
+// Unbounded intrusive multi-producer single-consumer FIFO queue (Vyukov).
+// Push is wait-free and may be called from any thread. Pop may only be called
+// by one thread at a time. Items must derive from MpscQueueNode and stay
+// alive while queued.
+template <typename T>
+class MpscQueue {
+  static_assert(std::is_base_of_v<MpscQueueNode, T>,
+                "MpscQueue items must derive from MpscQueueNode.");
+
+ public:
+  MpscQueue() : head_(&stub_), tail_(&stub_) {}
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator=(const MpscQueue&) = delete;
+
+  void Push(T* item) { PushNode(item); }
+
+  // Returns nullptr if the queue is empty, or if the next item's producer
+  // hasn't finished linking it yet.
+  T* Pop() {
+    MpscQueueNode* tail = tail_;
+    MpscQueueNode* next = tail->mpsc_next.load(std::memory_order_acquire);
+    if (tail == &stub_) {
+      if (next == nullptr) return nullptr;
+      tail_ = next;
+      tail = next;
+      next = next->mpsc_next.load(std::memory_order_acquire);
+    }
+    if (next != nullptr) {
+      tail_ = next;
+      return static_cast<T*>(tail);
+    }
+    if (tail != head_.load(std::memory_order_acquire)) return nullptr;
+    // Tail is the last item, put the stub behind it so it can be taken.
+    PushNode(&stub_);
+    next = tail->mpsc_next.load(std::memory_order_acquire);
+    if (next == nullptr) return nullptr;
+    tail_ = next;
+    return static_cast<T*>(tail);
+  }
+
+ private:
+  void PushNode(MpscQueueNode* node) {
+    node->mpsc_next.store(nullptr, std::memory_order_relaxed);
+    MpscQueueNode* prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->mpsc_next.store(node, std::memory_order_release);
+  }
+
+  alignas(64) std::atomic<MpscQueueNode*> head_;
+  alignas(64) MpscQueueNode* tail_;
+  MpscQueueNode stub_;
+};
+
+}  // namespace lczero
@@ -0,0 +1,89 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/mpscqueue.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+namespace lczero {
+
+namespace {
+struct Item : MpscQueueNode {
+  int producer = 0;
+  int value = 0;
+};
+}  // namespace
+
+TEST(MpscQueue, Fifo) {
+  MpscQueue<Item> queue;
+  Item items[3];
+  EXPECT_EQ(queue.Pop(), nullptr);
+  for (auto& item : items) queue.Push(&item);
+  EXPECT_EQ(queue.Pop(), &items[0]);
+  queue.Push(&items[0]);
+  EXPECT_EQ(queue.Pop(), &items[1]);
+  EXPECT_EQ(queue.Pop(), &items[2]);
+  EXPECT_EQ(queue.Pop(), &items[0]);
+  EXPECT_EQ(queue.Pop(), nullptr);
+}
+
+TEST(MpscQueue, EveryItemTakenOnceInProducerOrder) {
+  constexpr int kItems = 100000;
+  constexpr int kProducers = 4;
+  MpscQueue<Item> queue;
+  std::vector<std::vector<Item>> items(kProducers);
+  for (auto& producer_items : items) producer_items = std::vector<Item>(kItems);
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; p++) {
+    producers.emplace_back([&, p]() {
+      for (int i = 0; i < kItems; i++) {
+        items[p][i].producer = p;
+        items[p][i].value = i;
+        queue.Push(&items[p][i]);
+      }
+    });
+  }
+  std::vector<int> next(kProducers, 0);
+  for (int taken = 0; taken < kItems * kProducers;) {
+    Item* item = queue.Pop();
+    if (item == nullptr) continue;
+    EXPECT_EQ(item->value, next[item->producer]++);
+    taken++;
+  }
+  for (auto& producer : producers) producer.join();
+  EXPECT_EQ(queue.Pop(), nullptr);
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
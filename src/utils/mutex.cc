@@ -0,0 +1,103 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/mutex.h"
+
+#ifdef LC0_LOCK_PROFILING
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace lczero {
+namespace {
+
+class LockStatsRegistry {
+ public:
+  // Never destroyed, as mutexes may still be locked by static destructors.
+  static LockStatsRegistry* Get() {
+    static LockStatsRegistry* registry = new LockStatsRegistry();
+    return registry;
+  }
+
+  LockStats* GetStats(const char* name) {
+    // Not a Mutex, which would register itself here.
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& stats = stats_[name];
+    if (!stats) stats = std::make_unique<LockStats>();
+    return stats.get();
+  }
+
+  // Writes the statistics to stderr, the longest total wait first.
+  void Dump() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::pair<std::string, const LockStats*>> rows;
+    for (const auto& [name, stats] : stats_) {
+      if (stats->acquisitions.load() > 0) rows.emplace_back(name, stats.get());
+    }
+    std::sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) {
+      return a.second->wait_ns.load() > b.second->wait_ns.load();
+    });
+    std::fprintf(stderr, "%-32s %14s %12s %11s %12s %12s %12s\n", "mutex",
+                 "acquisitions", "contended", "contended%", "wait_ms",
+                 "avg_wait_us", "max_wait_us");
+    for (const auto& [name, stats] : rows) {
+      const uint64_t acquisitions = stats->acquisitions.load();
+      const uint64_t contended = stats->contended.load();
+      const uint64_t wait_ns = stats->wait_ns.load();
+      std::fprintf(stderr,
+                   "%-32s %14llu %12llu %10.2f%% %12.1f %12.2f %12.1f\n",
+                   name.c_str(), static_cast<unsigned long long>(acquisitions),
+                   static_cast<unsigned long long>(contended),
+                   100.0 * contended / acquisitions, wait_ns / 1e6,
+                   contended ? wait_ns / 1e3 / contended : 0.0,
+                   stats->max_wait_ns.load() / 1e3);
+    }
+  }
+
+ private:
+  std::mutex mutex_;
+  std::map<std::string, std::unique_ptr<LockStats>> stats_;
+};
+
+struct LockStatsDumper {
+  LockStatsDumper() { LockStatsRegistry::Get(); }
+  ~LockStatsDumper() { LockStatsRegistry::Get()->Dump(); }
+} lock_stats_dumper;
+
+}  // namespace
+
+LockStats* LockStats::Get(const char* name) {
+  return LockStatsRegistry::Get()->GetStats(name);
+}
+
+}  // namespace lczero
+
+#endif
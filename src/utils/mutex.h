@@ -27,7 +27,10 @@
 
 #pragma once
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <mutex>
 #include <shared_mutex>
 #include <thread>
@@ -38,26 +41,108 @@
 #endif
 
 #include "utils/cppattributes.h"
+#include "utils/futex.h"
+#include "utils/tracing.h"
 
 namespace lczero {
 
+// Lock profiling: when building with -Dlock_profiling=true (which defines
+// LC0_LOCK_PROFILING), the mutex wrappers below count acquisitions, contended
+// acquisitions and time spent waiting, summed over all mutexes of the same
+// name, and write a table of them to stderr at exit. Mutexes constructed
+// without a name are counted under the name of their type.
+#ifdef LC0_LOCK_PROFILING
+struct LockStats {
+  // Returns the statistics of mutexes named @name, a string literal.
+  static LockStats* Get(const char* name);
+
+  std::atomic<uint64_t> acquisitions{0};
+  std::atomic<uint64_t> contended{0};
+  std::atomic<uint64_t> wait_ns{0};
+  std::atomic<uint64_t> max_wait_ns{0};
+};
+#endif
+
+// Base of the mutex wrappers, holding their statistics in lock profiling
+// builds and empty otherwise.
+class ProfiledLockable {
+ protected:
+#ifdef LC0_LOCK_PROFILING
+  explicit ProfiledLockable(const char* name) : stats_(LockStats::Get(name)) {}
+#else
+  explicit ProfiledLockable(const char*) {}
+#endif
+
+  // Takes the lock with @lock(). In lock profiling and tracing builds, tries
+  // @try_lock() first, so that only contended acquisitions are timed.
+  template <typename TryLock, typename Lock>
+  void Acquire([[maybe_unused]] TryLock try_lock, Lock lock) {
+#if defined(LC0_LOCK_PROFILING) || defined(LC0_TRACING)
+    if (try_lock()) {
+#ifdef LC0_LOCK_PROFILING
+      stats_->acquisitions.fetch_add(1, std::memory_order_relaxed);
+#endif
+      return;
+    }
+    LC0_TRACE_SCOPE("mutex wait");
+#ifdef LC0_LOCK_PROFILING
+    const auto start = std::chrono::steady_clock::now();
+    lock();
+    const uint64_t wait_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count();
+    stats_->acquisitions.fetch_add(1, std::memory_order_relaxed);
+    stats_->contended.fetch_add(1, std::memory_order_relaxed);
+    stats_->wait_ns.fetch_add(wait_ns, std::memory_order_relaxed);
+    uint64_t max_wait_ns = stats_->max_wait_ns.load(std::memory_order_relaxed);
+    while (wait_ns > max_wait_ns &&
+           !stats_->max_wait_ns.compare_exchange_weak(
+               max_wait_ns, wait_ns, std::memory_order_relaxed)) {
+    }
+#else
+    lock();
+#endif
+#else
+    lock();
+#endif
+  }
+
+#ifdef LC0_LOCK_PROFILING
+ private:
+  LockStats* const stats_;
+#endif
+};
+
 // Implementation of reader-preferenced shared mutex. Based on fair shared
 // mutex.
-class CAPABILITY("mutex") RpSharedMutex {
+class CAPABILITY("mutex") RpSharedMutex : public ProfiledLockable {
  public:
-  RpSharedMutex() : waiting_readers_(0) {}
+  RpSharedMutex() : RpSharedMutex("RpSharedMutex") {}
+  explicit RpSharedMutex(const char* name)
+      : ProfiledLockable(name), waiting_readers_(0) {}
 
   void lock() ACQUIRE() {
-    while (true) {
-      mutex_.lock();
-      if (waiting_readers_ == 0) return;
-      mutex_.unlock();
-    }
+    Acquire(
+        [this]() {
+          if (!mutex_.try_lock()) return false;
+          if (waiting_readers_ == 0) return true;
+          mutex_.unlock();
+          return false;
+        },
+        [this]() {
+          while (true) {
+            mutex_.lock();
+            if (waiting_readers_ == 0) return;
+            mutex_.unlock();
+          }
+        });
   }
   void unlock() RELEASE() { mutex_.unlock(); }
   void lock_shared() ACQUIRE_SHARED() {
     ++waiting_readers_;
-    mutex_.lock_shared();
+    Acquire([this]() { return mutex_.try_lock_shared(); },
+            [this]() { mutex_.lock_shared(); });
   }
   void unlock_shared() RELEASE_SHARED() {
     --waiting_readers_;
@@ -70,12 +155,19 @@ class CAPABILITY("mutex") RpSharedMutex {
 };
 
 // std::mutex wrapper for clang thread safety annotation.
-class CAPABILITY("mutex") Mutex {
+class CAPABILITY("mutex") Mutex : public ProfiledLockable {
  public:
+  Mutex() : ProfiledLockable("Mutex") {}
+  // @name, a string literal, groups the statistics of lock profiling builds.
+  explicit Mutex(const char* name) : ProfiledLockable(name) {}
+
   // std::unique_lock<std::mutex> wrapper.
   class SCOPED_CAPABILITY Lock {
    public:
-    Lock(Mutex& m) ACQUIRE(m) : lock_(m.get_raw()) {}
+    Lock(Mutex& m) ACQUIRE(m) : lock_(m.get_raw(), std::defer_lock) {
+      m.Acquire([this]() { return lock_.try_lock(); },
+                [this]() { lock_.lock(); });
+    }
     ~Lock() RELEASE() {}
     std::unique_lock<std::mutex>& get_raw() { return lock_; }
 
@@ -83,7 +175,10 @@ class CAPABILITY("mutex") Mutex {
     std::unique_lock<std::mutex> lock_;
   };
 
-  void lock() ACQUIRE() { mutex_.lock(); }
+  void lock() ACQUIRE() {
+    Acquire([this]() { return mutex_.try_lock(); },
+            [this]() { mutex_.lock(); });
+  }
   void unlock() RELEASE() { mutex_.unlock(); }
   std::mutex& get_raw() { return mutex_; }
 
@@ -92,12 +187,19 @@ class CAPABILITY("mutex") Mutex {
 };
 
 // std::shared_mutex wrapper for clang thread safety annotation.
-class CAPABILITY("mutex") SharedMutex {
+class CAPABILITY("mutex") SharedMutex : public ProfiledLockable {
  public:
+  SharedMutex() : ProfiledLockable("SharedMutex") {}
+  // @name, a string literal, groups the statistics of lock profiling builds.
+  explicit SharedMutex(const char* name) : ProfiledLockable(name) {}
+
   // std::unique_lock<std::shared_mutex> wrapper.
   class SCOPED_CAPABILITY Lock {
    public:
-    Lock(SharedMutex& m) ACQUIRE(m) : lock_(m.get_raw()) {}
+    Lock(SharedMutex& m) ACQUIRE(m) : lock_(m.get_raw(), std::defer_lock) {
+      m.Acquire([this]() { return lock_.try_lock(); },
+                [this]() { lock_.lock(); });
+    }
     ~Lock() RELEASE() {}
 
    private:
@@ -107,16 +209,26 @@ class CAPABILITY("mutex") SharedMutex {
   // std::shared_lock<std::shared_mutex> wrapper.
   class SCOPED_CAPABILITY SharedLock {
    public:
-    SharedLock(SharedMutex& m) ACQUIRE_SHARED(m) : lock_(m.get_raw()) {}
+    SharedLock(SharedMutex& m) ACQUIRE_SHARED(m)
+        : lock_(m.get_raw(), std::defer_lock) {
+      m.Acquire([this]() { return lock_.try_lock(); },
+                [this]() { lock_.lock(); });
+    }
     ~SharedLock() RELEASE() {}
 
    private:
     std::shared_lock<std::shared_timed_mutex> lock_;
   };
 
-  void lock() ACQUIRE() { mutex_.lock(); }
+  void lock() ACQUIRE() {
+    Acquire([this]() { return mutex_.try_lock(); },
+            [this]() { mutex_.lock(); });
+  }
   void unlock() RELEASE() { mutex_.unlock(); }
-  void lock_shared() ACQUIRE_SHARED() { mutex_.lock_shared(); }
+  void lock_shared() ACQUIRE_SHARED() {
+    Acquire([this]() { return mutex_.try_lock_shared(); },
+            [this]() { mutex_.lock_shared(); });
+  }
   void unlock_shared() RELEASE_SHARED() { mutex_.unlock_shared(); }
 
   std::shared_timed_mutex& get_raw() { return mutex_; }
@@ -132,9 +244,43 @@ static inline void SpinloopPause() {
 #endif
 }
 
-// A very simple spin lock.
-class CAPABILITY("mutex") SpinMutex {
+// How many times to spin on a contended word before parking the thread in
+// the kernel, learned from the waits themselves: a wait which ends while
+// spinning pulls the budget towards twice the spins it took, a wait which ends
+// up parking halves it. Short waits thus stay cheap spins, while long ones
+// (e.g. with more threads than cores) stop burning CPU time.
+class SpinBudget {
  public:
+  int Get() const { return spins_.load(std::memory_order_relaxed); }
+
+  // Records a wait which took @spins spins, then parked if @parked.
+  void Update(int spins, bool parked) {
+    const int current = Get();
+    const int target = parked ? current / 2 : 2 * spins + kMinSpins;
+    int updated = current + (target - current) / 8;
+    updated = std::max(kMinSpins, std::min(kMaxSpins, updated));
+    // Racing updates may overwrite each other, which is fine for a heuristic.
+    if (updated != current) {
+      spins_.store(updated, std::memory_order_relaxed);
+    }
+  }
+
+ private:
+  static constexpr int kMinSpins = 16;
+  static constexpr int kMaxSpins = 16384;
+  std::atomic<int> spins_{1024};
+};
+
+// A spin lock which parks waiters in the kernel once they have spun for
+// longer than the learned SpinBudget. The word is 0 when unlocked, 1 when
+// locked and 2 when locked with (possibly) parked waiters, in which case
+// unlock() wakes one of them.
+class CAPABILITY("mutex") SpinMutex : public ProfiledLockable {
+ public:
+  SpinMutex() : ProfiledLockable("SpinMutex") {}
+  // @name, a string literal, groups the statistics of lock profiling builds.
+  explicit SpinMutex(const char* name) : ProfiledLockable(name) {}
+
   // std::unique_lock<SpinMutex> wrapper.
   class SCOPED_CAPABILITY Lock {
    public:
@@ -146,25 +292,42 @@ class CAPABILITY("mutex") SpinMutex {
   };
 
   void lock() ACQUIRE() {
-    int spins = 0;
-    while (true) {
+    Acquire(
+        [this]() {
+          int val = 0;
+          return mutex_.compare_exchange_strong(val, 1,
+                                                std::memory_order_acq_rel);
+        },
+        [this]() { Spin(); });
+  }
+  void unlock() RELEASE() {
+    if (mutex_.exchange(0, std::memory_order_release) == 2) {
+      FutexWakeOne(&mutex_);
+    }
+  }
+
+ private:
+  void Spin() {
+    const int budget = budget_.Get();
+    for (int spins = 0; spins < budget; ++spins) {
       int val = 0;
-      if (mutex_.compare_exchange_weak(val, 1, std::memory_order_acq_rel)) {
-        break;
-      }
-      ++spins;
-      // Help avoid complete resource starvation by yielding occasionally if
-      // needed.
-      if (spins % 512 == 0) {
-        std::this_thread::yield();
-      } else {
-        SpinloopPause();
+      if (mutex_.load(std::memory_order_relaxed) == 0 &&
+          mutex_.compare_exchange_weak(val, 1, std::memory_order_acq_rel)) {
+        budget_.Update(spins, false);
+        return;
       }
+      SpinloopPause();
+    }
+    budget_.Update(budget, true);
+    // Taking the lock as 2 rather than 1 is conservative: the next unlock()
+    // may wake a thread needlessly, but never misses one.
+    while (mutex_.exchange(2, std::memory_order_acquire) != 0) {
+      FutexWait(&mutex_, 2);
     }
   }
-  void unlock() RELEASE() { mutex_.store(0, std::memory_order_release); }
 
- private:
+  // Shared by all spin locks, they all guard short critical sections.
+  static inline SpinBudget budget_;
   std::atomic<int> mutex_{0};
 };
 
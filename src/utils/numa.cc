@@ -27,16 +27,206 @@
 
 #include "utils/numa.h"
 
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+
 #include "chess/bitboard.h"
 #include "utils/logging.h"
 
 #ifdef _WIN32
 #include <windows.h>
+#elif defined(__linux__)
+#include <sched.h>
 #endif
 
 namespace lczero {
 
 int Numa::threads_per_core_ = 1;
+std::atomic<bool> Numa::bound_{false};
+
+namespace {
+#if defined(__linux__)
+// Parses a sysfs cpu list like "0-15,32-47".
+std::vector<int> ParseCpuList(const std::string& list) {
+  std::vector<int> cpus;
+  size_t pos = 0;
+  while (pos < list.size()) {
+    size_t end = list.find(',', pos);
+    if (end == std::string::npos) end = list.size();
+    const std::string range = list.substr(pos, end - pos);
+    const size_t dash = range.find('-');
+    try {
+      const int first = std::stoi(range.substr(0, dash));
+      const int last =
+          dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+      for (int cpu = first; cpu <= last; cpu++) cpus.push_back(cpu);
+    } catch (const std::exception&) {
+    }
+    pos = end + 1;
+  }
+  return cpus;
+}
+
+// Returns the first line of sysfs file @path, empty if it doesn't exist.
+std::string ReadLine(const std::string& path) {
+  std::ifstream file(path);
+  std::string line;
+  if (file) std::getline(file, line);
+  return line;
+}
+
+int ReadInt(const std::string& path, int default_value) {
+  try {
+    return std::stoi(ReadLine(path));
+  } catch (const std::exception&) {
+    return default_value;
+  }
+}
+
+struct CpuTopology {
+  int cpu;
+  int package;
+  // Core id within the package, shared by SMT siblings.
+  int core;
+  // Lowest numbered processor sharing the last level cache, -1 if unknown.
+  int llc;
+};
+
+const std::vector<CpuTopology>& GetTopology() {
+  static const std::vector<CpuTopology> topology = []() {
+    std::vector<CpuTopology> result;
+    for (int cpu : ParseCpuList(ReadLine("/sys/devices/system/cpu/online"))) {
+      const std::string dir =
+          "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+      CpuTopology entry{cpu, ReadInt(dir + "/topology/physical_package_id", 0),
+                        ReadInt(dir + "/topology/core_id", cpu), -1};
+      int llc_level = 0;
+      for (int index = 0;; index++) {
+        const std::string cache =
+            dir + "/cache/index" + std::to_string(index);
+        const int level = ReadInt(cache + "/level", -1);
+        if (level < 0) break;
+        if (level <= llc_level) continue;
+        const auto shared = ParseCpuList(ReadLine(cache + "/shared_cpu_list"));
+        if (shared.empty()) continue;
+        llc_level = level;
+        entry.llc = *std::min_element(shared.begin(), shared.end());
+      }
+      result.push_back(entry);
+    }
+    return result;
+  }();
+  return topology;
+}
+
+// Processors close to PCI device @pci_bus_id, empty if unknown.
+std::vector<int> GetDeviceCpus(const std::string& pci_bus_id) {
+  if (pci_bus_id.empty()) return {};
+  std::string id;
+  for (char c : pci_bus_id) id += std::tolower(static_cast<unsigned char>(c));
+  // Sysfs uses 4 digit PCI domains, some drivers report 8.
+  const size_t colon = id.find(':');
+  if (colon != std::string::npos && colon > 4) id = id.substr(colon - 4);
+  return ParseCpuList(
+      ReadLine("/sys/bus/pci/devices/" + id + "/local_cpulist"));
+}
+#endif
+}  // namespace
+
+const std::vector<std::vector<int>>& Numa::GetNodeProcessors() {
+  static const std::vector<std::vector<int>> nodes = []() {
+    std::vector<std::vector<int>> result;
+#if defined(__linux__)
+    for (int node = 0;; node++) {
+      std::ifstream file("/sys/devices/system/node/node" +
+                         std::to_string(node) + "/cpulist");
+      if (!file) break;
+      std::string list;
+      std::getline(file, list);
+      auto cpus = ParseCpuList(list);
+      // Memory only nodes have no processors to bind to.
+      if (!cpus.empty()) result.push_back(std::move(cpus));
+    }
+#endif
+    return result;
+  }();
+  return nodes;
+}
+
+std::vector<std::vector<int>> Numa::GetDomains(Placement placement,
+                                               const std::string& pci_bus_id) {
+#if defined(__linux__)
+  const auto& topology = GetTopology();
+  std::vector<std::vector<int>> domains;
+  if (placement == Placement::kCache) {
+    const bool known = std::none_of(topology.begin(), topology.end(),
+                                    [](const auto& x) { return x.llc < 0; });
+    if (known) {
+      std::map<int, std::vector<int>> by_llc;
+      for (const auto& x : topology) by_llc[x.llc].push_back(x.cpu);
+      for (auto& entry : by_llc) domains.push_back(std::move(entry.second));
+    } else {
+      placement = Placement::kNode;
+    }
+  }
+  if (placement == Placement::kNode) domains = GetNodeProcessors();
+
+  const auto device_cpus = GetDeviceCpus(pci_bus_id);
+  if (!device_cpus.empty()) {
+    const std::set<int> close(device_cpus.begin(), device_cpus.end());
+    std::vector<std::vector<int>> filtered;
+    for (const auto& domain : domains) {
+      std::vector<int> cpus;
+      for (int cpu : domain) {
+        if (close.count(cpu)) cpus.push_back(cpu);
+      }
+      if (!cpus.empty()) filtered.push_back(std::move(cpus));
+    }
+    if (!filtered.empty()) domains = std::move(filtered);
+  }
+
+  if (domains.size() == 1 && domains[0].size() >= topology.size()) return {};
+  return domains;
+#else
+  // Silence warning.
+  (void)placement;
+  (void)pci_bus_id;
+  return {};
+#endif
+}
+
+void Numa::BindThreadToCpus(const std::vector<int>& cpus) {
+#if defined(__linux__)
+  if (cpus.empty() && !bound_.load(std::memory_order_relaxed)) return;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (cpus.empty()) {
+    for (const auto& x : GetTopology()) CPU_SET(x.cpu, &set);
+  } else {
+    for (int cpu : cpus) CPU_SET(cpu, &set);
+    bound_.store(true, std::memory_order_relaxed);
+  }
+  sched_setaffinity(0, sizeof(set), &set);
+#else
+  // Silence warning.
+  (void)cpus;
+#endif
+}
+
+void Numa::BindThreadNearDevice(const std::string& pci_bus_id) {
+#if defined(__linux__)
+  const auto cpus = GetDeviceCpus(pci_bus_id);
+  if (cpus.empty() || cpus.size() >= GetTopology().size()) return;
+  BindThreadToCpus(cpus);
+#else
+  // Silence warning.
+  (void)pci_bus_id;
+#endif
+}
 
 void Numa::Init() {
 #if defined(_WIN64) && _WIN32_WINNT >= 0x0601
@@ -61,6 +251,22 @@ void Numa::Init() {
     CERR << "Group " << group_id << " has " << group_cores
          << " core(s) and " << group_threads << " thread(s).";
   }
+#elif defined(__linux__)
+  const auto& topology = GetTopology();
+  if (topology.empty()) return;
+  std::set<int> packages;
+  std::set<int> llcs;
+  std::set<std::pair<int, int>> cores;
+  for (const auto& x : topology) {
+    packages.insert(x.package);
+    if (x.llc >= 0) llcs.insert(x.llc);
+    cores.emplace(x.package, x.core);
+  }
+  threads_per_core_ = std::max<int>(1, topology.size() / cores.size());
+  CERR << "Detected " << cores.size() << " core(s) and " << topology.size()
+       << " thread(s) in " << packages.size() << " package(s), "
+       << GetNodeProcessors().size() << " NUMA node(s) and " << llcs.size()
+       << " last level cache domain(s).";
 #endif
 }
 
@@ -27,6 +27,10 @@
 
 #pragma once
 
+#include <atomic>
+#include <string>
+#include <vector>
+
 namespace lczero {
 
 class Numa {
@@ -39,8 +43,39 @@ class Numa {
   // Bind thread to processor group.
   static void BindThread(int id);
 
+  // How search threads are spread over the processors.
+  enum class Placement {
+    // Threads are not bound.
+    kNone,
+    // Over the NUMA nodes.
+    kNode,
+    // Over the groups of processors sharing a last level cache, e.g. the CCDs
+    // of chiplet CPUs. Falls back to kNode if cache sharing is unknown.
+    kCache,
+  };
+
+  // Returns the processor sets threads are spread over with @placement. If
+  // the processors close to PCI device @pci_bus_id (e.g. "0000:65:00.0") are
+  // known, only those are kept, unless none would remain. Empty when there is
+  // nothing to restrict, i.e. for kNone, an unknown topology, or when the
+  // only set would hold all processors.
+  static std::vector<std::vector<int>> GetDomains(
+      Placement placement, const std::string& pci_bus_id);
+
+  // Bind thread to the processors @cpus, or allow it to run on all processors
+  // again if @cpus is empty.
+  static void BindThreadToCpus(const std::vector<int>& cpus);
+
+  // Bind thread to the processors close to PCI device @pci_bus_id, if those
+  // are known and are not all processors. Used by backend threads feeding a
+  // GPU.
+  static void BindThreadNearDevice(const std::string& pci_bus_id);
+
  private:
+  static const std::vector<std::vector<int>>& GetNodeProcessors();
+
   static int threads_per_core_;
+  static std::atomic<bool> bound_;
 };
 
 }  // namespace lczero
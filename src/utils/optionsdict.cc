@@ -340,4 +340,12 @@ void OptionsDict::CheckAllOptionsRead(
   }
 }
 
+void OptionsDict::MarkAllOptionsRead() const {
+  TypeDict<bool>::MarkAllUsed();
+  TypeDict<int>::MarkAllUsed();
+  TypeDict<float>::MarkAllUsed();
+  TypeDict<std::string>::MarkAllUsed();
+  for (auto const& dict : subdicts_) dict.second.MarkAllOptionsRead();
+}
+
 }  // namespace lczero
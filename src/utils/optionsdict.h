@@ -59,6 +59,9 @@ class TypeDict {
     mutable bool is_used_ = false;
     T value_;
   };
+  void MarkAllUsed() const {
+    for (auto const& option : dict_) option.second.Get();
+  }
   void EnsureNoUnusedOptions(const std::string& type_name,
                              const std::string& prefix) const {
     for (auto const& option : dict_) {
@@ -192,6 +195,10 @@ class OptionsDict : TypeDict<bool>,
   // to find syntax errors in options added using AddSubdictFromString.
   void CheckAllOptionsRead(const std::string& path_from_parent) const;
 
+  // Marks all options of the dict and its subdicts as read, e.g. the options
+  // of an alternative backend that was not used.
+  void MarkAllOptionsRead() const;
+
   bool HasSubdict(const std::string& name) const;
 
  private:
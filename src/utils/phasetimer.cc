@@ -0,0 +1,65 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/phasetimer.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace lczero {
+
+void PhaseTimer::Mark(const std::string& phase, Clock::time_point time) {
+  Mutex::Lock lock(mutex_);
+  for (const auto& mark : marks_) {
+    if (mark.first == phase) return;
+  }
+  marks_.emplace_back(phase, time);
+}
+
+std::string PhaseTimer::Report() const {
+  Mutex::Lock lock(mutex_);
+  auto marks = marks_;
+  std::stable_sort(marks.begin(), marks.end(),
+                   [](const auto& a, const auto& b) {
+                     return a.second < b.second;
+                   });
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(1);
+  const auto ms = [](Clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+  };
+  Clock::time_point last = start_;
+  for (const auto& [phase, time] : marks) {
+    out << phase << ' ' << ms(time - last) << "ms, ";
+    last = time;
+  }
+  out << "total " << ms(last - start_) << "ms";
+  return out.str();
+}
+
+}  // namespace lczero
@@ -0,0 +1,61 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "utils/mutex.h"
+
+namespace lczero {
+
+// Timestamps of the phases of some work, e.g. a move from receiving go to
+// sending bestmove, to see where its time goes. Each phase is marked when it
+// ends, from any thread.
+class PhaseTimer {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit PhaseTimer(Clock::time_point start) : start_(start) {}
+
+  // Records that @phase ended at @time. Only the first end of a phase counts.
+  void Mark(const std::string& phase, Clock::time_point time = Clock::now());
+  // Duration of each phase in the order they ended, each counted from the end
+  // of the previous one, then the total, e.g. "position 0.3ms, search 98.2ms,
+  // total 98.5ms".
+  std::string Report() const;
+
+ private:
+  const Clock::time_point start_;
+  mutable Mutex mutex_;
+  std::vector<std::pair<std::string, Clock::time_point>> marks_
+      GUARDED_BY(mutex_);
+};
+
+}  // namespace lczero
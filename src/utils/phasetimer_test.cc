@@ -0,0 +1,59 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/phasetimer.h"
+
+#include <gtest/gtest.h>
+
+namespace lczero {
+
+using std::chrono::milliseconds;
+
+TEST(PhaseTimer, ReportsPhasesInOrderOfTheirEnds) {
+  const auto start = PhaseTimer::Clock::now();
+  PhaseTimer timer(start);
+  timer.Mark("search", start + milliseconds(100));
+  timer.Mark("position", start + milliseconds(2));
+  timer.Mark("bestmove", start + milliseconds(105));
+  EXPECT_EQ(timer.Report(),
+            "position 2.0ms, search 98.0ms, bestmove 5.0ms, total 105.0ms");
+}
+
+TEST(PhaseTimer, OnlyFirstEndCounts) {
+  const auto start = PhaseTimer::Clock::now();
+  PhaseTimer timer(start);
+  timer.Mark("search", start + milliseconds(10));
+  timer.Mark("search", start + milliseconds(20));
+  EXPECT_EQ(timer.Report(), "search 10.0ms, total 10.0ms");
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,40 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+// Picks the vector instructions used by hand vectorized loops, and includes
+// their intrinsics. LC0_SIMD_AVX2 or LC0_SIMD_NEON is defined, or neither,
+// then only the scalar loops are compiled. NEON is only used on 64-bit ARM,
+// whose instruction set has e.g. the vector division 32-bit ARM lacks.
+#if defined(__AVX2__)
+#define LC0_SIMD_AVX2
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define LC0_SIMD_NEON
+#include <arm_neon.h>
+#endif
@@ -0,0 +1,162 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/slaballoc.h"
+
+#include <algorithm>
+#include <new>
+
+#include "utils/largepages.h"
+
+namespace lczero {
+
+namespace {
+// Amount of memory moved between a thread and the shared pool at once.
+constexpr size_t kBatchBytes = 64 * 1024;
+// Slabs taken at once when they go to large pages, which are this large.
+constexpr size_t kLargeSlabBytes = 2 * 1024 * 1024;
+std::atomic<int> next_allocator_id{0};
+// Set when the free lists of the thread are gone, e.g. in destructors of
+// static objects which run after those of the main thread's thread_locals.
+thread_local bool thread_caches_destroyed = false;
+}  // namespace
+
+// Free lists of one thread, indexed by allocator id. Given back to their
+// allocators when the thread exits.
+struct SlabAllocator::ThreadCaches {
+  ~ThreadCaches() {
+    for (size_t i = 0; i < lists.size(); i++) {
+      if (lists[i].count > 0) allocators[i]->Release(&lists[i], lists[i].count);
+    }
+    thread_caches_destroyed = true;
+  }
+  std::vector<FreeList> lists;
+  std::vector<SlabAllocator*> allocators;
+};
+
+SlabAllocator::SlabAllocator(size_t block_size)
+    : block_size_(
+          (std::max(block_size, sizeof(FreeBlock)) + alignof(FreeBlock) - 1) /
+          alignof(FreeBlock) * alignof(FreeBlock)),
+      batch_size_(std::max<size_t>(16, kBatchBytes / block_size_)),
+      id_(next_allocator_id.fetch_add(1, std::memory_order_relaxed)) {}
+
+SlabAllocator::FreeList* SlabAllocator::GetThreadFreeList() {
+  if (thread_caches_destroyed) return nullptr;
+  thread_local ThreadCaches caches;
+  if (caches.lists.size() <= static_cast<size_t>(id_)) {
+    caches.lists.resize(id_ + 1);
+    caches.allocators.resize(id_ + 1);
+  }
+  caches.allocators[id_] = this;
+  return &caches.lists[id_];
+}
+
+void* SlabAllocator::Allocate() {
+  FreeList* list = GetThreadFreeList();
+  if (!list) {
+    // Without a free list of its own, the thread takes a batch for one block.
+    FreeList batch;
+    Refill(&batch);
+    FreeBlock* block = batch.head;
+    batch.head = block->next;
+    if (--batch.count > 0) Release(&batch, batch.count);
+    return block;
+  }
+  if (!list->head) Refill(list);
+  FreeBlock* block = list->head;
+  list->head = block->next;
+  --list->count;
+  return block;
+}
+
+void SlabAllocator::Free(void* block) {
+  FreeList* list = GetThreadFreeList();
+  auto* free_block = static_cast<FreeBlock*>(block);
+  if (!list) {
+    free_block->next = nullptr;
+    FreeList single{free_block, 1};
+    Release(&single, 1);
+    return;
+  }
+  free_block->next = list->head;
+  list->head = free_block;
+  // Keep one batch around so that alternating allocations and frees don't
+  // bounce batches to and from the shared pool.
+  if (++list->count >= 2 * batch_size_) Release(list, batch_size_);
+}
+
+void SlabAllocator::Refill(FreeList* list) {
+  {
+    Mutex::Lock lock(mutex_);
+    if (!batches_.empty()) {
+      *list = batches_.back();
+      batches_.pop_back();
+      return;
+    }
+  }
+  const size_t batch_bytes = batch_size_ * block_size_;
+  // With large pages, a whole large page is split into batches and all but
+  // one of them go to the shared pool. Slabs are never returned, so the
+  // allocation doesn't have to be kept track of.
+  const size_t batches =
+      LargePages::IsEnabled() ? std::max<size_t>(1, kLargeSlabBytes / batch_bytes)
+                              : 1;
+  auto* slab = static_cast<char*>(batches > 1
+                                      ? LargePages::Allocate(batches * batch_bytes)
+                                      : ::operator new(batch_bytes));
+  reserved_bytes_.fetch_add(batches * batch_bytes, std::memory_order_relaxed);
+  for (size_t b = 0; b < batches; b++) {
+    FreeList batch;
+    char* batch_start = slab + b * batch_bytes;
+    for (size_t i = batch_size_; i-- > 0;) {
+      auto* block = reinterpret_cast<FreeBlock*>(batch_start + i * block_size_);
+      block->next = batch.head;
+      batch.head = block;
+    }
+    batch.count = batch_size_;
+    if (b == 0) {
+      *list = batch;
+    } else {
+      Mutex::Lock lock(mutex_);
+      batches_.push_back(batch);
+    }
+  }
+}
+
+void SlabAllocator::Release(FreeList* list, size_t count) {
+  FreeList batch{list->head, count};
+  FreeBlock* last = list->head;
+  for (size_t i = 1; i < count; i++) last = last->next;
+  list->head = last->next;
+  list->count -= count;
+  last->next = nullptr;
+  Mutex::Lock lock(mutex_);
+  batches_.push_back(batch);
+}
+
+}  // namespace lczero
@@ -0,0 +1,84 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+#include "utils/mutex.h"
+
+namespace lczero {
+
+// Allocator of fixed size blocks carved from larger slabs, which are kept for
+// reuse rather than returned to the system. Every thread has a free list of
+// its own and exchanges blocks with a shared pool in batches, so the shared
+// lock is rarely taken even when blocks are freed by another thread than the
+// one which allocated them (e.g. by the node garbage collector).
+// Instances must outlive all threads which use them, so they are usually
+// static.
+class SlabAllocator {
+ public:
+  explicit SlabAllocator(size_t block_size);
+  SlabAllocator(const SlabAllocator&) = delete;
+  SlabAllocator& operator=(const SlabAllocator&) = delete;
+
+  void* Allocate();
+  void Free(void* block);
+
+  size_t GetBlockSize() const { return block_size_; }
+  // Bytes of slabs taken from the system so far.
+  size_t GetReservedBytes() const {
+    return reserved_bytes_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+  struct FreeList {
+    FreeBlock* head = nullptr;
+    size_t count = 0;
+  };
+  struct ThreadCaches;
+
+  FreeList* GetThreadFreeList();
+  // Moves a batch of free blocks into the empty @list.
+  void Refill(FreeList* list);
+  // Moves @count blocks of @list to the shared pool.
+  void Release(FreeList* list, size_t count);
+
+  const size_t block_size_;
+  const size_t batch_size_;
+  const int id_;
+  std::atomic<size_t> reserved_bytes_{0};
+  Mutex mutex_{"SlabAllocator::mutex_"};
+  std::vector<FreeList> batches_ GUARDED_BY(mutex_);
+};
+
+}  // namespace lczero
@@ -0,0 +1,109 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/slaballoc.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "utils/largepages.h"
+
+namespace lczero {
+
+TEST(SlabAllocator, ReusesFreedBlocks) {
+  static SlabAllocator allocator(24);
+  EXPECT_EQ(allocator.GetBlockSize(), 24u);
+  void* block = allocator.Allocate();
+  allocator.Free(block);
+  EXPECT_EQ(allocator.Allocate(), block);
+  allocator.Free(block);
+}
+
+TEST(SlabAllocator, BlocksFreedByOtherThreadsComeBack) {
+  static SlabAllocator allocator(64);
+  std::vector<void*> blocks;
+  for (int i = 0; i < 10000; i++) blocks.push_back(allocator.Allocate());
+  EXPECT_EQ(std::set<void*>(blocks.begin(), blocks.end()).size(),
+            blocks.size());
+  const size_t reserved = allocator.GetReservedBytes();
+  std::thread([&]() {
+    for (void* block : blocks) allocator.Free(block);
+  }).join();
+  for (auto& block : blocks) block = allocator.Allocate();
+  EXPECT_EQ(allocator.GetReservedBytes(), reserved);
+  for (void* block : blocks) allocator.Free(block);
+}
+
+// Like static destructors at exit, frees and allocates after the free lists of
+// the thread are destroyed.
+TEST(SlabAllocator, WorksAfterThreadFreeListsAreGone) {
+  static SlabAllocator allocator(32);
+  struct FreeAtThreadExit {
+    ~FreeAtThreadExit() {
+      allocator.Free(block);
+      allocator.Free(allocator.Allocate());
+    }
+    void* block = nullptr;
+  };
+  std::thread([]() {
+    // Constructed before the free lists of the thread, so destroyed after.
+    thread_local FreeAtThreadExit at_exit;
+    at_exit.block = allocator.Allocate();
+  }).join();
+  const size_t reserved = allocator.GetReservedBytes();
+  void* block = allocator.Allocate();
+  allocator.Free(block);
+  EXPECT_EQ(allocator.GetReservedBytes(), reserved);
+}
+
+TEST(SlabAllocator, LargePageSlabs) {
+  static SlabAllocator allocator(64);
+  LargePages::SetEnabled(true);
+  std::vector<void*> blocks;
+  for (int i = 0; i < 10000; i++) {
+    blocks.push_back(allocator.Allocate());
+    std::memset(blocks.back(), i & 0xff, 64);
+  }
+  LargePages::SetEnabled(false);
+  EXPECT_EQ(std::set<void*>(blocks.begin(), blocks.end()).size(),
+            blocks.size());
+  // Whatever pages were available, a whole large page was carved up.
+  EXPECT_GE(allocator.GetReservedBytes(), 2u * 1024 * 1024);
+  for (void* block : blocks) allocator.Free(block);
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -27,9 +27,12 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <random>
 
+#include "utils/futex.h"
 #include "utils/mutex.h"
 
 namespace lczero {
@@ -43,10 +46,7 @@ class SpinHelper {
 
 class ExponentialBackoffSpinHelper : public SpinHelper {
  public:
-  ExponentialBackoffSpinHelper()
-    : backoff_iters_(kMinBackoffIters),
-      spin_to_sleep_iters_(0) {
-  }
+  ExponentialBackoffSpinHelper() : backoff_iters_(kMinBackoffIters) {}
 
   virtual void Backoff() {
     thread_local std::uniform_int_distribution<size_t> distribution;
@@ -58,28 +58,66 @@ class ExponentialBackoffSpinHelper : public SpinHelper {
     }
 
     backoff_iters_ = std::min(2*backoff_iters_, kMaxBackoffIters);
-    spin_to_sleep_iters_ = 0;
   }
 
-  // Spin to sleep
-  virtual void Wait() {
-    if (spin_to_sleep_iters_ < kMaxSpinToSleepIters) {
-      spin_to_sleep_iters_++;
+ private:
+  static constexpr size_t kMinBackoffIters = 0x20;
+  static constexpr size_t kMaxBackoffIters = 0x400;
+
+  size_t backoff_iters_;
+};
+
+// Where threads waiting for an atomic word to change park, shared by all the
+// waiters of that word. The writers of the word call WakeAll() after changing
+// it, which costs a single load unless somebody is actually parked.
+class ParkingSpot {
+ public:
+  // Parks the calling thread while @word holds @value. May return spuriously.
+  void Park(std::atomic<int>* word, int value) {
+    parked_.fetch_add(1, std::memory_order_relaxed);
+    // Pairs with the fence in WakeAll(): either the waker sees this thread
+    // counted, or this thread sees the changed word.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (word->load(std::memory_order_relaxed) == value) FutexWait(word, value);
+    parked_.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  void WakeAll(std::atomic<int>* word) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (parked_.load(std::memory_order_relaxed) > 0) FutexWakeAll(word);
+  }
+
+  SpinBudget* budget() { return &budget_; }
+
+ private:
+  SpinBudget budget_;
+  std::atomic<int> parked_{0};
+};
+
+// Spin-then-park helper for one wait. Call Wait() every time the awaited
+// condition is found false; it spins for the budget learned by @spot, then
+// parks the thread until @word changes from @value.
+class AdaptiveSpinHelper {
+ public:
+  explicit AdaptiveSpinHelper(ParkingSpot* spot)
+      : spot_(spot), budget_(spot->budget()->Get()) {}
+  ~AdaptiveSpinHelper() { spot_->budget()->Update(spins_, parked_); }
+
+  void Wait(std::atomic<int>* word, int value) {
+    if (spins_ < budget_) {
+      ++spins_;
       SpinloopPause();
     } else {
-      spin_to_sleep_iters_ = 0;
-      std::this_thread::sleep_for(kSleepDuration);
+      parked_ = true;
+      spot_->Park(word, value);
     }
   }
 
  private:
-  static constexpr size_t kMaxSpinToSleepIters = 0x10000;
-  static constexpr size_t kMinBackoffIters = 0x20;
-  static constexpr size_t kMaxBackoffIters = 0x400;
-  static constexpr std::chrono::microseconds kSleepDuration{1000};
-
-  size_t backoff_iters_;
-  size_t spin_to_sleep_iters_;
+  ParkingSpot* const spot_;
+  const int budget_;
+  int spins_ = 0;
+  bool parked_ = false;
 };
 
 }  // namespace lczero
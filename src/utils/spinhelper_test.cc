@@ -0,0 +1,84 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/spinhelper.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace lczero {
+
+TEST(SpinBudget, GrowsOnShortWaitsAndShrinksOnParking) {
+  SpinBudget budget;
+  const int initial = budget.Get();
+  for (int i = 0; i < 100; i++) budget.Update(initial * 4, false);
+  EXPECT_GT(budget.Get(), initial);
+  for (int i = 0; i < 100; i++) budget.Update(budget.Get(), true);
+  EXPECT_LT(budget.Get(), initial);
+  EXPECT_GT(budget.Get(), 0);
+}
+
+TEST(ParkingSpot, WakesParkedWaiters) {
+  ParkingSpot spot;
+  std::atomic<int> word{0};
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([&]() {
+      AdaptiveSpinHelper waiter(&spot);
+      while (word.load(std::memory_order_acquire) == 0) waiter.Wait(&word, 0);
+    });
+  }
+  word.store(1, std::memory_order_release);
+  spot.WakeAll(&word);
+  for (auto& thread : threads) thread.join();
+}
+
+TEST(SpinMutex, ExcludesUnderContention) {
+  SpinMutex mutex;
+  int counter = 0;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([&]() {
+      for (int j = 0; j < 100000; j++) {
+        SpinMutex::Lock lock(mutex);
+        ++counter;
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  EXPECT_EQ(counter, 400000);
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
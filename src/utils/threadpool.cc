@@ -0,0 +1,101 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/threadpool.h"
+
+#include <exception>
+
+namespace lczero {
+
+ThreadPool::~ThreadPool() {
+  std::vector<std::thread> threads;
+  {
+    Mutex::Lock lock(mutex_);
+    exiting_ = true;
+    task_added_.notify_all();
+    threads.swap(threads_);
+  }
+  for (auto& thread : threads) thread.join();
+}
+
+std::future<void> ThreadPool::Run(std::function<void()> task) {
+  Task item{std::move(task), {}};
+  auto future = item.done.get_future();
+  Mutex::Lock lock(mutex_);
+  tasks_.push_back(std::move(item));
+  // Every queued task needs a thread of its own, as tasks may wait for each
+  // other.
+  if (tasks_.size() > idle_threads_) {
+    // Counted as idle right away, it picks up a task as soon as it starts.
+    ++idle_threads_;
+    threads_.emplace_back([this]() { Worker(); });
+  } else {
+    task_added_.notify_one();
+  }
+  return future;
+}
+
+size_t ThreadPool::GetThreadCount() {
+  Mutex::Lock lock(mutex_);
+  return threads_.size();
+}
+
+void ThreadPool::Worker() {
+  while (true) {
+    Task task;
+    {
+      Mutex::Lock lock(mutex_);
+      task_added_.wait(lock.get_raw(),
+                       [&]() NO_THREAD_SAFETY_ANALYSIS {
+                         return exiting_ || !tasks_.empty();
+                       });
+      --idle_threads_;
+      if (tasks_.empty()) return;
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    std::exception_ptr exception;
+    try {
+      task.function();
+    } catch (...) {
+      exception = std::current_exception();
+    }
+    // Become idle before the waiter learns about completion, so that it can
+    // immediately reuse this thread.
+    {
+      Mutex::Lock lock(mutex_);
+      ++idle_threads_;
+    }
+    if (exception) {
+      task.done.set_exception(exception);
+    } else {
+      task.done.set_value();
+    }
+  }
+}
+
+}  // namespace lczero
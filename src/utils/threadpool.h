@@ -0,0 +1,78 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "utils/mutex.h"
+
+namespace lczero {
+
+// Pool of threads which outlive the tasks they run, so that a caller starting
+// the same set of long running tasks again and again (e.g. search threads on
+// every "go") doesn't pay for thread creation each time.
+// The pool grows on demand: a task never waits for another task to finish, so
+// tasks may block on each other freely.
+class ThreadPool {
+ public:
+  ThreadPool() = default;
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Waits for all the running tasks to finish and joins threads.
+  ~ThreadPool();
+
+  // Starts a task on an idle thread, spawning a new one if none is idle.
+  // The returned future becomes ready when the task finishes, by which time its
+  // thread already counts as idle.
+  std::future<void> Run(std::function<void()> task);
+
+  // Number of threads owned by the pool, idle or not.
+  size_t GetThreadCount();
+
+ private:
+  struct Task {
+    std::function<void()> function;
+    std::promise<void> done;
+  };
+
+  void Worker();
+
+  Mutex mutex_{"ThreadPool::mutex_"};
+  std::condition_variable task_added_;
+  std::deque<Task> tasks_ GUARDED_BY(mutex_);
+  std::vector<std::thread> threads_ GUARDED_BY(mutex_);
+  size_t idle_threads_ GUARDED_BY(mutex_) = 0;
+  bool exiting_ GUARDED_BY(mutex_) = false;
+};
+
+}  // namespace lczero
@@ -0,0 +1,60 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/threadpool.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+
+namespace lczero {
+
+TEST(ThreadPool, ReusesIdleThreads) {
+  ThreadPool pool;
+  std::atomic<int> runs{0};
+  for (int i = 0; i < 10; i++) {
+    pool.Run([&]() { ++runs; }).get();
+  }
+  EXPECT_EQ(runs.load(), 10);
+  EXPECT_EQ(pool.GetThreadCount(), 1u);
+}
+
+TEST(ThreadPool, TasksCanWaitForEachOther) {
+  ThreadPool pool;
+  std::promise<void> released;
+  auto waiter = pool.Run([&]() { released.get_future().wait(); });
+  pool.Run([&]() { released.set_value(); }).get();
+  waiter.get();
+  EXPECT_EQ(pool.GetThreadCount(), 2u);
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
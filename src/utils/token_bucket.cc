@@ -0,0 +1,74 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/token_bucket.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace lczero {
+
+TokenBucket::TokenBucket(double rate, double burst)
+    : rate_(rate), burst_(burst), tokens_(burst), last_(Clock::now()) {}
+
+TokenBucket::Clock::time_point TokenBucket::Take(double tokens,
+                                                 Clock::time_point now) {
+  Mutex::Lock lock(mutex_);
+  if (now > last_) {
+    const double elapsed = std::chrono::duration<double>(now - last_).count();
+    tokens_ = std::min(burst_, tokens_ + elapsed * rate_);
+    last_ = now;
+  }
+  tokens_ -= tokens;
+  if (tokens_ >= 0) return now;
+  return last_ + std::chrono::duration_cast<Clock::duration>(
+                     std::chrono::duration<double>(-tokens_ / rate_));
+}
+
+void TokenBucket::SetRate(double rate, double burst) {
+  Mutex::Lock lock(mutex_);
+  rate_ = rate;
+  burst_ = burst;
+  tokens_ = std::min(tokens_, burst_);
+}
+
+std::shared_ptr<TokenBucket> GetSharedTokenBucket(const std::string& name,
+                                                  double rate, double burst) {
+  static Mutex mutex{"GetSharedTokenBucket::mutex"};
+  static std::unordered_map<std::string, std::weak_ptr<TokenBucket>> buckets;
+  Mutex::Lock lock(mutex);
+  auto& weak_bucket = buckets[name];
+  if (auto bucket = weak_bucket.lock()) {
+    bucket->SetRate(rate, burst);
+    return bucket;
+  }
+  auto bucket = std::make_shared<TokenBucket>(rate, burst);
+  weak_bucket = bucket;
+  return bucket;
+}
+
+}  // namespace lczero
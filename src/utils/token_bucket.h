@@ -0,0 +1,71 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include "utils/mutex.h"
+
+namespace lczero {
+
+// Limits the rate of some work, e.g. the nodes per second of searches. Tokens
+// are earned at a fixed rate, up to a burst. Callers take the tokens of the
+// work they did and wait until the returned time: going into debt rather than
+// waiting for the tokens up front reserves the next tokens in call order, so
+// callers sharing a bucket get their turns in order and no time is lost
+// between them, however low the rate.
+class TokenBucket {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // The bucket starts full.
+  TokenBucket(double rate, double burst);
+
+  // Takes @tokens, returning when they are earned.
+  Clock::time_point Take(double tokens, Clock::time_point now = Clock::now());
+  // Changes the rate, keeping the tokens earned so far.
+  void SetRate(double rate, double burst);
+
+ private:
+  Mutex mutex_{"TokenBucket::mutex_"};
+  double rate_ GUARDED_BY(mutex_);
+  double burst_ GUARDED_BY(mutex_);
+  // Negative when in debt.
+  double tokens_ GUARDED_BY(mutex_);
+  Clock::time_point last_ GUARDED_BY(mutex_);
+};
+
+// Returns the bucket of the process shared by all callers with the same
+// @name, creating it if there is none yet, or updating its rate otherwise. The
+// bucket is destroyed with its last user.
+std::shared_ptr<TokenBucket> GetSharedTokenBucket(const std::string& name,
+                                                  double rate, double burst);
+
+}  // namespace lczero
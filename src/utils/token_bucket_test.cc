@@ -0,0 +1,84 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/token_bucket.h"
+
+#include <gtest/gtest.h>
+
+namespace lczero {
+
+namespace {
+using Clock = TokenBucket::Clock;
+using std::chrono::milliseconds;
+}  // namespace
+
+TEST(TokenBucket, BurstIsFree) {
+  TokenBucket bucket(100.0, 10.0);
+  const auto now = Clock::now();
+  EXPECT_EQ(bucket.Take(4, now), now);
+  EXPECT_EQ(bucket.Take(6, now), now);
+}
+
+TEST(TokenBucket, DebtIsPaidInOrder) {
+  TokenBucket bucket(100.0, 1.0);
+  const auto now = Clock::now();
+  EXPECT_EQ(bucket.Take(1, now), now);
+  // 10 ms per token.
+  EXPECT_NEAR((bucket.Take(2, now) - now) / milliseconds(1), 20, 1);
+  EXPECT_NEAR((bucket.Take(1, now) - now) / milliseconds(1), 30, 1);
+  // Waited as told, the next token is again 10 ms later.
+  const auto later = now + milliseconds(30);
+  EXPECT_NEAR((bucket.Take(1, later) - later) / milliseconds(1), 10, 1);
+}
+
+TEST(TokenBucket, IdleTimeIsCappedByBurst) {
+  TokenBucket bucket(10.0, 2.0);
+  const auto now = Clock::now();
+  EXPECT_EQ(bucket.Take(2, now), now);
+  const auto later = now + std::chrono::seconds(10);
+  EXPECT_EQ(bucket.Take(2, later), later);
+  EXPECT_NEAR((bucket.Take(1, later) - later) / milliseconds(1), 100, 1);
+}
+
+TEST(TokenBucket, SharedByName) {
+  auto a = GetSharedTokenBucket("test", 10.0, 1.0);
+  auto b = GetSharedTokenBucket("test", 20.0, 1.0);
+  auto c = GetSharedTokenBucket("other", 10.0, 1.0);
+  EXPECT_EQ(a, b);
+  EXPECT_NE(a, c);
+  // The last rate applies.
+  const auto now = Clock::now() + std::chrono::seconds(1);
+  a->Take(1, now);
+  EXPECT_NEAR((b->Take(1, now) - now) / milliseconds(1), 50, 1);
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
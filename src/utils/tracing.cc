@@ -0,0 +1,193 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/tracing.h"
+
+#ifdef LC0_TRACING
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "utils/exception.h"
+
+namespace lczero {
+namespace {
+
+constexpr size_t kTraceBufferSize = 65536;
+
+struct TraceEvent {
+  const char* name;
+  std::chrono::steady_clock::time_point start;
+  std::chrono::steady_clock::time_point end;
+};
+
+struct ThreadTrace {
+  explicit ThreadTrace(int tid) : tid(tid), events(kTraceBufferSize) {}
+  const int tid;
+  // Guarded by TraceRegistry::mutex_.
+  std::string name;
+  std::vector<TraceEvent> events;
+  // Number of events ever recorded, the ring buffer position is this modulo
+  // kTraceBufferSize.
+  std::atomic<uint64_t> count{0};
+};
+
+std::string JsonEscape(const std::string& str) {
+  std::string result;
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      result += '\\';
+      result += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char buf[8];
+      std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+      result += buf;
+    } else {
+      result += c;
+    }
+  }
+  return result;
+}
+
+class TraceRegistry {
+ public:
+  // Never destroyed, so that threads and static destructors running after the
+  // exit handler can still record.
+  static TraceRegistry* Get() {
+    static TraceRegistry* registry = new TraceRegistry();
+    return registry;
+  }
+
+  std::shared_ptr<ThreadTrace> NewThread() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    threads_.push_back(
+        std::make_shared<ThreadTrace>(static_cast<int>(threads_.size()) + 1));
+    return threads_.back();
+  }
+
+  void SetName(ThreadTrace* thread, const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    thread->name = name;
+  }
+
+  void Write(const std::string& filename) {
+    std::ofstream out(filename);
+    if (!out) throw Exception("Unable to open trace file " + filename);
+    std::lock_guard<std::mutex> lock(mutex_);
+    out << "{\"traceEvents\":[\n";
+    bool first = true;
+    auto separator = [&]() -> const char* {
+      if (first) {
+        first = false;
+        return "";
+      }
+      return ",\n";
+    };
+    for (const auto& thread : threads_) {
+      if (!thread->name.empty()) {
+        out << separator() << R"({"name":"thread_name","ph":"M","pid":1,)"
+            << R"("tid":)" << thread->tid << R"(,"args":{"name":")"
+            << JsonEscape(thread->name) << "\"}}";
+      }
+      const uint64_t count = thread->count.load(std::memory_order_acquire);
+      const uint64_t begin =
+          count > kTraceBufferSize ? count - kTraceBufferSize : 0;
+      for (uint64_t i = begin; i < count; i++) {
+        const TraceEvent& event = thread->events[i % kTraceBufferSize];
+        char buf[64];
+        std::snprintf(buf, sizeof(buf), R"("ts":%.3f,"dur":%.3f)",
+                      Micros(event.start - epoch_),
+                      Micros(event.end - event.start));
+        out << separator() << R"({"name":")" << JsonEscape(event.name)
+            << R"(","ph":"X","pid":1,"tid":)" << thread->tid << "," << buf
+            << "}";
+      }
+    }
+    out << "\n]}\n";
+    if (!out) throw Exception("Unable to write trace file " + filename);
+  }
+
+ private:
+  TraceRegistry() : epoch_(std::chrono::steady_clock::now()) {}
+
+  static double Micros(std::chrono::steady_clock::duration d) {
+    return std::chrono::duration<double, std::micro>(d).count();
+  }
+
+  const std::chrono::steady_clock::time_point epoch_;
+  std::mutex mutex_;
+  // Shared with the thread_local pointers, so that events of threads which
+  // have exited are still written.
+  std::vector<std::shared_ptr<ThreadTrace>> threads_;
+};
+
+ThreadTrace* CurrentThread() {
+  thread_local std::shared_ptr<ThreadTrace> thread =
+      TraceRegistry::Get()->NewThread();
+  return thread.get();
+}
+
+// Writes the trace at exit when LC0_TRACE_FILE is set.
+struct TraceFileWriter {
+  TraceFileWriter() { TraceRegistry::Get(); }
+  ~TraceFileWriter() {
+    const char* filename = std::getenv("LC0_TRACE_FILE");
+    if (!filename || !*filename) return;
+    try {
+      WriteTrace(filename);
+    } catch (const std::exception& e) {
+      std::fprintf(stderr, "%s\n", e.what());
+    }
+  }
+} trace_file_writer;
+
+}  // namespace
+
+TraceScope::~TraceScope() {
+  ThreadTrace* thread = CurrentThread();
+  const uint64_t count = thread->count.load(std::memory_order_relaxed);
+  thread->events[count % kTraceBufferSize] = {
+      name_, start_, std::chrono::steady_clock::now()};
+  thread->count.store(count + 1, std::memory_order_release);
+}
+
+void SetTraceThreadName(const std::string& name) {
+  TraceRegistry::Get()->SetName(CurrentThread(), name);
+}
+
+void WriteTrace(const std::string& filename) {
+  TraceRegistry::Get()->Write(filename);
+}
+
+}  // namespace lczero
+
+#endif
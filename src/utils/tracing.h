@@ -0,0 +1,81 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace lczero {
+
+// Timeline of what the engine threads are doing, viewable in chrome://tracing
+// or ui.perfetto.dev. Trace points are only compiled in when building with
+// -Dtracing=true (which defines LC0_TRACING); otherwise the macros below expand
+// to nothing.
+//
+// Each thread records its events into a ring buffer of its own, so recording
+// takes no locks and only the latest 65536 events of every thread are kept.
+// When the LC0_TRACE_FILE environment variable is set, the buffers of all
+// threads are written to that file at process exit.
+#ifdef LC0_TRACING
+
+// Records the time between its construction and destruction as an event.
+// @name must outlive the process, i.e. be a string literal.
+class TraceScope {
+ public:
+  explicit TraceScope(const char* name)
+      : name_(name), start_(std::chrono::steady_clock::now()) {}
+  ~TraceScope();
+
+ private:
+  const char* const name_;
+  const std::chrono::steady_clock::time_point start_;
+};
+
+// Names the calling thread in the trace. Threads of a pool are renamed by each
+// task they run, the last name wins.
+void SetTraceThreadName(const std::string& name);
+
+// Writes events recorded so far by all threads to @filename as Chrome trace
+// event JSON. Events of threads that are still running may be incomplete.
+void WriteTrace(const std::string& filename);
+
+#define LC0_TRACE_CONCAT_INNER(a, b) a##b
+#define LC0_TRACE_CONCAT(a, b) LC0_TRACE_CONCAT_INNER(a, b)
+#define LC0_TRACE_SCOPE(name) \
+  ::lczero::TraceScope LC0_TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define LC0_TRACE_THREAD_NAME(name) ::lczero::SetTraceThreadName(name)
+
+#else
+
+#define LC0_TRACE_SCOPE(name)
+#define LC0_TRACE_THREAD_NAME(name)
+
+#endif
+
+}  // namespace lczero
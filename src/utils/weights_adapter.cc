@@ -27,26 +27,84 @@
 
 #include "src/utils/weights_adapter.h"
 
+#include <cstring>
+
+#include "utils/exception.h"
+#include "utils/fp16_utils.h"
+
 namespace lczero {
-float LayerAdapter::Iterator::ExtractValue(const uint16_t* ptr,
-                                           const LayerAdapter* adapter) {
-  return *ptr / static_cast<float>(0xffff) * adapter->range_ + adapter->min_;
+namespace {
+
+using Encoding = pblczero::Weights::Layer::Encoding;
+
+Encoding GetEncoding(const pblczero::Weights::Layer& layer) {
+  switch (layer.encoding()) {
+    case pblczero::Weights::Layer::FLOAT16:
+    case pblczero::Weights::Layer::BFLOAT16:
+    case pblczero::Weights::Layer::FLOAT32:
+      return layer.encoding();
+    case pblczero::Weights::Layer::UNKNOWN_ENCODING:
+    case pblczero::Weights::Layer::LINEAR16:
+      return pblczero::Weights::Layer::LINEAR16;
+  }
+  throw Exception("Unknown layer encoding " +
+                  pblczero::Weights::Layer::Encoding_Name(layer.encoding()));
 }
 
+size_t GetValueSize(Encoding encoding) {
+  return encoding == pblczero::Weights::Layer::FLOAT32 ? sizeof(float)
+                                                       : sizeof(uint16_t);
+}
+
+}  // namespace
+
 LayerAdapter::LayerAdapter(const pblczero::Weights::Layer& layer)
-    : data_(reinterpret_cast<const uint16_t*>(layer.params().data())),
-      size_(layer.params().size() / sizeof(uint16_t)),
+    : data_(layer.params().data()),
+      encoding_(GetEncoding(layer)),
+      size_(layer.params().size() / GetValueSize(encoding_)),
       min_(layer.min_val()),
       range_(layer.max_val() - min_) {}
 
+float LayerAdapter::ExtractValue(size_t idx) const {
+  const char* ptr = data_ + idx * GetValueSize(encoding_);
+  if (encoding_ == pblczero::Weights::Layer::FLOAT32) {
+    float value;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+  }
+  uint16_t value16;
+  memcpy(&value16, ptr, sizeof(value16));
+  switch (encoding_) {
+    case pblczero::Weights::Layer::FLOAT16:
+      return FP16toFP32(value16);
+    case pblczero::Weights::Layer::BFLOAT16:
+      return BF16toFP32(value16);
+    default:
+      return value16 / static_cast<float>(0xffff) * range_ + min_;
+  }
+}
+
 std::vector<float> LayerAdapter::as_vector() const {
-  return std::vector<float>(begin(), end());
+  std::vector<float> result(size_);
+  if (encoding_ != pblczero::Weights::Layer::LINEAR16) {
+    for (size_t i = 0; i < size_; i++) result[i] = ExtractValue(i);
+    return result;
+  }
+  // Plain loop over the raw values rather than the iterators, so that the
+  // compiler vectorizes it. Same arithmetic as ExtractValue().
+  const uint16_t* data = reinterpret_cast<const uint16_t*>(data_);
+  const float min = min_;
+  const float range = range_;
+  for (size_t i = 0; i < size_; i++) {
+    result[i] = data[i] / static_cast<float>(0xffff) * range + min;
+  }
+  return result;
 }
 float LayerAdapter::Iterator::operator*() const {
-  return ExtractValue(data_, adapter_);
+  return adapter_->ExtractValue(idx_);
 }
 float LayerAdapter::Iterator::operator[](size_t idx) const {
-  return ExtractValue(data_ + idx, adapter_);
+  return adapter_->ExtractValue(idx_ + idx);
 }
 
 }  // namespace lczero
@@ -34,6 +34,8 @@
 
 namespace lczero {
 
+// Decodes the values of a layer, in any of the per-layer encodings. Layers
+// without one are LINEAR16, 16-bit fixed point between min_val and max_val.
 class LayerAdapter {
  public:
   class Iterator {
@@ -50,44 +52,46 @@ class LayerAdapter {
     float operator*() const;
     float operator[](size_t idx) const;
     bool operator==(const LayerAdapter::Iterator& other) const {
-      return data_ == other.data_;
+      return idx_ == other.idx_;
     }
     bool operator!=(const LayerAdapter::Iterator& other) const {
-      return data_ != other.data_;
+      return idx_ != other.idx_;
     }
     Iterator& operator++() {
-      ++data_;
+      ++idx_;
       return *this;
     }
     Iterator& operator--() {
-      --data_;
+      --idx_;
       return *this;
     }
     ptrdiff_t operator-(const Iterator& other) const {
-      return data_ - other.data_;
+      return idx_ - other.idx_;
     }
 
     // TODO(crem) implement other iterator functions when they are needed.
 
    private:
     friend class LayerAdapter;
-    Iterator(const LayerAdapter* adapter, const uint16_t* ptr)
-        : adapter_(adapter), data_(ptr) {}
-    static float ExtractValue(const uint16_t* ptr, const LayerAdapter* adapter);
+    Iterator(const LayerAdapter* adapter, size_t idx)
+        : adapter_(adapter), idx_(idx) {}
 
     const LayerAdapter* adapter_ = nullptr;
-    const uint16_t* data_ = nullptr;
+    size_t idx_ = 0;
   };
 
   LayerAdapter(const pblczero::Weights::Layer& layer);
   std::vector<float> as_vector() const;
   size_t size() const { return size_; }
-  float operator[](size_t idx) const { return begin()[idx]; }
-  Iterator begin() const { return {this, data_}; }
-  Iterator end() const { return {this, data_ + size_}; }
+  float operator[](size_t idx) const { return ExtractValue(idx); }
+  Iterator begin() const { return {this, 0}; }
+  Iterator end() const { return {this, size_}; }
 
  private:
-  const uint16_t* data_ = nullptr;
+  float ExtractValue(size_t idx) const;
+
+  const char* data_ = nullptr;
+  const pblczero::Weights::Layer::Encoding encoding_;
   const size_t size_ = 0;
   const float min_;
   const float range_;
@@ -0,0 +1,94 @@
+/*
+  This file is part of Leela Chess Zero.
+  Copyright (C) 2024 The LCZero Authors
+
+  Leela Chess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Leela Chess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Leela Chess.  If not, see <http://www.gnu.org/licenses/>.
+
+  Additional permission under GNU GPL version 3 section 7
+
+  If you modify this Program, or any covered work, by linking or
+  combining it with NVIDIA Corporation's libraries from the NVIDIA CUDA
+  Toolkit and the NVIDIA CUDA Deep Neural Network library (or a
+  modified version of those libraries), containing parts covered by the
+  terms of the respective license agreement, the licensors of this
+  Program grant you additional permission to convey the resulting work.
+*/
+
+#include "utils/wsdeque.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+namespace lczero {
+
+TEST(WorkStealingDeque, OwnerIsLifoThiefIsFifo) {
+  WorkStealingDeque<int> deque(4);
+  EXPECT_TRUE(deque.Empty());
+  EXPECT_TRUE(deque.Push(1));
+  EXPECT_TRUE(deque.Push(2));
+  EXPECT_TRUE(deque.Push(3));
+  EXPECT_EQ(deque.Steal(), 1);
+  EXPECT_EQ(deque.Pop(), 3);
+  EXPECT_EQ(deque.Pop(), 2);
+  EXPECT_FALSE(deque.Pop());
+  EXPECT_FALSE(deque.Steal());
+  EXPECT_TRUE(deque.Empty());
+}
+
+TEST(WorkStealingDeque, RejectsPushWhenFull) {
+  WorkStealingDeque<int> deque(3);
+  for (int i = 0; i < 4; i++) EXPECT_TRUE(deque.Push(i));
+  EXPECT_FALSE(deque.Push(4));
+  EXPECT_EQ(deque.Steal(), 0);
+  EXPECT_TRUE(deque.Push(4));
+  // Wrapped around the buffer.
+  EXPECT_EQ(deque.Pop(), 4);
+}
+
+TEST(WorkStealingDeque, EveryItemTakenOnce) {
+  constexpr int kItems = 100000;
+  constexpr int kThieves = 3;
+  WorkStealingDeque<int> deque(64);
+  std::vector<std::atomic<int>> taken(kItems);
+  std::atomic<bool> done{false};
+  std::vector<std::thread> thieves;
+  for (int i = 0; i < kThieves; i++) {
+    thieves.emplace_back([&]() {
+      while (!done.load(std::memory_order_acquire) || !deque.Empty()) {
+        if (auto item = deque.Steal()) taken[*item]++;
+      }
+    });
+  }
+  for (int i = 0; i < kItems; i++) {
+    while (!deque.Push(i)) {
+      if (auto item = deque.Pop()) taken[*item]++;
+    }
+    if (i % 3 == 0) {
+      if (auto item = deque.Pop()) taken[*item]++;
+    }
+  }
+  while (auto item = deque.Pop()) taken[*item]++;
+  done.store(true, std::memory_order_release);
+  for (auto& thief : thieves) thief.join();
+  for (int i = 0; i < kItems; i++) EXPECT_EQ(taken[i].load(), 1) << i;
+}
+
+}  // namespace lczero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}